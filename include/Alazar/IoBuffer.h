@@ -37,7 +37,8 @@ typedef struct _IO_BUFFER
 
 IO_BUFFER* 
 CreateIoBuffer (
-	U32 uBufferLength_bytes
+	U32 uBufferLength_bytes,
+	int allocationFlags = 0		// ALLOCATE_* flags of the sample buffer
 	);
 
 BOOL
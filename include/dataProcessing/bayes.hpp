@@ -8,20 +8,33 @@
 class BayesFactors{
     public:
 
-    void init(CombinedSpectrum combinedSpectrum);
-    void updateExclusionLine(CombinedSpectrum combinedSpectrum);
+    void init(const CombinedSpectrum& combinedSpectrum);
+    void updateExclusionLine(const CombinedSpectrum& combinedSpectrum);
+    void updateExclusionLine(const double* powers, const double* weightSum, const double* sigmaCombined, size_t size);
 
+    void reserveScan(double stepSize, int numSteps);
     void step(double stepSize);
+    size_t windowEnd() const { return startIndex + windowSize; } // Exclusion line bin after the current window
 
 
     // private:
+    void reserveGrid(size_t gridSize);
+    void showWindow();
+
     int startIndex=0;
     int cutoffIndex=0;
     double freqRes=0;
+
+    // Scan grid. Every bin the scan will step through is allocated when the first spectrum arrives, and stepping only moves startIndex.
+    // The exclusion line and coefficients hold the bins up to the end of the current window, within the reserved capacity
+    double plannedScanWidth=0; // MHz, set by reserveScan
+    double totalShift=0; // MHz stepped since init, startIndex is recomputed from it so rounding doesn't accumulate
+    size_t windowSize=0; // Bins per combined spectrum
+    FrequencyAxis scanAxis; // Whole grid, exclusionLine.freqAxis is a view of its first bins
     
     double sigmaProc=0.1;
 
-    // coefficients in the quadratic formula for the 90% excluded coupling strength
+    // coefficients in the quadratic formula for the 90% excluded coupling strength, one array per coefficient so the update vectorizes
     std::vector<double> coeffSumA, coeffSumB;
 
     Spectrum exclusionLine;
@@ -23,24 +23,36 @@ public:
     void displayState();
 
     void setFilterParams(double sampleRate, int poleNumber, double cutoffFrequency, double stopbandAttenuation);
+    void loadProcessingState(const DataProcessor& source);
     std::tuple<std::vector<double>, std::vector<double>, std::vector<double>> getFilterResponse();
     void displayFilterResponse();
 
     Spectrum loadSNR(std::string filenameSNR, std::string filenameSNRfreqs);
-    void trimSNRtoMatch(Spectrum spectrum);
+    void loadCalibration(const CalibrationStore& store);
+    void trimSNRtoMatch(const Spectrum& spectrum);
+    void selectBand(size_t firstBin, size_t numBins);
 
-    std::vector<double> removeBadBins(std::vector<double> unfilteredRawSpectrum);
-    std::vector<double> trimDC(std::vector<double> untrimmedSpectrum);
+    std::vector<double> removeBadBins(const std::vector<double>& unfilteredRawSpectrum);
+    std::vector<double> trimDC(const std::vector<double>& untrimmedSpectrum);
+    void maskBadBinsAndDC(std::vector<double>& spectrum);
+    void prepareBinRepair(size_t spectrumSize);
 
-    void addRawSpectrumToRunningAverage(std::vector<double> rawSpectrum);
+    void addRawSpectrumToRunningAverage(const std::vector<double>& rawSpectrum);
+    void addAverageToRunningAverage(const std::vector<double>& averagedSpectrum, int count);
     void updateBaseline();
     void resetBaselining();
+    bool pickUpBaseline();
 
-    std::vector<std::vector<double>> acquiredToRaw(fftw_complex* rawStream, int spectraPerAcquisition, int samplesPerSpectrum, fftw_plan plan);
+    std::vector<std::vector<double>> acquiredToRaw(fftw_complex* rawStream, int spectraPerAcquisition, int samplesPerSpectrum, fftw_plan plan, 
+                                                   fftw_plan batchPlan = NULL, int batchSize = 1);
     std::tuple<Spectrum, Spectrum> rawToProcessed(const Spectrum &rawSpectrum);
+    Spectrum rawToProcessedSpectrum(const Spectrum &rawSpectrum, std::vector<double>* processedBaseline = nullptr);
+    std::vector<Spectrum> rawToProcessedBatch(const std::vector<Spectrum> &rawSpectra);
     Spectrum processedToRescaled(const Spectrum &processedSpectrum);
-    void addRescaledToCombined(const Spectrum &rescaledSpectrum, CombinedSpectrum &combinedSpectrum);
-    CombinedSpectrum rebinCombinedSpectrum(CombinedSpectrum &combinedSpectrum, int rebinningWidthC, int convolutionWidthK);
+    Spectrum processedToRescaledTrimmed(const Spectrum &processedSpectrum, double cutPercentage);
+    void addRescaledToCombined(const Spectrum &rescaledSpectrum, CombinedSpectrumGrid &combinedGrid);
+    static double averagingWeight(const Spectrum& spectrum);
+    CombinedSpectrum rebinCombinedSpectrum(const CombinedSpectrum &combinedSpectrum, int rebinningWidthC, int convolutionWidthK);
 
 
     std::vector<int> badBins, DCbins;
@@ -49,13 +61,21 @@ public:
     int numSpectra=0;
 
     std::vector<double> runningAverage, currentBaseline;
+    BinRepairPlan binRepairPlan; // Compiled bad bin and DC masking, see prepareBinRepair
     Spectrum SNR, trimmedSNR;
+    SNRProfile SNRprofile;
+    const SNRProfile::Window* trimmedSNRWindow = nullptr; // Window trimmedSNR was last copied from
 
     // Dsp::FilterDesign <class DesignClass, int Channels = 0, class StateType = DirectFormII>
     // DesignClass <int MaxOrder>
-    Dsp::FilterDesign <Dsp::ChebyshevII::Design::LowPass<6>, 1> chebyshevFilter;
+    Dsp::FilterDesign <Dsp::ChebyshevII::Design::LowPass<6>, 1> chebyshevFilter; // For the filter response
+    ZeroPhaseFilter baselineFilter;
+    BaselineRefresher* baselineRefresher = nullptr; // Background baselines pickUpBaseline follows, if any. Copied by loadProcessingState
+    uint64_t baselineVersion = 0; // Of the refreshed baseline in currentBaseline, 0 for none
 
     double cutoffFrequency_, sampleRate_;
+
+    void initDCbins();
 };
 
 
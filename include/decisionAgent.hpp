@@ -17,6 +17,7 @@
 class DecisionAgent {
 public:
     Spectrum SNR, trimmedSNR;
+    SNRProfile SNRprofile; // Loaded from SNR on first use
 
     double targetCoupling;
     std::vector<double> inProgressTargets, points;
@@ -25,18 +26,32 @@ public:
     int minShots = 0;
 
 
-    void resizeSNRtoMatch(Spectrum spectrum);
-    void resizeSNRtoMatch(CombinedSpectrum spectrum);
+    void resizeSNRtoMatch(const Spectrum& spectrum); // Also takes a CombinedSpectrum, only its frequency axis is used
     void setTargets();
 
-    int getDecision(std::vector<double> activeExclusionLine, int numShots);
-    double checkScore(std::vector<double> activeExclusionLine);
+    int getDecision(const std::vector<double>& activeExclusionLine, int numShots);
+    int getDecision(double score, int numShots);
+    double checkScore(const std::vector<double>& activeExclusionLine);
+    double checkScore(const double* activeExclusionLine, size_t size);
+    double updateScore(const double* activeExclusionLine, size_t first, size_t count);
+    double scoreExclusionLine(const BayesFactors& bayesFactors, size_t updatedBins, size_t& scoredWindowStart);
+    int forecastSpectraToStop(int numShots);
     void setPoints();
 
     void toggleDecisionMaking(int decisionMaking);
+    int decisionMakingEnabled() const { return decisionMaking; }
+    void reset();
 
 private:
+    void setScoreWeights();
+
     int decisionMaking = 1;
+
+    // Incremental score. scoreWeights[i] = points[i]/inProgressTargets[i]^2, so a bin above its target scores scoreWeights[i]*line[i]^2
+    std::vector<double> scoreWeights;
+    std::vector<double> binScores; // Score of each bin of the active window, as of the last checkScore or updateScore
+    double score = 0;
+    std::vector<std::pair<double, double>> crossings; // Scratch for forecastSpectraToStop
 };
 
 #endif // DECISION_H
\ No newline at end of file
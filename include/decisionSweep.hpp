@@ -0,0 +1,99 @@
+/**
+ * @file decisionSweep.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definitions for DecisionStream, the rebinned spectra a scan decided on, and DecisionSweep, which replays them through many
+ *        DecisionAgent parameter sets in parallel.
+ * @version 0.1
+ * @date 2023-11-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef DECISIONSWEEP_H
+#define DECISIONSWEEP_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Rebinned spectra handed to the decision stage, step by step, as captured by ScanRunner::captureDecisionStream. Each spectrum only
+ * depends on its own acquisition, so a policy that stops a step after n spectra sees exactly the first n spectra of the captured step.
+ * Capture with decision making off so every step runs to its fixed horizon.
+ *
+ */
+struct DecisionStream {
+    struct Step {
+        double centerFreq;      // Receiver center frequency, MHz
+        double spectrumTime;    // Integration time of each spectrum, s
+        std::vector<CombinedSpectrum> spectra;
+    };
+
+    std::mutex mutex;
+    std::deque<Step> steps; // A deque so the step the decision stage is appending to never moves
+
+    /**
+     * @brief Starts a new step and returns the spectra vector the decision stage appends to.
+     */
+    std::vector<CombinedSpectrum>* addStep(double centerFreq, double spectrumTime) {
+        std::lock_guard<std::mutex> lock(mutex);
+        steps.push_back(Step{centerFreq, spectrumTime, {}});
+        return &steps.back().spectra;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        steps.clear();
+    }
+};
+
+/**
+ * @brief DecisionAgent parameters varied by a DecisionSweep.
+ *
+ */
+struct SweepParameters {
+    double threshold;
+    int minShots;
+};
+
+/**
+ * @brief Outcome of running one parameter set over a DecisionStream.
+ *
+ */
+struct SweepResult {
+    SweepParameters parameters;
+
+    double timeToTarget = 0;        // Integration time the policy spent over the whole scan, s
+    double fractionExcluded = 0;    // Fraction of the scanned bins excluded down to the target coupling at the end of the scan
+    int spectraUsed = 0;            // Spectra decided on over the whole scan
+    int decisions = 0;              // Steps a decision stopped, the others ran through all their captured spectra
+    std::vector<int> spectraAtDecision; // Spectra decided on in each step, as SPECTRA_AT_DECISION records them
+
+    double runTime = 0;             // Wall time of the replay, s
+};
+
+/**
+ * @brief Replays a captured DecisionStream through a fresh BayesFactors and a copy of a DecisionAgent for every parameter set, spreading
+ * the parameter sets over a pool of threads. Each replay steps its exclusion line and scores each spectrum exactly as decisionMakingThread
+ * does, and cuts a step short where the decision would have stopped the acquisition.
+ * Function definitions and documentation are in decisionSweep.cpp.
+ *
+ */
+class DecisionSweep {
+public:
+    DecisionSweep(const DecisionStream& stream, const DecisionAgent& agentTemplate, double sigmaProc = 0.1);
+
+    std::vector<SweepResult> run(const std::vector<SweepParameters>& parameterSets, int numThreads = 0);
+    SweepResult runOne(const SweepParameters& parameters) const;
+
+    static std::vector<SweepParameters> grid(const std::vector<double>& thresholds, const std::vector<int>& minShots);
+    static void report(const std::vector<SweepResult>& results);
+    static void save(const std::vector<SweepResult>& results, const std::string& filename);
+
+private:
+    const DecisionStream& stream;
+    DecisionAgent agentTemplate;
+    double sigmaProc;
+    double scanWidth; // MHz stepped from the first captured step to the last
+};
+
+#endif // DECISIONSWEEP_H
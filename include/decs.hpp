@@ -19,7 +19,48 @@
  ******************************************************************************/
 #define _CRTDBG_MAP_ALLOC // leak detection
 
-#define BUFFER_COUNT (8)
+#define BUFFER_COUNT (8) // Default DMA ring depth, see ATS::setAcquisitionParameters
+#define MAX_BUFFER_COUNT (512) // Upper bound on the adaptively sized DMA ring
+#define DMA_MEMORY_FRACTION (0.25) // Largest share of free physical memory the adaptive DMA ring may pin
+#define DMA_LATENCY_FLOOR (0.1) // Shortest host stall in s the adaptive DMA ring must ride out, used before any latency has been measured
+#define DMA_LATENCY_HEADROOM (2.0) // Adaptive DMA ring covers this multiple of the worst measured consumer latency
+#define POOL_BUFFER_COUNT (4*BUFFER_COUNT) // Buffers per BufferPool, caps the number of buffers in flight between two stages
+
+// Page allocation of the DMA buffers and buffer pools, see pageAllocation.cpp
+#define ALLOCATE_DEFAULT     (0)      // Pageable 4K pages
+#define ALLOCATE_LARGE_PAGES (1 << 0) // Large pages if the process holds SeLockMemoryPrivilege, which are never paged out. Else 4K pages
+#define ALLOCATE_LOCKED      (1 << 1) // Lock 4K pages into the working set with VirtualLock
+#define DMA_BUFFER_ALLOCATION (ALLOCATE_LARGE_PAGES | ALLOCATE_LOCKED) // Default of the DMA buffers
+#define POOL_BUFFER_ALLOCATION (ALLOCATE_LARGE_PAGES) // Default of the pools holding the FFT input and output blocks
+#define LARGE_PAGE_MAX_WASTE (0.25) // Largest share of a large page allocation that may be rounding, smaller buffers stay on 4K pages
+#define FFT_BATCH_SIZE (4) // Default number of contiguous spectra transformed by a single batched FFTW plan
+#define FFT_WORKER_COUNT (2) // Default number of FFTThread workers sharing the FFT stage
+#define PROCESSING_WORKER_COUNT (1) // Default number of processingWorker threads. 1 runs the serial processingThread instead
+#define PROCESSING_BATCH_SIZE (FILTER_SIMD_LANES) // Most spectra a processingWorker takes at once, so their baselines share the SIMD lanes of one filter pass
+
+// Set to 1 to parallelize each transform with FFTW's threaded planner (one FFT worker) instead of running FFT_WORKER_COUNT workers
+#define FFTW_THREADED_PLANNER (0)
+
+// Set to 1 to run acquisition conversion, FFT, magnitude and averaging in float (fftwf). Baselining and the Bayes accumulation stay in double
+#define SINGLE_PRECISION_PIPELINE (0)
+
+// FFT stage backends, see fftBackend.hpp. The ENABLE_CUDA_FFT build option sets CUDA_FFT_BACKEND to 1 and builds the cuFFT backend
+#define FFT_BACKEND_FFTW  (0) // FFTThread workers on the host, followed by the magnitude and averaging stages
+#define FFT_BACKEND_CUFFT (1) // One transformAccumulationThread per chain on a CUDA device, which only copies back averaged spectra
+#ifndef CUDA_FFT_BACKEND
+#define CUDA_FFT_BACKEND (0)
+#endif
+
+// Digital downconversion ahead of the FFT, see downConverter.hpp
+#define DOWNCONVERSION_FILTER_ORDER (8) // Order of the ChebyshevII anti-alias low-pass
+#define DOWNCONVERSION_STOPBAND (0.6) // Stopband edge as a fraction of the decimated rate, so nothing aliases into the central 80% the trim keeps
+#define DOWNCONVERSION_ATTENUATION (80) // Stopband attenuation in dB
+
+// Welch segments of the FFT stage, see welchSegmenter.hpp
+#define WELCH_WINDOW_RECTANGULAR     (0) // One unwindowed segment per buffer, the plain periodogram
+#define WELCH_WINDOW_HANN            (1)
+#define WELCH_WINDOW_BLACKMAN_HARRIS (2) // 4-term, for sidelobes below -90 dB
+#define WELCH_OVERLAP (0.5) // Default overlap of consecutive segments. 1/(1 - overlap) segments start in every buffer
 
 #define _USE_MATH_DEFINES
 
@@ -33,15 +74,177 @@
 #define TIMER_SAVE          (6)
 #define NUM_TIMERS          (7)
 
+// Latencies recorded besides the timers, which share their ids
+#define LATENCY_BUFFER_TO_DECISION (7) // From delivery of the newest buffer in a spectrum to the decision made on it (fused averaging only)
+#define NUM_LATENCIES              (8)
+#define LATENCY_SUB_BUCKET_BITS    (4) // A latency histogram splits every power of two into 2^bits buckets, ~6% resolution at any scale
+// Count the heap allocations of every timed item, see allocationTracker.cpp. A diagnostic, as it replaces the global operator new with one that
+// updates a shared atomic on every allocation. The ENABLE_ALLOCATION_TRACKING build option sets it to 1
+#ifndef TRACK_ALLOCATIONS
+#define TRACK_ALLOCATIONS (0)
+#endif
+
 // Per spectrum timing
 #define ACQUIRED_SPECTRA (0)
 #define SPECTRA_AT_DECISION (1)
 #define SPECTRUM_AVERAGE_SIZE (2)
-#define NUM_METRICS (3)
+#define DECISION_STOP_LATENCY (3) // Microseconds from the decision to the acquisition having stopped, -1 if no decision stopped the step
+#define LATE_BUFFERS (4) // Sample buffers the host held for longer than a buffer period before the source could reuse them
+#define ACQUISITION_OVERRUNS (5) // Board overflows, buffer wait timeouts and data pool stalls of the primary digitizer since the last step
+#define STEP_ALLOCATIONS (6) // Heap allocations of the timed stages since the last step finished (TRACK_ALLOCATIONS)
+#define STEP_ALLOCATED_MB (7) // MB those allocations asked for
+#define STEP_PEAK_HEAP_MB (8) // Most MB in use through operator new since the last step finished
+#define NUM_METRICS (9)
+
+// Trace-event export, see traceRecorder.hpp
+#define TRACE_BUFFER_EVENTS (16384) // Spans kept per thread, older spans are overwritten
+#define TRACE_PIPELINE   "pipeline"   // Trace categories
+#define TRACE_SCAN       "scan"
+#define TRACE_INSTRUMENT "instrument"
+
+// Pipeline queues sampled by QueueGauges
+#define QUEUE_DATA          (0) // dataRings, summed over the FFT workers
+#define QUEUE_FFT_DATA      (1)
+#define QUEUE_MAG_DATA      (2)
+#define QUEUE_RAW_DATA      (3)
+#define QUEUE_REBINNED_DATA (4)
+#define NUM_QUEUES          (5)
+#define QUEUE_GAUGE_VALUES  (8) // Values per queue in telemetry and checkpoints, see queueGaugeValues
 
 // Data saving flags
 #define SAVE_PROGRESS (0)
 
+// Backup retention policies for SharedDataBasic::backupDataQueue
+#define BACKUP_OFF    (0) // No backup buffers are kept
+#define BACKUP_COPY   (1) // Keep a memcpy of the last backupDepth buffers
+#define BACKUP_SHARED (2) // Keep a reference-counted share of the last backupDepth pool buffers (falls back to BACKUP_COPY without a pool)
+
+// Wait strategies for the SPSCRing queues between pipeline stages
+#define RING_WAIT_BLOCKING (0) // Spin RING_SPIN_COUNT times, then sleep until the other side wakes us
+#define RING_WAIT_SPIN     (1) // Spin (yielding) until the timeout. Lowest wake-up latency, but keeps a core busy per waiting stage
+#define PIPELINE_RING_WAIT (RING_WAIT_BLOCKING)
+#define RING_SPIN_COUNT (1000)
+#define PIPELINE_RING_CAPACITY (1024) // Default slots per ring, the buffer pools bound the number of blocks in flight well below this
+#define RING_POLL_MS (100) // Longest a stage waits on a ring before re-checking the error flag
+#define REBINNING_WIDTH (10) // Combined spectrum bins per coarse bin handed to the decision stage
+#define CONVOLUTION_WIDTH (1) // Coarse bins summed by the sliding convolution of each rebinned bin
+#define COMBINED_PYRAMID_LEVELS (16) // Pyramid levels of the scan's combined spectrum, so its coarsest bins are 2^16 bins wide
+#define COMBINED_GRID_TOLERANCE (1e-3) // Largest offset, in bins, of a spectrum from the combined spectrum's frequency grid
+#define OUTLIER_RESUM_INTERVAL (4096) // Points between exact recomputations of findOutliers' rolling window sums
+#define SNR_MATCH_ALIGNED (0) // SNRProfile window of consecutive SNR bins
+#define SNR_MATCH_NEAREST (1) // SNRProfile window of the nearest SNR bin to each frequency
+#define BAD_BIN_FILL_OFFSET (50) // Bad bins are filled with the average of the bins this far below and above them
+#define FILTER_SIMD_LANES (4) // Signals ZeroPhaseFilter::applyBatch filters together, one per double of a vector register
+#define BASELINE_REFRESH_INTERVAL (60) // Seconds between background baseline refreshes during a scan, see BaselineRefresher
+#define BASELINE_REFRESH_MIN_SPECTRA (2000) // Fewest new sub-spectra a background baseline refresh averages
+#define SPECTRUM_KERNEL_DISPATCH (1) // Set to 0 to always run the scalar spectrum kernels of spectrumKernels.cpp
+
+// Acquisition backends of ScanRunner
+#define ACQUISITION_ATS       (0) // ATS9462 digitizer and GPIB signal generators
+#define ACQUISITION_SIMULATED (1) // SimulatedDigitizer, and signal generators that accept every command without a connection
+#define ACQUISITION_REPLAY    (2) // ReplayDigitizer playing back a raw stream recording, with the simulated signal generators
+#define SIMULATED_GPIB_ADDRESS (-1) // GPIB address of an instrument with no connection behind it
+#define INSTRUMENT_BATCH_BYTES (1024) // Longest compound command line a CommandBatch sends in one write
+#define INSTRUMENT_ERROR_QUEUE_DEPTH (32) // Most SYST:ERR? entries read when a CommandBatch empties the error queue
+#define INSTRUMENT_BLOCK_CHUNK_BYTES ((size_t)1 << 20) // Bytes per viWrite of a binary block upload
+#define PSG_FREQ_SETTLE_TIME (0.01) // s for a PSG's output to settle after a frequency change, as PSG::setFreqAsync waits it out
+#define PSG_POWER_SETTLE_TIME (0.005) // s after a power change
+#define PSG_OUTPUT_SETTLE_TIME (0.005) // s after switching the output on or off
+#define AWG_DAC_FULL_SCALE (32767) // DAC code of a full scale arbitrary waveform sample
+#define FREE_RUN_TIMEOUT_MS (10000) // Longest a source without a sample clock waits for a free block while delivering as fast as possible
+#define PARALLEL_STARTUP (1) // Run the independent phases of ScanRunner startup concurrently (see startupScheduler.hpp), 0 runs them one by one
+#define SOAK_REPORT_INTERVAL (60.0) // Seconds of wall time per SoakMonitor interval, see soakMonitor.hpp
+
+// Thread roles of ThreadPlacement, see threadPlacement.hpp
+#define THREAD_ROLE_ACQUISITION (0) // Acquisition threads and the streaming session thread, which re-post the DMA buffers
+#define THREAD_ROLE_FFT         (1) // FFTThread workers
+#define THREAD_ROLE_COMPUTE     (2) // Magnitude, averaging, accumulation, processing, merge and decision stages
+#define NUM_THREAD_ROLES        (3)
+#define MMCSS_ACQUISITION_TASK "Pro Audio" // MMCSS task of the acquisition threads in ThreadPlacement::isolated
+
+// Raw stream recordings, see streamRecording.hpp
+#define RECORDING_MAGIC "RAWSTRM" // Null terminated, fills RecordingHeader::magic
+#define RECORDING_VERSION (1)
+#define RECORDED_STEP_MAGIC (0x50455453) // "STEP"
+#define RECORDED_STEP_OPEN (0xFFFFFFFF) // numBuffers of a step whose recording was never closed, e.g. after a crash
+#define RECORDING_BLOCK_BYTES ((size_t)8 << 20) // Staging block of StreamRecorder, whole sectors. 65 ms of both channels at 32 MS/s
+#define RECORDING_BLOCKS (4) // Staging blocks, at least 2: the acquisition thread fills one while the writer thread writes the others
+#define RECORDING_SECTOR_BYTES (4096) // Alignment of unbuffered writes, covers 512 byte and 4K sector disks
+#define RECORDING_PREALLOCATE_BYTES ((size_t)8 << 30) // Bytes a recording is extended by whenever it fills, about a minute at 32 MS/s
+#define RECORDING_PACKED_VERSION (2) // Version of recordings whose buffers are packed with RECORDING_CODEC_PACKED
+#define RECORDED_BUFFER_MAGIC (0x4B434150) // "PACK"
+#define RECORDING_CODEC_NONE   (0) // Buffers are recorded as the digitizer delivered them
+#define RECORDING_CODEC_PACKED (1) // Buffers are delta coded and bit-packed, see packRecordedBuffer
+#define RECORDING_PACK_GROUP (128) // Consecutive codes of a channel packed with one bit width
+#define RECORDING_CODEC_THREADS (4) // Threads packing the buffers of a packed recording
+#define RECORDING_CODEC_JOBS (16) // Buffers a packed recording holds for its codec threads, the acquisition thread waits once they are all taken
+#define REPLAY_DECODE_THREADS (4) // Threads unpacking the buffers of a packed recording during replay
+#define REPLAY_DECODE_AHEAD (16) // Buffers of a packed recording unpacked ahead of delivery
+
+// Spectrum and exclusion line output, see spectrumFile.hpp
+#define OUTPUT_BINARY (0) // SpectrumFileWriter files, SPECTRUM_FILE_EXTENSION in place of the requested extension
+#define OUTPUT_CSV    (1) // Comma separated text, for export
+#define OUTPUT_FORMAT (OUTPUT_BINARY)
+#define SPECTRUM_FILE_MAGIC "SPECBIN" // Null terminated, fills SpectrumFileHeader::magic
+#define SPECTRUM_FILE_VERSION (1)
+#define SPECTRUM_FILE_EXTENSION ".spec"
+#define SPECTRUM_AXIS_NONE     (0) // Plain arrays with no frequency axis
+#define SPECTRUM_AXIS_UNIFORM  (1) // Axis is axisStart + i*axisStep
+#define SPECTRUM_AXIS_EXPLICIT (2) // Axis values follow the header
+#define SPECTRUM_AXIS_TOLERANCE (1e-9) // Largest deviation, in bins, of an axis from its uniform descriptor
+#define SPECTRUM_FILE_SINGLE   (0) // One record, written by saveSpectrum, saveCombinedSpectrum and saveVector
+#define SPECTRUM_FILE_SEQUENCE (1) // One record per spectrum on a shared axis, written by saveSpectraFromQueue
+#define SPECTRUM_FILE_DELTAS   (2) // Records of the bins changed since the previous record, written by saveExclusionLineDeltas
+#define EXCLUSION_KEYFRAME_INTERVAL (64) // Progress snapshots per full exclusion line, the rest only hold the bins that changed
+
+// HDF5 scan archive, see HDF5DataWriter.hpp
+#define ARCHIVE_RAW_BUFFERS       (1 << 0) // Every digitizer buffer. 4 bytes per sample per channel pair, so only for short scans
+#define ARCHIVE_AVERAGED_SPECTRA  (1 << 1) // Every averaged spectrum handed to processing
+#define ARCHIVE_COMBINED_SPECTRUM (1 << 2) // Combined spectrum of the scan, when the archive is closed
+#define ARCHIVE_EXCLUSION_LINES   (1 << 3) // Exclusion line at the end of every step
+#define ARCHIVE_METRICS           (1 << 4) // Per step metrics of timing.cpp, when the archive is closed
+#define ARCHIVE_DEFAULT (ARCHIVE_AVERAGED_SPECTRA | ARCHIVE_COMBINED_SPECTRUM | ARCHIVE_EXCLUSION_LINES | ARCHIVE_METRICS)
+#define ARCHIVE_QUEUE_BYTES ((size_t)512 << 20) // Records held for the archive's writer thread at most, larger records are dropped
+#define ARCHIVE_COMPRESSION (0) // gzip level of the archived datasets, 0 for none
+#define ARCHIVE_CHUNK_BINS (16384) // Values per chunk along a row of an archived dataset
+
+// Scan checkpoints, see scanCheckpoint.hpp
+#define CHECKPOINT_MAGIC "SCANCKP" // Null terminated, fills CheckpointHeader::magic
+#define CHECKPOINT_VERSION (3)
+#define CHECKPOINT_TEMP_SUFFIX ".tmp" // Checkpoint being written, renamed over the checkpoint file once complete
+
+// Shared calibration of baseline, bad bins, SNR and filter, see calibrationStore.hpp
+#define CALIBRATION_STORE_DIRECTORY "calibration" // Store the executables share, next to the baseline.csv and badBins.csv it replaces
+#define CALIBRATION_MAGIC "SCANCAL" // Null terminated, fills CalibrationHeader::magic
+#define CALIBRATION_VERSION (1)
+#define CALIBRATION_TEMP_SUFFIX ".tmp" // Generation being written, renamed to its .cal name once complete
+#define CALIBRATION_STORE_KEEP (2) // Newest generations a publication leaves in the store
+
+// Live telemetry for monitoring clients, see telemetryPublisher.hpp
+#define TELEMETRY_NAME "Local\\scanTelemetry" // Name of the shared memory mapping
+#define TELEMETRY_MAGIC "SCANTLM" // Null terminated, fills TelemetryHeader::magic
+#define TELEMETRY_VERSION (2)
+#define TELEMETRY_RATE_HZ (10.0) // Publications per second per channel at most
+#define TELEMETRY_MAX_VALUES (4096) // Values per channel, longer spectra are averaged down to fit
+#define TELEMETRY_RAW_SPECTRUM       (0) // Averaged spectrum handed to processing
+#define TELEMETRY_PROCESSED_SPECTRUM (1) // Baseline removed spectrum
+#define TELEMETRY_REBINNED_SPECTRUM  (2) // Rebinned spectrum the decisions are made on
+#define TELEMETRY_COMBINED_SPECTRUM  (3) // Combined spectrum of the scan, after every step
+#define TELEMETRY_EXCLUSION_LINE     (4)
+#define TELEMETRY_METRICS            (5) // NUM_TIMERS stage times in seconds, then the latest value of each of the NUM_METRICS metrics
+#define TELEMETRY_QUEUE_GAUGES       (6) // QUEUE_GAUGE_VALUES values for each of the NUM_QUEUES pipeline queues
+#define TELEMETRY_CHANNELS           (7)
+#define SCAN_PLAN_MIN_GAIN (0.5) // Expected gain, in bins of the exclusion line, below which ScanPlanner leaves a window
+#define STOP_FORECAST_LEAD (3) // Forecast spectra to a stop at which a pipelined scan starts preparing the next step
+#define ADAPTIVE_BATCH_NEAR_STOP (2) // Forecast spectra to a stop from which the averaging stages average their smallest batches
+#define ADAPTIVE_BATCH_LAG_FILL (0.5) // Fill of the raw data ring from which the averaging stages average their largest batches
+#define DRAIN_AFTER_DECISION (1) // Set to 1 to discard the blocks and spectra still in flight once a decision stops the step, 0 to process them
+
+// Backpressure policies for a Stage whose output ring is full (see utils/pipelineStage.hpp)
+#define BACKPRESSURE_BLOCK       (0) // Wait for the next stage
+#define BACKPRESSURE_DROP_OLDEST (1) // Hold a few items locally and drop the oldest beyond that
+#define BACKPRESSURE_SPILL       (2) // Hold every item locally until the next stage catches up
+
 
 /*******************************************************************************
  *                                                                            *
@@ -64,8 +267,14 @@
 #include <iomanip>
 
 #include <string>
+#include <charconv>
+#include <cinttypes>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
 #include <complex>
 #include <iterator>
 
@@ -76,11 +285,54 @@
 #include <thread>
 #include <condition_variable>
 #include <mutex>
+#include <atomic>
+#include <memory>
 
 
 // Custom library includes
 #include <fftw3.h>
 
+// FFTW types and functions for the acquisition -> FFT -> averaging hot path, selected by SINGLE_PRECISION_PIPELINE
+#if SINGLE_PRECISION_PIPELINE
+typedef float pipeline_real;
+typedef fftwf_complex pipeline_complex;
+typedef fftwf_plan pipeline_plan;
+
+#define pipeline_malloc         fftwf_malloc
+#define pipeline_free           fftwf_free
+#define pipeline_execute_dft    fftwf_execute_dft
+#define pipeline_plan_dft_1d    fftwf_plan_dft_1d
+#define pipeline_plan_many_dft  fftwf_plan_many_dft
+#define pipeline_destroy_plan   fftwf_destroy_plan
+#else
+typedef double pipeline_real;
+typedef fftw_complex pipeline_complex;
+typedef fftw_plan pipeline_plan;
+
+#define pipeline_malloc         fftw_malloc
+#define pipeline_free           fftw_free
+#define pipeline_execute_dft    fftw_execute_dft
+#define pipeline_plan_dft_1d    fftw_plan_dft_1d
+#define pipeline_plan_many_dft  fftw_plan_many_dft
+#define pipeline_destroy_plan   fftw_destroy_plan
+#endif
+
+// cuFFT types and functions of the same precision, for the cuFFT backend
+#if CUDA_FFT_BACKEND
+#include <cuda_runtime.h>
+#include <cufft.h>
+
+#if SINGLE_PRECISION_PIPELINE
+typedef cufftComplex device_complex;
+#define DEVICE_FFT_TYPE     CUFFT_C2C
+#define device_execute_dft  cufftExecC2C
+#else
+typedef cufftDoubleComplex device_complex;
+#define DEVICE_FFT_TYPE     CUFFT_Z2Z
+#define device_execute_dft  cufftExecZ2Z
+#endif
+#endif
+
 #include <Eigen/Dense>
 
 #include <visa.h>
@@ -88,15 +340,25 @@
 #include "AlazarError.h"
 #include "AlazarApi.h"
 #include "AlazarCmd.h"
+#include <psapi.h> // Process memory counters for SoakMonitor, after the windows.h of AlazarApi.h
+#include <avrt.h> // MMCSS registration for ThreadPlacement
 #include "IoBuffer.h"
 
-// #include "H5Cpp.h"
+#include "H5Cpp.h"
 
 // #include "matplotlibcpp.h"
 // namespace plt = matplotlibcpp;
 
 #include "DspFilters/Dsp.h"
 
+// Needed by value in the shared data structs below
+#include "utils/cancellationToken.hpp"
+#include "utils/spscRing.hpp"
+#include "utils/frequencyAxis.hpp"
+#include "utils/binSpill.hpp"
+#include "utils/combinedSpectrumGrid.hpp"
+#include "utils/exclusionLineTrace.hpp"
+
 
 /*******************************************************************************
  *                                                                            *
@@ -104,11 +366,18 @@
  *                                                                            *
  ******************************************************************************/
 // Struct for holding spectrum information
+// Spectra are moved from stage to stage, so their storage is allocated once by the stage that creates them. Only saved results are copied.
+// The frequency axis is shared between spectra and only copied when one of them changes it
 struct Spectrum {
     std::vector<double> powers;
-    std::vector<double> freqAxis;
+    FrequencyAxis freqAxis;
     
     double trueCenterFreq;
+    int64_t acquiredAt = 0; // latencyClock() when the newest buffer in the spectrum was delivered, 0 if not tracked
+
+    // Sub-spectra averaged into the spectrum, and the batch the SNR holds for. 0 if not an average, see DataProcessor::averagingWeight
+    int subSpectra = 0;
+    int nominalSubSpectra = 0;
 };
 
 struct CombinedSpectrum : public Spectrum {
@@ -118,40 +387,98 @@ struct CombinedSpectrum : public Spectrum {
 };
 
 
+class BaselineRefresher;
+class BufferPool;
+class DataProcessor;
+class HDF5DataWriter;
+class QueueGauges;
+class TelemetryPublisher;
+
+// Contiguous run of numSpectra spectra, each SharedDataBasic::samplesPerBuffer samples long, handed between pipeline stages
+struct DataBlock {
+    pipeline_complex* data;
+    int numSpectra;
+    int sequence; // Acquisition order of the block, used to restore ordering after the parallel FFT workers
+    int64_t deliveredAt = 0; // latencyClock() when the block's last buffer was delivered
+    bool pooled = false; // data was borrowed from the stage's BufferPool, otherwise it was pipeline_malloc'd
+};
+
 // Struct for storing data shared between threads. Used for multithreaded data acquisition.
 struct SharedDataBasic{
     std::mutex mutex;
 
     int samplesPerBuffer;
+    int spectraPerBlock = 1; // Spectra packed into each DataBlock so the FFT stage can transform them with one batched plan
+
+    // Optional pools that blocks in dataRings and FFTDataRing are borrowed from. Blocks are pipeline_malloc'd and pipeline_free'd if null.
+    BufferPool* dataPool = nullptr;
+    BufferPool* FFTPool = nullptr;
+
+    // Retention of recent acquisition blocks for error recovery. backupDepth <= 0 keeps every block (BACKUP_COPY only)
+    int backupPolicy = BACKUP_COPY;
+    int backupDepth = 0;
 
-    std::queue<fftw_complex*> dataQueue;
-    std::queue<fftw_complex*> backupDataQueue;
-    std::queue<fftw_complex*> dataSavingQueue;
-    std::queue<fftw_complex*> FFTDataQueue;
+    // One ring per FFT worker. The acquisition deals block n to dataRings[n % dataRings.size()], so every ring keeps a single consumer
+    std::vector<std::unique_ptr<SPSCRing<DataBlock>>> dataRings;
+    std::queue<pipeline_complex*> backupDataQueue;
 
-    std::condition_variable dataReadyCondition;
-    std::condition_variable saveReadyCondition;
-    std::condition_variable FFTDataReadyCondition;
+    // Fed by the FFT workers from the reorder section under mutex, which serializes them into a single producer
+    SPSCRing<DataBlock> FFTDataRing;
+
+    // Transformed blocks that finished ahead of an earlier block, keyed by sequence. Released to FFTDataRing in acquisition order
+    std::map<int, DataBlock> FFTReorderBuffer;
+    int nextFFTSequence = 0;
+    int activeFFTWorkers = 0;
+};
+
+// Result of one processingWorker, held in the reorder buffer until every earlier spectrum has been released
+struct ProcessedSpectrum {
+    int sequence;
+    Spectrum rawSpectrum;
+    Spectrum rescaledSpectrum;
+    CombinedSpectrum rebinnedSpectrum;
 };
 
 struct SharedDataProcessing {
     std::mutex mutex;
 
-    std::queue<std::vector<double>> magDataQueue;
-    std::queue<Spectrum> rawDataQueue;
-    std::queue<CombinedSpectrum> rebinnedDataQueue;
-
-    std::condition_variable magDataReadyCondition;
-    std::condition_variable rawDataReadyCondition;
-    std::condition_variable rescaledDataReadyCondition;
-
+    SPSCRing<std::vector<double>> magDataRing;
+    SPSCRing<Spectrum> rawDataRing;
+    SPSCRing<CombinedSpectrum> rebinnedDataRing;
+    SPSCRing<CombinedSpectrum> digitizerDataRing; // Spectra of one digitizer's chain for digitizerMergeThread (multi-digitizer steps)
+
+    // Parallel processing stage. rawDataMutex serializes the workers' pops and numbers the spectra, mutex guards the reorder buffer
+    std::mutex rawDataMutex;
+    int nextRawSequence = 0;
+    std::map<int, ProcessedSpectrum> processingReorderBuffer;
+    int nextProcessedSequence = 0;
+    int activeProcessingWorkers = 0;
+
+    // Backpressure for the output rings of the magnitude, averaging and processing stages, see BACKPRESSURE_* above
+    int backpressurePolicy = BACKPRESSURE_BLOCK;
+    int spillDepth = 0;
+
+    // Batch bounds of the averaging stages, see adaptiveBatchSize in multiThreading.cpp. 0 for both keeps their subSpectraAveragingNumber
+    int minSubSpectra = 0;
+    int maxSubSpectra = 0;
+
+    HDF5DataWriter* archive = nullptr; // Scan archive the processing and decision stages write to, if any
+    int archiveStep = 0; // Scan step the stages are running, for the archive
+    TelemetryPublisher* telemetry = nullptr; // Live telemetry the processing and decision stages publish to, if any
+    bool diagnostics = true; // Publish the raw and processed spectra to the telemetry. Off in ScanRunner::productionMode
+    QueueGauges* queueGauges = nullptr; // Gauges of this step's rings the decision stage publishes to the telemetry, if any
 };
 
 struct SharedDataSaving {
     std::mutex mutex;
 
-    std::queue<Spectrum> exclusionLineQueue;
+    // Progress snapshots of the exclusion line (SAVE_PROGRESS). The trace is only used by the decision stage and restarts every step
+    std::queue<ExclusionLineDelta> exclusionLineQueue;
+    ExclusionLineTrace exclusionLineTrace;
+    bool exclusionLinesClosed = false; // End of stream for exclusionLineQueue, set when the decision stage exits
     std::condition_variable exclusionLineReadyCondition;
+
+    std::vector<CombinedSpectrum>* decisionCapture = nullptr; // Step of a DecisionStream the decision stage copies its spectra to, if any
 };
 
 
@@ -160,13 +487,31 @@ struct SavedData{
     std::mutex mutex;
 
     std::vector<Spectrum> rawSpectra;
+    size_t rawSpectraLimit = 10; // Spectra kept in rawSpectra, the first of the scan. acquireListSweep keeps every spectrum
     std::vector<Spectrum> processedSpectra;
     std::vector<Spectrum> rescaledSpectra;
 
-    CombinedSpectrum combinedSpectrum;
+    CombinedSpectrumGrid combinedSpectrum{REBINNING_WIDTH, CONVOLUTION_WIDTH, COMBINED_PYRAMID_LEVELS};
+};
+
+// Online statistics of a baseline calibration, accumulated by calibrationThread over every acquisition of the calibration. Only running means
+// and the sub-spectrum sum in progress are held, so memory doesn't grow with the calibration length
+struct CalibrationStatistics {
+    int subSpectraAveragingNumber = 32;
+    bool processSpectra = false; // Also process each averaged spectrum with the current baseline and average the processed spectra
+
+    // Sub-spectra of the averaged spectrum in progress. Carried over between acquisitions so averages can span them
+    std::vector<double> powerSum;
+    int numSummed = 0;
+
+    std::vector<double> rawAverage;       // Mean of the averaged raw spectra, unmasked
+    std::vector<double> processedAverage; // Mean of the processed spectra while processSpectra is set
+    int rawSpectra = 0, processedSpectra = 0;
+    std::vector<double> firstRawSpectrum; // First averaged raw spectrum, kept for plotting
 };
 
-// Struct for storing synchronization flags. Used for multithreaded data acquisition.
+// Struct for storing synchronization flags. Used for multithreaded data acquisition. The completion flags record how far a step got, stages
+// learn about the end of their input from the ring's end-of-stream mark and about failures elsewhere from the cancellation token
 struct SynchronizationFlags {
     std::mutex mutex;
     bool pauseDataCollection;
@@ -180,12 +525,56 @@ struct SynchronizationFlags {
 
     bool errorFlag;
     std::string errorMessage;
+    CancellationToken cancellation; // Cancelled by raiseError, wakes every ring of the step
+
+    // Set by requestAcquisitionStop. drainInFlight tells the stages to discard what is still in flight instead of processing it
+    bool stopRequested;
+    std::atomic<bool> drainInFlight;
+    std::chrono::steady_clock::time_point stopRequestTime;
+    std::function<void()> wakeAcquisition; // Installed by the acquisition for the length of a step. Called without the mutex held
+
+    // Decision forecast. spectraToStop is the decision agent's latest forecast (-1 if none), prepareNextStep is called once, without the
+    // mutex held, when the forecast first drops to STOP_FORECAST_LEAD
+    std::atomic<int> spectraToStop;
+    std::function<void()> prepareNextStep;
+
+    // Multi-digitizer steps (see ScanRunner::addDigitizer). The primary chain's flags list the flags of every other digitizer's chain, which
+    // get stop requests and errors passed on from it. Errors of another chain are passed back through primaryFlags. Only the primary chain
+    // records the per-step metrics, so they keep one value per step
+    std::vector<SynchronizationFlags*> linkedFlags;
+    SynchronizationFlags* primaryFlags = nullptr;
+    bool recordsMetrics = true;
 
     SynchronizationFlags() : pauseDataCollection(false), acquisitionComplete(false),
                              FFTComplete(false), magnitudeComplete(false), 
                              averagingComplete(false), processingComplete(false),
                              decisionsComplete(false),
-                             errorFlag(false), errorMessage("") {}
+                             errorFlag(false), errorMessage(""),
+                             stopRequested(false), drainInFlight(false), spectraToStop(-1) {}
+
+    // Records the first error of the step and cancels every other thread of it
+    void raiseError(const std::string& message) {
+        bool firstError = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!errorFlag) {
+                errorFlag = true;
+                errorMessage = message;
+                firstError = true;
+            }
+        }
+        cancellation.cancel(message);
+
+        // Every chain of a multi-digitizer step fails together. A chain that already has an error doesn't pass it on again
+        if (firstError) {
+            for (SynchronizationFlags* linked : linkedFlags) {
+                linked->raiseError(message);
+            }
+            if (primaryFlags != nullptr) {
+                primaryFlags->raiseError(message);
+            }
+        }
+    }
 };
 
 
@@ -196,16 +585,45 @@ struct SynchronizationFlags {
  ******************************************************************************/
 
 // Class includes
+#include "utils/latencyHistogram.hpp"
+#include "utils/allocationTracker.hpp"
+#include "utils/traceRecorder.hpp"
+#include "utils/bufferPool.hpp"
+#include "utils/wisdomStore.hpp"
+#include "utils/fftBackend.hpp"
+#include "utils/pipelineStage.hpp"
+#include "utils/zeroPhaseFilter.hpp"
+#include "utils/baselineRefresher.hpp"
+#include "utils/downConverter.hpp"
+#include "utils/welchSegmenter.hpp"
+#include "utils/binRepairPlan.hpp"
+#include "utils/SNRProfile.hpp"
+#include "utils/streamRecording.hpp"
+#include "utils/spectrumFile.hpp"
+#include "utils/HDF5DataWriter.hpp"
+#include "utils/scanCheckpoint.hpp"
+#include "utils/calibrationStore.hpp"
+#include "utils/telemetryPublisher.hpp"
+#include "utils/queueGauges.hpp"
+#include "utils/startupScheduler.hpp"
+#include "utils/soakMonitor.hpp"
+#include "utils/threadPlacement.hpp"
+
 #include "instruments/instrument.hpp"
 
 #include "instruments/PSG.hpp"
 #include "instruments/AWG.hpp"
+#include "instruments/acquisitionSource.hpp"
 #include "instruments/ATS.hpp"
+#include "instruments/simulatedDigitizer.hpp"
+#include "instruments/replayDigitizer.hpp"
 
 #include "dataProcessing/bayes.hpp"
 #include "dataProcessing/dataProcessor.hpp"
 
 #include "decisionAgent.hpp"
+#include "decisionSweep.hpp"
+#include "scanPlanner.hpp"
 #include "scanRunner.hpp"
 
 
@@ -219,46 +637,109 @@ struct SynchronizationFlags {
 std::vector<double> averageVectors(const std::vector<std::vector<double>>& vecs);
 int findClosestIndex(std::vector<double> vec, double target);
 std::vector<int> findOutliers(const std::vector<double>& data, int windowSize = 50, double multiplier = 5);
+void findOutliers(const std::vector<double>& data, int windowSize, double multiplier, std::vector<int>& outliers);
 int findMaxIndex(std::vector<double> vec, int startIndex, int endIndex);
 void unwrapPhase(std::vector<double>& phase);
-std::tuple<double, double> vectorStats(std::vector<double> vec);
+std::tuple<double, double> vectorStats(const std::vector<double>& vec);
 void trimVector(std::vector<double>& vec, double cutPercentage);
 void trimSpectrum(Spectrum& spec, double cutPercentage);
+void addToRunningMean(std::vector<double>& mean, int& count, const std::vector<double>& values);
 
 // fileIO.cpp
 std::vector<std::vector<double>> readCSV(std::string filename, int maxLines);
 std::vector<double> readVector(const std::string& filename);
-void saveCombinedSpectrum(CombinedSpectrum data, std::string filename);
-void saveSpectrum(Spectrum data, std::string filename);
-void saveVector(std::vector<int> data, std::string filename);
-void saveVector(std::vector<double> data, std::string filename);
+void saveCombinedSpectrum(const CombinedSpectrum& data, const std::string& filename, int format = OUTPUT_FORMAT);
+void saveSpectrum(const Spectrum& data, const std::string& filename, int format = OUTPUT_FORMAT);
+void saveVector(const std::vector<int>& data, const std::string& filename, int format = OUTPUT_FORMAT);
+void saveVector(const std::vector<double>& data, const std::string& filename, int format = OUTPUT_FORMAT);
 std::string getDateTimeString();
-void saveSpectraFromQueue(std::queue<Spectrum>& spectraQueue, std::string filename);
+void saveSpectraFromQueue(std::queue<Spectrum>& spectraQueue, const std::string& filename, int format = OUTPUT_FORMAT);
+void saveExclusionLineDeltas(std::queue<ExclusionLineDelta>& deltas, const std::string& filename);
+std::string outputFilename(const std::string& filename, int format);
 
 // multiThreading.cpp
-void FFTThread(fftw_plan plan, int N, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags);
+void initPipelineRings(SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, int numFFTWorkers, 
+                       size_t capacity = PIPELINE_RING_CAPACITY, int waitStrategy = PIPELINE_RING_WAIT, int numProcessingWorkers = 1);
+void resetStepData(SharedDataBasic& sharedData, SharedDataSaving& sharedSavedData, SynchronizationFlags& syncFlags);
+void requestAcquisitionStop(SynchronizationFlags& syncFlags);
+void FFTThread(pipeline_plan plan, pipeline_plan batchPlan, int N, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags, int workerID = 0);
 void magnitudeThread(int N, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor);
 void averagingThread(SharedDataProcessing& sharedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, double trueCenterFreq, int subSpectraAveragingNumber);
-void processingThread(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, BayesFactors& bayesFactors);
+void accumulationThread(int N, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, 
+                        DataProcessor& dataProcessor, double trueCenterFreq, int subSpectraAveragingNumber);
+void transformAccumulationThread(FFTBackend& backend, int N, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, 
+                                 DataProcessor& dataProcessor, double trueCenterFreq, int subSpectraAveragingNumber);
+void calibrationThread(int N, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, CalibrationStatistics& calibration);
+void processingThread(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor);
+void processingWorker(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, int workerID = 0);
+void digitizerProcessingThread(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, 
+                               bool primary);
+void digitizerMergeThread(const std::vector<SharedDataProcessing*>& digitizerData, SharedDataProcessing& sharedData, SynchronizationFlags& syncFlags);
 void decisionMakingThread(SharedDataProcessing& sharedData, SharedDataSaving& savedData, SynchronizationFlags& syncFlags, BayesFactors& bayesFactors, DecisionAgent& decisionAgent);
 void dataSavingThread(SharedDataSaving& savedData, SynchronizationFlags& syncFlags);
-void saveDataToBin(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags);
-void saveDataToHDF5(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags);
+void trimBackupQueue(SharedDataBasic& sharedData, int maxSize);
+
+// pageAllocation.cpp
+bool largePagesAvailable();
+void* allocatePages(size_t bytes, int flags, int* placed = nullptr);
+void freePages(void* pages);
+
+// powerKernels.cu
+#if CUDA_FFT_BACKEND
+void addDevicePowers(const cufftComplex* spectra, int numSpectra, int N, float* powerSum, cudaStream_t stream);
+void addDevicePowers(const cufftDoubleComplex* spectra, int numSpectra, int N, double* powerSum, cudaStream_t stream);
+#endif
+
+// spectrumKernels.cpp
+bool cpuHasAVX2();
+const char* spectrumKernelName();
+void spectrumAccumulate(double* sum, const double* values, size_t n);
+void spectrumScale(double* values, double scale, size_t n);
+void spectrumDivide(double* out, const double* numerator, const double* denominator, size_t n);
+void spectrumScaleAdd(double* values, double factor, const double* x, double weight, size_t n);
+void spectrumRatioMinusOne(double* out, const double* numerator, const double* denominator, size_t n);
+void spectrumScaledProduct(double* out, const double* x, const double* y, double scale, size_t n);
+double spectrumSum(const double* values, size_t n);
+void spectrumMoments(const double* values, size_t n, double shift, double& sum, double& sumSquares);
+void spectrumCoefficientUpdate(double* sumA, double* sumB, const double* powers, const double* weights, const double* sigmas, double factorA,
+                               double factorB, size_t n);
+void spectrumQuadraticRoot(double* out, const double* a, const double* b, double c, size_t n);
+double spectrumThresholdScore(double* scores, const double* values, const double* thresholds, const double* weights, size_t n);
 
 // tests.cpp
 void printAvailableResources();
 void psgTesting(int gpibAdress);
 void awgTesting(int gpibAdress);
+void benchmarkSampleConversion(U32 samplesPerBuffer = 320000, int repeats = 200);
+void benchmarkBaselineFilter(size_t spectrumLength = 65536, int poleNumber = 6, int repeats = 50);
 
 //timing.cpp
 void setTime(int timerCode, double val);
 double getTime(int timerCode);
 void startTimer(int timerCode);
-void stopTimer(int timerCode);
+void stopTimer(int timerCode, int64_t traceItem = -1);
 void resetTimers();
 void setMetric(int metricCode, int val);
 void updateMetric(int metricCode, int val);
 std::vector<int> getMetric(int metricCode);
+void restoreMetric(int metricCode, const std::vector<int>& values);
+int64_t latencyClock();
+void recordLatency(int latencyCode, int64_t since);
+LatencySummary getLatency(int latencyCode);
+AllocationSummary getAllocations(int timerCode);
+void recordStepAllocations();
+void setQueueGauge(int queueCode, const QueueGauge& gauge);
+QueueGauge getQueueGauge(int queueCode);
+void queueGaugeValues(const QueueGauge& gauge, double* values);
 void reportPerformance();
 
+// traceRecorder.cpp
+void startTracing();
+void stopTracing();
+bool tracingEnabled();
+void setTraceThreadName(const std::string& name);
+void traceEvent(const char* name, const char* category, int64_t start, int64_t duration, int64_t item = -1, int64_t allocations = -1,
+                int64_t allocatedBytes = 0);
+bool writeTrace(const std::string& path);
+
 #endif // DECS_H
\ No newline at end of file
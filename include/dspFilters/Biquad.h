@@ -87,6 +87,20 @@ public:
     }
   }
 
+  // Set the coefficients to from + t * (to - from), as smoothProcess1
+  // steps them, for filters redesigned at a control rate.
+  void interpolateCoefficients (const BiquadBase& from,
+                                const BiquadBase& to,
+                                double t)
+  {
+    m_a0 = from.m_a0 + t * (to.m_a0 - from.m_a0);
+    m_a1 = from.m_a1 + t * (to.m_a1 - from.m_a1);
+    m_a2 = from.m_a2 + t * (to.m_a2 - from.m_a2);
+    m_b0 = from.m_b0 + t * (to.m_b0 - from.m_b0);
+    m_b1 = from.m_b1 + t * (to.m_b1 - from.m_b1);
+    m_b2 = from.m_b2 + t * (to.m_b2 - from.m_b2);
+  }
+
 protected:
   //
   // These are protected so you can't mess with RBJ biquads
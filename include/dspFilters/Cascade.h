@@ -114,8 +114,29 @@ public:
   // Calculate filter response at the given normalized frequency.
   complex_t response (double normalizedFrequency) const;
 
+  // Calculate filter response at each of numFrequencies normalized frequencies.
+  void response (int numFrequencies,
+                 const double* normalizedFrequencies,
+                 complex_t* dest) const;
+
+  // Calculate filter response at numFrequencies evenly spaced normalized
+  // frequencies, firstFrequency + k * frequencyStep. The twiddles are
+  // computed incrementally, so this is the cheapest way to sweep or plot.
+  void response (int numFrequencies,
+                 double firstFrequency,
+                 double frequencyStep,
+                 complex_t* dest) const;
+
   std::vector<PoleZeroPair> getPoleZeros () const;
 
+  // Set the stages to from + t * (to - from), coefficient by coefficient.
+  // Both cascades need this cascade's storage size. If their layouts have a
+  // different number of stages there is nothing to interpolate, and the
+  // stages of to are taken as they are.
+  void interpolateCoefficients (const Cascade& from,
+                                const Cascade& to,
+                                double t);
+
   // Process a block of samples in the given form
   template <class StateType, typename Sample>
   void process (int numSamples, Sample* dest, StateType& state) const
@@ -134,6 +155,13 @@ protected:
   void applyScale (double scale);
   void setLayout (const LayoutBase& proto);
 
+private:
+  // Evaluate all stages over a block of z^-1 = (zr + i zi) values
+  void responseBlock (int numFrequencies,
+                      const double* zr,
+                      const double* zi,
+                      complex_t* dest) const;
+
 private:
   int m_numStages;
   int m_maxStages;
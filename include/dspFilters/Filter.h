@@ -179,6 +179,21 @@ public:
     return m_design.response (normalizedFrequency);
   }
 
+  void response (int numFrequencies,
+                 const double* normalizedFrequencies,
+                 complex_t* dest) const
+  {
+    m_design.response (numFrequencies, normalizedFrequencies, dest);
+  }
+
+  void response (int numFrequencies,
+                 double firstFrequency,
+                 double frequencyStep,
+                 complex_t* dest) const
+  {
+    m_design.response (numFrequencies, firstFrequency, frequencyStep, dest);
+  }
+
 protected:
   void doSetParams (const Params& parameters)
   {
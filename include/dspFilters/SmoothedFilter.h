@@ -44,6 +44,12 @@ namespace Dsp {
 /*
  * Implements smooth modulation of time-varying filter parameters
  *
+ * With controlSamples of 0 the filter is redesigned at every sample of a
+ * transition. Otherwise it is only redesigned every controlSamples samples,
+ * and the biquad coefficients are interpolated linearly in between, which
+ * keeps transitions affordable at high sample rates. Either way the filter
+ * state runs on through every redesign.
+ *
  */
 template <class DesignClass,
           int Channels,
@@ -56,9 +62,13 @@ class SmoothedFilterDesign
 public:
   typedef FilterDesign <DesignClass, Channels, StateType> filter_type_t;
 
-  SmoothedFilterDesign (int transitionSamples)
+  SmoothedFilterDesign (int transitionSamples, int controlSamples = 0)
     : m_transitionSamples (transitionSamples)
+    , m_controlSamples (controlSamples)
     , m_remainingSamples (-1) // first time flag
+    , m_controlTo (0)
+    , m_controlPosition (0)
+    , m_controlLength (0)
   {
   }
 
@@ -75,7 +85,11 @@ public:
     // first handle any transition samples
     int remainingSamples = std::min (m_remainingSamples, numSamples);
 
-    if (remainingSamples > 0)
+    if (remainingSamples > 0 && m_controlSamples > 0)
+    {
+      interpolateBlock (remainingSamples, destChannelArray);
+    }
+    else if (remainingSamples > 0)
     {
       // interpolate parameters for each sample
       const double t = 1. / m_remainingSamples;
@@ -103,6 +117,9 @@ public:
         m_transitionParams = this->getParams();
     }
 
+    if (m_remainingSamples == 0)
+      m_controlPosition = m_controlLength = 0;
+
     // do what's left
     if (numSamples - remainingSamples > 0)
     {
@@ -125,10 +142,69 @@ public:
   }
 
 protected:
+  // Process the first numSamples transition samples, redesigning at the
+  // end of every control segment and interpolating the coefficients from
+  // the design at its start. Segments carry over from one block to the next.
+  template <typename Sample>
+  void interpolateBlock (int numSamples,
+                         Sample* const* destChannelArray)
+  {
+    const int numChannels = this->getNumChannels();
+
+    for (int n = 0; n < numSamples;)
+    {
+      if (m_controlPosition == m_controlLength)
+      {
+        // The first segment of a transition starts from a fresh design
+        if (m_controlLength == 0)
+          m_controlFilter[m_controlTo].setParams (m_transitionParams);
+
+        const int remaining = m_remainingSamples - n;
+        const int segment = std::min (m_controlSamples, remaining);
+        const double t = double (segment) / remaining;
+
+        m_segmentStart = m_transitionParams;
+        for (int i = 0; i < DesignClass::NumParams; ++i)
+          m_transitionParams[i] += (this->getParams()[i] - m_transitionParams[i]) * t;
+
+        m_controlTo ^= 1;
+        m_controlFilter[m_controlTo].setParams (m_transitionParams);
+        m_controlPosition = 0;
+        m_controlLength = segment;
+      }
+
+      const DesignClass& from = m_controlFilter[m_controlTo ^ 1];
+      const DesignClass& to = m_controlFilter[m_controlTo];
+      const int count = std::min (m_controlLength - m_controlPosition, numSamples - n);
+      for (int k = 0; k < count; ++k, ++n)
+      {
+        m_transitionFilter.interpolateCoefficients (from, to, double (++m_controlPosition) / m_controlLength);
+
+        for (int i = numChannels; --i >= 0;)
+        {
+          Sample* dest = destChannelArray[i]+n;
+          *dest = this->m_state[i].process (*dest, m_transitionFilter);
+        }
+      }
+    }
+
+    m_remainingSamples -= numSamples;
+
+    if (m_remainingSamples == 0)
+      m_transitionParams = this->getParams();
+  }
+
   void doSetParams (const Params& parameters)
   {
     if (m_remainingSamples >= 0)
     {
+      // A new transition picks up where the current control segment got to
+      if (m_controlPosition < m_controlLength)
+        for (int i = 0; i < DesignClass::NumParams; ++i)
+          m_transitionParams[i] = m_segmentStart[i] + (m_transitionParams[i] - m_segmentStart[i]) *
+                                  m_controlPosition / m_controlLength;
+      m_controlPosition = m_controlLength = 0;
+
       m_remainingSamples = m_transitionSamples;
     }
     else
@@ -145,8 +221,16 @@ protected:
   Params m_transitionParams;
   DesignClass m_transitionFilter;
   int m_transitionSamples;
+  int m_controlSamples;          // samples between redesigns, 0 for every sample
 
   int m_remainingSamples;        // remaining transition samples
+
+  // Designs at the start and end of the current control segment
+  DesignClass m_controlFilter[2];
+  int m_controlTo;               // index of the design at the end
+  Params m_segmentStart;
+  int m_controlPosition;         // samples into the segment
+  int m_controlLength;           // samples in the segment, 0 for none
 };
 
 }
@@ -14,59 +14,69 @@
 
 #include "decs.hpp"
 
-/**
- * @brief Struct for storing acquisition parameters. Set by setAcquisitionParameters() method and accessed throughout the class.
- * 
- */
-struct AcquisitionParameters {
-    U32 sampleRate;
-    U32 samplesPerAcquisition;
-    U32 buffersPerAcquisition;
-    U32 recordsPerAcquisition;
-
-    double inputRange;
-    double inputImpedance;
-
-    U32 samplesPerBuffer;
-    U32 bytesPerSample;
-    U32 bytesPerBuffer;
-};
-
 /**
  * @brief Class for controlling alazarCard. Implements methods for acquiring data and setting acquisition parameters. 
  * Function definitions and documentation are in ATS.cpp.
  * 
  */
-class ATS {
+class ATS : public AcquisitionSource {
 public:
     ATS(int systemId = 1, int boardId = 1);
     ~ATS();
 
     double setExternalSampleClock(double requestedSampleRate);
-    void setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition=1, double inputRange=0.8, double inputImpedance=50);
+    void setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition=1, double inputRange=0.8, double inputImpedance=50,
+                                  U32 bufferCount=BUFFER_COUNT) override;
     void setInputParameters(char channel, std::string coupling, double inputRange, double inputImpedance=50);
     void toggleLowPass(char channel, bool enable);
 
     fftw_complex* AcquireData();
-    void AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags);
+    void AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) override;
+
+    void startStreamingSession() override;
+    void stopStreamingSession() override;
+    bool streamingSessionActive() const override { return sessionActive; }
 
     U32 suggestBufferNumber(U32 sampleRate, U32 samplesPerAcquisition);
+    U32 suggestBufferCount();
     void printBufferSize(U32 samplesPerAcquisition, U32 buffersPerAcquisition);
 
-    AcquisitionParameters acquisitionParams;
-
 private:
     HANDLE boardHandle;
     RETURN_CODE retCode;
 
-    IO_BUFFER *IoBufferArray[BUFFER_COUNT] = { NULL };
+    std::vector<IO_BUFFER*> IoBufferArray;
+
+    // Persistent streaming session. The board stays armed across steps and sessionThread gates buffers into activeStep
+    bool sessionActive = false;
+    bool sessionRunning = false;
+    std::thread sessionThread;
+    std::mutex sessionMutex;
+    std::condition_variable sessionCondition;
+    StepDelivery* activeStep = nullptr;
+    bool sessionDelivering = false; // The session thread is handing a buffer to activeStep, which must outlive it
 
     int getChannelID(char channel);
+
+    void allocateIoBuffers();
+    void freeIoBuffers();
+
+    void armBoard(bool continuous = false);
+    void disarmBoard();
+    void streamingSessionLoop();
+    void acquireFromStreamingSession(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags);
+
+    void interruptStep(StepDelivery* step) override;
 };
 
 
+void convertSamplesToComplex(const unsigned short* samples, fftw_complex* complexOutput, U32 samplesPerBuffer, double inputRange, bool startOdd = false);
+void convertSamplesToComplex(const unsigned short* samples, fftwf_complex* complexOutput, U32 samplesPerBuffer, double inputRange, bool startOdd = false);
 std::pair<std::vector<double>, std::vector<double>> processData(std::pair<std::vector<unsigned short>, std::vector<unsigned short>> sampleData, AcquisitionParameters acquisitionParams);
 
 fftw_complex* processDataFFT(fftw_complex* sampleData, fftw_plan plan, int N);
+void processDataFFT(fftw_complex* sampleData, fftw_complex* FFTData, fftw_plan plan);
+void processDataFFTBatched(fftw_complex* sampleData, fftw_complex* FFTData, int numSpectra, int N, fftw_plan plan, fftw_plan batchPlan, int batchSize);
+void processDataFFTBatched(fftwf_complex* sampleData, fftwf_complex* FFTData, int numSpectra, int N, fftwf_plan plan, fftwf_plan batchPlan, int batchSize);
 
 #endif // ATS_H
@@ -28,6 +28,12 @@ public:
 
     void AWG::clearMemory(int channel=1);
     void sendWaveform(std::vector<double> waveform, std::string name, int channel=1);
+
+    void invalidateCache() override;
+
+private:
+    // Name of every waveform in volatile memory, keyed by channel and hash of its DAC codes, so a known waveform is only selected again
+    std::map<std::pair<int, uint64_t>, std::string> uploadedWaveforms;
 };
 
 #endif // AWG_H
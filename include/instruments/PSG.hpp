@@ -16,16 +16,31 @@
 
 class PSG : public Instrument{
 public:
-    PSG(int gpibAddress);
+    PSG(int gpibAddress, bool connectNow = true);
     ~PSG();
 
+    void connect();
+
     void setFreq(double frequency);
     void setPow(double pow);
 
+    // Setters run on the I/O thread, ready once the output has settled, see Instrument::submit
+    std::future<void> setFreqAsync(double frequency);
+    std::future<void> setPowAsync(double pow);
+    std::future<void> onOffAsync(bool on);
+
     void modOnOff(bool on);
     void setFreqModDev(double dev);
     void freqModOnOff(bool on);
     void setFreqModSrc(bool ext, int src);
+
+    void loadList(const std::vector<double>& frequencies, const std::vector<double>& powers);
+    void startList();
+    void nextListPoint();
+    void stopList();
+
+private:
+    int gpibAddress;
 };
 
 #endif // PSG_H
@@ -0,0 +1,168 @@
+/**
+ * @file acquisitionSource.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for AcquisitionSource, the interface between a digitizer backend and the acquisition pipeline.
+ * @version 0.1
+ * @date 2023-11-21
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef ACQUISITIONSOURCE_H
+#define ACQUISITIONSOURCE_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Struct for storing acquisition parameters. Set by the setAcquisitionParameters() method of the source and read by the pipeline.
+ * 
+ */
+struct AcquisitionParameters {
+    U32 sampleRate;
+    U32 samplesPerAcquisition;
+    U32 buffersPerAcquisition;
+    U32 recordsPerAcquisition;
+
+    double inputRange;
+    double inputImpedance;
+
+    U32 samplesPerBuffer;
+    U32 bytesPerSample;
+    U32 bytesPerBuffer;
+
+    U32 bufferCount;            // DMA buffers posted to the board
+    bool adaptiveBufferCount;   // Re-size the DMA ring from the measured consumer latency every time the board is armed
+    int bufferAllocation = DMA_BUFFER_ALLOCATION; // ALLOCATE_* flags of the DMA buffers, applied the next time the board is armed
+};
+
+/**
+ * @brief State for delivering one step's worth of DMA buffers into pipeline blocks. Shared by the one-shot acquisition and the persistent
+ * streaming session so both hand blocks to the FFT stage in exactly the same way.
+ * 
+ */
+struct StepDelivery {
+    SharedDataBasic* sharedData = nullptr;
+    SynchronizationFlags* syncFlags = nullptr;
+
+    int spectraPerBlock = 1;
+    U32 samplesPerSpectrum = 0; // Samples per buffer after the downconversion
+    U32 samplesPerBlock = 0;
+    bool zeroCopy = false;
+
+    DataBlock block = { nullptr, 0, 0 };  // Block currently being filled
+    int blocksPushed = 0;
+    U32 buffersDelivered = 0;
+    int lateBuffers = 0; // Buffers held for longer than a buffer period, see deliverBuffer
+    bool failed = false;
+};
+
+/**
+ * @brief Instrument list sweep stepped by the acquisition, see AcquisitionSource::setListSweep. The buffers of a step are tagged with list
+ * points in order, buffersPerPoint buffers each, and advance steps the instrument once the last buffer of every point but the step's last
+ * has been delivered.
+ * 
+ */
+struct ListSweep {
+    U32 buffersPerPoint = 0;
+    std::function<void()> advance; // Called from the acquisition thread
+    int point = 0; // List point of the buffers being delivered
+};
+
+/**
+ * @brief Digitizer backend feeding the acquisition pipeline: the ATS9462 (ATS) or the synthetic SimulatedDigitizer. A source fills buffers of
+ * samplesPerBuffer U16 codes for channel A followed by samplesPerBuffer codes for channel B, and hands each one to deliverBuffer. The step 
+ * delivery (blocks, backups, the stop hook and the end of stream) is shared here so every backend feeds the FFT stage in exactly the same way.
+ * Backends implement interruptStep to end a wait early once the decision making stops the step. With a downconversion set, every buffer is
+ * decimated to samplesPerSpectrum() samples on the way into its block, while recordings and the archive keep the raw buffers. In Welch mode
+ * (setWelch) the blocks receive the overlapped, windowed segments of the step's buffers instead of the buffers themselves.
+ * Function definitions and documentation are in acquisitionSource.cpp.
+ * 
+ */
+class AcquisitionSource {
+public:
+    AcquisitionSource(){};
+    virtual ~AcquisitionSource(){};
+
+    virtual void setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition=1, double inputRange=0.8, 
+                                          double inputImpedance=50, U32 bufferCount=BUFFER_COUNT) = 0;
+    virtual void AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) = 0;
+
+    // Sources without a persistent session acquire every step on its own
+    virtual void startStreamingSession(){};
+    virtual void stopStreamingSession(){};
+    virtual bool streamingSessionActive() const { return false; }
+
+    // Receiver center frequency in MHz. Tagged onto recorded steps, and read by sources that synthesize or replay the RF input
+    void setCenterFrequency(double centerFrequency) { this->centerFrequency = centerFrequency; }
+
+    void startRecording(const std::string& path, int codec = RECORDING_CODEC_NONE);
+    void stopRecording();
+    bool recording() const { return recorder != nullptr; }
+
+    // Queues every delivered buffer to the archive's raw buffers while set, tagged with step. nullptr stops
+    void archiveTo(HDF5DataWriter* archive, int step) { this->archive = archive; archiveStep = step; }
+
+    // Decimates every buffer to the band around offsetFrequency (MHz from the receiver frequency) from the next step on. 1 turns it off
+    void setDownConversion(int decimation, double offsetFrequency = 0);
+    U32 samplesPerSpectrum() const { return acquisitionParams.samplesPerBuffer/(U32)decimation; }
+
+    // Delivers segmentsPerBuffer windowed segments per buffer from the next step on, see WelchSegmenter. 1 delivers the buffers
+    void setWelch(int window, int segmentsPerBuffer);
+
+    // Steps the list sweep through the buffers of every following step while set. nullptr stops
+    void setListSweep(ListSweep* sweep) { listSweep = sweep; }
+
+    // Placement of the threads the source runs itself, such as a streaming session's. Takes effect when the next session starts
+    void placeSessionThread(const ThreadPlacement& placement, DWORD_PTR chainMask = 0) { sessionPlacement = placement; sessionChainMask = chainMask; }
+
+    AcquisitionParameters acquisitionParams;
+
+protected:
+    virtual void interruptStep(StepDelivery* step);
+
+    void stopStep(StepDelivery* step);
+    bool pauseRequested(SynchronizationFlags& syncFlags);
+
+    void beginStepDelivery(StepDelivery& step, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags);
+    bool acquireStepBlock(StepDelivery& step, DWORD timeout_ms);
+    bool deliverBuffer(StepDelivery& step, const unsigned short* samples, DWORD timeout_ms);
+    void pushStepBlock(StepDelivery& step);
+    void endStepDelivery(StepDelivery& step);
+    void failStepDelivery(SynchronizationFlags& syncFlags, const std::exception& e);
+
+    double consumerLatency = 0; // Worst time in s a sample buffer was held by the host before the source could reuse it
+    std::atomic<int> overruns{0}; // Overflows, wait timeouts and pool stalls since the last step, recorded as ACQUISITION_OVERRUNS
+    ThreadPlacement sessionPlacement;
+    DWORD_PTR sessionChainMask = 0;
+    std::atomic<double> centerFrequency{0};
+
+    // Pacing of sources without a sample clock. interruptStep ends the wait at once
+    void resetPacing();
+    bool waitForBuffer(std::chrono::steady_clock::time_point stepStart, U32 bufferIndex, double rateFactor);
+    std::mutex pacingMutex;
+    std::condition_variable pacingCondition;
+    bool interrupted = false;
+
+    // Copies every delivered buffer into a recording while set, see startRecording
+    std::unique_ptr<StreamRecorder> recorder;
+    HDF5DataWriter* archive = nullptr;
+    int archiveStep = 0;
+    ListSweep* listSweep = nullptr;
+
+    // Downconversion of the delivered buffers, made for the acquisition parameters of the step by beginStepDelivery
+    int decimation = 1;
+    double downconversionOffset = 0; // MHz
+    std::unique_ptr<DownConverter> downConverter;
+
+    // Welch segments of the delivered buffers, made for the spectrum length of the step by beginStepDelivery
+    int welchWindow = WELCH_WINDOW_RECTANGULAR;
+    int welchSegmentsPerBuffer = 1;
+    std::unique_ptr<WelchSegmenter> segmenter;
+
+    // Step that requestAcquisitionStop may currently stop through SynchronizationFlags::wakeAcquisition. interruptStep runs under stopMutex
+    std::mutex stopMutex;
+    StepDelivery* stoppableStep = nullptr;
+};
+
+#endif // ACQUISITIONSOURCE_H
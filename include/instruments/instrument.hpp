@@ -16,15 +16,29 @@
 
 class Instrument {
 protected:
-    ViSession instrumentSession;
+    ViSession instrumentSession = VI_NULL; // Until openConnection
     ViSession defaultRM;
 
     ViStatus status;
+    bool simulated; // No VISA connection, see Instrument(bool)
+
+    ViStatus write(const std::string& command);
+    void checkError();
+
+    bool isCached(const std::string& header, const std::string& value) const;
+    ViStatus writeSetting(const std::string& header, const std::string& value);
+    ViStatus writeBlock(const std::string& header, const void* data, size_t bytes);
+
+    void stopCommandWorker();
 
 public:
-    Instrument();
+    Instrument(bool simulated = false);
     virtual ~Instrument();
 
+    // The destructor closes the VISA session, so a copy would close the original's session with it
+    Instrument(const Instrument&) = delete;
+    Instrument& operator=(const Instrument&) = delete;
+
     void openConnection(int gpibAddress);
     void closeConnection();
 
@@ -34,6 +48,61 @@ public:
 
     virtual void onOff(bool on);
     void reset();
+
+    void beginBatch(bool syncCompletion = false);
+    std::string endBatch();
+    void abortBatch();
+    bool batching() const { return batchDepth > 0; }
+
+    virtual void invalidateCache() { settings.clear(); }
+
+    // Asynchronous commands, run in order on the instrument's own I/O thread. Don't use the instrument directly while any are pending
+    std::future<void> submit(std::function<void()> command, double settleSeconds = 0);
+    void waitForCommands();
+
+private:
+    // Last value written to each setting, keyed by SCPI header, so writes that change nothing can be skipped. See writeSetting
+    std::map<std::string, std::string> settings;
+
+    // Command batch, see beginBatch. Commands written while batching are joined into batchedCommands and sent once it is full or ends
+    int batchDepth = 0;
+    bool batchSync = false;
+    std::string batchedCommands;
+    int batchedCount = 0;
+
+    // I/O thread of submit, started by the first asynchronous command
+    std::thread ioWorker;
+    std::mutex ioMutex;
+    std::condition_variable ioCondition;
+    std::deque<std::packaged_task<void()>> ioQueue;
+    int ioRunning = 0; // Commands taken off ioQueue and not finished yet
+    bool ioStopping = false;
+    uint64_t sentLines = 0; // Lines sent to a connected instrument, so a command that only hit the cache skips its settling
+
+    void commandWorker();
+
+    ViStatus send(const std::string& command);
+    ViStatus flushBatch();
+    std::string query(std::string query);
+    std::string readError();
+};
+
+/**
+ * @brief Scoped command batch on one instrument. Commands sent through the instrument until commit() are pipelined and the error queue is
+ * checked once at commit(), see Instrument::beginBatch. A batch left without commit(), e.g. by an exception, is abandoned: commands not yet
+ * sent are dropped and the error queue is left for the next check.
+ *
+ */
+class CommandBatch {
+public:
+    CommandBatch(Instrument& instrument, bool syncCompletion = false);
+    ~CommandBatch();
+
+    std::string commit();
+
+private:
+    Instrument& instrument;
+    bool open;
 };
 
 #endif // INST_H
\ No newline at end of file
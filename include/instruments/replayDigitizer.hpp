@@ -0,0 +1,90 @@
+/**
+ * @file replayDigitizer.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for ReplayDigitizer, an acquisition source that plays a raw stream recording back through the pipeline.
+ * @version 0.1
+ * @date 2023-11-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef REPLAYDIGITIZER_H
+#define REPLAYDIGITIZER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Acquisition source that memory-maps a recording written by StreamRecorder (see AcquisitionSource::startRecording) and delivers its
+ * buffers straight out of the mapping, one recorded step per AcquireDataMultithreadedContinuous call. Buffers are paced to rateFactor times
+ * the recorded sample rate (1 is the native rate) or delivered as fast as the pipeline takes them (0). The buffers of a packed recording are
+ * indexed when it is mapped, and REPLAY_DECODE_THREADS threads unpack up to REPLAY_DECODE_AHEAD buffers ahead of delivery in parallel.
+ * A replayed step ends when the decision making stops it, at the fixed horizon, or when its recorded buffers run out, so policies compared
+ * on one recording should stop no later than the policy that recorded it (record with a static run).
+ * Function definitions and documentation are in replayDigitizer.cpp.
+ *
+ */
+class ReplayDigitizer : public AcquisitionSource {
+public:
+    ReplayDigitizer(const std::string& path, double rateFactor = 0);
+    ~ReplayDigitizer();
+
+    void setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition=1, double inputRange=0.8, double inputImpedance=50,
+                                  U32 bufferCount=BUFFER_COUNT) override;
+    void AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) override;
+
+    size_t numSteps() const { return steps.size(); }
+    U32 stepBuffers(size_t step) const { return steps.at(step).numBuffers; }
+    void readBuffer(size_t step, U32 buffer, unsigned short* samples) const;
+    void rewind() { nextStep = 0; }
+
+    double rateFactor; // Playback speed over the recorded sample rate. 0 delivers as fast as possible
+
+private:
+    /**
+     * @brief One recorded step inside the mapping.
+     */
+    struct Step {
+        RecordedStepHeader header;
+        const unsigned short* buffers;
+        U32 numBuffers; // Complete buffers in the recording
+        std::vector<const char*> packedBuffers; // PackedBufferHeader of every buffer, packed recordings only
+    };
+
+    std::string path;
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+    const char* view = nullptr;
+    size_t fileSize = 0;
+
+    RecordingHeader header;
+    size_t bytesPerBuffer = 0;
+    bool packed = false;
+    std::vector<Step> steps;
+    size_t nextStep = 0;
+
+    // Unpacking of the step being replayed. Buffer i is unpacked into slot i % REPLAY_DECODE_AHEAD once buffer i - REPLAY_DECODE_AHEAD is released
+    std::vector<std::thread> unpackThreads;
+    std::mutex unpackMutex;
+    std::condition_variable unpackCondition;
+    std::vector<std::vector<unsigned short>> unpacked;
+    std::vector<bool> unpackedReady;
+    const Step* unpackStep = nullptr;
+    U32 unpackEnd = 0, nextUnpack = 0, buffersReleased = 0;
+    bool unpackStopping = false;
+    std::string unpackFailure;
+
+    void mapRecording();
+    void unmapRecording();
+    void indexSteps();
+    U32 recoverOpenStep(size_t offset, U32 stepIndex, size_t available, bool& followed) const;
+    size_t indexPackedStep(size_t offset, Step& step, bool& complete) const;
+
+    void startUnpacking(const Step& step, U32 numBuffers);
+    void unpackLoop();
+    const unsigned short* unpackedBuffer(U32 buffer);
+    void releaseBuffer(U32 buffer);
+    void stopUnpacking();
+};
+
+#endif // REPLAYDIGITIZER_H
@@ -0,0 +1,83 @@
+/**
+ * @file simulatedDigitizer.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for SimulatedDigitizer, a synthetic acquisition source for benchmarking the pipeline without the ATS9462.
+ * @version 0.1
+ * @date 2023-11-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SIMULATEDDIGITIZER_H
+#define SIMULATEDDIGITIZER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Signal model of the SimulatedDigitizer. Frequencies of the gain ripple and bad bins are fixed in the band, while the axion-like line
+ * sits at a fixed RF frequency and moves through the band as the receiver is stepped.
+ *
+ */
+struct SimulationParameters {
+    double rateFactor = 1;          // Deliver buffers at rateFactor times the real-time rate of the sample clock. 0 delivers them as fast as they are generated
+
+    double noiseAmplitude = 0.05;   // RMS white noise per channel, V
+    double gainRippleDepth = 0.1;   // Relative depth of the ripple of the noise power across the band
+    double gainRipplePeriod = 2e6;  // Period of the ripple across the band, Hz
+
+    double lineFrequency = 5209.3;  // RF frequency of the injected axion-like line, MHz
+    double lineAmplitude = 5e-4;    // Amplitude of the line, V. 0 disables it
+    double lineWidth = 5e3;         // Lorentzian FWHM of the line, Hz
+
+    std::vector<double> badBinOffsets = { -5.12e6, 2.56e6 }; // Narrow spurs, in Hz from the center of the band. Multiples of the RBW stay in one bin
+    double badBinAmplitude = 0.01;  // Amplitude of each spur, V
+
+    unsigned long long seed = 1;
+};
+
+/**
+ * @brief Acquisition source that synthesizes the two-channel U16 buffers of the ATS9462 (channel A followed by channel B, 0x8000 at 0 V) at
+ * a configurable rate. Channels A and B are the in-phase and quadrature parts of complex white noise with a gain ripple, plus an axion-like
+ * line and bad-bin spurs. Buffers go through the same step delivery as the board's DMA buffers, so the whole pipeline can be benchmarked and
+ * profiled on any machine. One step is generated per AcquireDataMultithreadedContinuous call, there is no persistent streaming session.
+ * Function definitions and documentation are in simulatedDigitizer.cpp.
+ *
+ */
+class SimulatedDigitizer : public AcquisitionSource {
+public:
+    SimulatedDigitizer(SimulationParameters simulationParams = SimulationParameters());
+    ~SimulatedDigitizer(){};
+
+    void setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition=1, double inputRange=0.8, double inputImpedance=50,
+                                  U32 bufferCount=BUFFER_COUNT) override;
+    void AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) override;
+
+    SimulationParameters simulationParams;
+
+private:
+    /**
+     * @brief Narrow tone at a fixed offset from the center of the band. Its phase random walks to give a Lorentzian of FWHM width.
+     */
+    struct Tone {
+        double frequency;
+        double amplitude;
+        double width;
+        double phase;
+    };
+
+    std::vector<Tone> tones;
+    U32 rippleDelay = 0; // Delay in samples of the noise echo that makes the gain ripple
+
+    // Generation scratch. The noise vectors start with the last rippleDelay noise samples of the previous buffer
+    std::vector<double> noiseA, noiseB;
+    std::vector<double> voltsA, voltsB;
+    std::vector<unsigned short> samples;
+    unsigned long long randomState;
+
+    void prepareStep();
+    void generateBuffer();
+    double gaussian();
+};
+
+#endif // SIMULATEDDIGITIZER_H
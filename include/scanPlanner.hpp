@@ -0,0 +1,78 @@
+/**
+ * @file scanPlanner.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for ScanPlanner, which picks the next center frequency of a scan by the exclusion it is expected to gain.
+ * @version 0.1
+ * @date 2023-11-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SCANPLANNER_H
+#define SCANPLANNER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Plans a scan over the windows a fixed scan of numSteps steps of stepSize would visit, in whatever order reaches the target coupling
+ * across the band in the least time. The windows are kept in a priority queue by the exclusion a step on them is expected to gain per second:
+ * each bin of a window is predicted to take up as much coeffSumA of the BayesFactors as the same bin of the receiver window took per second in
+ * the steps so far, which also captures bins lost to bad bins or low SNR, and the exclusion line it would then reach is weighed by how far it
+ * still is above the target. Windows the DecisionAgent stopped early on, or that are only partly covered, keep a high gain and are revisited,
+ * backward moves included. Only the windows overlapping the last step change, so only those are requeued.
+ * Run it with ScanRunner::runPlannedScan. Function definitions and documentation are in scanPlanner.cpp.
+ *
+ */
+class ScanPlanner {
+public:
+    ScanPlanner(double stepSize, int numSteps, double targetCoupling);
+
+    void beginStep(const BayesFactors& bayesFactors);
+    void endStep(const BayesFactors& bayesFactors, double stepTime);
+    int nextWindow();
+
+    int window() const { return currentWindow; }
+    int windows() const { return numWindows; }
+    double excludedFraction(const BayesFactors& bayesFactors) const;
+
+    double stepSize; // MHz between neighbouring windows
+    double minGain = SCAN_PLAN_MIN_GAIN; // Expected gain, in bins, below which a window is done
+
+private:
+    struct QueuedWindow {
+        double gainRate; // Expected gain per second
+        int window;
+        uint64_t version; // Stale once versions[window] moved on
+
+        // Highest gain rate first, then the lowest window, so untouched windows are taken in order
+        bool operator<(const QueuedWindow& other) const {
+            return (gainRate != other.gainRate) ? gainRate < other.gainRate : window > other.window;
+        }
+    };
+
+    void initGeometry(const BayesFactors& bayesFactors);
+    long long windowFirstBin(int window) const;
+    double expectedGain(const BayesFactors& bayesFactors, int window) const;
+    void requeue(const BayesFactors& bayesFactors, int first, int end);
+
+    int numWindows;
+    double targetCoupling;
+    int currentWindow = 0;
+
+    // Fixed once the first step initialized the exclusion line
+    long long originBin = -1; // Exclusion line bin of window 0, -1 until the exclusion line is initialized
+    size_t windowSize = 0;
+    double freqRes = 0; // MHz
+    long long bandFirst = 0, bandEnd = 0; // Exclusion line bins the band covers, from the center of the first window to that of the last
+
+    std::vector<double> startCoeffA; // coeffSumA of the current window at beginStep
+    std::vector<double> uptakeRate; // coeffSumA taken up per second by each bin of the receiver window, averaged over the steps
+    double meanStepTime = 0; // s
+    int observedSteps = 0;
+
+    std::priority_queue<QueuedWindow> queue;
+    std::vector<uint64_t> versions;
+};
+
+#endif // SCANPLANNER_H
@@ -26,25 +26,85 @@
 
 class ScanRunner {
 public:
-    ScanRunner(double maxIntegrationTime, int scanType = NO_FAXION, int decisionMaking = 0);
+    ScanRunner(double maxIntegrationTime, int scanType = NO_FAXION, int decisionMaking = 0, int acquisitionBackend = ACQUISITION_ATS,
+               std::string recordingPath = "");
     ~ScanRunner();
 
     void setTarget(double targetCoupling);
 
     void acquireData();
     void unrolledAcquisition();
+    void planScan(double stepSize, int numSteps);
+    int runPlannedScan(ScanPlanner& planner, int maxSteps);
     void step(double stepSize);
+    void waitForProcessing();
     void saveData(int dynamicFlag = 0);
     void flushData();
 
+    void startRecording(const std::string& path, int codec = RECORDING_CODEC_NONE);
+    void stopRecording();
+    void captureDecisionStream(DecisionStream* stream);
+
+    void openArchive(const std::string& path, int contents = ARCHIVE_DEFAULT, int compressionLevel = ARCHIVE_COMPRESSION);
+    void closeArchive();
+
+    void enableCheckpoints(const std::string& path);
+    bool resumeFromCheckpoint(const std::string& path);
+    int stepsCompleted() const { return scanStepIndex; }
+
+    void startTelemetry(const std::string& name = TELEMETRY_NAME, double rateHz = TELEMETRY_RATE_HZ);
+    void stopTelemetry();
+
+    void startTrace(const std::string& path);
+    void stopTrace();
+
     void refreshBaselineAndBadBins(int repeats = 3, int subSpectra = 32, int savePlots = 0);
+    void startBaselineRefresh(double intervalSeconds = BASELINE_REFRESH_INTERVAL, int minSpectra = BASELINE_REFRESH_MIN_SPECTRA);
+    void stopBaselineRefresh();
+
+    std::vector<std::vector<double>> acquireListSweep(int psgIndex, const std::vector<double>& frequencies, const std::vector<double>& powers,
+                                                      int spectraPerPoint, int settleSpectra = 1);
 
+    void retainCombinedSpectrum(double windowMHz, const std::string& spillDirectory = "");
     std::vector<std::vector<double>> retrieveRawData();
     std::vector<double> retrieveRawAxis();
+    SimulatedDigitizer* simulatedDigitizer() { return dynamic_cast<SimulatedDigitizer*>(alazarCard.get()); }
+    ReplayDigitizer* replayDigitizer() { return dynamic_cast<ReplayDigitizer*>(alazarCard.get()); }
+
+    void addDigitizer(std::unique_ptr<AcquisitionSource> source, double bandOffset, DWORD_PTR affinityMask = 0);
+    void addDigitizer(U32 systemId, U32 boardId, double bandOffset, DWORD_PTR affinityMask = 0);
+    void pinDigitizer(int digitizer, DWORD_PTR affinityMask);
+    int digitizerCount() const { return 1 + (int)digitizers.size(); }
+    AcquisitionSource* digitizer(int digitizer) { return (digitizer == 0) ? alazarCard.get() : digitizers[digitizer - 1]->source.get(); }
+
+    void setDownConversion(int decimation, double offsetMHz = 0);
+    int spectrumLength() const { return (int)alazarCard->samplesPerSpectrum(); }
+
+    void setWelch(int window, double overlap = WELCH_OVERLAP);
+    void reconfigure(double maxIntegrationTime, double RBW, int subSpectraAveragingNumber);
+    int segmentsPerAverage() const { return subSpectraAveragingNumber*welchSegments; }
+
+    void setThreadPlacement(const ThreadPlacement& placement);
+    const ThreadPlacement& getThreadPlacement() const { return threadPlacement; }
 
 
     // Public parameters
     int subSpectraAveragingNumber;
+    int minSubSpectra, maxSubSpectra; // Adaptive batch bounds of the averaging stages, 0 keeps subSpectraAveragingNumber. Single digitizer only
+    int FFTBatchSize; // Spectra transformed per batched FFTW plan call. Changes take effect on the next acquisition
+    int FFTWorkerCount; // FFTThread workers per acquisition, or planner threads per transform with FFTW_THREADED_PLANNER
+    int processingWorkerCount; // processingWorker threads per acquisition. 1 runs the serial processingThread
+    int fusedAveraging; // Use accumulationThread in place of magnitudeThread + averagingThread
+    int fftBackend; // FFT_BACKEND_* of the FFT stage. Device backends run one transformAccumulationThread per chain, FFTBatchSize spectra per batch
+    int persistentStreaming; // Keep the digitizer armed between steps instead of re-arming it for every acquisition
+    int ringWaitStrategy; // RING_WAIT_BLOCKING or RING_WAIT_SPIN for the rings between pipeline stages
+    int persistentPipeline; // Keep the pipeline threads alive across acquireData steps instead of creating them for every step
+    int pipelinedScan; // Return from acquireData once acquisition stops and finish processing the step while the next one is acquired
+    int backpressurePolicy, spillDepth; // BACKPRESSURE_* policy of the processing stages, and items held under BACKPRESSURE_DROP_OLDEST
+    int backupPolicy, backupDepth; // Backup retention for acquisition buffers, see BACKUP_* in decs.hpp
+    int dmaBufferAllocation; // ALLOCATE_* flags of the DMA buffers. Takes effect the next time the board is armed
+    int poolBufferAllocation; // ALLOCATE_* flags of the FFT input and output pools. Changes re-allocate the pools on the next acquisition
+    int productionMode; // Processing stages only make what the exclusion line needs. saveData still rebuilds its spectra from the raw ones
     DecisionAgent decisionAgent;
 
     double xModeFreq, yModeFreq;
@@ -62,6 +122,10 @@ private:
     double sampleRate, RBW;
     double trueCenterFreq;
     int maxSpectraPerAcquisition;
+    int decimationFactor = 1; // Downconversion ahead of the FFT, see setDownConversion
+    double downconversionOffset = 0; // MHz
+    int welchWindow = WELCH_WINDOW_RECTANGULAR; // Welch segments of the FFT stage, see setWelch
+    int welchSegments = 1; // Segments per buffer
 
     // Filter Parameters
     double cutoffFrequency, stopbandAttenuation;
@@ -69,27 +133,142 @@ private:
 
     // Misc variables
     int scanType;
-    const char* wisdomFilePath;
 
     // Member classes
     PSG psgList[NUM_PSGS];
-    ATS alazarCard;
+    std::unique_ptr<AcquisitionSource> alazarCard; // ATS, or the SimulatedDigitizer or ReplayDigitizer of the other acquisition backends
+    WisdomStore wisdomStore;
+    CalibrationStore calibrationStore; // Shared with the other executables, preferred over the CSV files
     fftw_plan fftwPlan;
+    fftw_plan fftwBatchPlan = NULL;
+    int fftwBatchPlanSize = 0;
+    int fftwBatchPlanLength = 0; // Spectrum length the batched plan and the pools were made for
+    pipeline_plan pipelinePlan = NULL, pipelineBatchPlan = NULL; // Plans for the acquisition pipeline. Alias the plans above unless SINGLE_PRECISION_PIPELINE
+    std::unique_ptr<FFTBackend> pipelineBackend; // Device FFT backend of the primary chain, null with FFT_BACKEND_FFTW
+    int pipelineBackendType = FFT_BACKEND_FFTW; // fftBackend the backends were made for
     DataProcessor dataProcessor;
+    std::vector<double> storedBaseline; // Calibrated baseline as last loaded or saved, restored by flushData without reading it again
+    std::unique_ptr<BaselineRefresher> baselineRefresher; // Background baseline of dataProcessor, see startBaselineRefresh
+
+    // Digitizers after the primary alazarCard, see addDigitizer. Each one has its own acquisition, FFT, accumulation and processing chain, and
+    // the chains' spectra are merged by absolute frequency before the decision stage
+    struct Digitizer {
+        std::unique_ptr<AcquisitionSource> source;
+        double bandOffset = 0; // MHz from trueCenterFreq to the center of the digitizer's band
+        DWORD_PTR affinityMask = 0; // Cores the chain's threads are pinned to, 0 for any
+        DataProcessor processor; // Bad bins and running average of the chain. Takes the baseline and SNR of dataProcessor every step
+        BufferPool dataPool, FFTPool;
+        std::unique_ptr<FFTBackend> backend; // Device FFT backend of the chain, null with FFT_BACKEND_FFTW
+    };
+    std::vector<std::unique_ptr<Digitizer>> digitizers;
+    DWORD_PTR primaryAffinityMask = 0; // Cores the primary digitizer's chain is pinned to once there are several digitizers, 0 for any
+    ThreadPlacement threadPlacement; // Cores, priority and MMCSS task of the pipeline threads by role, see setThreadPlacement
+
+    // Shared data of one extra digitizer's chain for one step. Its flags are linked to the step's syncFlags
+    struct DigitizerStepData {
+        SharedDataBasic dataBasic;
+        SharedDataProcessing dataProc;
+        SharedDataSaving savedData; // Only reset with the step, the decision stage belongs to the primary chain
+        SynchronizationFlags syncFlags;
+    };
+
+    // Recycled buffers for the acquisition -> FFT -> magnitude hand-offs
+    BufferPool dataPool, FFTPool;
 
     // Threaded structs
     SavedData savedData;
+    long long combinedRetentionBins = 0; // Retention window of savedData.combinedSpectrum, see retainCombinedSpectrum
+    std::string combinedSpillDirectory;
     BayesFactors bayesFactors;
+    DecisionStream* decisionStream = nullptr; // Set by captureDecisionStream
+
+    // Shared data and long-lived threads of one acquireData step. The pipeline is declared last so its threads stop first
+    struct StepSlot {
+        SharedDataBasic dataBasic;
+        SharedDataProcessing dataProc;
+        SharedDataSaving savedData;
+        SynchronizationFlags syncFlags;
+
+        int stepIndex = 0; // Scan step running in this slot, used to keep stages in step order
+        double centerFreq = 0; // trueCenterFreq when the step was acquired
+        double deferredStepSize = 0; // BayesFactors step to apply before this step's decisions (pipelinedScan)
+        bool inFlight = false; // Acquisition has finished but the processing tail may still be running (pipelinedScan)
+
+        // Set under forecastMutex when the decision agent forecasts a stop and when the acquisition body returns (pipelinedScan)
+        bool stopForecast = false, acquisitionEnded = false;
+
+        // Shared data already reset and rings already set up for the next step by prepareNextStep, with this layout
+        bool prepared = false;
+        int preparedWorkers = 0, preparedProcessingWorkers = 0, preparedWaitStrategy = 0;
+
+        // Shared data of the extra digitizers' chains, one per entry of digitizers, used by the pipeline below
+        std::vector<std::unique_ptr<DigitizerStepData>> digitizerData;
+
+        Pipeline pipeline;
+        int workers = 0, fused = -1, processingWorkers = 0; // Stage layout the persistent pipeline was built with
+        int backend = FFT_BACKEND_FFTW;
+        int builtDigitizers = 0; // Extra digitizers the persistent pipeline was built with
+        std::vector<size_t> acquisitionBodies; // Pipeline bodies that acquire, the primary digitizer's (body 0) first
+
+        QueueGauges queueGauges; // Depth and throughput of this slot's rings, sampled live for the telemetry and when the step finishes
+    };
+
+    // Scan archive, see openArchive. Declared ahead of the step slots so the pipeline threads writing to it stop first
+    std::unique_ptr<HDF5DataWriter> archive;
+
+    // Live telemetry for monitoring clients, see startTelemetry. Also declared ahead of the step slots
+    std::unique_ptr<TelemetryPublisher> telemetry;
+
+    // Chrome trace written by stopTrace, empty while not tracing
+    std::string tracePath;
+
+    // Writes a checkpoint of the scan after every step while set, see enableCheckpoints
+    std::unique_ptr<ScanCheckpointWriter> checkpointWriter;
+
+    // Steps alternate between the slots when pipelinedScan is set, otherwise only slot 0 is used
+    StepSlot stepSlots[2];
+    StepSequencer stepSequencer;
+    int scanStepIndex = 0;
+    double pendingStepSize = 0; // step() sizes not yet applied to bayesFactors (pipelinedScan)
+    std::mutex forecastMutex;
+    std::condition_variable forecastCondition;
+    std::future<void> retune; // Probe PSG retune queued by step(), settling while the next acquisition is set up
+
+    // Single spectrum plans of every length planned so far, owned here so reconfigure can go back to a length without planning it again
+    struct SpectrumPlans {
+        fftw_plan plan;
+        pipeline_plan pipelinePlan; // plan itself unless SINGLE_PRECISION_PIPELINE
+    };
+    std::map<int, SpectrumPlans> spectrumPlans;
 
 
     // Private methods
     void initPSGs();
+    void settleInstruments();
     void initAlazarCard();
     void initFFTW();
+    void selectSpectrumPlan();
+    void initBatchedFFTW();
+    bool batchedFFTStale() const { return FFTBatchSize != fftwBatchPlanSize || poolBufferAllocation != dataPool.allocation() || fftBackend != pipelineBackendType
+                                          || fftwBatchPlanLength != spectrumLength(); }
+    void buildPipeline(Pipeline& pipeline, SharedDataBasic& sharedDataBasic, SharedDataProcessing& sharedDataProc, SharedDataSaving& sharedSavedData, 
+                       SynchronizationFlags& syncFlags, int numFFTWorkers, int numProcessingWorkers, bool fused, StepSlot* orderedSlot = nullptr,
+                       std::vector<std::unique_ptr<DigitizerStepData>>* digitizerData = nullptr);
+    void prepareDigitizerData(StepSlot& slot, int numFFTWorkers, bool resetRings);
+    void tileDecisionSNR();
+    std::vector<double> spectrumFrequencies() const;
+    void acquirePipelinedStep(int numFFTWorkers);
+    void prepareNextStep(int numFFTWorkers, int numProcessingWorkers);
+    void finishStep(StepSlot& slot);
+    void checkpointScan();
     void initProcessor();
+    void loadProcessorFiles();
+    void publishCalibration();
+    void pickUpCalibration();
     void initDecisionAgent(int decisionMaking);
 
     void acquireProcCalibration(int repeats = 3, int subSpectra = 32, int savePlots = 0);
+    void acquireCalibrationStatistics(CalibrationStatistics& calibration, int repeats);
     void acquireProcCalibrationMulti(int repeats = 3, int subSpectra = 32, int savePlots = 0);
 };
 
@@ -1,82 +1,103 @@
 /**
  * @file HDF5DataWriter.hpp
  * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
- * @brief Class for HDF5 file I/O system
- * @version 0.1
- * @date 2023-06-30
- * 
+ * @brief Class definition for HDF5DataWriter, the HDF5 archive of a scan written asynchronously by its own thread.
+ * @version 0.2
+ * @date 2023-11-25
+ *
  * @copyright Copyright (c) 2023
- * 
- * @warning This class is not currently used in the project. It is a work in progress.
- * 
+ *
  */
 
+#ifndef HDF5DATAWRITER_H
+#define HDF5DATAWRITER_H
+
 #include "decs.hpp"
 
+/**
+ * @brief One HDF5 file per scan. Each kind of record selected by contents (ARCHIVE_* flags) has its own group:
+ *   /rawBuffers        samples      (buffers, 2*samplesPerBuffer) U16 codes, channel A then channel B
+ *   /averagedSpectra   powers       (spectra, bins)
+ *   /combinedSpectrum  powers, sigmaCombined, weightSum  (snapshots, bins)
+ *   /exclusionLines    powers       (steps, bins), one snapshot at the end of every step's decisions
+ *   /metrics           one 1D dataset per metric of timing.cpp, rewritten by every writeMetrics
+ * Every group except /metrics also holds step and centerFreq datasets with one entry per row, and the widest frequency axis written to it as
+ * axis. centerFreq is the receiver center frequency in MHz the row's axis is relative to, 0 for the absolute axis of the exclusion lines.
+ * Datasets are chunked and extensible in both dimensions, rows narrower than the dataset are padded with NaN.
+ *
+ * The write methods copy the record into a queue and return at once, so callers in the pipeline never wait on the disk. The writer thread
+ * empties the queue into the file, optionally compressed. A record that would take the queue past maxQueuedBytes is dropped and counted
+ * instead of blocking, so size the queue for the slowest stretch the disk has to absorb.
+ * Function definitions and documentation are in HDF5DataWriter.cpp.
+ *
+ */
 class HDF5DataWriter {
 public:
-    HDF5DataWriter(std::string filename) : file_(filename, H5F_ACC_TRUNC), rootGroup_(file_.createGroup("/")) {}
-
-    void saveData(fftw_complex* rawData, 
-                //   fftw_complex* fftData, 
-                  std::string groupName,
-                  hsize_t numSamples) {
+    HDF5DataWriter(const std::string& filename, int contents = ARCHIVE_DEFAULT, size_t maxQueuedBytes = ARCHIVE_QUEUE_BYTES,
+                   int compressionLevel = ARCHIVE_COMPRESSION);
+    ~HDF5DataWriter();
 
-        H5::Group* group = new H5::Group( file_.createGroup( groupName.c_str() ));
+    bool archives(int content) const { return (contents & content) != 0; }
 
-        hsize_t dims[2] = {2, numSamples};
-        H5::DataSpace dataspace(2, dims);
+    bool writeRawBuffer(const unsigned short* samples, size_t numSamples, int step, double centerFreq);
+    bool writeSpectrum(int content, const Spectrum& spectrum, int step);
+    bool writeCombinedSpectrum(const CombinedSpectrum& spectrum, int step);
+    bool writeMetrics();
+    void close();
 
-        std::string datasetName = groupName + "/rawData";
-        H5::DataSet rawDataSet = file_.createDataSet(datasetName, H5::PredType::NATIVE_DOUBLE, dataspace);
-        // H5::DataSet fftDataSet = experimentGroup.createDataSet("FFTData", H5::PredType::NATIVE_DOUBLE, dataspace);
-
-        rawDataSet.write(rawData, H5::PredType::NATIVE_DOUBLE);
-        // fftDataSet.write(fftData.data(), H5::PredType::NATIVE_DOUBLE);
-    }
+    size_t droppedRecords() const { return dropped.load(); }
 
 private:
-    H5::H5File file_;
-    H5::Group rootGroup_;
+    /**
+     * @brief Copy of one record waiting for the writer thread.
+     */
+    struct Record {
+        int content;
+        int step = 0;
+        double centerFreq = 0;
+        std::vector<std::pair<std::string, std::vector<double>>> arrays; // Datasets of the group and the row to append to each
+        std::vector<double> axis;
+        std::vector<unsigned short> samples;
+
+        size_t bytes() const;
+    };
+
+    /**
+     * @brief Open group of one ARCHIVE_* content, with the datasets created so far.
+     */
+    struct Group {
+        H5::Group group;
+        std::map<std::string, H5::DataSet> datasets;
+        hsize_t axisSize = 0;
+    };
+
+    std::string filename;
+    H5::H5File file;
+    int contents;
+    size_t maxQueuedBytes;
+    int compressionLevel;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Record> queue;
+    size_t queuedBytes = 0;
+    bool closing = false;
+    std::atomic<size_t> dropped{0};
+    std::thread writerThread;
+
+    // Writer thread only
+    std::map<int, Group> groups;
+    size_t recordsWritten = 0;
+    bool failed = false;
+
+    bool enqueue(Record&& record);
+    void writerLoop();
+    void writeRecord(const Record& record);
+
+    Group& openGroup(int content);
+    H5::DataSet& openDataset(Group& group, const std::string& name, int rank, const H5::PredType& type);
+    void appendRow(H5::DataSet& dataset, int rank, const void* data, hsize_t count, const H5::PredType& type);
+    void replaceData(H5::DataSet& dataset, const void* data, hsize_t count, const H5::PredType& type);
 };
 
-
-
-void saveDataToHDF5(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
-    HDF5DataWriter writer("test.h5");
-    int numSaved = 0;
-
-    while (true) {
-        // Check if data queue is empty
-        std::unique_lock<std::mutex> lock(sharedData.mutex);
-        sharedData.saveReadyCondition.wait(lock, [&sharedData]() {
-            return !sharedData.dataSavingQueue.empty();
-        });
-
-
-        // Process data if the data queue is not empty
-        while (!sharedData.dataSavingQueue.empty()) {
-            // Get the pointer to the data from the queue
-            fftw_complex* rawData = sharedData.dataSavingQueue.front();
-            sharedData.dataSavingQueue.pop();
-            lock.unlock();
-        
-            // Save the data to HDF5
-            writer.saveData(rawData, "testGroup", sharedData.samplesPerBuffer);
-            numSaved++;
-
-            // Free the memory allocated for the raw data
-            fftw_free(rawData);
-
-            lock.lock();  // Lock again before checking the data queue
-        }
-
-        // Check if the acquisition and saving is complete
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (syncFlags.acquisitionComplete && sharedData.dataSavingQueue.empty()) {
-                break;
-            }
-        }
-    }
-}
\ No newline at end of file
+#endif // HDF5DATAWRITER_H
@@ -0,0 +1,61 @@
+/**
+ * @file SNRProfile.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for SNRProfile, the SNR of the receiver with its trimmed windows cached by frequency window.
+ * @version 0.1
+ * @date 2023-11-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SNRPROFILE_H
+#define SNRPROFILE_H
+
+#include "decs.hpp"
+
+/**
+ * @brief SNR spectrum together with the windows of it that spectra get matched to. A window is the SNR bin of each bin of a spectrum, its SNR
+ * and the reciprocal of its SNR. It is built by a scan of the SNR axis the first time a frequency window is seen, and handed out by reference
+ * afterwards. The relative frequency window of a scan never changes, so after the first spectrum a lookup is a search in a map of a few
+ * entries rather than a scan of the SNR axis.
+ * Two matchings are available: aligned windows of consecutive SNR bins, for spectra on the SNR's own bins (DataProcessor::trimSNRtoMatch),
+ * and nearest-bin windows, for rebinned spectra (DecisionAgent::resizeSNRtoMatch).
+ * Function definitions and documentation are in SNRProfile.cpp.
+ *
+ * @warning Windows stay valid until the next load(). Copies of a profile have their own windows.
+ */
+class SNRProfile {
+public:
+    struct Window {
+        size_t size() const { return indices.size(); }
+
+        std::vector<int> indices;       // SNR bin of each bin of the window
+        std::vector<double> powers;     // SNR of each bin
+        std::vector<double> reciprocal; // 1/powers
+        FrequencyAxis freqAxis;         // SNR frequency of each bin
+    };
+
+    SNRProfile(){};
+
+    void load(const Spectrum& SNR);
+    bool empty() const { return SNR.powers.empty(); }
+    const Spectrum& spectrum() const { return SNR; }
+
+    const Window& alignedWindow(const FrequencyAxis& axis);
+    const Window& nearestWindow(const FrequencyAxis& axis);
+
+private:
+    // Matching, first frequency (aligned windows: SNR bin offset), last frequency (aligned windows: 0) and number of bins of the axis a window
+    // was built for, see keyFor
+    typedef std::tuple<int, double, double, size_t> WindowKey;
+
+    WindowKey keyFor(int matching, const FrequencyAxis& axis) const;
+    double SNRBinWidth() const;
+    Window& addWindow(const WindowKey& key, std::vector<int> indices);
+
+    Spectrum SNR;
+    std::map<WindowKey, Window> windows;
+};
+
+#endif // SNRPROFILE_H
@@ -0,0 +1,61 @@
+/**
+ * @file allocationTracker.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Heap allocation accounting behind the stage timers of timing.cpp, see allocationTracker.cpp.
+ * @version 0.1
+ * @date 2023-11-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLOCATIONTRACKER_H
+#define ALLOCATIONTRACKER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Allocations made through operator new by one thread since it started. Only ever grows, so the allocations of a span are the
+ *        difference of two snapshots.
+ *
+ */
+struct AllocationCounters {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+/**
+ * @brief Allocations of one stage timer, as printed by reportPerformance.
+ *
+ */
+struct AllocationSummary {
+    uint64_t items = 0;       // Timed items, as in LatencySummary::count
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t peakHeap = 0;     // Most bytes in use through operator new when an item of the stage finished
+};
+
+/**
+ * @brief Allocations of the items of one stage timer, which any number of threads record into at once. Recording is a few relaxed atomic adds.
+ * Function definitions are in allocationTracker.cpp.
+ *
+ */
+class AllocationStats {
+public:
+    void record(const AllocationCounters& item, int64_t heap);
+    AllocationSummary summary() const;
+    void reset();
+
+private:
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> peakHeap{0};
+};
+
+AllocationCounters threadAllocations();
+int64_t heapInUse();
+int64_t heapPeak();
+void resetHeapPeak();
+
+#endif // ALLOCATIONTRACKER_H
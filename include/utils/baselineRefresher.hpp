@@ -0,0 +1,76 @@
+/**
+ * @file baselineRefresher.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for BaselineRefresher, which recomputes the baseline from the running average in the background during a scan.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BASELINEREFRESHER_H
+#define BASELINEREFRESHER_H
+
+#include "decs.hpp"
+
+// Baseline published by BaselineRefresher. Never changed once published
+struct RefreshedBaseline {
+    std::vector<double> values;
+    uint64_t version = 0;
+    int numSpectra = 0; // Sub-spectra it was averaged from
+};
+
+/**
+ * @brief Tracks baseline drift during a scan without stopping it. A low priority thread asks the averaging stage for a snapshot of the source
+ * DataProcessor's running average every interval, averages the sub-spectra added since the previous snapshot, smooths them with the baseline
+ * filter as updateBaseline does, and publishes the result with an atomic pointer swap. Every DataProcessor following the refresher picks the
+ * newest baseline up at the start of its next spectrum (see DataProcessor::pickUpBaseline), so neither side takes a lock or waits. A running
+ * average that shrank or changed length, e.g. after resetBaselining or selectBand, restarts the window.
+ * Function definitions and documentation are in baselineRefresher.cpp.
+ *
+ */
+class BaselineRefresher {
+public:
+    BaselineRefresher(const DataProcessor& source, double intervalSeconds = BASELINE_REFRESH_INTERVAL, int minSpectra = BASELINE_REFRESH_MIN_SPECTRA);
+    ~BaselineRefresher();
+
+    BaselineRefresher(const BaselineRefresher&) = delete;
+    BaselineRefresher& operator=(const BaselineRefresher&) = delete;
+
+    void start();
+    void stop();
+
+    // Averaging side. Only copies the running average when the thread has asked for a snapshot
+    bool feeds(const DataProcessor* processor) const { return processor == source; }
+    void offerRunningAverage(const std::vector<double>& runningAverage, int numSpectra);
+
+    // Processing side
+    std::shared_ptr<const RefreshedBaseline> latest() const { return std::atomic_load(&published); }
+
+private:
+    struct Snapshot {
+        std::vector<double> average;
+        int numSpectra;
+    };
+
+    void run();
+    void refresh(const Snapshot& snapshot);
+
+    const DataProcessor* source;
+    ZeroPhaseFilter filter;
+    double interval; // s
+    int minSpectra;
+
+    std::atomic<bool> snapshotRequested{false};
+    std::shared_ptr<Snapshot> offered; // Swapped in by the averaging stage
+    std::shared_ptr<const RefreshedBaseline> published;
+    Snapshot previous = { {}, 0 }; // Window start, only used by the thread
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopping = false;
+};
+
+#endif // BASELINEREFRESHER_H
@@ -0,0 +1,56 @@
+/**
+ * @file binRepairPlan.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for BinRepairPlan, the precomputed bad bin and DC bin fills applied to every raw spectrum.
+ * @version 0.1
+ * @date 2023-11-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BINREPAIRPLAN_H
+#define BINREPAIRPLAN_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Bad bin and DC bin masking compiled once for a set of bins and a spectrum length, then applied in place to each spectrum.
+ * Bad bins are sorted into runs of consecutive bins whose fill sources (the bins BAD_BIN_FILL_OFFSET below and above, wrapping around) are
+ * consecutive too, so each run is one straight loop with no index arithmetic. Bad bin fills read the unmasked spectrum. The few sources that
+ * are themselves bad bins written earlier in the pass are copied out before it, so the whole mask is still a single pass.
+ * The DC bins are then replaced by the average of the two bins around them, after bad bin masking, as in DataProcessor::trimDC.
+ * apply() is const, so one plan can be used by several threads.
+ * Function definitions and documentation are in binRepairPlan.cpp.
+ *
+ */
+class BinRepairPlan {
+public:
+    BinRepairPlan(){};
+
+    void build(const std::vector<int>& badBins, const std::vector<int>& DCbins, size_t spectrumSize);
+    bool builtFor(const std::vector<int>& badBins, const std::vector<int>& DCbins, size_t spectrumSize) const;
+    size_t spectrumSize() const { return size; }
+
+    void apply(std::vector<double>& spectrum) const;
+
+private:
+    // Bins [first, first + length) are filled from [low, low + length) and [high, high + length). A source read from the staged copy has
+    // its offset into it in lowStaged/highStaged, -1 otherwise
+    struct Run {
+        int first, length;
+        int low, high;
+        int lowStaged, highStaged;
+    };
+
+    std::vector<Run> runs;
+    int stagedCount = 0;
+
+    int DCfirst = 0, DClength = 0;
+
+    // What the plan was built from
+    std::vector<int> sourceBadBins, sourceDCbins;
+    size_t size = 0;
+};
+
+#endif // BINREPAIRPLAN_H
@@ -0,0 +1,65 @@
+/**
+ * @file binSpill.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for BinSpill, the scratch file combined spectrum bins are flushed to once they leave the resident window.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BINSPILL_H
+#define BINSPILL_H
+
+#include "decs.hpp"
+
+/**
+ * @brief One bin of a CombinedSpectrumGrid as it is stored in a BinSpill.
+ *
+ */
+struct SpilledBin {
+    double power;
+    double weightSum;
+    double sigmaCombined;
+    int32_t numTraces;
+    int32_t padding;
+};
+
+static_assert(sizeof(SpilledBin) == 32, "Spilled bins must stay 8-byte aligned in the spill file");
+
+/**
+ * @brief Append-only file of SpilledBin records, read back through a read-only mapping of the whole file that is remapped whenever records
+ * were appended past it. The file is created with a unique name in the given directory and deleted when it is closed, so it only lives as
+ * long as the grids sharing it, e.g. a grid and the copy of it a checkpoint is being written from. Records are never overwritten, so every
+ * sharer can keep reading the records it knows about while another one appends. Thread safe.
+ * Function definitions and documentation are in binSpill.cpp.
+ *
+ */
+class BinSpill {
+public:
+    BinSpill(const std::string& directory);
+    ~BinSpill();
+
+    BinSpill(const BinSpill&) = delete;
+    BinSpill& operator=(const BinSpill&) = delete;
+
+    uint64_t append(const SpilledBin* bins, size_t count);
+    void read(uint64_t first, size_t count, SpilledBin* bins);
+
+    uint64_t size() const { return records.load(); }
+    const std::string& filePath() const { return path; }
+
+private:
+    std::string path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+    const SpilledBin* view = nullptr;
+    uint64_t mappedRecords = 0;
+    std::atomic<uint64_t> records{0};
+    std::mutex mutex;
+
+    void unmap();
+};
+
+#endif // BINSPILL_H
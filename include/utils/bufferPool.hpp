@@ -0,0 +1,64 @@
+/**
+ * @file bufferPool.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for BufferPool, a fixed-capacity pool of FFTW-aligned pipeline_complex buffers shared between pipeline stages.
+ * @version 0.1
+ * @date 2023-11-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Fixed-capacity pool of equally sized pipeline_complex buffers. Stages borrow a buffer with acquire() and hand it back with release(),
+ * so no allocation happens on the hot path and memory use is capped at capacity()*samplesPerBuffer() complex samples. When the pool is
+ * exhausted acquire() blocks, which applies backpressure to the producing stage instead of letting queues grow without bound.
+ * Buffers are reference counted so the same buffer can be shared by several consumers (see retain()); it only returns to the pool once
+ * every holder has released it. Retaining or releasing a buffer that is not borrowed from this pool throws.
+ * With ALLOCATE_* flags other than ALLOCATE_DEFAULT the buffers are carved out of one allocatePages slab, so a pool of FFT blocks can sit on 
+ * large pages without rounding every buffer up to a whole large page.
+ * Function definitions and documentation are in bufferPool.cpp.
+ *
+ */
+class BufferPool {
+public:
+    BufferPool(){};
+    ~BufferPool();
+
+    void allocate(int numBuffers, int samplesPerBuffer, int allocationFlags = ALLOCATE_DEFAULT);
+    void deallocate();
+    void reset();
+
+    pipeline_complex* acquire(int timeout_ms = -1);
+    void retain(pipeline_complex* buffer);
+    void release(pipeline_complex* buffer);
+
+    int capacity() const { return (int)buffers.size(); }
+    int samplesPerBuffer() const { return bufferSamples; }
+    int allocation() const { return requestedAllocation; } // ALLOCATE_* flags of the last allocate
+    int placement() const { return placedAllocation; } // ALLOCATE_* flags the buffers got
+    int available();
+
+private:
+    int slotOf(pipeline_complex* buffer) const;
+
+    std::mutex mutex;
+    std::condition_variable bufferReturnedCondition;
+
+    std::vector<pipeline_complex*> buffers;
+    std::vector<pipeline_complex*> freeBuffers;
+    std::vector<int> refCounts; // holders of each buffer, indexed like buffers
+    std::vector<std::pair<pipeline_complex*, int>> slotLookup; // buffers sorted by address with their index, when not carved from a slab
+
+    int bufferSamples = 0;
+    size_t bufferBytes = 0; // stride of the buffers in the slab
+    void* slab = nullptr; // allocatePages memory holding every buffer, nullptr if each buffer was pipeline_malloc'd
+    int requestedAllocation = ALLOCATE_DEFAULT, placedAllocation = ALLOCATE_DEFAULT;
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,89 @@
+/**
+ * @file calibrationStore.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for CalibrationStore, the versioned binary calibration that every executable maps instead of parsing CSV files.
+ * @version 0.1
+ * @date 2023-11-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef CALIBRATIONSTORE_H
+#define CALIBRATIONSTORE_H
+
+#include "decs.hpp"
+
+/**
+ * @brief First bytes of a calibration file. The header is followed by baselineBins baseline values, SNRBins SNR values, SNRBins SNR
+ * frequencies (MHz from the receiver frequency), all doubles, and last numBadBins int32_t bad bins.
+ *
+ */
+struct CalibrationHeader {
+    char magic[8];              // CALIBRATION_MAGIC
+    uint32_t version;           // CALIBRATION_VERSION
+    int32_t poleNumber;         // Filter the baseline was taken with, see DataProcessor::setFilterParams
+    uint64_t generation;        // Counts the calibrations published to the store, also in the file name
+    double sampleRate;          // Hz
+    double cutoffFrequency;     // Hz
+    double stopbandAttenuation; // dB
+    uint64_t baselineBins;
+    uint64_t SNRBins;
+    uint64_t numBadBins;
+};
+
+static_assert(sizeof(CalibrationHeader) == 72, "Calibration header must keep the arrays 8-byte aligned");
+
+/**
+ * @brief Calibration as it is published, see CalibrationStore::publish.
+ *
+ */
+struct Calibration {
+    std::vector<double> baseline;
+    std::vector<int> badBins;
+    std::vector<double> SNR, SNRFreqs;
+    double sampleRate = 0, cutoffFrequency = 0, stopbandAttenuation = 0;
+    int poleNumber = 0;
+};
+
+/**
+ * @brief Read-only mapping of the newest calibration in a store directory, shared by every process that maps it. Each publication is a new
+ * file calibration_<generation>.cal, written under a temporary name and renamed once complete, so the rename is the atomic version bump and a
+ * mapped generation never changes under its readers. refresh() moves the mapping on to a newer generation; old generations are deleted by
+ * later publications once nothing maps them any more. Not thread safe.
+ * Function definitions and documentation are in calibrationStore.cpp.
+ *
+ */
+class CalibrationStore {
+public:
+    CalibrationStore(const std::string& directory = CALIBRATION_STORE_DIRECTORY);
+    ~CalibrationStore();
+
+    CalibrationStore(const CalibrationStore&) = delete;
+    CalibrationStore& operator=(const CalibrationStore&) = delete;
+
+    bool refresh();
+    uint64_t publish(const Calibration& calibration);
+
+    bool empty() const { return view == nullptr; }
+    uint64_t generation() const { return empty() ? 0 : header().generation; }
+    const CalibrationHeader& header() const { return *reinterpret_cast<const CalibrationHeader*>(view); }
+
+    // Arrays of the mapped generation, valid until the next refresh
+    const double* baseline() const { return reinterpret_cast<const double*>(view + sizeof(CalibrationHeader)); }
+    const double* SNR() const { return baseline() + header().baselineBins; }
+    const double* SNRFreqs() const { return SNR() + header().SNRBins; }
+    const int32_t* badBins() const { return reinterpret_cast<const int32_t*>(SNRFreqs() + header().SNRBins); }
+
+private:
+    std::string directory;
+    HANDLE mappingHandle = NULL;
+    const char* view = nullptr;
+
+    uint64_t newestGeneration() const;
+    std::string generationPath(uint64_t generation) const;
+    bool map(uint64_t generation);
+    void unmap();
+};
+
+#endif // CALIBRATIONSTORE_H
@@ -0,0 +1,71 @@
+/**
+ * @file cancellationToken.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for CancellationToken, the broadcast stop signal shared by every thread of a pipeline step.
+ * @version 0.1
+ * @date 2023-11-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef CANCELLATIONTOKEN_H
+#define CANCELLATIONTOKEN_H
+
+#include "decs.hpp"
+
+/**
+ * @brief One-shot cancellation broadcast to every thread of a step. cancelled() is a single atomic load, so threads can check it on the hot
+ * path without taking a lock. Anything that sleeps on its own condition variable (a ring, a queue) subscribes a wake callback, which cancel()
+ * calls once so the sleeper re-checks its predicate at once instead of at its next timeout.
+ * Subscriptions end when their Subscription object is destroyed, and may safely outlive the token.
+ * Function definitions and documentation are in cancellationToken.cpp.
+ *
+ */
+class CancellationToken {
+private:
+    struct State {
+        std::atomic<bool> cancelled{false};
+        std::mutex mutex;
+        std::string reason;
+        std::map<size_t, std::function<void()>> subscribers;
+        size_t nextID = 0;
+    };
+
+public:
+    /**
+     * @brief Handle of one wake callback. Unsubscribes when destroyed or reset. Move-only.
+     */
+    class Subscription {
+    public:
+        Subscription(){};
+        Subscription(std::weak_ptr<State> state, size_t id) : state(state), id(id) {};
+        Subscription(Subscription&& other) noexcept { *this = std::move(other); }
+        Subscription& operator=(Subscription&& other) noexcept;
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+        ~Subscription() { reset(); }
+
+        void reset();
+
+    private:
+        std::weak_ptr<State> state;
+        size_t id = 0;
+    };
+
+    CancellationToken() : state(std::make_shared<State>()) {};
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    bool cancel(const std::string& reason);
+    bool cancelled() const { return state->cancelled.load(std::memory_order_acquire); }
+    std::string reason() const;
+    void reset();
+
+    Subscription subscribe(std::function<void()> wake);
+
+private:
+    std::shared_ptr<State> state;
+};
+
+#endif // CANCELLATIONTOKEN_H
@@ -0,0 +1,118 @@
+/**
+ * @file combinedSpectrumGrid.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for CombinedSpectrumGrid, the integer bin grid rescaled spectra are combined on.
+ * @version 0.1
+ * @date 2023-11-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COMBINEDSPECTRUMGRID_H
+#define COMBINEDSPECTRUMGRID_H
+
+#include "decs.hpp"
+
+struct Spectrum;
+struct CombinedSpectrum;
+
+/**
+ * @brief Weighted combination of rescaled spectra on a global grid of frequency bins. The first spectrum added fixes the grid origin f0 and
+ * the bin width df, and every later spectrum lands on global bins round((f - f0)/df), so finding its overlap is a subtraction instead of a
+ * search. The bins are stored with spare room at both ends that doubles whenever it runs out, so adding a spectrum costs O(spectrum width)
+ * amortized however far the scan has progressed, stepping up or down in frequency.
+ * Bins between two spectra that don't overlap are kept with no contributing traces. Combined spectra, e.g. those of other digitizers, are merged
+ * onto the same grid by their weights.
+ * With rebinning enabled the grid also keeps the weighted power and weight sums of every coarse bin of rebinningWidthC global bins, and updates
+ * only the coarse bins the newest spectrum touched. Rebinned spectra are a sliding convolution of convolutionWidthK coarse bins over those
+ * sums, computed with prefix sums, so a rebinned update also costs O(spectrum width).
+ * With a retention window set, bins farther than the window from the newest spectrum are flushed to a BinSpill and dropped from the storage,
+ * so the resident bins stay bounded over a scan of any width. Spilled bins are read back through the spill's mapping for toCombinedSpectrum,
+ * and faulted back into the storage if a spectrum lands on them again. The coarse sums of the rebinned view always stay resident.
+ * With a pyramid set, the grid also keeps the weighted sums of its bins rebinned by 2, 4, 8... global bins, each level summing pairs of the
+ * level below, and updates only the sums over the newest spectrum, so an add still costs O(spectrum width). A spectrum at any level, or a
+ * zoomed view that picks the level fitting a number of bins, then costs O(output bins) however wide the scan. The pyramid stays resident and
+ * takes about half the memory of the bins.
+ * Function definitions and documentation are in combinedSpectrumGrid.cpp.
+ *
+ */
+class CombinedSpectrumGrid {
+public:
+    CombinedSpectrumGrid(int rebinningWidthC = 0, int convolutionWidthK = 1, int pyramidLevels = 0);
+
+    void add(const Spectrum& rescaledSpectrum, const std::vector<double>& SNR, double weight = 1);
+    void merge(const CombinedSpectrum& combinedSpectrum);
+    CombinedSpectrum toCombinedSpectrum() const;
+    void clear();
+
+    void setRebinning(int rebinningWidthC, int convolutionWidthK);
+    void setRetention(long long residentBins, const std::string& spillDirectory = "");
+    CombinedSpectrum rebinnedSpectrum() const;
+    CombinedSpectrum rebinnedUpdate() const;
+
+    void setPyramid(int levels);
+    int pyramidLevels() const { return (int)pyramid.size(); }
+    CombinedSpectrum pyramidSpectrum(int level, double firstFreq = -INFINITY, double lastFreq = INFINITY) const;
+    CombinedSpectrum zoomedSpectrum(double firstFreq, double lastFreq, size_t maxBins) const;
+
+    static void convolveCoarseBins(const std::vector<double>& weightedPowers, const std::vector<double>& weights, int rebinningWidthC, 
+                                   int convolutionWidthK, CombinedSpectrum& rebinnedSpectrum);
+
+    bool empty() const { return endBin == firstBin; }
+    size_t size() const { return (size_t)(endBin - firstBin); }
+    size_t residentSize() const { return powers.size(); }
+    size_t spilledSize() const;
+
+private:
+    friend class ScanCheckpoint; // Saves and restores every field, see scanCheckpoint.hpp
+
+    long long placeSpectrum(const Spectrum& spectrum);
+    void spectrumAdded(long long first, long long end);
+    void reserveBins(long long first, long long end);
+    void updateCoarseBins(long long first, long long end);
+    CombinedSpectrum rebinnedWindows(long long firstWindow, long long endWindow) const;
+    long long coarseIndex(long long bin) const;
+    void retain();
+    void updatePyramid(long long first, long long end);
+    void spillBins(long long first, long long end);
+    std::vector<SpilledBin> spilledChunk(long long chunkFirst) const;
+    SpilledBin binAt(long long bin) const;
+    int tracesAt(long long bin) const { return binAt(bin).numTraces; }
+
+    double gridOrigin = 0; // Absolute frequency of global bin 0
+    double binWidth = 1;
+
+    // Global bins [firstBin, endBin) hold data, the storage covers [storageFirstBin, storageFirstBin + powers.size())
+    long long firstBin = 0, endBin = 0;
+    long long storageFirstBin = 0;
+
+    std::vector<double> powers;
+    std::vector<double> weightSum;
+    std::vector<double> sigmaCombined;
+    std::vector<int> numTraces;
+
+    // Rebinned view, disabled while rebinningWidthC is 0. Coarse bin l covers global bins [l*rebinningWidthC, (l+1)*rebinningWidthC)
+    int rebinningWidthC = 0;
+    int convolutionWidthK = 1;
+    long long firstCoarse = 0;
+    std::deque<double> coarseWeightedPowers; // Sum of power*weight over the coarse bin
+    std::deque<double> coarseWeights;        // Sum of weight over the coarse bin
+    long long lastFirstBin = 0, lastEndBin = 0; // Bins touched by the newest spectrum
+
+    // Pyramid, pyramid[level - 1] holds level level, whose bin m covers global bins [m << level, (m + 1) << level). Level 0 is the grid itself
+    struct PyramidLevel {
+        long long first = 0; // Bin of the level held first
+        std::deque<double> weightedPowers; // Sum of power*weight over the bin
+        std::deque<double> weights;        // Sum of weight over the bin
+    };
+    std::vector<PyramidLevel> pyramid;
+
+    // Retention window, disabled while retentionBins is 0. The spill is shared by copies of the grid, which only ever append to it
+    long long retentionBins = 0;
+    std::string spillDirectory;
+    std::shared_ptr<BinSpill> spill;
+    std::map<long long, std::pair<uint64_t, long long>> spilledChunks; // First global bin -> first spill record and bins, outside the storage
+};
+
+#endif // COMBINEDSPECTRUMGRID_H
@@ -0,0 +1,59 @@
+/**
+ * @file downConverter.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for DownConverter, the digital downconversion and decimation of sample buffers ahead of the FFT.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef DOWNCONVERTER_H
+#define DOWNCONVERTER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Digital downconversion of the complex sample stream to a band of interest: each buffer is converted as convertSamplesToComplex does,
+ * mixed down by offsetFrequency, low-pass filtered and decimated by the decimation factor, so the FFT stage transforms samplesPerBuffer/decimation
+ * samples per spectrum at the same bin width. The low-pass is a DOWNCONVERSION_FILTER_ORDER ChebyshevII design from DspFilters, run as
+ * transposed direct form II sections on I and Q together, with its state carried from buffer to buffer within a step.
+ * The mixer also undoes the alternating signs of the conversion, and the output gets its own alternating signs, so its DFT is 0-centered on
+ * offsetFrequency like the full-rate spectra are on the receiver frequency.
+ * The filter runs at the full sample rate in the acquisition thread, but every later stage handles only 1/decimation of the samples.
+ * Function definitions and documentation are in downConverter.cpp.
+ *
+ */
+class DownConverter {
+public:
+    DownConverter(double sampleRate, U32 samplesPerBuffer, int decimation, double offsetFrequency);
+    ~DownConverter();
+
+    DownConverter(const DownConverter&) = delete;
+    DownConverter& operator=(const DownConverter&) = delete;
+
+    void reset();
+    void process(const unsigned short* samples, double inputRange, pipeline_complex* output);
+
+    double sampleRate() const { return inputRate; }
+    U32 inputSamples() const { return samplesPerBuffer; }
+    U32 outputSamples() const { return samplesPerBuffer/(U32)decimation; }
+
+private:
+    struct Section {
+        double b0, b1, b2, a1, a2;
+    };
+
+    double inputRate;
+    U32 samplesPerBuffer;
+    int decimation;
+    double phaseStep; // Mixer phase per sample in rad, -2 pi offsetFrequency/sampleRate
+    double phase = 0; // Mixer phase at the start of the next buffer
+
+    std::vector<Section> sections;
+    std::vector<std::complex<double>> state; // Two registers per section
+    pipeline_complex* converted; // One buffer of converted samples
+};
+
+#endif // DOWNCONVERTER_H
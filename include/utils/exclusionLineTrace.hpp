@@ -0,0 +1,51 @@
+/**
+ * @file exclusionLineTrace.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for ExclusionLineTrace, the progress snapshots of the exclusion line that only copy the bins that changed.
+ * @version 0.1
+ * @date 2023-11-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef EXCLUSIONLINETRACE_H
+#define EXCLUSIONLINETRACE_H
+
+#include "decs.hpp"
+
+class BayesFactors;
+
+/**
+ * @brief Bins [firstBin, firstBin + powers.size()) of the exclusion line at one snapshot. A keyframe holds the whole line from bin 0.
+ */
+struct ExclusionLineDelta {
+    bool keyframe = false;
+    size_t firstBin = 0;
+    std::vector<double> powers;
+
+    double gridStart = 0; // Absolute frequency of bin 0 of the scan grid, MHz
+    double freqRes = 0;   // Spacing of the scan grid, MHz
+};
+
+/**
+ * @brief Snapshots the exclusion line after every update as the bins that may have changed since the previous snapshot. BayesFactors only
+ * updates the bins from its window start to the end of the line, and stepping only appends bins, so a snapshot costs the active window
+ * instead of the whole scan. Every keyframeInterval-th snapshot, and the first after reset, is a keyframe so a trace can be read from any
+ * keyframe on. Function definitions and documentation are in exclusionLineTrace.cpp.
+ *
+ */
+class ExclusionLineTrace {
+public:
+    ExclusionLineTrace(int keyframeInterval = EXCLUSION_KEYFRAME_INTERVAL) : keyframeInterval(max(1, keyframeInterval)) {}
+
+    void snapshot(const BayesFactors& bayesFactors, ExclusionLineDelta& delta);
+    void reset();
+
+private:
+    int keyframeInterval;
+    size_t snapshots = 0;
+    size_t previousSize = 0; // Bins of the line at the previous snapshot
+};
+
+#endif // EXCLUSIONLINETRACE_H
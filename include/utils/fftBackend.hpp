@@ -0,0 +1,105 @@
+/**
+ * @file fftBackend.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definitions for FFTBackend, the transform and power summing of the FFT stage, and its FFTW and cuFFT implementations.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef FFTBACKEND_H
+#define FFTBACKEND_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Transforms blocks of raw spectra and sums the power |X|^2 of chosen spectra into a sub-spectrum sum, wherever the backend computes.
+ * transformAccumulationThread loads every block once, adds its spectra to the sum up to each sub-spectrum average, and takes the sum back for
+ * every average, so a device backend only ever copies averaged spectra back to the host. Each chain needs its own backend, since the loaded
+ * block and the sum are state of the backend. Made by create() with the FFT_BACKEND_* of ScanRunner::fftBackend.
+ * Function definitions and documentation are in fftBackend.cpp.
+ *
+ */
+class FFTBackend {
+public:
+    virtual ~FFTBackend() {};
+
+    static std::unique_ptr<FFTBackend> create(int backend, int samplesPerSpectrum, int spectraPerBlock, pipeline_plan plan, pipeline_plan batchPlan);
+
+    virtual const char* name() const = 0;
+
+    // Transforms one block of at most spectraPerBlock contiguous spectra. The samples can be reused as soon as it returns
+    virtual void load(pipeline_complex* samples, int numSpectra) = 0;
+    // Adds the power of numSpectra spectra of the loaded block, from firstSpectrum on, to the sum
+    virtual void addPowers(int firstSpectrum, int numSpectra) = 0;
+    // Copies the sum to powerSum, samplesPerSpectrum values, and clears it
+    virtual void takePowerSum(pipeline_real* powerSum) = 0;
+
+protected:
+    FFTBackend(int samplesPerSpectrum, int spectraPerBlock) : samplesPerSpectrum(samplesPerSpectrum), spectraPerBlock(spectraPerBlock) {};
+
+    int samplesPerSpectrum;
+    int spectraPerBlock;
+};
+
+/**
+ * @brief FFTBackend on the host with the pipeline's FFTW plans, as processDataFFTBatched and accumulationThread compute it. The reference for
+ * device backends, e.g. in bench_pipeline. The plans stay owned by the caller.
+ * Function definitions and documentation are in fftBackend.cpp.
+ *
+ */
+class FFTWBackend : public FFTBackend {
+public:
+    FFTWBackend(int samplesPerSpectrum, int spectraPerBlock, pipeline_plan plan, pipeline_plan batchPlan);
+    ~FFTWBackend();
+
+    FFTWBackend(const FFTWBackend&) = delete;
+    FFTWBackend& operator=(const FFTWBackend&) = delete;
+
+    const char* name() const override { return "FFTW"; }
+    void load(pipeline_complex* samples, int numSpectra) override;
+    void addPowers(int firstSpectrum, int numSpectra) override;
+    void takePowerSum(pipeline_real* powerSum) override;
+
+private:
+    pipeline_plan plan, batchPlan;
+    pipeline_complex* spectra; // Loaded block
+    std::vector<pipeline_real> sum;
+};
+
+#if CUDA_FFT_BACKEND
+/**
+ * @brief FFTBackend on a CUDA device with cuFFT. Each block is copied to the device and transformed in place with one batched plan over
+ * spectraPerBlock spectra, and the power kernel of powerKernels.cu sums its spectra into a device buffer. All work is queued on the backend's
+ * own stream, and only takePowerSum waits for it, so the host converts the next block while the device transforms this one.
+ * Function definitions and documentation are in fftBackend.cpp.
+ *
+ */
+class CuFFTBackend : public FFTBackend {
+public:
+    CuFFTBackend(int samplesPerSpectrum, int spectraPerBlock, int device = 0);
+    ~CuFFTBackend();
+
+    CuFFTBackend(const CuFFTBackend&) = delete;
+    CuFFTBackend& operator=(const CuFFTBackend&) = delete;
+
+    const char* name() const override { return "cuFFT"; }
+    void load(pipeline_complex* samples, int numSpectra) override;
+    void addPowers(int firstSpectrum, int numSpectra) override;
+    void takePowerSum(pipeline_real* powerSum) override;
+
+private:
+    void release();
+
+    int device;
+    cudaStream_t stream = nullptr;
+    cufftHandle plan = 0, batchPlan = 0; // batchPlan is 0 if spectraPerBlock is 1
+    device_complex* deviceSpectra = nullptr; // Loaded block
+    pipeline_real* deviceSum = nullptr;
+    pipeline_real* hostSum = nullptr; // Pinned, so the sum comes back by DMA
+};
+#endif
+
+#endif // FFTBACKEND_H
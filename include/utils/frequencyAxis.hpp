@@ -0,0 +1,54 @@
+/**
+ * @file frequencyAxis.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for FrequencyAxis, a shared, copy-on-write frequency axis used by Spectrum and its derived types.
+ * @version 0.1
+ * @date 2023-11-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef FREQUENCYAXIS_H
+#define FREQUENCYAXIS_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Frequency axis that shares one immutable set of values between every spectrum that uses it. Every spectrum of a step has the same
+ * axis, so copying or assigning an axis only copies a pointer, and trim() narrows the visible window without touching the values.
+ * Reads look like a const std::vector<double>. Code that changes the values goes through edit(), which first gives the axis its own copy
+ * if the values are shared or trimmed, so other spectra never see the change.
+ * Function definitions and documentation are in frequencyAxis.cpp.
+ *
+ * @warning A single FrequencyAxis object is not thread-safe. Different objects sharing the same values may be used from different threads.
+ */
+class FrequencyAxis {
+public:
+    FrequencyAxis(){};
+    FrequencyAxis(std::vector<double> axis);
+    FrequencyAxis& operator=(std::vector<double> axis);
+
+    // Copy of the visible values, for APIs that take a plain vector
+    operator std::vector<double>() const { return std::vector<double>(begin(), end()); }
+
+    double operator[](size_t i) const { return (*values)[offset + i]; }
+    size_t size() const { return (values == nullptr) ? 0 : values->size() - offset - trimmedBack; }
+    bool empty() const { return size() == 0; }
+    double front() const { return (*this)[0]; }
+    double back() const { return (*this)[size() - 1]; }
+    std::vector<double>::const_iterator begin() const { return storage().begin() + offset; }
+    std::vector<double>::const_iterator end() const { return storage().end() - trimmedBack; }
+
+    void trim(size_t fromFront, size_t fromBack);
+    std::vector<double>& edit();
+    void clear();
+
+private:
+    const std::vector<double>& storage() const;
+
+    std::shared_ptr<std::vector<double>> values;
+    size_t offset = 0, trimmedBack = 0;
+};
+
+#endif // FREQUENCYAXIS_H
@@ -0,0 +1,62 @@
+/**
+ * @file latencyHistogram.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for LatencyHistogram, the lock-free latency distribution behind the stage timers of timing.cpp.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Distribution of one latency, as printed by reportPerformance.
+ *
+ */
+struct LatencySummary {
+    uint64_t count = 0;
+    double total = 0; // Seconds
+    double p50 = 0;   // Seconds
+    double p99 = 0;   // Seconds
+    double max = 0;   // Seconds
+};
+
+/**
+ * @brief Histogram of latencies in nanoseconds that any number of threads record into at once. Values below LATENCY_SUB_BUCKETS get a
+ * bucket each, larger values share a power of two range between LATENCY_SUB_BUCKETS equal buckets, so a percentile is within
+ * 1/LATENCY_SUB_BUCKETS of the true value at any scale. Recording is a few relaxed atomic adds and never takes a lock, the total and
+ * maximum are kept exactly.
+ * Function definitions and documentation are in latencyHistogram.cpp.
+ *
+ */
+class LatencyHistogram {
+public:
+    void record(int64_t nanoseconds);
+    void reset();
+    void setTotal(double seconds);
+
+    double total() const;
+    uint64_t count() const { return samples.load(std::memory_order_relaxed); }
+    double percentile(double fraction) const;
+    LatencySummary summary() const;
+
+private:
+    static constexpr int subBucketBits = LATENCY_SUB_BUCKET_BITS;
+    static constexpr int subBuckets = 1 << subBucketBits;
+    static constexpr int numBuckets = (64 - subBucketBits + 1) * subBuckets;
+
+    std::atomic<uint64_t> buckets[numBuckets] = {};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<int64_t> totalNanoseconds{0};
+    std::atomic<int64_t> maxNanoseconds{0};
+
+    static int bucketOf(uint64_t nanoseconds);
+    static double bucketMidpoint(int bucket);
+};
+
+#endif // LATENCYHISTOGRAM_H
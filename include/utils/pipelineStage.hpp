@@ -0,0 +1,324 @@
+/**
+ * @file pipelineStage.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definitions for Stage, a typed pipeline stage between two SPSCRings, and Pipeline, which launches and joins the stage threads.
+ * @version 0.1
+ * @date 2023-11-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PIPELINESTAGE_H
+#define PIPELINESTAGE_H
+
+#include "decs.hpp"
+
+/**
+ * @brief One pipeline stage that consumes In items from an input ring and emits Out items to an output ring. The stage owns the loop every
+ * pipeline thread shares: wait on the input, stop once the step is cancelled, call the item callback, and once the input has been closed and
+ * drained call the finish callback, set the stage's completion flags and close the output so the next stage can finish in turn. The end of
+ * the stream thus travels through the rings behind the last item, and cancellation wakes the stage at once, so it never polls shared flags.
+ * Exceptions thrown by a callback are reported through syncFlags.raiseError with the stage name, which cancels the other stages.
+ * Items that meet a full output ring are handled by the backpressure policy:
+ *   BACKPRESSURE_BLOCK       - wait for the consumer (the default, nothing is lost)
+ *   BACKPRESSURE_DROP_OLDEST - hold up to spillDepth items locally, discarding the oldest held item when that overflows
+ *   BACKPRESSURE_SPILL       - hold any number of items locally until the consumer catches up (nothing is lost, memory is unbounded)
+ * Held items are always delivered in order ahead of newer ones. A stage with no output ring (the last stage) passes output = nullptr.
+ * A stage set to drainsOnStop() stops processing once a decision has asked for the in-flight data to be drained, and only empties its input.
+ * The items it discards are counted on the input ring, where the queue gauges pick them up.
+ * Defined entirely in this header since it is a template.
+ *
+ */
+template <typename In, typename Out>
+class Stage {
+public:
+    using Emit = std::function<bool(Out&)>;
+
+    Stage(std::string name, SPSCRing<In>& input, SPSCRing<Out>* output, SynchronizationFlags& syncFlags)
+        : name(name), input(input), output(output), syncFlags(syncFlags) {};
+
+    /**
+     * @brief Sets the callback run for each input item. It returns false if emit() failed, which stops the stage.
+     */
+    Stage& onItem(std::function<bool(In&, const Emit&)> callback) { processItem = callback; return *this; }
+
+    /**
+     * @brief Sets the callback run once the input is drained, before completion is signalled. Used to emit partial results.
+     */
+    Stage& onFinish(std::function<bool(const Emit&)> callback) { finish = callback; return *this; }
+
+    /**
+     * @brief Sets the callback run when the stage stops because the step was cancelled.
+     */
+    Stage& onAbort(std::function<void()> callback) { abort = callback; return *this; }
+
+    /**
+     * @brief Adds a SynchronizationFlags member set (under syncFlags.mutex) when the stage completes normally.
+     */
+    Stage& completes(bool SynchronizationFlags::* flag) { completionFlags.push_back(flag); return *this; }
+
+    /**
+     * @brief Makes the stage discard its input instead of processing it once requestAcquisitionStop has asked for a drain.
+     *
+     * @param releaseCallback - called on each discarded item, e.g. to return its buffer
+     */
+    Stage& drainsOnStop(std::function<void(In&)> releaseCallback = nullptr) {
+        drainOnStop = true;
+        release = releaseCallback;
+        return *this;
+    }
+
+    /**
+     * @brief Sets how emit() handles a full output ring.
+     *
+     * @param policy - one of the BACKPRESSURE_* policies
+     * @param depth - items held locally under BACKPRESSURE_DROP_OLDEST
+     * @param discardCallback - called on each item dropped by BACKPRESSURE_DROP_OLDEST or left over after an error, e.g. to return its buffer
+     */
+    Stage& backpressure(int policy, size_t depth = 0, std::function<void(Out&)> discardCallback = nullptr) {
+        backpressurePolicy = policy;
+        spillDepth = max(depth, (size_t)1);
+        discard = discardCallback;
+        return *this;
+    }
+
+    /**
+     * @brief Stage thread body. Runs until the input is drained or the step is cancelled.
+     */
+    void run() {
+        Emit emitter = [this](Out& item) { return emit(item); };
+        try {
+            while (true) {
+                In item;
+                if (!input.pop(item, RING_POLL_MS)) {
+                    if (input.drained()) {
+                        complete(emitter);
+                        return;
+                    }
+                    if (errorRaised()) {
+                        stop();
+                        return;
+                    }
+
+                    // Deliver held items while the input is idle
+                    flushHeld();
+                    continue;
+                }
+
+                if (drainOnStop && draining()) {
+                    if (release) {
+                        release(item);
+                    }
+                    input.countDiscarded();
+                    continue;
+                }
+
+                if (!processItem(item, emitter)) {
+                    stop();
+                    return;
+                }
+            }
+        }
+        catch (const std::exception& e) {
+            std::string message = name + ": " + std::string(e.what());
+            std::cout << message << '\n';
+            syncFlags.raiseError(message);
+        }
+    }
+
+    int droppedItems() const { return dropped; }
+
+private:
+    bool errorRaised() { return syncFlags.cancellation.cancelled(); }
+    bool draining() { return syncFlags.drainInFlight.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Pushes one item downstream according to the backpressure policy.
+     *
+     * @return false - the step was cancelled while blocked on the output
+     */
+    bool emit(Out& item) {
+        if (output == nullptr) {
+            return true;
+        }
+
+        if (backpressurePolicy == BACKPRESSURE_BLOCK) {
+            while (!output->push(item, RING_POLL_MS)) {
+                if (errorRaised()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        flushHeld();
+        if (held.empty() && output->tryPush(item)) {
+            return true;
+        }
+
+        held.push_back(std::move(item));
+        if (backpressurePolicy == BACKPRESSURE_DROP_OLDEST && held.size() > spillDepth) {
+            if (discard) {
+                discard(held.front());
+            }
+            held.pop_front();
+            dropped++;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Moves held items into the output ring, oldest first, until it is full.
+     */
+    void flushHeld() {
+        if (output == nullptr) {
+            return;
+        }
+        while (!held.empty() && output->tryPush(held.front())) {
+            held.pop_front();
+        }
+    }
+
+    void complete(const Emit& emitter) {
+        if (finish && !finish(emitter)) {
+            stop();
+            return;
+        }
+
+        // Everything held must reach the next stage before it is told the stream is over
+        while (!held.empty()) {
+            if (!output->push(held.front(), RING_POLL_MS)) {
+                if (errorRaised()) {
+                    stop();
+                    return;
+                }
+                continue;
+            }
+            held.pop_front();
+        }
+
+        if (dropped > 0) {
+            std::cout << name << " dropped " << std::to_string(dropped) << " items to backpressure." << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(syncFlags.mutex);
+            for (bool SynchronizationFlags::* flag : completionFlags) {
+                syncFlags.*flag = true;
+            }
+        }
+        if (output != nullptr) {
+            output->close();
+        }
+    }
+
+    void stop() {
+        std::cout << name << " gracefully exiting due to error." << std::endl;
+
+        for (Out& item : held) {
+            if (discard) {
+                discard(item);
+            }
+        }
+        held.clear();
+
+        if (abort) {
+            abort();
+        }
+    }
+
+    std::string name;
+    SPSCRing<In>& input;
+    SPSCRing<Out>* output;
+    SynchronizationFlags& syncFlags;
+
+    std::function<bool(In&, const Emit&)> processItem;
+    std::function<bool(const Emit&)> finish;
+    std::function<void()> abort;
+    std::vector<bool SynchronizationFlags::*> completionFlags;
+
+    int backpressurePolicy = BACKPRESSURE_BLOCK;
+    size_t spillDepth = 1;
+    std::function<void(Out&)> discard;
+    std::deque<Out> held;
+    int dropped = 0;
+
+    bool drainOnStop = false;
+    std::function<void(In&)> release;
+};
+
+
+
+/**
+ * @brief Named set of pipeline threads (the acquisition, FFT workers and Stage::run bodies). Launches them together, or one after another
+ * for debugging, and joins them in the order they were added.
+ * In persistent mode (startPersistent) every body gets a long-lived thread that stays idle between steps. beginStep() is the "step started"
+ * message that runs each body once, and endStep() is the "step ended" message that waits until all of them have returned. Threads, their
+ * stacks and caches stay warm across the whole scan. waitForBody() waits for a single body, e.g. to retune once acquisition alone has finished.
+ * Function definitions and documentation are in pipelineStage.cpp.
+ *
+ */
+class Pipeline {
+public:
+    Pipeline(){};
+    ~Pipeline();
+
+    void add(std::string name, std::function<void()> body);
+    void clear();
+
+    void start();
+    void join();
+    void runSequentially();
+
+    void startPersistent();
+    void beginStep();
+    void endStep();
+    void waitForBody(size_t index);
+    void shutdown();
+    bool persistent() const { return persistentMode; }
+    size_t size() const { return bodies.size(); }
+
+private:
+    void persistentLoop(size_t index);
+
+    std::vector<std::string> names;
+    std::vector<std::function<void()>> bodies;
+    std::vector<std::thread> threads;
+
+    // Persistent mode
+    bool persistentMode = false;
+    bool stopping = false;
+    int stepNumber = 0;
+    int bodiesRunning = 0;
+    std::vector<int> bodySteps; // Last step each body has returned from
+    std::mutex stepMutex;
+    std::condition_variable stepStartedCondition;
+    std::condition_variable stepEndedCondition;
+};
+
+
+
+
+/**
+ * @brief Keeps the stages of consecutive steps in step order when two Pipelines run overlapping steps. Body i of step k only starts once body i
+ * of step k-1 has returned, so each kind of stage still touches the scan state (DataProcessor, BayesFactors, DecisionAgent) from one thread
+ * at a time and in the order the steps were taken.
+ * Function definitions and documentation are in pipelineStage.cpp.
+ *
+ */
+class StepSequencer {
+public:
+    StepSequencer(){};
+
+    void reset(size_t numBodies, int lastStep);
+    void waitForTurn(size_t index, int step);
+    void finishTurn(size_t index, int step);
+
+private:
+    std::vector<int> finishedSteps;
+    std::mutex mutex;
+    std::condition_variable turnFinishedCondition;
+};
+
+#endif // PIPELINESTAGE_H
@@ -0,0 +1,60 @@
+/**
+ * @file queueGauges.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for QueueGauges, which samples the depth and throughput of the rings between the pipeline stages.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef QUEUEGAUGES_H
+#define QUEUEGAUGES_H
+
+#include "decs.hpp"
+
+/**
+ * @brief State of one pipeline queue when it was last sampled. Rates are over the time since the sample before.
+ *
+ */
+struct QueueGauge {
+    uint64_t pushed = 0;        // Items pushed since the step began
+    uint64_t popped = 0;        // Items popped since the step began
+    uint64_t depth = 0;         // Items waiting
+    uint64_t highWater = 0;     // Most items ever waiting since the step began
+    uint64_t capacity = 0;
+    double pushRate = 0;        // Items per second
+    double popRate = 0;         // Items per second
+    double bytesInFlight = 0;   // Payload of the waiting items
+    uint64_t discarded = 0;     // Items popped and discarded after a decision asked for a drain (DRAIN_AFTER_DECISION)
+};
+
+/**
+ * @brief Samples the rings of one step's shared data (QUEUE_* ids) into QueueGauge values. The rings already count their pushes and pops and
+ * track their high water mark, so sampling only reads a few atomics per ring and never slows the stages down. The latest sample is also stored
+ * with setQueueGauge, so reportPerformance and the scan checkpoints pick it up like the metrics of timing.cpp.
+ * The data rings of the FFT workers are summed into QUEUE_DATA. Bytes in flight count the samples every waiting item carries, taking the
+ * spectrum rings as one buffer of doubles per item, which bounds the trimmed and rebinned spectra from above.
+ * Function definitions and documentation are in queueGauges.cpp.
+ *
+ */
+class QueueGauges {
+public:
+    void watch(SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc);
+    void restart();
+    void sample();
+    bool publish(TelemetryPublisher& telemetry);
+
+    const QueueGauge& operator[](int queue) const { return gauges[queue]; }
+
+private:
+    SharedDataBasic* sharedData = nullptr;
+    SharedDataProcessing* sharedDataProc = nullptr;
+
+    std::mutex mutex;
+    QueueGauge gauges[NUM_QUEUES];
+    std::chrono::steady_clock::time_point sampled;
+};
+
+#endif // QUEUEGAUGES_H
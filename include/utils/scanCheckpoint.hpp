@@ -0,0 +1,110 @@
+/**
+ * @file scanCheckpoint.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Binary checkpoint of the accumulated state of a scan, and the ScanCheckpointWriter class that writes checkpoints on its own thread.
+ * @version 0.1
+ * @date 2023-11-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SCANCHECKPOINT_H
+#define SCANCHECKPOINT_H
+
+#include "decs.hpp"
+
+class BayesFactors;
+class DataProcessor;
+
+/**
+ * @brief First bytes of a checkpoint file. The header is followed by the sections of ScanCheckpoint::write, every array stored as a uint64_t
+ * count followed by its values, and ends with the magic again so a truncated file is rejected.
+ *
+ */
+struct CheckpointHeader {
+    char magic[8];              // CHECKPOINT_MAGIC
+    uint32_t version;           // CHECKPOINT_VERSION
+    uint32_t numMetrics;        // NUM_METRICS of the scan that wrote it
+    uint32_t sampleRate;        // Hz, must match the resuming scan
+    uint32_t samplesPerBuffer;  // Must match the resuming scan
+    int32_t stepIndex;          // Steps acquired when the checkpoint was taken
+    uint32_t numQueues;         // NUM_QUEUES of the scan that wrote it
+    double trueCenterFreq;      // Receiver center frequency of the last step, MHz
+};
+
+static_assert(sizeof(CheckpointHeader) == 40, "Checkpoint header must keep the arrays 8-byte aligned");
+
+/**
+ * @brief Everything a scan accumulates from step to step: the exclusion line and its coefficient sums, the combined spectrum grid, the
+ * baselining state of the DataProcessor, the raw spectra kept for saveData, the per step metrics of timing.cpp and the step position. The last
+ * pipeline queue gauges (QueueGauges) are stored with them for diagnosing a scan afterwards, and are not restored.
+ * capture copies the state out of the live objects, so the copy can be written while the scan carries on, and restore puts it back.
+ * Function definitions and documentation are in scanCheckpoint.cpp.
+ *
+ */
+class ScanCheckpoint {
+public:
+    void capture(int stepIndex, double trueCenterFreq, const AcquisitionParameters& acquisitionParams, const BayesFactors& bayesFactors,
+                 const SavedData& savedData, const DataProcessor& dataProcessor);
+    void restore(BayesFactors& bayesFactors, SavedData& savedData, DataProcessor& dataProcessor) const;
+
+    bool write(const std::string& path) const;
+    bool read(const std::string& path);
+
+    CheckpointHeader header;
+
+private:
+    // BayesFactors, with the frequency axes as plain copies so they don't share storage with the live scan
+    int startIndex = 0, cutoffIndex = 0;
+    double freqRes = 0, plannedScanWidth = 0, totalShift = 0, sigmaProc = 0;
+    uint64_t windowSize = 0;
+    std::vector<double> scanAxis, coeffSumA, coeffSumB, exclusionPowers;
+    double exclusionCenterFreq = 0;
+
+    CombinedSpectrumGrid combinedSpectrum;
+    std::vector<Spectrum> rawSpectra;
+
+    // DataProcessor
+    int numSpectra = 0;
+    std::vector<double> runningAverage, currentBaseline;
+    std::vector<int> badBins;
+
+    std::vector<std::vector<int>> metrics;
+    std::vector<double> queueGauges; // QUEUE_GAUGE_VALUES per queue, see queueGaugeValues
+
+    void writeGrid(std::ostream& file) const;
+    void readGrid(std::istream& file, uint64_t bytesLeft);
+};
+
+/**
+ * @brief Writes checkpoints to one file on its own thread, so a step only pays for capturing its state. Every checkpoint is written next to
+ * the file and renamed over it once complete, so the file always holds the last complete checkpoint. A checkpoint submitted while the previous
+ * one is still being written replaces any checkpoint waiting behind it, since only the newest is worth keeping.
+ * Function definitions and documentation are in scanCheckpoint.cpp.
+ *
+ */
+class ScanCheckpointWriter {
+public:
+    ScanCheckpointWriter(const std::string& path);
+    ~ScanCheckpointWriter();
+
+    void submit(std::unique_ptr<ScanCheckpoint> checkpoint);
+
+    const std::string& path() const { return checkpointPath; }
+    size_t checkpointsWritten() const { return written.load(); }
+
+private:
+    std::string checkpointPath;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::unique_ptr<ScanCheckpoint> pending;
+    bool closing = false;
+    std::atomic<size_t> written{0};
+    std::thread writerThread;
+
+    void writerLoop();
+};
+
+#endif // SCANCHECKPOINT_H
@@ -0,0 +1,80 @@
+/**
+ * @file soakMonitor.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for SoakMonitor, which tracks the real-time headroom of the pipeline over a long run of steps.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SOAKMONITOR_H
+#define SOAKMONITOR_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Pipeline headroom over one interval of a soak run. Intervals end on a step boundary, so their wall times add up to the whole run.
+ *
+ */
+struct SoakInterval {
+    double elapsed = 0;             // Wall time from the start of the run to the end of the interval, s
+    double wallTime = 0;            // s
+    double dataTime = 0;            // Sample clock time of the sub-spectra acquired, s
+    double acquisitionTime = 0;     // Time the source spent delivering buffers (TIMER_ACQUISITION), s
+    int steps = 0;
+    double maxDeadTime = 0;         // Longest time between the acquisitions of two steps, s
+    double workingSet = 0;          // Bytes of the process at the end of the interval
+    double privateBytes = 0;        // Committed private bytes of the process at the end of the interval
+    long long lateBuffers = 0;      // LATE_BUFFERS of the interval's steps
+    long long overruns = 0;         // ACQUISITION_OVERRUNS of the interval's steps
+    double stageBusy[NUM_TIMERS] = {}; // Busy time of each stage, summed over its workers as the timers of timing.cpp do, s
+
+    double dutyCycle() const { return (wallTime > 0) ? dataTime/wallTime : 0; }
+    double deadTime() const { return max(wallTime - acquisitionTime, 0.0); }
+};
+
+/**
+ * @brief Follows a long scan through the timers and metrics of timing.cpp, step by step. Every intervalSeconds it closes a SoakInterval with
+ * the duty cycle (seconds of data acquired per second of wall time, 1 at real-time rate with no dead time), the dead time between steps,
+ * the memory of the process, the late buffers and overruns of the acquisition and the busy time of every stage, and prints it on one line.
+ * The summary estimates the sample rate each stage would saturate at from its busy time per second of data: a stage of W workers that is
+ * busy u seconds per second of data at sampleRate keeps up until W/u times sampleRate. Memory growth is measured from the end of the first
+ * interval, after the pools, rings and maps of the pipeline have been allocated.
+ * Function definitions and documentation are in soakMonitor.cpp.
+ *
+ */
+class SoakMonitor {
+public:
+    SoakMonitor(double sampleRate, U32 samplesPerSpectrum, double intervalSeconds = SOAK_REPORT_INTERVAL);
+
+    void setStageWorkers(int timerCode, int workers) { stageWorkers[timerCode] = max(1, workers); }
+
+    void stepCompleted();
+    bool intervalDue() const;
+    bool intervalEmpty() const { return current.steps == 0; }
+    const SoakInterval& closeInterval();
+    double elapsed() const;
+
+    void report() const;
+    void save(const std::string& filename) const;
+
+    const std::vector<SoakInterval>& intervals() const { return history; }
+
+private:
+    double sampleRate;
+    U32 samplesPerSpectrum;
+    double intervalSeconds;
+    int stageWorkers[NUM_TIMERS];
+
+    std::chrono::steady_clock::time_point start, intervalStart, lastStep;
+    double lastAcquisitionTime = 0; // getTime(TIMER_ACQUISITION) at the last step
+    double intervalTimerTotals[NUM_TIMERS] = {}; // Timer totals at the start of the interval
+    size_t metricsSeen[NUM_METRICS] = {}; // Values of each metric already counted
+
+    SoakInterval current;
+    std::vector<SoakInterval> history;
+};
+
+#endif // SOAKMONITOR_H
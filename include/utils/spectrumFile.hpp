@@ -0,0 +1,80 @@
+/**
+ * @file spectrumFile.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Binary file format of saved spectra and exclusion lines, and the SpectrumFileWriter class that writes it. Read by
+ *        plotting/spectrumFile.py.
+ * @version 0.1
+ * @date 2023-11-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SPECTRUMFILE_H
+#define SPECTRUMFILE_H
+
+#include "decs.hpp"
+
+/**
+ * @brief First bytes of a spectrum file. A file is laid out as
+ *   SpectrumFileHeader
+ *   numBins axis doubles, only with SPECTRUM_AXIS_EXPLICIT
+ *   for every record: arraysPerRecord arrays of numBins doubles
+ * except in SPECTRUM_FILE_DELTAS files, where every record is a SpectrumDeltaHeader followed by its numBins doubles. A delta record replaces
+ * bins [firstBin, firstBin + numBins) of the array built from the records before it, and a keyframe record starts the array over from bin 0.
+ * The header's numBins is then the widest the array gets.
+ * Everything is little-endian, as the acquisition machine writes it, and stored at full double precision.
+ *
+ */
+struct SpectrumFileHeader {
+    char magic[8];                  // SPECTRUM_FILE_MAGIC
+    uint32_t version;               // SPECTRUM_FILE_VERSION
+    uint32_t axisType;              // SPECTRUM_AXIS_*
+    uint64_t numBins;               // Doubles per array
+    uint64_t numRecords;            // Records written, patched when the writer closes
+    uint32_t arraysPerRecord;       // e.g. 1 for powers, 2 for powers and sigmaCombined
+    uint32_t kind;                  // SPECTRUM_FILE_SINGLE, SPECTRUM_FILE_SEQUENCE or SPECTRUM_FILE_DELTAS
+    double axisStart;               // First axis value, with SPECTRUM_AXIS_UNIFORM
+    double axisStep;                // Spacing of the axis, with SPECTRUM_AXIS_UNIFORM
+    double trueCenterFreq;          // Receiver center frequency the axis is relative to, MHz. 0 if the axis is absolute or there is none
+};
+
+/**
+ * @brief Leads every record of a SPECTRUM_FILE_DELTAS file.
+ *
+ */
+struct SpectrumDeltaHeader {
+    uint64_t firstBin;              // First bin the record replaces
+    uint64_t numBins;               // Doubles that follow
+    uint32_t keyframe;              // 1 if the record starts the array over, firstBin is then 0
+    uint32_t reserved;
+};
+
+static_assert(sizeof(SpectrumFileHeader) == 64 && sizeof(SpectrumDeltaHeader) == 24, "Spectrum file headers must keep the arrays 8-byte aligned");
+
+/**
+ * @brief Writes a spectrum file record by record. The axis is stored as a start and step when it is uniform, which every axis the pipeline
+ * generates is, so a file costs 8 bytes per bin per array. Function definitions and documentation are in spectrumFile.cpp.
+ *
+ */
+class SpectrumFileWriter {
+public:
+    SpectrumFileWriter(const std::string& filename, size_t numBins, U32 arraysPerRecord, U32 kind = SPECTRUM_FILE_SINGLE,
+                       const FrequencyAxis* axis = nullptr, double trueCenterFreq = 0);
+    ~SpectrumFileWriter();
+
+    bool isOpen() const { return file.is_open(); }
+    void writeArray(const double* data, size_t size);
+    void writeArray(const std::vector<double>& data) { writeArray(data.data(), data.size()); }
+    void writeDelta(uint64_t firstBin, const double* data, size_t size, bool keyframe);
+    void setUniformAxis(double axisStart, double axisStep);
+    bool close();
+
+private:
+    std::ofstream file;
+    SpectrumFileHeader header;
+    uint64_t arraysWritten = 0;
+    uint64_t widestDelta = 0;
+};
+
+#endif // SPECTRUMFILE_H
@@ -0,0 +1,256 @@
+/**
+ * @file spscRing.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for SPSCRing, a bounded lock-free single-producer/single-consumer ring used between pipeline stages.
+ * @version 0.1
+ * @date 2023-11-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Bounded ring of T with exactly one producing and one consuming thread. Pushing and popping only touch two atomic indices, so the
+ * hot path takes no lock and never contends with other stages. When the ring is empty (or full) the waiting side either spins
+ * (RING_WAIT_SPIN) or, after RING_SPIN_COUNT tries, sleeps on a condition variable (RING_WAIT_BLOCKING). The other side only takes the
+ * ring's mutex to wake a thread that is actually asleep.
+ * The producer calls close() once it has pushed its last item. That end-of-stream mark travels behind the data, so pop() still drains what is
+ * left and drained() reports the end of the stream only after the last item.
+ * The indices double as counts of the items pushed and popped since the last allocate or reset, and the producer keeps the high water mark,
+ * so the ring can be watched (QueueGauges) without touching the hot path. Consumers that discard what they pop while draining count it with
+ * countDiscarded().
+ * A ring watching a CancellationToken (cancelOn) wakes both sides as soon as the token is cancelled, so a stage blocked on it never waits
+ * out its timeout before seeing an error.
+ * Defined entirely in this header since it is a template.
+ *
+ * @warning Several threads may push (or pop) only if they serialize their calls with their own mutex, as the FFT workers do.
+ */
+template <typename T>
+class SPSCRing {
+public:
+    SPSCRing(){};
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    /**
+     * @brief Allocates the ring and clears it. Not thread-safe, only call while neither side is running.
+     *
+     * @param capacity - minimum number of items the ring holds before push() waits. Rounded up to a power of two
+     * @param strategy - RING_WAIT_BLOCKING or RING_WAIT_SPIN
+     */
+    void allocate(size_t capacity, int strategy = PIPELINE_RING_WAIT) {
+        size_t size = 1;
+        while (size < max(capacity, (size_t)1)) {
+            size <<= 1;
+        }
+
+        slots.clear();
+        slots.resize(size);
+        mask = size - 1;
+        waitStrategy = strategy;
+
+        head.store(0);
+        tail.store(0);
+        peak.store(0);
+        drops.store(0);
+        closed.store(false);
+    }
+
+    /**
+     * @brief Empties and re-opens the ring for the next stream without reallocating. Not thread-safe, only call while neither side is running.
+     *
+     * @param strategy - RING_WAIT_BLOCKING or RING_WAIT_SPIN
+     */
+    void reset(int strategy = PIPELINE_RING_WAIT) {
+        // Drop anything left over from an aborted stream
+        for (size_t i = head.load(); i != tail.load(); i++) {
+            slots[i & mask] = T();
+        }
+        waitStrategy = strategy;
+
+        head.store(0);
+        tail.store(0);
+        peak.store(0);
+        drops.store(0);
+        closed.store(false);
+    }
+
+    /**
+     * @brief Makes push() and pop() return as soon as token is cancelled. Not thread-safe, only call while neither side is running.
+     *
+     * @param token - cancellation token of the step. Must outlive every push() and pop() made while it is watched
+     */
+    void cancelOn(CancellationToken& token) {
+        if (cancelToken == &token) {
+            return;
+        }
+        cancelToken = &token;
+        cancelSubscription = token.subscribe([this]() { interrupt(); });
+    }
+
+    /**
+     * @brief Pushes an item without waiting. Producer only.
+     *
+     * @param item - moved into the ring on success, left untouched otherwise
+     * @return true - the item was pushed
+     * @return false - the ring is full
+     */
+    bool tryPush(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        if (t - h > mask) {
+            return false;
+        }
+
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_seq_cst);
+
+        // Only the producer writes the peak. Pops racing with this push can make it overcount by those pops
+        if (t + 1 - h > peak.load(std::memory_order_relaxed)) {
+            peak.store(t + 1 - h, std::memory_order_relaxed);
+        }
+
+        if (consumerWaiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            itemPushedCondition.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Pushes an item, waiting up to timeout_ms for the consumer to free a slot. Producer only.
+     *
+     * @param item - moved into the ring on success, left untouched otherwise
+     * @param timeout_ms - maximum time to wait for a free slot
+     * @return true - the item was pushed
+     * @return false - the ring stayed full for timeout_ms, or the watched token was cancelled
+     */
+    bool push(T& item, int timeout_ms) {
+        return tryPush(item) || (waitFor(producerWaiting, itemPoppedCondition, [this]() { return !full() || cancelled(); }, timeout_ms) && tryPush(item));
+    }
+
+    /**
+     * @brief Pops an item without waiting. Consumer only.
+     *
+     * @param item - receives the popped item
+     * @return true - an item was popped
+     * @return false - the ring is empty
+     */
+    bool tryPop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_seq_cst);
+
+        if (producerWaiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            itemPoppedCondition.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Pops an item, waiting up to timeout_ms for the producer. Returns early once the ring is closed. Consumer only.
+     *
+     * @param item - receives the popped item
+     * @param timeout_ms - maximum time to wait for an item
+     * @return true - an item was popped
+     * @return false - no item arrived within timeout_ms, the ring is drained(), or the watched token was cancelled
+     */
+    bool pop(T& item, int timeout_ms) {
+        return tryPop(item) || (waitFor(consumerWaiting, itemPushedCondition, [this]() { return !empty() || closed.load() || cancelled(); }, timeout_ms) && tryPop(item));
+    }
+
+    /**
+     * @brief Marks the end of the stream and wakes the consumer. Producer only, after its last push.
+     *
+     */
+    void close() {
+        closed.store(true, std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(mutex);
+        itemPushedCondition.notify_all();
+    }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+    bool full() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) > mask; }
+    bool drained() const { return closed.load(std::memory_order_acquire) && empty(); }
+    size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    size_t capacity() const { return slots.size(); }
+    size_t pushed() const { return tail.load(std::memory_order_relaxed); }
+    size_t popped() const { return head.load(std::memory_order_relaxed); }
+    size_t highWater() const { return peak.load(std::memory_order_relaxed); }
+    size_t discarded() const { return drops.load(std::memory_order_relaxed); }
+    void countDiscarded() { drops.fetch_add(1, std::memory_order_relaxed); }
+    bool cancelled() const { return cancelToken != nullptr && cancelToken->cancelled(); }
+
+private:
+    /**
+     * @brief Wakes both sides so they re-check their predicates. Called by the watched token when it is cancelled.
+     */
+    void interrupt() {
+        std::lock_guard<std::mutex> lock(mutex);
+        itemPushedCondition.notify_all();
+        itemPoppedCondition.notify_all();
+    }
+
+    /**
+     * @brief Waits until ready() is true or timeout_ms passes, spinning or sleeping according to waitStrategy.
+     *
+     * @return true - ready() became true
+     */
+    template <typename Predicate>
+    bool waitFor(std::atomic<bool>& waiting, std::condition_variable& condition, Predicate ready, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        // Spin first, the other side is usually only a few microseconds behind
+        for (int spin = 0; waitStrategy == RING_WAIT_SPIN || spin < RING_SPIN_COUNT; spin++) {
+            if (ready()) {
+                return true;
+            }
+            if (waitStrategy == RING_WAIT_SPIN) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        // Announce the sleeper before re-checking so a push or pop that races with us always sees the flag and wakes us (under the mutex)
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting.store(true, std::memory_order_seq_cst);
+        bool result = condition.wait_until(lock, deadline, ready);
+        waiting.store(false, std::memory_order_relaxed);
+        return result;
+    }
+
+    std::vector<T> slots;
+    size_t mask = 0;
+    int waitStrategy = PIPELINE_RING_WAIT;
+
+    // Producer and consumer indices on separate cache lines. Both only ever increase, the slot is index & mask
+    alignas(64) std::atomic<size_t> head{0};
+    std::atomic<size_t> drops{0}; // Popped items the consumer discarded since the last allocate or reset, on the consumer's line
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<size_t> peak{0}; // Most items waiting at once since the last allocate or reset, on the producer's line
+    alignas(64) std::atomic<bool> closed{false};
+
+    // Slow path only
+    std::atomic<bool> consumerWaiting{false};
+    std::atomic<bool> producerWaiting{false};
+    std::mutex mutex;
+    std::condition_variable itemPushedCondition;
+    std::condition_variable itemPoppedCondition;
+
+    CancellationToken* cancelToken = nullptr;
+    CancellationToken::Subscription cancelSubscription; // Declared last so it unsubscribes before the rest of the ring is destroyed
+};
+
+#endif // SPSCRING_H
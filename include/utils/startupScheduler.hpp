@@ -0,0 +1,49 @@
+/**
+ * @file startupScheduler.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for StartupScheduler, which runs the independent phases of a startup concurrently and times each of them.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef STARTUPSCHEDULER_H
+#define STARTUPSCHEDULER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Dependency ordered startup phases. Every phase added with add() starts on its own thread as soon as the phases it comes after have
+ * finished, so phases that don't depend on each other (instrument connections, FFT planning, file loading) overlap. run() returns once every
+ * phase has finished and rethrows the first failure; a phase after a failed phase is skipped. With PARALLEL_STARTUP set to 0 the phases run
+ * one after another in the order they were added, which is always a valid order since a phase can only come after phases added before it.
+ * Function definitions and documentation are in startupScheduler.cpp.
+ *
+ */
+class StartupScheduler {
+public:
+    int add(const std::string& name, std::function<void()> body, const std::vector<int>& after = {});
+    void run();
+    void report() const;
+
+private:
+    struct Phase {
+        std::string name;
+        std::function<void()> body;
+        std::vector<int> after;
+
+        double start = 0, end = 0; // Seconds since run() began
+        bool ran = false;
+        std::shared_future<void> done;
+    };
+
+    std::vector<Phase> phases;
+    std::chrono::steady_clock::time_point started;
+    double total = 0;
+
+    void runPhase(Phase& phase);
+};
+
+#endif // STARTUPSCHEDULER_H
@@ -0,0 +1,177 @@
+/**
+ * @file streamRecording.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief File format of raw digitizer stream recordings, and the StreamRecorder class that writes them.
+ * @version 0.1
+ * @date 2023-11-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef STREAMRECORDING_H
+#define STREAMRECORDING_H
+
+#include "decs.hpp"
+
+struct AcquisitionParameters;
+
+/**
+ * @brief First bytes of a raw stream recording. A recording is laid out as
+ *   RecordingHeader
+ *   for every step: RecordedStepHeader, then numBuffers raw buffers of samplesPerBuffer channel A codes followed by samplesPerBuffer channel B
+ *                   codes, exactly as the digitizer delivered them
+ * Fields are fixed width and every buffer is 8-byte aligned, so a memory-mapped recording can be read in place. Recordings of version
+ * RECORDING_PACKED_VERSION hold every buffer as a PackedBufferHeader and its packed codes instead, see packRecordedBuffer.
+ *
+ */
+struct RecordingHeader {
+    char magic[8];                  // RECORDING_MAGIC
+    uint32_t version;               // RECORDING_VERSION
+    uint32_t sampleRate;            // Hz
+    uint32_t samplesPerBuffer;      // Per channel
+    uint32_t bytesPerSample;
+    double inputRange;              // Full scale voltage range the codes were acquired with
+};
+
+/**
+ * @brief Metadata written ahead of the buffers of every recorded step.
+ *
+ */
+struct RecordedStepHeader {
+    uint32_t magic;                 // RECORDED_STEP_MAGIC
+    uint32_t stepIndex;             // Steps in recording order, from 0
+    uint32_t numBuffers;            // Buffers recorded for the step, RECORDED_STEP_OPEN until the step is closed
+    uint32_t buffersPerAcquisition; // Fixed horizon of the step when it was recorded
+    double centerFrequency;         // Receiver center frequency, MHz
+    uint32_t stoppedByDecision;     // 1 if a decision ended the step before its fixed horizon
+    uint32_t reserved;
+};
+
+/**
+ * @brief Header of a buffer in a packed recording, followed by payloadBytes of packed codes. Buffers vary in size, so a replay indexes a step
+ *        by walking these headers, after which any buffer can be unpacked on its own.
+ *
+ */
+struct PackedBufferHeader {
+    uint32_t magic;                 // RECORDED_BUFFER_MAGIC
+    uint32_t bufferIndex;           // Buffers in step order, from 0
+    uint32_t payloadBytes;          // Multiple of 8, keeping the next header 8-byte aligned
+    uint32_t reserved;
+};
+
+static_assert(sizeof(RecordingHeader) == 32 && sizeof(RecordedStepHeader) == 32 && sizeof(PackedBufferHeader) == 16,
+              "Recording headers must keep the buffers 8-byte aligned");
+
+void packRecordedBuffer(const unsigned short* samples, size_t samplesPerBuffer, uint32_t bufferIndex, std::vector<char>& packed);
+void unpackRecordedBuffer(const char* payload, size_t payloadBytes, size_t samplesPerBuffer, unsigned short* samples);
+
+/**
+ * @brief Appends the raw buffers of each acquisition step to a recording, so the step can later be played back through the pipeline by a
+ * ReplayDigitizer. Keeps up with the full 2 channel stream of the digitizer (128 MB/s at 32 MS/s):
+ *   - writeBuffer only copies the buffer into a RECORDING_BLOCK_BYTES staging block. Full blocks are handed to the recorder's writer thread,
+ *     and the acquisition thread carries on filling the next of RECORDING_BLOCKS blocks
+ *   - the writer thread writes the blocks with overlapped, unbuffered (FILE_FLAG_NO_BUFFERING) writes at sector aligned offsets, so the data
+ *     goes from the staging block to the disk without passing through the system cache
+ *   - the file is preallocated preallocateBytes at a time, so the file system does not extend it on every write
+ * With RECORDING_CODEC_PACKED, writeBuffer only copies the buffer for one of RECORDING_CODEC_THREADS codec threads, which pack the buffers
+ * in parallel and append them to the staging blocks in order. A step's header is appended once the codec threads have caught up with it.
+ * The acquisition thread only waits on the disk, or on the codec threads, when every block or codec job is taken, and that wait is reported
+ * when the recording closes. Step headers still in the filling block are patched in place, earlier ones when the recording is closed, which also trims the
+ * preallocated tail. A recording that was never closed reads back as steps whose numBuffers is RECORDED_STEP_OPEN followed by zeros.
+ * Function definitions and documentation are in streamRecording.cpp.
+ *
+ */
+class StreamRecorder {
+public:
+    StreamRecorder(const std::string& path, const AcquisitionParameters& acquisitionParams, size_t preallocateBytes = RECORDING_PREALLOCATE_BYTES,
+                   int codec = RECORDING_CODEC_NONE);
+    ~StreamRecorder();
+
+    void beginStep(const AcquisitionParameters& acquisitionParams, double centerFrequency);
+    void writeBuffer(const unsigned short* samples);
+    void endStep(bool stoppedByDecision);
+    void close();
+
+    U32 stepsRecorded() const { return numSteps; }
+    double stalledSeconds() const { return stalled; }
+    int codec() const { return bufferCodec; }
+
+private:
+    /**
+     * @brief Sector aligned staging block, filled by the acquisition thread and written by the writer thread.
+     */
+    struct Block {
+        char* data = nullptr;
+        uint64_t offset = 0; // File offset of data[0], a multiple of RECORDING_BLOCK_BYTES
+        size_t size = 0;     // Bytes of the recording in the block
+        OVERLAPPED overlapped = OVERLAPPED();
+    };
+
+    std::string path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    RecordingHeader header;
+    size_t bytesPerBuffer;
+    size_t preallocateBytes;
+
+    std::vector<Block> blocks;
+    Block* filling = nullptr;  // Appending thread only, see append
+    uint64_t position = 0;     // Bytes appended so far
+    double stalled = 0;        // Seconds writeBuffer waited for a free block or codec job
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Block*> freeBlocks;
+    std::deque<Block*> fullBlocks;
+    bool closing = false;
+    std::string failure;       // Error of the writer thread, raised by the next append
+    std::thread writerThread;
+
+    // Writer thread only
+    uint64_t allocated = 0;
+
+    /**
+     * @brief Buffer of a packed recording, copied by writeBuffer and packed by a codec thread.
+     */
+    struct CodecJob {
+        uint64_t sequence = 0;               // Order the buffers are appended in
+        uint32_t bufferIndex = 0;            // Buffer of the open step
+        std::vector<unsigned short> samples;
+        std::vector<char> packed;            // PackedBufferHeader and payload
+    };
+
+    int bufferCodec;
+    uint64_t rawBytes = 0; // Bytes of the buffers written, before packing
+
+    // Codec threads of a packed recording. appendMutex makes them, one at a time, the appending thread
+    std::vector<CodecJob> codecJobs;
+    std::mutex codecMutex;
+    std::condition_variable codecCondition;
+    std::deque<CodecJob*> freeJobs;
+    std::deque<CodecJob*> pendingJobs;
+    std::map<uint64_t, CodecJob*> packedJobs;
+    uint64_t nextJobSequence = 0;    // Acquisition thread only
+    uint64_t nextAppendSequence = 0;
+    bool codecStopping = false;
+    std::mutex appendMutex;
+    std::vector<std::thread> codecThreads;
+
+    bool stepOpen = false;
+    RecordedStepHeader step;
+    uint64_t stepPosition = 0; // Offset of the open step's header, patched once the step is closed
+    std::vector<std::pair<uint64_t, RecordedStepHeader>> closedSteps; // Headers already handed to the writer thread, patched by close
+    U32 numSteps = 0;
+
+    void append(const void* data, size_t size);
+    void handOff();
+    void writerLoop();
+    void writeBlock(Block& block);
+    void waitForBlock(Block& block);
+    void releaseBuffers();
+    void codecLoop();
+    void appendPacked();
+    void drainCodec();
+    void stopCodec();
+};
+
+#endif // STREAMRECORDING_H
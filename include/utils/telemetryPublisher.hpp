@@ -0,0 +1,103 @@
+/**
+ * @file telemetryPublisher.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for TelemetryPublisher, the shared memory channel that live monitoring clients watch a scan through.
+ * @version 0.1
+ * @date 2023-11-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef TELEMETRYPUBLISHER_H
+#define TELEMETRYPUBLISHER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Start of the shared memory. The header is followed by TELEMETRY_CHANNELS channels, channelStride bytes apart, each a
+ * TelemetryChannelHeader followed by room for maxValues doubles. The magic is written last when the publisher opens the memory and
+ * cleared when it closes, so a viewer can tell whether a scan is publishing.
+ *
+ */
+struct TelemetryHeader {
+    char magic[8];          // TELEMETRY_MAGIC
+    uint32_t version;       // TELEMETRY_VERSION
+    uint32_t numChannels;   // TELEMETRY_CHANNELS
+    uint32_t maxValues;     // Capacity of every channel
+    uint32_t reserved;
+    uint64_t channelStride; // Bytes from the start of one channel to the next, the first starts right after this header
+    double rateHz;          // Publications per second per channel at most
+};
+
+static_assert(sizeof(TelemetryHeader) == 40, "Telemetry header layout is read by plotting/telemetryViewer.py");
+
+/**
+ * @brief Latest publication of one channel. sequence is odd while the publisher is writing the channel and advances by 2 per publication,
+ * so a reader copies the channel and accepts the copy if sequence was even and unchanged before and after.
+ *
+ */
+struct TelemetryChannelHeader {
+    std::atomic<uint64_t> sequence;
+    uint32_t numValues;     // Values published, at most maxValues
+    uint32_t decimation;    // Source bins averaged into every value
+    int32_t step;           // Scan step the values came from
+    uint32_t reserved;
+    uint64_t sourceBins;    // Bins of the spectrum before decimation
+    double axisStart;       // Frequency of the first value, 0 with axisStep for values without a frequency axis
+    double axisStep;
+    double trueCenterFreq;  // Receiver center frequency, MHz
+    double timestamp;       // Seconds since the publisher opened the memory
+};
+
+static_assert(sizeof(TelemetryChannelHeader) == 64, "Telemetry channel layout is read by plotting/telemetryViewer.py");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Telemetry sequence must be a plain 64-bit word in shared memory");
+
+/**
+ * @brief Publishes decimated spectra, the exclusion line and the stage metrics of a scan to a named shared memory mapping, for viewers in
+ * other processes such as plotting/telemetryViewer.py. Every channel only keeps its latest publication and is published at most rateHz
+ * times a second. A publish call that is not due, or that finds another thread writing the same channel, returns right away without
+ * copying anything, and a publication never waits on a reader, so viewers can't slow the pipeline down. Call due() before building values
+ * that are only needed for telemetry.
+ * Function definitions and documentation are in telemetryPublisher.cpp.
+ *
+ */
+class TelemetryPublisher {
+public:
+    TelemetryPublisher(const std::string& name = TELEMETRY_NAME, double rateHz = TELEMETRY_RATE_HZ, uint32_t maxValues = TELEMETRY_MAX_VALUES);
+    ~TelemetryPublisher();
+
+    bool due(int channel) const;
+
+    bool publishSpectrum(int channel, const Spectrum& spectrum);
+    bool publishValues(int channel, const double* values, size_t count, double axisStart = 0, double axisStep = 0, double trueCenterFreq = 0);
+    bool publishMetrics();
+
+    void setStep(int step) { currentStep.store(step, std::memory_order_relaxed); }
+
+    const std::string& name() const { return mappingName; }
+    size_t publications() const { return published.load(); }
+
+private:
+    std::string mappingName;
+    int64_t periodNanoseconds;
+    uint32_t maxValues;
+    uint64_t channelStride;
+
+    HANDLE mappingHandle = NULL;
+    char* view = nullptr;
+    std::chrono::steady_clock::time_point opened;
+
+    std::atomic<int64_t> nextDue[TELEMETRY_CHANNELS] = {};
+    std::atomic<bool> writing[TELEMETRY_CHANNELS] = {};
+    std::atomic<int> currentStep{0};
+    std::atomic<size_t> published{0};
+
+    int64_t now() const;
+    bool claim(int channel);
+    TelemetryChannelHeader* channelHeader(int channel) const;
+    double* channelValues(int channel) const;
+    void unmap();
+};
+
+#endif // TELEMETRYPUBLISHER_H
@@ -0,0 +1,60 @@
+/**
+ * @file threadPlacement.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definitions for ThreadPlacement, the cores, priorities and MMCSS tasks of the pipeline threads, and ThreadPlacementScope,
+ *        which places the calling thread for the length of a stage body.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Where and at what priority the pipeline threads run, by THREAD_ROLE_*. Each role has a core mask (0 for any core), a Win32 thread
+ * priority, and an MMCSS task ("" for none) that gets its threads scheduled ahead of the rest of the box while they run. The default runs
+ * every thread anywhere at normal priority, as plain std::threads do. isolated() gives the acquisition its own cores at time critical
+ * priority and keeps the compute stages off them, and load() reads a deployment's placement from a file.
+ * Function definitions and documentation are in threadPlacement.cpp.
+ *
+ */
+class ThreadPlacement {
+public:
+    ThreadPlacement();
+    static ThreadPlacement isolated(int acquisitionCores = 1);
+
+    void load(const std::string& path);
+    void print() const;
+
+    DWORD_PTR affinityMask[NUM_THREAD_ROLES];
+    int priority[NUM_THREAD_ROLES];
+    std::string mmcssTask[NUM_THREAD_ROLES];
+};
+
+/**
+ * @brief Places the calling thread by a ThreadPlacement role while in scope, and puts back its cores and priority and leaves MMCSS when it
+ * goes out of scope, so a persistent pipeline thread picks up a new placement with its next body. A chain mask, e.g. the cores of one
+ * digitizer's chain, takes the place of the role's cores.
+ * Function definitions and documentation are in threadPlacement.cpp.
+ *
+ */
+class ThreadPlacementScope {
+public:
+    ThreadPlacementScope(const ThreadPlacement& placement, int role, DWORD_PTR chainMask = 0);
+    ~ThreadPlacementScope();
+
+    ThreadPlacementScope(const ThreadPlacementScope&) = delete;
+    ThreadPlacementScope& operator=(const ThreadPlacementScope&) = delete;
+
+private:
+    DWORD_PTR previousMask = 0; // 0 if the cores were left alone
+    int previousPriority = THREAD_PRIORITY_ERROR_RETURN; // THREAD_PRIORITY_ERROR_RETURN if the priority was left alone
+    HANDLE mmcssHandle = NULL;
+};
+
+#endif // THREADPLACEMENT_H
@@ -0,0 +1,54 @@
+/**
+ * @file traceRecorder.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Span recording for a Chrome trace-event view of the pipeline, see startTracing and writeTrace in traceRecorder.cpp.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief One finished span. Names and categories point at string literals, so recording a span copies no strings.
+ *
+ */
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    int64_t start;      // latencyClock() nanoseconds
+    int64_t duration;   // Nanoseconds
+    int64_t item;       // Buffer, block or step the span worked on, -1 for none
+    int64_t allocations; // Heap allocations the thread made during the span, -1 if not counted (see TRACK_ALLOCATIONS)
+    int64_t allocatedBytes;
+};
+
+/**
+ * @brief Records the span from construction to destruction while tracing is on, a single flag check otherwise. The stage timers of timing.cpp
+ * record theirs from stopTimer, this is for everything in between (buffer waits, conversion, steps, instrument commands).
+ * Function definitions are in traceRecorder.cpp.
+ *
+ * @warning name and category must be string literals, or otherwise outlive the trace.
+ */
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* category = TRACE_PIPELINE, int64_t item = -1);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    int64_t item;
+    int64_t start;
+    AllocationCounters startAllocations;
+};
+
+#endif // TRACERECORDER_H
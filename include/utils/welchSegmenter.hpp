@@ -0,0 +1,59 @@
+/**
+ * @file welchSegmenter.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for WelchSegmenter, the overlapped and windowed segments of the Welch PSD estimate.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef WELCHSEGMENTER_H
+#define WELCHSEGMENTER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Cuts the contiguous sample stream of a step into overlapping, windowed segments of one buffer's length for the FFT stage, so the
+ * averaged spectra become Welch estimates. Each buffer is converted into input(), and segmentsPerBuffer segments then end in it, hop samples
+ * apart, the earlier ones starting in the previous buffer. The first buffer of a step has no previous buffer and gives only itself.
+ * The window table is computed once and scaled to a mean square of 1, so every segment's |X|^2 has the scale of an unwindowed buffer's and the
+ * averaging stages only need segmentsPerBuffer as many segments per average for the same live time. Segments spanning two buffers keep the
+ * alternating signs of the conversion running across the join.
+ * Function definitions and documentation are in welchSegmenter.cpp.
+ *
+ */
+class WelchSegmenter {
+public:
+    WelchSegmenter(U32 samplesPerSegment, int window, int segmentsPerBuffer);
+    ~WelchSegmenter();
+
+    WelchSegmenter(const WelchSegmenter&) = delete;
+    WelchSegmenter& operator=(const WelchSegmenter&) = delete;
+
+    static std::vector<double> windowTable(int window, U32 length);
+
+    void reset() { havePrevious = false; }
+    pipeline_complex* input() { return current; }
+    int segmentsReady() const { return havePrevious ? segmentsPerBuffer : 1; }
+    void writeSegment(int segment, pipeline_complex* output) const;
+    void advance();
+
+    U32 samplesPerSegment() const { return N; }
+    int window() const { return windowType; }
+    int segments() const { return segmentsPerBuffer; }
+
+private:
+    U32 N;
+    int windowType;
+    int segmentsPerBuffer;
+    U32 hop; // Samples between the starts of consecutive segments
+
+    std::vector<pipeline_real> windowValues;
+    pipeline_complex* previous;
+    pipeline_complex* current;
+    bool havePrevious = false;
+};
+
+#endif // WELCHSEGMENTER_H
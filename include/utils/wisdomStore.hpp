@@ -0,0 +1,43 @@
+/**
+ * @file wisdomStore.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for WisdomStore, an on-disk FFTW wisdom cache keyed by transform size, batch size, precision and planner mode.
+ * @version 0.1
+ * @date 2023-11-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef WISDOMSTORE_H
+#define WISDOMSTORE_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Creates FFTW plans from wisdom stored on disk, one file per (N, batch size, precision, planner threads, planner rigor) key.
+ * Wisdom from a more rigorous planner also satisfies a less rigorous request, so a FFTW_MEASURE plan is built from FFTW_PATIENT or
+ * FFTW_EXHAUSTIVE wisdom made offline by fftw_planner (see src/fftwPlanning.cpp) when it exists. Only a size that has never been planned
+ * is measured, and its wisdom is written as soon as the plan is made so it survives a crash.
+ * Function definitions and documentation are in wisdomStore.cpp.
+ *
+ */
+class WisdomStore {
+public:
+    WisdomStore(std::string directory = "fftwWisdom") : directory(directory) {};
+    ~WisdomStore(){};
+
+    fftw_plan planDFT(int N, int batchSize = 1, unsigned flags = FFTW_MEASURE);
+    fftwf_plan planDFTf(int N, int batchSize = 1, unsigned flags = FFTW_MEASURE);
+
+    std::string wisdomFilename(int N, int batchSize, bool singlePrecision, unsigned flags);
+
+    int plannerThreads = 1; // Threads set with fftw_plan_with_nthreads, part of the key since threaded plans differ
+
+private:
+    std::string directory;
+
+    std::vector<unsigned> levelsAtLeast(unsigned flags);
+};
+
+#endif // WISDOMSTORE_H
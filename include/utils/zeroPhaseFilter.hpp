@@ -0,0 +1,62 @@
+/**
+ * @file zeroPhaseFilter.hpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Class definition for ZeroPhaseFilter, the forward-backward IIR filter used to smooth baselines.
+ * @version 0.1
+ * @date 2023-11-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ZEROPHASEFILTER_H
+#define ZEROPHASEFILTER_H
+
+#include "decs.hpp"
+
+/**
+ * @brief Zero-phase (forward-backward) filtering with the second order sections of a DspFilters cascade, like scipy's sosfiltfilt.
+ * The signal is extended at both ends by its odd reflection, and each pass starts every section from its steady state for the first sample it
+ * sees, so the edges don't ring and no long constant padding is needed. The backward pass iterates in reverse over the same buffer instead of
+ * reversing copies of it.
+ * The filter holds only coefficients, so one object can be shared by several threads and copied freely. applyBatch() filters several signals of
+ * the same length at once, interleaved so that each section updates FILTER_SIMD_LANES signals with one vector operation.
+ * Cascades of up to MAX_FIXED_SECTIONS sections (every design of the order 6 baseline filter) run through kernels specialized on the section
+ * count and on 1 or FILTER_SIMD_LANES lanes, which unroll both loops and keep the coefficients and state in registers. Other cascades and
+ * partial lane groups use the generic kernel.
+ * Function definitions and documentation are in zeroPhaseFilter.cpp.
+ *
+ */
+class ZeroPhaseFilter {
+public:
+    ZeroPhaseFilter(){};
+
+    void setSections(Dsp::Cascade& cascade);
+    bool empty() const { return sections.empty(); }
+    void setFixedKernels(bool enabled) { fixedKernels = enabled; }
+
+    void apply(std::vector<double>& signal) const;
+    void applyBatch(const std::vector<std::vector<double>*>& signals) const;
+
+private:
+    // Normalized section coefficients (a0 = 1) and the section's steady state for a unit input, scaled by the gain of the sections before it
+    struct Section {
+        double b0, b1, b2, a1, a2;
+        double zi1, zi2;
+    };
+
+    size_t padLength(size_t length) const;
+    void filterInterleaved(double* data, size_t length, size_t lanes) const;
+    template <size_t NumSections, size_t Lanes>
+    void filterInterleavedFixed(double* data, size_t length) const;
+    template <size_t NumSections>
+    bool filterInterleavedFixed(double* data, size_t length, size_t lanes) const;
+
+    static constexpr size_t MAX_FIXED_SECTIONS = 3;
+
+    std::vector<Section> sections;
+    alignas(64) double coefficients[5*MAX_FIXED_SECTIONS]; // b0, b1, b2, a1, a2 of each section, read by the fixed kernels
+    bool fixedKernels = true;
+};
+
+#endif // ZEROPHASEFILTER_H
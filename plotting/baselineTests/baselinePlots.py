@@ -1,12 +1,17 @@
 import numpy as np
 import matplotlib.pyplot as plt
+import os
+import sys
 
-rawData = np.loadtxt("baseline/rawData.csv", delimiter=",")
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import spectrumFile
 
-baseline = np.loadtxt("baseline/baseline.csv", delimiter=",")
-runningAverage = np.loadtxt("baseline/runningAverage.csv", delimiter=",")
-freq = np.loadtxt("baseline/freq.csv", delimiter=",")
-outliers = np.loadtxt("baseline/outliers.csv", delimiter=",").astype(int)
+rawData = spectrumFile.load("baseline/rawData.csv")
+
+baseline = spectrumFile.load("baseline/baseline.csv")
+runningAverage = spectrumFile.load("baseline/runningAverage.csv")
+freq = spectrumFile.load("baseline/freq.csv")
+outliers = spectrumFile.load("baseline/outliers.csv").astype(int)
 
 
 # Plot in the first subplot
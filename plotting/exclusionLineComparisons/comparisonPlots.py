@@ -1,28 +1,30 @@
 import numpy as np
 import matplotlib.pyplot as plt
 import os
+import sys
 
-# Get a list of all .csv files in the "data" folder
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import spectrumFile
+
+# Get a list of all spectrum files in the "data" folder
 metric_folder = "metrics"
-metric_files = [f for f in os.listdir(metric_folder) if f.endswith(".csv")]
+metric_files = spectrumFile.spectrum_files(metric_folder)
 
-# Load data from each .csv file and store it in the data_arrays list
+# Load data from each file and store it in the data_arrays list
 metric_arrays = []
-for csv_file in metric_files:
-    file_path = os.path.join(metric_folder, csv_file)
-    data = np.loadtxt(file_path, delimiter=",")
+for file_path in metric_files:
+    data = spectrumFile.load(file_path)
     metric_arrays.append(data)
 
 
-# Get a list of all .csv files in the "data" folder
+# Get a list of all spectrum files in the "data" folder
 data_folder = "data"
-csv_files = [f for f in os.listdir(data_folder) if f.endswith(".csv")]
+csv_files = spectrumFile.spectrum_files(data_folder)
 
-# Load data from each .csv file and store it in the data_arrays list
+# Load data from each file and store it in the data_arrays list
 data_arrays = []
-for csv_file in csv_files:
-    file_path = os.path.join(data_folder, csv_file)
-    data = np.loadtxt(file_path, delimiter=",")
+for file_path in csv_files:
+    data = spectrumFile.load(file_path)
     data_arrays.append(data)
 
 
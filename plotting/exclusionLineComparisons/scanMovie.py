@@ -2,18 +2,21 @@ import numpy as np
 import matplotlib.pyplot as plt
 from matplotlib.animation import FuncAnimation
 import os
+import sys
 
-# Get a list of all .csv files in the "data" folder
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import spectrumFile
+
+# Get a list of all spectrum files in the "data" folder
 scanWIP_folder = "scanProgress"
-scan_files = [f for f in os.listdir(scanWIP_folder) if f.endswith(".csv")]
+scan_files = spectrumFile.spectrum_files(scanWIP_folder)
 
 # Initialize a list to store the data
 scan_data = []
 
-# Load data from each .csv file and store it in the scan_data list
-for csv_file in scan_files:
-    file_path = os.path.join(scanWIP_folder, csv_file)
-    data = np.loadtxt(file_path, delimiter=",")
+# Load data from each file and store it in the scan_data list
+for file_path in scan_files:
+    data = spectrumFile.load(file_path)
 
     # Assuming data is a 2D array where each row represents a power spectrum
     spectra_list = data.tolist()  # Convert the numpy array to a list of lists
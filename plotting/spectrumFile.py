@@ -0,0 +1,121 @@
+"""Reader for the binary spectrum files written by SpectrumFileWriter (include/utils/spectrumFile.hpp).
+
+read(path) returns the header, axis and records of a file. load(path) returns the same rows np.loadtxt returns for the CSV export of
+the file, so plotting scripts work on either format. A path ending in .csv falls back to the .spec file of the same name when the CSV
+does not exist. Delta files, the exclusion line progress snapshots that only hold the bins changed since the previous snapshot, are
+rebuilt into one full record per snapshot.
+"""
+import os
+
+import numpy as np
+
+MAGIC = b"SPECBIN\0"
+VERSION = 1
+EXTENSION = ".spec"
+
+AXIS_NONE, AXIS_UNIFORM, AXIS_EXPLICIT = 0, 1, 2
+FILE_SINGLE, FILE_SEQUENCE, FILE_DELTAS = 0, 1, 2
+
+HEADER = np.dtype(
+    [
+        ("magic", "S8"),
+        ("version", "<u4"),
+        ("axisType", "<u4"),
+        ("numBins", "<u8"),
+        ("numRecords", "<u8"),
+        ("arraysPerRecord", "<u4"),
+        ("kind", "<u4"),
+        ("axisStart", "<f8"),
+        ("axisStep", "<f8"),
+        ("trueCenterFreq", "<f8"),
+    ]
+)
+assert HEADER.itemsize == 64
+
+DELTA_HEADER = np.dtype([("firstBin", "<u8"), ("numBins", "<u8"), ("keyframe", "<u4"), ("reserved", "<u4")])
+assert DELTA_HEADER.itemsize == 24
+
+
+def read(path):
+    """Returns (header, axis, records). header is a dict, axis is None for plain arrays and records has shape
+    (numRecords, arraysPerRecord, numBins). The file is memory-mapped, so large files load lazily."""
+    header = np.fromfile(path, dtype=HEADER, count=1)
+    if header.size != 1 or header["magic"][0] != MAGIC.rstrip(b"\0"):
+        raise ValueError(f"{path} is not a spectrum file")
+    header = {name: header[name][0].item() for name in HEADER.names}
+    if header["version"] != VERSION:
+        raise ValueError(f"{path} is spectrum file version {header['version']}, expected {VERSION}")
+
+    numBins = header["numBins"]
+    offset = HEADER.itemsize
+    axis = None
+    if header["axisType"] == AXIS_UNIFORM:
+        axis = header["axisStart"] + np.arange(numBins) * header["axisStep"]
+    elif header["axisType"] == AXIS_EXPLICIT:
+        axis = np.fromfile(path, dtype="<f8", count=numBins, offset=offset)
+        offset += 8 * numBins
+
+    if header["kind"] == FILE_DELTAS:
+        return header, axis, read_deltas(path, offset, header["numRecords"], numBins)
+
+    shape = (header["numRecords"], header["arraysPerRecord"], numBins)
+    if np.prod(shape) == 0:
+        records = np.zeros(shape)
+    else:
+        records = np.memmap(path, dtype="<f8", mode="r", offset=offset, shape=shape)
+    return header, axis, records
+
+
+def read_deltas(path, offset, numRecords, numBins):
+    """Rebuilds the records of a delta file, shape (numRecords, 1, numBins). Bins the line did not reach yet at a snapshot are NaN."""
+    data = np.memmap(path, dtype="u1", mode="r", offset=offset) if numRecords else np.zeros(0, dtype="u1")
+    records = np.full((numRecords, 1, numBins), np.nan)
+    line = np.full(numBins, np.nan)
+    position = 0
+    for i in range(numRecords):
+        delta = np.frombuffer(data, dtype=DELTA_HEADER, count=1, offset=position)[0]
+        position += DELTA_HEADER.itemsize
+        first, count = int(delta["firstBin"]), int(delta["numBins"])
+        values = np.frombuffer(data, dtype="<f8", count=count, offset=position)
+        position += 8 * count
+
+        if delta["keyframe"]:
+            line[:] = np.nan
+        line[first : first + count] = values
+        records[i, 0] = line
+    return records
+
+
+def resolve(path):
+    """The file to read for path: path itself, or its .spec counterpart when path is a missing .csv."""
+    if not os.path.exists(path) and path.endswith(".csv"):
+        binary = path[: -len(".csv")] + EXTENSION
+        if os.path.exists(binary):
+            return binary
+    return path
+
+
+def load(path):
+    """Loads a spectrum file, or a CSV export, as the rows np.loadtxt(path, delimiter=",") gives for the CSV export:
+    spectra are [powers, freq, (sigmaCombined)], exclusion line sequences are [freq, line, line, ...] and plain arrays are 1D."""
+    path = resolve(path)
+    if not path.endswith(EXTENSION):
+        return np.loadtxt(path, delimiter=",")
+
+    header, axis, records = read(path)
+    if header["kind"] in (FILE_SEQUENCE, FILE_DELTAS):
+        rows = [] if axis is None else [axis]
+        rows += [record[0] for record in records]
+        return np.array(rows)
+
+    arrays = [np.asarray(array) for array in records[0]] if len(records) else []
+    if axis is None:
+        return arrays[0] if len(arrays) == 1 else np.array(arrays)
+    return np.array(arrays[:1] + [axis] + arrays[1:])
+
+
+def spectrum_files(folder):
+    """Paths of the spectrum files and CSV exports in folder, sorted by name."""
+    return sorted(
+        os.path.join(folder, f) for f in os.listdir(folder) if f.endswith(EXTENSION) or f.endswith(".csv")
+    )
@@ -0,0 +1,147 @@
+"""Live viewer for the telemetry a scan publishes with TelemetryPublisher (include/utils/telemetryPublisher.hpp).
+
+The scan publishes the latest raw, processed, rebinned and combined spectra, the exclusion line, the stage metrics and the pipeline queue
+gauges to a named shared memory mapping. This script opens the mapping read-only and redraws the channels as they change, so watching a scan
+never slows it down.
+Run it on the acquisition machine while the scan runs, e.g. `python telemetryViewer.py` or `python telemetryViewer.py --name Local\\other`.
+Shared memory names are a Windows feature, so this only runs on Windows.
+"""
+import argparse
+import mmap
+import struct
+
+import numpy as np
+
+NAME = "Local\\scanTelemetry"
+MAGIC = b"SCANTLM\0"
+VERSION = 2
+
+RAW_SPECTRUM, PROCESSED_SPECTRUM, REBINNED_SPECTRUM, COMBINED_SPECTRUM, EXCLUSION_LINE, METRICS, QUEUE_GAUGES = range(7)
+CHANNEL_NAMES = ["Raw spectrum", "Processed spectrum", "Rebinned spectrum", "Combined spectrum", "Exclusion line", "Metrics",
+                 "Queue gauges"]
+TIMER_NAMES = ["acquisition", "FFT", "magnitude", "averaging", "processing", "decision", "saving"]
+QUEUE_NAMES = ["data", "FFT data", "mag data", "raw data", "rebinned data"]
+QUEUE_GAUGE_VALUES = 8  # depth, high water, capacity, pushes/s, pops/s, bytes in flight, items pushed, items discarded
+
+HEADER = struct.Struct("<8sIIIIQd")
+CHANNEL = struct.Struct("<QIIiIQdddd")
+assert HEADER.size == 40 and CHANNEL.size == 64
+
+
+class TelemetryReader:
+    """Read-only view of the telemetry mapping. read(channel) returns the channel's latest publication, or None if nothing consistent
+    has been published yet."""
+
+    def __init__(self, name=NAME):
+        probe = mmap.mmap(-1, HEADER.size, tagname=name, access=mmap.ACCESS_READ)
+        magic, version, numChannels, maxValues, _, channelStride, rateHz = HEADER.unpack(probe[: HEADER.size])
+        probe.close()
+        if magic != MAGIC:
+            raise RuntimeError(f"No scan is publishing telemetry to {name}")
+        if version != VERSION:
+            raise RuntimeError(f"{name} holds telemetry version {version}, expected {VERSION}")
+
+        self.numChannels, self.maxValues, self.channelStride, self.rateHz = numChannels, maxValues, channelStride, rateHz
+        self.memory = mmap.mmap(-1, HEADER.size + numChannels * channelStride, tagname=name, access=mmap.ACCESS_READ)
+
+    def publishing(self):
+        return self.memory[:8] == MAGIC
+
+    def read(self, channel, retries=16):
+        """Copies the channel and keeps the copy if its sequence was even and unchanged across the copy, i.e. the publisher did not write
+        the channel in the meantime. Returns a dict of the channel header with the values and their frequency axis."""
+        start = HEADER.size + channel * self.channelStride
+        for _ in range(retries):
+            before = struct.unpack_from("<Q", self.memory, start)[0]
+            if before == 0:
+                return None
+            if before % 2:
+                continue
+
+            raw = self.memory[start : start + self.channelStride]
+            after = struct.unpack_from("<Q", self.memory, start)[0]
+            if after != before:
+                continue
+
+            fields = CHANNEL.unpack_from(raw)
+            info = dict(zip(("sequence", "numValues", "decimation", "step", "reserved", "sourceBins", "axisStart", "axisStep",
+                             "trueCenterFreq", "timestamp"), fields))
+            info["values"] = np.frombuffer(raw, dtype="<f8", count=info["numValues"], offset=CHANNEL.size).copy()
+            info["axis"] = info["axisStart"] + np.arange(info["numValues"]) * info["axisStep"]
+            return info
+        return None
+
+
+def main():
+    import matplotlib.pyplot as plt
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--name", default=NAME, help="Shared memory name the scan publishes to")
+    parser.add_argument("--interval", type=float, default=0.2, help="Seconds between redraws")
+    args = parser.parse_args()
+
+    reader = TelemetryReader(args.name)
+    spectra = [RAW_SPECTRUM, PROCESSED_SPECTRUM, REBINNED_SPECTRUM, COMBINED_SPECTRUM, EXCLUSION_LINE]
+
+    fig, axes = plt.subplots(3, 2, figsize=(12, 9))
+    axes = axes.flatten()
+    lines = {}
+    for ax, channel in zip(axes, spectra):
+        ax.set_title(CHANNEL_NAMES[channel])
+        ax.set_xlabel("Frequency (MHz)")
+        (lines[channel],) = ax.plot([], [])
+    metricsText = axes[5].text(0.02, 0.98, "", va="top", family="monospace", transform=axes[5].transAxes)
+    axes[5].set_axis_off()
+
+    plt.ion()
+    plt.show()
+    seen = {}
+    latest = {}
+    while plt.fignum_exists(fig.number):
+        if not reader.publishing():
+            fig.suptitle("Scan stopped publishing")
+
+        for channel, ax in zip(spectra, axes):
+            info = reader.read(channel)
+            if info is None or info["sequence"] == seen.get(channel):
+                continue
+            seen[channel] = info["sequence"]
+            lines[channel].set_data(info["axis"], info["values"])
+            ax.relim()
+            ax.autoscale_view()
+            ax.set_title(f"{CHANNEL_NAMES[channel]} (step {info['step']}, {info['sourceBins']} bins, {info['decimation']} per point)")
+
+        # The metrics come once a step and the queue gauges while the step runs, so the text is redrawn when either changes
+        changed = False
+        for channel in (METRICS, QUEUE_GAUGES):
+            info = reader.read(channel)
+            if info is not None and info["sequence"] != seen.get(channel):
+                seen[channel] = info["sequence"]
+                latest[channel] = info
+                changed = True
+
+        if changed:
+            text = []
+            if METRICS in latest:
+                info = latest[METRICS]
+                values = info["values"]
+                text += [f"Step {info['step']} at {info['timestamp']:.1f} s"]
+                text += [f"{name:>12}: {values[i]:8.2f} s" for i, name in enumerate(TIMER_NAMES) if i < len(values)]
+                text += [f"{'metric ' + str(i):>12}: {value:8.0f}" for i, value in enumerate(values[len(TIMER_NAMES) :])]
+
+            if QUEUE_GAUGES in latest:
+                values = latest[QUEUE_GAUGES]["values"]
+                text += ["", f"{'queue':>13} {'depth':>6} {'high':>6} {'cap':>6} {'push/s':>8} {'pop/s':>8} {'MB':>7} {'drop':>6}"]
+                for i, name in enumerate(QUEUE_NAMES):
+                    gauge = values[i * QUEUE_GAUGE_VALUES : (i + 1) * QUEUE_GAUGE_VALUES]
+                    if len(gauge) == QUEUE_GAUGE_VALUES:
+                        depth, high, capacity, pushRate, popRate, bytesInFlight, _, discarded = gauge
+                        text.append(f"{name:>13} {depth:6.0f} {high:6.0f} {capacity:6.0f} {pushRate:8.1f} {popRate:8.1f} {bytesInFlight / 1e6:7.2f} {discarded:6.0f}")
+            metricsText.set_text("\n".join(text))
+
+        fig.canvas.draw_idle()
+        plt.pause(args.interval)
+
+
+if __name__ == "__main__":
+    main()
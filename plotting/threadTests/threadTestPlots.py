@@ -3,6 +3,11 @@ import matplotlib.pyplot as plt
 
 # to produce the normal pdf for plots
 from scipy.stats import norm
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import spectrumFile
 
 
 def plotVerticalHistogram(data, axis, ylim=6):
@@ -26,19 +31,19 @@ def plotVerticalHistogram(data, axis, ylim=6):
 
 
 # Load data from file
-freq = np.loadtxt("freq.csv", delimiter=",")
-outliers = np.loadtxt("outliers.csv", delimiter=",").astype(int)
+freq = spectrumFile.load("freq.csv")
+outliers = spectrumFile.load("outliers.csv").astype(int)
 
-baseline = np.loadtxt("baseline.csv", delimiter=",")
-runningAverage = np.loadtxt("runningAverage.csv", delimiter=",")
+baseline = spectrumFile.load("baseline.csv")
+runningAverage = spectrumFile.load("runningAverage.csv")
 
-rawSpectrum = np.loadtxt("rawSpectrum.csv", delimiter=",")
-processedSpectrum = np.loadtxt("processedSpectrum.csv", delimiter=",")
-# processedBaseline = np.loadtxt("processedBaseline.csv", delimiter=",")
+rawSpectrum = spectrumFile.load("rawSpectrum.csv")
+processedSpectrum = spectrumFile.load("processedSpectrum.csv")
+# processedBaseline = spectrumFile.load("processedBaseline.csv")
 
-combinedSpectrum = np.loadtxt("combinedSpectrum.csv", delimiter=",")
+combinedSpectrum = spectrumFile.load("combinedSpectrum.csv")
 
-exclusionLine = np.loadtxt("exclusionLine.csv", delimiter=",")
+exclusionLine = spectrumFile.load("exclusionLine.csv")
 
 
 # Get processed spectrum
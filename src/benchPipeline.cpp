@@ -0,0 +1,254 @@
+/**
+ * @file benchPipeline.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Microbenchmarks of the processing kernels on synthetic inputs the size of a real scan: N = 320k bins (100 Hz RBW at 32 MS/s),
+ *        20 sub-spectra per average and a 50-step scan. Each kernel is timed on its own and reported in ms per call, ns per bin and GB/s,
+ *        so kernel changes can be measured without instruments or the pipeline threads. See pipeline_benchmark for the whole pipeline.
+ *
+ *        GB/s counts the bytes of each kernel's inputs and outputs once, so kernels that make extra passes show below the memory bandwidth.
+ *
+ *        Usage: bench_pipeline [repeats]      (defaults to 20 calls per kernel, after one warm up call)
+ *
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "decs.hpp"
+
+#define BENCH_SAMPLE_RATE (32e6) // Samples per second, as used by ScanRunner
+#define BENCH_RBW (100) // Hz
+#define BENCH_AVERAGING_NUMBER (20) // Sub-spectra per averaged spectrum
+#define BENCH_NUM_STEPS (50) // Steps of the synthetic scan
+#define BENCH_STEP_SIZE (0.1) // MHz
+
+static double checksum = 0; // Sum of one value of every kernel's result, printed so no kernel is optimized away
+
+
+
+// Runs a kernel once to warm up and then repeats times, and prints its time per call, per bin and its effective bandwidth
+template <typename Kernel>
+static void timeKernel(const std::string& name, double bins, double bytes, int repeats, Kernel kernel) {
+    kernel();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < repeats; n++) {
+        kernel();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+
+    std::cout << "    " << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << 1e3*seconds << " ms" << std::setw(10) << 1e9*seconds/bins << " ns/bin"
+              << std::setw(10) << 1e-9*bytes/seconds << " GB/s" << std::endl;
+}
+
+
+
+int main(int argc, char* argv[]) {
+    int repeats = (argc > 1) ? max(1, std::stoi(argv[1])) : 20;
+    int N = (int)(BENCH_SAMPLE_RATE/BENCH_RBW);
+    double binWidth = BENCH_SAMPLE_RATE/N * 1e-6; // MHz
+
+
+    // Synthetic SNR on the spectrum's frequency axis, DC in the middle
+    DataProcessor processor;
+    std::vector<double> freqAxis(N);
+    processor.SNR.powers.resize(N);
+    for (int i = 0; i < N; i++) {
+        freqAxis[i] = (i - N/2)*binWidth;
+        processor.SNR.powers[i] = 1 + 4*std::exp(-freqAxis[i]*freqAxis[i]/16);
+    }
+    processor.SNR.freqAxis = freqAxis;
+    processor.SNR.trueCenterFreq = 0;
+    processor.trimmedSNR = processor.SNR;
+    processor.SNRprofile.load(processor.SNR);
+    processor.setFilterParams(BENCH_SAMPLE_RATE, 3, 10e3, 15.0);
+
+    for (int bin = 123; bin < N; bin += 997) {
+        processor.badBins.push_back(bin);
+    }
+
+    // Noise voltages with a tone, as the acquisition stage hands them to the FFT
+    fftw_complex* sampleData = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * N));
+    fftw_complex* FFTData = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * N));
+    for (int i = 0; i < N; i++) {
+        sampleData[i][0] = 0.1*(std::rand() / (double)RAND_MAX - 0.5) + 0.01*std::cos(0.05*i);
+        sampleData[i][1] = 0.1*(std::rand() / (double)RAND_MAX - 0.5) + 0.01*std::sin(0.05*i);
+    }
+
+    WisdomStore wisdomStore;
+    fftw_plan plan = wisdomStore.planDFT(N);
+
+    std::cout << "Processing kernels (N = " << std::to_string(N) << " bins, " << std::to_string(BENCH_AVERAGING_NUMBER) << " sub-spectra per average, "
+              << std::to_string(BENCH_NUM_STEPS) << " steps, " << std::to_string(repeats) << " calls each)" << std::endl;
+
+
+    // Acquisition side: FFT, magnitude loop of magnitudeThread, bad bin and DC masking, sub-spectrum averaging
+    timeKernel("processDataFFT", N, 2.0*N*sizeof(fftw_complex), repeats, [&]() {
+        processDataFFT(sampleData, FFTData, plan);
+        checksum += FFTData[0][0];
+    });
+
+    // One average of sub-spectra through each FFT backend: transform, power sum and the copy back of the sum. A device backend also pays
+    // for the upload of the block, so this compares FFT, magnitude and averaging together
+    pipeline_complex* blockData = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * BENCH_AVERAGING_NUMBER * N));
+    for (size_t i = 0; i < (size_t)BENCH_AVERAGING_NUMBER*N; i++) {
+        blockData[i][0] = (pipeline_real)sampleData[i % N][0];
+        blockData[i][1] = (pipeline_real)sampleData[i % N][1];
+    }
+    #if SINGLE_PRECISION_PIPELINE
+    pipeline_plan blockPlan = wisdomStore.planDFTf(N);
+    pipeline_plan blockBatchPlan = wisdomStore.planDFTf(N, BENCH_AVERAGING_NUMBER);
+    #else
+    pipeline_plan blockPlan = wisdomStore.planDFT(N);
+    pipeline_plan blockBatchPlan = wisdomStore.planDFT(N, BENCH_AVERAGING_NUMBER);
+    #endif
+
+    std::vector<int> backends = { FFT_BACKEND_FFTW };
+    #if CUDA_FFT_BACKEND
+    backends.push_back(FFT_BACKEND_CUFFT);
+    #endif
+    std::vector<pipeline_real> powerSum(N);
+    for (int backendType : backends) {
+        std::unique_ptr<FFTBackend> backend = FFTBackend::create(backendType, N, BENCH_AVERAGING_NUMBER, blockPlan, blockBatchPlan);
+        timeKernel("FFTBackend average (" + std::string(backend->name()) + ")", (double)N*BENCH_AVERAGING_NUMBER,
+                   (double)N*(BENCH_AVERAGING_NUMBER*sizeof(pipeline_complex) + sizeof(pipeline_real)), repeats, [&]() {
+            backend->load(blockData, BENCH_AVERAGING_NUMBER);
+            backend->addPowers(0, BENCH_AVERAGING_NUMBER);
+            backend->takePowerSum(powerSum.data());
+            checksum += powerSum[1];
+        });
+    }
+    pipeline_destroy_plan(blockBatchPlan);
+    pipeline_destroy_plan(blockPlan);
+    pipeline_free(blockData);
+
+    std::vector<double> magData(N);
+    timeKernel("Magnitude loop", N, (double)N*(sizeof(fftw_complex) + sizeof(double)), repeats, [&]() {
+        for (int i = 0; i < N; i++) {
+            magData[i] = ( FFTData[i][0]*FFTData[i][0] + FFTData[i][1]*FFTData[i][1] ) / N / 50; // Hard code in 50 Ohm input impedance
+        }
+        checksum += magData[1];
+    });
+
+    std::vector<double> maskedData;
+    timeKernel("removeBadBins + trimDC", N, 4.0*N*sizeof(double), repeats, [&]() {
+        maskedData = processor.trimDC(processor.removeBadBins(magData));
+        checksum += maskedData[1];
+    });
+
+    std::vector<std::vector<double>> subSpectra(BENCH_AVERAGING_NUMBER);
+    for (std::vector<double>& subSpectrum : subSpectra) {
+        subSpectrum = maskedData;
+        for (double& power : subSpectrum) {
+            power *= 0.5 + std::rand() / (double)RAND_MAX;
+        }
+    }
+
+    Spectrum rawSpectrum;
+    rawSpectrum.freqAxis = processor.SNR.freqAxis;
+    rawSpectrum.trueCenterFreq = 0;
+    timeKernel("averageVectors", (double)N*BENCH_AVERAGING_NUMBER, (BENCH_AVERAGING_NUMBER + 1.0)*N*sizeof(double), repeats, [&]() {
+        rawSpectrum.powers = averageVectors(subSpectra);
+        checksum += rawSpectrum.powers[1];
+    });
+
+    std::vector<int> outliers;
+    timeKernel("findOutliers", N, (double)N*sizeof(double), repeats, [&]() {
+        findOutliers(rawSpectrum.powers, 50, 5, outliers);
+        checksum += outliers.size();
+    });
+
+
+    // Processing side: baseline removal, rescaling, combining and rebinning
+    for (const std::vector<double>& subSpectrum : subSpectra) {
+        processor.addRawSpectrumToRunningAverage(subSpectrum);
+    }
+    processor.updateBaseline();
+
+    Spectrum processedSpectrum, processedBaseline;
+    timeKernel("rawToProcessed", N, 4.0*N*sizeof(double), repeats, [&]() {
+        std::tie(processedSpectrum, processedBaseline) = processor.rawToProcessed(rawSpectrum);
+        checksum += processedSpectrum.powers[1];
+    });
+
+    // Untrimmed first, since the trimmed kernel swaps trimmedSNR for its window
+    Spectrum rescaledSpectrum;
+    timeKernel("processedToRescaled", N, 3.0*N*sizeof(double), repeats, [&]() {
+        rescaledSpectrum = processor.processedToRescaled(processedSpectrum);
+        checksum += rescaledSpectrum.powers[1];
+    });
+
+    timeKernel("processedToRescaledTrimmed", 0.8*N, 3.0*0.8*N*sizeof(double), repeats, [&]() {
+        rescaledSpectrum = processor.processedToRescaledTrimmed(processedSpectrum, 0.1);
+        checksum += rescaledSpectrum.powers[1];
+    });
+
+    // One scan of the rescaled spectrum stepped BENCH_NUM_STEPS times. Per bin, the spectrum and SNR are read and the combined powers,
+    // weights, sigmas and trace counts updated
+    double width = (double)rescaledSpectrum.powers.size();
+    double scanBins = width*(BENCH_NUM_STEPS + 1);
+    CombinedSpectrumGrid scanGrid(REBINNING_WIDTH, CONVOLUTION_WIDTH);
+    timeKernel("addRescaledToCombined (scan)", scanBins, scanBins*(2*sizeof(double) + 2*(3*sizeof(double) + sizeof(int))), repeats, [&]() {
+        Spectrum steppedSpectrum = rescaledSpectrum;
+        scanGrid.clear();
+        for (int step = 0; step <= BENCH_NUM_STEPS; step++) {
+            steppedSpectrum.trueCenterFreq = step*BENCH_STEP_SIZE;
+            processor.addRescaledToCombined(steppedSpectrum, scanGrid);
+        }
+        checksum += scanGrid.size();
+    });
+
+    CombinedSpectrum combinedSpectrum = scanGrid.toCombinedSpectrum();
+    double combinedBins = (double)combinedSpectrum.powers.size();
+    CombinedSpectrum rebinnedScan;
+    timeKernel("rebinCombinedSpectrum (scan)", combinedBins, combinedBins*(4*sizeof(double) + sizeof(int)), repeats, [&]() {
+        rebinnedScan = processor.rebinCombinedSpectrum(combinedSpectrum, REBINNING_WIDTH, CONVOLUTION_WIDTH);
+        checksum += rebinnedScan.powers[0];
+    });
+
+
+    // Decision side, on the rebinned spectrum of a single step as the decision stage receives it
+    CombinedSpectrumGrid stepGrid(REBINNING_WIDTH, CONVOLUTION_WIDTH);
+    processor.addRescaledToCombined(rescaledSpectrum, stepGrid);
+    CombinedSpectrum rebinnedSpectrum = stepGrid.rebinnedSpectrum();
+    double rebinnedBins = (double)rebinnedSpectrum.powers.size();
+
+    // One scan, including the grid allocation of its first spectrum. Per bin, 3 inputs are read and 3 coefficient arrays updated
+    BayesFactors bayesFactors;
+    double exclusionBins = rebinnedBins*(BENCH_NUM_STEPS + 1);
+    timeKernel("updateExclusionLine (scan)", exclusionBins, exclusionBins*9*sizeof(double), repeats, [&]() {
+        bayesFactors = BayesFactors();
+        bayesFactors.reserveScan(BENCH_STEP_SIZE, BENCH_NUM_STEPS);
+        for (int step = 0; step <= BENCH_NUM_STEPS; step++) {
+            bayesFactors.updateExclusionLine(rebinnedSpectrum);
+            if (step < BENCH_NUM_STEPS) {
+                bayesFactors.step(BENCH_STEP_SIZE);
+            }
+        }
+        checksum += bayesFactors.exclusionLine.powers.back();
+    });
+
+    DecisionAgent decisionAgent;
+    decisionAgent.SNR = processor.SNR;
+    decisionAgent.targetCoupling = 6.5e-5;
+    decisionAgent.resizeSNRtoMatch(rebinnedSpectrum);
+    decisionAgent.setTargets();
+    decisionAgent.setPoints();
+
+    size_t windowBins = decisionAgent.trimmedSNR.powers.size();
+    const double* activeWindow = bayesFactors.exclusionLine.powers.data() + bayesFactors.exclusionLine.powers.size() - windowBins;
+    timeKernel("DecisionAgent::checkScore", (double)windowBins, 3.0*windowBins*sizeof(double), repeats, [&]() {
+        checksum += decisionAgent.checkScore(activeWindow, windowBins);
+    });
+
+
+    fftw_destroy_plan(plan);
+    fftw_free(sampleData);
+    fftw_free(FFTData);
+
+    std::cout << "Checksum: " << checksum << std::endl;
+    std::cout << "Exited Normally" << std::endl;
+    return 0;
+}
@@ -11,10 +11,14 @@
 #include "decs.hpp"
 
 #define REFRESH_PROCESSOR (0)
+#define RECORD_STATIC_RUN (0) // Record the raw stream of the static run to RECORDING_PATH
+#define REPLAY_RECORDING  (0) // Run both policies on the recording at RECORDING_PATH instead of the hardware
+#define RECORDING_PATH "recordings/staticRun.rec"
 
 
 void dynamicRun(int maxSpectraPerStep, int minSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling);
 void staticRun(int maxSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling);
+void plannedRun(int maxSpectraPerStep, int minSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling);
 
 int main() {
     int steps(50), subSpectraAveragingNumber(15);
@@ -29,6 +33,9 @@ int main() {
     //     std::cerr << e.what() << '\n';
     // }
 
+    // Same band as the dynamic run, visited in the order the planner expects the most exclusion from
+    // plannedRun(75, 45, subSpectraAveragingNumber, stepSize, steps, couplingTarget);
+
 
     int maxSpectra = 25;
     // int maxSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling
@@ -42,7 +49,11 @@ int main() {
 void dynamicRun(int maxSpectraPerStep, int minSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling){
     double maxIntegrationTime = maxSpectraPerStep*subSpectraAveragingNumber*0.01; // seconds
 
+    #if REPLAY_RECORDING
+    ScanRunner scanRunner(maxIntegrationTime, 0, 1, ACQUISITION_REPLAY, RECORDING_PATH);
+    #else
     ScanRunner scanRunner(maxIntegrationTime, 0, 1);
+    #endif
     scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
     scanRunner.setTarget(targetCoupling);
     scanRunner.decisionAgent.minShots = minSpectraPerStep;
@@ -52,6 +63,7 @@ void dynamicRun(int maxSpectraPerStep, int minSpectraPerStep, int subSpectraAver
     scanRunner.refreshBaselineAndBadBins(1, 32, 1);
     #endif
 
+    scanRunner.planScan(stepSize, numSteps);
     scanRunner.acquireData();
     for (int i = 0; i < numSteps; i++) {
         scanRunner.step(stepSize);
@@ -62,10 +74,39 @@ void dynamicRun(int maxSpectraPerStep, int minSpectraPerStep, int subSpectraAver
 }
 
 
+void plannedRun(int maxSpectraPerStep, int minSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling){
+    double maxIntegrationTime = maxSpectraPerStep*subSpectraAveragingNumber*0.01; // seconds
+
+    #if REPLAY_RECORDING
+    ScanRunner scanRunner(maxIntegrationTime, 0, 1, ACQUISITION_REPLAY, RECORDING_PATH);
+    #else
+    ScanRunner scanRunner(maxIntegrationTime, 0, 1);
+    #endif
+    scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
+    scanRunner.setTarget(targetCoupling);
+    scanRunner.decisionAgent.minShots = minSpectraPerStep;
+
+
+    #if REFRESH_PROCESSOR
+    scanRunner.refreshBaselineAndBadBins(1, 32, 1);
+    #endif
+
+    // Revisits may take up to as many steps again as the fixed scan
+    ScanPlanner planner(stepSize, numSteps, targetCoupling);
+    scanRunner.runPlannedScan(planner, 2*(numSteps + 1));
+
+    scanRunner.saveData(1);
+}
+
+
 void staticRun(int maxSpectraPerStep, int subSpectraAveragingNumber, double stepSize, int numSteps, double targetCoupling){
     double maxIntegrationTime = maxSpectraPerStep*subSpectraAveragingNumber*0.01; // seconds
 
+    #if REPLAY_RECORDING
+    ScanRunner scanRunner(maxIntegrationTime, 0, 0, ACQUISITION_REPLAY, RECORDING_PATH);
+    #else
     ScanRunner scanRunner(maxIntegrationTime, 0, 0);
+    #endif
     scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
     scanRunner.setTarget(targetCoupling);
 
@@ -73,6 +114,11 @@ void staticRun(int maxSpectraPerStep, int subSpectraAveragingNumber, double step
     scanRunner.refreshBaselineAndBadBins(1, 32, 1);
     #endif
 
+    #if RECORD_STATIC_RUN && !REPLAY_RECORDING
+    scanRunner.startRecording(RECORDING_PATH, RECORDING_CODEC_PACKED);
+    #endif
+
+    scanRunner.planScan(stepSize, numSteps);
     scanRunner.acquireData();
     for (int i = 0; i < numSteps; i++) {
         std::cout << "Stepping: i=" << std::to_string(i) << std::endl;
@@ -3,11 +3,11 @@
 
 
 /**
- * @brief Initializes the exclusion line with the first spectrum's data
+ * @brief Initializes the exclusion line with the first spectrum's data, and reserves the scan grid for the steps planned by reserveScan
  * 
  * @param combinedSpectrum - first spectrum in the sequence to initialize the exclusion line
  */
-void BayesFactors::init(CombinedSpectrum combinedSpectrum) {
+void BayesFactors::init(const CombinedSpectrum& combinedSpectrum) {
     // Clear any existing data
     exclusionLine.powers.clear();
     exclusionLine.freqAxis.clear();
@@ -15,78 +15,159 @@ void BayesFactors::init(CombinedSpectrum combinedSpectrum) {
 
     coeffSumA.clear();
     coeffSumB.clear();
+    scanAxis.clear();
 
     freqRes = combinedSpectrum.freqAxis[1] - combinedSpectrum.freqAxis[0];
+    windowSize = combinedSpectrum.freqAxis.size();
+    startIndex = 0;
+    totalShift = 0;
 
 
     // Create the frequency axis on an absolute scale
     double shift = combinedSpectrum.trueCenterFreq;
+    std::vector<double>& axis = scanAxis.edit();
+    axis.reserve(windowSize);
     for (double freq : combinedSpectrum.freqAxis) {
-        exclusionLine.freqAxis.push_back(shift + freq);
-        exclusionLine.powers.push_back(100);
-
-        coeffSumA.push_back(0);
-        coeffSumB.push_back(0);
+        axis.push_back(shift + freq);
     }
+    reserveGrid(windowSize + (size_t)std::ceil(plannedScanWidth/freqRes) + 1);
+
+    exclusionLine.powers.assign(windowSize, 100);
+    coeffSumA.assign(windowSize, 0);
+    coeffSumB.assign(windowSize, 0);
+    showWindow();
 
     cutoffIndex = (int)std::floor(exclusionLine.powers.size()/2);
 }
 
 
 
+/**
+ * @brief Plans the scan so the grid for all of it is allocated once, when the first spectrum initializes the exclusion line. Steps past the
+ *        plan still work, but reallocate the grid.
+ * 
+ * @param stepSize - size of each step in MHz
+ * @param numSteps - number of steps the scan will take
+ */
+void BayesFactors::reserveScan(double stepSize, int numSteps) {
+    plannedScanWidth = max(0.0, stepSize*numSteps);
+
+    if (!coeffSumA.empty()) {
+        reserveGrid(startIndex + windowSize + (size_t)std::ceil(plannedScanWidth/freqRes) + 1);
+    }
+}
+
+
+
+/**
+ * @brief Extends the scan grid to at least gridSize bins. The new bins are spaced by freqRes from the end of the first window, each computed
+ *        from its index so long scans don't drift.
+ * 
+ * @param gridSize - number of bins the grid must hold
+ */
+void BayesFactors::reserveGrid(size_t gridSize) {
+    if (gridSize <= scanAxis.size()) {
+        return;
+    }
+
+    std::vector<double>& axis = scanAxis.edit();
+    double windowEnd = axis[windowSize - 1];
+    axis.reserve(gridSize);
+    for (size_t i = axis.size(); i < gridSize; i++) {
+        axis.push_back(windowEnd + (double)(i - windowSize + 1)*freqRes);
+    }
+
+    exclusionLine.powers.reserve(gridSize);
+    coeffSumA.reserve(gridSize);
+    coeffSumB.reserve(gridSize);
+}
+
+
+
+/**
+ * @brief Points the exclusion line axis at the bins of the grid up to the end of the current window.
+ * 
+ */
+void BayesFactors::showWindow() {
+    exclusionLine.freqAxis = scanAxis;
+    exclusionLine.freqAxis.trim(0, scanAxis.size() - exclusionLine.powers.size());
+}
+
+
+
 /**
  * @brief Move the 90% exclusion line to its new coupling strengths based on updated information
  * 
  * @param combinedSpectrum combinedSpectrum object containing the data to update the exclusion cut with
  */
-void BayesFactors::updateExclusionLine(CombinedSpectrum combinedSpectrum){
+void BayesFactors::updateExclusionLine(const CombinedSpectrum& combinedSpectrum){
     if (coeffSumA.empty()) {
         init(combinedSpectrum);
     }
 
-    double coeffA, coeffB;
-    double scanFactor, newExcludedStrength;
-    double fourLnPtOne = 9.210340372; // Numerical factor 4*ln(0.1) that goes into quadratic formula, 0.1 set by desried exclusion level (90%)
+    updateExclusionLine(combinedSpectrum.powers.data(), combinedSpectrum.weightSum.data(), combinedSpectrum.sigmaCombined.data(), 
+                        combinedSpectrum.powers.size());
+}
 
-    for(int i=0; i<combinedSpectrum.powers.size(); i++){
-        scanFactor = (1/sigmaProc)*sqrt(combinedSpectrum.weightSum[i]);
 
-        coeffSumA[startIndex+i] += scanFactor*scanFactor/2;
-        coeffSumB[startIndex+i] += scanFactor*combinedSpectrum.powers[i]/combinedSpectrum.sigmaCombined[i];
 
-        coeffA = coeffSumA[startIndex+i];
-        coeffB = coeffSumB[startIndex+i];
+/**
+ * @brief Same as updateExclusionLine(const CombinedSpectrum&) on the arrays of a combined spectrum, starting at startIndex of the exclusion
+ *        line. The exclusion line must already be initialized. Bins below cutoffIndex only update their coefficients and stay at 0, so the
+ *        update is split at the cutoff instead of branching per bin. Both halves run the dispatched spectrum kernels.
+ * 
+ * @param powers - combined powers
+ * @param weightSum - combined weights
+ * @param sigmaCombined - combined standard deviations
+ * @param size - number of bins in each array
+ */
+void BayesFactors::updateExclusionLine(const double* powers, const double* weightSum, const double* sigmaCombined, size_t size){
+    double fourLnPtOne = 9.210340372; // Numerical factor 4*ln(0.1) that goes into quadratic formula, 0.1 set by desried exclusion level (90%)
+    double inverseSigmaProc = 1/sigmaProc;
+    double halfInverseVariance = inverseSigmaProc*inverseSigmaProc/2; // scanFactor^2/2 = weightSum/(2*sigmaProc^2), no sqrt needed
 
-        newExcludedStrength = (coeffB+std::sqrt(coeffB*coeffB+fourLnPtOne*coeffA))/(2*coeffA);
+    size_t split = (size_t)max(0, min((int)size, cutoffIndex - startIndex));
 
-        exclusionLine.powers[startIndex+i] = newExcludedStrength;
+    double* sumA = coeffSumA.data() + startIndex;
+    double* sumB = coeffSumB.data() + startIndex;
+    double* strength = exclusionLine.powers.data() + startIndex;
 
-        if(startIndex + i < cutoffIndex){
-            exclusionLine.powers[startIndex+i] = 0;
-        }
-    }
+    spectrumCoefficientUpdate(sumA, sumB, powers, weightSum, sigmaCombined, halfInverseVariance, inverseSigmaProc, size);
+    std::fill(strength, strength + split, 0.0);
+    spectrumQuadraticRoot(strength + split, sumA + split, sumB + split, fourLnPtOne, size - split);
 }
 
 
 
 /**
- * @brief Prepare to take data, moving forward by a given step size
+ * @brief Prepare to take data, moving the window by a given step size. Only the window offset and the end of the visible bins move, nothing
+ *        is reallocated while the scan stays within the grid reserved by reserveScan. Backward steps revisit bins already on the line, down
+ *        to the first window.
  * 
- * @param stepSize - the size of the step to take in MHz
+ * @param stepSize - the size of the step to take in MHz, negative to step back
  */
 void BayesFactors::step(double stepSize){
-    double shift = 0;
+    // Nothing to step until the first spectrum fixes the grid
+    if (coeffSumA.empty()) {
+        return;
+    }
 
-    while(shift <= stepSize){
-        shift += freqRes;
-        startIndex += 1;
+    long long newStart = std::llround((totalShift + stepSize)/freqRes);
+    if (newStart < 0) {
+        throw std::runtime_error("Error: Can't step " + std::to_string(-stepSize) + " MHz back, past the first window of the scan\n");
+    }
+    totalShift += stepSize;
+    startIndex = (int)newStart;
 
+    size_t visibleBins = max(exclusionLine.powers.size(), windowEnd());
+    if (visibleBins > scanAxis.size()) {
+        reserveGrid(max(visibleBins, 2*scanAxis.size()));
+    }
 
-        // Expand exclusion line vector
-        exclusionLine.freqAxis.push_back(exclusionLine.freqAxis.back() + freqRes);
-        exclusionLine.powers.push_back(100);
 
-        coeffSumA.push_back(0);
-        coeffSumB.push_back(0);
-    }
-}
\ No newline at end of file
+    // Expand the exclusion line over the new bins
+    exclusionLine.powers.resize(visibleBins, 100);
+    coeffSumA.resize(visibleBins, 0);
+    coeffSumB.resize(visibleBins, 0);
+    showWindow();
+}
@@ -33,11 +33,41 @@ void DataProcessor::setFilterParams(double sampleRate, int poleNumber, double cu
 
     chebyshevFilter.setParams(params);
 
+    // Same design, applied forward and backward by the baseline filter
+    Dsp::ChebyshevII::LowPass<6> baselineFilterDesign;
+    baselineFilterDesign.setup(poleNumber, sampleRate, cutoffFrequency, stopbandAttenuation);
+    baselineFilter.setSections(baselineFilterDesign);
+
     sampleRate_ = sampleRate;
     cutoffFrequency_ = cutoffFrequency;
 }
 
 
+/**
+ * @brief Copies what the per-spectrum processing functions read (baseline, SNR, bad bins and filter design) from another processor, so
+ *        several processing workers can each run rawToProcessed on their own processor. The response filter is redesigned from the source's
+ *        parameters rather than copied, because a copied cascade still points at the source's stages. The baseline filter has no state
+ *        and is copied.
+ * 
+ * @param source - processor to copy from. Only read
+ */
+void DataProcessor::loadProcessingState(const DataProcessor& source) {
+    chebyshevFilter.setParams(source.chebyshevFilter.getParams());
+    baselineFilter = source.baselineFilter;
+    sampleRate_ = source.sampleRate_;
+    cutoffFrequency_ = source.cutoffFrequency_;
+
+    currentBaseline = source.currentBaseline;
+    baselineRefresher = source.baselineRefresher;
+    baselineVersion = source.baselineVersion;
+    SNR = source.SNR;
+    trimmedSNR = source.trimmedSNR;
+    SNRprofile = source.SNRprofile;
+    trimmedSNRWindow = nullptr;
+    badBins = source.badBins;
+}
+
+
 /**
  * @brief 
  * 
@@ -54,9 +84,13 @@ std::tuple<std::vector<double>, std::vector<double>, std::vector<double>> DataPr
 
     for (int i = 0; i < numPoints; i++) {
         freqPoints[i] = 100 * static_cast<double>(i) / (numPoints - 1);
-        
-        response[i] = chebyshevFilter.response(freqPoints[i]*(cutoffFrequency_/sampleRate_));
+    }
+
+    // Evenly spaced, so the whole sweep is one batched evaluation
+    double normalization = cutoffFrequency_/sampleRate_;
+    chebyshevFilter.response(numPoints, 0.0, normalization*100/(numPoints - 1), response.data());
 
+    for (int i = 0; i < numPoints; i++) {
         magnitude[i] = std::abs(response[i]);
         phase[i] = std::arg(response[i]);
     }
@@ -108,27 +142,13 @@ void DataProcessor::displayFilterResponse() {
 }
 
 
+/**
+ * @brief Smooths the running average with the zero-phase baseline filter to get the current baseline.
+ * 
+ */
 void DataProcessor::updateBaseline() {
-    // Calculate the number of values to pad at the beginning
-    size_t paddingSize = static_cast<size_t>(0.3 * runningAverage.size());
-    
-    // Create the padded vector with repeated first value
-    std::vector<double> paddedVector(paddingSize, runningAverage.front());
-    paddedVector.insert(paddedVector.end(), runningAverage.begin(), runningAverage.end());
-
-    // Apply the bidirectional filter to the padded vector
-    double* averagedData[1];
-    averagedData[0] = paddedVector.data();
-    chebyshevFilter.process(static_cast<int>(paddedVector.size()), averagedData);
-
-    // Reverse the padded vector and apply the filter again
-    std::reverse(paddedVector.begin(), paddedVector.end());
-    averagedData[0] = paddedVector.data();
-    chebyshevFilter.process(static_cast<int>(paddedVector.size()), averagedData);
-    std::reverse(paddedVector.begin(), paddedVector.end());
-
-    // Update the baseline with the part that corresponds to the actual runningAverage vector
-    currentBaseline.assign(paddedVector.begin() + paddingSize, paddedVector.end());
+    currentBaseline = runningAverage;
+    baselineFilter.apply(currentBaseline);
 }
 
 
@@ -140,72 +160,155 @@ void DataProcessor::resetBaselining() {
 }
 
 
-std::tuple<Spectrum, Spectrum> DataProcessor::rawToProcessed(const Spectrum &rawSpectrum) {
-    Spectrum intermediateSpectrum = rawSpectrum;
 
-    int size = (int)rawSpectrum.powers.size();
+/**
+ * @brief Takes the newest baseline of the background refresher into currentBaseline, if there is a newer one than it holds and it is the
+ *        length of the current baseline. Lock free, so the processing stages call it at the start of every spectrum.
+ * 
+ * @return true - the baseline changed
+ */
+bool DataProcessor::pickUpBaseline() {
+    if (baselineRefresher == nullptr) {
+        return false;
+    }
 
-    #pragma omp simd
-    for (int i = 0; i < size; i++) {
-        intermediateSpectrum.powers[i] = rawSpectrum.powers[i] / currentBaseline[i];
+    std::shared_ptr<const RefreshedBaseline> latest = baselineRefresher->latest();
+    if (latest == nullptr || latest->version == baselineVersion || latest->values.size() != currentBaseline.size()) {
+        return false;
     }
+    currentBaseline = latest->values;
+    baselineVersion = latest->version;
+    return true;
+}
+
+
+std::tuple<Spectrum, Spectrum> DataProcessor::rawToProcessed(const Spectrum &rawSpectrum) {
+    Spectrum processedBaselineSpectrum;
+    Spectrum processedSpectrum = rawToProcessedSpectrum(rawSpectrum, &processedBaselineSpectrum.powers);
+    processedBaselineSpectrum.freqAxis = processedSpectrum.freqAxis;
+
+    return std::make_tuple(std::move(processedSpectrum), std::move(processedBaselineSpectrum));
+}
 
 
-    // Set up containers for the baselining process
-    std::vector<double> processedBaseline = intermediateSpectrum.powers;
 
-    double* processedBaselineData[1];
-    processedBaselineData[0] = processedBaseline.data();
+/**
+ * @brief Same processed spectrum as rawToProcessed, without building the residual baseline as a Spectrum unless asked for it. This is what
+ *        the processing stages run for every spectrum, as only diagnostics look at the baseline.
+ * 
+ * @param rawSpectrum - spectrum to process
+ * @param processedBaseline - if not NULL, set to the residual baseline the spectrum was divided by
+ * @return Spectrum - processed spectrum
+ */
+Spectrum DataProcessor::rawToProcessedSpectrum(const Spectrum &rawSpectrum, std::vector<double>* processedBaseline) {
+    pickUpBaseline();
+
+    size_t size = rawSpectrum.powers.size();
+    std::vector<double> intermediatePowers(size);
+    spectrumDivide(intermediatePowers.data(), rawSpectrum.powers.data(), currentBaseline.data(), size);
 
 
     // Calculate residual baseline
-    chebyshevFilter.process(static_cast<int>(size), processedBaselineData);
-    std::reverse(processedBaseline.begin(), processedBaseline.end());
-    chebyshevFilter.process(static_cast<int>(size), processedBaselineData);
-    std::reverse(processedBaseline.begin(), processedBaseline.end());
+    std::vector<double> residualBaseline = intermediatePowers;
+    baselineFilter.apply(residualBaseline);
 
 
     // Calculate processed spectrum
     Spectrum processedSpectrum;
     processedSpectrum.powers.resize(size);
     processedSpectrum.freqAxis = rawSpectrum.freqAxis;
+    processedSpectrum.trueCenterFreq = rawSpectrum.trueCenterFreq;
+    processedSpectrum.subSpectra = rawSpectrum.subSpectra;
+    processedSpectrum.nominalSubSpectra = rawSpectrum.nominalSubSpectra;
+    spectrumRatioMinusOne(processedSpectrum.powers.data(), intermediatePowers.data(), residualBaseline.data(), size);
 
-    for (size_t i = 0; i < size; ++i) {
-        processedSpectrum.powers[i] = intermediateSpectrum.powers[i] / processedBaseline[i] - 1;
+    if (processedBaseline != nullptr) {
+        *processedBaseline = std::move(residualBaseline);
     }
+    return processedSpectrum;
+}
 
-    Spectrum processedBaselineSpectrum;
-    processedBaselineSpectrum.powers = processedBaseline;
-    processedBaselineSpectrum.freqAxis = processedSpectrum.freqAxis;
 
-    return std::make_tuple(processedSpectrum, processedBaselineSpectrum);
+/**
+ * @brief Processes several raw spectra of the same length at once. Same as rawToProcessed, but the residual baselines of the spectra are
+ *        filtered together in SIMD lanes.
+ * 
+ * @param rawSpectra - spectra to process
+ * @return std::vector<Spectrum> - processed spectra, in the order of rawSpectra
+ */
+std::vector<Spectrum> DataProcessor::rawToProcessedBatch(const std::vector<Spectrum> &rawSpectra) {
+    pickUpBaseline();
+    std::vector<Spectrum> processedSpectra(rawSpectra.size());
+    std::vector<std::vector<double>> intermediatePowers(rawSpectra.size());
+    std::vector<std::vector<double>> processedBaselines(rawSpectra.size());
+    std::vector<std::vector<double>*> baselinePointers(rawSpectra.size());
+
+    for (size_t j = 0; j < rawSpectra.size(); j++) {
+        size_t size = rawSpectra[j].powers.size();
+        intermediatePowers[j].resize(size);
+        spectrumDivide(intermediatePowers[j].data(), rawSpectra[j].powers.data(), currentBaseline.data(), size);
+
+        processedBaselines[j] = intermediatePowers[j];
+        baselinePointers[j] = &processedBaselines[j];
+    }
+
+    // Calculate residual baselines
+    baselineFilter.applyBatch(baselinePointers);
+
+    for (size_t j = 0; j < rawSpectra.size(); j++) {
+        size_t size = intermediatePowers[j].size();
+        processedSpectra[j].powers.resize(size);
+        processedSpectra[j].freqAxis = rawSpectra[j].freqAxis;
+        processedSpectra[j].trueCenterFreq = rawSpectra[j].trueCenterFreq;
+        processedSpectra[j].subSpectra = rawSpectra[j].subSpectra;
+        processedSpectra[j].nominalSubSpectra = rawSpectra[j].nominalSubSpectra;
+        spectrumRatioMinusOne(processedSpectra[j].powers.data(), intermediatePowers[j].data(), processedBaselines[j].data(), size);
+    }
+
+    return processedSpectra;
+}
+
+
+void DataProcessor::addRawSpectrumToRunningAverage(const std::vector<double>& rawSpectrum) {
+    addAverageToRunningAverage(rawSpectrum, 1);
 }
 
 
-void DataProcessor::addRawSpectrumToRunningAverage(std::vector<double> rawSpectrum) {
+
+/**
+ * @brief Adds an already averaged spectrum of count sub-spectra to the running average, weighting it as count spectra.
+ * 
+ * @param averagedSpectrum - average of count raw sub-spectra
+ * @param count - number of sub-spectra in averagedSpectrum
+ */
+void DataProcessor::addAverageToRunningAverage(const std::vector<double>& averagedSpectrum, int count) {
     if (runningAverage.empty()) {
-        runningAverage = rawSpectrum;
+        runningAverage = averagedSpectrum;
+        numSpectra = count;
         return;
     }
 
-    numSpectra++;
+    numSpectra += count;
+
+    double factor = (double)(numSpectra - count) / (double)numSpectra;
+    double weight = (double)count / (double)numSpectra;
+    spectrumScaleAdd(runningAverage.data(), factor, averagedSpectrum.data(), weight, runningAverage.size());
 
-    double factor = (double)(numSpectra - 1) / (double)numSpectra;
-    for (int i = 0; i < runningAverage.size(); i++) {
-        runningAverage[i] = factor * runningAverage[i] + rawSpectrum[i] / numSpectra;
+    if (baselineRefresher != nullptr && baselineRefresher->feeds(this)) {
+        baselineRefresher->offerRunningAverage(runningAverage, numSpectra);
     }
 }
 
 
 
-std::vector<double> DataProcessor::removeBadBins(std::vector<double> unfilteredRawSpectrum) {
+std::vector<double> DataProcessor::removeBadBins(const std::vector<double>& unfilteredRawSpectrum) {
     std::vector<double> filteredSpectrum = unfilteredRawSpectrum;
 
     // Replace bad bins with a linear fill
     for (int index : badBins) {
         double fillValue = (
-            unfilteredRawSpectrum[(index + 50) % unfilteredRawSpectrum.size()] +
-            unfilteredRawSpectrum[(index + unfilteredRawSpectrum.size() - 50) % unfilteredRawSpectrum.size()]
+            unfilteredRawSpectrum[(index + BAD_BIN_FILL_OFFSET) % unfilteredRawSpectrum.size()] +
+            unfilteredRawSpectrum[(index + unfilteredRawSpectrum.size() - BAD_BIN_FILL_OFFSET) % unfilteredRawSpectrum.size()]
             ) / 2.0;
         
         filteredSpectrum[index] = fillValue;
@@ -216,17 +319,10 @@ std::vector<double> DataProcessor::removeBadBins(std::vector<double> unfilteredR
 
 
 
-std::vector<double> DataProcessor::trimDC(std::vector<double> untrimmedSpectrum){
+std::vector<double> DataProcessor::trimDC(const std::vector<double>& untrimmedSpectrum){
     std::vector<double> filteredSpectrum = untrimmedSpectrum;
 
-    if (DCbins.empty()) {
-        int i = findClosestIndex(SNR.freqAxis, -0.005);
-
-        while(SNR.freqAxis[i] <= 0.005){
-            DCbins.push_back(i);
-            i++;
-        }
-    }
+    initDCbins();
 
     double fillValue = (
         untrimmedSpectrum[(DCbins[0]-1)] +
@@ -243,39 +339,96 @@ std::vector<double> DataProcessor::trimDC(std::vector<double> untrimmedSpectrum)
 
 
 
-std::vector<std::vector<double>> DataProcessor::acquiredToRaw(fftw_complex* rawStream, int spectraPerAcquisition, int samplesPerSpectrum, fftw_plan plan){
-    // Slice the rawStream into subStreams and store them in the rawData vector
-    std::vector<fftw_complex*> procData(spectraPerAcquisition);
-
-    for (int i = 0; i < spectraPerAcquisition; ++i) {
-        int startIndex = i * samplesPerSpectrum;
-        fftw_complex* subStream = (fftw_complex*) fftw_malloc(samplesPerSpectrum * sizeof(fftw_complex));
+/**
+ * @brief Same result as trimDC(removeBadBins(spectrum)) but applied in place through the bin repair plan, without copying the spectrum. Both
+ *        fills are linear, so masking a sum or average of sub-spectra gives the same result as averaging the masked sub-spectra.
+ *        The plan is built on first use if prepareBinRepair wasn't called for this spectrum length.
+ * 
+ * @param spectrum - raw power spectrum to mask in place
+ */
+void DataProcessor::maskBadBinsAndDC(std::vector<double>& spectrum) {
+    if (binRepairPlan.spectrumSize() != spectrum.size()) {
+        prepareBinRepair(spectrum.size());
+    }
+    binRepairPlan.apply(spectrum);
+}
 
-        for (int j = 0; j < samplesPerSpectrum; ++j) {
-            subStream[j][0] = rawStream[startIndex + j][0]; // Real part
-            subStream[j][1] = rawStream[startIndex + j][1]; // Imaginary part
-        }
 
-        procData[i] = processDataFFT(subStream, plan, samplesPerSpectrum);
 
-        fftw_free(subStream);
+/**
+ * @brief Builds the bin repair plan used by maskBadBinsAndDC for the current bad bins, unless it is already up to date. Call before the
+ *        pipeline threads start, since they apply the plan concurrently.
+ * 
+ * @param spectrumSize - length of the spectra that will be masked
+ */
+void DataProcessor::prepareBinRepair(size_t spectrumSize) {
+    initDCbins();
+    if (!binRepairPlan.builtFor(badBins, DCbins, spectrumSize)) {
+        binRepairPlan.build(badBins, DCbins, spectrumSize);
     }
+}
 
 
-    // Process the data into voltages
-    std::vector<std::vector<double>> fftVoltage(spectraPerAcquisition);
-    std::vector<std::vector<double>> fftPower(spectraPerAcquisition);
 
-    for (int i=0; i < spectraPerAcquisition; i++) {
-        for (int j=0; j < samplesPerSpectrum; j++){
-            fftPower[i].push_back(( procData[i][j][0]*procData[i][j][0] + procData[i][j][1]*procData[i][j][1] ) / samplesPerSpectrum / 50); // Hard code in 50 Ohm input impedance
+/**
+ * @brief Finds the bins within 5 kHz of DC on first use.
+ * 
+ */
+void DataProcessor::initDCbins() {
+    if (DCbins.empty()) {
+        int i = findClosestIndex(SNR.freqAxis, -0.005);
+
+        // A downconverted band may not reach DC at all
+        while(i < (int)SNR.freqAxis.size() && SNR.freqAxis[i] <= 0.005){
+            if (SNR.freqAxis[i] >= -0.005) {
+                DCbins.push_back(i);
+            }
+            i++;
+        }
+
+        // DC at the very edge of the band can't be filled from both sides
+        if (!DCbins.empty() && (DCbins.front() < 1 || DCbins.back() + 1 >= (int)SNR.freqAxis.size())) {
+            DCbins.clear();
         }
     }
+}
+
 
-    for (fftw_complex* data : procData) {
-        fftw_free(data);
+
+/**
+ * @brief Fourier transforms a full acquisition stream and converts it into power spectra. The spectra are transformed in place in the stream,
+ *        batchSize at a time with the batched plan, so no sub-stream is copied and only one batch of FFT output is held at once.
+ * 
+ * @param rawStream - fftw_complex array holding spectraPerAcquisition contiguous spectra, e.g. from ATS::AcquireData
+ * @param spectraPerAcquisition - number of spectra in rawStream
+ * @param samplesPerSpectrum - number of samples per spectrum
+ * @param plan - single spectrum plan of size samplesPerSpectrum
+ * @param batchPlan - plan from fftw_plan_many_dft over batchSize spectra with stride 1 and distance samplesPerSpectrum. May be NULL
+ * @param batchSize - number of spectra batchPlan was made for
+ * @return std::vector<std::vector<double>> - power spectrum of each spectrum in the stream
+ */
+std::vector<std::vector<double>> DataProcessor::acquiredToRaw(fftw_complex* rawStream, int spectraPerAcquisition, int samplesPerSpectrum, fftw_plan plan, 
+                                                              fftw_plan batchPlan, int batchSize){
+    batchSize = (batchPlan != NULL) ? max(1, batchSize) : 1;
+    fftw_complex* FFTData = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * batchSize * samplesPerSpectrum);
+
+    std::vector<std::vector<double>> fftPower(spectraPerAcquisition, std::vector<double>(samplesPerSpectrum));
+
+    for (int i = 0; i < spectraPerAcquisition; i += batchSize) {
+        int numSpectra = min(batchSize, spectraPerAcquisition - i);
+        processDataFFTBatched(rawStream + (size_t)i*samplesPerSpectrum, FFTData, numSpectra, samplesPerSpectrum, plan, batchPlan, batchSize);
+
+        // Process the batch into powers
+        for (int k = 0; k < numSpectra; k++) {
+            fftw_complex* spectrum = FFTData + (size_t)k*samplesPerSpectrum;
+            for (int j = 0; j < samplesPerSpectrum; j++) {
+                fftPower[i+k][j] = ( spectrum[j][0]*spectrum[j][0] + spectrum[j][1]*spectrum[j][1] ) / samplesPerSpectrum / 50; // Hard code in 50 Ohm input impedance
+            }
+        }
     }
 
+    fftw_free(FFTData);
+
     return fftPower;
 }
 
@@ -285,189 +438,220 @@ Spectrum DataProcessor::loadSNR(std::string filenameSNR, std::string filenameSNR
     SNR.freqAxis = readVector(filenameSNRfreqs);
 
     trimmedSNR = SNR;
+    SNRprofile.load(SNR);
+    trimmedSNRWindow = nullptr;
 
     return SNR;
 }
 
 
 
-void DataProcessor::trimSNRtoMatch(Spectrum spectrum) {
-    int startIndex=0;
-    while (SNR.freqAxis[startIndex+1] < spectrum.freqAxis[0]) {
-        startIndex++;
+/**
+ * @brief Loads the SNR, bad bins and baseline from the mapped generation of a calibration store, in place of loadSNR and the CSV files. A
+ *        calibration without an SNR leaves the loaded SNR as it is.
+ * 
+ * @param store - store with a mapped calibration
+ */
+void DataProcessor::loadCalibration(const CalibrationStore& store) {
+    const CalibrationHeader& header = store.header();
+    if (header.SNRBins > 0) {
+        SNR.powers.assign(store.SNR(), store.SNR() + header.SNRBins);
+        SNR.freqAxis = std::vector<double>(store.SNRFreqs(), store.SNRFreqs() + header.SNRBins);
+        trimmedSNR = SNR;
+        SNRprofile.load(SNR);
+        trimmedSNRWindow = nullptr;
     }
+    badBins.assign(store.badBins(), store.badBins() + header.numBadBins);
+    currentBaseline.assign(store.baseline(), store.baseline() + header.baselineBins);
+}
 
-    trimmedSNR.powers.clear();
-    trimmedSNR.freqAxis.clear();
 
-    trimmedSNR.powers.resize(spectrum.freqAxis.size());
-    trimmedSNR.freqAxis.resize(spectrum.freqAxis.size());
 
-    for(int i=0; i < trimmedSNR.powers.size(); i++){
-        trimmedSNR.powers[i] = SNR.powers[i+startIndex];
-        trimmedSNR.freqAxis[i] = SNR.freqAxis[i+startIndex];
+/**
+ * @brief Narrows everything loaded bin by bin for the full span (SNR, baseline and bad bins) to the band a downconverted spectrum covers.
+ *        Bins keep their frequencies, so the SNR axis stays the frequency offset of each bin from the receiver frequency. The baseline was
+ *        measured without the downconversion filter, so refresh it once the band is set.
+ * 
+ * @param firstBin - bin of the full span the band starts at
+ * @param numBins - bins in the band
+ */
+void DataProcessor::selectBand(size_t firstBin, size_t numBins) {
+    if (firstBin + numBins > SNR.powers.size() || firstBin + numBins > SNR.freqAxis.size()) {
+        throw std::runtime_error("Error: Band of " + std::to_string(numBins) + " bins from bin " + std::to_string(firstBin) + 
+                                 " reaches past the SNR profile\n");
     }
-}
 
+    SNR.powers = std::vector<double>(SNR.powers.begin() + firstBin, SNR.powers.begin() + firstBin + numBins);
+    SNR.freqAxis.trim(firstBin, SNR.freqAxis.size() - firstBin - numBins);
+    trimmedSNR = SNR;
+    SNRprofile.load(SNR);
+    trimmedSNRWindow = nullptr;
 
+    if (currentBaseline.size() >= firstBin + numBins) {
+        currentBaseline = std::vector<double>(currentBaseline.begin() + firstBin, currentBaseline.begin() + firstBin + numBins);
+    }
+    else {
+        currentBaseline.clear();
+    }
+    runningAverage.clear();
+    numSpectra = 0;
 
-Spectrum DataProcessor::processedToRescaled(const Spectrum &processedSpectrum) {
-    Spectrum rescaledSpectrum = processedSpectrum;
-
-    double mean, stddev;
-    std::tie(mean, stddev) = vectorStats(rescaledSpectrum.powers);
-
-    for (int i=0; i < rescaledSpectrum.powers.size(); i++){
-        rescaledSpectrum.powers[i] /= (stddev*trimmedSNR.powers[i]);
+    std::vector<int> bandBadBins;
+    for (int bin : badBins) {
+        if (bin >= (int)firstBin && bin < (int)(firstBin + numBins)) {
+            bandBadBins.push_back(bin - (int)firstBin);
+        }
     }
-    
-    return rescaledSpectrum;
+    badBins = std::move(bandBadBins);
+    DCbins.clear();
 }
 
 
 
+/**
+ * @brief Trims the SNR to the frequency range of a spectrum. The window comes from the SNR profile, which only scans the SNR axis the first
+ *        time a frequency window is seen, and trimmedSNR is only rewritten when the window changes.
+ * 
+ * @param spectrum - spectrum to match
+ */
+void DataProcessor::trimSNRtoMatch(const Spectrum& spectrum) {
+    const SNRProfile::Window& window = SNRprofile.alignedWindow(spectrum.freqAxis);
+    if (&window == trimmedSNRWindow) {
+        return;
+    }
 
-void DataProcessor::addRescaledToCombined(const Spectrum &rescaledSpectrum, CombinedSpectrum &combinedSpectrum)
-{
-    std::vector<double> trueRescaledRange = rescaledSpectrum.freqAxis;
-    double shift = rescaledSpectrum.trueCenterFreq;
-
+    trimmedSNRWindow = &window;
+    trimmedSNR.powers = window.powers;
+    trimmedSNR.freqAxis = window.freqAxis;
+}
 
-    // Shift the frequency range to be absolute rather than relative
-    for(int i=0; i<trueRescaledRange.size(); i++){
-        trueRescaledRange[i] += shift;
-    }
 
 
-    // Either set the combined spectrum frequency range and powers or expand it as necessary
-    if(combinedSpectrum.freqAxis.empty()){
-        combinedSpectrum.freqAxis = trueRescaledRange;
-        combinedSpectrum.powers = rescaledSpectrum.powers;
+Spectrum DataProcessor::processedToRescaled(const Spectrum &processedSpectrum) {
+    Spectrum rescaledSpectrum = processedSpectrum;
 
-        
-        for(int i=0; i<trimmedSNR.powers.size(); i++){
-            combinedSpectrum.sigmaCombined.push_back(1/trimmedSNR.powers[i]);
-            combinedSpectrum.weightSum.push_back(trimmedSNR.powers[i]*trimmedSNR.powers[i]);
-            combinedSpectrum.numTraces.push_back(1);
-        }
-    }
+    double mean, stddev;
+    std::tie(mean, stddev) = vectorStats(rescaledSpectrum.powers);
+    stddev *= std::sqrt(averagingWeight(processedSpectrum));
 
+    size_t size = rescaledSpectrum.powers.size();
+    spectrumDivide(rescaledSpectrum.powers.data(), rescaledSpectrum.powers.data(), trimmedSNR.powers.data(), size);
+    spectrumScale(rescaledSpectrum.powers.data(), 1/stddev, size);
+    
+    return rescaledSpectrum;
+}
 
-    // Case where there may be a shift that needs to occur
-    else{
-        // Logic if the trace we're trying to add comes before the current combined spectrum for some reason
-        // Note the performance here is horrible since we have to "push_front" a vector -- avoid this at all costs!!
-        int shiftStart = 0;
-        double currFront = combinedSpectrum.freqAxis.front();
 
-        while(trueRescaledRange[shiftStart] < currFront){
-            shiftStart += 1;
 
-            // Maximum value of shiftStart is the final index of the rescaled range
-            if(shiftStart==(trueRescaledRange.size())) break;
-        }
-        shiftStart = shiftStart-1; // Value of negative one corresponds to no dangling values, the two ranges overlap completely
+/**
+ * @brief Same result as trimSpectrum, trimSNRtoMatch and processedToRescaled in turn, in one kernel. The trim is a view onto the processed
+ *        powers rather than an erase, the mean and standard deviation come from a single pass, and the powers are scaled with the cached
+ *        reciprocal of the trimmed SNR.
+ * 
+ * @param processedSpectrum - spectrum from rawToProcessed, untrimmed
+ * @param cutPercentage - fraction of the bins cut from each end, as in trimSpectrum
+ * @return Spectrum - trimmed, rescaled spectrum. Its axis is a window onto the processed spectrum's
+ */
+Spectrum DataProcessor::processedToRescaledTrimmed(const Spectrum &processedSpectrum, double cutPercentage) {
+    size_t size = processedSpectrum.powers.size();
+    size_t numCut = (size < 3) ? 0 : (size_t)std::round(size * cutPercentage);
+    size_t width = size - 2*numCut;
+    const double* powers = processedSpectrum.powers.data() + numCut;
+
+    Spectrum rescaledSpectrum;
+    rescaledSpectrum.freqAxis = processedSpectrum.freqAxis;
+    rescaledSpectrum.freqAxis.trim(numCut, numCut);
+    rescaledSpectrum.trueCenterFreq = processedSpectrum.trueCenterFreq;
+    rescaledSpectrum.subSpectra = processedSpectrum.subSpectra;
+    rescaledSpectrum.nominalSubSpectra = processedSpectrum.nominalSubSpectra;
+    if (width == 0) {
+        return rescaledSpectrum;
+    }
 
-        for(int i=shiftStart; i >= 0; i--){
-            combinedSpectrum.freqAxis.insert(combinedSpectrum.freqAxis.begin(), 1, trueRescaledRange[i]);
-            combinedSpectrum.weightSum.insert(combinedSpectrum.freqAxis.begin(), 1, 0);
-            combinedSpectrum.sigmaCombined.insert(combinedSpectrum.freqAxis.begin(), 1, 0);
-            combinedSpectrum.powers.insert(combinedSpectrum.freqAxis.begin(), 1, 0);
-        }
+    trimSNRtoMatch(rescaledSpectrum);
 
+    // Single pass population statistics, taken relative to the first value so the variance doesn't cancel
+    double shift = powers[0];
+    double sum, sumSquares;
+    spectrumMoments(powers, width, shift, sum, sumSquares);
+    double meanOffset = sum / width;
+    double stddev = std::sqrt(max(sumSquares / width - meanOffset*meanOffset, 0.0));
 
-        // Logic if the trace we're trying to add comes after the current combined spectrum (this is the case when we step forward)
-        int shiftBack = (int)trueRescaledRange.size()-1;
-        double currBack = combinedSpectrum.freqAxis.back();
+    // The SNR of an average grows with the root of its sub-spectra
+    double scale = 1/(stddev*std::sqrt(averagingWeight(processedSpectrum)));
+    rescaledSpectrum.powers.resize(width);
+    spectrumScaledProduct(rescaledSpectrum.powers.data(), powers, trimmedSNRWindow->reciprocal.data(), scale, width);
 
-        while(trueRescaledRange[shiftBack] > currBack){
-            shiftBack -= 1;
+    return rescaledSpectrum;
+}
 
-            // Minimum value of shiftStart is 0 
-            if(shiftBack==-1) break;     
-        }
-        shiftBack = shiftBack+1; // Value of trueRescaledRange.size() corresponds to no dangling values, the two ranges overlap completely
 
-        for(int i=shiftBack; i <trueRescaledRange.size(); i++){
-            combinedSpectrum.freqAxis.push_back(trueRescaledRange[i]);
-            combinedSpectrum.weightSum.push_back(0);
-            combinedSpectrum.sigmaCombined.push_back(0);
-            combinedSpectrum.powers.push_back(0);
-        }
 
 
+/**
+ * @brief Adds a rescaled spectrum to a combined spectrum, weighting it with the trimmed SNR scaled to its sub-spectra (see averagingWeight).
+ *        The overlap is found on the combination's integer bin grid, so the cost only depends on the width of the spectrum.
+ * 
+ * @param rescaledSpectrum - spectrum from processedToRescaled
+ * @param combinedGrid - combination to add to
+ */
+void DataProcessor::addRescaledToCombined(const Spectrum &rescaledSpectrum, CombinedSpectrumGrid &combinedGrid)
+{
+    combinedGrid.add(rescaledSpectrum, trimmedSNR.powers, averagingWeight(rescaledSpectrum));
+}
 
-        // Now do the vertical recombination
-        int fullRangeIndex = 0;
-        while(combinedSpectrum.freqAxis[fullRangeIndex] != trueRescaledRange.front()){
-            fullRangeIndex++;
 
-            if(fullRangeIndex==combinedSpectrum.freqAxis.size()){
-                std::cout << "An issue occured in adding this rescaled spectrum to the combined spectrum" << std::endl;
-                exit(-1);
-            }
-        }
 
-        double newSNRsq;
-        double oldSum;
-        double newSum;
-        for(int i=0; i<trueRescaledRange.size(); i++){
-            // Increase the number of contributing traces
-            combinedSpectrum.numTraces[i+fullRangeIndex] += 1;
-
-            // Add SNR (R_ij) squared to the sum
-            oldSum = combinedSpectrum.weightSum[i+fullRangeIndex];
-            newSNRsq = trimmedSNR.powers[i]*trimmedSNR.powers[i];
-            newSum = oldSum+newSNRsq;
-
-            // Update the sum normalization term and sigma in each bin
-            combinedSpectrum.weightSum[i+fullRangeIndex] = newSum;
-            combinedSpectrum.sigmaCombined[i+fullRangeIndex] = std::sqrt(1/newSum);
-
-            // Update the powers based on the reweighted contrubting traces
-            combinedSpectrum.powers[i+fullRangeIndex] *= (oldSum/newSum);
-            combinedSpectrum.powers[i+fullRangeIndex] += (newSNRsq/newSum)*rescaledSpectrum.powers[i]; 
-        }
+/**
+ * @brief Weight of an averaged spectrum relative to one of the batch the SNR holds for. Its noise falls with the root of its sub-spectra, so
+ *        its squared SNR, and its weight in a combination, goes with subSpectra/nominalSubSpectra. Spectra that don't record their batch,
+ *        such as those from files, weigh 1.
+ * 
+ * @param spectrum - raw, processed or rescaled spectrum
+ * @return double - subSpectra/nominalSubSpectra, or 1
+ */
+double DataProcessor::averagingWeight(const Spectrum& spectrum) {
+    if (spectrum.subSpectra <= 0 || spectrum.nominalSubSpectra <= 0) {
+        return 1;
     }
+    return (double)spectrum.subSpectra/spectrum.nominalSubSpectra;
 }
 
 
 
 /**
- * @brief 
+ * @brief Rebins a combined spectrum into coarse bins of rebinningWidthC bins, then takes a sliding sum of convolutionWidthK coarse bins 
+ *        through prefix sums (see CombinedSpectrumGrid::convolveCoarseBins). Only complete coarse bins are used.
  * 
- * @param combinedSpectrum 
- * @param rebinningWidthC 
- * @param convolutionWidthK 
- * @return CombinedSpectrum 
+ * @param combinedSpectrum - spectrum to rebin
+ * @param rebinningWidthC - fine bins per coarse bin
+ * @param convolutionWidthK - coarse bins per rebinned bin
+ * @return CombinedSpectrum - numCoarse - convolutionWidthK + 1 rebinned bins, each labelled with the frequency of its center bin
  * 
  * @todo Fix frequency assignment so it doesn't always round down for even rebinning widths
  */
-CombinedSpectrum DataProcessor::rebinCombinedSpectrum(CombinedSpectrum &combinedSpectrum, int rebinningWidthC=2, int convolutionWidthK=1){
-
+CombinedSpectrum DataProcessor::rebinCombinedSpectrum(const CombinedSpectrum &combinedSpectrum, int rebinningWidthC=2, int convolutionWidthK=1){
     CombinedSpectrum rebinnedSpectrum;
-
-    rebinnedSpectrum.numTraces = combinedSpectrum.numTraces;
     rebinnedSpectrum.trueCenterFreq = combinedSpectrum.trueCenterFreq;
 
-    int numRebinned = (int)std::ceil((int)combinedSpectrum.freqAxis.size()/rebinningWidthC);
-
-    for (int l=0; l<(numRebinned-1); l++){
-        rebinnedSpectrum.freqAxis.push_back(combinedSpectrum.freqAxis[l*rebinningWidthC + rebinningWidthC/2]);
-
-        rebinnedSpectrum.weightSum.push_back(0);
-        double weightedSum = 0;
-
-        for (int i=l*rebinningWidthC; i<(l+1)*rebinningWidthC; i++){
-            weightedSum += combinedSpectrum.powers[i]/combinedSpectrum.sigmaCombined[i]/combinedSpectrum.sigmaCombined[i];
-
-            rebinnedSpectrum.weightSum[l] += combinedSpectrum.weightSum[i];
+    size_t numCoarse = combinedSpectrum.freqAxis.size()/rebinningWidthC;
+    std::vector<double> weightedPowers(numCoarse, 0), weights(numCoarse, 0);
+    for (size_t l = 0; l < numCoarse; l++) {
+        for (size_t i = l*rebinningWidthC; i < (l + 1)*rebinningWidthC; i++) {
+            weightedPowers[l] += combinedSpectrum.powers[i]/combinedSpectrum.sigmaCombined[i]/combinedSpectrum.sigmaCombined[i];
+            weights[l] += combinedSpectrum.weightSum[i];
         }
-
-        weightedSum /= rebinningWidthC*convolutionWidthK;
-
-        rebinnedSpectrum.sigmaCombined.push_back(1/std::sqrt(rebinnedSpectrum.weightSum[l]));
-        rebinnedSpectrum.powers.push_back(weightedSum*rebinnedSpectrum.sigmaCombined[l]*rebinnedSpectrum.sigmaCombined[l]);
+    }
+    CombinedSpectrumGrid::convolveCoarseBins(weightedPowers, weights, rebinningWidthC, convolutionWidthK, rebinnedSpectrum);
+
+    size_t numRebinned = rebinnedSpectrum.powers.size();
+    std::vector<double>& freqAxis = rebinnedSpectrum.freqAxis.edit();
+    freqAxis.resize(numRebinned);
+    rebinnedSpectrum.numTraces.resize(numRebinned);
+    for (size_t j = 0; j < numRebinned; j++) {
+        size_t centerBin = j*rebinningWidthC + (convolutionWidthK*rebinningWidthC)/2;
+        freqAxis[j] = combinedSpectrum.freqAxis[centerBin];
+        rebinnedSpectrum.numTraces[j] = combinedSpectrum.numTraces[centerBin];
     }
 
     return rebinnedSpectrum;
@@ -11,49 +11,26 @@
 
 #include "decs.hpp"
 
-void DecisionAgent::resizeSNRtoMatch(CombinedSpectrum spectrum) {
-    Spectrum temp;
-
-    temp.powers = spectrum.powers;
-    temp.freqAxis = spectrum.freqAxis;
-
-    resizeSNRtoMatch(temp);
-}
-
-
-
-
-void DecisionAgent::resizeSNRtoMatch(Spectrum spectrum) {
-    trimmedSNR.powers.clear();
-    trimmedSNR.freqAxis.clear();
-
-    trimmedSNR.powers.resize(spectrum.freqAxis.size());
-    trimmedSNR.freqAxis.resize(spectrum.freqAxis.size());
-
-
-    int matchingIndex = 1;
-    for(int i=0; i<trimmedSNR.powers.size(); i++){
-        while(spectrum.freqAxis[i] > SNR.freqAxis[matchingIndex]){
-            matchingIndex++;
-
-            if (matchingIndex >= SNR.freqAxis.size()){
-                matchingIndex = int(SNR.freqAxis.size())-1;
-                break;
-            }
-        }
-        if (std::abs(SNR.freqAxis[matchingIndex]-spectrum.freqAxis[i]) > std::abs(SNR.freqAxis[matchingIndex-1]-spectrum.freqAxis[i])) {
-            matchingIndex--;
-        }
-
-        trimmedSNR.powers[i] = SNR.powers[matchingIndex];
-        trimmedSNR.freqAxis[i] = SNR.freqAxis[matchingIndex];
+/**
+ * @brief Sets trimmedSNR to the SNR of the nearest SNR bin to each bin of a spectrum. The mapping is cached by the SNR profile, which is
+ *        loaded from SNR on first use.
+ * 
+ * @param spectrum - spectrum to match, usually a rebinned CombinedSpectrum
+ */
+void DecisionAgent::resizeSNRtoMatch(const Spectrum& spectrum) {
+    if (SNRprofile.empty()) {
+        SNRprofile.load(SNR);
     }
+
+    const SNRProfile::Window& window = SNRprofile.nearestWindow(spectrum.freqAxis);
+    trimmedSNR.powers = window.powers;
+    trimmedSNR.freqAxis = window.freqAxis;
 }
 
 
 void DecisionAgent::setTargets(){
     double SNRsum=0;
-    for (int i=0; i<trimmedSNR.powers.size(); i++){
+    for (size_t i=0; i<trimmedSNR.powers.size(); i++){
         SNRsum += trimmedSNR.powers[i]*trimmedSNR.powers[i];
         inProgressTargets.push_back(0);
     }
@@ -71,7 +48,7 @@ void DecisionAgent::setPoints(){
     double SNRsum=0;
     double cumSum=0;
 
-    for (int i=0; i<trimmedSNR.powers.size(); i++){
+    for (size_t i=0; i<trimmedSNR.powers.size(); i++){
         SNRsum += trimmedSNR.powers[i]*trimmedSNR.powers[i];
         points.push_back(0);
     }
@@ -99,7 +76,7 @@ void DecisionAgent::setPoints(){
 }
 
 
-int DecisionAgent::getDecision(std::vector<double> activeExclusionLine, int numShots){
+int DecisionAgent::getDecision(const std::vector<double>& activeExclusionLine, int numShots){
     if (decisionMaking && (numShots > minShots)){
         return (checkScore(activeExclusionLine) <= threshold);
     } else {
@@ -108,20 +85,176 @@ int DecisionAgent::getDecision(std::vector<double> activeExclusionLine, int numS
 }
 
 
-double DecisionAgent::checkScore(std::vector<double> activeExclusionLine){
-    double score = 0;
 
-    for (int i=0; i < activeExclusionLine.size(); i++){
-        if (activeExclusionLine[i] > inProgressTargets[i]){
-            score += points[i]*(activeExclusionLine[i]/inProgressTargets[i])*(activeExclusionLine[i]/inProgressTargets[i]);
-        } 
+/**
+ * @brief Same as getDecision(activeExclusionLine, numShots) for a score already computed by checkScore or updateScore.
+ * 
+ * @param score - score of the active exclusion line
+ * @param numShots - spectra decided on so far this step
+ */
+int DecisionAgent::getDecision(double score, int numShots){
+    if (decisionMaking && (numShots > minShots)){
+        return (score <= threshold);
+    } else {
+        return 0;
+    }
+}
+
+
+double DecisionAgent::checkScore(const std::vector<double>& activeExclusionLine){
+    return checkScore(activeExclusionLine.data(), activeExclusionLine.size());
+}
+
+
+
+/**
+ * @brief Scores the whole active window of the exclusion line, read in place, and remembers each bin's score for updateScore.
+ * 
+ * @param activeExclusionLine - first bin of the active window
+ * @param size - number of bins in the window, at most the number of targets
+ * @return double - sum of points*(line/target)^2 over the bins above their target
+ */
+double DecisionAgent::checkScore(const double* activeExclusionLine, size_t size){
+    if (scoreWeights.size() != points.size()) {
+        setScoreWeights();
     }
-    
+    binScores.resize(size);
+    updateScore(activeExclusionLine, 0, size);
+
+    score = spectrumSum(binScores.data(), size);
     return score;
 }
 
 
 
+/**
+ * @brief Updates the score for the bins of the active window that changed since the last checkScore or updateScore, e.g. the bins 
+ *        BayesFactors::updateExclusionLine just wrote. Only those bins are read. Use checkScore instead whenever the window itself moved.
+ * 
+ * @param activeExclusionLine - first bin of the active window
+ * @param first - first changed bin, relative to the window
+ * @param count - number of changed bins
+ * @return double - score of the whole window
+ */
+double DecisionAgent::updateScore(const double* activeExclusionLine, size_t first, size_t count){
+    if (scoreWeights.size() != points.size()) {
+        setScoreWeights();
+    }
+    if (first + count > binScores.size()) {
+        return checkScore(activeExclusionLine, max(binScores.size(), first + count));
+    }
+
+    score += spectrumThresholdScore(binScores.data() + first, activeExclusionLine + first, inProgressTargets.data() + first,
+                                    scoreWeights.data() + first, count);
+    return score;
+}
+
+
+
+/**
+ * @brief Scores the active window of bayesFactors' exclusion line, read in place, after updateExclusionLine. Once a window has been scored
+ *        only the bins the update wrote are rescored, and the whole window is scored again whenever it moved.
+ * 
+ * @param bayesFactors - exclusion line just updated
+ * @param updatedBins - bins of the spectrum the exclusion line was updated with, starting at bayesFactors.startIndex
+ * @param scoredWindowStart - exclusion line bin the score was last computed from, updated here. SIZE_MAX at the start of a step
+ * @return double - score of the active window
+ */
+double DecisionAgent::scoreExclusionLine(const BayesFactors& bayesFactors, size_t updatedBins, size_t& scoredWindowStart){
+    size_t windowBins = trimmedSNR.powers.size();
+    size_t windowStart = bayesFactors.windowEnd() - windowBins;
+    const double* activeWindow = bayesFactors.exclusionLine.powers.data() + windowStart;
+
+    size_t updatedFirst = max((size_t)bayesFactors.startIndex, windowStart);
+    size_t updatedEnd = min((size_t)bayesFactors.startIndex + updatedBins, windowStart + windowBins);
+    if (windowStart != scoredWindowStart) {
+        scoredWindowStart = windowStart;
+        return checkScore(activeWindow, windowBins);
+    }
+    else if (updatedEnd > updatedFirst) {
+        return updateScore(activeWindow, updatedFirst - windowStart, updatedEnd - updatedFirst);
+    }
+    return updateScore(activeWindow, 0, 0);
+}
+
+
+
+/**
+ * @brief Forecasts how many more spectra this step needs before getDecision stops it, from the bin scores of the last checkScore or
+ *        updateScore. The exclusion line falls as 1/sqrt(N) with the number of spectra N, so after N spectra a bin above its target scores
+ *        binScore*n/N and drops below its target (scoring 0) once N >= n*(line/target)^2 = n*binScore/points, where n is the number of
+ *        spectra so far. The forecast is the smallest N whose predicted score is at most threshold.
+ * 
+ * @param numShots - spectra decided on so far this step, as passed to getDecision
+ * @return int - further spectra until the forecast stop, 0 if the next decision is expected to stop. -1 if decision making is off
+ */
+int DecisionAgent::forecastSpectraToStop(int numShots){
+    if (!decisionMaking) {
+        return -1;
+    }
+
+    // Spectra, relative to now, at which each scoring bin falls below its target, with the score it has until then
+    double n = (double)(numShots + 1);
+    double remainingScore = 0;
+    crossings.clear();
+    for (size_t i = 0; i < binScores.size(); i++) {
+        if (binScores[i] > 0) {
+            crossings.emplace_back(n*binScores[i]/points[i], binScores[i]);
+            remainingScore += binScores[i];
+        }
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    // Between two crossings the predicted score is (n/N)*remainingScore, which falls to threshold at N = n*remainingScore/threshold
+    // Past the last crossing every bin is below its target and the score is 0
+    double stopSpectra = n;
+    for (size_t j = 0; j < crossings.size() && remainingScore > 0; j++) {
+        if (threshold > 0 && n*remainingScore/threshold < crossings[j].first) {
+            stopSpectra = max(stopSpectra, n*remainingScore/threshold);
+            break;
+        }
+
+        stopSpectra = max(stopSpectra, crossings[j].first);
+        remainingScore -= crossings[j].second;
+    }
+
+    int forecast = (int)std::ceil(min(stopSpectra - n, (double)INT_MAX/2));
+    return max(forecast, minShots + 1 - numShots);
+}
+
+
+
+/**
+ * @brief Folds the targets into the points, so scoring a bin takes no divisions.
+ * 
+ */
+void DecisionAgent::setScoreWeights(){
+    scoreWeights.resize(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        scoreWeights[i] = points[i]/(inProgressTargets[i]*inProgressTargets[i]);
+    }
+    binScores.clear();
+    score = 0;
+}
+
+
+
 void DecisionAgent::toggleDecisionMaking(int decisionMaking) {
     this->decisionMaking = decisionMaking;
-}
\ No newline at end of file
+}
+
+
+
+/**
+ * @brief Forgets the window matched to the last scan (trimmedSNR, targets, points and scores), so the agent matches the next spectrum it
+ *        sees again. threshold, minShots, targetCoupling and the SNR are kept.
+ * 
+ */
+void DecisionAgent::reset() {
+    trimmedSNR = Spectrum();
+    inProgressTargets.clear();
+    points.clear();
+    scoreWeights.clear();
+    binScores.clear();
+    score = 0;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file decisionSweep.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the DecisionSweep class. See include\decisionSweep.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Construct a new DecisionSweep over a captured stream. The stream must not be captured to while the sweep runs.
+ *
+ * @param stream - spectra captured by ScanRunner::captureDecisionStream
+ * @param agentTemplate - decision agent every replay starts from, with its SNR and targetCoupling set (ScanRunner::decisionAgent)
+ * @param sigmaProc - sigmaProc of the replayed exclusion lines
+ */
+DecisionSweep::DecisionSweep(const DecisionStream& stream, const DecisionAgent& agentTemplate, double sigmaProc) :
+    stream(stream), agentTemplate(agentTemplate), sigmaProc(sigmaProc) {
+    if (stream.steps.empty()) {
+        throw std::runtime_error("Error: Cannot sweep decision parameters over an empty decision stream\n");
+    }
+    scanWidth = std::abs(stream.steps.back().centerFreq - stream.steps.front().centerFreq);
+
+    // Load the SNR profile once, so the replays share the loaded copy instead of each loading it again
+    this->agentTemplate.reset();
+    if (this->agentTemplate.SNRprofile.empty()) {
+        this->agentTemplate.SNRprofile.load(this->agentTemplate.SNR);
+    }
+}
+
+
+
+/**
+ * @brief Replays the stream for every parameter set. Parameter sets are handed out to the threads one at a time, so uneven replays (small
+ *        minShots stop early) still balance.
+ *
+ * @param parameterSets - decision parameters to replay, see grid
+ * @param numThreads - replay threads. 0 uses every hardware thread
+ * @return std::vector<SweepResult> - one result per parameter set, in the order of parameterSets
+ */
+std::vector<SweepResult> DecisionSweep::run(const std::vector<SweepParameters>& parameterSets, int numThreads) {
+    std::vector<SweepResult> results(parameterSets.size());
+    if (parameterSets.empty()) {
+        return results;
+    }
+
+    if (numThreads <= 0) {
+        numThreads = max(1, (int)std::thread::hardware_concurrency());
+    }
+    numThreads = min(numThreads, (int)parameterSets.size());
+
+    std::atomic<size_t> nextSet(0);
+    std::mutex errorMutex;
+    std::exception_ptr error = nullptr;
+
+    auto worker = [&]() {
+        for (size_t i = nextSet++; i < parameterSets.size(); i = nextSet++) {
+            try {
+                results[i] = runOne(parameterSets[i]);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                nextSet = parameterSets.size();
+            }
+        }
+    };
+
+    std::cout << "Sweeping " << std::to_string(parameterSets.size()) << " decision parameter sets over " << std::to_string(stream.steps.size())
+              << " steps on " << std::to_string(numThreads) << " threads" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return results;
+}
+
+
+
+/**
+ * @brief Replays the stream with one parameter set, mirroring decisionMakingThread and ScanRunner::step: each step is decided on spectrum
+ *        by spectrum until the decision stops it or its captured spectra run out, then the exclusion line steps to the next center frequency.
+ *
+ * @param parameters - decision parameters
+ * @return SweepResult - time to target, excluded fraction and per step decisions
+ */
+SweepResult DecisionSweep::runOne(const SweepParameters& parameters) const {
+    auto replayStart = std::chrono::steady_clock::now();
+
+    SweepResult result;
+    result.parameters = parameters;
+    result.spectraAtDecision.reserve(stream.steps.size());
+
+    BayesFactors bayesFactors;
+    bayesFactors.sigmaProc = sigmaProc;
+    bayesFactors.reserveScan(scanWidth, 1);
+
+    DecisionAgent decisionAgent = agentTemplate;
+    decisionAgent.threshold = parameters.threshold;
+    decisionAgent.minShots = parameters.minShots;
+    decisionAgent.toggleDecisionMaking(1);
+
+    for (size_t k = 0; k < stream.steps.size(); k++) {
+        const DecisionStream::Step& step = stream.steps[k];
+        if (k > 0) {
+            bayesFactors.step(step.centerFreq - stream.steps[k - 1].centerFreq);
+        }
+
+        int buffersDecided = 0;
+        size_t scoredWindowStart = SIZE_MAX;
+        for (const CombinedSpectrum& spectrum : step.spectra) {
+            if (decisionAgent.trimmedSNR.powers.empty()) {
+                decisionAgent.resizeSNRtoMatch(spectrum);
+                decisionAgent.setTargets();
+                decisionAgent.setPoints();
+            }
+
+            bayesFactors.updateExclusionLine(spectrum);
+            double score = decisionAgent.scoreExclusionLine(bayesFactors, spectrum.powers.size(), scoredWindowStart);
+            int decision = decisionAgent.getDecision(score, buffersDecided);
+            buffersDecided++;
+
+            if (decision) {
+                result.decisions++;
+                break;
+            }
+        }
+
+        result.spectraAtDecision.push_back(buffersDecided);
+        result.spectraUsed += buffersDecided;
+        result.timeToTarget += buffersDecided*step.spectrumTime;
+    }
+
+    // Bins below the cutoff are never updated, so only the scanned bins count
+    const std::vector<double>& line = bayesFactors.exclusionLine.powers;
+    size_t scannedBins = (line.size() > (size_t)bayesFactors.cutoffIndex) ? line.size() - bayesFactors.cutoffIndex : 0;
+    size_t excludedBins = 0;
+    for (size_t i = bayesFactors.cutoffIndex; i < line.size(); i++) {
+        if (line[i] <= agentTemplate.targetCoupling) {
+            excludedBins++;
+        }
+    }
+    result.fractionExcluded = (scannedBins > 0) ? (double)excludedBins/scannedBins : 0;
+
+    std::chrono::duration<double> runTime = std::chrono::steady_clock::now() - replayStart;
+    result.runTime = runTime.count();
+    return result;
+}
+
+
+
+/**
+ * @brief Every combination of thresholds and minShots.
+ *
+ * @param thresholds - score thresholds to try
+ * @param minShots - minimum spectra per step to try
+ * @return std::vector<SweepParameters> - thresholds.size()*minShots.size() parameter sets
+ */
+std::vector<SweepParameters> DecisionSweep::grid(const std::vector<double>& thresholds, const std::vector<int>& minShots) {
+    std::vector<SweepParameters> parameterSets;
+    parameterSets.reserve(thresholds.size()*minShots.size());
+    for (double threshold : thresholds) {
+        for (int shots : minShots) {
+            parameterSets.push_back(SweepParameters{threshold, shots});
+        }
+    }
+    return parameterSets;
+}
+
+
+
+/**
+ * @brief Prints a table of the results, one parameter set per row, in the style of reportPerformance.
+ *
+ * @param results - results of run
+ */
+void DecisionSweep::report(const std::vector<SweepResult>& results) {
+    fprintf(stdout, "\n********** DECISION SWEEP **********\n");
+    fprintf(stdout, "   %10s %9s %12s %10s %9s %12s %10s\n", "THRESHOLD", "MIN SHOTS", "TIME (s)", "EXCLUDED", "DECISIONS",
+            "SPECTRA/STEP", "REPLAY (s)");
+
+    for (const SweepResult& result : results) {
+        double spectraPerStep = result.spectraAtDecision.empty() ? 0 : (double)result.spectraUsed/result.spectraAtDecision.size();
+        fprintf(stdout, "   %10.4g %9d %12.4g %10.4f %9d %12.4g %10.4g\n", result.parameters.threshold, result.parameters.minShots,
+                result.timeToTarget, result.fractionExcluded, result.decisions, spectraPerStep, result.runTime);
+    }
+
+    fprintf(stdout, "*********************************\n\n");
+}
+
+
+
+/**
+ * @brief Saves the results as CSV, one parameter set per row, with the spectra decided on in each step at the end of the row.
+ *
+ * @param results - results of run
+ * @param filename - CSV file
+ */
+void DecisionSweep::save(const std::vector<SweepResult>& results, const std::string& filename) {
+    std::ofstream dataFile(filename);
+    if (!dataFile.is_open()) {
+        std::cerr << "Unable to open file " << filename << " to save data." << std::endl;
+        return;
+    }
+
+    dataFile << "threshold,minShots,timeToTarget,fractionExcluded,spectraUsed,decisions,spectraAtDecision" << std::endl;
+    dataFile << std::setprecision(10);
+    for (const SweepResult& result : results) {
+        dataFile << result.parameters.threshold << "," << result.parameters.minShots << "," << result.timeToTarget << ","
+                 << result.fractionExcluded << "," << result.spectraUsed << "," << result.decisions;
+        for (int spectra : result.spectraAtDecision) {
+            dataFile << "," << spectra;
+        }
+        dataFile << std::endl;
+    }
+    dataFile.close();
+}
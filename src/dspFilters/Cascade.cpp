@@ -52,28 +52,132 @@ void Cascade::setCascadeStorage (const Storage& storage)
   m_stageArray = storage.stageArray;
 }
 
+namespace {
+
+// Frequencies evaluated together by the batched response
+const int responseBlockSize = 256;
+
+// Evenly spaced twiddles are re-anchored with std::polar this often,
+// so the rounding error of the incremental rotation stays negligible
+const int twiddleAnchorInterval = 64;
+
+}
+
 complex_t Cascade::response (double normalizedFrequency) const
 {
-  double w = 2 * doublePi * normalizedFrequency;
-  const complex_t czn1 = std::polar (1., -w);
-  const complex_t czn2 = std::polar (1., -2 * w);
-  complex_t ch (1);
-  complex_t cbot (1);
+  complex_t result;
+  response (1, &normalizedFrequency, &result);
+  return result;
+}
+
+void Cascade::response (int numFrequencies,
+                        const double* normalizedFrequencies,
+                        complex_t* dest) const
+{
+  double zr [responseBlockSize];
+  double zi [responseBlockSize];
+
+  for (int first = 0; first < numFrequencies; first += responseBlockSize)
+  {
+    const int n = std::min (responseBlockSize, numFrequencies - first);
+    for (int k = 0; k < n; ++k)
+    {
+      const double w = 2 * doublePi * normalizedFrequencies[first + k];
+      zr[k] = std::cos (w);
+      zi[k] = -std::sin (w);
+    }
+    responseBlock (n, zr, zi, dest + first);
+  }
+}
+
+void Cascade::response (int numFrequencies,
+                        double firstFrequency,
+                        double frequencyStep,
+                        complex_t* dest) const
+{
+  double zr [responseBlockSize];
+  double zi [responseBlockSize];
+
+  const double stepW = 2 * doublePi * frequencyStep;
+  const double rr = std::cos (stepW);
+  const double ri = -std::sin (stepW);
+
+  for (int first = 0; first < numFrequencies; first += responseBlockSize)
+  {
+    const int n = std::min (responseBlockSize, numFrequencies - first);
+    for (int k = 0; k < n; ++k)
+    {
+      if (k % twiddleAnchorInterval == 0)
+      {
+        const double w = 2 * doublePi * (firstFrequency + (first + k) * frequencyStep);
+        zr[k] = std::cos (w);
+        zi[k] = -std::sin (w);
+      }
+      else
+      {
+        zr[k] = zr[k-1] * rr - zi[k-1] * ri;
+        zi[k] = zr[k-1] * ri + zi[k-1] * rr;
+      }
+    }
+    responseBlock (n, zr, zi, dest + first);
+  }
+}
+
+void Cascade::responseBlock (int numFrequencies,
+                             const double* zr,
+                             const double* zi,
+                             complex_t* dest) const
+{
+  double nr [responseBlockSize];
+  double ni [responseBlockSize];
+  double dr [responseBlockSize];
+  double di [responseBlockSize];
 
+  for (int k = 0; k < numFrequencies; ++k)
+  {
+    nr[k] = 1;
+    ni[k] = 0;
+    dr[k] = 1;
+    di[k] = 0;
+  }
+
+  // Stages outermost, so the frequency loop is a straight vector loop
+  // over the products of the numerators and denominators
   const Biquad* stage = m_stageArray;
-  for (int i = m_numStages; --i >=0; ++stage)
+  for (int i = m_numStages; --i >= 0; ++stage)
   {
-    complex_t cb (1);
-    complex_t ct    (stage->getB0()/stage->getA0());
-    ct = addmul (ct, stage->getB1()/stage->getA0(), czn1);
-    ct = addmul (ct, stage->getB2()/stage->getA0(), czn2);
-    cb = addmul (cb, stage->getA1()/stage->getA0(), czn1);
-    cb = addmul (cb, stage->getA2()/stage->getA0(), czn2);
-    ch   *= ct;
-    cbot *= cb;
+    const double b0 = stage->m_b0;
+    const double b1 = stage->m_b1;
+    const double b2 = stage->m_b2;
+    const double a1 = stage->m_a1;
+    const double a2 = stage->m_a2;
+
+    for (int k = 0; k < numFrequencies; ++k)
+    {
+      const double z2r = zr[k] * zr[k] - zi[k] * zi[k];
+      const double z2i = 2 * zr[k] * zi[k];
+
+      const double tr = b0 + b1 * zr[k] + b2 * z2r;
+      const double ti =      b1 * zi[k] + b2 * z2i;
+      const double br = 1  + a1 * zr[k] + a2 * z2r;
+      const double bi =      a1 * zi[k] + a2 * z2i;
+
+      const double pr = nr[k] * tr - ni[k] * ti;
+      ni[k] = nr[k] * ti + ni[k] * tr;
+      nr[k] = pr;
+
+      const double qr = dr[k] * br - di[k] * bi;
+      di[k] = dr[k] * bi + di[k] * br;
+      dr[k] = qr;
+    }
   }
 
-  return ch / cbot;
+  for (int k = 0; k < numFrequencies; ++k)
+  {
+    const double norm = dr[k] * dr[k] + di[k] * di[k];
+    dest[k] = complex_t ((nr[k] * dr[k] + ni[k] * di[k]) / norm,
+                         (ni[k] * dr[k] - nr[k] * di[k]) / norm);
+  }
 }
 
 std::vector<PoleZeroPair> Cascade::getPoleZeros () const
@@ -92,6 +196,27 @@ std::vector<PoleZeroPair> Cascade::getPoleZeros () const
   return vpz;
 }
 
+void Cascade::interpolateCoefficients (const Cascade& from,
+                                       const Cascade& to,
+                                       double t)
+{
+  assert (to.m_numStages <= m_maxStages);
+  m_numStages = to.m_numStages;
+
+  Biquad* stage = m_stageArray;
+  const Biquad* target = to.m_stageArray;
+  if (from.m_numStages != to.m_numStages)
+  {
+    for (int i = 0; i < m_numStages; ++i)
+      stage[i] = target[i];
+    return;
+  }
+
+  const Biquad* origin = from.m_stageArray;
+  for (int i = 0; i < m_numStages; ++i)
+    stage[i].interpolateCoefficients (origin[i], target[i], t);
+}
+
 void Cascade::applyScale (double scale)
 {
   // For higher order filters it might be helpful
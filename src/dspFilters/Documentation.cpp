@@ -202,6 +202,12 @@ class SmoothedFilterDesign : public Filter
   caller, except that the constructor takes an additional parameter that
   indicates the duration of transitions when parameters change.
 
+  By default the filter is redesigned at every sample of a transition. An
+  optional second constructor parameter, the control rate in samples, only
+  redesigns it that often and interpolates the biquad coefficients linearly
+  in between. At high sample rates this is far cheaper, and the filter state
+  is carried through every redesign the same way.
+
 
 
 template <class FilterClass, int Channels = 0, class StateType = DirectFormII>
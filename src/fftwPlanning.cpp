@@ -0,0 +1,61 @@
+/**
+ * @file fftwPlanning.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Offline FFTW planner. Pre-computes FFTW_PATIENT (or FFTW_EXHAUSTIVE) wisdom for the transform sizes used by ScanRunner and stores it
+ *        in the WisdomStore so that scans never measure plans at startup. Needs no instruments.
+ * 
+ *        Usage: fftw_planner [-exhaustive] [RBW_Hz ...]      (defaults to the 100 Hz RBW at 32 MS/s used by ScanRunner)
+ * 
+ * @version 0.1
+ * @date 2023-11-06
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "decs.hpp"
+
+#define PLANNING_SAMPLE_RATE (32e6)
+
+int main(int argc, char* argv[]) {
+    unsigned flags = FFTW_PATIENT;
+    std::vector<double> RBWs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-exhaustive") {
+            flags = FFTW_EXHAUSTIVE;
+        }
+        else {
+            RBWs.push_back(std::stod(arg));
+        }
+    }
+
+    if (RBWs.empty()) {
+        RBWs.push_back(100);
+    }
+
+
+    // Mirror the planner configuration ScanRunner::initFFTW uses, since threaded and batched plans have their own wisdom
+    WisdomStore wisdomStore;
+    #if FFTW_THREADED_PLANNER
+    fftw_init_threads();
+    fftw_plan_with_nthreads(FFT_WORKER_COUNT);
+    fftwf_init_threads();
+    fftwf_plan_with_nthreads(FFT_WORKER_COUNT);
+    wisdomStore.plannerThreads = FFT_WORKER_COUNT;
+    #endif
+
+    for (double RBW : RBWs) {
+        int N = (int)(PLANNING_SAMPLE_RATE/RBW);
+
+        for (int batchSize : {1, FFT_BATCH_SIZE}) {
+            std::cout << "Planning N = " << std::to_string(N) << " x " << std::to_string(batchSize) << "..." << std::endl;
+
+            fftw_destroy_plan(wisdomStore.planDFT(N, batchSize, flags));
+            fftwf_destroy_plan(wisdomStore.planDFTf(N, batchSize, flags));
+        }
+    }
+
+    std::cout << "Exited Normally" << std::endl;
+    return 0;
+}
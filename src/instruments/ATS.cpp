@@ -16,6 +16,18 @@
 
 #include "decs.hpp"
 
+#if defined(_M_X64) || defined(__x86_64__)
+#define SAMPLE_CONVERSION_X64 (1)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define SAMPLE_AVX2_TARGET // MSVC emits any intrinsic whatever /arch
+#else
+#define SAMPLE_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#else
+#define SAMPLE_CONVERSION_X64 (0)
+#endif
+
 #define VERBOSE_OUTPUT (0)
 
 
@@ -38,6 +50,8 @@ ATS::ATS(int systemId, int boardId) {
  * 
  */
 ATS::~ATS() { 
+    stopStreamingSession();
+
     if (boardHandle != NULL) {
         boardHandle = NULL;
     }
@@ -288,6 +302,35 @@ void ATS::printBufferSize(U32 samplesPerAcquisition, U32 buffersPerAcquisition){
 
 
 
+/**
+ * @brief Suggests a DMA ring depth that lets the host stall for DMA_LATENCY_HEADROOM times the worst measured consumer latency (at least 
+ *        DMA_LATENCY_FLOOR) without the board overflowing, capped at DMA_MEMORY_FRACTION of the free physical memory.
+ * 
+ * @return U32 - suggested number of DMA buffers, between 2 and MAX_BUFFER_COUNT
+ */
+U32 ATS::suggestBufferCount(){
+    // Each buffer posted to the board buys one buffer period of slack before the acquisition overflows
+    double bufferPeriod = (double)acquisitionParams.samplesPerBuffer/acquisitionParams.sampleRate;
+    double stall = max(DMA_LATENCY_FLOOR, DMA_LATENCY_HEADROOM*consumerLatency);
+    U32 bufferCount = (U32)std::ceil(stall/bufferPeriod);
+    bufferCount = min(max(bufferCount, (U32)BUFFER_COUNT), (U32)MAX_BUFFER_COUNT);
+
+    // DMA buffers are pinned, so leave most of the free memory to the rest of the pipeline
+    MEMORYSTATUSEX memoryStatus;
+    memoryStatus.dwLength = sizeof(memoryStatus);
+    if (GlobalMemoryStatusEx(&memoryStatus)) {
+        U32 maxByMemory = (U32)min(DMA_MEMORY_FRACTION*memoryStatus.ullAvailPhys/acquisitionParams.bytesPerBuffer, (double)MAX_BUFFER_COUNT);
+        if (bufferCount > maxByMemory) {
+            std::cout << "Warning: DMA ring limited to " << std::to_string(maxByMemory) << " buffers by available memory." << std::endl;
+            bufferCount = maxByMemory;
+        }
+    }
+
+    return max(bufferCount, (U32)2);
+}
+
+
+
 /**
  * @brief Sets the acquisition parameters for the ATS9462. This will set all parameters in the acquisitionParams struct.
  * 
@@ -296,8 +339,14 @@ void ATS::printBufferSize(U32 samplesPerAcquisition, U32 buffersPerAcquisition){
  * @param buffersPerAcquisition - desired number of buffers to split the acquisition into. If 0, will be calculated automatically for efficiency.
  * @param inputRange - desired full scale voltage range. Valid values are 0.2, 0.4, 0.8, and 2 V
  * @param inputImpedance - desired input impedance. Valid values are 50 and 1e6 ohms
+ * @param bufferCount - number of DMA buffers posted to the board. If 0, sized adaptively from the measured consumer latency and the available 
+ *                      memory, and re-evaluated every time the board is armed. Deeper rings tolerate longer host stalls before ApiBufferOverflow.
  */
-void ATS::setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition, double inputRange, double inputImpedance){
+void ATS::setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition, double inputRange, double inputImpedance,
+                                   U32 bufferCount){
+    // The streaming session's DMA buffers are sized for the old parameters
+    stopStreamingSession();
+
     if (buffersPerAcquisition <= 0){
         buffersPerAcquisition = suggestBufferNumber(sampleRate, samplesPerAcquisition);
     }
@@ -330,6 +379,11 @@ void ATS::setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U3
     // Calculated from the above parameters since rounding could cause the actual sample number to be slightly different than requested
     acquisitionParams.samplesPerAcquisition = acquisitionParams.samplesPerBuffer*acquisitionParams.buffersPerAcquisition;
 
+    acquisitionParams.adaptiveBufferCount = (bufferCount == 0);
+    acquisitionParams.bufferCount = acquisitionParams.adaptiveBufferCount ? suggestBufferCount() : max(bufferCount, (U32)2);
+    std::cout << "Using " << std::to_string(acquisitionParams.bufferCount) << (acquisitionParams.adaptiveBufferCount ? " adaptive" : "") 
+              << " DMA buffers." << std::endl;
+
 
     // Send parameters to board
     double realSampleRate = setExternalSampleClock(acquisitionParams.sampleRate);
@@ -373,6 +427,9 @@ void ATS::setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U3
  * @return fftw_complex* - pointer to the raw data as voltages with channel A and B in real and imaginary components, respectively.
  */
 fftw_complex* ATS::AcquireData() {
+    // Single-shot acquisitions need the board to themselves
+    stopStreamingSession();
+
     // Set basic flags
     U32 channelMask = CHANNEL_A | CHANNEL_B;
     U32 admaFlags = ADMA_TRIGGERED_STREAMING | ADMA_EXTERNAL_STARTCAPTURE;         // Start acquisition when AlazarStartCapture is called
@@ -396,16 +453,10 @@ fftw_complex* ATS::AcquireData() {
 
     // Allocate memory for DMA buffers and post them to board
 	int bufferIndex;
-	for (bufferIndex = 0; bufferIndex < BUFFER_COUNT; bufferIndex++)
-	{
-		IoBufferArray[bufferIndex] = CreateIoBuffer(acquisitionParams.bytesPerBuffer);
-		if (IoBufferArray[bufferIndex] == NULL) {
-            throw std::runtime_error(std::string("Error: Alloc ") + AlazarErrorToText(retCode) +  "bytes failed\n");
-		}
-	}
+	allocateIoBuffers();
     bool success = TRUE;
 
-	for (bufferIndex = 0; (bufferIndex < BUFFER_COUNT) && (success == TRUE); bufferIndex++)
+	for (bufferIndex = 0; (bufferIndex < (int)IoBufferArray.size()) && (success == TRUE); bufferIndex++)
 	{
 		IO_BUFFER *pIoBuffer = IoBufferArray[bufferIndex];
 		if (!ResetIoBuffer(pIoBuffer)) {
@@ -434,9 +485,6 @@ fftw_complex* ATS::AcquireData() {
 		}
 	}
 
-    std::vector<unsigned short> fullDataA;
-    std::vector<unsigned short> fullDataB;
-
     fftw_complex* complexOutput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * acquisitionParams.samplesPerAcquisition));
 
 	// Wait for each buffer to be filled, process the buffer, and re-post it to the board.
@@ -463,38 +511,26 @@ fftw_complex* ATS::AcquireData() {
 
 
 			// Wait for the buffer at the head of the list of available buffers to be filled by the board.
-			bufferIndex = buffersCompleted % BUFFER_COUNT;
+			bufferIndex = buffersCompleted % IoBufferArray.size();
 			IO_BUFFER *pIoBuffer = IoBufferArray[bufferIndex];
-			retCode = AlazarWaitAsyncBufferComplete(
-                boardHandle, 
-                pIoBuffer->pBuffer, 
-                timeout_ms
-            );
+            {
+                TraceSpan bufferWait("Buffer wait", TRACE_PIPELINE, buffersCompleted);
+                retCode = AlazarWaitAsyncBufferComplete(
+                    boardHandle, 
+                    pIoBuffer->pBuffer, 
+                    timeout_ms
+                );
+            }
 
             // Process the buffer that was just filled. This buffer is full and has been removed from the list of buffers available to the board.
 			if (retCode == ApiSuccess) {
                 // DWORD startProcTickCount = GetTickCount();
 
-                std::vector<unsigned short> bufferData(reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer),
-                                      reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer) + (acquisitionParams.bytesPerBuffer / sizeof(unsigned short)));
-
-                // Deprecated from before I was using FFTW immediately after acquisition
-                fullDataA.insert(fullDataA.end(), bufferData.begin(), bufferData.begin() + bufferData.size()/2);
-                fullDataB.insert(fullDataB.end(), bufferData.begin() + bufferData.size()/2, bufferData.end());
-
-                // Current implementation - pre processes the data into a complex array for FFT
-                for (unsigned int i=0; i < bufferData.size()/2; i++) {
-                    int index = buffersCompleted*acquisitionParams.samplesPerBuffer + i;
-
-                    complexOutput[index][0] = (bufferData[i]   / (double)0xFFFF) * 2 * acquisitionParams.inputRange - acquisitionParams.inputRange;
-                    complexOutput[index][1] = (bufferData[bufferData.size()/2 + i]  / (double)0xFFFF) * 2 * acquisitionParams.inputRange - acquisitionParams.inputRange;
-
-                    // WARNING: Alternating signs trick to 0-center the dft
-                    if (index % 2 == 1) {
-                        complexOutput[index][0] *= -1;
-                        complexOutput[index][1] *= -1;
-                    }
-                }
+                // Pre process the data into a complex array for FFT straight out of the DMA buffer
+                // WARNING: Alternating signs trick to 0-center the dft (parity follows the index in the full acquisition)
+                U32 startIndex = buffersCompleted*acquisitionParams.samplesPerBuffer;
+                convertSamplesToComplex(reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer), complexOutput + startIndex,
+                                        acquisitionParams.samplesPerBuffer, acquisitionParams.inputRange, startIndex % 2 == 1);
 
                 // double bufferProcTime_sec = (GetTickCount() - startProcTickCount) / 1000.;
 	            // std::cout << "Buffer processed in " << bufferProcTime_sec << " sec" << std::endl;
@@ -598,10 +634,7 @@ fftw_complex* ATS::AcquireData() {
 
 
 	// Free all memory allocated
-	for (bufferIndex = 0; bufferIndex < BUFFER_COUNT; bufferIndex++) {
-		if (IoBufferArray[bufferIndex] != NULL)
-			DestroyIoBuffer(IoBufferArray[bufferIndex]);
-	}
+	freeIoBuffers();
 
 
     // Return the fftw_complex array for further processing
@@ -643,6 +676,162 @@ std::pair<std::vector<double>, std::vector<double>> processData(std::pair<std::v
 
 
 
+#if SAMPLE_CONVERSION_X64
+// AVX2 loop of convertSamplesToComplex, 4 samples per iteration. Returns the first sample it left for the scalar loop
+SAMPLE_AVX2_TARGET static U32 convertSamplesAVX2(const unsigned short* samplesA, const unsigned short* samplesB, double* output, U32 samplesPerBuffer,
+                                                 double scale, double inputRange, bool startOdd) {
+    const __m256d scaleVec = _mm256_set1_pd(scale);
+    const __m256d rangeVec = _mm256_set1_pd(inputRange);
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+
+    U32 i = 0;
+    for (; i + 4 <= samplesPerBuffer; i += 4) {
+        // Widen 4 codes per channel to doubles and scale to volts
+        __m256d voltsA = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(samplesA + i))));
+        __m256d voltsB = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(samplesB + i))));
+        voltsA = _mm256_sub_pd(_mm256_mul_pd(voltsA, scaleVec), rangeVec);
+        voltsB = _mm256_sub_pd(_mm256_mul_pd(voltsB, scaleVec), rangeVec);
+
+        // Interleave into complex pairs. evenPairs holds samples i, i+2 and oddPairs holds i+1, i+3, so the sign flip is a single xor
+        __m256d evenPairs = _mm256_unpacklo_pd(voltsA, voltsB);
+        __m256d oddPairs = _mm256_unpackhi_pd(voltsA, voltsB);
+        if (startOdd) {
+            evenPairs = _mm256_xor_pd(evenPairs, signMask);
+        }
+        else {
+            oddPairs = _mm256_xor_pd(oddPairs, signMask);
+        }
+
+        _mm256_storeu_pd(output + 2*i, _mm256_permute2f128_pd(evenPairs, oddPairs, 0x20));
+        _mm256_storeu_pd(output + 2*i + 4, _mm256_permute2f128_pd(evenPairs, oddPairs, 0x31));
+    }
+    return i;
+}
+
+
+
+// AVX2 loop of the single precision convertSamplesToComplex, 8 samples per iteration. Returns the first sample it left for the scalar loop
+SAMPLE_AVX2_TARGET static U32 convertSamplesAVX2(const unsigned short* samplesA, const unsigned short* samplesB, float* output, U32 samplesPerBuffer,
+                                                 float scale, float range, bool startOdd) {
+    const __m256 scaleVec = _mm256_set1_ps(scale);
+    const __m256 rangeVec = _mm256_set1_ps(range);
+
+    // Each stored vector holds 4 complex samples, so the odd samples are always float lanes 2, 3, 6 and 7
+    const __m256 signMask = startOdd ? _mm256_setr_ps(-0.0f, -0.0f, 0.0f, 0.0f, -0.0f, -0.0f, 0.0f, 0.0f)
+                                     : _mm256_setr_ps(0.0f, 0.0f, -0.0f, -0.0f, 0.0f, 0.0f, -0.0f, -0.0f);
+
+    U32 i = 0;
+    for (; i + 8 <= samplesPerBuffer; i += 8) {
+        // Widen 8 codes per channel to floats and scale to volts
+        __m256 voltsA = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samplesA + i))));
+        __m256 voltsB = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samplesB + i))));
+        voltsA = _mm256_sub_ps(_mm256_mul_ps(voltsA, scaleVec), rangeVec);
+        voltsB = _mm256_sub_ps(_mm256_mul_ps(voltsB, scaleVec), rangeVec);
+
+        // Interleave into complex pairs: low holds samples i, i+1, i+4, i+5 and high holds i+2, i+3, i+6, i+7
+        __m256 low = _mm256_unpacklo_ps(voltsA, voltsB);
+        __m256 high = _mm256_unpackhi_ps(voltsA, voltsB);
+
+        _mm256_storeu_ps(output + 2*i, _mm256_xor_ps(_mm256_permute2f128_ps(low, high, 0x20), signMask));
+        _mm256_storeu_ps(output + 2*i + 8, _mm256_xor_ps(_mm256_permute2f128_ps(low, high, 0x31), signMask));
+    }
+    return i;
+}
+
+
+
+// Whether the conversion runs its AVX2 loops, decided once for the CPU the program runs on as for the spectrum kernels
+static bool useAVX2Conversion() {
+    static const bool useAVX2 = SPECTRUM_KERNEL_DISPATCH && cpuHasAVX2();
+    return useAVX2;
+}
+#endif
+
+
+
+/**
+ * @brief Converts one two-channel DMA buffer of raw sample codes into the sign-modulated complex voltage array the FFT expects, in a single pass.
+ * Channel A becomes the real part and channel B the imaginary part, and every odd sample is negated to 0-center the DFT. Uses AVX2 when the
+ * CPU has it, which is checked at run time, and an equivalent scalar loop otherwise.
+ * 
+ * @param samples - raw DMA buffer holding samplesPerBuffer codes for channel A followed by samplesPerBuffer codes for channel B
+ * @param complexOutput - fftw_complex array with room for samplesPerBuffer samples
+ * @param samplesPerBuffer - number of samples per channel in the buffer
+ * @param inputRange - full scale voltage range the codes were acquired with
+ * @param startOdd - true if the first sample sits at an odd index of the transform (negate even samples instead)
+ */
+void convertSamplesToComplex(const unsigned short* samples, fftw_complex* complexOutput, U32 samplesPerBuffer, double inputRange, bool startOdd) {
+    // Sample codes run from 0x0000 (-inputRange) through 0x8000 (0V) to 0xFFFF (+inputRange)
+    const unsigned short* samplesA = samples;
+    const unsigned short* samplesB = samples + samplesPerBuffer;
+
+    const double scale = 2 * inputRange / (double)0xFFFF;
+    double* output = reinterpret_cast<double*>(complexOutput);
+    U32 i = 0;
+
+    #if SAMPLE_CONVERSION_X64
+    if (useAVX2Conversion()) {
+        i = convertSamplesAVX2(samplesA, samplesB, output, samplesPerBuffer, scale, inputRange, startOdd);
+    }
+    #endif
+
+    // Scalar fallback, also handles the tail of the vectorized loop (i is always even here). Unrolled by pairs to drop the parity branch
+    const double evenSign = startOdd ? -1.0 : 1.0;
+    for (; i + 2 <= samplesPerBuffer; i += 2) {
+        output[2*i]     =  evenSign * (samplesA[i] * scale - inputRange);
+        output[2*i + 1] =  evenSign * (samplesB[i] * scale - inputRange);
+        output[2*i + 2] = -evenSign * (samplesA[i+1] * scale - inputRange);
+        output[2*i + 3] = -evenSign * (samplesB[i+1] * scale - inputRange);
+    }
+    if (i < samplesPerBuffer) {
+        output[2*i]     = evenSign * (samplesA[i] * scale - inputRange);
+        output[2*i + 1] = evenSign * (samplesB[i] * scale - inputRange);
+    }
+}
+
+
+
+/**
+ * @brief Single precision version of convertSamplesToComplex for the SINGLE_PRECISION_PIPELINE build. 16-bit codes are exactly representable
+ * in float, so only the scaled voltages are rounded. The AVX2 path converts 8 samples per iteration.
+ * 
+ * @param samples - raw DMA buffer holding samplesPerBuffer codes for channel A followed by samplesPerBuffer codes for channel B
+ * @param complexOutput - fftwf_complex array with room for samplesPerBuffer samples
+ * @param samplesPerBuffer - number of samples per channel in the buffer
+ * @param inputRange - full scale voltage range the codes were acquired with
+ * @param startOdd - true if the first sample sits at an odd index of the transform (negate even samples instead)
+ */
+void convertSamplesToComplex(const unsigned short* samples, fftwf_complex* complexOutput, U32 samplesPerBuffer, double inputRange, bool startOdd) {
+    const unsigned short* samplesA = samples;
+    const unsigned short* samplesB = samples + samplesPerBuffer;
+
+    const float scale = (float)(2 * inputRange / (double)0xFFFF);
+    const float range = (float)inputRange;
+    float* output = reinterpret_cast<float*>(complexOutput);
+    U32 i = 0;
+
+    #if SAMPLE_CONVERSION_X64
+    if (useAVX2Conversion()) {
+        i = convertSamplesAVX2(samplesA, samplesB, output, samplesPerBuffer, scale, range, startOdd);
+    }
+    #endif
+
+    // Scalar fallback, also handles the tail of the vectorized loop (i is always even here)
+    const float evenSign = startOdd ? -1.0f : 1.0f;
+    for (; i + 2 <= samplesPerBuffer; i += 2) {
+        output[2*i]     =  evenSign * (samplesA[i] * scale - range);
+        output[2*i + 1] =  evenSign * (samplesB[i] * scale - range);
+        output[2*i + 2] = -evenSign * (samplesA[i+1] * scale - range);
+        output[2*i + 3] = -evenSign * (samplesB[i+1] * scale - range);
+    }
+    if (i < samplesPerBuffer) {
+        output[2*i]     = evenSign * (samplesA[i] * scale - range);
+        output[2*i + 1] = evenSign * (samplesB[i] * scale - range);
+    }
+}
+
+
+
 /**
  * @brief Fourier transforms the time domain data from the ATS9462. This will return a fftw_complex array containing frequency domain 
  * voltage data (raw spectra).
@@ -654,8 +843,8 @@ std::pair<std::vector<double>, std::vector<double>> processData(std::pair<std::v
  * @return fftw_complex* - Fourier transformed data in the frequency domain
  */
 fftw_complex* processDataFFT(fftw_complex* sampleData, fftw_plan plan, int N) {
-    fftw_complex *FFTData = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * 2 * N));
-    fftw_execute_dft(plan, sampleData, FFTData);
+    fftw_complex *FFTData = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * N));
+    processDataFFT(sampleData, FFTData, plan);
 
     return FFTData;
 }
@@ -663,18 +852,134 @@ fftw_complex* processDataFFT(fftw_complex* sampleData, fftw_plan plan, int N) {
 
 
 /**
- * @brief Data acquisition loop for the fully parallelized acquisition. Designed to acquire data continuously until the pauseDataCollection flag 
- * is set to true or the fixed horizon is hit. This function will acquire data, process it into voltage, and save it to the sharedData struct.
+ * @brief Fourier transforms the time domain data from the ATS9462 into a caller-provided output buffer (e.g. one borrowed from a BufferPool).
  * 
- * @param sharedData - Struct containing the shared data between threads. This function will write to dataQueue and signal dataReadyCondition
- * @param syncFlags - Struct containing the synchronization flags between threads. This function will read the pauseDataCollection flag
+ * @param sampleData - fftw_complex array containing the raw sample data, pre-processed into voltages
+ * @param FFTData - fftw_complex array to write the frequency domain data to. Must hold as many samples as the plan was made for.
+ * @param plan - fftw_plan object containing the plan for the FFT. Should be created before calling this function.
  */
-void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
-    try{
+void processDataFFT(fftw_complex* sampleData, fftw_complex* FFTData, fftw_plan plan) {
+    fftw_execute_dft(plan, sampleData, FFTData);
+}
+
+
+
+/**
+ * @brief Fourier transforms numSpectra contiguous spectra of N samples each. Full groups of batchSize spectra are transformed with one call to
+ *        the batched plan, and any remainder falls back to the single spectrum plan. Input and output are addressed in place, so no spectrum is copied.
+ * 
+ * @param sampleData - fftw_complex array holding numSpectra*N samples, pre-processed into voltages
+ * @param FFTData - fftw_complex array with room for numSpectra*N samples to write the frequency domain data to
+ * @param numSpectra - number of spectra in sampleData
+ * @param N - number of samples per spectrum
+ * @param plan - single spectrum plan of size N
+ * @param batchPlan - plan from fftw_plan_many_dft over batchSize spectra with stride 1 and distance N. May be NULL if batchSize <= 1
+ * @param batchSize - number of spectra batchPlan was made for
+ * 
+ * @note FFTW requires new-array execution to keep the alignment of the planning arrays, so N must be even for the offsets to stay aligned.
+ */
+void processDataFFTBatched(fftw_complex* sampleData, fftw_complex* FFTData, int numSpectra, int N, fftw_plan plan, fftw_plan batchPlan, int batchSize) {
+    int spectrum = 0;
+
+    if (batchPlan != NULL && batchSize > 1) {
+        for (; spectrum + batchSize <= numSpectra; spectrum += batchSize) {
+            fftw_execute_dft(batchPlan, sampleData + (size_t)spectrum*N, FFTData + (size_t)spectrum*N);
+        }
+    }
+
+    for (; spectrum < numSpectra; spectrum++) {
+        fftw_execute_dft(plan, sampleData + (size_t)spectrum*N, FFTData + (size_t)spectrum*N);
+    }
+}
+
+
+
+/**
+ * @brief Single precision version of processDataFFTBatched for the SINGLE_PRECISION_PIPELINE build.
+ * 
+ * @param sampleData - fftwf_complex array holding numSpectra*N samples, pre-processed into voltages
+ * @param FFTData - fftwf_complex array with room for numSpectra*N samples to write the frequency domain data to
+ * @param numSpectra - number of spectra in sampleData
+ * @param N - number of samples per spectrum
+ * @param plan - single spectrum plan of size N
+ * @param batchPlan - plan from fftwf_plan_many_dft over batchSize spectra with stride 1 and distance N. May be NULL if batchSize <= 1
+ * @param batchSize - number of spectra batchPlan was made for
+ */
+void processDataFFTBatched(fftwf_complex* sampleData, fftwf_complex* FFTData, int numSpectra, int N, fftwf_plan plan, fftwf_plan batchPlan, int batchSize) {
+    int spectrum = 0;
+
+    if (batchPlan != NULL && batchSize > 1) {
+        for (; spectrum + batchSize <= numSpectra; spectrum += batchSize) {
+            fftwf_execute_dft(batchPlan, sampleData + (size_t)spectrum*N, FFTData + (size_t)spectrum*N);
+        }
+    }
+
+    for (; spectrum < numSpectra; spectrum++) {
+        fftwf_execute_dft(plan, sampleData + (size_t)spectrum*N, FFTData + (size_t)spectrum*N);
+    }
+}
+
+
+
+/**
+ * @brief Allocates acquisitionParams.bufferCount DMA buffers of acquisitionParams.bytesPerBuffer into IoBufferArray, placed by 
+ *        acquisitionParams.bufferAllocation. In adaptive mode the ring is re-sized first from the consumer latency measured during the 
+ *        previous acquisitions.
+ * 
+ */
+void ATS::allocateIoBuffers() {
+    freeIoBuffers();
+
+    if (acquisitionParams.adaptiveBufferCount) {
+        U32 bufferCount = suggestBufferCount();
+        if (bufferCount != acquisitionParams.bufferCount) {
+            std::cout << "Resizing DMA ring from " << std::to_string(acquisitionParams.bufferCount) << " to " << std::to_string(bufferCount) 
+                      << " buffers (worst consumer latency " << std::to_string(consumerLatency*1e3) << " ms)." << std::endl;
+            acquisitionParams.bufferCount = bufferCount;
+        }
+
+        // Let the measurement decay so a single stall doesn't pin a deep ring forever
+        consumerLatency /= 2;
+    }
+
+    IoBufferArray.assign(acquisitionParams.bufferCount, NULL);
+	for (U32 bufferIndex = 0; bufferIndex < acquisitionParams.bufferCount; bufferIndex++)
+	{
+		IoBufferArray[bufferIndex] = CreateIoBuffer(acquisitionParams.bytesPerBuffer, acquisitionParams.bufferAllocation);
+		if (IoBufferArray[bufferIndex] == NULL) {
+            freeIoBuffers();
+            throw std::runtime_error(std::string("Error: Alloc ") + std::to_string(acquisitionParams.bytesPerBuffer) + " bytes failed for DMA buffer " 
+                                     + std::to_string(bufferIndex) + "\n");
+		}
+	}
+}
+
+
+
+/**
+ * @brief Frees every DMA buffer in IoBufferArray.
+ * 
+ */
+void ATS::freeIoBuffers() {
+	for (IO_BUFFER* pIoBuffer : IoBufferArray) {
+		if (pIoBuffer != NULL) {
+			DestroyIoBuffer(pIoBuffer);
+        }
+	}
+    IoBufferArray.clear();
+}
+
+
+
+/**
+ * @brief Primes the board for a triggered streaming acquisition, allocates and posts the DMA buffers, and starts the capture.
+ * 
+ * @param continuous - if true, the board keeps acquiring records until aborted instead of stopping after recordsPerAcquisition
+ */
+void ATS::armBoard(bool continuous) {
     // Set basic flags
     U32 channelMask = CHANNEL_A | CHANNEL_B;
     U32 admaFlags = ADMA_TRIGGERED_STREAMING | ADMA_EXTERNAL_STARTCAPTURE;         // Start acquisition when AlazarStartCapture is called
-    int channelCount = 2; 
 
 
     // Prime board for acquisition
@@ -684,7 +989,7 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
         0,						                    // long -- offset from trigger in samples
         acquisitionParams.samplesPerBuffer,		    // U32 -- samples per buffer
         1,		                                    // U32 -- records per buffer (must be 1)
-        acquisitionParams.recordsPerAcquisition,    // U32 -- records per acquisition 
+        continuous ? 0x7FFFFFFF : acquisitionParams.recordsPerAcquisition,    // U32 -- records per acquisition (0x7FFFFFFF acquires until aborted)
         admaFlags				                    // U32 -- AutoDMA flags
     ); 
     if (retCode != ApiSuccess) {
@@ -693,46 +998,104 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
 
 
     // Allocate memory for DMA buffers and post them to board
-	int bufferIndex;
-	for (bufferIndex = 0; bufferIndex < BUFFER_COUNT; bufferIndex++)
-	{
-		IoBufferArray[bufferIndex] = CreateIoBuffer(acquisitionParams.bytesPerBuffer);
-		if (IoBufferArray[bufferIndex] == NULL) {
-            throw std::runtime_error(std::string("Error: Alloc ") + AlazarErrorToText(retCode) +  "bytes failed\n");
-		}
-	}
+	allocateIoBuffers();
 
-    bool success = TRUE;
-	for (bufferIndex = 0; (bufferIndex < BUFFER_COUNT) && (success == TRUE); bufferIndex++)
+	for (int bufferIndex = 0; bufferIndex < (int)IoBufferArray.size(); bufferIndex++)
 	{
 		IO_BUFFER *pIoBuffer = IoBufferArray[bufferIndex];
 		if (!ResetIoBuffer(pIoBuffer)) {
-			success = FALSE;
-		}
-		else {
-			retCode = AlazarPostAsyncBuffer(
-                boardHandle,					// HANDLE -- board handle
-                pIoBuffer->pBuffer,				// void* -- buffer
-                pIoBuffer->uBufferLength_bytes	// U32 -- buffer length in bytes
-            );				
-			if (retCode != ApiSuccess) {
-                throw std::runtime_error(std::string("Error: AlazarAsyncRead ") + std::to_string(bufferIndex) + 
-                                                     " failed -- " + AlazarErrorToText(retCode) + "\n");
-			}
+            throw std::runtime_error(std::string("Error: ResetIoBuffer ") + std::to_string(bufferIndex) + " failed\n");
 		}
+
+        retCode = AlazarPostAsyncBuffer(
+            boardHandle,					// HANDLE -- board handle
+            pIoBuffer->pBuffer,				// void* -- buffer
+            pIoBuffer->uBufferLength_bytes	// U32 -- buffer length in bytes
+        );				
+        if (retCode != ApiSuccess) {
+            throw std::runtime_error(std::string("Error: AlazarAsyncRead ") + std::to_string(bufferIndex) + 
+                                                 " failed -- " + AlazarErrorToText(retCode) + "\n");
+        }
 	}
 
 
 	// Arm the board to begin the acquisition 
-	if (success) {
-		retCode = AlazarStartCapture(boardHandle);
-		if (retCode != ApiSuccess) {
-			throw std::runtime_error(std::string("Error: AlazarStartCapture failed -- ") + AlazarErrorToText(retCode) + "\n");
-            success = false;
-		}
+    retCode = AlazarStartCapture(boardHandle);
+    if (retCode != ApiSuccess) {
+        throw std::runtime_error(std::string("Error: AlazarStartCapture failed -- ") + AlazarErrorToText(retCode) + "\n");
+    }
+}
+
+
+
+/**
+ * @brief Stops the capture and frees the DMA buffers allocated by armBoard().
+ * 
+ */
+void ATS::disarmBoard() {
+	// Abort the acquisition ("abort" is potentially misleading here - should call even if the acquisition completed normally)
+	retCode = AlazarAbortAsyncRead(boardHandle);
+	if (retCode != ApiSuccess) {
+		printf("Error: AlazarAbortAsyncRead failed -- %s\n", AlazarErrorToText(retCode));
 	}
 
 
+	// Free all memory allocated
+	freeIoBuffers();
+}
+
+
+
+/**
+ * @brief Ends the step's acquisition wait now instead of at the next buffer or timeout: in a streaming session the step is released from the 
+ *        gate, otherwise the pending DMA is aborted so that AlazarWaitAsyncBufferComplete returns.
+ * 
+ * @param step - step to stop
+ */
+void ATS::interruptStep(StepDelivery* step) {
+    if (sessionActive) {
+        {
+            std::lock_guard<std::mutex> sessionLock(sessionMutex);
+            if (activeStep == step) {
+                activeStep = nullptr;
+            }
+        }
+        sessionCondition.notify_all();
+        return;
+    }
+
+    // Called from the decision thread, so don't touch the retCode member of the acquisition thread
+    RETURN_CODE abortCode = AlazarAbortAsyncRead(boardHandle);
+    if (abortCode != ApiSuccess) {
+        printf("Error: AlazarAbortAsyncRead failed on stop request -- %s\n", AlazarErrorToText(abortCode));
+    }
+}
+
+
+
+/**
+ * @brief Data acquisition loop for the fully parallelized acquisition. Designed to acquire data continuously until the pauseDataCollection flag 
+ * is set to true or the fixed horizon is hit. This function will acquire data, process it into voltage, and save it to the sharedData struct.
+ * 
+ * @param sharedData - Struct containing the shared data between threads. This function will push to dataRings and close them at the end
+ * @param syncFlags - Struct containing the synchronization flags between threads. This function will read the pauseDataCollection flag
+ */
+void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
+    try{
+    // Keep delivering from the persistent session if one is armed
+    if (sessionActive) {
+        acquireFromStreamingSession(sharedData, syncFlags);
+        return;
+    }
+
+    StepDelivery step;
+    beginStepDelivery(step, sharedData, syncFlags);
+
+    armBoard();
+    int bufferIndex;
+    bool success = TRUE;
+
+
 	// Wait for each buffer to be filled, process the buffer, and re-post it to the board.
 	if (success) {
         startTimer(TIMER_ACQUISITION);
@@ -746,18 +1109,20 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
 
         // Main acquisition logic     
 		while (buffersCompleted < acquisitionParams.buffersPerAcquisition) {
-            // Acquire a mutex lock and check if the pause flag has been set
-            {
-                std::lock_guard<std::mutex> lock(syncFlags.mutex);
-                if (syncFlags.pauseDataCollection) {
-                    std::cout << "Received pause signal" << std::endl;
-                    break;
-                }
+            // Check if the pause flag has been set
+            if (pauseRequested(syncFlags)) {
+                std::cout << "Received pause signal" << std::endl;
+                break;
             }
 
 
-            // Send a software trigger to begin acquisition (technically should be unecessary but won't hurt anything)
+            // Send a software trigger to begin acquisition (technically should be unecessary but won't hurt anything). Fails if a stop 
+            // request aborted the capture since the check above
             retCode = AlazarForceTrigger(boardHandle);
+            if (retCode != ApiSuccess && pauseRequested(syncFlags)) {
+                std::cout << "Received pause signal" << std::endl;
+                break;
+            }
             if (retCode != ApiSuccess) {
                 throw std::runtime_error(std::string("Error: Trigger failed to send -- ") + AlazarErrorToText(retCode) + "\n");
             }
@@ -767,7 +1132,7 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
 
 
 			// Wait for the buffer at the head of the list of available buffers to be filled by the board.
-			bufferIndex = buffersCompleted % BUFFER_COUNT;
+			bufferIndex = buffersCompleted % IoBufferArray.size();
 			IO_BUFFER *pIoBuffer = IoBufferArray[bufferIndex];
 			retCode = AlazarWaitAsyncBufferComplete(
                 boardHandle, 
@@ -779,36 +1144,11 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
             // Process the buffer that was just filled. This buffer is full and has been removed from the list of buffers available to the board.
 			if (retCode == ApiSuccess) {
                 // DWORD startProcTickCount = GetTickCount();
-                fftw_complex* complexOutput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * acquisitionParams.samplesPerBuffer));
-
-                std::vector<unsigned short> bufferData(reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer),
-                                      reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer) + (acquisitionParams.bytesPerBuffer / sizeof(unsigned short)));
-
-
-                for (unsigned int i=0; i < bufferData.size()/2; i++) {
-                    complexOutput[i][0] = (bufferData[i]   / (double)0xFFFF) * 2 * acquisitionParams.inputRange - acquisitionParams.inputRange;
-                    complexOutput[i][1] = (bufferData[bufferData.size()/2 + i]  / (double)0xFFFF) * 2 * acquisitionParams.inputRange - acquisitionParams.inputRange;
-
-                    // Trick to 0-center the dft
-                    if (i % 2 == 1) {
-                        complexOutput[i][0] *= -1;
-                        complexOutput[i][1] *= -1;
-                    }
-                }
-
-                fftw_complex* backupComplexOutput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * acquisitionParams.samplesPerBuffer));
-                std::memcpy(backupComplexOutput, complexOutput, sizeof(fftw_complex) * acquisitionParams.samplesPerBuffer);
-
-                // Push the data to the shared data queue and notify the processing thread that data is ready
-                {
-                    std::lock_guard<std::mutex> lock(sharedData.mutex);
-                    sharedData.dataQueue.push(complexOutput);
-                    sharedData.backupDataQueue.push(backupComplexOutput);
+                // Convert straight into the step's current block. Fails if downstream stages have every block in flight past the buffer timeout
+                if (!deliverBuffer(step, reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer), timeout_ms)) {
+                    success = FALSE;
+                    break;
                 }
-                sharedData.dataReadyCondition.notify_one();
-
-                complexOutput = nullptr;
-                backupComplexOutput = nullptr;
 
                 buffersCompleted++;
 				bytesTransferred += acquisitionParams.bytesPerBuffer;	
@@ -818,6 +1158,11 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
                 // double bufferProcTime_sec = (GetTickCount() - startProcTickCount) / 1000.;
 	            // std::cout << "Buffer processed in " << bufferProcTime_sec << " sec" << std::endl;
             }
+			else if (pauseRequested(syncFlags)) {
+				// A stop request aborted the capture to end the wait early, the buffer holds nothing to deliver
+                std::cout << "Received pause signal" << std::endl;
+                break;
+			}
 			else {
 				// The wait failed
 				success = FALSE;
@@ -826,10 +1171,12 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
 				{
 				case ApiWaitTimeout:
 					printf("Error: Wait timeout after %lu ms\n", timeout_ms);
+					overruns++;
 					break;
 
 				case ApiBufferOverflow:
 					printf("Error: Board overflowed on-board memory\n");
+					overruns++;
 					break;
 
                 case ApiBufferNotReady:
@@ -859,6 +1206,10 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
                         pIoBuffer->pBuffer,				// void* -- buffer
                         pIoBuffer->uBufferLength_bytes	// U32 -- buffer length in bytes
                     );		
+					if (retCode != ApiSuccess && pauseRequested(syncFlags)) {
+                        std::cout << "Received pause signal" << std::endl;
+                        break;
+					}
 					if (retCode != ApiSuccess) {
 						printf("Error: AlazarPostAsyncBuffer failed -- %s\n", AlazarErrorToText(retCode));
 						success = FALSE;
@@ -883,6 +1234,7 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
 			printf("Completed %u buffers\r", buffersCompleted);
             #endif
 		}
+
         stopTimer(TIMER_ACQUISITION);
 
         #if VERBOSE_OUTPUT
@@ -914,33 +1266,203 @@ void ATS::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, Synchr
 	}
 
 
-    // Signal the end of data acquisition if the decision making didn't stop it
+    // Hand off whatever was converted and signal the end of data acquisition
+    endStepDelivery(step);
+
+    disarmBoard();
+
+    return;
+
+    }
+    catch(const std::exception& e)
     {
-        std::lock_guard<std::mutex> lock(syncFlags.mutex);
-        syncFlags.acquisitionComplete = true;
+        failStepDelivery(syncFlags, e);
     }
+}
 
 
-	// Abort the acquisition ("abort" is potentially misleading here - should call even if the acquisition completed normally)
-	retCode = AlazarAbortAsyncRead(boardHandle);
-	if (retCode != ApiSuccess) {
-		printf("Error: AlazarAbortAsyncRead failed -- %s\n", AlazarErrorToText(retCode));
-		success = FALSE;
-	}
 
+/**
+ * @brief Arms the board once and keeps it streaming across scan steps. A background thread waits for every DMA buffer and re-posts it, 
+ *        delivering buffers to the pipeline only while a step opened by AcquireDataMultithreadedContinuous is active and discarding them
+ *        otherwise. This removes the AlazarBeforeAsyncRead/buffer allocation/AlazarStartCapture dead time from every step.
+ * 
+ * @note AcquireData() and setAcquisitionParameters() stop the session. The next call to startStreamingSession() re-arms the board.
+ */
+void ATS::startStreamingSession() {
+    if (sessionActive) {
+        return;
+    }
 
-	// Free all memory allocated
-	for (bufferIndex = 0; bufferIndex < BUFFER_COUNT; bufferIndex++) {
-		if (IoBufferArray[bufferIndex] != NULL)
-			DestroyIoBuffer(IoBufferArray[bufferIndex]);
-	}
+    armBoard(true);
+
+    sessionActive = true;
+    sessionRunning = true;
+    sessionThread = std::thread(&ATS::streamingSessionLoop, this);
+}
 
-    return;
 
+
+/**
+ * @brief Stops the streaming session thread, aborts the capture and frees the DMA buffers.
+ * 
+ */
+void ATS::stopStreamingSession() {
+    if (!sessionActive) {
+        return;
     }
-    catch(const std::exception& e)
+
     {
-        std::cout << "Acquisition thread exiting due to exception." << std::endl;
-        std::cerr << e.what() << '\n';
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        sessionRunning = false;
+    }
+    sessionCondition.notify_all();
+
+    if (sessionThread.joinable()) {
+        sessionThread.join();
     }
+
+    disarmBoard();
+    sessionActive = false;
+}
+
+
+
+/**
+ * @brief Body of the streaming session thread. Waits for each DMA buffer in ring order, hands it to the active step (if any) and re-posts it.
+ *        A step is released once it has buffersPerAcquisition buffers, its pause flag is set or a block could not be delivered. A failed wait
+ *        ends the session; the next step re-arms the board. The thread runs with the acquisition placement of placeSessionThread.
+ * 
+ */
+void ATS::streamingSessionLoop() {
+    ThreadPlacementScope placement(sessionPlacement, THREAD_ROLE_ACQUISITION, sessionChainMask);
+    U64 buffersCompleted = 0;
+
+    // Timeout after 10x the expected time for 1 buffer
+    DWORD timeout_ms = (DWORD)(10*1e3*acquisitionParams.samplesPerBuffer/acquisitionParams.sampleRate); 
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            if (!sessionRunning) {
+                break;
+            }
+        }
+
+        // Send a software trigger to begin acquisition (technically should be unecessary but won't hurt anything)
+        AlazarForceTrigger(boardHandle);
+
+        // Wait for the buffer at the head of the list of available buffers to be filled by the board
+        IO_BUFFER *pIoBuffer = IoBufferArray[buffersCompleted % IoBufferArray.size()];
+        RETURN_CODE waitCode;
+        {
+            TraceSpan bufferWait("Buffer wait", TRACE_PIPELINE, buffersCompleted);
+            waitCode = AlazarWaitAsyncBufferComplete(boardHandle, pIoBuffer->pBuffer, timeout_ms);
+        }
+        if (waitCode != ApiSuccess) {
+            printf("Error: Streaming session wait failed -- %s\n", AlazarErrorToText(waitCode));
+            if (waitCode == ApiWaitTimeout || waitCode == ApiBufferOverflow) {
+                overruns++;
+            }
+            break;
+        }
+        buffersCompleted++;
+
+
+        // Gate the buffer into the active step, or drop it between steps
+        StepDelivery* step;
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            step = activeStep;
+            sessionDelivering = (step != nullptr);
+        }
+
+        if (step != nullptr) {
+            bool stepDone = pauseRequested(*step->syncFlags);
+
+            if (!stepDone) {
+                stepDone = !deliverBuffer(*step, reinterpret_cast<unsigned short*>(pIoBuffer->pBuffer), timeout_ms) ||
+                           step->buffersDelivered >= acquisitionParams.buffersPerAcquisition;
+            }
+
+            // A stop request may have released the step already, its acquisition thread is waiting for this delivery to finish
+            bool released;
+            {
+                std::lock_guard<std::mutex> lock(sessionMutex);
+                sessionDelivering = false;
+                if (stepDone && activeStep == step) {
+                    activeStep = nullptr;
+                }
+                released = (activeStep != step);
+            }
+            if (released) {
+                sessionCondition.notify_all();
+            }
+        }
+
+
+        // Add the buffer to the end of the list of available buffers so the board can keep streaming
+        if (!ResetIoBuffer(pIoBuffer)) {
+            printf("Error: ResetIoBuffer failed in streaming session\n");
+            break;
+        }
+
+        RETURN_CODE postCode = AlazarPostAsyncBuffer(boardHandle, pIoBuffer->pBuffer, pIoBuffer->uBufferLength_bytes);
+        if (postCode != ApiSuccess) {
+            printf("Error: AlazarPostAsyncBuffer failed -- %s\n", AlazarErrorToText(postCode));
+            break;
+        }
+    }
+
+    // Release any step still waiting so its pipeline can finish
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        if (activeStep != nullptr) {
+            activeStep->failed = true;
+            activeStep = nullptr;
+        }
+        sessionRunning = false;
+    }
+    sessionCondition.notify_all();
+}
+
+
+
+/**
+ * @brief Delivers one step of buffersPerAcquisition buffers from the running streaming session to the pipeline. Re-arms the session first 
+ *        if it ended after an error.
+ * 
+ * @param sharedData - Struct containing the shared data between threads. This function will push to dataRings and close them at the end
+ * @param syncFlags - Struct containing the synchronization flags between threads. This function will read the pauseDataCollection flag
+ */
+void ATS::acquireFromStreamingSession(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
+    bool running;
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        running = sessionRunning;
+    }
+    if (!running) {
+        std::cout << "Streaming session ended unexpectedly. Re-arming the board." << std::endl;
+        stopStreamingSession();
+        startStreamingSession();
+    }
+
+    StepDelivery step;
+    beginStepDelivery(step, sharedData, syncFlags);
+
+    // Open the gate and wait until the session thread has delivered the whole step
+    startTimer(TIMER_ACQUISITION);
+    {
+        std::unique_lock<std::mutex> lock(sessionMutex);
+        activeStep = &step;
+        sessionCondition.wait(lock, [this]() { return activeStep == nullptr && !sessionDelivering; });
+    }
+    stopTimer(TIMER_ACQUISITION);
+
+    if (step.failed) {
+        std::cout << "Streaming session delivered " << std::to_string(step.buffersDelivered) << " of " 
+                  << std::to_string(acquisitionParams.buffersPerAcquisition) << " buffers before failing." << std::endl;
+    }
+
+    endStepDelivery(step);
 }
@@ -24,47 +24,63 @@ void AWG::onOff(bool on) {
 }
 
 void AWG::onOff(bool on, int channel) {
-    std::string command = on ? "OUTPUT" + std::to_string(channel) + " ON" : "OUTPUT" + std::to_string(channel) + " OFF";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string header = "OUTPUT" + std::to_string(channel);
+    std::string value = on ? "ON" : "OFF";
+    if (isCached(header, value)) {
+        return;
+    }
+    status = writeSetting(header, value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set AWG on/off state.");
     }
 
-    queryError();
+    checkError();
 }
 
 void AWG::setSampleRate(double rate, int channel){
-    std::string command = "SOURCE" + std::to_string(channel) + ":FUNCtion:ARB:SRATe " + std::to_string(rate);
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string header = "SOURCE" + std::to_string(channel) + ":FUNCtion:ARB:SRATe";
+    std::string value = std::to_string(rate);
+    if (isCached(header, value)) {
+        return;
+    }
+    status = writeSetting(header, value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set AWG sample rate.");
     }
 
-    queryError();
+    checkError();
 }
 
 void AWG::setAmp(double amp, int channel){
-    std::string command = "SOURCE" + std::to_string(channel) + ":VOLT " + std::to_string(amp);
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string header = "SOURCE" + std::to_string(channel) + ":VOLT";
+    std::string value = std::to_string(amp);
+    if (isCached(header, value)) {
+        return;
+    }
+    status = writeSetting(header, value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set AWG amplitude.");
     }
 
-    queryError();
+    checkError();
 }
 
 void AWG::setOffset(double offset, int channel){
-    std::string command = "SOURCE" + std::to_string(channel) + ":VOLT:OFFSET " + std::to_string(offset);
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string header = "SOURCE" + std::to_string(channel) + ":VOLT:OFFSET";
+    std::string value = std::to_string(offset);
+    if (isCached(header, value)) {
+        return;
+    }
+    status = writeSetting(header, value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set AWG dc offset.");
     }
 
-    queryError();
+    checkError();
 }
 
 
@@ -72,58 +88,102 @@ void AWG::setOffset(double offset, int channel){
 
 void AWG::clearMemory(int channel){
     std::string command = "SOURCE" + std::to_string(channel) + ":DATA:VOLatile:CLEar";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    status = write(command);
 
     if (status != VI_SUCCESS) {
-        throw std::runtime_error("Failed to set AWG dc offset.");
+        throw std::runtime_error("Failed to clear AWG waveform memory.");
+    }
+
+    // The channel's waveforms are gone, whether or not the instrument reports an error
+    for (auto uploaded = uploadedWaveforms.begin(); uploaded != uploadedWaveforms.end();) {
+        uploaded = (uploaded->first.first == channel) ? uploadedWaveforms.erase(uploaded) : std::next(uploaded);
     }
 
-    queryError();
+    checkError();
 }
 
 
 
-void AWG::sendWaveform(std::vector<double> waveform, std::string name, int channel) {
-    // Scale arb to send
-    double mx = *std::max_element(waveform.begin(), waveform.end());
-    for (double& value : waveform) {
-        value /= mx;
-    }
+/**
+ * @brief Forgets the cached settings and uploaded waveforms. Every event that invalidates the settings, *RST or an instrument error among
+ *        them, may also have cleared the waveform memory.
+ * 
+ */
+void AWG::invalidateCache() {
+    Instrument::invalidateCache();
+    uploadedWaveforms.clear();
+}
 
 
-    // Convert the waveform data to a comma-separated string
-    std::stringstream waveformStream;
-    for (const auto& sample : waveform) {
-        waveformStream << sample << ",";
+
+/**
+ * @brief Uploads an arbitrary waveform to the channel's volatile memory and selects it. The samples are scaled to full scale and sent as
+ *        int16 DAC codes in one IEEE 488.2 binary block, see Instrument::writeBlock. A waveform whose codes were already uploaded to the
+ *        channel is only selected again, under the name it was uploaded with.
+ * 
+ * @param waveform - samples, scaled so the largest magnitude is full scale
+ * @param name - name of the waveform in the AWG's volatile memory
+ * @param channel - output channel
+ */
+void AWG::sendWaveform(std::vector<double> waveform, std::string name, int channel) {
+    // Scale arb to the DAC range
+    double fullScale = 0;
+    for (double value : waveform) {
+        fullScale = max(fullScale, std::abs(value));
+    }
+    std::vector<int16_t> codes(waveform.size());
+    for (size_t i = 0; i < waveform.size(); i++) {
+        codes[i] = (fullScale > 0) ? (int16_t)std::lround(waveform[i] / fullScale * AWG_DAC_FULL_SCALE) : 0;
     }
-    std::string waveformString = waveformStream.str();
-    waveformString.pop_back(); // Remove the trailing comma
 
 
-    // Send the waveform data to the AWG
-    std::string command = "DATA" + std::to_string(channel) + ":ARB " + name + ", " + waveformString;
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
-    if (status != VI_SUCCESS) {
-        throw std::runtime_error("Failed to send waveform to AWG.");
+    // FNV-1a of the codes identifies the waveform
+    uint64_t hash = 14695981039346656037ULL;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(codes.data());
+    for (size_t i = 0; i < codes.size() * sizeof(int16_t); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
     }
 
-    status = viPrintf(instrumentSession, "*WAI\n");
-    queryError();
-
+    std::string source = "SOURce" + std::to_string(channel);
+    auto uploaded = uploadedWaveforms.find({channel, hash});
+    if (uploaded != uploadedWaveforms.end()) {
+        name = uploaded->second;
+    }
+    else {
+        // Loading an arbitrary waveform can rescale the channel's output settings
+        Instrument::invalidateCache();
+
+        // Little endian codes, as they are laid out in memory
+        status = write("FORMat:BORDer SWAPped");
+        if (status == VI_SUCCESS) {
+            status = writeBlock(source + ":DATA:ARBitrary:DAC " + name + ",", codes.data(), codes.size() * sizeof(int16_t));
+        }
+        if (status != VI_SUCCESS) {
+            throw std::runtime_error("Failed to send waveform to AWG.");
+        }
+
+        status = write("*WAI");
+        checkError();
+        uploadedWaveforms[{channel, hash}] = name;
+    }
 
 
-    // Set the AWG to use the uploaded waveform
-    command = "SOURce" + std::to_string(channel) + ":FUNCtion ARB";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    // Set the AWG to use the uploaded waveform, unless it already does
+    std::string selection = "'" + name + "'";
+    if (isCached(source + ":FUNCtion", "ARB") && isCached(source + ":FUNCtion:ARB", selection)) {
+        return;
+    }
+    status = writeSetting(source + ":FUNCtion", "ARB");
 
     // command = "MMEM:LOAD:DATA" + std::to_string(channel) + " 'INT:\\" + name + ".arb'";
     // status = viPrintf(instrumentSession, "%s\n", command.c_str());
 
-    command = "SOURce" + std::to_string(channel) + ":FUNCtion:ARB '" + name +"'";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    if (status == VI_SUCCESS) {
+        status = writeSetting(source + ":FUNCtion:ARB", selection);
+    }
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set AWG waveform.");
     }
-    queryError();
+    checkError();
 }
\ No newline at end of file
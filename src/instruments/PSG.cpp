@@ -12,21 +12,61 @@
 #include "decs.hpp"
 
 
-PSG::PSG(int gpibAddress) {
+/**
+ * @brief Construct a new PSG object and connect to it. At SIMULATED_GPIB_ADDRESS the PSG accepts every command without a connection.
+ * 
+ * @param gpibAddress - GPIB address of the generator
+ * @param connectNow - false to leave the connection to connect(), so several instruments can connect at once (see StartupScheduler)
+ */
+PSG::PSG(int gpibAddress, bool connectNow) : Instrument(gpibAddress == SIMULATED_GPIB_ADDRESS), gpibAddress(gpibAddress) {
+    if (connectNow) {
+        connect();
+    }
+}
+
+
+
+/**
+ * @brief Opens the connection to the PSG's GPIB address.
+ *
+ */
+void PSG::connect() {
     openConnection(gpibAddress);
 }
 
 
 
 PSG::~PSG() {
+    stopCommandWorker();
     closeConnection();
 }
 
 
 
+std::future<void> PSG::setFreqAsync(double frequency) {
+    return submit([this, frequency]() { setFreq(frequency); }, PSG_FREQ_SETTLE_TIME);
+}
+
+
+
+std::future<void> PSG::setPowAsync(double pow) {
+    return submit([this, pow]() { setPow(pow); }, PSG_POWER_SETTLE_TIME);
+}
+
+
+
+std::future<void> PSG::onOffAsync(bool on) {
+    return submit([this, on]() { onOff(on); }, PSG_OUTPUT_SETTLE_TIME);
+}
+
+
+
 void PSG::setFreq(double frequency) {
-    std::string command = "FREQ " + std::to_string(frequency) + "GHz";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = std::to_string(frequency) + "GHz";
+    if (isCached("FREQ", value)) {
+        return;
+    }
+    status = writeSetting("FREQ", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set PSG frequency.");
@@ -36,8 +76,11 @@ void PSG::setFreq(double frequency) {
 
 
 void PSG::setPow(double pow) {
-    std::string command = "POW " + std::to_string(pow) + "dBm";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = std::to_string(pow) + "dBm";
+    if (isCached("POW", value)) {
+        return;
+    }
+    status = writeSetting("POW", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set PSG power.");
@@ -47,8 +90,11 @@ void PSG::setPow(double pow) {
 
 
 void PSG::modOnOff(bool on) {
-    std::string command = on ? "OUTPUT:MOD 1" : "OUTPUT:MOD 0";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = on ? "1" : "0";
+    if (isCached("OUTPUT:MOD", value)) {
+        return;
+    }
+    status = writeSetting("OUTPUT:MOD", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set PSG overall modulation on/off state.");
@@ -58,8 +104,11 @@ void PSG::modOnOff(bool on) {
 
 
 void PSG::freqModOnOff(bool on) {
-    std::string command = on ? "FM:STATE 1" : "FM:STATE 0";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = on ? "1" : "0";
+    if (isCached("FM:STATE", value)) {
+        return;
+    }
+    status = writeSetting("FM:STATE", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set PSG FM on/off state.");
@@ -69,9 +118,11 @@ void PSG::freqModOnOff(bool on) {
 
 
 void PSG::setFreqModDev(double dev) {
-    std::string command = "FM:DEV " + std::to_string(dev) + "kHz";
-
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = std::to_string(dev) + "kHz";
+    if (isCached("FM:DEV", value)) {
+        return;
+    }
+    status = writeSetting("FM:DEV", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set FM modulation path deviation");
@@ -82,13 +133,110 @@ void PSG::setFreqModDev(double dev) {
 
 
 void PSG::setFreqModSrc(bool ext, int src) {
-    std::string command = "FM:SOURCE ";
-    command += ext ? "EXT" : "INT";
-    command += std::to_string(src);
-
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = ext ? "EXT" : "INT";
+    value += std::to_string(src);
+    if (isCached("FM:SOURCE", value)) {
+        return;
+    }
+    status = writeSetting("FM:SOURCE", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set FM modulation path deviation");
     }
+}
+
+
+
+/**
+ * @brief Loads a frequency and power list for list sweep mode, see startList. Nothing is output from the list until startList.
+ * 
+ * @param frequencies - list frequencies, GHz
+ * @param powers - power of every list point in dBm, or a single power for all of them
+ */
+void PSG::loadList(const std::vector<double>& frequencies, const std::vector<double>& powers) {
+    if (frequencies.empty() || (powers.size() != 1 && powers.size() != frequencies.size())) {
+        throw std::runtime_error("Error: PSG list needs one power, or one power per frequency\n");
+    }
+
+    std::string frequencyList, powerList;
+    for (double frequency : frequencies) {
+        frequencyList += (frequencyList.empty() ? "" : ",") + std::to_string(frequency*1e9);
+    }
+    for (double pow : powers) {
+        powerList += (powerList.empty() ? "" : ",") + std::to_string(pow);
+    }
+
+    CommandBatch batch(*this, true);
+
+    // Every list point is held until a bus trigger, the sweep itself starts as soon as it is armed
+    std::vector<std::string> commands = { "LIST:TYPE LIST", "LIST:TRIG:SOUR BUS", "TRIG:SOUR IMM", "INIT:CONT OFF",
+                                          "LIST:FREQ " + frequencyList, "LIST:POW " + powerList };
+    for (const std::string& command : commands) {
+        status = write(command);
+        if (status != VI_SUCCESS) {
+            throw std::runtime_error("Failed to load PSG list.");
+        }
+    }
+
+    batch.commit();
+}
+
+
+
+/**
+ * @brief Switches frequency and power to the loaded list and arms the sweep at its first point. Every nextListPoint steps the output to the
+ *        next point, so a sweep costs one short write per point instead of a frequency and power setting each.
+ * 
+ */
+void PSG::startList() {
+    CommandBatch batch(*this);
+    status = writeSetting("FREQ:MODE", "LIST");
+    if (status == VI_SUCCESS) {
+        status = writeSetting("POW:MODE", "LIST");
+    }
+    if (status == VI_SUCCESS) {
+        status = write("INIT");
+    }
+
+    if (status != VI_SUCCESS) {
+        throw std::runtime_error("Failed to start PSG list sweep.");
+    }
+    batch.commit();
+}
+
+
+
+/**
+ * @brief Steps a started list sweep to its next point with a bus trigger. Called from the acquisition thread, so like the other setters it
+ *        doesn't wait for the error queue.
+ * 
+ */
+void PSG::nextListPoint() {
+    status = write("*TRG");
+
+    if (status != VI_SUCCESS) {
+        throw std::runtime_error("Failed to trigger PSG list point.");
+    }
+}
+
+
+
+/**
+ * @brief Ends a list sweep and returns to the fixed frequency and power last set with setFreq and setPow.
+ * 
+ */
+void PSG::stopList() {
+    CommandBatch batch(*this);
+    status = write("ABORT");
+    if (status == VI_SUCCESS) {
+        status = writeSetting("FREQ:MODE", "CW");
+    }
+    if (status == VI_SUCCESS) {
+        status = writeSetting("POW:MODE", "FIX");
+    }
+
+    if (status != VI_SUCCESS) {
+        throw std::runtime_error("Failed to stop PSG list sweep.");
+    }
+    batch.commit();
 }
\ No newline at end of file
@@ -0,0 +1,479 @@
+/**
+ * @file acquisitionSource.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the AcquisitionSource base class, the step delivery shared by every digitizer backend.
+ *        See include\instruments\acquisitionSource.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-21
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "decs.hpp"
+
+
+
+/**
+ * @brief Stop hook installed in SynchronizationFlags::wakeAcquisition. Has the source end the step's acquisition wait now instead of at the
+ *        next buffer or timeout (see interruptStep). Does nothing once the step has ended, so a late call can't hit the next step.
+ * 
+ * @param step - step to stop
+ */
+void AcquisitionSource::stopStep(StepDelivery* step) {
+    std::lock_guard<std::mutex> lock(stopMutex);
+    if (step != stoppableStep) {
+        return;
+    }
+
+    interruptStep(step);
+}
+
+
+
+/**
+ * @brief Reads the pause flag set by the decision making. A cancelled step pauses too, since nothing downstream will take its data.
+ * 
+ * @param syncFlags - Struct containing the synchronization flags between threads
+ * @return true - the step should stop acquiring
+ */
+bool AcquisitionSource::pauseRequested(SynchronizationFlags& syncFlags) {
+    if (syncFlags.cancellation.cancelled()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(syncFlags.mutex);
+    return syncFlags.pauseDataCollection;
+}
+
+
+
+/**
+ * @brief Sets the digital downconversion of the delivered buffers. Takes effect at the next step.
+ * 
+ * @warning Only call between steps.
+ * 
+ * @param decimation - raw samples per delivered sample, 1 delivers the raw buffers
+ * @param offsetFrequency - center of the delivered band in MHz, relative to the receiver frequency
+ */
+void AcquisitionSource::setDownConversion(int decimation, double offsetFrequency) {
+    this->decimation = max(decimation, 1);
+    downconversionOffset = offsetFrequency;
+    downConverter.reset();
+}
+
+
+
+/**
+ * @brief Sets the Welch segments of the delivered buffers. Takes effect at the next step. Every buffer but a step's first then delivers
+ *        segmentsPerBuffer spectra, so a step of B buffers gives 1 + (B - 1)*segmentsPerBuffer.
+ * 
+ * @warning Only call between steps.
+ * 
+ * @param window - WELCH_WINDOW_* of the segments
+ * @param segmentsPerBuffer - segments starting in every buffer, 1/(1 - overlap). 1 with a rectangular window delivers the buffers as they are
+ */
+void AcquisitionSource::setWelch(int window, int segmentsPerBuffer) {
+    welchWindow = window;
+    welchSegmentsPerBuffer = max(segmentsPerBuffer, 1);
+    segmenter.reset();
+}
+
+
+
+/**
+ * @brief Prepares a StepDelivery for one step of the pipeline: block size, zero-copy mode and the backup retention limits. Also installs the
+ *        stop hook that lets requestAcquisitionStop end the step early, and opens the step in the recording if one is running.
+ * 
+ * @param step - delivery state to initialize
+ * @param sharedData - Struct containing the shared data between threads
+ * @param syncFlags - Struct containing the synchronization flags between threads
+ */
+void AcquisitionSource::beginStepDelivery(StepDelivery& step, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
+    step = StepDelivery();
+    step.sharedData = &sharedData;
+    step.syncFlags = &syncFlags;
+
+    if (sharedData.dataRings.empty()) {
+        throw std::runtime_error("Error: No FFT data rings. Call initPipelineRings before starting the acquisition\n");
+    }
+
+    // Sample buffers are packed into blocks of spectraPerBlock spectra so the FFT stage can run one batched plan per block
+    step.spectraPerBlock = max(1, sharedData.spectraPerBlock);
+    step.samplesPerSpectrum = samplesPerSpectrum();
+    step.samplesPerBlock = step.spectraPerBlock*step.samplesPerSpectrum;
+
+    // The downconverter follows the acquisition parameters, and starts every step from rest
+    if (decimation > 1) {
+        if (downConverter == nullptr || downConverter->sampleRate() != acquisitionParams.sampleRate || 
+            downConverter->inputSamples() != acquisitionParams.samplesPerBuffer) {
+            downConverter = std::make_unique<DownConverter>(acquisitionParams.sampleRate, acquisitionParams.samplesPerBuffer, decimation, 
+                                                            downconversionOffset*1e6);
+        }
+        downConverter->reset();
+    }
+
+    // So does the segmenter, and the first buffer of a step has no previous buffer to overlap
+    if (welchWindow == WELCH_WINDOW_RECTANGULAR && welchSegmentsPerBuffer == 1) {
+        segmenter.reset();
+    }
+    else {
+        if (segmenter == nullptr || segmenter->samplesPerSegment() != step.samplesPerSpectrum) {
+            segmenter = std::make_unique<WelchSegmenter>(step.samplesPerSpectrum, welchWindow, welchSegmentsPerBuffer);
+        }
+        segmenter->reset();
+    }
+
+    // Zero-copy mode converts each sample buffer directly into a block borrowed from the shared data pool
+    step.zeroCopy = (sharedData.dataPool != nullptr) && (sharedData.dataPool->samplesPerBuffer() == (int)step.samplesPerBlock);
+
+    // Shared backups need pool buffers to reference count, and must leave enough of the pool free for the pipeline
+    {
+        std::lock_guard<std::mutex> lock(sharedData.mutex);
+        if (sharedData.backupPolicy == BACKUP_SHARED) {
+            if (!step.zeroCopy) {
+                sharedData.backupPolicy = BACKUP_COPY;
+            }
+            else if (sharedData.backupDepth <= 0 || sharedData.backupDepth > sharedData.dataPool->capacity()/2) {
+                sharedData.backupDepth = sharedData.dataPool->capacity()/2;
+            }
+        }
+    }
+
+    if (recorder != nullptr) {
+        recorder->beginStep(acquisitionParams, centerFrequency.load());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stoppableStep = &step;
+    }
+    std::lock_guard<std::mutex> lock(syncFlags.mutex);
+    syncFlags.wakeAcquisition = [this, &step]() { stopStep(&step); };
+}
+
+
+
+/**
+ * @brief Starts the step's next block if the previous one was handed off. Blocks (up to the buffer timeout) if downstream stages have every
+ *        block in flight.
+ * 
+ * @param step - delivery state of the current step
+ * @param timeout_ms - maximum time to wait for a free block from the data pool
+ * @return true - the step has a block to fill
+ * @return false - no block was free in time
+ */
+bool AcquisitionSource::acquireStepBlock(StepDelivery& step, DWORD timeout_ms) {
+    if (step.block.data != nullptr) {
+        return true;
+    }
+
+    TraceSpan blockWait("Block wait", TRACE_PIPELINE, step.blocksPushed);
+    if (step.zeroCopy) {
+        step.block.data = step.sharedData->dataPool->acquire(timeout_ms);
+        step.block.pooled = true;
+    }
+    else {
+        step.block.data = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * step.samplesPerBlock));
+    }
+
+    if (step.block.data == nullptr) {
+        printf("Error: No free data buffer after %lu ms\n", timeout_ms);
+        consumerLatency = max(consumerLatency, timeout_ms/1e3);
+        overruns++;
+        step.failed = true;
+        return false;
+    }
+    return true;
+}
+
+
+
+/**
+ * @brief Converts one filled sample buffer into the next slot of the step's current block, starting a new block when needed, and hands the
+ *        block to the FFT stage once it is full or the step has all of its buffers. In Welch mode the buffer is converted into the segmenter
+ *        and every segment ending in it takes a slot instead.
+ * 
+ * @param step - delivery state of the current step
+ * @param samples - filled sample buffer, e.g. a DMA buffer of the board
+ * @param timeout_ms - maximum time to wait for a free block from the data pool
+ * @return true - the buffer was delivered
+ * @return false - no block was free in time because downstream stages fell too far behind, or the FFT stage stopped after an error
+ */
+bool AcquisitionSource::deliverBuffer(StepDelivery& step, const unsigned short* samples, DWORD timeout_ms) {
+    // The source can't reuse this buffer until we return, so the time spent here is what a DMA ring has to absorb
+    auto deliveryStart = std::chrono::steady_clock::now();
+    if (segmenter == nullptr && !acquireStepBlock(step, timeout_ms)) {
+        return false;
+    }
+
+    // Convert straight out of the sample buffer, including the trick to 0-center the dft
+    {
+        TraceSpan conversion("Conversion", TRACE_PIPELINE, step.buffersDelivered);
+        pipeline_complex* slot = (segmenter != nullptr) ? segmenter->input() : step.block.data + (size_t)step.block.numSpectra*step.samplesPerSpectrum;
+        if (decimation > 1) {
+            downConverter->process(samples, acquisitionParams.inputRange, slot);
+        }
+        else {
+            convertSamplesToComplex(samples, slot, acquisitionParams.samplesPerBuffer, acquisitionParams.inputRange);
+        }
+    }
+
+    if (segmenter == nullptr) {
+        step.block.numSpectra++;
+    }
+    else {
+        TraceSpan segmentation("Welch segments", TRACE_PIPELINE, step.buffersDelivered);
+        for (int segment = 0; segment < segmenter->segmentsReady(); segment++) {
+            if (!acquireStepBlock(step, timeout_ms)) {
+                return false;
+            }
+            segmenter->writeSegment(segment, step.block.data + (size_t)step.block.numSpectra*step.samplesPerSpectrum);
+            step.block.numSpectra++;
+            if (step.block.numSpectra == step.spectraPerBlock) {
+                pushStepBlock(step);
+                if (step.failed) {
+                    return false;
+                }
+            }
+        }
+        segmenter->advance();
+    }
+    step.buffersDelivered++;
+
+    // Step a list sweep once a point's last buffer is in. The instrument settles during the first buffers of the next point
+    if (listSweep != nullptr && step.buffersDelivered % listSweep->buffersPerPoint == 0 &&
+        step.buffersDelivered < acquisitionParams.buffersPerAcquisition) {
+        listSweep->advance();
+        listSweep->point++;
+    }
+
+    if (recorder != nullptr) {
+        recorder->writeBuffer(samples);
+    }
+    if (archive != nullptr) {
+        archive->writeRawBuffer(samples, 2*(size_t)acquisitionParams.samplesPerBuffer, archiveStep, centerFrequency.load());
+    }
+
+    // Hand off full blocks, and the last partial block of the step. Welch segments have handed off their full blocks already
+    if (step.block.data != nullptr && step.block.numSpectra > 0 &&
+        (step.block.numSpectra == step.spectraPerBlock || step.buffersDelivered == acquisitionParams.buffersPerAcquisition)) {
+        pushStepBlock(step);
+    }
+
+    // A buffer held past one buffer period has cost the DMA ring a buffer of its slack
+    std::chrono::duration<double> deliveryTime = std::chrono::steady_clock::now() - deliveryStart;
+    consumerLatency = max(consumerLatency, deliveryTime.count());
+    if (deliveryTime.count()*acquisitionParams.sampleRate > acquisitionParams.samplesPerBuffer) {
+        step.lateBuffers++;
+    }
+
+    return !step.failed;
+}
+
+
+
+/**
+ * @brief Hands the step's current (possibly partial) block to the FFT stage, keeping a backup according to the retention policy.
+ * 
+ * @param step - delivery state of the current step
+ */
+void AcquisitionSource::pushStepBlock(StepDelivery& step) {
+    SharedDataBasic& sharedData = *step.sharedData;
+    pipeline_complex* backupBlock = nullptr;
+
+    // Shared backups hold a second reference instead of copying
+    if (sharedData.backupPolicy == BACKUP_COPY) {
+        backupBlock = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * step.samplesPerBlock));
+        std::memcpy(backupBlock, step.block.data, sizeof(pipeline_complex) * step.block.numSpectra * step.samplesPerSpectrum);
+    }
+    else if (sharedData.backupPolicy == BACKUP_SHARED) {
+        sharedData.dataPool->retain(step.block.data);
+        backupBlock = step.block.data;
+    }
+
+    if (backupBlock != nullptr) {
+        std::lock_guard<std::mutex> lock(sharedData.mutex);
+        sharedData.backupDataQueue.push(backupBlock);
+        if (sharedData.backupDepth > 0) {
+            trimBackupQueue(sharedData, sharedData.backupDepth);
+        }
+    }
+
+    // Deal the block to the next FFT worker's ring. The data pool bounds the blocks in flight, so the ring only fills if the worker has stopped
+    step.block.sequence = step.blocksPushed++;
+    step.block.deliveredAt = latencyClock();
+    SPSCRing<DataBlock>& dataRing = *sharedData.dataRings[step.block.sequence % sharedData.dataRings.size()];
+    while (!dataRing.push(step.block, RING_POLL_MS)) {
+        if (step.syncFlags->cancellation.cancelled()) {
+            printf("Error: FFT stage stopped, dropping block %d\n", step.block.sequence);
+            if (step.block.pooled) {
+                sharedData.dataPool->release(step.block.data);
+            }
+            else {
+                pipeline_free(step.block.data);
+            }
+            step.failed = true;
+            break;
+        }
+    }
+
+    step.block = { nullptr, 0, 0 };
+}
+
+
+
+/**
+ * @brief Finishes a step. Hands off whatever was converted before a pause, abort or error so no acquired spectrum is lost, then signals the 
+ *        end of data acquisition and closes every data ring so the FFT workers exit once they have drained them. Records the step's late
+ *        buffers and the overruns since the last step.
+ * 
+ * @param step - delivery state of the current step
+ */
+void AcquisitionSource::endStepDelivery(StepDelivery& step) {
+    // The acquisition has stopped, so a stop request from here on must not interrupt the source
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stoppableStep = nullptr;
+    }
+
+    if (step.block.numSpectra > 0) {
+        pushStepBlock(step);
+    }
+
+    // Signal the end of data acquisition if the decision making didn't stop it, and record how long a decision took to stop it
+    int stopLatency = -1;
+    {
+        std::lock_guard<std::mutex> lock(step.syncFlags->mutex);
+        step.syncFlags->acquisitionComplete = true;
+        step.syncFlags->wakeAcquisition = nullptr;
+        if (step.syncFlags->stopRequested) {
+            stopLatency = (int)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - step.syncFlags->stopRequestTime).count();
+        }
+    }
+    int stepOverruns = overruns.exchange(0);
+    if (step.syncFlags->recordsMetrics) {
+        setMetric(DECISION_STOP_LATENCY, stopLatency);
+        setMetric(LATE_BUFFERS, step.lateBuffers);
+        setMetric(ACQUISITION_OVERRUNS, stepOverruns);
+    }
+
+    for (std::unique_ptr<SPSCRing<DataBlock>>& dataRing : step.sharedData->dataRings) {
+        dataRing->close();
+    }
+
+    if (recorder != nullptr) {
+        recorder->endStep(stopLatency >= 0);
+    }
+}
+
+
+
+/**
+ * @brief Exception path of a source's acquisition thread. Removes the stop hook and raises the error, so the downstream stages stop instead
+ *        of waiting for data that will never arrive.
+ * 
+ * @param syncFlags - Struct containing the synchronization flags between threads
+ * @param e - exception that ended the acquisition
+ */
+void AcquisitionSource::failStepDelivery(SynchronizationFlags& syncFlags, const std::exception& e) {
+    std::cout << "Acquisition thread exiting due to exception." << std::endl;
+    std::cerr << e.what() << '\n';
+
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stoppableStep = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(syncFlags.mutex);
+        syncFlags.wakeAcquisition = nullptr;
+    }
+
+    // Keep what was recorded of the step
+    if (recorder != nullptr) {
+        try {
+            recorder->endStep(false);
+        }
+        catch (const std::exception& recordingError) {
+            std::cerr << recordingError.what() << '\n';
+        }
+    }
+
+    syncFlags.raiseError("AcquisitionThread: " + std::string(e.what()));
+}
+
+
+
+/**
+ * @brief Starts copying every delivered buffer into a raw stream recording at path, one recorded step per acquisition step, until
+ *        stopRecording. The acquisition parameters must stay fixed while recording.
+ * 
+ * @warning Only call between steps.
+ * 
+ * @param path - recording file, overwritten if it exists
+ * @param codec - RECORDING_CODEC_* the buffers are recorded with
+ */
+void AcquisitionSource::startRecording(const std::string& path, int codec) {
+    stopRecording();
+    recorder = std::make_unique<StreamRecorder>(path, acquisitionParams, RECORDING_PREALLOCATE_BYTES, codec);
+    std::cout << "Recording raw buffers to " << path << std::endl;
+}
+
+
+
+/**
+ * @brief Closes the recording, if one is running.
+ * 
+ * @warning Only call between steps.
+ */
+void AcquisitionSource::stopRecording() {
+    recorder.reset();
+}
+
+
+
+/**
+ * @brief Ends the step's wait for its next buffer now. The default ends the pacing wait of sources without a sample clock, which is the
+ *        same for every step. Backends with a sample clock end the board waits of the given step.
+ * 
+ */
+void AcquisitionSource::interruptStep(StepDelivery*) {
+    {
+        std::lock_guard<std::mutex> lock(pacingMutex);
+        interrupted = true;
+    }
+    pacingCondition.notify_all();
+}
+
+
+
+/**
+ * @brief Clears an interruption of the previous step. Call before beginStepDelivery.
+ * 
+ */
+void AcquisitionSource::resetPacing() {
+    std::lock_guard<std::mutex> lock(pacingMutex);
+    interrupted = false;
+}
+
+
+
+/**
+ * @brief Holds buffer bufferIndex of the step until a sample clock running rateFactor times faster than sampleRate would have filled it.
+ * 
+ * @param stepStart - time the step's first buffer started
+ * @param bufferIndex - buffer of the step, from 0
+ * @param rateFactor - speed up over real time. 0 doesn't wait at all
+ * @return true - the buffer is due
+ * @return false - a stop request interrupted the step
+ */
+bool AcquisitionSource::waitForBuffer(std::chrono::steady_clock::time_point stepStart, U32 bufferIndex, double rateFactor) {
+    std::unique_lock<std::mutex> lock(pacingMutex);
+    if (rateFactor <= 0) {
+        return !interrupted;
+    }
+
+    std::chrono::duration<double> bufferPeriod((double)acquisitionParams.samplesPerBuffer/acquisitionParams.sampleRate);
+    auto due = stepStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(bufferPeriod*((bufferIndex + 1)/rateFactor));
+    return !pacingCondition.wait_until(lock, due, [this]() { return interrupted; });
+}
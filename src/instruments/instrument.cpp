@@ -13,7 +13,19 @@
 
 #include "decs.hpp"
 
-Instrument::Instrument() {
+/**
+ * @brief Construct a new Instrument object and open the default VISA resource manager.
+ * 
+ * @param simulated - skip VISA entirely. Commands succeed without being sent and queries report no error, for running without hardware
+ */
+Instrument::Instrument(bool simulated) : simulated(simulated) {
+    if (simulated) {
+        instrumentSession = VI_NULL;
+        defaultRM = VI_NULL;
+        status = VI_SUCCESS;
+        return;
+    }
+
     status = viOpenDefaultRM(&defaultRM);
     if (status != VI_SUCCESS) {
         std::cout << "Failed to initialize VISA." << std::endl;
@@ -22,12 +34,22 @@ Instrument::Instrument() {
 }
 
 Instrument::~Instrument() {
+    stopCommandWorker();
+    if (simulated) {
+        return;
+    }
     viClose(instrumentSession);
     viClose(defaultRM);
     status = VI_NULL;
 }
 
 void Instrument::openConnection(int gpibAddress) {
+    if (simulated) {
+        return;
+    }
+
+    invalidateCache();
+
     std::string deviceAddress = "GPIB0::" + std::to_string(gpibAddress) + "::INSTR";
     status = viOpen(defaultRM, (ViRsrc)deviceAddress.c_str(), VI_NULL, VI_NULL, &instrumentSession);
     if (status != VI_SUCCESS) {
@@ -45,47 +67,50 @@ void Instrument::openConnection(int gpibAddress) {
 }
 
 void Instrument::closeConnection() {
+    if (simulated) {
+        return;
+    }
     viClose(instrumentSession);
     instrumentSession = VI_NULL;
+    invalidateCache();
 }
 
 void Instrument::reset(){
     std::string command = "*RST";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    status = write(command);
+    invalidateCache();
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to reset instrument");
     }
 
-    queryError();
+    checkError();
 }
 
 void Instrument::sendCustomCommand(const std::string& command) {
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    // The command may change any setting behind the cache's back
+    invalidateCache();
+    status = write(command);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to send custom command: " + command);
     }
-    queryError();
+    checkError();
 }
 
 std::string Instrument::sendCustomQuery(std::string query) {
-    query += "\n";
+    std::string response = this->query(query);
+    checkError();
 
-    char idnBuffer[256];
-    status = viQueryf(instrumentSession, const_cast<ViString>(query.c_str()), "%t", idnBuffer);
-    if (status != VI_SUCCESS) {
-        throw std::runtime_error("Failed to send custom query.");
-    }
-    queryError();
-
-    std::string idn(idnBuffer);
-    return idn;
+    return response;
 }
 
 void Instrument::onOff(bool on) {
-    std::string command = on ? "OUTPUT 1" : "OUTPUT 0";
-    status = viPrintf(instrumentSession, "%s\n", command.c_str());
+    std::string value = on ? "1" : "0";
+    if (isCached("OUTPUT", value)) {
+        return;
+    }
+    status = writeSetting("OUTPUT", value);
 
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to set instrument on/off state.");
@@ -93,19 +118,417 @@ void Instrument::onOff(bool on) {
 }
 
 std::string Instrument::queryError() {
+    std::string errorString = readError();
+    if (errorString.substr(0, 2) != "+0") {
+        // There is no telling which setting the instrument rejected
+        invalidateCache();
+        throw std::runtime_error("Instrument reported an error: " + errorString);
+    }
+
+    return errorString;
+}
+
+
+
+/**
+ * @brief Checks the error queue after a command, unless a batch is open. A batch checks the queue once when it ends instead.
+ * 
+ */
+void Instrument::checkError() {
+    if (batchDepth > 0) {
+        return;
+    }
+    queryError();
+}
+
+
+
+/**
+ * @brief Reads the oldest entry of the instrument's error queue, "+0,..." once it is empty.
+ * 
+ * @return std::string - SYST:ERR? response
+ */
+std::string Instrument::readError() {
+    if (simulated) {
+        return "+0,\"No error\"";
+    }
+
     const int bufferSize = 256;
     char errorBuffer[bufferSize] = {0};
     ViUInt32 retCount = 0;
+    TraceSpan span("Instrument error query", TRACE_INSTRUMENT);
 
     status = viQueryf(instrumentSession, "SYST:ERR?\n", "%t", errorBuffer, bufferSize, &retCount);
     if (status != VI_SUCCESS) {
         throw std::runtime_error("Failed to query instrument error.");
     }
 
-    std::string errorString(errorBuffer);
-    if (errorString.substr(0, 2) != "+0") {
-        throw std::runtime_error("Instrument reported an error: " + errorString);
+    return std::string(errorBuffer);
+}
+
+
+
+/**
+ * @brief Sends a query and returns the response, without checking the error queue. Commands still held by a batch are sent first so the
+ *        response reflects them.
+ * 
+ * @param query - query without the terminating newline
+ * @return std::string - response of the instrument, empty for a simulated instrument
+ */
+std::string Instrument::query(std::string query) {
+    if (flushBatch() != VI_SUCCESS) {
+        throw std::runtime_error("Failed to send batched commands ahead of query: " + query);
+    }
+    if (simulated) {
+        return "";
     }
+    query += "\n";
+    TraceSpan span("Instrument query", TRACE_INSTRUMENT);
 
-    return errorString;
-}
\ No newline at end of file
+    char responseBuffer[256];
+    status = viQueryf(instrumentSession, const_cast<ViString>(query.c_str()), "%t", responseBuffer);
+    if (status != VI_SUCCESS) {
+        throw std::runtime_error("Failed to send custom query.");
+    }
+
+    return std::string(responseBuffer);
+}
+
+
+
+/**
+ * @brief Starts a command batch. Until the matching endBatch, commands are joined into compound SCPI lines of up to INSTRUMENT_BATCH_BYTES
+ *        and sent together, and the commands that normally check the error queue after every write skip the check, so a batch of n
+ *        commands costs one write and one error query instead of n of each. Batches nest, only the outermost endBatch sends and checks.
+ *        A VISA failure or instrument error can then only be traced to the batch, not the command, so strict per command checking stays
+ *        the default outside batches. See CommandBatch for the scoped form.
+ * 
+ * @param syncCompletion - wait for the instrument to finish the batch with *OPC? before checking its error queue
+ */
+void Instrument::beginBatch(bool syncCompletion) {
+    if (batchDepth == 0) {
+        batchSync = false;
+        batchedCount = 0;
+    }
+    batchSync = batchSync || syncCompletion;
+    batchDepth++;
+}
+
+
+
+/**
+ * @brief Ends a command batch. The outermost endBatch sends the commands still held, waits for *OPC? if any level of the batch asked for
+ *        it, and reads the error queue until it is empty.
+ * 
+ * @return std::string - *OPC? response when synchronized, otherwise empty
+ */
+std::string Instrument::endBatch() {
+    if (batchDepth == 0) {
+        throw std::runtime_error("Error: endBatch called without beginBatch\n");
+    }
+    if (--batchDepth > 0) {
+        return "";
+    }
+
+    int commands = batchedCount;
+    if (flushBatch() != VI_SUCCESS) {
+        throw std::runtime_error("Failed to send a batch of " + std::to_string(commands) + " commands.");
+    }
+
+    std::string response = batchSync ? query("*OPC?") : "";
+
+    std::string errors;
+    for (int n = 0; n < INSTRUMENT_ERROR_QUEUE_DEPTH; n++) {
+        std::string errorString = readError();
+        if (errorString.substr(0, 2) == "+0") {
+            break;
+        }
+        errors += (errors.empty() ? "" : "; ") + errorString;
+    }
+    if (!errors.empty()) {
+        invalidateCache();
+        throw std::runtime_error("Instrument reported errors in a batch of " + std::to_string(commands) + " commands: " + errors);
+    }
+
+    return response;
+}
+
+
+
+/**
+ * @brief Whether the setting was last written with this value, in which case writing it again would change nothing.
+ * 
+ * @param header - SCPI header of the setting, e.g. "FREQ"
+ * @param value - argument the setting would be written with
+ */
+bool Instrument::isCached(const std::string& header, const std::string& value) const {
+    auto setting = settings.find(header);
+    return setting != settings.end() && setting->second == value;
+}
+
+
+
+/**
+ * @brief Writes "header value" and records value as the setting's state. Setters check isCached first and skip writes that would change
+ *        nothing. A failed write forgets the setting. The cache is cleared whenever the instrument state may have changed without it:
+ *        connecting, *RST, custom commands, an abandoned batch or a reported error.
+ * 
+ * @param header - SCPI header of the setting, e.g. "FREQ"
+ * @param value - argument to write, compared as text so it should be formatted the same way every time
+ * @return ViStatus - status of write
+ */
+ViStatus Instrument::writeSetting(const std::string& header, const std::string& value) {
+    ViStatus written = write(header + " " + value);
+    if (written == VI_SUCCESS) {
+        settings[header] = value;
+    }
+    else {
+        settings.erase(header);
+    }
+    return written;
+}
+
+
+
+/**
+ * @brief Sends header followed by data as an IEEE 488.2 definite length binary block, "#<digits><length><bytes>", without formatting
+ *        the data. Large blocks go out in writes of INSTRUMENT_BLOCK_CHUNK_BYTES, with END only asserted by the terminating newline, so
+ *        the instrument receives one message. Commands held by a batch are sent first, the block itself is never held.
+ * 
+ * @param header - command the block is the last argument of, e.g. "DATA:ARB:DAC name,"
+ * @param data - bytes of the block
+ * @param bytes - length of the block, below 10^9
+ * @return ViStatus - status of the first write that failed, VI_SUCCESS otherwise
+ */
+ViStatus Instrument::writeBlock(const std::string& header, const void* data, size_t bytes) {
+    ViStatus written = flushBatch();
+    if (written != VI_SUCCESS || simulated) {
+        return written;
+    }
+
+    std::string length = std::to_string(bytes);
+    if (length.size() > 9) {
+        throw std::runtime_error("Error: Binary block of " + length + " bytes is too long for a definite length header\n");
+    }
+    std::string prefix = header + " #" + std::to_string(length.size()) + length;
+    TraceSpan span("Instrument block write", TRACE_INSTRUMENT, (int64_t)bytes);
+
+    ViUInt32 count = 0;
+    sentLines++;
+    written = viSetAttribute(instrumentSession, VI_ATTR_SEND_END_EN, VI_FALSE);
+    if (written == VI_SUCCESS) {
+        written = viWrite(instrumentSession, (ViBuf)prefix.data(), (ViUInt32)prefix.size(), &count);
+    }
+
+    const ViByte* block = static_cast<const ViByte*>(data);
+    for (size_t sent = 0; written == VI_SUCCESS && sent < bytes;) {
+        size_t chunk = min(bytes - sent, INSTRUMENT_BLOCK_CHUNK_BYTES);
+        written = viWrite(instrumentSession, (ViBuf)(block + sent), (ViUInt32)chunk, &count);
+        sent += chunk;
+    }
+
+    // Restored even after a failed write, every other command relies on END
+    ViStatus restored = viSetAttribute(instrumentSession, VI_ATTR_SEND_END_EN, VI_TRUE);
+    if (written == VI_SUCCESS) {
+        written = (restored == VI_SUCCESS) ? viWrite(instrumentSession, (ViBuf)"\n", 1, &count) : restored;
+    }
+    return written;
+}
+
+
+
+/**
+ * @brief Leaves every level of the current batch without sending the commands it still holds or checking the error queue.
+ * 
+ */
+void Instrument::abortBatch() {
+    // Dropped commands were already recorded as written
+    invalidateCache();
+    batchDepth = 0;
+    batchSync = false;
+    batchedCommands.clear();
+    batchedCount = 0;
+}
+
+
+
+/**
+ * @brief Sends the commands held by the batch as one compound line.
+ * 
+ * @return ViStatus - status of the write, VI_SUCCESS if nothing was held
+ */
+ViStatus Instrument::flushBatch() {
+    if (batchedCommands.empty()) {
+        return VI_SUCCESS;
+    }
+
+    ViStatus flushed = send(batchedCommands);
+    batchedCommands.clear();
+    return flushed;
+}
+
+/**
+ * @brief Sends one command to the instrument, or adds it to the open batch. Batched commands are joined with ";:" so every command starts
+ *        from the root of the SCPI tree, and the held line is sent first when the command would take it past INSTRUMENT_BATCH_BYTES.
+ * 
+ * @param command - command without the terminating newline
+ * @return ViStatus - status of viPrintf, or of sending the held line when batching
+ */
+ViStatus Instrument::write(const std::string& command) {
+    if (batchDepth == 0) {
+        return send(command);
+    }
+
+    if (!batchedCommands.empty() && batchedCommands.size() + command.size() + 2 > INSTRUMENT_BATCH_BYTES) {
+        ViStatus flushed = flushBatch();
+        if (flushed != VI_SUCCESS) {
+            return flushed;
+        }
+    }
+
+    if (!batchedCommands.empty()) {
+        // Common commands and commands with their own leading colon don't need the root prefix
+        batchedCommands += (command[0] == '*' || command[0] == ':') ? ";" : ";:";
+    }
+    batchedCommands += command;
+    batchedCount++;
+    return VI_SUCCESS;
+}
+
+
+
+/**
+ * @brief Sends one command line to the instrument. Always succeeds for a simulated instrument.
+ * 
+ * @param command - command line without the terminating newline
+ * @return ViStatus - status of viPrintf
+ */
+ViStatus Instrument::send(const std::string& command) {
+    if (simulated) {
+        return VI_SUCCESS;
+    }
+    TraceSpan span("Instrument write", TRACE_INSTRUMENT);
+    sentLines++;
+    return viPrintf(instrumentSession, "%s\n", command.c_str());
+}
+
+
+
+/**
+ * @brief Queues a command for the instrument's I/O thread, so the caller can go on while it is written and the instrument settles. The
+ *        commands run in the order they were submitted, and the future is ready once the command returned and, if it sent anything, the
+ *        settle time has passed. An exception from the command is rethrown by the future's get(). The instrument must not be used directly
+ *        from another thread until waitForCommands or the futures say the queue is done.
+ * 
+ * @param command - command to run, e.g. a setter of the derived instrument
+ * @param settleSeconds - time the instrument needs after the command before its output is in spec
+ * @return std::future<void> - ready once the command has run and settled
+ */
+std::future<void> Instrument::submit(std::function<void()> command, double settleSeconds) {
+    std::packaged_task<void()> task([this, command, settleSeconds]() {
+        uint64_t sentBefore = sentLines;
+        command();
+        if (settleSeconds > 0 && sentLines != sentBefore) {
+            TraceSpan span("Instrument settle", TRACE_INSTRUMENT);
+            std::this_thread::sleep_for(std::chrono::duration<double>(settleSeconds));
+        }
+    });
+    std::future<void> done = task.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        if (ioStopping) {
+            throw std::runtime_error("Error: Command submitted to an instrument that is shutting down\n");
+        }
+        ioQueue.push_back(std::move(task));
+        if (!ioWorker.joinable()) {
+            ioWorker = std::thread(&Instrument::commandWorker, this);
+        }
+    }
+    ioCondition.notify_all();
+    return done;
+}
+
+
+
+/**
+ * @brief Waits until every submitted command has run and settled, after which the instrument can be used directly again.
+ * 
+ */
+void Instrument::waitForCommands() {
+    std::unique_lock<std::mutex> lock(ioMutex);
+    ioCondition.wait(lock, [this]() { return ioQueue.empty() && ioRunning == 0; });
+}
+
+
+
+/**
+ * @brief Runs the commands still queued and stops the I/O thread. Derived instruments call it before closing their connection.
+ * 
+ */
+void Instrument::stopCommandWorker() {
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        ioStopping = true;
+    }
+    ioCondition.notify_all();
+    if (ioWorker.joinable()) {
+        ioWorker.join();
+    }
+}
+
+
+
+// Runs the submitted commands one at a time until stopCommandWorker, finishing the queue first
+void Instrument::commandWorker() {
+    setTraceThreadName("Instrument I/O");
+
+    std::unique_lock<std::mutex> lock(ioMutex);
+    while (true) {
+        ioCondition.wait(lock, [this]() { return ioStopping || !ioQueue.empty(); });
+        if (ioQueue.empty()) {
+            return;
+        }
+
+        std::packaged_task<void()> task = std::move(ioQueue.front());
+        ioQueue.pop_front();
+        ioRunning++;
+        lock.unlock();
+        task();
+        lock.lock();
+        ioRunning--;
+        ioCondition.notify_all();
+    }
+}
+
+
+
+/**
+ * @brief Opens a batch on the instrument for the lifetime of this object, see Instrument::beginBatch.
+ * 
+ * @param instrument - instrument to batch the commands of
+ * @param syncCompletion - wait for *OPC? in commit() before checking the error queue
+ */
+CommandBatch::CommandBatch(Instrument& instrument, bool syncCompletion) : instrument(instrument), open(true) {
+    instrument.beginBatch(syncCompletion);
+}
+
+
+
+CommandBatch::~CommandBatch() {
+    if (open) {
+        instrument.abortBatch();
+    }
+}
+
+
+
+/**
+ * @brief Sends the batch and checks the error queue once, throwing on any VISA failure or instrument error like the unbatched commands.
+ * 
+ * @return std::string - *OPC? response when synchronized, otherwise empty
+ */
+std::string CommandBatch::commit() {
+    open = false;
+    return instrument.endBatch();
+}
@@ -0,0 +1,474 @@
+/**
+ * @file replayDigitizer.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the ReplayDigitizer class. See include\instruments\replayDigitizer.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Construct a new ReplayDigitizer object. Maps the recording and indexes its steps.
+ *
+ * @param path - recording written by StreamRecorder
+ * @param rateFactor - playback speed over the recorded sample rate. 0 delivers as fast as possible
+ */
+ReplayDigitizer::ReplayDigitizer(const std::string& path, double rateFactor) : rateFactor(rateFactor), path(path) {
+    mapRecording();
+    try {
+        indexSteps();
+    }
+    catch (const std::exception& e) {
+        unmapRecording();
+        throw;
+    }
+
+    std::cout << "Replaying " << std::to_string(steps.size()) << " recorded steps from " << path << std::endl;
+}
+
+
+
+ReplayDigitizer::~ReplayDigitizer() {
+    stopUnpacking();
+    unmapRecording();
+}
+
+
+
+/**
+ * @brief Maps the whole recording read-only. Pages are read from disk as the replay touches them.
+ *
+ */
+void ReplayDigitizer::mapRecording() {
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Error: Unable to open recording " + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart < (LONGLONG)sizeof(RecordingHeader)) {
+        unmapRecording();
+        throw std::runtime_error("Error: Recording " + path + " is too short to hold a header\n");
+    }
+    fileSize = (size_t)size.QuadPart;
+
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle != NULL) {
+        view = reinterpret_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (view == nullptr) {
+        unmapRecording();
+        throw std::runtime_error("Error: Unable to map recording " + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+}
+
+
+
+void ReplayDigitizer::unmapRecording() {
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mappingHandle != NULL) {
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+}
+
+
+
+/**
+ * @brief Checks the recording header and walks the step headers. A recording that was never closed (see StreamRecorder) ends in zeros and
+ *        its steps may still be open, each open step keeps the buffers up to the next step's header, or up to the zeros if it is the last.
+ *        A step that a crash cut short keeps the complete buffers that made it to disk and ends the recording. The buffers of a packed
+ *        recording are indexed on the way.
+ *
+ */
+void ReplayDigitizer::indexSteps() {
+    std::memcpy(&header, view, sizeof(header));
+    if (std::strncmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0 ||
+        (header.version != RECORDING_VERSION && header.version != RECORDING_PACKED_VERSION)) {
+        throw std::runtime_error("Error: " + path + " is not a version " + std::to_string(RECORDING_VERSION) + " or "
+                                 + std::to_string(RECORDING_PACKED_VERSION) + " stream recording\n");
+    }
+    bytesPerBuffer = 2 * (size_t)header.samplesPerBuffer * header.bytesPerSample;
+    packed = (header.version == RECORDING_PACKED_VERSION);
+    if (packed && header.bytesPerSample != 2) {
+        throw std::runtime_error("Error: Packed recording " + path + " does not hold 16 bit codes\n");
+    }
+
+    size_t openSteps = 0;
+    size_t offset = sizeof(RecordingHeader);
+    while (offset + sizeof(RecordedStepHeader) <= fileSize) {
+        Step step;
+        std::memcpy(&step.header, view + offset, sizeof(RecordedStepHeader));
+        if (step.header.magic == 0) {
+            break; // Preallocated tail of a recording that was never closed
+        }
+        if (step.header.magic != RECORDED_STEP_MAGIC) {
+            throw std::runtime_error("Error: Corrupt step header " + std::to_string(steps.size()) + " in recording " + path + "\n");
+        }
+        offset += sizeof(RecordedStepHeader);
+
+        size_t available = (fileSize - offset)/bytesPerBuffer;
+        bool complete;
+        size_t stepEnd = 0;
+        if (packed) {
+            stepEnd = indexPackedStep(offset, step, complete);
+            openSteps += (step.header.numBuffers == RECORDED_STEP_OPEN);
+        }
+        else if (step.header.numBuffers == RECORDED_STEP_OPEN) {
+            step.numBuffers = recoverOpenStep(offset, step.header.stepIndex, available, complete);
+            openSteps++;
+        }
+        else {
+            complete = (step.header.numBuffers <= available);
+            step.numBuffers = complete ? step.header.numBuffers : (U32)available;
+        }
+        step.buffers = packed ? nullptr : reinterpret_cast<const unsigned short*>(view + offset);
+        steps.push_back(step);
+
+        if (!complete) {
+            std::cout << "Warning: Step " << std::to_string(step.header.stepIndex) << " of " << path << " was cut short after "
+                      << std::to_string(step.numBuffers) << " buffers." << std::endl;
+            break;
+        }
+        offset = packed ? stepEnd : offset + (size_t)step.numBuffers*bytesPerBuffer;
+    }
+
+    if (openSteps > 0) {
+        std::cout << "Warning: " << path << " was never closed, recovered " << std::to_string(openSteps) << " open steps." << std::endl;
+    }
+}
+
+
+
+/**
+ * @brief Counts the buffers of a step whose header was never patched, by looking for the next step's header at every buffer boundary.
+ *
+ * @param offset - offset of the step's first buffer in the mapping
+ * @param stepIndex - index of the open step
+ * @param available - complete buffers between offset and the end of the recording
+ * @param followed - set if the next step's header was found, so the step is complete
+ * @return U32 - buffers of the step
+ */
+U32 ReplayDigitizer::recoverOpenStep(size_t offset, U32 stepIndex, size_t available, bool& followed) const {
+    followed = false;
+    for (size_t i = 0; i <= available; i++) {
+        const char* buffer = view + offset + i*bytesPerBuffer;
+
+        RecordedStepHeader next;
+        if (offset + i*bytesPerBuffer + sizeof(next) <= fileSize) {
+            std::memcpy(&next, buffer, sizeof(next));
+            if (next.magic == RECORDED_STEP_MAGIC && next.stepIndex == stepIndex + 1) {
+                followed = true;
+                return (U32)i;
+            }
+        }
+        if (i == available) {
+            break;
+        }
+
+        // The recording stopped here, the rest of the file is the zeroed preallocation
+        if (std::all_of(buffer, buffer + bytesPerBuffer, [](char byte) { return byte == 0; })) {
+            return (U32)i;
+        }
+    }
+    return (U32)available;
+}
+
+
+
+/**
+ * @brief Indexes the buffers of a step of a packed recording by walking their headers. A step whose header was never patched ends at the
+ *        first offset that doesn't hold its next buffer.
+ *
+ * @param offset - offset of the step's first buffer header in the mapping
+ * @param step - step to index, its header already read
+ * @param complete - set if the step has all of its buffers, or for an open step if the next step's header follows it
+ * @return size_t - offset past the step's last complete buffer
+ */
+size_t ReplayDigitizer::indexPackedStep(size_t offset, Step& step, bool& complete) const {
+    bool open = (step.header.numBuffers == RECORDED_STEP_OPEN);
+    while (offset + sizeof(PackedBufferHeader) <= fileSize && (open || step.packedBuffers.size() < step.header.numBuffers)) {
+        PackedBufferHeader bufferHeader;
+        std::memcpy(&bufferHeader, view + offset, sizeof(bufferHeader));
+        if (bufferHeader.magic != RECORDED_BUFFER_MAGIC || bufferHeader.bufferIndex != step.packedBuffers.size() ||
+            offset + sizeof(bufferHeader) + bufferHeader.payloadBytes > fileSize) {
+            break;
+        }
+        step.packedBuffers.push_back(view + offset);
+        offset += sizeof(bufferHeader) + bufferHeader.payloadBytes;
+    }
+    step.numBuffers = (U32)step.packedBuffers.size();
+
+    if (!open) {
+        complete = (step.numBuffers == step.header.numBuffers);
+        return offset;
+    }
+    RecordedStepHeader next;
+    complete = false;
+    if (offset + sizeof(next) <= fileSize) {
+        std::memcpy(&next, view + offset, sizeof(next));
+        complete = (next.magic == RECORDED_STEP_MAGIC && next.stepIndex == step.header.stepIndex + 1);
+    }
+    return offset;
+}
+
+
+
+/**
+ * @brief Copies, or unpacks, a buffer of a recorded step. Any buffer can be read on its own, from any thread.
+ *
+ * @param step - recorded step, from 0
+ * @param buffer - buffer of the step
+ * @param samples - set to samplesPerBuffer channel A codes followed by samplesPerBuffer channel B codes
+ */
+void ReplayDigitizer::readBuffer(size_t step, U32 buffer, unsigned short* samples) const {
+    const Step& recordedStep = steps.at(step);
+    if (buffer >= recordedStep.numBuffers) {
+        throw std::runtime_error("Error: Step " + std::to_string(step) + " of " + path + " has no buffer " + std::to_string(buffer) + "\n");
+    }
+
+    if (!packed) {
+        std::memcpy(samples, recordedStep.buffers + (size_t)buffer*bytesPerBuffer/sizeof(unsigned short), bytesPerBuffer);
+        return;
+    }
+    const char* record = recordedStep.packedBuffers[buffer];
+    PackedBufferHeader bufferHeader;
+    std::memcpy(&bufferHeader, record, sizeof(bufferHeader));
+    unpackRecordedBuffer(record + sizeof(bufferHeader), bufferHeader.payloadBytes, header.samplesPerBuffer, samples);
+}
+
+
+
+/**
+ * @brief Takes the acquisition parameters from the recording. The requested sample rate and buffer size must match the recorded ones, since
+ *        the FFT plans and processing are sized from them.
+ *
+ * @param sampleRate - requested sample rate in Hz
+ * @param samplesPerAcquisition - desired number of samples over the full acquisition
+ * @param buffersPerAcquisition - desired number of buffers to split the acquisition into. If 0, the recorded buffer size is used
+ * @param inputRange - ignored, the codes are converted with the recorded range
+ * @param inputImpedance - recorded only
+ * @param bufferCount - recorded only, there are no DMA buffers
+ */
+void ReplayDigitizer::setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition, double inputRange,
+                                               double inputImpedance, U32 bufferCount){
+    if (buffersPerAcquisition <= 0) {
+        buffersPerAcquisition = max((U32)1, samplesPerAcquisition/header.samplesPerBuffer);
+    }
+
+    if (sampleRate != header.sampleRate || samplesPerAcquisition/buffersPerAcquisition != header.samplesPerBuffer) {
+        throw std::runtime_error("Error: " + path + " was recorded at " + std::to_string(header.sampleRate) + " Hz with "
+                                 + std::to_string(header.samplesPerBuffer) + " samples per buffer, requested " + std::to_string(sampleRate)
+                                 + " Hz with " + std::to_string(samplesPerAcquisition/buffersPerAcquisition) + "\n");
+    }
+    if (inputRange != header.inputRange) {
+        std::cout << "Warning: Using the recorded input range of " << std::to_string(header.inputRange) << " V." << std::endl;
+    }
+
+    acquisitionParams.sampleRate = header.sampleRate;
+    acquisitionParams.buffersPerAcquisition = buffersPerAcquisition;
+    acquisitionParams.inputRange = header.inputRange;
+    acquisitionParams.inputImpedance = inputImpedance;
+    acquisitionParams.recordsPerAcquisition = buffersPerAcquisition;
+
+    acquisitionParams.samplesPerBuffer = header.samplesPerBuffer;
+    acquisitionParams.bytesPerSample = header.bytesPerSample;
+    acquisitionParams.bytesPerBuffer = (U32)bytesPerBuffer;
+    acquisitionParams.samplesPerAcquisition = acquisitionParams.samplesPerBuffer*acquisitionParams.buffersPerAcquisition;
+
+    acquisitionParams.adaptiveBufferCount = false;
+    acquisitionParams.bufferCount = max(bufferCount, (U32)2);
+}
+
+
+
+/**
+ * @brief Delivers the next recorded step to the pipeline until its buffers run out, the fixed horizon is hit or the pauseDataCollection flag
+ *        is set.
+ *
+ * @param sharedData - Struct containing the shared data between threads. This function will push to dataRings and close them at the end
+ * @param syncFlags - Struct containing the synchronization flags between threads. This function will read the pauseDataCollection flag
+ */
+void ReplayDigitizer::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
+    try {
+    if (nextStep >= steps.size()) {
+        throw std::runtime_error("Error: " + path + " has no step " + std::to_string(nextStep) + "\n");
+    }
+    const Step& recordedStep = steps[nextStep++];
+
+    // Decisions are made on the frequencies ScanRunner thinks it is at, so replay the scan it was recorded with
+    if (std::abs(recordedStep.header.centerFrequency - centerFrequency.load()) > 1e-6) {
+        std::cout << "Warning: Replaying step recorded at " << std::to_string(recordedStep.header.centerFrequency) << " MHz at "
+                  << std::to_string(centerFrequency.load()) << " MHz." << std::endl;
+    }
+
+    resetPacing();
+
+    StepDelivery step;
+    beginStepDelivery(step, sharedData, syncFlags);
+
+    DWORD timeout_ms = (DWORD)FREE_RUN_TIMEOUT_MS;
+    if (rateFactor > 0) {
+        timeout_ms = (DWORD)(10*1e3*acquisitionParams.samplesPerBuffer/acquisitionParams.sampleRate);
+    }
+
+    startTimer(TIMER_ACQUISITION);
+    auto stepStart = std::chrono::steady_clock::now();
+
+    U32 buffersCompleted = 0;
+    U32 numBuffers = min(recordedStep.numBuffers, acquisitionParams.buffersPerAcquisition);
+    if (packed) {
+        startUnpacking(recordedStep, numBuffers);
+    }
+    for (; buffersCompleted < numBuffers; buffersCompleted++) {
+        if (pauseRequested(syncFlags) || !waitForBuffer(stepStart, buffersCompleted, rateFactor)) {
+            std::cout << "Received pause signal" << std::endl;
+            break;
+        }
+
+        const unsigned short* samples = packed ? unpackedBuffer(buffersCompleted)
+                                               : recordedStep.buffers + (size_t)buffersCompleted*bytesPerBuffer/sizeof(unsigned short);
+        bool delivered = deliverBuffer(step, samples, timeout_ms);
+        if (packed) {
+            releaseBuffer(buffersCompleted);
+        }
+        if (!delivered) {
+            break;
+        }
+    }
+    stopUnpacking();
+
+    stopTimer(TIMER_ACQUISITION);
+
+    if (buffersCompleted == recordedStep.numBuffers && buffersCompleted < acquisitionParams.buffersPerAcquisition) {
+        std::cout << "Recorded step " << std::to_string(recordedStep.header.stepIndex) << " ran out after " << std::to_string(buffersCompleted)
+                  << " buffers." << std::endl;
+    }
+
+    endStepDelivery(step);
+
+    }
+    catch(const std::exception& e)
+    {
+        stopUnpacking();
+        failStepDelivery(syncFlags, e);
+    }
+}
+
+
+
+/**
+ * @brief Starts the threads unpacking the first numBuffers buffers of a packed step ahead of delivery.
+ *
+ * @param step - step about to be replayed
+ * @param numBuffers - buffers that will be delivered
+ */
+void ReplayDigitizer::startUnpacking(const Step& step, U32 numBuffers) {
+    stopUnpacking();
+
+    unpacked.resize(REPLAY_DECODE_AHEAD);
+    for (std::vector<unsigned short>& slot : unpacked) {
+        slot.resize(bytesPerBuffer/sizeof(unsigned short));
+    }
+    unpackedReady.assign(REPLAY_DECODE_AHEAD, false);
+    unpackStep = &step;
+    unpackEnd = numBuffers;
+    nextUnpack = 0;
+    buffersReleased = 0;
+    unpackStopping = false;
+    unpackFailure.clear();
+
+    int numThreads = (int)min((U32)REPLAY_DECODE_THREADS, numBuffers);
+    for (int i = 0; i < numThreads; i++) {
+        unpackThreads.emplace_back(&ReplayDigitizer::unpackLoop, this);
+    }
+}
+
+
+
+// Unpacking thread. Takes the next buffer whose slot is free until the step's buffers are taken or stopUnpacking is called
+void ReplayDigitizer::unpackLoop() {
+    size_t stepIndex = (size_t)(unpackStep - steps.data());
+    while (true) {
+        U32 buffer;
+        {
+            std::unique_lock<std::mutex> lock(unpackMutex);
+            unpackCondition.wait(lock, [this]() { return unpackStopping || nextUnpack >= unpackEnd || nextUnpack < buffersReleased + REPLAY_DECODE_AHEAD; });
+            if (unpackStopping || nextUnpack >= unpackEnd) {
+                return;
+            }
+            buffer = nextUnpack++;
+        }
+
+        try {
+            readBuffer(stepIndex, buffer, unpacked[buffer % REPLAY_DECODE_AHEAD].data());
+        }
+        catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(unpackMutex);
+            if (unpackFailure.empty()) {
+                unpackFailure = e.what();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(unpackMutex);
+            unpackedReady[buffer % REPLAY_DECODE_AHEAD] = true;
+        }
+        unpackCondition.notify_all();
+    }
+}
+
+
+
+/**
+ * @brief Waits for a buffer of the step being replayed to be unpacked. Raises an error of the unpacking threads.
+ *
+ * @param buffer - next buffer to deliver
+ * @return const unsigned short* - the unpacked buffer, valid until releaseBuffer
+ */
+const unsigned short* ReplayDigitizer::unpackedBuffer(U32 buffer) {
+    std::unique_lock<std::mutex> lock(unpackMutex);
+    unpackCondition.wait(lock, [this, buffer]() { return unpackedReady[buffer % REPLAY_DECODE_AHEAD]; });
+    if (!unpackFailure.empty()) {
+        throw std::runtime_error(unpackFailure);
+    }
+    return unpacked[buffer % REPLAY_DECODE_AHEAD].data();
+}
+
+
+
+// Frees the slot of a delivered buffer for the buffer REPLAY_DECODE_AHEAD later
+void ReplayDigitizer::releaseBuffer(U32 buffer) {
+    {
+        std::lock_guard<std::mutex> lock(unpackMutex);
+        unpackedReady[buffer % REPLAY_DECODE_AHEAD] = false;
+        buffersReleased = buffer + 1;
+    }
+    unpackCondition.notify_all();
+}
+
+
+
+void ReplayDigitizer::stopUnpacking() {
+    {
+        std::lock_guard<std::mutex> lock(unpackMutex);
+        unpackStopping = true;
+    }
+    unpackCondition.notify_all();
+    for (std::thread& thread : unpackThreads) {
+        thread.join();
+    }
+    unpackThreads.clear();
+}
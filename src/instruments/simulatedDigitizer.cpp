@@ -0,0 +1,233 @@
+/**
+ * @file simulatedDigitizer.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the SimulatedDigitizer class. See include\instruments\simulatedDigitizer.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note Intended for benchmarking the pipeline. The noise is an Irwin-Hall approximation of a Gaussian (cut off at 3.5 sigma), which is cheap
+ *       enough to synthesize faster than real time.
+ *
+ */
+
+#include "decs.hpp"
+
+#define TONE_CHUNK (256) // Samples between exact recomputations of each tone's phasor, and between steps of its phase random walk
+
+
+
+/**
+ * @brief Construct a new SimulatedDigitizer object.
+ *
+ * @param simulationParams - signal model and delivery rate
+ */
+SimulatedDigitizer::SimulatedDigitizer(SimulationParameters simulationParams) : simulationParams(simulationParams) {
+    randomState = simulationParams.seed ? simulationParams.seed : 1;
+}
+
+
+
+/**
+ * @brief Sets the acquisition parameters as the ATS9462 would, for 16-bit samples on two channels. Nothing is sent anywhere.
+ *
+ * @param sampleRate - sample rate in Hz
+ * @param samplesPerAcquisition - desired number of samples over the full acquisition
+ * @param buffersPerAcquisition - desired number of buffers to split the acquisition into. If 0, buffers of about 2MB are used
+ * @param inputRange - full scale voltage range the samples are coded with
+ * @param inputImpedance - recorded only
+ * @param bufferCount - recorded only, there are no DMA buffers
+ */
+void SimulatedDigitizer::setAcquisitionParameters(U32 sampleRate, U32 samplesPerAcquisition, U32 buffersPerAcquisition, double inputRange,
+                                                  double inputImpedance, U32 bufferCount){
+    int channelCount = 2;
+
+    if (buffersPerAcquisition <= 0) {
+        buffersPerAcquisition = max((U32)1, (U32)std::round(2.0 * samplesPerAcquisition * channelCount / 2e6));
+        while (samplesPerAcquisition % buffersPerAcquisition != 0) {
+            buffersPerAcquisition--;
+        }
+    }
+
+    acquisitionParams.sampleRate = sampleRate;
+    acquisitionParams.buffersPerAcquisition = buffersPerAcquisition;
+    acquisitionParams.inputRange = inputRange;
+    acquisitionParams.inputImpedance = inputImpedance;
+    acquisitionParams.recordsPerAcquisition = buffersPerAcquisition;
+
+    acquisitionParams.samplesPerBuffer = samplesPerAcquisition/buffersPerAcquisition;
+    acquisitionParams.bytesPerSample = 2;
+    acquisitionParams.bytesPerBuffer = acquisitionParams.bytesPerSample * acquisitionParams.samplesPerBuffer * channelCount;
+    acquisitionParams.samplesPerAcquisition = acquisitionParams.samplesPerBuffer*acquisitionParams.buffersPerAcquisition;
+
+    acquisitionParams.adaptiveBufferCount = false;
+    acquisitionParams.bufferCount = max(bufferCount, (U32)2);
+
+    std::cout << "Simulated digitizer generating " << std::to_string(acquisitionParams.buffersPerAcquisition) << " buffers per acquisition at "
+              << (simulationParams.rateFactor > 0 ? std::to_string(simulationParams.rateFactor) + "x real time." : "full speed.") << std::endl;
+}
+
+
+
+/**
+ * @brief Generates one step of buffersPerAcquisition buffers and delivers them to the pipeline, paced to rateFactor times the real-time rate,
+ *        until the fixed horizon is hit or the pauseDataCollection flag is set.
+ *
+ * @param sharedData - Struct containing the shared data between threads. This function will push to dataRings and close them at the end
+ * @param syncFlags - Struct containing the synchronization flags between threads. This function will read the pauseDataCollection flag
+ */
+void SimulatedDigitizer::AcquireDataMultithreadedContinuous(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
+    try {
+    resetPacing();
+
+    StepDelivery step;
+    beginStepDelivery(step, sharedData, syncFlags);
+    prepareStep();
+
+    // Same timeout as the board, 10x the expected time for 1 buffer, unless running as fast as possible
+    DWORD timeout_ms = (DWORD)FREE_RUN_TIMEOUT_MS;
+    if (simulationParams.rateFactor > 0) {
+        timeout_ms = (DWORD)(10*1e3*acquisitionParams.samplesPerBuffer/acquisitionParams.sampleRate);
+    }
+
+    startTimer(TIMER_ACQUISITION);
+    auto stepStart = std::chrono::steady_clock::now();
+
+    for (U32 buffersCompleted = 0; buffersCompleted < acquisitionParams.buffersPerAcquisition; buffersCompleted++) {
+        if (pauseRequested(syncFlags)) {
+            std::cout << "Received pause signal" << std::endl;
+            break;
+        }
+
+        generateBuffer();
+
+        // Hold each buffer until the sample clock would have filled it
+        if (!waitForBuffer(stepStart, buffersCompleted, simulationParams.rateFactor)) {
+            std::cout << "Received pause signal" << std::endl;
+            break;
+        }
+
+        if (!deliverBuffer(step, samples.data(), timeout_ms)) {
+            break;
+        }
+    }
+
+    stopTimer(TIMER_ACQUISITION);
+
+    // Hand off whatever was generated and signal the end of data acquisition
+    endStepDelivery(step);
+
+    }
+    catch(const std::exception& e)
+    {
+        failStepDelivery(syncFlags, e);
+    }
+}
+
+
+
+/**
+ * @brief Sizes the generation scratch for the current acquisition parameters and places the tones in the band for the current center
+ *        frequency. The noise history carries over between steps.
+ *
+ */
+void SimulatedDigitizer::prepareStep() {
+    const double sampleRate = acquisitionParams.sampleRate;
+    const U32 N = acquisitionParams.samplesPerBuffer;
+
+    // An echo of the noise d samples later makes its power 1 + a^2 + 2a cos(2 pi f d/fs), a ripple of period fs/d and relative depth ~2a
+    rippleDelay = (simulationParams.gainRippleDepth > 0) ? (U32)std::round(sampleRate/simulationParams.gainRipplePeriod) : 0;
+    rippleDelay = min(rippleDelay, N);
+    if (noiseA.size() != N + rippleDelay) {
+        noiseA.assign(N + rippleDelay, 0);
+        noiseB.assign(N + rippleDelay, 0);
+    }
+    voltsA.resize(N);
+    voltsB.resize(N);
+    samples.resize(2*(size_t)N);
+
+    tones.clear();
+    double lineOffset = (simulationParams.lineFrequency - centerFrequency.load())*1e6;
+    if (simulationParams.lineAmplitude > 0 && std::abs(lineOffset) < sampleRate/2) {
+        tones.push_back({ lineOffset, simulationParams.lineAmplitude, simulationParams.lineWidth, 0 });
+    }
+    for (double offset : simulationParams.badBinOffsets) {
+        tones.push_back({ offset, simulationParams.badBinAmplitude, 0, 0 });
+    }
+}
+
+
+
+/**
+ * @brief Synthesizes the next buffer into samples: rippled complex noise plus every tone, quantized to 16-bit codes over +-inputRange.
+ *
+ */
+void SimulatedDigitizer::generateBuffer() {
+    const double sampleRate = acquisitionParams.sampleRate;
+    const double inputRange = acquisitionParams.inputRange;
+    const U32 N = acquisitionParams.samplesPerBuffer;
+    const double depth = (rippleDelay > 0) ? simulationParams.gainRippleDepth/2 : 0;
+    const double noiseScale = simulationParams.noiseAmplitude/std::sqrt(1 + depth*depth);
+
+    // Keep the echo continuous across buffers
+    std::copy(noiseA.end() - rippleDelay, noiseA.end(), noiseA.begin());
+    std::copy(noiseB.end() - rippleDelay, noiseB.end(), noiseB.begin());
+    for (U32 i = rippleDelay; i < N + rippleDelay; i++) {
+        noiseA[i] = gaussian();
+        noiseB[i] = gaussian();
+    }
+
+    for (U32 i = 0; i < N; i++) {
+        voltsA[i] = noiseScale*(noiseA[i + rippleDelay] + depth*noiseA[i]);
+        voltsB[i] = noiseScale*(noiseB[i + rippleDelay] + depth*noiseB[i]);
+    }
+
+    // Tones by phasor recurrence, re-anchored to the exact phase every TONE_CHUNK samples so rounding doesn't build up
+    for (Tone& tone : tones) {
+        const double omega = 2*M_PI*tone.frequency/sampleRate;
+        const double rotationRe = std::cos(omega), rotationIm = std::sin(omega);
+        const double diffusion = std::sqrt(2*M_PI*tone.width*TONE_CHUNK/sampleRate);
+
+        for (U32 chunkStart = 0; chunkStart < N; chunkStart += TONE_CHUNK) {
+            U32 chunkEnd = min(chunkStart + (U32)TONE_CHUNK, N);
+            double re = tone.amplitude*std::cos(tone.phase), im = tone.amplitude*std::sin(tone.phase);
+            for (U32 i = chunkStart; i < chunkEnd; i++) {
+                voltsA[i] += re;
+                voltsB[i] += im;
+                double nextRe = re*rotationRe - im*rotationIm;
+                im = re*rotationIm + im*rotationRe;
+                re = nextRe;
+            }
+
+            tone.phase = std::fmod(tone.phase + omega*(chunkEnd - chunkStart) + diffusion*gaussian(), 2*M_PI);
+        }
+    }
+
+    // Sample codes run from 0x0000 (-inputRange) through 0x8000 (0V) to 0xFFFF (+inputRange), see convertSamplesToComplex
+    const double codesPerVolt = (double)0xFFFF/(2*inputRange);
+    unsigned short* samplesA = samples.data();
+    unsigned short* samplesB = samples.data() + N;
+    for (U32 i = 0; i < N; i++) {
+        samplesA[i] = (unsigned short)min(max(std::round((voltsA[i] + inputRange)*codesPerVolt), 0.0), (double)0xFFFF);
+        samplesB[i] = (unsigned short)min(max(std::round((voltsB[i] + inputRange)*codesPerVolt), 0.0), (double)0xFFFF);
+    }
+}
+
+
+
+/**
+ * @brief Unit variance, zero mean noise sample: the sum of four uniform variates from one xorshift64* draw, rescaled.
+ *
+ */
+double SimulatedDigitizer::gaussian() {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    unsigned long long bits = randomState * 2685821657736338717ULL;
+
+    // Each 16-bit part is uniform on [0, 65535] with variance (65536^2 - 1)/12, ~65536^2/12
+    double sum = (double)(bits & 0xFFFF) + (double)((bits >> 16) & 0xFFFF) + (double)((bits >> 32) & 0xFFFF) + (double)(bits >> 48);
+    return (sum - 2*65535.0)*(std::sqrt(3.0)/65536);
+}
+
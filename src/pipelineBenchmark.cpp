@@ -0,0 +1,64 @@
+/**
+ * @file pipelineBenchmark.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Hardware-free benchmark of the acquisition pipeline. Runs the threadedTesting scan on a SimulatedDigitizer with unconnected PSGs and
+ *        reports the stage timings, so pipeline changes can be measured and profiled on any machine.
+ *        With several digitizers, the extra SimulatedDigitizers tile the band next to the primary one and each runs its own chain, so the
+ *        bandwidth scanned per second shows how the pipeline scales with the number of cards.
+ *
+ *        Usage: pipeline_benchmark [rateFactor] [digitizers]      (defaults to 0, buffers delivered as fast as they are generated, and 1 digitizer)
+ *
+ * @version 0.1
+ * @date 2023-11-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "decs.hpp"
+
+#define BENCHMARK_BAND_SPACING (0.8*32) // MHz between the centers of neighbouring digitizers, the band kept by processedToRescaledTrimmed
+
+int main(int argc, char* argv[]) {
+    int maxSpectraPerStep = 50;
+    int minSpectraPerStep = 13;
+    int subSpectraAveragingNumber = 15;
+    double maxIntegrationTime = maxSpectraPerStep*subSpectraAveragingNumber*0.01; // seconds
+
+    double stepSize = 0.1; // MHz
+    int numSteps = 50;
+
+
+    double rateFactor = (argc > 1) ? std::stod(argv[1]) : 0;
+    int numDigitizers = (argc > 2) ? max(1, std::stoi(argv[2])) : 1;
+
+    ScanRunner scanRunner(maxIntegrationTime, 0, 0, ACQUISITION_SIMULATED);
+    scanRunner.simulatedDigitizer()->simulationParams.rateFactor = rateFactor;
+    for (int d = 1; d < numDigitizers; d++) {
+        SimulationParameters simulationParams;
+        simulationParams.rateFactor = rateFactor;
+        scanRunner.addDigitizer(std::make_unique<SimulatedDigitizer>(simulationParams), d*BENCHMARK_BAND_SPACING);
+    }
+    scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
+    scanRunner.setTarget(6.5e-5);
+    scanRunner.decisionAgent.minShots = minSpectraPerStep;
+
+    resetTimers();
+    auto scanStart = std::chrono::steady_clock::now();
+
+    scanRunner.planScan(stepSize, numSteps);
+    scanRunner.acquireData();
+    for (int i = 0; i < numSteps; i++) {
+        scanRunner.step(stepSize);
+        scanRunner.acquireData();
+    }
+    scanRunner.waitForProcessing();
+
+    std::chrono::duration<double> scanTime = std::chrono::steady_clock::now() - scanStart;
+    std::cout << "Scanned " << std::to_string(numSteps + 1) << " steps in " << std::to_string(scanTime.count()) << " s." << std::endl;
+    std::cout << "Scanned " << std::to_string(numDigitizers*BENCHMARK_BAND_SPACING*(numSteps + 1)/scanTime.count()) << " MHz of band per second with "
+              << std::to_string(numDigitizers) << " digitizers." << std::endl;
+    reportPerformance();
+
+    std::cout << "Exited Normally" << std::endl;
+    return 0;
+}
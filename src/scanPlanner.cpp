@@ -0,0 +1,205 @@
+/**
+ * @file scanPlanner.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for ScanPlanner.
+ * @version 0.1
+ * @date 2023-11-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+// 90% exclusion line of a bin from its coefficients, as BayesFactors::updateExclusionLine computes it. Infinite for a bin without data
+static double exclusionStrength(double coeffA, double coeffB) {
+    double fourLnPtOne = 9.210340372;
+    return (coeffA > 0) ? (coeffB + std::sqrt(coeffB*coeffB + fourLnPtOne*coeffA))/(2*coeffA) : INFINITY;
+}
+
+// How far a bin is from being excluded, from 1 for a bin without data to 0 once its line is at the target
+static double exclusionShortfall(double line, double targetCoupling) {
+    return (line > targetCoupling) ? 1 - targetCoupling/line : 0;
+}
+
+
+
+/**
+ * @brief Plans the windows of a fixed scan of numSteps steps of stepSize from the current center frequency.
+ *
+ * @param stepSize - MHz between neighbouring windows
+ * @param numSteps - steps of the fixed scan, so the band has numSteps + 1 windows
+ * @param targetCoupling - exclusion line value a bin is excluded at, as DecisionAgent::targetCoupling
+ */
+ScanPlanner::ScanPlanner(double stepSize, int numSteps, double targetCoupling) : stepSize(stepSize), numWindows(numSteps + 1), targetCoupling(targetCoupling) {
+    if (stepSize <= 0 || numSteps < 0) {
+        throw std::runtime_error("Error: A planned scan needs a positive step size and at least one window\n");
+    }
+    versions.assign(numWindows, 0);
+}
+
+
+
+// Places the windows on the exclusion line, with window 0 at its current window
+void ScanPlanner::initGeometry(const BayesFactors& bayesFactors) {
+    originBin = bayesFactors.startIndex;
+    windowSize = bayesFactors.windowSize;
+    freqRes = bayesFactors.freqRes;
+
+    bandFirst = originBin + (long long)windowSize/2;
+    bandEnd = max(windowFirstBin(numWindows - 1) + (long long)windowSize/2, bandFirst + 1);
+    uptakeRate.assign(windowSize, 0);
+}
+
+
+
+long long ScanPlanner::windowFirstBin(int window) const {
+    return originBin + std::llround(window*stepSize/freqRes);
+}
+
+
+
+/**
+ * @brief Remembers the coefficients of the current window before its step is acquired, so endStep can tell what the step added.
+ *
+ * @param bayesFactors - exclusion line of the scan
+ */
+void ScanPlanner::beginStep(const BayesFactors& bayesFactors) {
+    if (originBin < 0 && !bayesFactors.coeffSumA.empty()) {
+        initGeometry(bayesFactors);
+    }
+
+    startCoeffA.assign(windowSize, 0);
+    if (originBin >= 0) {
+        long long first = windowFirstBin(currentWindow);
+        for (size_t j = 0; j < windowSize && first + (long long)j < (long long)bayesFactors.coeffSumA.size(); j++) {
+            startCoeffA[j] = bayesFactors.coeffSumA[first + j];
+        }
+    }
+}
+
+
+
+/**
+ * @brief Learns from the step just decided on how fast each bin of the receiver window takes up coeffSumA, and requeues the windows whose
+ *        expected gain it changed. The profile settles within a few steps, so every window is only requeued after steps 1, 2, 4, 8..., and
+ *        in between only the windows overlapping the step.
+ *
+ * @param bayesFactors - exclusion line of the scan, updated with the step
+ * @param stepTime - wall time of the step, s
+ */
+void ScanPlanner::endStep(const BayesFactors& bayesFactors, double stepTime) {
+    if (bayesFactors.coeffSumA.empty()) {
+        throw std::runtime_error("Error: The planned step added nothing to the exclusion line\n");
+    }
+    if (stepTime <= 0) {
+        throw std::runtime_error("Error: Planned steps need a positive step time\n");
+    }
+    if (originBin < 0) {
+        initGeometry(bayesFactors);
+        startCoeffA.assign(windowSize, 0);
+    }
+
+    long long first = windowFirstBin(currentWindow);
+    for (size_t j = 0; j < windowSize && first + (long long)j < (long long)bayesFactors.coeffSumA.size(); j++) {
+        double rate = (bayesFactors.coeffSumA[first + j] - startCoeffA[j])/stepTime;
+        uptakeRate[j] = (uptakeRate[j]*observedSteps + rate)/(observedSteps + 1);
+    }
+    meanStepTime = (meanStepTime*observedSteps + stepTime)/(observedSteps + 1);
+    observedSteps++;
+
+    if ((observedSteps & (observedSteps - 1)) == 0) {
+        requeue(bayesFactors, 0, numWindows);
+        return;
+    }
+    int overlap = (int)std::ceil(windowSize*freqRes/stepSize);
+    requeue(bayesFactors, max(0, currentWindow - overlap), min(numWindows, currentWindow + overlap + 1));
+}
+
+
+
+/**
+ * @brief Takes the window with the highest expected gain per second off the queue and makes it the current window.
+ *
+ * @return int - window to step to next, -1 once no window is expected to gain minGain bins
+ */
+int ScanPlanner::nextWindow() {
+    while (!queue.empty() && queue.top().version != versions[queue.top().window]) {
+        queue.pop();
+    }
+    if (queue.empty()) {
+        return -1;
+    }
+
+    currentWindow = queue.top().window;
+    queue.pop();
+    return currentWindow;
+}
+
+
+
+/**
+ * @brief Fraction of the band's bins excluded down to the target coupling.
+ *
+ * @param bayesFactors - exclusion line of the scan
+ * @return double - excluded fraction, 0 before the first step
+ */
+double ScanPlanner::excludedFraction(const BayesFactors& bayesFactors) const {
+    if (originBin < 0) {
+        return 0;
+    }
+
+    const std::vector<double>& line = bayesFactors.exclusionLine.powers;
+    long long excludedBins = 0;
+    for (long long i = bandFirst; i < bandEnd && i < (long long)line.size(); i++) {
+        if (line[i] <= targetCoupling) {
+            excludedBins++;
+        }
+    }
+    return (double)excludedBins/(bandEnd - bandFirst);
+}
+
+
+
+/**
+ * @brief Expected gain of one more step on a window: the drop in exclusionShortfall of its bins in the band once each takes up its share of
+ *        coeffSumA over a mean step. coeffSumB is expected to stay where it is, as it would without a signal.
+ *
+ * @param bayesFactors - exclusion line of the scan
+ * @param window - window to score
+ * @return double - expected gain, in bins
+ */
+double ScanPlanner::expectedGain(const BayesFactors& bayesFactors, int window) const {
+    const std::vector<double>& coeffSumA = bayesFactors.coeffSumA;
+    const std::vector<double>& coeffSumB = bayesFactors.coeffSumB;
+
+    long long first = windowFirstBin(window);
+    double gain = 0;
+    for (size_t j = 0; j < windowSize; j++) {
+        long long i = first + (long long)j;
+        double added = uptakeRate[j]*meanStepTime;
+        if (i < bandFirst || i >= bandEnd || added <= 0) {
+            continue;
+        }
+
+        double coeffA = (i < (long long)coeffSumA.size()) ? coeffSumA[i] : 0;
+        double coeffB = (i < (long long)coeffSumB.size()) ? coeffSumB[i] : 0;
+        gain += exclusionShortfall(exclusionStrength(coeffA, coeffB), targetCoupling) -
+                exclusionShortfall(exclusionStrength(coeffA + added, coeffB), targetCoupling);
+    }
+    return gain;
+}
+
+
+
+// Queues windows [first, end) again with their current expected gain, which makes their older entries stale
+void ScanPlanner::requeue(const BayesFactors& bayesFactors, int first, int end) {
+    for (int window = first; window < end; window++) {
+        versions[window]++;
+
+        double gain = expectedGain(bayesFactors, window);
+        if (gain >= minGain) {
+            queue.push(QueuedWindow{ gain/meanStepTime, window, versions[window] });
+        }
+    }
+}
@@ -19,14 +19,18 @@
 
 
 /**
- * @brief Construct a new Scan Runner object. This constructor initializes the PSGs, Alazar card, FFTW, and DataProcessor.
+ * @brief Construct a new Scan Runner object. This constructor initializes the PSGs, Alazar card, FFTW, and DataProcessor, running the
+ *        independent parts concurrently with a StartupScheduler that prints the time of every phase.
  * 
+ * @param acquisitionBackend - ACQUISITION_ATS for the lab hardware. ACQUISITION_SIMULATED runs the whole pipeline on a SimulatedDigitizer and
+ *                             ACQUISITION_REPLAY on a ReplayDigitizer, both with unconnected PSGs
+ * @param recordingPath - recording replayed under ACQUISITION_REPLAY
  */
-ScanRunner::ScanRunner(double maxIntegrationTime, int scanType, int decisionMaking) : alazarCard(1, 1),
+ScanRunner::ScanRunner(double maxIntegrationTime, int scanType, int decisionMaking, int acquisitionBackend, std::string recordingPath) :
                 psgList{
-                    PSG(30),  // PSG_DIFF
-                    PSG(21),  // PSG_JPA
-                    PSG(27)   // PSG_PROBE
+                    PSG(acquisitionBackend == ACQUISITION_ATS ? 30 : SIMULATED_GPIB_ADDRESS, false),  // PSG_DIFF
+                    PSG(acquisitionBackend == ACQUISITION_ATS ? 21 : SIMULATED_GPIB_ADDRESS, false),  // PSG_JPA
+                    PSG(acquisitionBackend == ACQUISITION_ATS ? 27 : SIMULATED_GPIB_ADDRESS, false)   // PSG_PROBE
                 },
                 scanType(scanType) {
     // Pumping parameters
@@ -45,6 +49,28 @@ ScanRunner::ScanRunner(double maxIntegrationTime, int scanType, int decisionMaki
     maxSpectraPerAcquisition = (int)(maxIntegrationTime*RBW);
     trueCenterFreq = xModeFreq*1e3 - 1; // Start 1 MHz below the y mode
     subSpectraAveragingNumber = 20;
+    minSubSpectra = 0;
+    maxSubSpectra = 0;
+    FFTBatchSize = FFT_BATCH_SIZE;
+    FFTWorkerCount = FFT_WORKER_COUNT;
+    processingWorkerCount = PROCESSING_WORKER_COUNT;
+    fusedAveraging = 1;
+    fftBackend = FFT_BACKEND_FFTW;
+    persistentStreaming = 1;
+    ringWaitStrategy = PIPELINE_RING_WAIT;
+    persistentPipeline = 1;
+    pipelinedScan = 0;
+    backpressurePolicy = BACKPRESSURE_BLOCK;
+    spillDepth = 0;
+    productionMode = 0;
+
+    // Keep a reference to the last few buffers for error recovery rather than copying every buffer
+    backupPolicy = BACKUP_SHARED;
+    backupDepth = BUFFER_COUNT;
+
+    // Keep the DMA ring and the FFT blocks on large pages where the account allows it
+    dmaBufferAllocation = DMA_BUFFER_ALLOCATION;
+    poolBufferAllocation = POOL_BUFFER_ALLOCATION;
 
     // Filter Parameters
     cutoffFrequency = 10e3;
@@ -56,12 +82,33 @@ ScanRunner::ScanRunner(double maxIntegrationTime, int scanType, int decisionMaki
     savePath = "threadTests";
 
 
-    // Set up member classes
-    initPSGs();
-    initAlazarCard();
-    initFFTW();
-    initProcessor();
-    initDecisionAgent(decisionMaking);
+    // Set up member classes. The PSG connections, the digitizer, FFT planning and the processor files don't depend on each other, so they
+    // start together and each later phase waits only for what it reads
+    StartupScheduler startup;
+    int connectDiff = startup.add("Connect PSG_DIFF", [this]() { psgList[PSG_DIFF].connect(); });
+    int connectJPA = startup.add("Connect PSG_JPA", [this]() { psgList[PSG_JPA].connect(); });
+    int connectProbe = startup.add("Connect PSG_PROBE", [this]() { psgList[PSG_PROBE].connect(); });
+    startup.add("Set PSGs", [this]() { initPSGs(); }, {connectDiff, connectJPA, connectProbe});
+
+    int digitizer = startup.add("Digitizer", [this, acquisitionBackend, recordingPath]() {
+        if (acquisitionBackend == ACQUISITION_SIMULATED) {
+            alazarCard = std::make_unique<SimulatedDigitizer>();
+        }
+        else if (acquisitionBackend == ACQUISITION_REPLAY) {
+            alazarCard = std::make_unique<ReplayDigitizer>(recordingPath);
+        }
+        else {
+            alazarCard = std::make_unique<ATS>(1, 1);
+        }
+        initAlazarCard();
+    });
+    startup.add("FFTW plans", [this]() { initFFTW(); }, {digitizer});
+
+    int processorFiles = startup.add("Processor files", [this]() { loadProcessorFiles(); });
+    int processor = startup.add("Processor filters", [this]() { initProcessor(); }, {digitizer, processorFiles});
+    startup.add("Decision agent", [this, decisionMaking]() { initDecisionAgent(decisionMaking); }, {processor});
+
+    startup.run();
 }
 
 
@@ -71,33 +118,64 @@ ScanRunner::ScanRunner(double maxIntegrationTime, int scanType, int decisionMaki
  * 
  */
 ScanRunner::~ScanRunner() {
-    // Turn off PSGs
-    for (PSG psg : psgList) {
-        psg.onOff(false);
+    // Finish any pipelined step and stop the long-lived pipeline threads before anything they reference is destroyed
+    waitForProcessing();
+    closeArchive();
+    stopTelemetry();
+    stopTrace();
+    stopBaselineRefresh();
+    for (StepSlot& slot : stepSlots) {
+        slot.pipeline.shutdown();
     }
 
-    // Save FFTW wisdom
-    fftw_export_wisdom_to_filename(wisdomFilePath);
+    // Turn off PSGs, after a pending retune without rethrowing its error
+    for (PSG& psg : psgList) {
+        psg.waitForCommands();
+        psg.onOff(false);
+    }
 
     // Free FFTW memory
-    fftw_destroy_plan(fftwPlan);
+    for (std::pair<const int, SpectrumPlans>& plans : spectrumPlans) {
+        fftw_destroy_plan(plans.second.plan);
+        #if SINGLE_PRECISION_PIPELINE
+        fftwf_destroy_plan(plans.second.pipelinePlan);
+        #endif
+    }
+    if (fftwBatchPlan != NULL) {
+        fftw_destroy_plan(fftwBatchPlan);
+    }
+
+    // The single precision pipeline has its own plans
+    #if SINGLE_PRECISION_PIPELINE
+    if (pipelineBatchPlan != NULL) {
+        fftwf_destroy_plan(pipelineBatchPlan);
+    }
+    #endif
 }
 
 
 /**
- * @brief Sets frequencies and powers for interaction PSGs and JPA pump. 
+ * @brief Sets frequencies and powers for interaction PSGs and JPA pump. Each PSG gets its settings in one batch, so they cost one write and
+ *        one error check per PSG.
  * 
  */
 void ScanRunner::initPSGs() {
+    settleInstruments();
+    CommandBatch diffBatch(psgList[PSG_DIFF]);
     psgList[PSG_DIFF].setFreq(yModeFreq - xModeFreq);
     psgList[PSG_DIFF].setPow(diffPower);
+    diffBatch.commit();
 
+    CommandBatch jpaBatch(psgList[PSG_JPA]);
     psgList[PSG_JPA].setFreq(xModeFreq * 2);
     psgList[PSG_JPA].setPow(jpaPower);
+    jpaBatch.commit();
 
     if (scanType == SHARP_FAXION) {
+        CommandBatch probeBatch(psgList[PSG_PROBE]);
         psgList[PSG_PROBE].setFreq(yModeFreq + faxionFreq - trueCenterFreq/1e3);
         psgList[PSG_PROBE].setPow(faxionPower);
+        probeBatch.commit();
     }
 }
 
@@ -111,50 +189,183 @@ void ScanRunner::initAlazarCard() {
     double samplesPerAcquisition = samplesPerSpectrum*maxSpectraPerAcquisition;
 
     std::cout << "Trying to set acquisition parameters." << std::endl;
-    alazarCard.setAcquisitionParameters((U32)sampleRate, (U32)samplesPerAcquisition, maxSpectraPerAcquisition);
-    std::cout << "Acquisition parameters set. Collecting " << std::to_string(alazarCard.acquisitionParams.buffersPerAcquisition) << " buffers." << std::endl;
+    // Size the DMA ring adaptively so host stalls (file saves, plotting) are absorbed instead of overflowing the board
+    alazarCard->setAcquisitionParameters((U32)sampleRate, (U32)samplesPerAcquisition, maxSpectraPerAcquisition, 0.8, 50, 0);
+    std::cout << "Acquisition parameters set. Collecting " << std::to_string(alazarCard->acquisitionParams.buffersPerAcquisition) << " buffers." << std::endl;
+    alazarCard->setCenterFrequency(trueCenterFreq);
 }
 
 
 /**
- * @brief Initializes FFTW plan for data processing.
+ * @brief Initializes FFTW plan for data processing. Plans come from the wisdom store, so only a transform size that has never been planned
+ *        is measured (run fftw_planner offline to pre-compute FFTW_PATIENT wisdom instead).
  * 
  * @warning Must be called after initAlazarCard() because the FFTW plan is dependent on the Alazar card's acquisition parameters.
  * 
  */
 void ScanRunner::initFFTW() {
-    // Try to import an FFTW plan if available
-    wisdomFilePath = "fftw_wisdom.txt";
-    if (fftw_import_wisdom_from_filename(wisdomFilePath) != 0) {
-        std::cout << "Successfully imported FFTW wisdom from file." << std::endl;
+    // Let FFTW split each transform across threads instead of running several FFT workers
+    #if FFTW_THREADED_PLANNER
+    fftw_init_threads();
+    fftw_plan_with_nthreads(max(1, FFTWorkerCount));
+    #if SINGLE_PRECISION_PIPELINE
+    fftwf_init_threads();
+    fftwf_plan_with_nthreads(max(1, FFTWorkerCount));
+    #endif
+    wisdomStore.plannerThreads = max(1, FFTWorkerCount);
+    #endif
+
+    selectSpectrumPlan();
+    initBatchedFFTW();
+}
+
+
+
+/**
+ * @brief Points fftwPlan and pipelinePlan at the single spectrum plans for the current spectrum length, creating them the first time the
+ *        length is seen. The batched plan and the pools follow from acquireData once batchedFFTStale sees the new length.
+ * 
+ */
+void ScanRunner::selectSpectrumPlan() {
+    int N = spectrumLength();
+    std::map<int, SpectrumPlans>::iterator cached = spectrumPlans.find(N);
+    if (cached == spectrumPlans.end()) {
+        SpectrumPlans plans;
+        std::cout << "Creating plan for N = " << std::to_string(N) << std::endl;
+        plans.plan = wisdomStore.planDFT(N, 1, FFTW_MEASURE);
+        std::cout << "Plan created!" << std::endl;
+
+        // The acquisition pipeline uses a float plan in single precision builds and shares the double plan otherwise
+        #if SINGLE_PRECISION_PIPELINE
+        plans.pipelinePlan = wisdomStore.planDFTf(N, 1, FFTW_MEASURE);
+        std::cout << "Single precision plan created!" << std::endl;
+        #else
+        plans.pipelinePlan = plans.plan;
+        #endif
+        cached = spectrumPlans.emplace(N, plans).first;
     }
-    else {
-        std::cout << "Failed to import FFTW wisdom from file." << std::endl;
+
+    fftwPlan = cached->second.plan;
+    pipelinePlan = cached->second.pipelinePlan;
+}
+
+
+
+/**
+ * @brief Waits for the PSG commands queued on their I/O threads, rethrowing the error of a failed retune, so the PSGs can be used directly
+ *        again and their outputs are settled.
+ * 
+ */
+void ScanRunner::settleInstruments() {
+    if (retune.valid()) {
+        retune.get();
     }
+    for (PSG& psg : psgList) {
+        psg.waitForCommands();
+    }
+}
+
+
 
-    // Create an FFTW plan
-    int N = (int)alazarCard.acquisitionParams.samplesPerBuffer;
+/**
+ * @brief Creates the batched FFTW plan over FFTBatchSize contiguous spectra and sizes the pipeline buffer pools to hold one batch per buffer.
+ *        Called from initFFTW() and again from acquireData() if FFTBatchSize or the spectrum length has been changed since.
+ * 
+ * @warning Must be called after initFFTW() has created the single spectrum plan.
+ * 
+ */
+void ScanRunner::initBatchedFFTW() {
+    int N = spectrumLength();
+    FFTBatchSize = max(1, FFTBatchSize);
 
-    std::cout << "Creating plan for N = " << std::to_string(N) << std::endl;
+    if (fftwBatchPlan != NULL) {
+        fftw_destroy_plan(fftwBatchPlan);
+        fftwBatchPlan = NULL;
+    }
+
+    // Transform K spectra laid out back to back (stride 1, distance N) with one plan
+    if (FFTBatchSize > 1) {
+        std::cout << "Creating batched plan for " << std::to_string(FFTBatchSize) << " x N = " << std::to_string(N) << std::endl;
+        fftwBatchPlan = wisdomStore.planDFT(N, FFTBatchSize, FFTW_MEASURE);
+        std::cout << "Batched plan created!" << std::endl;
+    }
 
-    fftw_complex* fftwInput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * N));
-    fftw_complex* fftwOutput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * N));
-    fftwPlan = fftw_plan_dft_1d(N, fftwInput, fftwOutput, FFTW_FORWARD, FFTW_MEASURE);
+    #if SINGLE_PRECISION_PIPELINE
+    if (pipelineBatchPlan != NULL) {
+        fftwf_destroy_plan(pipelineBatchPlan);
+        pipelineBatchPlan = NULL;
+    }
 
-    std::cout << "Plan created!" << std::endl;
+    if (FFTBatchSize > 1) {
+        pipelineBatchPlan = wisdomStore.planDFTf(N, FFTBatchSize, FFTW_MEASURE);
+    }
+    #else
+    pipelineBatchPlan = fftwBatchPlan;
+    #endif
+    fftwBatchPlanSize = FFTBatchSize;
+    fftwBatchPlanLength = N;
+
+    // Allocate the pipeline buffer pools now that the transform size is known. Each buffer holds one batch, keeping the total footprint the same
+    int poolBlocks = max(4, POOL_BUFFER_COUNT / FFTBatchSize);
+    dataPool.allocate(poolBlocks, FFTBatchSize * N, poolBufferAllocation);
+    FFTPool.allocate(poolBlocks, FFTBatchSize * N, poolBufferAllocation);
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->dataPool.allocate(poolBlocks, FFTBatchSize * N, poolBufferAllocation);
+        digitizer->FFTPool.allocate(poolBlocks, FFTBatchSize * N, poolBufferAllocation);
+    }
+    if (dataPool.placement() & ALLOCATE_LARGE_PAGES) {
+        std::cout << "Buffer pools are on large pages." << std::endl;
+    }
 
-    fftw_free(fftwInput);
-    fftw_free(fftwOutput);
+    // Each chain gets its own device backend, holding one block of spectra and its sub-spectrum sum
+    pipelineBackend.reset();
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->backend.reset();
+    }
+    if (fftBackend != FFT_BACKEND_FFTW) {
+        pipelineBackend = FFTBackend::create(fftBackend, N, FFTBatchSize, pipelinePlan, pipelineBatchPlan);
+        for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+            digitizer->backend = FFTBackend::create(fftBackend, N, FFTBatchSize, pipelinePlan, pipelineBatchPlan);
+        }
+        std::cout << "FFT stage runs on the " << pipelineBackend->name() << " backend." << std::endl;
+    }
+    pipelineBackendType = fftBackend;
 }
 
 
 /**
- * @brief Initializes DataProcessor object. Initializes filter and loads SNR, bad bins and baseline if available.
+ * @brief Initializes the DataProcessor's filter from the Alazar card's sample rate.
+ * 
+ * @warning Must be called after initAlazarCard() because the filter is designed for the acquisition sample rate.
  * 
  */
 void ScanRunner::initProcessor() {
-    // Create data processor
-    dataProcessor.setFilterParams(alazarCard.acquisitionParams.sampleRate, poleNumber, cutoffFrequency, stopbandAttenuation);
+    dataProcessor.setFilterParams(alazarCard->acquisitionParams.sampleRate, poleNumber, cutoffFrequency, stopbandAttenuation);
+}
+
+
+
+/**
+ * @brief Loads the DataProcessor's SNR, and bad bins and baseline if available. Needs nothing from the instruments, so it runs alongside
+ *        their startup. The calibration store is mapped rather than parsed, so it is used whenever it has an SNR, and the CSV files only
+ *        seed it the first time.
+ * 
+ */
+void ScanRunner::loadProcessorFiles() {
+    calibrationStore.refresh();
+    if (!calibrationStore.empty() && calibrationStore.header().SNRBins > 0) {
+        dataProcessor.loadCalibration(calibrationStore);
+        storedBaseline = dataProcessor.currentBaseline;
+
+        const CalibrationHeader& header = calibrationStore.header();
+        if (header.poleNumber != poleNumber || header.cutoffFrequency != cutoffFrequency || header.stopbandAttenuation != stopbandAttenuation ||
+            header.sampleRate != sampleRate) {
+            std::cout << "Warning: Calibration " << std::to_string(header.generation) << " was taken with other filter settings, "
+                      << "run refreshBaselineAndBadBins." << std::endl;
+        }
+        return;
+    }
+
     dataProcessor.loadSNR("../../../src/dataProcessing/visSmoothed.csv", "../../../src/dataProcessing/visFreq.csv");
 
 
@@ -171,7 +382,64 @@ void ScanRunner::initProcessor() {
 
 
     // Try to import baseline if available
-    dataProcessor.currentBaseline = readVector("baseline.csv");
+    storedBaseline = readVector("baseline.csv");
+    dataProcessor.currentBaseline = storedBaseline;
+
+    publishCalibration();
+}
+
+
+
+/**
+ * @brief Publishes the bad bins and baseline of the DataProcessor with the filter settings as the next generation of the calibration store,
+ *        where running scans pick it up at their next checkpoint and every executable loads it on startup. The SNR is carried over from
+ *        the current generation, since the DataProcessor's may be narrowed to a band, and only comes from the DataProcessor for the first.
+ * 
+ */
+void ScanRunner::publishCalibration() {
+    Calibration calibration;
+    calibration.baseline = dataProcessor.currentBaseline;
+    calibration.badBins = dataProcessor.badBins;
+    if (!calibrationStore.empty() && calibrationStore.header().SNRBins > 0) {
+        size_t SNRBins = (size_t)calibrationStore.header().SNRBins;
+        calibration.SNR.assign(calibrationStore.SNR(), calibrationStore.SNR() + SNRBins);
+        calibration.SNRFreqs.assign(calibrationStore.SNRFreqs(), calibrationStore.SNRFreqs() + SNRBins);
+    }
+    else {
+        calibration.SNR = dataProcessor.SNR.powers;
+        calibration.SNRFreqs = dataProcessor.SNR.freqAxis;
+    }
+    calibration.sampleRate = sampleRate;
+    calibration.cutoffFrequency = cutoffFrequency;
+    calibration.stopbandAttenuation = stopbandAttenuation;
+    calibration.poleNumber = poleNumber;
+
+    uint64_t generation = calibrationStore.publish(calibration);
+    std::cout << "Published calibration " << std::to_string(generation) << std::endl;
+}
+
+
+
+/**
+ * @brief Swaps in the baseline and bad bins of a calibration published since the last one was loaded, e.g. by a baselining run beside the
+ *        scan. The SNR and filter stay as they are. Only called with nothing in flight.
+ * 
+ */
+void ScanRunner::pickUpCalibration() {
+    if (!calibrationStore.refresh()) {
+        return;
+    }
+
+    const CalibrationHeader& header = calibrationStore.header();
+    if (header.baselineBins != dataProcessor.currentBaseline.size()) {
+        std::cout << "Warning: Calibration " << std::to_string(header.generation) << " has a baseline of " << std::to_string(header.baselineBins)
+                  << " bins, not " << std::to_string(dataProcessor.currentBaseline.size()) << ", keeping the current one." << std::endl;
+        return;
+    }
+    dataProcessor.currentBaseline.assign(calibrationStore.baseline(), calibrationStore.baseline() + header.baselineBins);
+    dataProcessor.badBins.assign(calibrationStore.badBins(), calibrationStore.badBins() + header.numBadBins);
+    storedBaseline = dataProcessor.currentBaseline;
+    std::cout << "Picked up calibration " << std::to_string(header.generation) << std::endl;
 }
 
 
@@ -189,10 +457,147 @@ void ScanRunner::initDecisionAgent(int decisionMaking){
 
 /**
  * @brief Runs a scan. This function assumes that the probes and frequency have been properly set and begins acquisition for a single data point.
+ *        With pipelinedScan it returns as soon as acquisition stops (by decision or after the full horizon) so the PSG can be retuned and the
+ *        next step acquired while this step's processing tail finishes in the other step slot. Call waitForProcessing() before using the results.
  * 
  */
 void ScanRunner::acquireData() {
-    // Turn on PSGs
+    TraceSpan span("Acquire step", TRACE_SCAN, scanStepIndex + 1);
+
+    // The threaded planner already parallelizes each transform, so it runs with a single FFT worker. A device backend takes the whole chain
+    int numFFTWorkers = (FFTW_THREADED_PLANNER || fftBackend != FFT_BACKEND_FFTW) ? 1 : max(1, FFTWorkerCount);
+    int numProcessingWorkers = max(1, processingWorkerCount);
+
+    // Overlapping steps share the plans, buffer pools and stage layout, so let them finish before any of those change
+    bool layoutChanged = batchedFFTStale();
+    for (StepSlot& other : stepSlots) {
+        if (other.inFlight && (other.workers != numFFTWorkers || other.processingWorkers != numProcessingWorkers || other.fused != fusedAveraging
+                               || other.backend != fftBackend || other.builtDigitizers != (int)digitizers.size())) {
+            layoutChanged = true;
+        }
+    }
+    if (!pipelinedScan || layoutChanged) {
+        waitForProcessing();
+    }
+
+
+    // Steps alternate between the two slots. A slot's data can only be reused once the step two back has finished its tail
+    scanStepIndex++;
+    StepSlot& slot = stepSlots[pipelinedScan ? scanStepIndex % 2 : 0];
+    if (slot.inFlight) {
+        finishStep(slot);
+    }
+    bool otherInFlight = stepSlots[0].inFlight || stepSlots[1].inFlight;
+
+    slot.stepIndex = scanStepIndex;
+    slot.centerFreq = trueCenterFreq;
+    slot.deferredStepSize = pendingStepSize;
+    pendingStepSize = 0;
+
+
+    // Set up shared data. It outlives the step so the persistent pipeline threads can keep referencing it, and is only reset here
+    SharedDataBasic& sharedDataBasic = slot.dataBasic;
+    SharedDataProcessing& sharedDataProc = slot.dataProc;
+    SharedDataSaving& sharedSavedData = slot.savedData;
+    SynchronizationFlags& syncFlags = slot.syncFlags;
+
+    // prepareNextStep may already have done the resets while the previous step was finishing
+    bool prepared = slot.prepared && slot.preparedWorkers == numFFTWorkers && slot.preparedProcessingWorkers == numProcessingWorkers 
+                    && slot.preparedWaitStrategy == ringWaitStrategy && FFTBatchSize == fftwBatchPlanSize;
+    slot.prepared = false;
+    if (!prepared) {
+        resetStepData(sharedDataBasic, sharedSavedData, syncFlags);
+    }
+
+    sharedDataBasic.samplesPerBuffer = spectrumLength();
+    dataProcessor.prepareBinRepair(sharedDataBasic.samplesPerBuffer);
+
+    // Rebuild the batched plan, pools and FFT backends if the batch size, the pools' page allocation or the backend was changed since the last acquisition
+    if (batchedFFTStale()) {
+        initBatchedFFTW();
+    }
+    sharedDataBasic.spectraPerBlock = fftwBatchPlanSize;
+
+    // Reclaim any buffers stranded by a previous error and share the pools between stages. A step still in flight holds live buffers
+    if (!otherInFlight) {
+        dataPool.reset();
+        FFTPool.reset();
+    }
+    sharedDataBasic.dataPool = &dataPool;
+    sharedDataBasic.FFTPool = &FFTPool;
+
+    sharedDataBasic.backupPolicy = backupPolicy;
+    sharedDataBasic.backupDepth = backupDepth;
+    sharedDataProc.backpressurePolicy = backpressurePolicy;
+    sharedDataProc.spillDepth = spillDepth;
+    sharedDataProc.diagnostics = !productionMode;
+    // The chains of several digitizers are merged spectrum by spectrum, so they keep the same fixed batches
+    sharedDataProc.minSubSpectra = digitizers.empty() ? minSubSpectra*welchSegments : 0;
+    sharedDataProc.maxSubSpectra = digitizers.empty() ? maxSubSpectra*welchSegments : 0;
+    sharedSavedData.decisionCapture = (decisionStream != nullptr) ? decisionStream->addStep(trueCenterFreq, subSpectraAveragingNumber/RBW) : nullptr;
+    sharedDataProc.archive = archive.get();
+    sharedDataProc.archiveStep = scanStepIndex;
+    if (archive != nullptr) {
+        alazarCard->archiveTo(archive->archives(ARCHIVE_RAW_BUFFERS) ? archive.get() : nullptr, scanStepIndex);
+    }
+    sharedDataProc.telemetry = telemetry.get();
+    if (telemetry != nullptr) {
+        telemetry->setStep(scanStepIndex);
+    }
+
+    if (!prepared) {
+        initPipelineRings(sharedDataBasic, sharedDataProc, syncFlags, numFFTWorkers, PIPELINE_RING_CAPACITY, ringWaitStrategy, numProcessingWorkers);
+    }
+    slot.queueGauges.watch(sharedDataBasic, sharedDataProc);
+    sharedDataProc.queueGauges = &slot.queueGauges;
+
+    // The other digitizers' chains are set up like the primary's, on their own pools. Only the primary feeds the archive and telemetry
+    prepareDigitizerData(slot, numFFTWorkers, !prepared);
+    for (size_t d = 0; d < digitizers.size(); d++) {
+        Digitizer& digitizer = *digitizers[d];
+        DigitizerStepData& data = *slot.digitizerData[d];
+        if (digitizer.source->samplesPerSpectrum() != (U32)sharedDataBasic.samplesPerBuffer) {
+            throw std::runtime_error("Error: Digitizer " + std::to_string(d + 1) + " does not acquire spectra of the primary digitizer's length\n");
+        }
+
+        data.dataBasic.samplesPerBuffer = sharedDataBasic.samplesPerBuffer;
+        data.dataBasic.spectraPerBlock = fftwBatchPlanSize;
+        if (!otherInFlight) {
+            digitizer.dataPool.reset();
+            digitizer.FFTPool.reset();
+        }
+        data.dataBasic.dataPool = &digitizer.dataPool;
+        data.dataBasic.FFTPool = &digitizer.FFTPool;
+        data.dataBasic.backupPolicy = backupPolicy;
+        data.dataBasic.backupDepth = backupDepth;
+        data.dataProc.backpressurePolicy = backpressurePolicy;
+        data.dataProc.spillDepth = spillDepth;
+        data.dataProc.diagnostics = !productionMode;
+
+        // Baseline, SNR and bad bins follow the primary's calibration
+        digitizer.processor.loadProcessingState(dataProcessor);
+        digitizer.processor.prepareBinRepair(sharedDataBasic.samplesPerBuffer);
+    }
+
+    // A forecast stop wakes acquireData below so it can prepare the next step before this one ends
+    {
+        std::lock_guard<std::mutex> lock(forecastMutex);
+        slot.stopForecast = false;
+        slot.acquisitionEnded = false;
+    }
+    if (pipelinedScan) {
+        std::lock_guard<std::mutex> lock(syncFlags.mutex);
+        syncFlags.prepareNextStep = [this, &slot]() {
+            {
+                std::lock_guard<std::mutex> forecastLock(forecastMutex);
+                slot.stopForecast = true;
+            }
+            forecastCondition.notify_all();
+        };
+    }
+
+    // Turn on PSGs once the retune of step() settled behind the setup above
+    settleInstruments();
     // psgList[PSG_DIFF].onOff(true); // Temporarily turned off for cavity only operation
     psgList[PSG_JPA].onOff(true);
 
@@ -200,74 +605,98 @@ void ScanRunner::acquireData() {
         psgList[PSG_PROBE].onOff(true);
     }
 
+    // Arm the board once and reuse the same streaming session for every following step
+    // The DMA buffers are re-allocated whenever the board is armed
+    alazarCard->acquisitionParams.bufferAllocation = dmaBufferAllocation;
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->acquisitionParams.bufferAllocation = dmaBufferAllocation;
+    }
+    if (persistentStreaming) {
+        alazarCard->placeSessionThread(threadPlacement, primaryAffinityMask);
+        alazarCard->startStreamingSession();
+        for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+            digitizer->source->placeSessionThread(threadPlacement, digitizer->affinityMask);
+            digitizer->source->startStreamingSession();
+        }
+    }
 
-    // Set up shared data
-    SharedDataBasic sharedDataBasic;
-    SharedDataProcessing sharedDataProc;
-    SharedDataSaving sharedSavedData;
-    SynchronizationFlags syncFlags;
+    // Begin the threads. Persistent threads stay warm between steps and are only rebuilt when the stage layout changes
+    Pipeline oneShotPipeline;
+    if (persistentPipeline || pipelinedScan) {
+        if (!slot.pipeline.persistent() || slot.workers != numFFTWorkers || slot.processingWorkers != numProcessingWorkers || slot.fused != fusedAveraging
+            || slot.backend != fftBackend || slot.builtDigitizers != (int)digitizers.size()) {
+            slot.pipeline.clear();
+            buildPipeline(slot.pipeline, sharedDataBasic, sharedDataProc, sharedSavedData, syncFlags, numFFTWorkers, numProcessingWorkers, fusedAveraging, &slot,
+                          &slot.digitizerData);
+            slot.pipeline.startPersistent();
+
+            slot.workers = numFFTWorkers;
+            slot.processingWorkers = numProcessingWorkers;
+            slot.fused = fusedAveraging;
+            slot.backend = fftBackend;
+            slot.builtDigitizers = (int)digitizers.size();
+        }
 
-    int N = (int)alazarCard.acquisitionParams.samplesPerBuffer;
-    sharedDataBasic.samplesPerBuffer = alazarCard.acquisitionParams.samplesPerBuffer;
+        // With nothing else in flight every stage may run this step straight away
+        if (!otherInFlight) {
+            stepSequencer.reset(slot.pipeline.size(), scanStepIndex - 1);
+        }
+        slot.pipeline.beginStep();
+    }
+    else {
+        slot.pipeline.clear();
+        buildPipeline(oneShotPipeline, sharedDataBasic, sharedDataProc, sharedSavedData, syncFlags, numFFTWorkers, numProcessingWorkers, fusedAveraging, 
+                      nullptr, &slot.digitizerData);
+        oneShotPipeline.start();
+    }
 
-    // Begin the threads
-    std::thread acquisitionThread(&ATS::AcquireDataMultithreadedContinuous, &alazarCard, std::ref(sharedDataBasic), std::ref(syncFlags));
-    std::thread FFTThread(FFTThread, fftwPlan, N, std::ref(sharedDataBasic), std::ref(syncFlags));
-    std::thread magnitudeThread(magnitudeThread, N, std::ref(sharedDataBasic), std::ref(sharedDataProc), std::ref(syncFlags), std::ref(dataProcessor));
-    std::thread averagingThread(averagingThread, std::ref(sharedDataProc), std::ref(syncFlags), std::ref(dataProcessor), std::ref(trueCenterFreq), subSpectraAveragingNumber);
-    std::thread processingThread(processingThread, std::ref(sharedDataProc), std::ref(savedData), std::ref(syncFlags), std::ref(dataProcessor), std::ref(bayesFactors));
-    std::thread decisionMakingThread(decisionMakingThread, std::ref(sharedDataProc), std::ref(sharedSavedData), std::ref(syncFlags), std::ref(bayesFactors), std::ref(decisionAgent));
     #if SAVE_PROGRESS
     // std::thread savingThread(dataSavingThread, std::ref(sharedSavedData), std::ref(syncFlags));
     #endif
 
-    // Wait for the threads to finish
-    if (acquisitionThread.joinable()) { 
-        acquisitionThread.join();
-        std::cout << "Acquisition thread joined." << std::endl;
-    } 
-    else { std::cerr << "Acquisition thread is not joinable" << std::endl;}
-
-    if (FFTThread.joinable()) { 
-        FFTThread.join();
-        std::cout << "FFT thread joined." << std::endl;
-    } 
-    else { std::cerr << "FFT thread is not joinable" << std::endl;}
-
-    if (magnitudeThread.joinable()) { 
-        magnitudeThread.join();
-        std::cout << "Magnitude thread joined." << std::endl;
-    } 
-    else { std::cerr << "Magnitude thread is not joinable" << std::endl;}
-
-    if (averagingThread.joinable()) { 
-        averagingThread.join();
-        std::cout << "Averaging thread joined." << std::endl;
-    } 
-    else { std::cerr << "Averaging thread is not joinable" << std::endl;}
-
-    if(processingThread.joinable()) {
-        processingThread.join();
-        std::cout << "Processing thread joined." << std::endl;
+    // Hand the tail over to the next acquireData call once the acquisition thread (body 0) has stopped. The next step is prepared as soon
+    // as the decision agent forecasts the stop, so that work overlaps the last spectra of this step instead of adding to the dead time
+    if (pipelinedScan) {
+        {
+            std::unique_lock<std::mutex> lock(forecastMutex);
+            forecastCondition.wait(lock, [&slot]() { return slot.stopForecast || slot.acquisitionEnded; });
+        }
+        prepareNextStep(numFFTWorkers, numProcessingWorkers);
+
+        // Every digitizer has stopped acquiring before the next step retunes
+        for (size_t body : slot.acquisitionBodies) {
+            slot.pipeline.waitForBody(body);
+        }
+        slot.inFlight = true;
+
+        // Both slots draw on the same data pool, so the backups of a finished acquisition are dropped now unless they are needed for recovery
+        bool acquisitionFailed;
         {
-            std::lock_guard<std::mutex> lock(sharedDataProc.mutex);
-            sharedDataProc.rescaledDataReadyCondition.notify_one();
+            std::lock_guard<std::mutex> lock(syncFlags.mutex);
+            acquisitionFailed = syncFlags.errorFlag;
         }
-    } else {
-        std::cerr << "Processing thread is not joinable" << std::endl;
+        if (!acquisitionFailed) {
+            {
+                std::lock_guard<std::mutex> lock(sharedDataBasic.mutex);
+                trimBackupQueue(sharedDataBasic, 0);
+            }
+            for (std::unique_ptr<DigitizerStepData>& data : slot.digitizerData) {
+                std::lock_guard<std::mutex> lock(data->dataBasic.mutex);
+                trimBackupQueue(data->dataBasic, 0);
+            }
+        }
+        return;
     }
 
-    if (decisionMakingThread.joinable()) { 
-        decisionMakingThread.join();
-        std::cout << "Decision thread joined." << std::endl;
-    } 
-    else { std::cerr << "Decision making thread is not joinable" << std::endl;}
+    // Wait for the threads to finish
+    if (!persistentPipeline) {
+        oneShotPipeline.join();
+    }
+    finishStep(slot);
+    checkpointScan();
     
     #if SAVE_PROGRESS
     // savingThread.join();
-
-    std::string exclusionLineFilename = "../../../plotting/" + exclusionPath + "/scanProgress/exclusionLine_" + getDateTimeString() + ".csv";
-    saveSpectraFromQueue(sharedSavedData.exclusionLineQueue, exclusionLineFilename);
     #endif
 
 
@@ -275,234 +704,908 @@ void ScanRunner::acquireData() {
     psgList[PSG_DIFF].onOff(false);
     psgList[PSG_JPA].onOff(false);
     psgList[PSG_PROBE].onOff(false);
+}
 
-    reportPerformance();
 
 
-    // Error recovery for when the threads don't finish properly
-    if (syncFlags.errorFlag) {
-        std::cout << "Error flag set. Recovering..." << std::endl;
-    }
-    else {
-        std::cout << "Emptying backupDataQueue" << std::endl;
-        while (!sharedDataBasic.backupDataQueue.empty()) {
-            fftw_complex* data = sharedDataBasic.backupDataQueue.front();
-            fftw_free(data);  // Free the memory
-            sharedDataBasic.backupDataQueue.pop();
-        }
+/**
+ * @brief Gets the step slot of the next acquireData call ready while the current step is still acquiring: finishes the tail of the step
+ *        that last used it and resets its shared data and rings, so the next step can start as soon as the current one stops.
+ * 
+ * @param numFFTWorkers - FFT workers the next step's rings are set up for
+ * @param numProcessingWorkers - processing workers the next step's rings are set up for
+ */
+void ScanRunner::prepareNextStep(int numFFTWorkers, int numProcessingWorkers) {
+    StepSlot& next = stepSlots[(scanStepIndex + 1) % 2];
+    if (next.inFlight) {
+        finishStep(next);
     }
-}
 
+    resetStepData(next.dataBasic, next.savedData, next.syncFlags);
+    initPipelineRings(next.dataBasic, next.dataProc, next.syncFlags, numFFTWorkers, PIPELINE_RING_CAPACITY, ringWaitStrategy, numProcessingWorkers);
+    prepareDigitizerData(next, numFFTWorkers, true);
 
+    next.prepared = true;
+    next.preparedWorkers = numFFTWorkers;
+    next.preparedProcessingWorkers = numProcessingWorkers;
+    next.preparedWaitStrategy = ringWaitStrategy;
+}
 
-void ScanRunner::unrolledAcquisition() {
-    // Turn on PSGs
-    // psgList[PSG_DIFF].onOff(true); // Temporarily turned off for cavity only operation
-    psgList[PSG_JPA].onOff(true);
 
 
-    // Set up shared data
-    SharedDataBasic sharedDataBasic;
-    SharedDataProcessing sharedDataProc;
-    SharedDataSaving sharedSavedData;
-    SynchronizationFlags syncFlags;
+/**
+ * @brief Gets the shared data of the extra digitizers' chains ready for a step in slot, one per entry of digitizers, and links their flags
+ *        to the slot's so stop requests and errors reach every chain.
+ * 
+ * @param slot - Step slot the chains run in
+ * @param numFFTWorkers - FFT workers the chains' rings are set up for
+ * @param resetRings - Reset the chains' shared data and rings. Chains created here are always reset
+ */
+void ScanRunner::prepareDigitizerData(StepSlot& slot, int numFFTWorkers, bool resetRings) {
+    slot.syncFlags.linkedFlags.clear();
+    if (slot.digitizerData.size() > digitizers.size()) {
+        slot.digitizerData.resize(digitizers.size());
+    }
 
-    int N = (int)alazarCard.acquisitionParams.samplesPerBuffer;
-    sharedDataBasic.samplesPerBuffer = alazarCard.acquisitionParams.samplesPerBuffer;
+    for (size_t d = 0; d < digitizers.size(); d++) {
+        bool created = (d >= slot.digitizerData.size());
+        if (created) {
+            slot.digitizerData.push_back(std::make_unique<DigitizerStepData>());
+        }
+        DigitizerStepData& data = *slot.digitizerData[d];
 
+        if (resetRings || created) {
+            resetStepData(data.dataBasic, data.savedData, data.syncFlags);
+            initPipelineRings(data.dataBasic, data.dataProc, data.syncFlags, numFFTWorkers, PIPELINE_RING_CAPACITY, ringWaitStrategy, 1);
+        }
+        data.syncFlags.primaryFlags = &slot.syncFlags;
+        data.syncFlags.recordsMetrics = false;
+        slot.syncFlags.linkedFlags.push_back(&data.syncFlags);
+    }
+}
 
-    // Begin the threads
-    std::cout << "Launching acquisition thread." << std::endl;
-    std::queue<fftw_complex*> backupDataQueue;
-    std::thread acquisitionThread(&ATS::AcquireDataMultithreadedContinuous, &alazarCard, std::ref(sharedDataBasic), std::ref(syncFlags));
-    acquisitionThread.join();
 
-    std::cout << "Launching FFT thread." << std::endl;
-    std::thread FFTThread(FFTThread, fftwPlan, N, std::ref(sharedDataBasic), std::ref(syncFlags));
-    FFTThread.join();
 
-    std::cout << "Launching magnitude thread." << std::endl;
-    std::thread magnitudeThread(magnitudeThread, N, std::ref(sharedDataBasic), std::ref(sharedDataProc), std::ref(syncFlags), std::ref(dataProcessor));
-    magnitudeThread.join();
+/**
+ * @brief Adds a digitizer that acquires alongside the primary one, centered bandOffset MHz from it. The digitizer gets its own acquisition,
+ *        FFT, averaging and processing chain, and its spectra are merged with the other digitizers' by absolute frequency before the decision
+ *        stage, so each step covers the bands of all of them. Acquisition parameters are copied from the primary digitizer.
+ * 
+ * @warning Digitizers can only be added before the scan starts.
+ * 
+ * @param source - Acquisition source of the digitizer
+ * @param bandOffset - MHz from the primary digitizer's center frequency to this one's, rounded to whole bins
+ * @param affinityMask - Cores the chain's threads are pinned to, 0 for any
+ */
+void ScanRunner::addDigitizer(std::unique_ptr<AcquisitionSource> source, double bandOffset, DWORD_PTR affinityMask) {
+    waitForProcessing();
+    if (scanStepIndex > 0) {
+        throw std::runtime_error("Error: Digitizers can only be added before the scan starts\n");
+    }
 
-    std::cout << "Launching averaging thread." << std::endl;
-    std::thread averagingThread(averagingThread, std::ref(sharedDataProc), std::ref(syncFlags), std::ref(dataProcessor), std::ref(trueCenterFreq), subSpectraAveragingNumber);
-    averagingThread.join();
-    
-    std::cout << "Launching processing thread." << std::endl;
-    std::thread processingThread(processingThread, std::ref(sharedDataProc), std::ref(savedData), std::ref(syncFlags), std::ref(dataProcessor), std::ref(bayesFactors));
-    processingThread.join();
-    
-    std::cout << "Launching decision making thread." << std::endl;
-    std::thread decisionMakingThread(decisionMakingThread, std::ref(sharedDataProc), std::ref(sharedSavedData), std::ref(syncFlags), std::ref(bayesFactors), std::ref(decisionAgent));
-    decisionMakingThread.join();
+    // The chains and their rings are rebuilt with the new digitizer on the next acquisition
+    for (StepSlot& slot : stepSlots) {
+        slot.pipeline.clear();
+        slot.prepared = false;
+    }
 
+    std::unique_ptr<Digitizer> digitizer = std::make_unique<Digitizer>();
+    double binWidth = RBW/1e6; // MHz
+    digitizer->bandOffset = std::round(bandOffset/binWidth)*binWidth;
+    digitizer->affinityMask = affinityMask;
+
+    const AcquisitionParameters& primary = alazarCard->acquisitionParams;
+    source->setAcquisitionParameters(primary.sampleRate, primary.samplesPerAcquisition, maxSpectraPerAcquisition, 0.8, 50, 0);
+    source->setCenterFrequency(trueCenterFreq + digitizer->bandOffset);
+    source->setDownConversion(decimationFactor, downconversionOffset);
+    source->setWelch(welchWindow, welchSegments);
+    digitizer->source = std::move(source);
+
+    digitizer->processor.loadProcessingState(dataProcessor);
+
+    int N = spectrumLength();
+    int poolBlocks = max(4, POOL_BUFFER_COUNT / fftwBatchPlanSize);
+    digitizer->dataPool.allocate(poolBlocks, fftwBatchPlanSize * N, poolBufferAllocation);
+    digitizer->FFTPool.allocate(poolBlocks, fftwBatchPlanSize * N, poolBufferAllocation);
+    if (pipelineBackend != nullptr) {
+        digitizer->backend = FFTBackend::create(pipelineBackendType, N, fftwBatchPlanSize, pipelinePlan, pipelineBatchPlan);
+    }
 
-    // Cleanup
-    psgList[PSG_DIFF].onOff(false);
-    psgList[PSG_JPA].onOff(false);
-    psgList[PSG_PROBE].onOff(false);
+    std::cout << "Added digitizer " << std::to_string(digitizers.size() + 1) << " at " << std::to_string(digitizer->bandOffset) << " MHz." << std::endl;
+    digitizers.push_back(std::move(digitizer));
+    tileDecisionSNR();
 }
 
 
 
 /**
- * @brief Saves any data available to the scanRunner to csv files to be plotted later in python.
+ * @brief Adds an ATS card that acquires alongside the primary digitizer, see the other overload.
  * 
+ * @param systemId - System ID of the card
+ * @param boardId - Board ID of the card
+ * @param bandOffset - MHz from the primary digitizer's center frequency to this one's, rounded to whole bins
+ * @param affinityMask - Cores the chain's threads are pinned to, 0 for any
  */
-void ScanRunner::saveData(int dynamicFlag) {
-    // Save the data
-    std::vector<int> outliers = findOutliers(dataProcessor.runningAverage, 50, 4);
+void ScanRunner::addDigitizer(U32 systemId, U32 boardId, double bandOffset, DWORD_PTR affinityMask) {
+    addDigitizer(std::make_unique<ATS>(systemId, boardId), bandOffset, affinityMask);
+}
 
-    std::vector<double> freq(alazarCard.acquisitionParams.samplesPerBuffer);
-    for (int i = 0; i < freq.size(); ++i) {
-        freq[i] = (static_cast<double>(i)-static_cast<double>(alazarCard.acquisitionParams.samplesPerBuffer)/2)
-                    *alazarCard.acquisitionParams.sampleRate/alazarCard.acquisitionParams.samplesPerBuffer/1e6;
-    }
 
-    saveVector(freq, "../../../plotting/" + savePath + "/freq.csv");
-    saveVector(outliers, "../../../plotting/" + savePath + "/outliers.csv");
 
-    dataProcessor.updateBaseline();
-    saveVector(dataProcessor.currentBaseline, "../../../plotting/" + savePath + "/baseline.csv");
-    saveVector(dataProcessor.runningAverage, "../../../plotting/" + savePath + "/runningAverage.csv");
+/**
+ * @brief Pins the threads of one digitizer's chain to a set of cores from the next acquisition on.
+ * 
+ * @param digitizer - 0 for the primary digitizer, the order of addDigitizer after it
+ * @param affinityMask - Cores the chain's threads are pinned to, 0 for any
+ */
+void ScanRunner::pinDigitizer(int digitizer, DWORD_PTR affinityMask) {
+    if (digitizer < 0 || digitizer >= digitizerCount()) {
+        throw std::runtime_error("Error: No digitizer " + std::to_string(digitizer) + "\n");
+    }
 
-    saveSpectrum(savedData.rawSpectra[0], "../../../plotting/" + savePath + "/rawSpectrum.csv");
+    waitForProcessing();
+    for (StepSlot& slot : stepSlots) {
+        slot.pipeline.clear();
+    }
 
+    if (digitizer == 0) {
+        primaryAffinityMask = affinityMask;
+    }
+    else {
+        digitizers[digitizer - 1]->affinityMask = affinityMask;
+    }
+}
 
-    Spectrum processedSpectrum, foo;
-    std::tie(processedSpectrum, foo) = dataProcessor.rawToProcessed(savedData.rawSpectra[0]);
-    trimSpectrum(processedSpectrum, 0.1);
-    saveSpectrum(processedSpectrum, "../../../plotting/" + savePath + "/processedSpectrum.csv");
 
 
-    dataProcessor.trimSNRtoMatch(processedSpectrum);
-    Spectrum rescaledSpectrum = dataProcessor.processedToRescaled(processedSpectrum);
+/**
+ * @brief Sets the cores, priority and MMCSS task of the pipeline threads by role from the next acquisition on. A persistent streaming
+ *        session is stopped so it restarts with the new placement. Late buffers and overruns of every step are recorded as the LATE_BUFFERS 
+ *        and ACQUISITION_OVERRUNS metrics, to compare placements by.
+ * 
+ * @param placement - Placement of the pipeline threads, e.g. ThreadPlacement::isolated() or one loaded from the deployment's file
+ */
+void ScanRunner::setThreadPlacement(const ThreadPlacement& placement) {
+    waitForProcessing();
+    alazarCard->stopStreamingSession();
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->stopStreamingSession();
+    }
 
+    threadPlacement = placement;
+    threadPlacement.print();
+}
 
-    saveCombinedSpectrum(savedData.combinedSpectrum, "../../../plotting/" + savePath + "/combinedSpectrum.csv");
-    saveSpectrum(bayesFactors.exclusionLine, "../../../plotting/" + savePath + "/exclusionLine.csv");
 
-    std::string exclusionLineFilename = "../../../plotting/" + exclusionPath + "/data/exclusionLine_";
-    std::string scanInfoFilename = "../../../plotting/" + exclusionPath + "/metrics/scanInfo_";
 
-    if (dynamicFlag){
-        exclusionLineFilename += "dynamic_";
-        scanInfoFilename += "dynamic_";
+/**
+ * @brief Tiles the decision agent's SNR over the bands of every digitizer, so it covers the merged spectra of a step. Where bands overlap
+ *        the lower band's SNR is kept.
+ * 
+ */
+void ScanRunner::tileDecisionSNR() {
+    std::vector<double> offsets = {0};
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        offsets.push_back(digitizer->bandOffset);
     }
+    std::sort(offsets.begin(), offsets.end());
+
+    const Spectrum& SNR = dataProcessor.SNR;
+    Spectrum tiled;
+    std::vector<double> axis;
+    tiled.trueCenterFreq = SNR.trueCenterFreq;
+    for (double offset : offsets) {
+        for (size_t i = 0; i < SNR.powers.size(); i++) {
+            double freq = SNR.freqAxis[i] + offset;
+            if (axis.empty() || freq > axis.back()) {
+                axis.push_back(freq);
+                tiled.powers.push_back(SNR.powers[i]);
+            }
+        }
+    }
+    tiled.freqAxis = axis;
 
-    exclusionLineFilename += getDateTimeString() + ".csv";
-    scanInfoFilename += getDateTimeString() + ".csv";
-
-    saveSpectrum(bayesFactors.exclusionLine, exclusionLineFilename);
-    saveVector(getMetric(ACQUIRED_SPECTRA), scanInfoFilename);
-    // Add in scan info saving
+    decisionAgent.SNR = tiled;
+    decisionAgent.SNRprofile = SNRProfile();
 }
 
 
-void ScanRunner::refreshBaselineAndBadBins(int repeats, int subSpectra, int savePlots) {
-    // Acquire some data
-    acquireProcCalibration(repeats, subSpectra, savePlots);
-
-    // Cleanup and saving
-    saveVector(dataProcessor.currentBaseline, "baseline.csv");
-    saveVector(dataProcessor.badBins, "badBins.csv");
-
-
-    if (savePlots){
-        std::vector<double> freq(alazarCard.acquisitionParams.samplesPerBuffer);
-        for (int i = 0; i < freq.size(); ++i) {
-            freq[i] = (static_cast<double>(i)-static_cast<double>(alazarCard.acquisitionParams.samplesPerBuffer)/2)
-                        *alazarCard.acquisitionParams.sampleRate/alazarCard.acquisitionParams.samplesPerBuffer/1e6;
-        }
 
-        saveVector(freq, "../../../plotting/baselineTests/baseline/freq.csv");
-        saveVector(dataProcessor.badBins, "../../../plotting/baselineTests/baseline/outliers.csv");
+/**
+ * @brief Frequency of every bin of the pipeline's spectra, in MHz from the receiver frequency.
+ * 
+ */
+std::vector<double> ScanRunner::spectrumFrequencies() const {
+    const AcquisitionParameters& params = alazarCard->acquisitionParams;
+    int N = spectrumLength();
 
-        saveVector(dataProcessor.currentBaseline, "../../../plotting/baselineTests/baseline/baseline.csv");
-        saveVector(dataProcessor.runningAverage, "../../../plotting/baselineTests/baseline/runningAverage.csv");
+    std::vector<double> freq(N);
+    for (int i = 0; i < N; ++i) {
+        freq[i] = (static_cast<double>(i) - static_cast<double>(N)/2)*params.sampleRate/params.samplesPerBuffer/1e6 + downconversionOffset;
     }
-
-    dataProcessor.resetBaselining();
+    return freq;
 }
 
 
-void ScanRunner::acquireProcCalibration(int repeats, int subSpectra, int savePlots) {
-    // Turn on PSGs
-    // psgList[PSG_DIFF].onOff(true); // Temporarily turned off for cavity only operation
-    psgList[PSG_JPA].onOff(true);
 
+/**
+ * @brief Downconverts every digitizer's samples to the band of interest ahead of the FFT: mixed down by offsetMHz, low-pass filtered and
+ *        decimated (see DownConverter), so every spectrum has samplesPerBuffer/decimation bins of the same width centered offsetMHz from the
+ *        receiver frequency. The FFT plans, pools and backends are rebuilt for the shorter spectra, and the SNR, baseline and bad bins are
+ *        reloaded and narrowed to the band. The baseline doesn't include the downconversion filter yet, so run refreshBaselineAndBadBins after.
+ * 
+ * @param decimation - raw samples per FFT sample, 1 turns the downconversion off
+ * @param offsetMHz - center of the band relative to the receiver frequency, rounded to whole bins
+ */
+void ScanRunner::setDownConversion(int decimation, double offsetMHz) {
+    waitForProcessing();
+    if (scanStepIndex > 0) {
+        throw std::runtime_error("Error: The downconversion can only be changed before the scan starts\n");
+    }
 
-    // Acquire the data
-    std::vector<std::vector<double>> fullRawData;
+    const AcquisitionParameters& params = alazarCard->acquisitionParams;
+    decimation = max(decimation, 1);
+    if (params.samplesPerBuffer % (U32)decimation != 0) {
+        throw std::runtime_error("Error: Buffers of " + std::to_string(params.samplesPerBuffer) + " samples can't be decimated by " + 
+                                 std::to_string(decimation) + "\n");
+    }
 
-    for (int i = 0; i < repeats; i++){
-        fftw_complex* rawStream = alazarCard.AcquireData();
-        std::vector<std::vector<double>> rawData = dataProcessor.acquiredToRaw(rawStream, 
-                                                                            alazarCard.acquisitionParams.buffersPerAcquisition, 
-                                                                            alazarCard.acquisitionParams.samplesPerBuffer, 
-                                                                            fftwPlan);
-        fftw_free(rawStream);
+    // The band must lie inside the digitized span, bin for bin
+    double binWidth = RBW/1e6; // MHz
+    long long offsetBins = (decimation > 1) ? std::llround(offsetMHz/binWidth) : 0;
+    long long fullBins = (long long)params.samplesPerBuffer;
+    long long bandBins = fullBins/decimation;
+    long long firstBin = fullBins/2 + offsetBins - bandBins/2;
+    if (firstBin < 0 || firstBin + bandBins > fullBins) {
+        throw std::runtime_error("Error: Band of " + std::to_string(bandBins*binWidth) + " MHz at " + std::to_string(offsetBins*binWidth) + 
+                                 " MHz reaches past the digitized span\n");
+    }
 
-        for (std::vector<double> data : rawData){
-            fullRawData.push_back(data);
-        }
+    // The chains and their sessions are rebuilt for the new spectrum length on the next acquisition
+    alazarCard->stopStreamingSession();
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->stopStreamingSession();
+    }
+    for (StepSlot& slot : stepSlots) {
+        slot.pipeline.clear();
+        slot.prepared = false;
     }
 
-    std::vector<std::vector<double>> averagedRawData;
-    for (int i=0; i < std::floor(fullRawData.size()/subSpectra); i++){
-        std::vector<double> averagedSpectrum = averageVectors(std::vector<std::vector<double>>(fullRawData.begin()+i*subSpectra, fullRawData.begin()+(i+1)*subSpectra));
-        averagedRawData.push_back(averagedSpectrum);
+    decimationFactor = decimation;
+    downconversionOffset = offsetBins*binWidth;
+    alazarCard->setDownConversion(decimationFactor, downconversionOffset);
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->setDownConversion(decimationFactor, downconversionOffset);
     }
 
-    // Turn off PSGs
-    psgList[PSG_DIFF].onOff(false);
-    psgList[PSG_JPA].onOff(false);
-    
-    if(savePlots) {
-        saveVector(averagedRawData[0], "../../../plotting/baselineTests/baseline/rawData.csv");
+    // SNR, baseline and bad bins are stored for the full span
+    dataProcessor.badBins.clear();
+    loadProcessorFiles();
+    dataProcessor.selectBand((size_t)firstBin, (size_t)bandBins);
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->processor.loadProcessingState(dataProcessor);
+    }
+    tileDecisionSNR();
+
+    initFFTW();
+
+    std::cout << "Downconverting by " << std::to_string(decimationFactor) << " to " << std::to_string(bandBins*binWidth) << " MHz at "
+              << std::to_string(downconversionOffset) << " MHz." << std::endl;
+}
+
+
+
+/**
+ * @brief Turns the FFT stage into a Welch PSD estimate: every buffer delivers 1/(1 - overlap) windowed segments of the contiguous sample
+ *        stream (see WelchSegmenter), and the averaging stages average as many more segments per spectrum, so an averaged spectrum keeps its
+ *        live time and power scale while neighbouring bins leak far less into each other. The first buffer of a step has no previous one,
+ *        so a step of B buffers gives 1 + (B - 1)/(1 - overlap) segments.
+ * 
+ * @param window - WELCH_WINDOW_* of the segments. WELCH_WINDOW_RECTANGULAR with no overlap delivers the buffers as they are
+ * @param overlap - fraction of a segment shared with the next one: 0, 0.5 or 0.75
+ */
+void ScanRunner::setWelch(int window, double overlap) {
+    if (window != WELCH_WINDOW_RECTANGULAR && window != WELCH_WINDOW_HANN && window != WELCH_WINDOW_BLACKMAN_HARRIS) {
+        throw std::runtime_error("Error: Unknown Welch window " + std::to_string(window) + "\n");
+    }
+    if (overlap < 0 || overlap >= 1) {
+        throw std::runtime_error("Error: Welch overlap " + std::to_string(overlap) + " must be in [0, 1)\n");
+    }
+    int segments = (int)std::lround(1/(1 - overlap));
+    if (std::abs(1/(1 - overlap) - segments) > 1e-9 || spectrumLength() % segments != 0) {
+        throw std::runtime_error("Error: Welch overlap " + std::to_string(overlap) + " doesn't split spectra of " + std::to_string(spectrumLength()) + 
+                                 " samples into whole hops\n");
+    }
+    waitForProcessing();
+
+    welchWindow = window;
+    welchSegments = segments;
+    alazarCard->setWelch(welchWindow, welchSegments);
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->setWelch(welchWindow, welchSegments);
+    }
+}
+
+
+
+/**
+ * @brief Changes the integration horizon, resolution bandwidth and averaging in place, so another configuration can be tried without
+ *        rebuilding the runner. The PSG sessions, the open digitizers, the calibration and the FFT plans of lengths planned before are kept;
+ *        only the acquisition parameters are set again, and the batched plan and buffer pools are resized by the next acquisition. A new
+ *        RBW changes the spectrum length, so it is only allowed before the scan starts and without downconversion, and it drops the baseline
+ *        and bad bins taken at the old one. Run refreshBaselineAndBadBins after.
+ * 
+ * @param maxIntegrationTime - longest acquisition of a step, s
+ * @param RBW - resolution bandwidth, Hz. Must split the sample rate into whole spectra
+ * @param subSpectraAveragingNumber - sub-spectra per averaged spectrum
+ */
+void ScanRunner::reconfigure(double maxIntegrationTime, double RBW, int subSpectraAveragingNumber) {
+    if (maxIntegrationTime <= 0 || RBW <= 0 || subSpectraAveragingNumber < 1) {
+        throw std::runtime_error("Error: Reconfiguring needs a positive integration time, RBW and averaging number\n");
+    }
+    int maxSpectra = (int)(maxIntegrationTime*RBW);
+    if (maxSpectra < 1) {
+        throw std::runtime_error("Error: An integration time of " + std::to_string(maxIntegrationTime) + " s holds no spectrum at " +
+                                 std::to_string(RBW) + " Hz\n");
+    }
+
+    bool resolutionChanged = RBW != this->RBW;
+    if (resolutionChanged) {
+        double samplesPerSpectrum = sampleRate/RBW;
+        if (scanStepIndex > 0 || decimationFactor > 1) {
+            throw std::runtime_error("Error: The RBW can only be changed before the scan starts and without downconversion\n");
+        }
+        if (std::abs(samplesPerSpectrum - std::round(samplesPerSpectrum)) > 1e-9 || std::llround(samplesPerSpectrum) % welchSegments != 0) {
+            throw std::runtime_error("Error: An RBW of " + std::to_string(RBW) + " Hz doesn't split the sample rate into whole spectra of " +
+                                     std::to_string(welchSegments) + " Welch hops\n");
+        }
+    }
+    waitForProcessing();
+
+    // The chains and their sessions are rebuilt for the new buffers on the next acquisition
+    alazarCard->stopStreamingSession();
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->stopStreamingSession();
+    }
+    for (StepSlot& slot : stepSlots) {
+        slot.pipeline.clear();
+        slot.prepared = false;
+    }
+
+    this->RBW = RBW;
+    this->subSpectraAveragingNumber = subSpectraAveragingNumber;
+    maxSpectraPerAcquisition = maxSpectra;
+    initAlazarCard();
+    const AcquisitionParameters& primary = alazarCard->acquisitionParams;
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->setAcquisitionParameters(primary.sampleRate, primary.samplesPerAcquisition, maxSpectraPerAcquisition, 0.8, 50, 0);
+    }
+
+    if (resolutionChanged) {
+        selectSpectrumPlan();
+
+        // Bins of the old resolution mean nothing at the new one
+        dataProcessor.resetBaselining();
+        dataProcessor.badBins.clear();
+        storedBaseline.clear();
+        for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+            digitizer->processor.loadProcessingState(dataProcessor);
+        }
+        std::cout << "Warning: The baseline and bad bins were taken at the old RBW, run refreshBaselineAndBadBins." << std::endl;
+    }
+
+    std::cout << "Reconfigured to " << std::to_string(maxSpectraPerAcquisition) << " spectra per acquisition of " << std::to_string(spectrumLength())
+              << " bins at " << std::to_string(this->RBW) << " Hz, averaging " << std::to_string(subSpectraAveragingNumber) << "." << std::endl;
+}
+
+
+
+/**
+ * @brief Keeps the baseline following drift during the scan without stopping it for refreshBaselineAndBadBins. A BaselineRefresher
+ *        recomputes the baseline from the sub-spectra averaged into the running average every interval, and every chain swaps it in between
+ *        spectra. Restarts the refresher with the new settings if one is running.
+ * 
+ * @param intervalSeconds - time between refreshes
+ * @param minSpectra - fewest new sub-spectra a refresh averages, fewer defer it to the next interval
+ */
+void ScanRunner::startBaselineRefresh(double intervalSeconds, int minSpectra) {
+    if (intervalSeconds <= 0) {
+        throw std::runtime_error("Error: Baseline refresh interval " + std::to_string(intervalSeconds) + " s must be positive\n");
+    }
+    waitForProcessing();
+    stopBaselineRefresh();
+
+    baselineRefresher = std::make_unique<BaselineRefresher>(dataProcessor, intervalSeconds, minSpectra);
+    dataProcessor.baselineRefresher = baselineRefresher.get();
+    dataProcessor.baselineVersion = 0;
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->processor.baselineRefresher = baselineRefresher.get();
+        digitizer->processor.baselineVersion = 0;
+    }
+    baselineRefresher->start();
+}
+
+
+
+/**
+ * @brief Stops the background baseline refresh. The chains keep the last baseline they picked up.
+ * 
+ */
+void ScanRunner::stopBaselineRefresh() {
+    if (baselineRefresher == nullptr) {
+        return;
+    }
+    waitForProcessing();
+
+    dataProcessor.baselineRefresher = nullptr;
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->processor.baselineRefresher = nullptr;
+    }
+    baselineRefresher.reset();
+}
+
+
+
+/**
+ * @brief Waits for the processing tail of one step, then saves its progress, reports performance and recovers from any error it raised.
+ * 
+ * @param slot - Step slot to finish. Its Pipeline must be persistent or already joined
+ */
+void ScanRunner::finishStep(StepSlot& slot) {
+    TraceSpan span("Finish step", TRACE_SCAN, slot.stepIndex);
+    if (slot.pipeline.persistent()) {
+        slot.pipeline.endStep();
+    }
+    slot.inFlight = false;
+
+    #if SAVE_PROGRESS
+    std::string exclusionLineFilename = "../../../plotting/" + exclusionPath + "/scanProgress/exclusionLine_" + getDateTimeString() + ".csv";
+    saveExclusionLineDeltas(slot.savedData.exclusionLineQueue, exclusionLineFilename);
+    #endif
+
+    slot.queueGauges.sample();
+    #if TRACK_ALLOCATIONS
+    recordStepAllocations();
+    #endif
+    reportPerformance();
+
+    // The combined spectrum of the scan is only built for the telemetry when its channel is due, from the pyramid level that fits the channel
+    if (telemetry != nullptr) {
+        telemetry->publishMetrics();
+        if (telemetry->due(TELEMETRY_COMBINED_SPECTRUM)) {
+            std::lock_guard<std::mutex> lock(savedData.mutex);
+            if (!savedData.combinedSpectrum.empty()) {
+                telemetry->publishSpectrum(TELEMETRY_COMBINED_SPECTRUM, savedData.combinedSpectrum.zoomedSpectrum(-INFINITY, INFINITY, TELEMETRY_MAX_VALUES));
+            }
+        }
+    }
+
+
+    // Error recovery for when the threads don't finish properly. The backup queue still holds the most recent buffers at this point
+    if (slot.syncFlags.errorFlag) {
+        std::cout << "Error flag set (" << slot.syncFlags.errorMessage << "). " << std::to_string(slot.dataBasic.backupDataQueue.size()) 
+                  << " backup buffers retained. Recovering..." << std::endl;
+    }
+
+    std::cout << "Emptying backupDataQueue" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(slot.dataBasic.mutex);
+        trimBackupQueue(slot.dataBasic, 0);
+    }
+    for (std::unique_ptr<DigitizerStepData>& data : slot.digitizerData) {
+        std::lock_guard<std::mutex> lock(data->dataBasic.mutex);
+        trimBackupQueue(data->dataBasic, 0);
+    }
+}
+
+
+
+/**
+ * @brief Finishes the processing tail of every step still in flight, oldest first, and applies any step() sizes that followed the last
+ *        acquisition to bayesFactors. Only needed with pipelinedScan, and called by every method that reads the results.
+ * 
+ */
+void ScanRunner::waitForProcessing() {
+    StepSlot* oldestFirst[2] = { &stepSlots[0], &stepSlots[1] };
+    if (oldestFirst[1]->stepIndex < oldestFirst[0]->stepIndex) {
+        std::swap(oldestFirst[0], oldestFirst[1]);
+    }
+
+    bool finishedAny = false;
+    for (StepSlot* slot : oldestFirst) {
+        if (slot->inFlight) {
+            finishStep(*slot);
+            finishedAny = true;
+        }
+    }
+
+    // No decisions are left to make on the old frequencies
+    if (pendingStepSize != 0) {
+        bayesFactors.step(pendingStepSize);
+        pendingStepSize = 0;
+    }
+
+    // Only a pipelined scan can have finished a step here. Its state is only consistent with nothing in flight, so it is checkpointed now
+    if (finishedAny) {
+        checkpointScan();
+    }
+
+    // PSGs stay on between pipelined steps
+    if (finishedAny) {
+        settleInstruments();
+        psgList[PSG_DIFF].onOff(false);
+        psgList[PSG_JPA].onOff(false);
+        psgList[PSG_PROBE].onOff(false);
+    }
+}
+
+
+
+void ScanRunner::unrolledAcquisition() {
+    waitForProcessing();
+
+    // Turn on PSGs
+    settleInstruments();
+    // psgList[PSG_DIFF].onOff(true); // Temporarily turned off for cavity only operation
+    psgList[PSG_JPA].onOff(true);
+
+
+    // Set up shared data
+    SharedDataBasic sharedDataBasic;
+    SharedDataProcessing sharedDataProc;
+    SharedDataSaving sharedSavedData;
+    SynchronizationFlags syncFlags;
+
+    sharedDataBasic.samplesPerBuffer = spectrumLength();
+    dataProcessor.prepareBinRepair(sharedDataBasic.samplesPerBuffer);
+    sharedSavedData.decisionCapture = (decisionStream != nullptr) ? decisionStream->addStep(trueCenterFreq, subSpectraAveragingNumber/RBW) : nullptr;
+
+    if (batchedFFTStale()) {
+        initBatchedFFTW();
     }
+    sharedDataBasic.spectraPerBlock = fftwBatchPlanSize;
+
+    // Each stage runs to completion before the next starts, so every ring must hold the whole acquisition
+    initPipelineRings(sharedDataBasic, sharedDataProc, syncFlags, 1, max((size_t)PIPELINE_RING_CAPACITY, (size_t)alazarCard->acquisitionParams.buffersPerAcquisition*welchSegments), 
+                      ringWaitStrategy);
+
+
+    sharedDataProc.backpressurePolicy = backpressurePolicy;
+    sharedDataProc.spillDepth = spillDepth;
+    sharedDataProc.diagnostics = !productionMode;
+
+    // Run the stages one at a time
+    Pipeline pipeline;
+    buildPipeline(pipeline, sharedDataBasic, sharedDataProc, sharedSavedData, syncFlags, 1, 1, false);
+    pipeline.runSequentially();
+
+
+    // Cleanup
+    psgList[PSG_DIFF].onOff(false);
+    psgList[PSG_JPA].onOff(false);
+    psgList[PSG_PROBE].onOff(false);
+
+    trimBackupQueue(sharedDataBasic, 0);
+}
+
+
 
+/**
+ * @brief Adds the acquisition, FFT workers and processing stages of one step to a pipeline, in data flow order. The stages of every extra
+ *        digitizer's chain follow the primary digitizer's, ahead of the merge and decision stages.
+ * 
+ * @param pipeline - Pipeline to add the threads to
+ * @param sharedDataBasic - Data shared between the acquisition and FFT stages. Rings must be set up by initPipelineRings
+ * @param sharedDataProc - Data shared between the processing stages
+ * @param sharedSavedData - Data shared with the saving thread
+ * @param syncFlags - Synchronization flags shared between all stages
+ * @param numFFTWorkers - Number of FFTThread workers, must match the ring setup
+ * @param numProcessingWorkers - Number of processingWorker threads, must match the ring setup. 1 runs processingThread instead
+ * @param fused - Use accumulationThread in place of magnitudeThread + averagingThread. Device FFT backends always fuse, see transformAccumulationThread
+ * @param orderedSlot - Step slot the pipeline belongs to. If set, every stage after the acquisition waits for the same stage of the previous
+ *                      step (see StepSequencer) and the slot's center frequency and deferred BayesFactors step are used
+ * @param digitizerData - Shared data of the chains of the extra digitizers, one per entry of digitizers. If any, each digitizer gets its own
+ *                        acquisition, FFT, averaging and digitizerProcessingThread stages, and digitizerMergeThread feeds the decision stage
+ */
+void ScanRunner::buildPipeline(Pipeline& pipeline, SharedDataBasic& sharedDataBasic, SharedDataProcessing& sharedDataProc, SharedDataSaving& sharedSavedData, 
+                               SynchronizationFlags& syncFlags, int numFFTWorkers, int numProcessingWorkers, bool fused, StepSlot* orderedSlot,
+                               std::vector<std::unique_ptr<DigitizerStepData>>* digitizerData) {
+    // Stages after the acquisition take their turn in step order. The workers of a multi-worker stage (firstTurn, numTurns) wait for every worker
+    // of that stage in the previous step, so the previous step's workers never compete with the new step's for pool buffers. The turn is
+    // released even if the body throws
+    auto addStage = [this, &pipeline, orderedSlot](std::string name, std::function<void()> body, size_t firstTurn = SIZE_MAX, size_t numTurns = 1) {
+        size_t index = pipeline.size();
+        if (orderedSlot == nullptr || index == 0) {
+            pipeline.add(name, body);
+            return;
+        }
+        if (firstTurn == SIZE_MAX) {
+            firstTurn = index;
+        }
+
+        pipeline.add(name, [this, orderedSlot, index, firstTurn, numTurns, body]() {
+            int stepIndex = orderedSlot->stepIndex;
+            for (size_t turn = firstTurn; turn < firstTurn + numTurns; turn++) {
+                stepSequencer.waitForTurn(turn, stepIndex);
+            }
+            try {
+                body();
+            }
+            catch (...) {
+                stepSequencer.finishTurn(index, stepIndex);
+                throw;
+            }
+            stepSequencer.finishTurn(index, stepIndex);
+        });
+    };
+
+    // Bodies read the plans, spectrum length and center frequency when they run, so a persistent pipeline picks up changes made between steps.
+    // An overlapped step may start its stages after step() has moved on, so it uses the center frequency recorded in its slot
+    auto centerFreq = [this, orderedSlot]() { return (orderedSlot != nullptr) ? orderedSlot->centerFreq : trueCenterFreq; };
+
+    // Tells a pipelined acquireData that it no longer needs to wait for a stop forecast
+    auto endAcquisition = [this, orderedSlot]() {
+        if (orderedSlot != nullptr) {
+            {
+                std::lock_guard<std::mutex> lock(forecastMutex);
+                orderedSlot->acquisitionEnded = true;
+            }
+            forecastCondition.notify_all();
+        }
+    };
+
+    // Every thread takes the threadPlacement of its role while its body runs. A pinned digitizer's chain stays on the chain's cores
+    auto placed = [this](int role, DWORD_PTR chainMask, std::function<void()> body) -> std::function<void()> {
+        return [this, role, chainMask, body]() {
+            ThreadPlacementScope placement(threadPlacement, role, chainMask);
+            body();
+        };
+    };
+
+    // FFT workers and averaging of one digitizer's chain, from its data rings to its raw data ring. Every chain shares the FFT plans.
+    // A device backend transforms and averages the whole chain in one stage. The body looks the backend up when it runs, since
+    // initBatchedFFTW remakes it
+    auto addFrontEnd = [&](const std::string& prefix, SharedDataBasic& chainBasic, SharedDataProcessing& chainProc, SynchronizationFlags& chainFlags,
+                           DataProcessor& chainProcessor, double bandOffset, DWORD_PTR affinityMask, std::unique_ptr<FFTBackend>& chainBackend) {
+        if (fftBackend != FFT_BACKEND_FFTW) {
+            addStage(prefix + "Transform accumulation thread", placed(THREAD_ROLE_FFT, affinityMask, [this, centerFreq, bandOffset, &chainBasic, &chainProc, &chainFlags, 
+                                                                                                       &chainProcessor, &chainBackend]() { 
+                transformAccumulationThread(*chainBackend, chainBasic.samplesPerBuffer, chainBasic, chainProc, chainFlags, chainProcessor, 
+                                            centerFreq() + bandOffset, segmentsPerAverage()); 
+            }));
+            return;
+        }
+
+        size_t firstFFTWorker = pipeline.size();
+        for (int i = 0; i < numFFTWorkers; i++) {
+            addStage(prefix + "FFT thread " + std::to_string(i), placed(THREAD_ROLE_FFT, affinityMask, [this, i, &chainBasic, &chainFlags]() { 
+                FFTThread(pipelinePlan, pipelineBatchPlan, chainBasic.samplesPerBuffer, chainBasic, chainFlags, i); 
+            }), firstFFTWorker, numFFTWorkers);
+        }
 
-    // Get data ready to find badBins
-    std::vector<double> freq(alazarCard.acquisitionParams.samplesPerBuffer);
-    for (int i = 0; i < freq.size(); ++i) {
-        freq[i] = (static_cast<double>(i)-static_cast<double>(alazarCard.acquisitionParams.samplesPerBuffer)/2)
-                    *alazarCard.acquisitionParams.sampleRate/alazarCard.acquisitionParams.samplesPerBuffer/1e6;
+        // The fused stage replaces the separate magnitude and averaging threads
+        if (fused) {
+            addStage(prefix + "Accumulation thread", placed(THREAD_ROLE_COMPUTE, affinityMask, [this, centerFreq, bandOffset, &chainBasic, &chainProc, &chainFlags, &chainProcessor]() { 
+                accumulationThread(chainBasic.samplesPerBuffer, chainBasic, chainProc, chainFlags, chainProcessor, centerFreq() + bandOffset, 
+                                   segmentsPerAverage()); 
+            }));
+        }
+        else {
+            addStage(prefix + "Magnitude thread", placed(THREAD_ROLE_COMPUTE, affinityMask, [this, &chainBasic, &chainProc, &chainFlags, &chainProcessor]() { 
+                magnitudeThread(chainBasic.samplesPerBuffer, chainBasic, chainProc, chainFlags, chainProcessor); 
+            }));
+            addStage(prefix + "Averaging thread", placed(THREAD_ROLE_COMPUTE, affinityMask, [this, centerFreq, bandOffset, &chainProc, &chainFlags, &chainProcessor]() { 
+                averagingThread(chainProc, chainFlags, chainProcessor, centerFreq() + bandOffset, segmentsPerAverage()); 
+            }));
+        }
+    };
+
+    if (orderedSlot != nullptr) {
+        orderedSlot->acquisitionBodies = { 0 };
     }
+    addStage("Acquisition thread", placed(THREAD_ROLE_ACQUISITION, primaryAffinityMask, [this, endAcquisition, &sharedDataBasic, &syncFlags]() { 
+        try {
+            alazarCard->AcquireDataMultithreadedContinuous(sharedDataBasic, syncFlags); 
+        }
+        catch (...) {
+            endAcquisition();
+            throw;
+        }
+        endAcquisition();
+    }));
+    addFrontEnd("", sharedDataBasic, sharedDataProc, syncFlags, dataProcessor, 0, primaryAffinityMask, pipelineBackend);
+
+    // With several digitizers every chain processes its own spectra, and the merge stage combines them for the decision stage
+    if (digitizerData != nullptr && !digitizerData->empty()) {
+        std::vector<SharedDataProcessing*> mergeInputs = { &sharedDataProc };
+        addStage("Digitizer 0 Processing thread", placed(THREAD_ROLE_COMPUTE, primaryAffinityMask, [this, &sharedDataProc, &syncFlags]() { 
+            digitizerProcessingThread(sharedDataProc, savedData, syncFlags, dataProcessor, true); 
+        }));
+
+        for (size_t d = 0; d < digitizerData->size(); d++) {
+            Digitizer& digitizer = *digitizers[d];
+            DigitizerStepData& data = *(*digitizerData)[d];
+            std::string prefix = "Digitizer " + std::to_string(d + 1) + " ";
+
+            if (orderedSlot != nullptr) {
+                orderedSlot->acquisitionBodies.push_back(pipeline.size());
+            }
+            addStage(prefix + "Acquisition thread", placed(THREAD_ROLE_ACQUISITION, digitizer.affinityMask, [&digitizer, &data]() { 
+                digitizer.source->AcquireDataMultithreadedContinuous(data.dataBasic, data.syncFlags); 
+            }));
+            addFrontEnd(prefix, data.dataBasic, data.dataProc, data.syncFlags, digitizer.processor, digitizer.bandOffset, digitizer.affinityMask, digitizer.backend);
+            addStage(prefix + "Processing thread", placed(THREAD_ROLE_COMPUTE, digitizer.affinityMask, [this, &digitizer, &data]() { 
+                digitizerProcessingThread(data.dataProc, savedData, data.syncFlags, digitizer.processor, false); 
+            }));
+
+            mergeInputs.push_back(&data.dataProc);
+        }
 
-    dataProcessor.badBins = findOutliers(averageVectors(averagedRawData), 25, 5);
-    for (int i = 0; i < averagedRawData.size(); ++i) {
-        std::vector<double> cleanedRawData = dataProcessor.removeBadBins(averagedRawData[i]);
-        dataProcessor.addRawSpectrumToRunningAverage(cleanedRawData);
+        addStage("Digitizer merge thread", placed(THREAD_ROLE_COMPUTE, 0, [mergeInputs, &sharedDataProc, &syncFlags]() { 
+            digitizerMergeThread(mergeInputs, sharedDataProc, syncFlags); 
+        }));
+    }
+    // The workers of the previous step must have merged all of their spectra before any worker of this step can
+    else if (numProcessingWorkers > 1) {
+        size_t firstProcessingWorker = pipeline.size();
+        for (int i = 0; i < numProcessingWorkers; i++) {
+            addStage("Processing worker " + std::to_string(i), placed(THREAD_ROLE_COMPUTE, 0, [this, i, &sharedDataProc, &syncFlags]() { 
+                processingWorker(sharedDataProc, savedData, syncFlags, dataProcessor, i); 
+            }), firstProcessingWorker, numProcessingWorkers);
+        }
     }
+    else {
+        addStage("Processing thread", placed(THREAD_ROLE_COMPUTE, 0, [this, &sharedDataProc, &syncFlags]() { 
+            processingThread(sharedDataProc, savedData, syncFlags, dataProcessor); 
+        }));
+    }
+
+    // The previous step has made all of its decisions by the time this body gets its turn, so its deferred exclusion line shift applies here
+    addStage("Decision thread", placed(THREAD_ROLE_COMPUTE, 0, [this, orderedSlot, &sharedDataProc, &sharedSavedData, &syncFlags]() { 
+        if (orderedSlot != nullptr && orderedSlot->deferredStepSize != 0) {
+            bayesFactors.step(orderedSlot->deferredStepSize);
+            orderedSlot->deferredStepSize = 0;
+        }
+        decisionMakingThread(sharedDataProc, sharedSavedData, syncFlags, bayesFactors, decisionAgent); 
+    }));
+}
+
+
+
+/**
+ * @brief Saves any data available to the scanRunner to csv files to be plotted later in python.
+ * 
+ */
+void ScanRunner::saveData(int dynamicFlag) {
+    waitForProcessing();
+
+    // Save the data
+    std::vector<int> outliers = findOutliers(dataProcessor.runningAverage, 50, 4);
+
+    std::vector<double> freq = spectrumFrequencies();
+
+    saveVector(freq, "../../../plotting/" + savePath + "/freq.csv");
+    saveVector(outliers, "../../../plotting/" + savePath + "/outliers.csv");
 
     dataProcessor.updateBaseline();
-    
+    saveVector(dataProcessor.currentBaseline, "../../../plotting/" + savePath + "/baseline.csv");
+    saveVector(dataProcessor.runningAverage, "../../../plotting/" + savePath + "/runningAverage.csv");
+
+    saveSpectrum(savedData.rawSpectra[0], "../../../plotting/" + savePath + "/rawSpectrum.csv");
 
-    // Do bad bin detection on processed spectra
-    std::vector<std::vector<double>> processedSpectra(averagedRawData.size());
 
-    for (int i = 0; i < averagedRawData.size(); ++i) {
-        Spectrum rawSpectrum;
-        rawSpectrum.powers = averagedRawData[i];
-        rawSpectrum.freqAxis = freq;
+    Spectrum processedSpectrum = dataProcessor.rawToProcessedSpectrum(savedData.rawSpectra[0]);
+    trimSpectrum(processedSpectrum, 0.1);
+    saveSpectrum(processedSpectrum, "../../../plotting/" + savePath + "/processedSpectrum.csv");
 
-        Spectrum processedSpectrum, foo;
-        std::tie(processedSpectrum, foo) = dataProcessor.rawToProcessed(rawSpectrum);
 
-        processedSpectra[i] = processedSpectrum.powers;
+    dataProcessor.trimSNRtoMatch(processedSpectrum);
+    Spectrum rescaledSpectrum = dataProcessor.processedToRescaled(processedSpectrum);
+
+
+    saveCombinedSpectrum(savedData.combinedSpectrum.toCombinedSpectrum(), "../../../plotting/" + savePath + "/combinedSpectrum.csv");
+    saveCombinedSpectrum(savedData.combinedSpectrum.rebinnedSpectrum(), "../../../plotting/" + savePath + "/rebinnedSpectrum.csv");
+    saveSpectrum(bayesFactors.exclusionLine, "../../../plotting/" + savePath + "/exclusionLine.csv");
+
+    std::string exclusionLineFilename = "../../../plotting/" + exclusionPath + "/data/exclusionLine_";
+    std::string scanInfoFilename = "../../../plotting/" + exclusionPath + "/metrics/scanInfo_";
+
+    if (dynamicFlag){
+        exclusionLineFilename += "dynamic_";
+        scanInfoFilename += "dynamic_";
     }
 
-    dataProcessor.badBins = findOutliers(averageVectors(processedSpectra), 25, 5);
+    exclusionLineFilename += getDateTimeString() + ".csv";
+    scanInfoFilename += getDateTimeString() + ".csv";
+
+    saveSpectrum(bayesFactors.exclusionLine, exclusionLineFilename);
+    saveVector(getMetric(ACQUIRED_SPECTRA), scanInfoFilename);
+    // Add in scan info saving
+}
+
 
+void ScanRunner::refreshBaselineAndBadBins(int repeats, int subSpectra, int savePlots) {
+    waitForProcessing();
+
+    // Acquire some data
+    acquireProcCalibration(repeats, subSpectra, savePlots);
+
+    // Cleanup and saving
+    // The store is what the executables load, the CSV files are kept for the plotting scripts
+    publishCalibration();
+    saveVector(dataProcessor.currentBaseline, "baseline.csv", OUTPUT_CSV);
+    saveVector(dataProcessor.badBins, "badBins.csv", OUTPUT_CSV);
+    storedBaseline = dataProcessor.currentBaseline;
+
+
+    if (savePlots){
+        std::vector<double> freq = spectrumFrequencies();
+
+        saveVector(freq, "../../../plotting/baselineTests/baseline/freq.csv");
+        saveVector(dataProcessor.badBins, "../../../plotting/baselineTests/baseline/outliers.csv");
+
+        saveVector(dataProcessor.currentBaseline, "../../../plotting/baselineTests/baseline/baseline.csv");
+        saveVector(dataProcessor.runningAverage, "../../../plotting/baselineTests/baseline/runningAverage.csv");
+    }
 
-    // Use the bad bins to find a clean baseline
     dataProcessor.resetBaselining();
-    for (int i = 0; i < averagedRawData.size(); ++i) {
-        std::vector<double> cleanedRawData = dataProcessor.trimDC(dataProcessor.removeBadBins(averagedRawData[i]));
-        dataProcessor.addRawSpectrumToRunningAverage(cleanedRawData);
+}
+
+
+/**
+ * @brief Finds the bad bins and the baseline from calibration data. The data streams through the acquisition and FFT stages of the science
+ *        pipeline into calibrationThread, which only keeps running means, so memory stays flat however long the calibration is.
+ *        The processed spectra depend on the baseline from the raw average, so the calibration takes two passes of repeats acquisitions:
+ *        the first finds the raw bad bins and a first baseline, the second averages the spectra processed with that baseline to find the
+ *        remaining bad bins. The clean baseline comes from the raw average of both passes.
+ * 
+ * @param repeats - acquisitions per pass
+ * @param subSpectra - sub-spectra per averaged spectrum
+ * @param savePlots - save the first averaged raw spectrum for plotting
+ */
+void ScanRunner::acquireProcCalibration(int repeats, int subSpectra, int savePlots) {
+    // Turn on PSGs
+    settleInstruments();
+    // psgList[PSG_DIFF].onOff(true); // Temporarily turned off for cavity only operation
+    psgList[PSG_JPA].onOff(true);
+
+    CalibrationStatistics calibration;
+    calibration.subSpectraAveragingNumber = max(1, subSpectra)*welchSegments;
+
+
+    // First pass, bad bins and baseline from the raw average
+    acquireCalibrationStatistics(calibration, repeats);
+    if (calibration.rawSpectra == 0) {
+        throw std::runtime_error("Error: Calibration acquired fewer than " + std::to_string(subSpectra) + " sub-spectra.");
+    }
+
+    if(savePlots) {
+        saveVector(calibration.firstRawSpectrum, "../../../plotting/baselineTests/baseline/rawData.csv");
+    }
+
+    dataProcessor.badBins = findOutliers(calibration.rawAverage, 25, 5);
+    dataProcessor.resetBaselining();
+    dataProcessor.addAverageToRunningAverage(dataProcessor.removeBadBins(calibration.rawAverage), calibration.rawSpectra*subSpectra);
+    dataProcessor.updateBaseline();
+
+
+    // Second pass, bad bin detection on processed spectra
+    calibration.processSpectra = true;
+    acquireCalibrationStatistics(calibration, repeats);
+
+    // Turn off PSGs
+    psgList[PSG_DIFF].onOff(false);
+    psgList[PSG_JPA].onOff(false);
+
+    if (calibration.processedSpectra == 0) {
+        throw std::runtime_error("Error: Calibration acquired fewer than " + std::to_string(subSpectra) + " sub-spectra.");
     }
+    dataProcessor.badBins = findOutliers(calibration.processedAverage, 25, 5);
+
+
+    // Use the bad bins to find a clean baseline
+    dataProcessor.resetBaselining();
+    dataProcessor.addAverageToRunningAverage(dataProcessor.trimDC(dataProcessor.removeBadBins(calibration.rawAverage)), calibration.rawSpectra*subSpectra);
     for (int bin : findOutliers(dataProcessor.runningAverage, 50, 4)){
         dataProcessor.badBins.push_back(bin);
     }
@@ -511,11 +1614,364 @@ void ScanRunner::acquireProcCalibration(int repeats, int subSpectra, int savePlo
 }
 
 
+
+/**
+ * @brief Streams repeats acquisitions through the acquisition and FFT stages into calibrationThread, which adds them to the calibration
+ *        statistics.
+ * 
+ * @param calibration - Statistics to add to. Keeps accumulating across calls
+ * @param repeats - number of acquisitions
+ */
+void ScanRunner::acquireCalibrationStatistics(CalibrationStatistics& calibration, int repeats) {
+    int numFFTWorkers = FFTW_THREADED_PLANNER ? 1 : max(1, FFTWorkerCount);
+
+    SharedDataBasic sharedDataBasic;
+    SharedDataProcessing sharedDataProc;
+    SharedDataSaving sharedSavedData;
+    SynchronizationFlags syncFlags;
+
+    sharedDataBasic.samplesPerBuffer = spectrumLength();
+
+    if (batchedFFTStale()) {
+        initBatchedFFTW();
+    }
+    sharedDataBasic.spectraPerBlock = fftwBatchPlanSize;
+
+    // Nothing else is in flight during a calibration
+    dataPool.reset();
+    FFTPool.reset();
+    sharedDataBasic.dataPool = &dataPool;
+    sharedDataBasic.FFTPool = &FFTPool;
+
+    sharedDataBasic.backupPolicy = backupPolicy;
+    sharedDataBasic.backupDepth = backupDepth;
+
+    for (int i = 0; i < repeats; i++) {
+        resetStepData(sharedDataBasic, sharedSavedData, syncFlags);
+        initPipelineRings(sharedDataBasic, sharedDataProc, syncFlags, numFFTWorkers, PIPELINE_RING_CAPACITY, ringWaitStrategy);
+
+        Pipeline pipeline;
+        pipeline.add("Acquisition thread", [this, &sharedDataBasic, &syncFlags]() { 
+            alazarCard->AcquireDataMultithreadedContinuous(sharedDataBasic, syncFlags); 
+        });
+        for (int j = 0; j < numFFTWorkers; j++) {
+            pipeline.add("FFT thread " + std::to_string(j), [this, j, &sharedDataBasic, &syncFlags]() { 
+                FFTThread(pipelinePlan, pipelineBatchPlan, sharedDataBasic.samplesPerBuffer, sharedDataBasic, syncFlags, j); 
+            });
+        }
+        pipeline.add("Calibration thread", [this, &sharedDataBasic, &syncFlags, &calibration]() { 
+            calibrationThread(sharedDataBasic.samplesPerBuffer, sharedDataBasic, syncFlags, dataProcessor, calibration); 
+        });
+
+        pipeline.start();
+        pipeline.join();
+
+        {
+            std::lock_guard<std::mutex> lock(sharedDataBasic.mutex);
+            trimBackupQueue(sharedDataBasic, 0);
+        }
+
+        if (syncFlags.errorFlag) {
+            throw std::runtime_error("Error: Calibration acquisition failed -- " + syncFlags.errorMessage);
+        }
+    }
+}
+
+
+/**
+ * @brief Tells the exclusion line how far the scan will step, so its grid is allocated once for the whole scan.
+ * 
+ * @param stepSize - size of each step in MHz
+ * @param numSteps - number of steps the scan will take
+ */
+void ScanRunner::planScan(double stepSize, int numSteps) {
+    bayesFactors.reserveScan(stepSize, numSteps);
+}
+
+
+
+/**
+ * @brief Scans the band of planner, starting on its first window at the current center frequency, stepping to whichever window the planner
+ *        expects the most exclusion per second from after each step, backward moves included. The planner needs each step's decisions
+ *        before it picks the next window, so a pipelined scan waits for every step's processing before stepping.
+ * 
+ * @param planner - plan of the scan, fresh or carried over from an earlier call
+ * @param maxSteps - most steps to acquire, the scan ends earlier once no window is expected to gain anything
+ * @return int - steps acquired
+ */
+int ScanRunner::runPlannedScan(ScanPlanner& planner, int maxSteps) {
+    waitForProcessing();
+    planScan(planner.stepSize, planner.windows() - 1);
+
+    int steps = 0;
+    while (steps < maxSteps) {
+        planner.beginStep(bayesFactors);
+        auto stepStart = std::chrono::steady_clock::now();
+        acquireData();
+        waitForProcessing();
+        std::chrono::duration<double> stepTime = std::chrono::steady_clock::now() - stepStart;
+        planner.endStep(bayesFactors, stepTime.count());
+        if (++steps >= maxSteps) {
+            break;
+        }
+
+        int window = planner.window();
+        int next = planner.nextWindow();
+        if (next < 0) {
+            break;
+        }
+        std::cout << "Planned step " << std::to_string(steps) << ": window " << std::to_string(window) << " -> " << std::to_string(next) 
+                  << ", " << std::to_string(100*planner.excludedFraction(bayesFactors)) << "% of the band excluded" << std::endl;
+        step((next - window)*planner.stepSize);
+    }
+
+    std::cout << "Planned scan finished after " << std::to_string(steps) << " steps with " 
+              << std::to_string(100*planner.excludedFraction(bayesFactors)) << "% of the band excluded" << std::endl;
+    return steps;
+}
+
+
+
 void ScanRunner::step(double stepSize) {
-    bayesFactors.step(stepSize);
+    TraceSpan span("Step", TRACE_SCAN, scanStepIndex);
 
+    // The previous step may still be deciding on the old frequencies, so its exclusion line is only shifted once those decisions are in
+    if (pipelinedScan) {
+        pendingStepSize += stepSize;
+    }
+    else {
+        bayesFactors.step(stepSize);
+    }
+
+    // The probe retunes and settles on its I/O thread while the digitizers and the next acquisition are set up, see settleInstruments
     trueCenterFreq += stepSize;
-    psgList[PSG_PROBE].setFreq(yModeFreq + faxionFreq - trueCenterFreq/1e3);
+    if (scanType != NO_FAXION) {
+        settleInstruments();
+        retune = psgList[PSG_PROBE].setFreqAsync(yModeFreq + faxionFreq - trueCenterFreq/1e3);
+    }
+    alazarCard->setCenterFrequency(trueCenterFreq);
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->setCenterFrequency(trueCenterFreq + digitizer->bandOffset);
+    }
+}
+
+
+
+/**
+ * @brief Records the raw buffers of every following step to path, until stopRecording, so the scan can be replayed with ACQUISITION_REPLAY.
+ * 
+ * @param path - recording file, overwritten if it exists
+ * @param codec - RECORDING_CODEC_* the buffers are recorded with. RECORDING_CODEC_PACKED packs the codes losslessly
+ */
+void ScanRunner::startRecording(const std::string& path, int codec) {
+    waitForProcessing();
+    alazarCard->startRecording(path, codec);
+}
+
+
+
+void ScanRunner::stopRecording() {
+    waitForProcessing();
+    alazarCard->stopRecording();
+}
+
+
+
+/**
+ * @brief Copies the rebinned spectra of every following step into stream as the decision stage receives them, until called with nullptr,
+ *        so DecisionSweep can replay the scan for other decision parameters. Capture with decision making off to keep every step whole.
+ * 
+ * @param stream - stream to append the steps to, or nullptr to stop capturing. Must outlive the capture
+ */
+void ScanRunner::captureDecisionStream(DecisionStream* stream) {
+    waitForProcessing();
+    decisionStream = stream;
+}
+
+
+
+/**
+ * @brief Archives the following steps to one HDF5 file, until closeArchive. The records are written by the archive's own thread, see
+ *        HDF5DataWriter. An archive already open is closed first.
+ * 
+ * @param path - HDF5 file, overwritten if it exists
+ * @param contents - ARCHIVE_* flags of the records to keep
+ * @param compressionLevel - gzip level of the datasets, 0 for none
+ */
+void ScanRunner::openArchive(const std::string& path, int contents, int compressionLevel) {
+    closeArchive();
+    archive = std::make_unique<HDF5DataWriter>(path, contents, ARCHIVE_QUEUE_BYTES, compressionLevel);
+}
+
+
+
+/**
+ * @brief Adds the combined spectrum and the metrics of the scan to the archive, then writes out everything still queued and closes it.
+ * 
+ */
+void ScanRunner::closeArchive() {
+    waitForProcessing();
+    if (archive == nullptr) {
+        return;
+    }
+
+    if (archive->archives(ARCHIVE_COMBINED_SPECTRUM) && !savedData.combinedSpectrum.empty()) {
+        archive->writeCombinedSpectrum(savedData.combinedSpectrum.toCombinedSpectrum(), scanStepIndex);
+    }
+    archive->writeMetrics();
+
+    alazarCard->archiveTo(nullptr, 0);
+    for (StepSlot& slot : stepSlots) {
+        slot.dataProc.archive = nullptr;
+    }
+    archive.reset();
+}
+
+
+
+/**
+ * @brief Publishes live spectra, the exclusion line and the stage metrics of the following steps to shared memory for monitoring clients,
+ *        such as plotting/telemetryViewer.py, until stopTelemetry. Publishing never waits on a client, see TelemetryPublisher. Telemetry
+ *        already running is restarted with the new settings.
+ * 
+ * @param name - Name of the shared memory mapping
+ * @param rateHz - Publications per second per channel at most
+ */
+void ScanRunner::startTelemetry(const std::string& name, double rateHz) {
+    stopTelemetry();
+    telemetry = std::make_unique<TelemetryPublisher>(name, rateHz);
+}
+
+
+
+/**
+ * @brief Stops publishing telemetry. Viewers see the mapping's magic cleared.
+ * 
+ */
+void ScanRunner::stopTelemetry() {
+    waitForProcessing();
+    if (telemetry == nullptr) {
+        return;
+    }
+
+    for (StepSlot& slot : stepSlots) {
+        slot.dataProc.telemetry = nullptr;
+    }
+    telemetry.reset();
+}
+
+
+
+/**
+ * @brief Records spans of the following steps for a Chrome trace, until stopTrace writes it to path: every stage timer per block or
+ *        spectrum, buffer waits and conversion in the acquisition, the steps themselves and every instrument command. Open the file in
+ *        chrome://tracing or ui.perfetto.dev. A trace already running is written first.
+ * 
+ * @param path - trace-event JSON file
+ */
+void ScanRunner::startTrace(const std::string& path) {
+    stopTrace();
+    tracePath = path;
+    setTraceThreadName("Scan");
+    startTracing();
+}
+
+
+
+/**
+ * @brief Stops tracing and writes the trace started by startTrace.
+ * 
+ */
+void ScanRunner::stopTrace() {
+    waitForProcessing();
+    if (tracePath.empty()) {
+        return;
+    }
+
+    stopTracing();
+    writeTrace(tracePath);
+    tracePath.clear();
+}
+
+
+
+/**
+ * @brief Writes a checkpoint of the scan to path after every following step, until called with an empty path. The checkpoint is captured
+ *        between steps and written by its own thread, see ScanCheckpointWriter. A pipelined scan is only checkpointed when its processing is
+ *        waited for, since the step in flight keeps changing the state.
+ * 
+ * @param path - checkpoint file, replaced by every checkpoint. Empty to stop checkpointing
+ */
+void ScanRunner::enableCheckpoints(const std::string& path) {
+    checkpointWriter.reset();
+    if (!path.empty()) {
+        checkpointWriter = std::make_unique<ScanCheckpointWriter>(path);
+    }
+}
+
+
+
+/**
+ * @brief Restores the state of a scan from the checkpoint at path and tunes to the frequency of its last step, so the scan continues with
+ *        the step after stepsCompleted(). The processor must already be initialized, the checkpoint replaces its baselining state.
+ * 
+ * @param path - checkpoint written by enableCheckpoints
+ * @return true - the scan was restored
+ * @return false - there is no usable checkpoint at path, the scan is unchanged
+ */
+bool ScanRunner::resumeFromCheckpoint(const std::string& path) {
+    waitForProcessing();
+
+    ScanCheckpoint checkpoint;
+    if (!checkpoint.read(path)) {
+        std::cout << "No checkpoint to resume from at " << path << std::endl;
+        return false;
+    }
+    if (checkpoint.header.sampleRate != alazarCard->acquisitionParams.sampleRate 
+        || checkpoint.header.samplesPerBuffer != alazarCard->acquisitionParams.samplesPerBuffer) {
+        std::cout << "Warning: Checkpoint " << path << " was taken at " << std::to_string(checkpoint.header.sampleRate) << " Hz with "
+                  << std::to_string(checkpoint.header.samplesPerBuffer) << " samples per buffer, not resuming." << std::endl;
+        return false;
+    }
+
+    checkpoint.restore(bayesFactors, savedData, dataProcessor);
+    savedData.combinedSpectrum.setRetention(combinedRetentionBins, combinedSpillDirectory);
+    scanStepIndex = checkpoint.header.stepIndex;
+    pendingStepSize = 0;
+
+    trueCenterFreq = checkpoint.header.trueCenterFreq;
+    if (scanType != NO_FAXION) {
+        settleInstruments();
+        psgList[PSG_PROBE].setFreq(yModeFreq + faxionFreq - trueCenterFreq/1e3);
+    }
+    alazarCard->setCenterFrequency(trueCenterFreq);
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->source->setCenterFrequency(trueCenterFreq + digitizer->bandOffset);
+        digitizer->processor.loadProcessingState(dataProcessor);
+    }
+
+    std::cout << "Resumed scan after step " << std::to_string(scanStepIndex) << " at " << std::to_string(trueCenterFreq) << " MHz" << std::endl;
+    return true;
+}
+
+
+
+/**
+ * @brief Hands a copy of the scan state to the checkpoint writer, if checkpoints are enabled. Only call with no step in flight.
+ * 
+ */
+void ScanRunner::checkpointScan() {
+    pickUpCalibration();
+    if (checkpointWriter == nullptr) {
+        return;
+    }
+
+    // Nothing is in flight, so the checkpoint can hold the newest background baseline
+    dataProcessor.pickUpBaseline();
+
+    std::unique_ptr<ScanCheckpoint> checkpoint = std::make_unique<ScanCheckpoint>();
+    checkpoint->capture(scanStepIndex, trueCenterFreq, alazarCard->acquisitionParams, bayesFactors, savedData, dataProcessor);
+    checkpointWriter->submit(std::move(checkpoint));
 }
 
 
@@ -526,10 +1982,148 @@ void ScanRunner::setTarget(double targetCoupling) {
 
 
 
+/**
+ * @brief Takes an average raw spectrum at every point of a frequency and power list on one PSG, using the PSG's list sweep mode. The list
+ *        is loaded once and the acquisition steps the PSG to the next point with a bus trigger as soon as a point's last buffer is in, see
+ *        ListSweep, so the points are streamed back to back instead of paying an acquisition and the GPIB settings for each. The digitizer
+ *        counts the samples of an acquisition in a U32, so a long list is streamed in as few acquisitions of whole points as that allows.
+ *        Decision making is off during the sweep. The spectra stay in the saved data until flushData, retrieveRawAxis gives their axis.
+ * 
+ * @param psgIndex - PSG_* generator to sweep
+ * @param frequencies - list frequencies, GHz
+ * @param powers - power of every list point in dBm, or a single power for all of them
+ * @param spectraPerPoint - averaged spectra acquired at every point
+ * @param settleSpectra - spectra at the start of every point dropped while the PSG settles, fewer than spectraPerPoint
+ * @return std::vector<std::vector<double>> - average raw spectrum of every point
+ */
+std::vector<std::vector<double>> ScanRunner::acquireListSweep(int psgIndex, const std::vector<double>& frequencies, const std::vector<double>& powers,
+                                                              int spectraPerPoint, int settleSpectra) {
+    waitForProcessing();
+    if (settleSpectra < 0 || spectraPerPoint <= settleSpectra) {
+        throw std::runtime_error("Error: A list sweep point needs more spectra than it drops while settling\n");
+    }
+    // Averages of overlapped segments don't line up with the points' buffers
+    if (welchSegments > 1) {
+        throw std::runtime_error("Error: List sweeps need the Welch segments off, see setWelch\n");
+    }
+
+    settleInstruments();
+    PSG& psg = psgList[psgIndex];
+    int numPoints = (int)frequencies.size();
+    AcquisitionParameters stepParams = alazarCard->acquisitionParams;
+    U32 buffersPerPoint = (U32)(spectraPerPoint*subSpectraAveragingNumber);
+
+    uint64_t samplesPerPoint = (uint64_t)stepParams.samplesPerBuffer*buffersPerPoint;
+    int pointsPerAcquisition = (int)min((uint64_t)numPoints, (uint64_t)UINT32_MAX/samplesPerPoint);
+    if (pointsPerAcquisition == 0) {
+        throw std::runtime_error("Error: One list sweep point is longer than an acquisition can be\n");
+    }
+
+    psg.loadList(frequencies, powers);
+    psg.startList();
+
+    ListSweep sweep;
+    sweep.buffersPerPoint = buffersPerPoint;
+    sweep.advance = [&psg]() { psg.nextListPoint(); };
+
+    int decisionMaking = decisionAgent.decisionMakingEnabled();
+    size_t rawSpectraLimit = savedData.rawSpectraLimit;
+    auto restore = [&]() {
+        alazarCard->setListSweep(nullptr);
+        alazarCard->setAcquisitionParameters(stepParams.sampleRate, stepParams.samplesPerAcquisition, stepParams.buffersPerAcquisition,
+                                             stepParams.inputRange, stepParams.inputImpedance, stepParams.adaptiveBufferCount ? 0 : stepParams.bufferCount);
+        decisionAgent.toggleDecisionMaking(decisionMaking);
+        savedData.rawSpectraLimit = rawSpectraLimit;
+        psg.stopList();
+    };
+
+    flushData();
+    decisionAgent.toggleDecisionMaking(0);
+    savedData.rawSpectraLimit = SIZE_MAX;
+    alazarCard->setListSweep(&sweep);
+
+    std::vector<std::vector<double>> pointSpectra(numPoints);
+    std::vector<int> pointCounts(numPoints, 0);
+    try {
+        for (int firstPoint = 0; firstPoint < numPoints; firstPoint += pointsPerAcquisition) {
+            int points = min(pointsPerAcquisition, numPoints - firstPoint);
+            U32 buffers = buffersPerPoint*(U32)points;
+            alazarCard->setAcquisitionParameters(stepParams.sampleRate, stepParams.samplesPerBuffer*buffers, buffers, stepParams.inputRange,
+                                                 stepParams.inputImpedance, stepParams.adaptiveBufferCount ? 0 : stepParams.bufferCount);
+
+            // acquireData turns the PSGs off after every acquisition
+            psg.onOff(true);
+            sweep.point = firstPoint;
+            acquireData();
+            waitForProcessing();
+
+            // Averaged spectrum k holds the k-th subSpectraAveragingNumber buffers, which all belong to one point
+            for (size_t k = 0; k < savedData.rawSpectra.size(); k++) {
+                int point = firstPoint + (int)(k/spectraPerPoint);
+                if (point >= numPoints || (int)(k % spectraPerPoint) < settleSpectra) {
+                    continue;
+                }
+
+                const std::vector<double>& rawPowers = savedData.rawSpectra[k].powers;
+                if (pointSpectra[point].empty()) {
+                    pointSpectra[point].assign(rawPowers.size(), 0.0);
+                }
+                for (size_t i = 0; i < rawPowers.size() && i < pointSpectra[point].size(); i++) {
+                    pointSpectra[point][i] += rawPowers[i];
+                }
+                pointCounts[point]++;
+            }
+
+            // The last acquisition's spectra are kept for retrieveRawAxis
+            if (firstPoint + points < numPoints) {
+                savedData.rawSpectra.clear();
+                psg.nextListPoint();
+            }
+        }
+    }
+    catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+
+    for (int point = 0; point < numPoints; point++) {
+        for (double& power : pointSpectra[point]) {
+            power /= pointCounts[point];
+        }
+    }
+    return pointSpectra;
+}
+
+
+
+/**
+ * @brief Bounds the combined spectrum kept in memory over long scans. Bins more than windowMHz from the newest step are flushed to a scratch
+ *        file in spillDirectory, deleted with the scan, and read back through its mapping when the combined spectrum is saved, archived or
+ *        checkpointed. The window carries over flushData and resumeFromCheckpoint.
+ * 
+ * @param windowMHz - span kept in memory on either side of the newest step, 0 keeps the whole combined spectrum in memory
+ * @param spillDirectory - directory of the scratch file, defaults to the savePath plotting directory
+ */
+void ScanRunner::retainCombinedSpectrum(double windowMHz, const std::string& spillDirectory) {
+    waitForProcessing();
+
+    combinedRetentionBins = (windowMHz > 0) ? (long long)std::ceil(windowMHz*1e6/RBW) : 0;
+    combinedSpillDirectory = spillDirectory.empty() ? "../../../plotting/" + savePath : spillDirectory;
+
+    std::lock_guard<std::mutex> lock(savedData.mutex);
+    savedData.combinedSpectrum.setRetention(combinedRetentionBins, combinedSpillDirectory);
+}
+
+
+
 std::vector<std::vector<double>> ScanRunner::retrieveRawData() {
+    waitForProcessing();
+
     std::vector<std::vector<double>> rawData;
+    rawData.reserve(savedData.rawSpectra.size());
 
-    for (Spectrum spectrum : savedData.rawSpectra){
+    for (const Spectrum& spectrum : savedData.rawSpectra){
         rawData.push_back(spectrum.powers);
     }
     
@@ -539,17 +2133,20 @@ std::vector<std::vector<double>> ScanRunner::retrieveRawData() {
 
 
 std::vector<double> ScanRunner::retrieveRawAxis() {
+    waitForProcessing();
+
     return savedData.rawSpectra[0].freqAxis;
 }
 
 
 
 void ScanRunner::flushData() {
+    waitForProcessing();
+
     savedData.rawSpectra.clear();
     savedData.processedSpectra.clear();
     savedData.rescaledSpectra.clear();
-    savedData.combinedSpectrum.powers.clear();
-    savedData.combinedSpectrum.freqAxis.clear();
+    savedData.combinedSpectrum.clear();
 
     bayesFactors.exclusionLine.powers.clear();
     bayesFactors.exclusionLine.freqAxis.clear();
@@ -557,5 +2154,8 @@ void ScanRunner::flushData() {
     bayesFactors.coeffSumB.clear();
 
     dataProcessor.resetBaselining();
-    dataProcessor.currentBaseline = readVector("baseline.csv");
+    dataProcessor.currentBaseline = storedBaseline;
+    for (std::unique_ptr<Digitizer>& digitizer : digitizers) {
+        digitizer->processor.loadProcessingState(dataProcessor);
+    }
 }
\ No newline at end of file
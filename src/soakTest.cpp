@@ -0,0 +1,107 @@
+/**
+ * @file soakTest.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Real-time soak test of the acquisition pipeline. Scans the SimulatedDigitizer, or loops a raw stream recording on the ReplayDigitizer,
+ *        at the real sample rate for hours with the full pipeline, decision making and stepping, and reports the sustained duty cycle, the
+ *        dead time between steps, the memory growth and the sample rate each stage saturates at (see SoakMonitor).
+ *        The scan restarts every lap so the scan data stays bounded, and memory growth over the run is the pipeline's own.
+ *        The pipeline threads run with the given ThreadPlacement, so placements can be compared by their late buffers and overruns.
+ *
+ *        Usage: soak_test [hours] [rateFactor] [recording] [placement]
+ *               (defaults to 1 h at 1x real time on the SimulatedDigitizer with the default placement. A recording of "" keeps the
+ *               SimulatedDigitizer, and a placement of "isolated" runs ThreadPlacement::isolated() instead of a placement file)
+ *
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "decs.hpp"
+
+#define SOAK_LAP_STEPS (50) // Steps per lap on the SimulatedDigitizer. A recording is replayed whole every lap
+
+int main(int argc, char* argv[]) {
+    int maxSpectraPerStep = 50;
+    int minSpectraPerStep = 13;
+    int subSpectraAveragingNumber = 15;
+    double maxIntegrationTime = maxSpectraPerStep*subSpectraAveragingNumber*0.01; // seconds
+
+    double stepSize = 0.1; // MHz
+
+    double hours = (argc > 1) ? std::stod(argv[1]) : 1;
+    double rateFactor = (argc > 2) ? std::stod(argv[2]) : 1;
+    std::string recordingPath = (argc > 3) ? argv[3] : "";
+    std::string placementPath = (argc > 4) ? argv[4] : "";
+
+
+    int backend = recordingPath.empty() ? ACQUISITION_SIMULATED : ACQUISITION_REPLAY;
+    ScanRunner scanRunner(maxIntegrationTime, NO_FAXION, 1, backend, recordingPath);
+    scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
+    scanRunner.setTarget(6.5e-5);
+    scanRunner.decisionAgent.minShots = minSpectraPerStep;
+
+    if (placementPath == "isolated") {
+        scanRunner.setThreadPlacement(ThreadPlacement::isolated());
+    }
+    else if (!placementPath.empty()) {
+        ThreadPlacement placement;
+        placement.load(placementPath);
+        scanRunner.setThreadPlacement(placement);
+    }
+
+    AcquisitionSource* source = scanRunner.simulatedDigitizer();
+    ReplayDigitizer* replay = scanRunner.replayDigitizer();
+    int lapSteps = SOAK_LAP_STEPS;
+    if (replay != nullptr) {
+        replay->rateFactor = rateFactor;
+        lapSteps = max(0, (int)replay->numSteps() - 1);
+        source = replay;
+    }
+    else {
+        scanRunner.simulatedDigitizer()->simulationParams.rateFactor = rateFactor;
+    }
+
+    SoakMonitor monitor(source->acquisitionParams.sampleRate, source->acquisitionParams.samplesPerBuffer);
+    monitor.setStageWorkers(TIMER_FFT, scanRunner.FFTWorkerCount);
+    monitor.setStageWorkers(TIMER_PROCESS, scanRunner.processingWorkerCount);
+
+    std::cout << "Soaking for " << std::to_string(hours) << " h at " << std::to_string(rateFactor) << "x real time, "
+              << std::to_string(lapSteps + 1) << " steps per lap." << std::endl;
+
+
+    // Stepping and the scan restart between laps count as dead time of the step after them
+    double duration = 3600*hours;
+    int laps = 0;
+    while (monitor.elapsed() < duration) {
+        if (replay != nullptr) {
+            replay->rewind();
+        }
+        scanRunner.planScan(stepSize, lapSteps);
+
+        for (int i = 0; i <= lapSteps && monitor.elapsed() < duration; i++) {
+            if (i > 0) {
+                scanRunner.step(stepSize);
+            }
+            scanRunner.acquireData();
+
+            monitor.stepCompleted();
+            if (monitor.intervalDue()) {
+                monitor.closeInterval();
+            }
+        }
+
+        scanRunner.flushData();
+        laps++;
+    }
+    if (!monitor.intervalEmpty()) {
+        monitor.closeInterval();
+    }
+
+    std::cout << "Soaked " << std::to_string(laps) << " laps in " << std::to_string(monitor.elapsed()/3600) << " h." << std::endl;
+    monitor.report();
+    monitor.save("../../../plotting/" + scanRunner.exclusionPath + "/soakTest_" + getDateTimeString() + ".csv");
+
+    std::cout << "Exited Normally" << std::endl;
+    return 0;
+}
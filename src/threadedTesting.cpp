@@ -11,6 +11,9 @@
 #include "decs.hpp"
 
 #define REFRESH_PROCESSOR (0)
+#define CHECKPOINT_PATH "checkpoints/threadedTesting.ckpt" // Written after every step, a rerun after a crash resumes from it
+#define LIVE_TELEMETRY (1) // Publish to TELEMETRY_NAME for plotting/telemetryViewer.py
+#define SCAN_TRACE_PATH "" // Chrome trace of the scan for chrome://tracing, e.g. "threadTests/scanTrace.json". Empty for none
 
 int main() {
     int maxSpectraPerStep = 50;
@@ -32,8 +35,25 @@ int main() {
     scanRunner.refreshBaselineAndBadBins(1, 32, 1);
     #endif
 
-    scanRunner.acquireData();
-    for (int i = 0; i < numSteps; i++) {
+    scanRunner.planScan(stepSize, numSteps);
+
+    #if LIVE_TELEMETRY
+    scanRunner.startTelemetry();
+    #endif
+    scanRunner.enableCheckpoints(CHECKPOINT_PATH);
+    if (!std::string(SCAN_TRACE_PATH).empty()) {
+        scanRunner.startTrace(SCAN_TRACE_PATH);
+    }
+
+    // Step k of the loop is scan step k + 2, the first acquisition is step 1
+    int firstStep = 0;
+    if (scanRunner.resumeFromCheckpoint(CHECKPOINT_PATH)) {
+        firstStep = scanRunner.stepsCompleted() - 1;
+    }
+    else {
+        scanRunner.acquireData();
+    }
+    for (int i = firstStep; i < numSteps; i++) {
         scanRunner.step(stepSize);
         scanRunner.acquireData();
     }
@@ -41,6 +61,10 @@ int main() {
     std::cout << "Saving data..." << std::endl;
     scanRunner.saveData();
 
+    // The scan is complete, so the next run starts over
+    scanRunner.enableCheckpoints("");
+    std::filesystem::remove(CHECKPOINT_PATH);
+
     std::cout << "Exited Normally" << std::endl;
     return 0;
 }
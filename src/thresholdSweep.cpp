@@ -0,0 +1,61 @@
+/**
+ * @file thresholdSweep.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Sweeps the DecisionAgent threshold and minShots over one scan. A static scan is run once, on the SimulatedDigitizer or on a raw
+ *        stream recording, with its decision stream captured, then every parameter set is replayed over the captured spectra on all cores.
+ *
+ *        Usage: threshold_sweep [recording]        (without a recording the scan is simulated)
+ *
+ * @version 0.1
+ * @date 2023-11-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "decs.hpp"
+
+int main(int argc, char* argv[]) {
+    int maxSpectraPerStep = 50;
+    int subSpectraAveragingNumber = 15;
+    double maxIntegrationTime = maxSpectraPerStep*subSpectraAveragingNumber*0.01; // seconds
+
+    double stepSize = 0.1; // MHz
+    int numSteps = 50;
+
+    std::vector<double> thresholds = { 0, 0.5, 1, 2, 5, 10, 20, 50 };
+    std::vector<int> minShots = { 5, 9, 13, 17, 21 };
+
+
+    std::string recordingPath = (argc > 1) ? argv[1] : "";
+    int backend = recordingPath.empty() ? ACQUISITION_SIMULATED : ACQUISITION_REPLAY;
+    ScanRunner scanRunner(maxIntegrationTime, 0, 0, backend, recordingPath);
+    if (backend == ACQUISITION_SIMULATED) {
+        scanRunner.simulatedDigitizer()->simulationParams.rateFactor = 0;
+    }
+    scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
+    scanRunner.setTarget(6.5e-5);
+
+    DecisionStream stream;
+    scanRunner.captureDecisionStream(&stream);
+
+    scanRunner.planScan(stepSize, numSteps);
+    scanRunner.acquireData();
+    for (int i = 0; i < numSteps; i++) {
+        scanRunner.step(stepSize);
+        scanRunner.acquireData();
+    }
+    scanRunner.captureDecisionStream(nullptr);
+
+
+    DecisionSweep sweep(stream, scanRunner.decisionAgent);
+    auto sweepStart = std::chrono::steady_clock::now();
+    std::vector<SweepResult> results = sweep.run(DecisionSweep::grid(thresholds, minShots));
+    std::chrono::duration<double> sweepTime = std::chrono::steady_clock::now() - sweepStart;
+
+    std::cout << "Swept " << std::to_string(results.size()) << " parameter sets in " << std::to_string(sweepTime.count()) << " s." << std::endl;
+    DecisionSweep::report(results);
+    DecisionSweep::save(results, "../../../plotting/" + scanRunner.exclusionPath + "/thresholdSweep_" + getDateTimeString() + ".csv");
+
+    std::cout << "Exited Normally" << std::endl;
+    return 0;
+}
@@ -0,0 +1,424 @@
+/**
+ * @file HDF5DataWriter.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the HDF5DataWriter class. See include\utils\HDF5DataWriter.hpp for the class definition
+ *        and the layout of the archive.
+ * @version 0.2
+ * @date 2023-11-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+// Group of each ARCHIVE_* content
+static const char* archiveGroupName(int content) {
+    switch (content) {
+        case ARCHIVE_RAW_BUFFERS:       return "/rawBuffers";
+        case ARCHIVE_AVERAGED_SPECTRA:  return "/averagedSpectra";
+        case ARCHIVE_COMBINED_SPECTRUM: return "/combinedSpectrum";
+        case ARCHIVE_EXCLUSION_LINES:   return "/exclusionLines";
+        case ARCHIVE_METRICS:           return "/metrics";
+        default:
+            throw std::runtime_error("Error: No archive group for content " + std::to_string(content) + "\n");
+    }
+}
+
+
+
+/**
+ * @brief Creates the archive, overwriting any file at filename, and starts the writer thread.
+ *
+ * @param filename - HDF5 file of the scan
+ * @param contents - ARCHIVE_* flags of the records to keep. Writes of other records return at once
+ * @param maxQueuedBytes - records held for the writer thread at most, in bytes. Records that don't fit are dropped
+ * @param compressionLevel - gzip level 1-9 of every dataset, with byte shuffling. 0 stores the data uncompressed
+ */
+HDF5DataWriter::HDF5DataWriter(const std::string& filename, int contents, size_t maxQueuedBytes, int compressionLevel) :
+    filename(filename), contents(contents), maxQueuedBytes(maxQueuedBytes), compressionLevel(compressionLevel) {
+    H5::Exception::dontPrint();
+
+    std::filesystem::path parent = std::filesystem::path(filename).parent_path();
+    if (!parent.empty()) {
+        std::filesystem::create_directories(parent);
+    }
+
+    try {
+        file = H5::H5File(filename, H5F_ACC_TRUNC);
+    }
+    catch (const H5::Exception& e) {
+        throw std::runtime_error("Error: Unable to create archive " + filename + " -- " + e.getDetailMsg() + "\n");
+    }
+
+    writerThread = std::thread(&HDF5DataWriter::writerLoop, this);
+}
+
+
+
+HDF5DataWriter::~HDF5DataWriter() {
+    close();
+}
+
+
+
+/**
+ * @brief Writes every queued record, stops the writer thread and closes the file. Later writes are dropped.
+ *
+ */
+void HDF5DataWriter::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closing) {
+            return;
+        }
+        closing = true;
+    }
+    condition.notify_all();
+    writerThread.join();
+
+    groups.clear();
+    file.close();
+
+    std::cout << "Archived " << std::to_string(recordsWritten) << " records to " << filename;
+    if (dropped.load() > 0) {
+        std::cout << ", dropped " << std::to_string(dropped.load()) << " the writer could not keep up with";
+    }
+    std::cout << std::endl;
+}
+
+
+
+/**
+ * @brief Queues one digitizer buffer. Called from the acquisition thread, so a full queue drops the buffer.
+ *
+ * @param samples - samplesPerBuffer channel A codes followed by samplesPerBuffer channel B codes
+ * @param numSamples - codes in samples, 2*samplesPerBuffer
+ * @param step - scan step of the buffer
+ * @param centerFreq - receiver center frequency in MHz
+ * @return true - the buffer was queued
+ * @return false - the buffer was dropped, or raw buffers are not archived
+ */
+bool HDF5DataWriter::writeRawBuffer(const unsigned short* samples, size_t numSamples, int step, double centerFreq) {
+    if (!archives(ARCHIVE_RAW_BUFFERS)) {
+        return false;
+    }
+
+    Record record;
+    record.content = ARCHIVE_RAW_BUFFERS;
+    record.step = step;
+    record.centerFreq = centerFreq;
+    record.samples.assign(samples, samples + numSamples);
+    return enqueue(std::move(record));
+}
+
+
+
+/**
+ * @brief Queues a spectrum as one row of the group of content.
+ *
+ * @param content - ARCHIVE_AVERAGED_SPECTRA or ARCHIVE_EXCLUSION_LINES
+ * @param spectrum - spectrum to archive, with the center frequency its axis is relative to
+ * @param step - scan step of the spectrum
+ * @return true - the spectrum was queued
+ * @return false - the spectrum was dropped, or content is not archived
+ */
+bool HDF5DataWriter::writeSpectrum(int content, const Spectrum& spectrum, int step) {
+    if (!archives(content)) {
+        return false;
+    }
+
+    Record record;
+    record.content = content;
+    record.step = step;
+    record.centerFreq = spectrum.trueCenterFreq;
+    record.arrays.emplace_back("powers", spectrum.powers);
+    record.axis = spectrum.freqAxis;
+    return enqueue(std::move(record));
+}
+
+
+
+/**
+ * @brief Queues a snapshot of the combined spectrum.
+ *
+ * @param spectrum - combined spectrum, e.g. CombinedSpectrumGrid::toCombinedSpectrum
+ * @param step - last scan step merged into the spectrum
+ * @return true - the snapshot was queued
+ * @return false - the snapshot was dropped, or the combined spectrum is not archived
+ */
+bool HDF5DataWriter::writeCombinedSpectrum(const CombinedSpectrum& spectrum, int step) {
+    if (!archives(ARCHIVE_COMBINED_SPECTRUM)) {
+        return false;
+    }
+
+    Record record;
+    record.content = ARCHIVE_COMBINED_SPECTRUM;
+    record.step = step;
+    record.centerFreq = spectrum.trueCenterFreq;
+    record.arrays.emplace_back("powers", spectrum.powers);
+    record.arrays.emplace_back("sigmaCombined", spectrum.sigmaCombined);
+    record.arrays.emplace_back("weightSum", spectrum.weightSum);
+    record.axis = spectrum.freqAxis;
+    return enqueue(std::move(record));
+}
+
+
+
+/**
+ * @brief Queues the per step metrics recorded so far (see timing.cpp). Each metric replaces the one written before it.
+ *
+ * @return true - the metrics were queued
+ * @return false - the metrics were dropped, or metrics are not archived
+ */
+bool HDF5DataWriter::writeMetrics() {
+    if (!archives(ARCHIVE_METRICS)) {
+        return false;
+    }
+
+    auto asDoubles = [](const std::vector<int>& values) { return std::vector<double>(values.begin(), values.end()); };
+
+    Record record;
+    record.content = ARCHIVE_METRICS;
+    record.arrays.emplace_back("acquiredSpectra", asDoubles(getMetric(ACQUIRED_SPECTRA)));
+    record.arrays.emplace_back("spectraAtDecision", asDoubles(getMetric(SPECTRA_AT_DECISION)));
+    record.arrays.emplace_back("spectrumAverageSize", asDoubles(getMetric(SPECTRUM_AVERAGE_SIZE)));
+    record.arrays.emplace_back("decisionStopLatency", asDoubles(getMetric(DECISION_STOP_LATENCY)));
+    record.arrays.emplace_back("lateBuffers", asDoubles(getMetric(LATE_BUFFERS)));
+    record.arrays.emplace_back("acquisitionOverruns", asDoubles(getMetric(ACQUISITION_OVERRUNS)));
+    record.arrays.emplace_back("stepAllocations", asDoubles(getMetric(STEP_ALLOCATIONS)));
+    record.arrays.emplace_back("stepAllocatedMB", asDoubles(getMetric(STEP_ALLOCATED_MB)));
+    record.arrays.emplace_back("stepPeakHeapMB", asDoubles(getMetric(STEP_PEAK_HEAP_MB)));
+    return enqueue(std::move(record));
+}
+
+
+
+size_t HDF5DataWriter::Record::bytes() const {
+    size_t total = sizeof(Record) + axis.size()*sizeof(double) + samples.size()*sizeof(unsigned short);
+    for (const std::pair<std::string, std::vector<double>>& array : arrays) {
+        total += array.second.size()*sizeof(double);
+    }
+    return total;
+}
+
+
+
+/**
+ * @brief Hands a record to the writer thread, unless the queue is full or the archive is closed.
+ *
+ * @param record - record to write
+ * @return true - the record was queued
+ * @return false - the record was dropped
+ */
+bool HDF5DataWriter::enqueue(Record&& record) {
+    size_t bytes = record.bytes();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closing || queuedBytes + bytes > maxQueuedBytes) {
+            dropped++;
+            return false;
+        }
+        queuedBytes += bytes;
+        queue.push_back(std::move(record));
+    }
+    condition.notify_one();
+    return true;
+}
+
+
+
+/**
+ * @brief Writer thread. Writes the queued records in order and flushes the file whenever the queue runs dry, so an interrupted scan keeps
+ *        everything written up to its last idle moment. Once a write fails the remaining records are discarded.
+ *
+ */
+void HDF5DataWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this]() { return !queue.empty() || closing; });
+        if (queue.empty()) {
+            break;
+        }
+
+        Record record = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        if (!failed) {
+            try {
+                writeRecord(record);
+                recordsWritten++;
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Archiving to " << filename << " failed, discarding further records -- " << e.what() << std::endl;
+                failed = true;
+            }
+            catch (const H5::Exception& e) {
+                std::cerr << "Error: Archiving to " << filename << " failed, discarding further records -- " << e.getDetailMsg() << std::endl;
+                failed = true;
+            }
+        }
+
+        lock.lock();
+        queuedBytes -= record.bytes();
+        if (queue.empty() && !failed) {
+            lock.unlock();
+            try {
+                file.flush(H5F_SCOPE_GLOBAL);
+            }
+            catch (const H5::Exception& e) {
+                std::cerr << "Warning: Unable to flush " << filename << " -- " << e.getDetailMsg() << std::endl;
+            }
+            lock.lock();
+        }
+    }
+}
+
+
+
+/**
+ * @brief Appends a record to its group, or replaces the metrics.
+ *
+ * @param record - record to write
+ */
+void HDF5DataWriter::writeRecord(const Record& record) {
+    Group& group = openGroup(record.content);
+
+    if (record.content == ARCHIVE_METRICS) {
+        for (const std::pair<std::string, std::vector<double>>& array : record.arrays) {
+            replaceData(openDataset(group, array.first, 1, H5::PredType::NATIVE_DOUBLE), array.second.data(), array.second.size(),
+                        H5::PredType::NATIVE_DOUBLE);
+        }
+        return;
+    }
+
+    if (!record.samples.empty()) {
+        appendRow(openDataset(group, "samples", 2, H5::PredType::NATIVE_UINT16), 2, record.samples.data(), record.samples.size(),
+                  H5::PredType::NATIVE_UINT16);
+    }
+    for (const std::pair<std::string, std::vector<double>>& array : record.arrays) {
+        appendRow(openDataset(group, array.first, 2, H5::PredType::NATIVE_DOUBLE), 2, array.second.data(), array.second.size(),
+                  H5::PredType::NATIVE_DOUBLE);
+    }
+
+    double step = (double)record.step;
+    appendRow(openDataset(group, "step", 1, H5::PredType::NATIVE_DOUBLE), 1, &step, 1, H5::PredType::NATIVE_DOUBLE);
+    appendRow(openDataset(group, "centerFreq", 1, H5::PredType::NATIVE_DOUBLE), 1, &record.centerFreq, 1, H5::PredType::NATIVE_DOUBLE);
+
+    // Rows of a group share their axis up to their own length, so only a wider axis is written
+    if (record.axis.size() > group.axisSize) {
+        replaceData(openDataset(group, "axis", 1, H5::PredType::NATIVE_DOUBLE), record.axis.data(), record.axis.size(),
+                    H5::PredType::NATIVE_DOUBLE);
+        group.axisSize = record.axis.size();
+    }
+}
+
+
+
+HDF5DataWriter::Group& HDF5DataWriter::openGroup(int content) {
+    auto found = groups.find(content);
+    if (found != groups.end()) {
+        return found->second;
+    }
+
+    Group& group = groups[content];
+    group.group = file.createGroup(archiveGroupName(content));
+    return group;
+}
+
+
+
+/**
+ * @brief Returns a dataset of the group, creating it empty on first use. Datasets are extensible in every dimension and chunked by row
+ *        (ARCHIVE_CHUNK_BINS values per chunk), with the archive's compression and NaN as the fill value.
+ *
+ * @param group - group of the dataset
+ * @param name - name of the dataset in the group
+ * @param rank - 1 for a vector, 2 for one row per record
+ * @param type - element type
+ * @return H5::DataSet& - the dataset
+ */
+H5::DataSet& HDF5DataWriter::openDataset(Group& group, const std::string& name, int rank, const H5::PredType& type) {
+    auto found = group.datasets.find(name);
+    if (found != group.datasets.end()) {
+        return found->second;
+    }
+
+    hsize_t dims[2] = { 0, 0 };
+    hsize_t maxDims[2] = { H5S_UNLIMITED, H5S_UNLIMITED };
+    hsize_t chunk[2] = { 1, ARCHIVE_CHUNK_BINS };
+    if (rank == 1) {
+        chunk[0] = ARCHIVE_CHUNK_BINS;
+    }
+    H5::DataSpace space(rank, dims, maxDims);
+
+    H5::DSetCreatPropList properties;
+    properties.setChunk(rank, chunk);
+    if (compressionLevel > 0) {
+        properties.setShuffle();
+        properties.setDeflate(compressionLevel);
+    }
+    if (type == H5::PredType::NATIVE_DOUBLE) {
+        double fill = std::numeric_limits<double>::quiet_NaN();
+        properties.setFillValue(type, &fill);
+    }
+
+    H5::DataSet dataset = group.group.createDataSet(name, type, space, properties);
+    return group.datasets.emplace(name, dataset).first->second;
+}
+
+
+
+/**
+ * @brief Appends one row to a dataset, widening it if the row is wider than the rows before it. A rank 1 dataset is extended by count
+ *        values instead.
+ *
+ * @param dataset - dataset from openDataset
+ * @param rank - rank of the dataset
+ * @param data - values of the row
+ * @param count - number of values
+ * @param type - element type of data
+ */
+void HDF5DataWriter::appendRow(H5::DataSet& dataset, int rank, const void* data, hsize_t count, const H5::PredType& type) {
+    hsize_t dims[2] = { 0, 0 };
+    dataset.getSpace().getSimpleExtentDims(dims);
+
+    hsize_t offset[2] = { dims[0], 0 };
+    hsize_t extent[2] = { 1, count };
+    hsize_t newDims[2] = { dims[0] + 1, max(dims[1], count) };
+    if (rank == 1) {
+        extent[0] = count;
+        newDims[0] = dims[0] + count;
+    }
+    dataset.extend(newDims);
+    if (count == 0) {
+        return;
+    }
+
+    H5::DataSpace fileSpace = dataset.getSpace();
+    fileSpace.selectHyperslab(H5S_SELECT_SET, extent, offset);
+    H5::DataSpace memorySpace(rank, extent);
+    dataset.write(data, type, memorySpace, fileSpace);
+}
+
+
+
+/**
+ * @brief Resizes a rank 1 dataset to count values and writes them.
+ *
+ * @param dataset - dataset from openDataset
+ * @param data - new values
+ * @param count - number of values
+ * @param type - element type of data
+ */
+void HDF5DataWriter::replaceData(H5::DataSet& dataset, const void* data, hsize_t count, const H5::PredType& type) {
+    hsize_t dims[1] = { count };
+    dataset.extend(dims);
+    if (count == 0) {
+        return;
+    }
+
+    H5::DataSpace memorySpace(1, dims);
+    dataset.write(data, type, memorySpace, dataset.getSpace());
+}
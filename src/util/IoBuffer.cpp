@@ -27,16 +27,18 @@
 #include <stdio.h>
 #include "AlazarApi.h"
 #include "IoBuffer.h"
+#include "decs.hpp"
 
 //----------------------------------------------------------------------------
 //
 // Function    :  CreateIoBuffer
 //
-// Description :  Allocate and initialize an IO_BUFFER structure
+// Description :  Allocate and initialize an IO_BUFFER structure. The sample
+//                buffer is placed by allocationFlags, see allocatePages
 //
 //----------------------------------------------------------------------------
 
-IO_BUFFER*  CreateIoBuffer (U32 uBufferLength_bytes)
+IO_BUFFER*  CreateIoBuffer (U32 uBufferLength_bytes, int allocationFlags)
 {
 	BOOL bSuccess = FALSE;
 
@@ -55,11 +57,9 @@ IO_BUFFER*  CreateIoBuffer (U32 uBufferLength_bytes)
 	// allocate a buffer for sample data
 
 	pIoBuffer->pBuffer = 
-		VirtualAlloc (
-			NULL,
+		allocatePages (
 			uBufferLength_bytes,
-			MEM_COMMIT,
-			PAGE_READWRITE
+			allocationFlags
 			);
 
 	if (pIoBuffer->pBuffer == NULL)
@@ -127,11 +127,7 @@ BOOL DestroyIoBuffer (IO_BUFFER *pIoBuffer)
 
 			if (pIoBuffer->pBuffer != NULL)
 			{
-				VirtualFree (
-					pIoBuffer->pBuffer, 
-					0,
-					MEM_RELEASE
-					);
+				freePages (pIoBuffer->pBuffer);
 			}
 
 			free (pIoBuffer);
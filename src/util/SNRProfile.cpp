@@ -0,0 +1,156 @@
+/**
+ * @file SNRProfile.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the SNRProfile class. See include\utils\SNRProfile.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Sets the SNR spectrum and drops every cached window.
+ *
+ * @param SNR - SNR on a relative frequency axis, as loaded by DataProcessor::loadSNR
+ */
+void SNRProfile::load(const Spectrum& SNR) {
+    this->SNR = SNR;
+    windows.clear();
+}
+
+
+
+/**
+ * @brief Window of consecutive SNR bins for a spectrum on the SNR's own bins. It starts at the last SNR bin at or before the first frequency
+ *        of the axis, as in DataProcessor::trimSNRtoMatch.
+ *
+ * @param axis - frequency axis of the spectrum, relative like the SNR's
+ * @return const Window& - cached window of axis.size() bins
+ */
+const SNRProfile::Window& SNRProfile::alignedWindow(const FrequencyAxis& axis) {
+    WindowKey key = keyFor(SNR_MATCH_ALIGNED, axis);
+    std::map<WindowKey, Window>::iterator cached = windows.find(key);
+    if (cached != windows.end()) {
+        return cached->second;
+    }
+
+    // A frequency within COMBINED_GRID_TOLERANCE bins of an SNR bin counts as on it, as in keyFor
+    double tolerance = COMBINED_GRID_TOLERANCE*SNRBinWidth();
+    size_t startIndex = 0;
+    while (startIndex + 1 < SNR.freqAxis.size() && SNR.freqAxis[startIndex+1] < axis[0] - tolerance) {
+        startIndex++;
+    }
+    if (startIndex + axis.size() > SNR.powers.size()) {
+        throw std::runtime_error("Error: Spectrum reaches past the end of the SNR\n");
+    }
+
+    std::vector<int> indices(axis.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = (int)(startIndex + i);
+    }
+
+    // Window onto the SNR axis, shared rather than copied
+    Window& window = addWindow(key, std::move(indices));
+    window.freqAxis = SNR.freqAxis;
+    window.freqAxis.trim(startIndex, SNR.freqAxis.size() - startIndex - axis.size());
+    return window;
+}
+
+
+
+/**
+ * @brief Window of the nearest SNR bin to each frequency of the axis, for spectra on coarser bins than the SNR, as in
+ *        DecisionAgent::resizeSNRtoMatch.
+ *
+ * @param axis - frequency axis of the spectrum, relative like the SNR's
+ * @return const Window& - cached window of axis.size() bins
+ */
+const SNRProfile::Window& SNRProfile::nearestWindow(const FrequencyAxis& axis) {
+    WindowKey key = keyFor(SNR_MATCH_NEAREST, axis);
+    std::map<WindowKey, Window>::iterator cached = windows.find(key);
+    if (cached != windows.end()) {
+        return cached->second;
+    }
+    if (SNR.freqAxis.size() < 2) {
+        throw std::runtime_error("Error: SNR needs at least 2 bins to match a spectrum to\n");
+    }
+
+    std::vector<int> indices(axis.size());
+    int matchingIndex = 1;
+    for (size_t i = 0; i < indices.size(); i++) {
+        while (axis[i] > SNR.freqAxis[matchingIndex]) {
+            matchingIndex++;
+
+            if (matchingIndex >= (int)SNR.freqAxis.size()) {
+                matchingIndex = (int)SNR.freqAxis.size()-1;
+                break;
+            }
+        }
+        if (std::abs(SNR.freqAxis[matchingIndex]-axis[i]) > std::abs(SNR.freqAxis[matchingIndex-1]-axis[i])) {
+            matchingIndex--;
+        }
+
+        indices[i] = matchingIndex;
+    }
+
+    Window& window = addWindow(key, std::move(indices));
+    std::vector<double>& freqAxis = window.freqAxis.edit();
+    freqAxis.resize(window.size());
+    for (size_t i = 0; i < window.size(); i++) {
+        freqAxis[i] = SNR.freqAxis[window.indices[i]];
+    }
+    return window;
+}
+
+
+
+/**
+ * @brief Key of the window for an axis. An aligned window only depends on where the axis starts on the SNR bins, so it is keyed on the offset of
+ *        the first frequency in SNR bins, as the combined spectrum grid places spectra: within COMBINED_GRID_TOLERANCE of a bin the offset is
+ *        that bin, anywhere else it is the middle of the bins around it. Axes recomputed with rounding noise thus share one window. Nearest-bin
+ *        windows are keyed on the first and last frequencies.
+ *
+ */
+SNRProfile::WindowKey SNRProfile::keyFor(int matching, const FrequencyAxis& axis) const {
+    if (axis.empty()) {
+        return std::make_tuple(matching, 0.0, 0.0, (size_t)0);
+    }
+    if (matching != SNR_MATCH_ALIGNED || SNR.freqAxis.empty()) {
+        return std::make_tuple(matching, axis.front(), axis.back(), axis.size());
+    }
+
+    double binOffset = (axis.front() - SNR.freqAxis.front())/SNRBinWidth();
+    double onBin = std::round(binOffset);
+    double position = (std::abs(binOffset - onBin) <= COMBINED_GRID_TOLERANCE) ? onBin : std::floor(binOffset) + 0.5;
+    return std::make_tuple(matching, position, 0.0, axis.size());
+}
+
+
+
+// Spacing of the SNR bins, 1 if there is only one
+double SNRProfile::SNRBinWidth() const {
+    return (SNR.freqAxis.size() > 1) ? SNR.freqAxis[1] - SNR.freqAxis[0] : 1;
+}
+
+
+
+/**
+ * @brief Caches a window with the given SNR bins, filling in its SNR and reciprocal SNR. The caller sets the frequency axis.
+ *
+ */
+SNRProfile::Window& SNRProfile::addWindow(const WindowKey& key, std::vector<int> indices) {
+    Window& window = windows[key];
+    window.indices = std::move(indices);
+
+    window.powers.resize(window.size());
+    window.reciprocal.resize(window.size());
+    for (size_t i = 0; i < window.size(); i++) {
+        window.powers[i] = SNR.powers[window.indices[i]];
+        window.reciprocal[i] = 1/window.powers[i];
+    }
+    return window;
+}
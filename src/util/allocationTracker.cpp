@@ -0,0 +1,152 @@
+/**
+ * @file allocationTracker.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Heap allocation accounting behind the stage timers of timing.cpp. With TRACK_ALLOCATIONS the global operator new and delete are
+ *        replaced here: every allocation is counted for the calling thread, and the bytes in use for the process, so startTimer and
+ *        stopTimer can attribute the allocations in between to their stage. The over-aligned forms, and memory that doesn't come from
+ *        operator new (the FFTW, DMA and pool buffers), are not counted.
+ * @version 0.1
+ * @date 2023-11-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+static thread_local AllocationCounters threadCounters;
+static std::atomic<int64_t> heapBytes{0};
+static std::atomic<int64_t> heapPeakBytes{0};
+
+#if TRACK_ALLOCATIONS
+// Every block starts with its size, so delete can take it off the bytes in use. Keeps the alignment malloc gives
+#define ALLOCATION_HEADER_BYTES (16)
+static_assert(alignof(std::max_align_t) <= ALLOCATION_HEADER_BYTES, "Allocation header must keep the alignment of malloc");
+
+static void* trackedAllocate(size_t size) {
+    void* block = std::malloc(size + ALLOCATION_HEADER_BYTES);
+    if (block == nullptr) {
+        return nullptr;
+    }
+    *reinterpret_cast<size_t*>(block) = size;
+
+    threadCounters.allocations++;
+    threadCounters.bytes += size;
+    int64_t inUse = heapBytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+    int64_t peak = heapPeakBytes.load(std::memory_order_relaxed);
+    while (inUse > peak && !heapPeakBytes.compare_exchange_weak(peak, inUse, std::memory_order_relaxed)) {}
+
+    return reinterpret_cast<char*>(block) + ALLOCATION_HEADER_BYTES;
+}
+
+static void trackedFree(void* pointer) {
+    if (pointer == nullptr) {
+        return;
+    }
+    void* block = reinterpret_cast<char*>(pointer) - ALLOCATION_HEADER_BYTES;
+    heapBytes.fetch_sub((int64_t)*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void* operator new(size_t size) {
+    void* pointer = trackedAllocate(size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return trackedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return trackedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    trackedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    trackedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    trackedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    trackedFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    trackedFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    trackedFree(pointer);
+}
+#endif
+
+
+
+// Allocations of the calling thread so far, zero without TRACK_ALLOCATIONS
+AllocationCounters threadAllocations() {
+    return threadCounters;
+}
+
+// Bytes allocated through operator new and not yet freed
+int64_t heapInUse() {
+    return heapBytes.load(std::memory_order_relaxed);
+}
+
+// Most bytes in use since the last resetHeapPeak
+int64_t heapPeak() {
+    return heapPeakBytes.load(std::memory_order_relaxed);
+}
+
+void resetHeapPeak() {
+    heapPeakBytes.store(heapInUse(), std::memory_order_relaxed);
+}
+
+
+
+/**
+ * @brief Adds the allocations of one timed item.
+ *
+ * @param item - allocations the item made, the difference of threadAllocations() around it
+ * @param heap - heapInUse() when the item finished
+ */
+void AllocationStats::record(const AllocationCounters& item, int64_t heap) {
+    items.fetch_add(1, std::memory_order_relaxed);
+    allocations.fetch_add(item.allocations, std::memory_order_relaxed);
+    bytes.fetch_add(item.bytes, std::memory_order_relaxed);
+
+    int64_t previous = peakHeap.load(std::memory_order_relaxed);
+    while (heap > previous && !peakHeap.compare_exchange_weak(previous, heap, std::memory_order_relaxed)) {}
+}
+
+
+
+AllocationSummary AllocationStats::summary() const {
+    AllocationSummary summary;
+    summary.items = items.load(std::memory_order_relaxed);
+    summary.allocations = allocations.load(std::memory_order_relaxed);
+    summary.bytes = bytes.load(std::memory_order_relaxed);
+    summary.peakHeap = peakHeap.load(std::memory_order_relaxed);
+    return summary;
+}
+
+
+
+void AllocationStats::reset() {
+    items.store(0, std::memory_order_relaxed);
+    allocations.store(0, std::memory_order_relaxed);
+    bytes.store(0, std::memory_order_relaxed);
+    peakHeap.store(0, std::memory_order_relaxed);
+}
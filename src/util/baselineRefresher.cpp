@@ -0,0 +1,129 @@
+/**
+ * @file baselineRefresher.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the BaselineRefresher class. See include\utils\baselineRefresher.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Prepares a refresher for the running average of source, with a copy of its baseline filter. Call start() to run it.
+ *
+ * @param source - DataProcessor whose running average is refreshed from. Its averaging stage offers the snapshots
+ * @param intervalSeconds - time between refreshes
+ * @param minSpectra - fewest sub-spectra added since the previous snapshot that a baseline is refreshed from. Smaller windows are extended
+ */
+BaselineRefresher::BaselineRefresher(const DataProcessor& source, double intervalSeconds, int minSpectra)
+    : source(&source), filter(source.baselineFilter), interval(intervalSeconds), minSpectra(max(minSpectra, 1)) {}
+
+
+
+BaselineRefresher::~BaselineRefresher() {
+    stop();
+}
+
+
+
+void BaselineRefresher::start() {
+    if (worker.joinable()) {
+        return;
+    }
+    stopping = false;
+    previous = { {}, 0 };
+    worker = std::thread(&BaselineRefresher::run, this);
+}
+
+
+
+void BaselineRefresher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCondition.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+
+
+/**
+ * @brief Hands a copy of the running average to the thread if it asked for one. Called by the averaging stage after every update, so it
+ *        costs an atomic load unless a snapshot is due.
+ *
+ * @param runningAverage - running average of the source
+ * @param numSpectra - sub-spectra in it
+ */
+void BaselineRefresher::offerRunningAverage(const std::vector<double>& runningAverage, int numSpectra) {
+    if (!snapshotRequested.load(std::memory_order_relaxed) || !snapshotRequested.exchange(false)) {
+        return;
+    }
+    std::atomic_store(&offered, std::make_shared<Snapshot>(Snapshot{ runningAverage, numSpectra }));
+}
+
+
+
+// Asks for a snapshot every interval and refreshes from it, below the pipeline's priority
+void BaselineRefresher::run() {
+    setTraceThreadName("Baseline refresher");
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while (!stopCondition.wait_for(lock, std::chrono::duration<double>(interval), [this]() { return stopping; })) {
+        std::shared_ptr<Snapshot> snapshot = std::atomic_exchange(&offered, std::shared_ptr<Snapshot>());
+        snapshotRequested = true;
+        if (snapshot == nullptr) {
+            continue;
+        }
+
+        lock.unlock();
+        try {
+            refresh(*snapshot);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Baseline refresh failed: " << e.what() << '\n';
+        }
+        lock.lock();
+    }
+}
+
+
+
+/**
+ * @brief Publishes the baseline of the sub-spectra added between the previous snapshot and this one, once there are minSpectra of them.
+ *
+ * @param snapshot - running average and its sub-spectra
+ */
+void BaselineRefresher::refresh(const Snapshot& snapshot) {
+    // A reset or narrowed running average starts a new window
+    if (snapshot.numSpectra < previous.numSpectra || snapshot.average.size() != previous.average.size()) {
+        previous = { std::vector<double>(snapshot.average.size(), 0), 0 };
+    }
+
+    int windowSpectra = snapshot.numSpectra - previous.numSpectra;
+    if (windowSpectra < minSpectra || snapshot.average.empty()) {
+        return;
+    }
+
+    // Mean of the window from the two running means
+    std::vector<double> window = snapshot.average;
+    spectrumScaleAdd(window.data(), (double)snapshot.numSpectra/windowSpectra, previous.average.data(), -(double)previous.numSpectra/windowSpectra, window.size());
+    filter.apply(window);
+
+    std::shared_ptr<const RefreshedBaseline> last = latest();
+    std::shared_ptr<RefreshedBaseline> baseline = std::make_shared<RefreshedBaseline>();
+    baseline->values = std::move(window);
+    baseline->version = (last != nullptr) ? last->version + 1 : 1;
+    baseline->numSpectra = windowSpectra;
+    std::atomic_store(&published, std::shared_ptr<const RefreshedBaseline>(std::move(baseline)));
+
+    previous = snapshot;
+    std::cout << "Baseline refreshed from " << std::to_string(windowSpectra) << " sub-spectra." << std::endl;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file binRepairPlan.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the BinRepairPlan class. See include\utils\binRepairPlan.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Compiles the fills for a set of bad bins and DC bins.
+ *
+ * @param badBins - bins replaced by the average of the bins BAD_BIN_FILL_OFFSET away on either side. May be unsorted and repeat bins
+ * @param DCbins - consecutive bins replaced by the average of the bins just outside them. May be empty
+ * @param spectrumSize - length of the spectra the plan is applied to
+ */
+void BinRepairPlan::build(const std::vector<int>& badBins, const std::vector<int>& DCbins, size_t spectrumSize) {
+    sourceBadBins = badBins;
+    sourceDCbins = DCbins;
+    size = spectrumSize;
+    runs.clear();
+    stagedCount = 0;
+    DCfirst = DClength = 0;
+
+    std::vector<int> sortedBins = badBins;
+    std::sort(sortedBins.begin(), sortedBins.end());
+    sortedBins.erase(std::unique(sortedBins.begin(), sortedBins.end()), sortedBins.end());
+    if (!sortedBins.empty() && (sortedBins.front() < 0 || sortedBins.back() >= (int)spectrumSize)) {
+        throw std::runtime_error("Error: Bad bin outside of the " + std::to_string(spectrumSize) + " bin spectrum\n");
+    }
+
+    int numBins = (int)spectrumSize;
+    int offset = BAD_BIN_FILL_OFFSET % numBins;
+    for (int bin : sortedBins) {
+        int low = (bin + numBins - offset) % numBins;
+        int high = (bin + offset) % numBins;
+
+        // The pass runs in increasing bin order, so a source that is a lower bad bin has already been overwritten
+        bool lowStaged = low < bin && std::binary_search(sortedBins.begin(), sortedBins.end(), low);
+        bool highStaged = high < bin && std::binary_search(sortedBins.begin(), sortedBins.end(), high);
+
+        if (!runs.empty()) {
+            Run& run = runs.back();
+            if (bin == run.first + run.length && low == run.low + run.length && high == run.high + run.length &&
+                lowStaged == (run.lowStaged >= 0) && highStaged == (run.highStaged >= 0)) {
+                run.length++;
+                continue;
+            }
+        }
+
+        Run run;
+        run.first = bin;
+        run.length = 1;
+        run.low = low;
+        run.high = high;
+        run.lowStaged = lowStaged ? 0 : -1;
+        run.highStaged = highStaged ? 0 : -1;
+        runs.push_back(run);
+    }
+
+    // A source read from the staged copy owns length consecutive values of it
+    stagedCount = 0;
+    for (Run& run : runs) {
+        if (run.lowStaged >= 0) {
+            run.lowStaged = stagedCount;
+            stagedCount += run.length;
+        }
+        if (run.highStaged >= 0) {
+            run.highStaged = stagedCount;
+            stagedCount += run.length;
+        }
+    }
+
+    if (!DCbins.empty()) {
+        DCfirst = *std::min_element(DCbins.begin(), DCbins.end());
+        DClength = *std::max_element(DCbins.begin(), DCbins.end()) - DCfirst + 1;
+        if (DCfirst < 1 || DCfirst + DClength >= numBins || DClength != (int)DCbins.size()) {
+            throw std::runtime_error("Error: DC bins must be consecutive and inside the spectrum\n");
+        }
+    }
+}
+
+
+
+/**
+ * @brief Checks whether the plan was built from these bins and spectrum length, so it doesn't need to be rebuilt.
+ *
+ */
+bool BinRepairPlan::builtFor(const std::vector<int>& badBins, const std::vector<int>& DCbins, size_t spectrumSize) const {
+    return size == spectrumSize && sourceBadBins == badBins && sourceDCbins == DCbins;
+}
+
+
+
+/**
+ * @brief Masks the bad bins and then the DC bins of a spectrum in place.
+ *
+ * @param spectrum - spectrum of spectrumSize() bins
+ */
+void BinRepairPlan::apply(std::vector<double>& spectrum) const {
+    if (spectrum.size() != size) {
+        throw std::runtime_error("Error: Bin repair plan for " + std::to_string(size) + " bins applied to a " + std::to_string(spectrum.size()) +
+                                 " bin spectrum\n");
+    }
+    double* data = spectrum.data();
+
+    // Sources that the pass overwrites before reading them. Rare, so only allocated when there are any
+    std::vector<double> staged;
+    if (stagedCount > 0) {
+        staged.resize(stagedCount);
+        for (const Run& run : runs) {
+            if (run.lowStaged >= 0) {
+                std::copy(data + run.low, data + run.low + run.length, staged.begin() + run.lowStaged);
+            }
+            if (run.highStaged >= 0) {
+                std::copy(data + run.high, data + run.high + run.length, staged.begin() + run.highStaged);
+            }
+        }
+    }
+
+    for (const Run& run : runs) {
+        const double* low = (run.lowStaged >= 0) ? staged.data() + run.lowStaged : data + run.low;
+        const double* high = (run.highStaged >= 0) ? staged.data() + run.highStaged : data + run.high;
+        double* bins = data + run.first;
+        for (int i = 0; i < run.length; i++) {
+            bins[i] = (low[i] + high[i]) / 2.0;
+        }
+    }
+
+    // Replace DC bins with a flat average fill
+    if (DClength > 0) {
+        double fillValue = (data[DCfirst - 1] + data[DCfirst + DClength]) / 2.0;
+        std::fill(data + DCfirst, data + DCfirst + DClength, fillValue);
+    }
+}
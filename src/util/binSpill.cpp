@@ -0,0 +1,128 @@
+/**
+ * @file binSpill.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the BinSpill class. See include\utils\binSpill.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+static std::atomic<int> spillsCreated{0}; // Keeps the names of the spill files of one process apart
+
+
+
+/**
+ * @brief Creates an empty spill file in directory, named after the process and a counter. It is deleted once the spill is destroyed.
+ *
+ * @param directory - directory of the spill file, created if missing. The working directory if empty
+ */
+BinSpill::BinSpill(const std::string& directory) {
+    if (!directory.empty()) {
+        std::filesystem::create_directories(directory);
+    }
+    std::string name = "combinedSpectrum_" + std::to_string(GetCurrentProcessId()) + "_" + std::to_string(spillsCreated++) + ".spill";
+    path = directory.empty() ? name : directory + "/" + name;
+
+    file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Error: Unable to create spill file " + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+}
+
+
+
+BinSpill::~BinSpill() {
+    unmap();
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+
+
+/**
+ * @brief Writes bins to the end of the file.
+ *
+ * @param bins - records to write
+ * @param count - number of records
+ * @return uint64_t - index of the first record written, for read
+ */
+uint64_t BinSpill::append(const SpilledBin* bins, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t first = records.load();
+
+    LARGE_INTEGER offset;
+    offset.QuadPart = (LONGLONG)(first * sizeof(SpilledBin));
+    if (!SetFilePointerEx(file, offset, NULL, FILE_BEGIN)) {
+        throw std::runtime_error("Error: Unable to seek in spill file " + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+
+    // WriteFile takes at most 4 GB per call
+    const char* data = reinterpret_cast<const char*>(bins);
+    size_t bytesLeft = count * sizeof(SpilledBin);
+    while (bytesLeft > 0) {
+        DWORD chunk = (DWORD)min(bytesLeft, (size_t)1 << 30);
+        DWORD written = 0;
+        if (!WriteFile(file, data, chunk, &written, NULL) || written != chunk) {
+            throw std::runtime_error("Error: Unable to write to spill file " + path + " -- " + std::to_string(GetLastError()) + "\n");
+        }
+        data += chunk;
+        bytesLeft -= chunk;
+    }
+
+    records = first + count;
+    return first;
+}
+
+
+
+/**
+ * @brief Copies records out of the mapping, mapping the file again first if they were appended since it was last mapped.
+ *
+ * @param first - index of the first record, from append
+ * @param count - number of records
+ * @param bins - receives the records
+ */
+void BinSpill::read(uint64_t first, size_t count, SpilledBin* bins) {
+    if (count == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (first + count > records.load()) {
+        throw std::runtime_error("Error: Read past the end of spill file " + path + "\n");
+    }
+
+    if (first + count > mappedRecords) {
+        unmap();
+        mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle != NULL) {
+            view = reinterpret_cast<const SpilledBin*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (view == nullptr) {
+            unmap();
+            throw std::runtime_error("Error: Unable to map spill file " + path + " -- " + std::to_string(GetLastError()) + "\n");
+        }
+        mappedRecords = records.load();
+    }
+
+    std::memcpy(bins, view + first, count * sizeof(SpilledBin));
+}
+
+
+
+void BinSpill::unmap() {
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mappingHandle != NULL) {
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+    mappedRecords = 0;
+}
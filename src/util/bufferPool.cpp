@@ -0,0 +1,213 @@
+/**
+ * @file bufferPool.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the BufferPool class. See include\utils\bufferPool.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Destroy the BufferPool object. Frees every buffer the pool owns, including any that were never returned.
+ *
+ */
+BufferPool::~BufferPool() {
+    deallocate();
+}
+
+
+
+/**
+ * @brief Allocates the pool's buffers, with pipeline_malloc or, for ALLOCATE_* flags other than ALLOCATE_DEFAULT, from one allocatePages
+ *        slab with every buffer on a cache line boundary. Any previously allocated buffers are freed first.
+ *
+ * @param numBuffers - number of buffers in the pool (hard cap on buffers in flight)
+ * @param samplesPerBuffer - number of pipeline_complex samples in each buffer
+ * @param allocationFlags - ALLOCATE_* flags of the buffers
+ */
+void BufferPool::allocate(int numBuffers, int samplesPerBuffer, int allocationFlags) {
+    deallocate();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    bufferSamples = samplesPerBuffer;
+    requestedAllocation = allocationFlags;
+    placedAllocation = ALLOCATE_DEFAULT;
+    buffers.reserve(numBuffers);
+    freeBuffers.reserve(numBuffers);
+    refCounts.assign(numBuffers, 0);
+
+    if (allocationFlags != ALLOCATE_DEFAULT) {
+        bufferBytes = (sizeof(pipeline_complex) * samplesPerBuffer + 63) / 64 * 64;
+        slab = allocatePages(bufferBytes * numBuffers, allocationFlags, &placedAllocation);
+        if (slab == nullptr) {
+            throw std::runtime_error("Error: BufferPool failed to allocate " + std::to_string(bufferBytes * numBuffers) + " bytes\n");
+        }
+
+        for (int i = 0; i < numBuffers; i++) {
+            pipeline_complex* buffer = reinterpret_cast<pipeline_complex*>(reinterpret_cast<char*>(slab) + i * bufferBytes);
+            buffers.push_back(buffer);
+            freeBuffers.push_back(buffer);
+        }
+        return;
+    }
+
+    for (int i = 0; i < numBuffers; i++) {
+        pipeline_complex* buffer = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * samplesPerBuffer));
+        if (buffer == NULL) {
+            throw std::runtime_error("Error: BufferPool failed to allocate buffer " + std::to_string(i) + "\n");
+        }
+
+        buffers.push_back(buffer);
+        freeBuffers.push_back(buffer);
+        slotLookup.push_back({ buffer, i });
+    }
+    std::sort(slotLookup.begin(), slotLookup.end());
+}
+
+
+
+/**
+ * @brief Frees all buffers owned by the pool.
+ *
+ * @warning No stage may still hold a buffer from this pool when this is called.
+ */
+void BufferPool::deallocate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (slab != nullptr) {
+        freePages(slab);
+        slab = nullptr;
+    }
+    else {
+        for (pipeline_complex* buffer : buffers) {
+            pipeline_free(buffer);
+        }
+    }
+
+    buffers.clear();
+    freeBuffers.clear();
+    refCounts.clear();
+    slotLookup.clear();
+    bufferSamples = 0;
+    bufferBytes = 0;
+}
+
+
+
+/**
+ * @brief Marks every buffer as available again. Used between acquisitions to reclaim buffers left in queues after an error.
+ *
+ * @warning Only call once every stage that borrows from this pool has exited.
+ */
+void BufferPool::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeBuffers = buffers;
+    std::fill(refCounts.begin(), refCounts.end(), 0);
+}
+
+
+
+/**
+ * @brief Borrows a buffer from the pool, blocking until one is returned if the pool is exhausted.
+ *
+ * @param timeout_ms - maximum time to wait for a buffer in ms. Negative values wait indefinitely.
+ * @return pipeline_complex* - borrowed buffer, or nullptr if the wait timed out
+ */
+pipeline_complex* BufferPool::acquire(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto bufferAvailable = [this]() { return !freeBuffers.empty(); };
+    if (timeout_ms < 0) {
+        bufferReturnedCondition.wait(lock, bufferAvailable);
+    }
+    else if (!bufferReturnedCondition.wait_for(lock, std::chrono::milliseconds(timeout_ms), bufferAvailable)) {
+        return nullptr;
+    }
+
+    pipeline_complex* buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    refCounts[slotOf(buffer)] = 1;
+
+    return buffer;
+}
+
+
+
+/**
+ * @brief Adds a holder to a borrowed buffer. Each call must be matched by an extra release() before the buffer returns to the pool.
+ *
+ * @param buffer - buffer previously obtained from acquire()
+ */
+void BufferPool::retain(pipeline_complex* buffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int& count = refCounts[slotOf(buffer)];
+    if (count == 0) {
+        throw std::runtime_error("Error: BufferPool::retain called on a buffer that is not borrowed\n");
+    }
+    count++;
+}
+
+
+
+/**
+ * @brief Drops one holder of a borrowed buffer. Once the last holder releases it the buffer returns to the pool and one waiting stage is woken.
+ *
+ * @param buffer - buffer previously obtained from acquire()
+ */
+void BufferPool::release(pipeline_complex* buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int& count = refCounts[slotOf(buffer)];
+        if (count == 0) {
+            throw std::runtime_error("Error: BufferPool::release called on a buffer that is not borrowed\n");
+        }
+        if (--count > 0) {
+            return;
+        }
+
+        freeBuffers.push_back(buffer);
+    }
+    bufferReturnedCondition.notify_one();
+}
+
+
+
+/**
+ * @brief Number of buffers currently available to borrow.
+ *
+ * @return int
+ */
+int BufferPool::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)freeBuffers.size();
+}
+
+
+
+/**
+ * @brief Index of a buffer in the pool, from its offset in the slab or by binary search of the address table built in allocate(). The caller
+ *        must hold the mutex.
+ *
+ * @param buffer - buffer to look up
+ * @return int - index of the buffer in buffers and refCounts
+ */
+int BufferPool::slotOf(pipeline_complex* buffer) const {
+    if (slab != nullptr) {
+        std::ptrdiff_t offset = reinterpret_cast<char*>(buffer) - reinterpret_cast<char*>(slab);
+        if (offset >= 0 && offset % bufferBytes == 0 && (size_t)offset / bufferBytes < buffers.size()) {
+            return (int)((size_t)offset / bufferBytes);
+        }
+    }
+    else {
+        auto it = std::lower_bound(slotLookup.begin(), slotLookup.end(), std::make_pair(buffer, 0));
+        if (it != slotLookup.end() && it->first == buffer) {
+            return it->second;
+        }
+    }
+
+    throw std::runtime_error("Error: Buffer does not belong to this BufferPool\n");
+}
@@ -0,0 +1,197 @@
+/**
+ * @file calibrationStore.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the CalibrationStore class. See include\utils\calibrationStore.hpp for the class definition
+ *        and the file format.
+ * @version 0.1
+ * @date 2023-11-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+/**
+ * @brief Maps the newest calibration of the store, if there is one.
+ *
+ * @param directory - store directory, CALIBRATION_STORE_DIRECTORY by default. Created by the first publish
+ */
+CalibrationStore::CalibrationStore(const std::string& directory) : directory(directory) {
+    refresh();
+}
+
+
+
+CalibrationStore::~CalibrationStore() {
+    unmap();
+}
+
+
+
+/**
+ * @brief Maps the newest generation of the store if it is newer than the mapped one. A generation that fails to map keeps the old mapping.
+ *
+ * @return true - a newer generation is mapped now
+ */
+bool CalibrationStore::refresh() {
+    uint64_t newest = newestGeneration();
+    if (newest <= generation()) {
+        return false;
+    }
+    return map(newest);
+}
+
+
+
+/**
+ * @brief Writes a calibration as the next generation of the store and maps it. Generations older than the CALIBRATION_STORE_KEEP newest are
+ *        deleted, unless another process still maps them, in which case a later publication deletes them. One publisher at a time.
+ *
+ * @param calibration - calibration to publish. The SNR and its frequencies must have the same length
+ * @return uint64_t - generation of the publication
+ */
+uint64_t CalibrationStore::publish(const Calibration& calibration) {
+    if (calibration.SNR.size() != calibration.SNRFreqs.size()) {
+        throw std::runtime_error("Error: Calibration SNR of " + std::to_string(calibration.SNR.size()) + " bins has " +
+                                 std::to_string(calibration.SNRFreqs.size()) + " frequencies\n");
+    }
+    std::filesystem::create_directories(directory);
+
+    CalibrationHeader header = {};
+    std::memcpy(header.magic, CALIBRATION_MAGIC, sizeof(CALIBRATION_MAGIC));
+    header.version = CALIBRATION_VERSION;
+    header.poleNumber = calibration.poleNumber;
+    header.generation = max(newestGeneration(), generation()) + 1;
+    header.sampleRate = calibration.sampleRate;
+    header.cutoffFrequency = calibration.cutoffFrequency;
+    header.stopbandAttenuation = calibration.stopbandAttenuation;
+    header.baselineBins = calibration.baseline.size();
+    header.SNRBins = calibration.SNR.size();
+    header.numBadBins = calibration.badBins.size();
+
+    std::vector<int32_t> badBins(calibration.badBins.begin(), calibration.badBins.end());
+    std::string path = generationPath(header.generation);
+    std::string tempPath = path + CALIBRATION_TEMP_SUFFIX;
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(calibration.baseline.data()), calibration.baseline.size()*sizeof(double));
+        file.write(reinterpret_cast<const char*>(calibration.SNR.data()), calibration.SNR.size()*sizeof(double));
+        file.write(reinterpret_cast<const char*>(calibration.SNRFreqs.data()), calibration.SNRFreqs.size()*sizeof(double));
+        file.write(reinterpret_cast<const char*>(badBins.data()), badBins.size()*sizeof(int32_t));
+        file.close();
+        if (!file) {
+            throw std::runtime_error("Error: Unable to write calibration " + tempPath + "\n");
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        throw std::runtime_error("Error: Unable to publish calibration " + path + " -- " + error.message() + "\n");
+    }
+    map(header.generation);
+
+    // Stale generations another process still maps can't be deleted yet
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error)) {
+        uint64_t old = 0;
+        std::string name = entry.path().filename().string();
+        if (entry.path().extension() == ".cal" && std::sscanf(name.c_str(), "calibration_%" SCNu64 ".cal", &old) == 1 &&
+            old + CALIBRATION_STORE_KEEP <= header.generation) {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+    return header.generation;
+}
+
+
+
+// Generation of the newest complete calibration file in the store, 0 for none
+uint64_t CalibrationStore::newestGeneration() const {
+    uint64_t newest = 0;
+    std::error_code error;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error)) {
+        uint64_t generation = 0;
+        std::string name = entry.path().filename().string();
+        if (entry.path().extension() == ".cal" && std::sscanf(name.c_str(), "calibration_%" SCNu64 ".cal", &generation) == 1) {
+            newest = max(newest, generation);
+        }
+    }
+    return newest;
+}
+
+
+
+std::string CalibrationStore::generationPath(uint64_t generation) const {
+    return directory + "/calibration_" + std::to_string(generation) + ".cal";
+}
+
+
+
+/**
+ * @brief Maps a generation read-only in place of the mapped one, after checking the header and the file size against each other.
+ *
+ * @param generation - generation to map
+ * @return true - the generation is mapped
+ * @return false - it couldn't be opened or isn't a complete version CALIBRATION_VERSION calibration, and the old mapping is kept
+ */
+bool CalibrationStore::map(uint64_t generation) {
+    std::string path = generationPath(generation);
+
+    // Sharing delete keeps this handle from blocking the cleanup of a publisher, which still fails while the generation is mapped
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cout << "Warning: Unable to open calibration " << path << " -- " << std::to_string(GetLastError()) << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    HANDLE newMapping = NULL;
+    const char* newView = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG)sizeof(CalibrationHeader)) {
+        newMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (newMapping != NULL) {
+            newView = reinterpret_cast<const char*>(MapViewOfFile(newMapping, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+    CloseHandle(file);
+
+    bool valid = false;
+    if (newView != nullptr) {
+        const CalibrationHeader& header = *reinterpret_cast<const CalibrationHeader*>(newView);
+        uint64_t doubles = header.baselineBins + 2*header.SNRBins;
+        uint64_t expectedBytes = sizeof(CalibrationHeader) + doubles*sizeof(double) + header.numBadBins*sizeof(int32_t);
+        valid = std::memcmp(header.magic, CALIBRATION_MAGIC, sizeof(CALIBRATION_MAGIC)) == 0 && header.version == CALIBRATION_VERSION &&
+                header.generation == generation && (uint64_t)size.QuadPart == expectedBytes;
+    }
+    if (!valid) {
+        if (newView != nullptr) {
+            UnmapViewOfFile(newView);
+        }
+        if (newMapping != NULL) {
+            CloseHandle(newMapping);
+        }
+        std::cout << "Warning: " << path << " is not a complete version " << std::to_string(CALIBRATION_VERSION) << " calibration, keeping generation "
+                  << std::to_string(this->generation()) << std::endl;
+        return false;
+    }
+
+    unmap();
+    mappingHandle = newMapping;
+    view = newView;
+    return true;
+}
+
+
+
+void CalibrationStore::unmap() {
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mappingHandle != NULL) {
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * @file cancellationToken.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the CancellationToken class. See include\utils\cancellationToken.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Cancels the token and wakes every subscriber. Only the first call has an effect.
+ *
+ * @param reason - why the token was cancelled, e.g. the error message of the failed thread
+ * @return true - this call cancelled the token
+ * @return false - the token was already cancelled
+ */
+bool CancellationToken::cancel(const std::string& reason) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->cancelled.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    state->reason = reason;
+    state->cancelled.store(true, std::memory_order_release);
+
+    // Wake under the lock so a subscriber being destroyed waits until its callback has returned
+    for (std::pair<const size_t, std::function<void()>>& subscriber : state->subscribers) {
+        subscriber.second();
+    }
+    return true;
+}
+
+
+
+/**
+ * @brief Returns the reason given to cancel(), or an empty string if the token has not been cancelled.
+ *
+ */
+std::string CancellationToken::reason() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->reason;
+}
+
+
+
+/**
+ * @brief Clears the cancellation for the next step. Subscribers stay registered.
+ *
+ * @warning Only call between steps, while no thread is checking the token.
+ */
+void CancellationToken::reset() {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->cancelled.store(false, std::memory_order_release);
+    state->reason = "";
+}
+
+
+
+/**
+ * @brief Registers a callback that cancel() calls once to wake a sleeping thread. The callback must not call back into the token.
+ *
+ * @param wake - callback, typically notifying the condition variable the thread sleeps on (under its mutex)
+ * @return Subscription - keeps the callback registered for as long as it lives
+ */
+CancellationToken::Subscription CancellationToken::subscribe(std::function<void()> wake) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    size_t id = state->nextID++;
+    state->subscribers[id] = wake;
+    return Subscription(state, id);
+}
+
+
+
+CancellationToken::Subscription& CancellationToken::Subscription::operator=(Subscription&& other) noexcept {
+    if (this != &other) {
+        reset();
+        state = std::move(other.state);
+        id = other.id;
+        other.state.reset();
+    }
+    return *this;
+}
+
+
+
+/**
+ * @brief Unregisters the callback. Does nothing if the token is already gone.
+ *
+ */
+void CancellationToken::Subscription::reset() {
+    std::shared_ptr<State> lockedState = state.lock();
+    if (lockedState != nullptr) {
+        std::lock_guard<std::mutex> lock(lockedState->mutex);
+        lockedState->subscribers.erase(id);
+    }
+    state.reset();
+}
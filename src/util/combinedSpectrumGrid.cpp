@@ -0,0 +1,825 @@
+/**
+ * @file combinedSpectrumGrid.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the CombinedSpectrumGrid class. See include\utils\combinedSpectrumGrid.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+// Quotient rounded down for negative values too, as coarseIndex does for coarse bins
+static long long floorDivide(long long value, long long divisor) {
+    return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+
+/**
+ * @brief Construct an empty CombinedSpectrumGrid.
+ *
+ * @param rebinningWidthC - global bins per coarse bin of the rebinned view, 0 disables it
+ * @param convolutionWidthK - coarse bins summed by each rebinned bin
+ * @param pyramidLevels - levels of the pyramid above the grid, 0 disables it
+ */
+CombinedSpectrumGrid::CombinedSpectrumGrid(int rebinningWidthC, int convolutionWidthK, int pyramidLevels) {
+    setRebinning(rebinningWidthC, convolutionWidthK);
+    setPyramid(pyramidLevels);
+}
+
+
+
+/**
+ * @brief Adds a rescaled spectrum to the combination. Each bin is reweighted by the squared SNR of the new trace, as in the optimal weighting
+ *        of the combined spectrum.
+ *
+ * @param rescaledSpectrum - spectrum with a frequency axis relative to its trueCenterFreq
+ * @param SNR - SNR of each bin of rescaledSpectrum
+ * @param weight - factor on the squared SNR, for traces averaged over more or fewer sub-spectra than the SNR holds for
+ */
+void CombinedSpectrumGrid::add(const Spectrum& rescaledSpectrum, const std::vector<double>& SNR, double weight) {
+    size_t width = rescaledSpectrum.powers.size();
+    if (width == 0) {
+        return;
+    }
+    if (SNR.size() < width || rescaledSpectrum.freqAxis.size() < width) {
+        throw std::runtime_error("Error: Rescaled spectrum has more bins than its SNR or frequency axis\n");
+    }
+
+    long long first = placeSpectrum(rescaledSpectrum);
+    long long end = first + (long long)width;
+
+
+    size_t start = (size_t)(first - storageFirstBin);
+    for (size_t i = 0; i < width; i++) {
+        size_t bin = start + i;
+
+        // Increase the number of contributing traces
+        numTraces[bin] += 1;
+
+        // Add SNR (R_ij) squared to the sum
+        double oldSum = weightSum[bin];
+        double newSNRsq = weight*SNR[i]*SNR[i];
+        double newSum = oldSum + newSNRsq;
+
+        // Update the sum normalization term and sigma in each bin
+        weightSum[bin] = newSum;
+        sigmaCombined[bin] = std::sqrt(1/newSum);
+
+        // Update the powers based on the reweighted contributing traces
+        powers[bin] *= (oldSum/newSum);
+        powers[bin] += (newSNRsq/newSum)*rescaledSpectrum.powers[i];
+    }
+
+    spectrumAdded(first, end);
+}
+
+
+
+/**
+ * @brief Merges a combined spectrum into the combination, e.g. the traces of another digitizer. Each bin is reweighted by the bin's weight sum
+ *        in the merged spectrum, so merging the combination of some traces is the same as adding each of them.
+ *
+ * @param combinedSpectrum - spectrum with a frequency axis relative to its trueCenterFreq, 0 for the absolute axis of toCombinedSpectrum
+ */
+void CombinedSpectrumGrid::merge(const CombinedSpectrum& combinedSpectrum) {
+    size_t width = combinedSpectrum.powers.size();
+    if (width == 0) {
+        return;
+    }
+    if (combinedSpectrum.weightSum.size() < width || combinedSpectrum.numTraces.size() < width || combinedSpectrum.freqAxis.size() < width) {
+        throw std::runtime_error("Error: Combined spectrum has more bins than its weights, trace counts or frequency axis\n");
+    }
+
+    long long first = placeSpectrum(combinedSpectrum);
+    long long end = first + (long long)width;
+
+
+    size_t start = (size_t)(first - storageFirstBin);
+    for (size_t i = 0; i < width; i++) {
+        size_t bin = start + i;
+        double weight = combinedSpectrum.weightSum[i];
+        if (weight <= 0) {
+            continue;
+        }
+
+        numTraces[bin] += combinedSpectrum.numTraces[i];
+
+        double oldSum = weightSum[bin];
+        double newSum = oldSum + weight;
+
+        weightSum[bin] = newSum;
+        sigmaCombined[bin] = std::sqrt(1/newSum);
+
+        powers[bin] *= (oldSum/newSum);
+        powers[bin] += (weight/newSum)*combinedSpectrum.powers[i];
+    }
+
+    spectrumAdded(first, end);
+}
+
+
+
+/**
+ * @brief Copies the occupied bins out as a CombinedSpectrum with an absolute frequency axis, so its trueCenterFreq is 0.
+ *
+ */
+CombinedSpectrum CombinedSpectrumGrid::toCombinedSpectrum() const {
+    CombinedSpectrum combinedSpectrum;
+    combinedSpectrum.trueCenterFreq = 0;
+
+    combinedSpectrum.powers.assign(size(), 0);
+    combinedSpectrum.weightSum.assign(size(), 0);
+    combinedSpectrum.sigmaCombined.assign(size(), 0);
+    combinedSpectrum.numTraces.assign(size(), 0);
+
+    long long storageEndBin = storageFirstBin + (long long)powers.size();
+    for (long long bin = max(firstBin, storageFirstBin); bin < min(endBin, storageEndBin); bin++) {
+        size_t i = (size_t)(bin - firstBin), stored = (size_t)(bin - storageFirstBin);
+        combinedSpectrum.powers[i] = powers[stored];
+        combinedSpectrum.weightSum[i] = weightSum[stored];
+        combinedSpectrum.sigmaCombined[i] = sigmaCombined[stored];
+        combinedSpectrum.numTraces[i] = numTraces[stored];
+    }
+
+    for (const auto& chunk : spilledChunks) {
+        std::vector<SpilledBin> bins = spilledChunk(chunk.first);
+        for (size_t j = 0; j < bins.size(); j++) {
+            size_t i = (size_t)(chunk.first - firstBin) + j;
+            combinedSpectrum.powers[i] = bins[j].power;
+            combinedSpectrum.weightSum[i] = bins[j].weightSum;
+            combinedSpectrum.sigmaCombined[i] = bins[j].sigmaCombined;
+            combinedSpectrum.numTraces[i] = bins[j].numTraces;
+        }
+    }
+
+    std::vector<double>& freqAxis = combinedSpectrum.freqAxis.edit();
+    freqAxis.resize(size());
+    for (size_t i = 0; i < size(); i++) {
+        freqAxis[i] = gridOrigin + (double)(firstBin + (long long)i)*binWidth;
+    }
+
+    return combinedSpectrum;
+}
+
+
+
+/**
+ * @brief Empties the combination, including its spilled bins. The next spectrum added defines a new grid, with the same retention window.
+ *
+ */
+void CombinedSpectrumGrid::clear() {
+    firstBin = endBin = storageFirstBin = 0;
+    lastFirstBin = lastEndBin = 0;
+    powers.clear();
+    weightSum.clear();
+    sigmaCombined.clear();
+    numTraces.clear();
+
+    firstCoarse = 0;
+    coarseWeightedPowers.clear();
+    coarseWeights.clear();
+
+    for (PyramidLevel& level : pyramid) {
+        level = PyramidLevel();
+    }
+
+    spilledChunks.clear();
+    spill.reset();
+}
+
+
+
+/**
+ * @brief Sets the shape of the rebinned view and rebuilds its coarse sums from the bins added so far.
+ *
+ * @param rebinningWidthC - global bins per coarse bin, 0 disables the rebinned view
+ * @param convolutionWidthK - coarse bins summed by each rebinned bin
+ */
+void CombinedSpectrumGrid::setRebinning(int rebinningWidthC, int convolutionWidthK) {
+    this->rebinningWidthC = max(rebinningWidthC, 0);
+    this->convolutionWidthK = max(convolutionWidthK, 1);
+
+    firstCoarse = 0;
+    coarseWeightedPowers.clear();
+    coarseWeights.clear();
+    if (this->rebinningWidthC > 0 && !empty()) {
+        // The sums are rebuilt from the storage, so the spilled bins are faulted back first and spilled again by the next add
+        reserveBins(firstBin, endBin);
+        updateCoarseBins(firstBin, endBin);
+    }
+}
+
+
+
+/**
+ * @brief Sets the depth of the pyramid and rebuilds its sums from the bins added so far.
+ *
+ * @param levels - levels above the grid, so the coarsest bins are 2^levels global bins. 0 disables the pyramid
+ */
+void CombinedSpectrumGrid::setPyramid(int levels) {
+    // Level widths are passed on as int
+    pyramid.assign((size_t)std::clamp(levels, 0, 30), PyramidLevel());
+    if (!pyramid.empty() && !empty()) {
+        updatePyramid(firstBin, endBin);
+    }
+}
+
+
+
+/**
+ * @brief Bounds the bins kept in memory to a window around the newest spectrum. Bins farther from it are flushed to a spill file once at least
+ *        half a window of them has built up, so a scan stepping in one direction flushes every half window instead of every step.
+ *
+ * @param residentBins - bins kept on either side of the newest spectrum, 0 keeps every bin in memory and reads the spilled ones back
+ * @param spillDirectory - directory of the spill file, the working directory if empty
+ */
+void CombinedSpectrumGrid::setRetention(long long residentBins, const std::string& spillDirectory) {
+    retentionBins = max(residentBins, 0LL);
+    this->spillDirectory = spillDirectory;
+
+    if (retentionBins == 0) {
+        if (!spilledChunks.empty()) {
+            reserveBins(firstBin, endBin);
+        }
+        spill.reset();
+        return;
+    }
+    if (!empty()) {
+        retain();
+    }
+}
+
+
+
+/**
+ * @brief Bins held in the spill file rather than in memory.
+ *
+ */
+size_t CombinedSpectrumGrid::spilledSize() const {
+    size_t bins = 0;
+    for (const auto& chunk : spilledChunks) {
+        bins += (size_t)chunk.second.second;
+    }
+    return bins;
+}
+
+
+
+/**
+ * @brief Rebins every complete coarse bin of the grid.
+ *
+ * @return CombinedSpectrum - one bin per window of convolutionWidthK coarse bins, on the absolute frequency axis. Empty if rebinning is disabled
+ */
+CombinedSpectrum CombinedSpectrumGrid::rebinnedSpectrum() const {
+    if (rebinningWidthC <= 0 || empty()) {
+        return rebinnedWindows(0, 0);
+    }
+    return rebinnedWindows(coarseIndex(firstBin), coarseIndex(endBin) + 1);
+}
+
+
+
+/**
+ * @brief Rebins only the windows that overlap the newest spectrum added, i.e. the rebinned bins the last add() changed.
+ *
+ * @return CombinedSpectrum - changed rebinned bins, on the absolute frequency axis. Empty if rebinning is disabled
+ */
+CombinedSpectrum CombinedSpectrumGrid::rebinnedUpdate() const {
+    if (rebinningWidthC <= 0 || lastEndBin == lastFirstBin) {
+        return rebinnedWindows(0, 0);
+    }
+    return rebinnedWindows(coarseIndex(lastFirstBin) - convolutionWidthK + 1, coarseIndex(lastEndBin - 1) + 1);
+}
+
+
+
+/**
+ * @brief Rebins the complete bins of one pyramid level within a frequency range. Level bin m is the same as a rebinned bin of the rebinned
+ *        view with rebinningWidthC = 2^level and convolutionWidthK = 1 starting at global bin m*2^level, so decisions can be made on it.
+ *
+ * @param level - 0 for the grid's own bins, up to pyramidLevels()
+ * @param firstFreq - lowest frequency to cover, MHz. The whole scan by default
+ * @param lastFreq - highest frequency to cover, MHz
+ * @return CombinedSpectrum - the level's bins overlapping the range, on the absolute frequency axis. Empty for a level outside the pyramid
+ */
+CombinedSpectrum CombinedSpectrumGrid::pyramidSpectrum(int level, double firstFreq, double lastFreq) const {
+    CombinedSpectrum spectrum;
+    spectrum.trueCenterFreq = 0;
+    if (level < 0 || level > pyramidLevels() || empty()) {
+        return spectrum;
+    }
+
+    firstFreq = max(firstFreq, gridOrigin + (double)firstBin*binWidth);
+    lastFreq = min(lastFreq, gridOrigin + (double)(endBin - 1)*binWidth);
+    if (lastFreq < firstFreq) {
+        return spectrum;
+    }
+
+    // Complete bins only, as every bin must cover 2^level occupied bins
+    long long width = 1LL << level;
+    long long first = floorDivide(std::llround((firstFreq - gridOrigin)/binWidth), width);
+    long long end = floorDivide(std::llround((lastFreq - gridOrigin)/binWidth), width) + 1;
+    first = max(first, floorDivide(firstBin + width - 1, width));
+    end = min(end, floorDivide(endBin, width));
+    if (end <= first) {
+        return spectrum;
+    }
+
+    size_t numBins = (size_t)(end - first);
+    std::vector<double> weightedPowers(numBins, 0), weights(numBins, 0);
+    for (size_t j = 0; j < numBins; j++) {
+        long long m = first + (long long)j;
+        if (level == 0) {
+            SpilledBin bin = binAt(m);
+            weightedPowers[j] = bin.power*bin.weightSum;
+            weights[j] = bin.weightSum;
+            continue;
+        }
+
+        const PyramidLevel& sums = pyramid[level - 1];
+        if (m >= sums.first && m < sums.first + (long long)sums.weights.size()) {
+            weightedPowers[j] = sums.weightedPowers[(size_t)(m - sums.first)];
+            weights[j] = sums.weights[(size_t)(m - sums.first)];
+        }
+    }
+    convolveCoarseBins(weightedPowers, weights, (int)width, 1, spectrum);
+
+    // Each bin is labelled with the global bin at its center
+    std::vector<double>& freqAxis = spectrum.freqAxis.edit();
+    freqAxis.resize(numBins);
+    spectrum.numTraces.resize(numBins);
+    for (size_t j = 0; j < numBins; j++) {
+        long long centerBin = (first + (long long)j)*width + width/2;
+        freqAxis[j] = gridOrigin + (double)centerBin*binWidth;
+        spectrum.numTraces[j] = tracesAt(centerBin);
+    }
+
+    return spectrum;
+}
+
+
+
+/**
+ * @brief View of a frequency range in at most maxBins bins, from the finest pyramid level that fits, for zoomable plots. Unlike
+ *        pyramidSpectrum the powers are the weighted means of the bins, on the scale of the grid's own bins, so they don't change with the
+ *        zoom. A range wider than maxBins bins of the coarsest level comes back at that level.
+ *
+ * @param firstFreq - lowest frequency to show, MHz, clamped to the occupied bins
+ * @param lastFreq - highest frequency to show, MHz
+ * @param maxBins - bins of the view at most
+ * @return CombinedSpectrum - the view, on the absolute frequency axis
+ */
+CombinedSpectrum CombinedSpectrumGrid::zoomedSpectrum(double firstFreq, double lastFreq, size_t maxBins) const {
+    if (empty() || maxBins == 0) {
+        return pyramidSpectrum(-1);
+    }
+
+    firstFreq = max(firstFreq, gridOrigin + (double)firstBin*binWidth);
+    lastFreq = min(lastFreq, gridOrigin + (double)(endBin - 1)*binWidth);
+    double spanBins = (lastFreq - firstFreq)/binWidth + 1;
+    int level = 0;
+    while (level < pyramidLevels() && spanBins/(double)(1LL << level) > (double)maxBins) {
+        level++;
+    }
+
+    CombinedSpectrum spectrum = pyramidSpectrum(level, firstFreq, lastFreq);
+    double width = (double)(1LL << level);
+    for (double& power : spectrum.powers) {
+        power *= width;
+    }
+    return spectrum;
+}
+
+
+
+/**
+ * @brief Sliding convolution of coarse bin sums. Rebinned bin j sums coarse bins [j, j + convolutionWidthK) through prefix sums, so each
+ *        output bin costs O(1) whatever the width. Its power is the weighted mean over the window divided by rebinningWidthC*convolutionWidthK,
+ *        its weight the summed weight and its sigma 1/sqrt(weight). Windows without any weight are left at zero.
+ *
+ * @param weightedPowers - sum of power*weight of each coarse bin
+ * @param weights - sum of weight of each coarse bin
+ * @param rebinningWidthC - fine bins per coarse bin
+ * @param convolutionWidthK - coarse bins per window
+ * @param rebinnedSpectrum - receives powers, weightSum and sigmaCombined of the weights.size() - convolutionWidthK + 1 windows
+ */
+void CombinedSpectrumGrid::convolveCoarseBins(const std::vector<double>& weightedPowers, const std::vector<double>& weights, int rebinningWidthC,
+                                              int convolutionWidthK, CombinedSpectrum& rebinnedSpectrum) {
+    size_t numCoarse = weights.size();
+    size_t width = (size_t)max(convolutionWidthK, 1);
+    size_t numWindows = (numCoarse >= width) ? numCoarse - width + 1 : 0;
+
+    std::vector<double> weightedPrefix(numCoarse + 1, 0), weightPrefix(numCoarse + 1, 0);
+    for (size_t l = 0; l < numCoarse; l++) {
+        weightedPrefix[l + 1] = weightedPrefix[l] + weightedPowers[l];
+        weightPrefix[l + 1] = weightPrefix[l] + weights[l];
+    }
+
+    rebinnedSpectrum.powers.assign(numWindows, 0);
+    rebinnedSpectrum.weightSum.assign(numWindows, 0);
+    rebinnedSpectrum.sigmaCombined.assign(numWindows, 0);
+
+    double normalization = 1.0 / ((double)rebinningWidthC * width);
+    for (size_t j = 0; j < numWindows; j++) {
+        double windowWeight = weightPrefix[j + width] - weightPrefix[j];
+        if (windowWeight <= 0) {
+            continue;
+        }
+
+        rebinnedSpectrum.weightSum[j] = windowWeight;
+        rebinnedSpectrum.sigmaCombined[j] = 1/std::sqrt(windowWeight);
+        rebinnedSpectrum.powers[j] = (weightedPrefix[j + width] - weightedPrefix[j]) * normalization / windowWeight;
+    }
+}
+
+
+
+/**
+ * @brief Rebins windows [firstWindow, endWindow), clamped to the windows whose coarse bins are all inside the occupied bins.
+ *
+ */
+CombinedSpectrum CombinedSpectrumGrid::rebinnedWindows(long long firstWindow, long long endWindow) const {
+    CombinedSpectrum rebinnedSpectrum;
+    rebinnedSpectrum.trueCenterFreq = 0;
+    if (rebinningWidthC <= 0 || empty()) {
+        return rebinnedSpectrum;
+    }
+
+    // Complete coarse bins only, as every window must cover rebinningWidthC*convolutionWidthK occupied bins
+    long long completeFirst = coarseIndex(firstBin + rebinningWidthC - 1);
+    long long completeEnd = coarseIndex(endBin);
+    firstWindow = max(firstWindow, completeFirst);
+    endWindow = min(endWindow, completeEnd - convolutionWidthK + 1);
+    if (endWindow <= firstWindow) {
+        return rebinnedSpectrum;
+    }
+
+    size_t numCoarse = (size_t)(endWindow - firstWindow + convolutionWidthK - 1);
+    size_t start = (size_t)(firstWindow - firstCoarse);
+    std::vector<double> weightedPowers(coarseWeightedPowers.begin() + start, coarseWeightedPowers.begin() + start + numCoarse);
+    std::vector<double> weights(coarseWeights.begin() + start, coarseWeights.begin() + start + numCoarse);
+    convolveCoarseBins(weightedPowers, weights, rebinningWidthC, convolutionWidthK, rebinnedSpectrum);
+
+    // Each window is labelled with the bin at its center
+    size_t numWindows = (size_t)(endWindow - firstWindow);
+    std::vector<double>& freqAxis = rebinnedSpectrum.freqAxis.edit();
+    freqAxis.resize(numWindows);
+    rebinnedSpectrum.numTraces.resize(numWindows);
+    for (size_t j = 0; j < numWindows; j++) {
+        long long centerBin = (firstWindow + (long long)j)*rebinningWidthC + ((long long)convolutionWidthK*rebinningWidthC)/2;
+        freqAxis[j] = gridOrigin + (double)centerBin*binWidth;
+        rebinnedSpectrum.numTraces[j] = tracesAt(centerBin);
+    }
+
+    return rebinnedSpectrum;
+}
+
+
+
+/**
+ * @brief Recomputes the sums of the coarse bins overlapping global bins [first, end), growing the coarse storage at either end as needed.
+ *
+ */
+void CombinedSpectrumGrid::updateCoarseBins(long long first, long long end) {
+    long long lo = coarseIndex(first);
+    long long hi = coarseIndex(end - 1) + 1;
+
+    if (coarseWeights.empty()) {
+        firstCoarse = lo;
+    }
+    while (firstCoarse > lo) {
+        coarseWeightedPowers.push_front(0);
+        coarseWeights.push_front(0);
+        firstCoarse--;
+    }
+    while (firstCoarse + (long long)coarseWeights.size() < hi) {
+        coarseWeightedPowers.push_back(0);
+        coarseWeights.push_back(0);
+    }
+
+    // Coarse bins at the edges may reach past the storage, whose bins outside it hold no weight
+    long long storageEndBin = storageFirstBin + (long long)powers.size();
+    for (long long l = lo; l < hi; l++) {
+        double weightedPower = 0, weight = 0;
+        long long binFirst = max(l*rebinningWidthC, storageFirstBin);
+        long long binEnd = min((l + 1)*rebinningWidthC, storageEndBin);
+        for (long long bin = binFirst; bin < binEnd; bin++) {
+            size_t i = (size_t)(bin - storageFirstBin);
+            weightedPower += powers[i]*weightSum[i];
+            weight += weightSum[i];
+        }
+        coarseWeightedPowers[(size_t)(l - firstCoarse)] = weightedPower;
+        coarseWeights[(size_t)(l - firstCoarse)] = weight;
+    }
+}
+
+
+
+/**
+ * @brief Recomputes the pyramid sums over global bins [first, end) level by level, each from the pairs of bins below it, growing every level
+ *        at either end as needed. The grid's bins are read wherever they are held, so a pair half in the spill still sums correctly.
+ *
+ */
+void CombinedSpectrumGrid::updatePyramid(long long first, long long end) {
+    long long lo = first, hi = end;
+    for (int level = 1; level <= pyramidLevels(); level++) {
+        lo = floorDivide(lo, 2);
+        hi = floorDivide(hi - 1, 2) + 1;
+
+        PyramidLevel& sums = pyramid[level - 1];
+        if (sums.weights.empty()) {
+            sums.first = lo;
+        }
+        while (sums.first > lo) {
+            sums.weightedPowers.push_front(0);
+            sums.weights.push_front(0);
+            sums.first--;
+        }
+        while (sums.first + (long long)sums.weights.size() < hi) {
+            sums.weightedPowers.push_back(0);
+            sums.weights.push_back(0);
+        }
+
+        for (long long m = lo; m < hi; m++) {
+            double weightedPower = 0, weight = 0;
+            for (long long child = 2*m; child < 2*m + 2; child++) {
+                if (level == 1) {
+                    SpilledBin bin = binAt(child);
+                    weightedPower += bin.power*bin.weightSum;
+                    weight += bin.weightSum;
+                    continue;
+                }
+
+                const PyramidLevel& below = pyramid[level - 2];
+                if (child >= below.first && child < below.first + (long long)below.weights.size()) {
+                    weightedPower += below.weightedPowers[(size_t)(child - below.first)];
+                    weight += below.weights[(size_t)(child - below.first)];
+                }
+            }
+            sums.weightedPowers[(size_t)(m - sums.first)] = weightedPower;
+            sums.weights[(size_t)(m - sums.first)] = weight;
+        }
+    }
+}
+
+
+
+/**
+ * @brief Coarse bin holding global bin bin. Rounds down for negative bins too.
+ *
+ */
+long long CombinedSpectrumGrid::coarseIndex(long long bin) const {
+    long long width = rebinningWidthC;
+    return (bin >= 0) ? bin / width : -((-bin + width - 1) / width);
+}
+
+
+
+/**
+ * @brief Finds the global bins of a spectrum about to be added and makes room for them. The first spectrum fixes the grid.
+ *
+ * @param spectrum - spectrum with a frequency axis relative to its trueCenterFreq
+ * @return long long - global bin of the spectrum's first bin
+ */
+long long CombinedSpectrumGrid::placeSpectrum(const Spectrum& spectrum) {
+    size_t width = spectrum.powers.size();
+
+    double firstFreq = spectrum.freqAxis.front() + spectrum.trueCenterFreq;
+    if (empty()) {
+        binWidth = (width > 1) ? spectrum.freqAxis[1] - spectrum.freqAxis[0] : 1;
+        gridOrigin = firstFreq;
+        firstBin = endBin = storageFirstBin = 0;
+        powers.clear();
+        weightSum.clear();
+        sigmaCombined.clear();
+        numTraces.clear();
+    }
+
+    double binOffset = (firstFreq - gridOrigin) / binWidth;
+    long long first = std::llround(binOffset);
+    if (std::abs(binOffset - (double)first) > COMBINED_GRID_TOLERANCE) {
+        throw std::runtime_error("Error: Spectrum at " + std::to_string(spectrum.trueCenterFreq) +
+                                 " Hz does not line up with the bins of the combined spectrum\n");
+    }
+    reserveBins(first, first + (long long)width);
+
+    return first;
+}
+
+
+
+/**
+ * @brief Extends the occupied bins over the spectrum just added to global bins [first, end) and updates the rebinned view.
+ *
+ * @param first - first global bin of the spectrum
+ * @param end - global bin after its last bin
+ */
+void CombinedSpectrumGrid::spectrumAdded(long long first, long long end) {
+    if (firstBin == endBin) {
+        firstBin = first;
+        endBin = end;
+    }
+    else {
+        firstBin = min(firstBin, first);
+        endBin = max(endBin, end);
+    }
+
+    lastFirstBin = first;
+    lastEndBin = end;
+    if (rebinningWidthC > 0) {
+        updateCoarseBins(first, end);
+    }
+    if (!pyramid.empty()) {
+        updatePyramid(first, end);
+    }
+    if (retentionBins > 0) {
+        retain();
+    }
+}
+
+
+
+/**
+ * @brief Makes sure the storage covers global bins [first, end). When it has to grow, the side that ran out gets as much spare room again as
+ *        the storage already holds, so repeated steps in the same direction reallocate only O(log n) times. With rebinning the range is
+ *        widened to whole coarse bins, so updateCoarseBins never sums a coarse bin that is partly spilled. Spilled chunks the grown storage
+ *        reaches are read back whole, so the storage stays contiguous and never overlaps the spill.
+ *
+ * @param first - first global bin needed
+ * @param end - one past the last global bin needed
+ */
+void CombinedSpectrumGrid::reserveBins(long long first, long long end) {
+    if (rebinningWidthC > 0 && end > first) {
+        first = coarseIndex(first)*rebinningWidthC;
+        end = (coarseIndex(end - 1) + 1)*rebinningWidthC;
+    }
+
+    long long capacity = (long long)powers.size();
+    long long storageEndBin = storageFirstBin + capacity;
+    if (first >= storageFirstBin && end <= storageEndBin) {
+        return;
+    }
+
+    long long newFirst = min(first, storageFirstBin);
+    long long newEnd = max(end, storageEndBin);
+    if (capacity == 0) {
+        newFirst = first;
+        newEnd = end;
+    }
+    if (first < storageFirstBin) {
+        newFirst -= capacity;
+    }
+    if (end > storageEndBin) {
+        newEnd += capacity;
+    }
+
+    // Chunks are disjoint, so widening over every chunk the range overlaps can't reach another one
+    std::vector<long long> faulted;
+    for (const auto& chunk : spilledChunks) {
+        long long chunkEnd = chunk.first + chunk.second.second;
+        if (chunk.first < newEnd && chunkEnd > newFirst) {
+            newFirst = min(newFirst, chunk.first);
+            newEnd = max(newEnd, chunkEnd);
+            faulted.push_back(chunk.first);
+        }
+    }
+
+    // Move the occupied bins into the larger storage
+    size_t newSize = (size_t)(newEnd - newFirst);
+    size_t shift = (size_t)(storageFirstBin - newFirst);
+
+    std::vector<double> newPowers(newSize, 0), newWeightSum(newSize, 0), newSigmaCombined(newSize, 0);
+    std::vector<int> newNumTraces(newSize, 0);
+    for (size_t i = 0; i < powers.size(); i++) {
+        newPowers[shift + i] = powers[i];
+        newWeightSum[shift + i] = weightSum[i];
+        newSigmaCombined[shift + i] = sigmaCombined[i];
+        newNumTraces[shift + i] = numTraces[i];
+    }
+
+    for (long long chunkFirst : faulted) {
+        std::vector<SpilledBin> bins = spilledChunk(chunkFirst);
+        size_t offset = (size_t)(chunkFirst - newFirst);
+        for (size_t i = 0; i < bins.size(); i++) {
+            newPowers[offset + i] = bins[i].power;
+            newWeightSum[offset + i] = bins[i].weightSum;
+            newSigmaCombined[offset + i] = bins[i].sigmaCombined;
+            newNumTraces[offset + i] = bins[i].numTraces;
+        }
+        spilledChunks.erase(chunkFirst);
+    }
+
+    powers = std::move(newPowers);
+    weightSum = std::move(newWeightSum);
+    sigmaCombined = std::move(newSigmaCombined);
+    numTraces = std::move(newNumTraces);
+    storageFirstBin = newFirst;
+}
+
+
+
+/**
+ * @brief Flushes the occupied bins more than retentionBins from the newest spectrum to the spill and shrinks the storage to the rest. A side is
+ *        only flushed once at least half a window of its bins qualify, and the storage is reallocated so the flushed bins are really freed.
+ *
+ */
+void CombinedSpectrumGrid::retain() {
+    long long keepFirst = lastFirstBin - retentionBins;
+    long long keepEnd = lastEndBin + retentionBins;
+    if (rebinningWidthC > 0) {
+        keepFirst = coarseIndex(keepFirst)*rebinningWidthC;
+        keepEnd = (coarseIndex(keepEnd - 1) + 1)*rebinningWidthC;
+    }
+
+    // Only occupied bins are worth flushing, the spare room of the storage holds nothing
+    long long storageEndBin = storageFirstBin + (long long)powers.size();
+    long long lowFirst = max(storageFirstBin, firstBin), lowEnd = min(keepFirst, endBin);
+    long long highFirst = max(keepEnd, firstBin), highEnd = min(storageEndBin, endBin);
+    long long threshold = max(retentionBins/2, 1LL);
+    bool spillLow = lowEnd - lowFirst >= threshold;
+    bool spillHigh = highEnd - highFirst >= threshold;
+    if (!spillLow && !spillHigh) {
+        return;
+    }
+
+    if (!spill) {
+        spill = std::make_shared<BinSpill>(spillDirectory);
+    }
+    long long newFirst = storageFirstBin, newEnd = storageEndBin;
+    if (spillLow) {
+        spillBins(lowFirst, lowEnd);
+        newFirst = keepFirst;
+    }
+    if (spillHigh) {
+        spillBins(highFirst, highEnd);
+        newEnd = keepEnd;
+    }
+
+    size_t start = (size_t)(newFirst - storageFirstBin), end = (size_t)(newEnd - storageFirstBin);
+    powers = std::vector<double>(powers.begin() + start, powers.begin() + end);
+    weightSum = std::vector<double>(weightSum.begin() + start, weightSum.begin() + end);
+    sigmaCombined = std::vector<double>(sigmaCombined.begin() + start, sigmaCombined.begin() + end);
+    numTraces = std::vector<int>(numTraces.begin() + start, numTraces.begin() + end);
+    storageFirstBin = newFirst;
+}
+
+
+
+/**
+ * @brief Appends stored global bins [first, end) to the spill as one chunk. The caller drops them from the storage.
+ *
+ */
+void CombinedSpectrumGrid::spillBins(long long first, long long end) {
+    std::vector<SpilledBin> bins((size_t)(end - first));
+    for (size_t i = 0; i < bins.size(); i++) {
+        size_t stored = (size_t)(first - storageFirstBin) + i;
+        bins[i] = {powers[stored], weightSum[stored], sigmaCombined[stored], numTraces[stored], 0};
+    }
+
+    uint64_t record = spill->append(bins.data(), bins.size());
+    spilledChunks[first] = std::make_pair(record, end - first);
+}
+
+
+
+/**
+ * @brief Reads a spilled chunk back from the spill.
+ *
+ * @param chunkFirst - first global bin of the chunk, a key of spilledChunks
+ * @return std::vector<SpilledBin> - the chunk's bins
+ */
+std::vector<SpilledBin> CombinedSpectrumGrid::spilledChunk(long long chunkFirst) const {
+    const std::pair<uint64_t, long long>& chunk = spilledChunks.at(chunkFirst);
+    std::vector<SpilledBin> bins((size_t)chunk.second);
+    spill->read(chunk.first, bins.size(), bins.data());
+    return bins;
+}
+
+
+
+/**
+ * @brief A global bin, wherever it is held. All zero for bins neither stored nor spilled.
+ *
+ */
+SpilledBin CombinedSpectrumGrid::binAt(long long bin) const {
+    if (bin >= storageFirstBin && bin < storageFirstBin + (long long)numTraces.size()) {
+        size_t stored = (size_t)(bin - storageFirstBin);
+        return {powers[stored], weightSum[stored], sigmaCombined[stored], numTraces[stored], 0};
+    }
+
+    SpilledBin spilled = {0, 0, 0, 0, 0};
+    std::map<long long, std::pair<uint64_t, long long>>::const_iterator chunk = spilledChunks.upper_bound(bin);
+    if (chunk == spilledChunks.begin()) {
+        return spilled;
+    }
+    chunk--;
+    if (bin >= chunk->first + chunk->second.second) {
+        return spilled;
+    }
+
+    spill->read(chunk->second.first + (uint64_t)(bin - chunk->first), 1, &spilled);
+    return spilled;
+}
\ No newline at end of file
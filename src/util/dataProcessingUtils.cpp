@@ -30,22 +30,20 @@ void unwrapPhase(std::vector<double>& phase) {
  * @param vec - Vector of doubles to be analyzed
  * @return std::tuple<double, double> - Tuple containing the mean and standard deviation of the vector. 
  */
-std::tuple<double, double> vectorStats(std::vector<double> vec) {
+std::tuple<double, double> vectorStats(const std::vector<double>& vec) {
     if (vec.empty()) {
         // Return NaN to indicate that the mean is undefined for an empty vector.
         return std::make_tuple(std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN());
     }
 
-    double sum = std::accumulate(vec.begin(), vec.end(), 0.0);
-    double mean = sum / static_cast<double>(vec.size());
+    double count = static_cast<double>(vec.size());
+    double mean = spectrumSum(vec.data(), vec.size()) / count;
 
-    double sumSquaredDiff = 0.0;
-    for (const double& value : vec) {
-        double diff = value - mean;
-        sumSquaredDiff += diff * diff;
-    }
+    // Second pass about the mean, whose residual sum corrects for the rounding of the mean
+    double sumDiff, sumSquaredDiff;
+    spectrumMoments(vec.data(), vec.size(), mean, sumDiff, sumSquaredDiff);
 
-    double variance = sumSquaredDiff / static_cast<double>(vec.size());
+    double variance = max(sumSquaredDiff / count - (sumDiff / count)*(sumDiff / count), 0.0);
     return std::make_tuple(mean, std::sqrt(variance));
 }
 
@@ -67,7 +65,12 @@ void trimVector(std::vector<double>& vec, double cutPercentage) {
 
 void trimSpectrum(Spectrum& spec, double cutPercentage) {
     trimVector(spec.powers, cutPercentage);
-    trimVector(spec.freqAxis, cutPercentage);
+
+    // Same cut as trimVector, but the shared axis is only narrowed rather than copied
+    if (spec.freqAxis.size() >= 3) {
+        size_t numElementsToRemove = (size_t) std::round(spec.freqAxis.size() * cutPercentage);
+        spec.freqAxis.trim(numElementsToRemove, numElementsToRemove);
+    }
 }
 
 
@@ -82,22 +85,60 @@ void trimSpectrum(Spectrum& spec, double cutPercentage) {
  * @return std::vector<int> - Vector of indices of the outliers
  */
 std::vector<int> findOutliers(const std::vector<double>& data, int windowSize, double multiplier) {
-    int halfWindow = windowSize / 2;
     std::vector<int> outliers;
+    findOutliers(data, windowSize, multiplier, outliers);
+    return outliers;
+}
+
+
+
+/**
+ * @brief Same as findOutliers above, but in O(N) whatever the window size and without allocating. The window of 2*(windowSize/2) + 1 points 
+ * centered on each point keeps a rolling sum and sum of squares: each step adds the point entering the window and removes the one leaving it.
+ * The sums are taken relative to a nearby data value so the variance doesn't cancel catastrophically, and are rebuilt from scratch every
+ * OUTLIER_RESUM_INTERVAL points so rounding can't accumulate.
+ * 
+ * @param data - Vector of data to be scanned for outliers
+ * @param windowSize - Size of the moving average window
+ * @param multiplier - number of standard deviations to be considered an outlier
+ * @param outliers - Receives the indices of the outliers, in increasing order. Its storage is reused
+ */
+void findOutliers(const std::vector<double>& data, int windowSize, double multiplier, std::vector<int>& outliers) {
+    outliers.clear();
 
-    for (int i = halfWindow; i < data.size() - halfWindow; ++i) {
-        std::vector<double> windowData(data.begin() + i - halfWindow, data.begin() + i + halfWindow + 1);
-        
-        double mean, stdDev;
-        std::tie(mean, stdDev) = vectorStats(windowData);
+    int halfWindow = windowSize / 2;
+    int width = 2*halfWindow + 1;
+    int size = (int)data.size();
+    if (size < width) {
+        return;
+    }
+
+    double shift = 0, sum = 0, sumSquares = 0;
+    for (int i = halfWindow; i < size - halfWindow; ++i) {
+        if ((i - halfWindow) % OUTLIER_RESUM_INTERVAL == 0) {
+            shift = data[i];
+            sum = sumSquares = 0;
+            for (int j = i - halfWindow; j <= i + halfWindow; j++) {
+                double value = data[j] - shift;
+                sum += value;
+                sumSquares += value*value;
+            }
+        }
+        else {
+            double entering = data[i + halfWindow] - shift;
+            double leaving = data[i - halfWindow - 1] - shift;
+            sum += entering - leaving;
+            sumSquares += entering*entering - leaving*leaving;
+        }
+
+        double mean = sum / width;
+        double variance = max(sumSquares / width - mean*mean, 0.0);
 
         // Check if the current element is an outlier
-        if (data[i] > (mean + multiplier * stdDev)) {
+        if (data[i] - shift > (mean + multiplier * std::sqrt(variance))) {
             outliers.push_back(i);
         }
     }
-
-    return outliers;
 }
 
 
@@ -140,15 +181,43 @@ int findMaxIndex(std::vector<double> vec, int startIndex, int endIndex) {
 
 
 
+/**
+ * @brief Adds one vector to a running mean without keeping the vectors that were averaged.
+ * 
+ * @param mean - running mean, set to values if empty
+ * @param count - number of vectors already in the mean, incremented
+ * @param values - vector to add, the same length as mean
+ */
+void addToRunningMean(std::vector<double>& mean, int& count, const std::vector<double>& values) {
+    if (mean.empty() || count == 0) {
+        mean = values;
+        count = 1;
+        return;
+    }
+
+    count++;
+    double weight = 1.0 / (double)count;
+    spectrumScaleAdd(mean.data(), 1 - weight, values.data(), weight, mean.size());
+}
+
+
+
+/**
+ * @brief Elementwise mean of vectors of the same length. Sums them one whole vector at a time, so every vector is read once in order.
+ * 
+ * @param vecs - vectors to average, at least one
+ * @return std::vector<double> - their mean
+ */
 std::vector<double> averageVectors(const std::vector<std::vector<double>>& vecs) {
-    std::vector<double> vecAvg(vecs[0].size());
+    if (vecs.empty()) {
+        return std::vector<double>();
+    }
 
-    for (int i=0; i < vecAvg.size(); i++) {
-        for (int j=0; j < vecs.size(); j++) {
-            vecAvg[i] += vecs[j][i];
-        }
-        vecAvg[i] /= vecs.size();
+    std::vector<double> vecAvg = vecs[0];
+    for (size_t j = 1; j < vecs.size(); j++) {
+        spectrumAccumulate(vecAvg.data(), vecs[j].data(), vecAvg.size());
     }
+    spectrumScale(vecAvg.data(), 1.0 / (double)vecs.size(), vecAvg.size());
 
     return vecAvg;
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+/**
+ * @file downConverter.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the DownConverter class. See include\utils\downConverter.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Designs the anti-alias low-pass for a decimation factor and allocates the conversion buffer.
+ *
+ * @param sampleRate - input sample rate in Hz
+ * @param samplesPerBuffer - complex samples per input buffer, a multiple of decimation
+ * @param decimation - input samples per output sample, at least 2
+ * @param offsetFrequency - center of the band of interest in Hz, relative to the receiver frequency
+ */
+DownConverter::DownConverter(double sampleRate, U32 samplesPerBuffer, int decimation, double offsetFrequency)
+    : inputRate(sampleRate), samplesPerBuffer(samplesPerBuffer), decimation(decimation) {
+    if (decimation < 2 || samplesPerBuffer % (U32)decimation != 0) {
+        throw std::runtime_error("Error: Buffers of " + std::to_string(samplesPerBuffer) + " samples can't be decimated by " + 
+                                 std::to_string(decimation) + "\n");
+    }
+    phaseStep = -2*M_PI*offsetFrequency/sampleRate;
+
+    Dsp::ChebyshevII::LowPass<DOWNCONVERSION_FILTER_ORDER> design;
+    design.setup(DOWNCONVERSION_FILTER_ORDER, sampleRate, DOWNCONVERSION_STOPBAND*sampleRate/decimation, DOWNCONVERSION_ATTENUATION);
+    for (int i = 0; i < design.getNumStages(); i++) {
+        const Dsp::Cascade::Stage& stage = design[i];
+        sections.push_back({stage.m_b0, stage.m_b1, stage.m_b2, stage.m_a1, stage.m_a2});
+    }
+    state.assign(2*sections.size(), 0);
+
+    converted = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * samplesPerBuffer));
+}
+
+
+
+DownConverter::~DownConverter() {
+    pipeline_free(converted);
+}
+
+
+
+/**
+ * @brief Clears the filter and mixer state, e.g. at the start of a step, which is acquired at another receiver frequency.
+ *
+ */
+void DownConverter::reset() {
+    std::fill(state.begin(), state.end(), std::complex<double>(0));
+    phase = 0;
+}
+
+
+
+/**
+ * @brief Downconverts one sample buffer to outputSamples() complex samples.
+ *
+ * @param samples - samplesPerBuffer codes of channel A followed by samplesPerBuffer codes of channel B, as for convertSamplesToComplex
+ * @param inputRange - input range of the digitizer in V
+ * @param output - receives outputSamples() samples, ready for the FFT
+ */
+void DownConverter::process(const unsigned short* samples, double inputRange, pipeline_complex* output) {
+    convertSamplesToComplex(samples, converted, samplesPerBuffer, inputRange);
+
+    // The conversion starts every buffer on a + sign, so the sign undo restarts with the buffer while the offset mix carries on
+    std::complex<double> rotation = std::polar(1.0, phase);
+    std::complex<double> rotationStep = std::polar(1.0, M_PI + phaseStep);
+    size_t numSections = sections.size();
+
+    U32 outputIndex = 0;
+    for (U32 n = 0; n < samplesPerBuffer; n++) {
+        std::complex<double> x = std::complex<double>(converted[n][0], converted[n][1])*rotation;
+        rotation *= rotationStep;
+
+        for (size_t s = 0; s < numSections; s++) {
+            const Section& section = sections[s];
+            std::complex<double>& z1 = state[2*s];
+            std::complex<double>& z2 = state[2*s + 1];
+
+            std::complex<double> y = section.b0*x + z1;
+            z1 = section.b1*x - section.a1*y + z2;
+            z2 = section.b2*x - section.a2*y;
+            x = y;
+        }
+
+        // Keep the last sample of every decimation group, with the alternating signs that 0-center the output's DFT
+        if ((n + 1) % (U32)decimation == 0) {
+            double sign = (outputIndex % 2 == 0) ? 1 : -1;
+            output[outputIndex][0] = (pipeline_real)(sign*x.real());
+            output[outputIndex][1] = (pipeline_real)(sign*x.imag());
+            outputIndex++;
+        }
+    }
+
+    phase = std::fmod(phase + phaseStep*samplesPerBuffer, 2*M_PI);
+}
@@ -0,0 +1,47 @@
+/**
+ * @file exclusionLineTrace.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the ExclusionLineTrace class. See include\utils\exclusionLineTrace.hpp for the class
+ *        definition.
+ * @version 0.1
+ * @date 2023-11-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Takes the next snapshot of the exclusion line. Run it after every update, on the thread that updates bayesFactors.
+ *
+ * @param bayesFactors - exclusion line to snapshot
+ * @param delta - set to the bins that changed since the previous snapshot, or to the whole line for a keyframe
+ */
+void ExclusionLineTrace::snapshot(const BayesFactors& bayesFactors, ExclusionLineDelta& delta) {
+    const std::vector<double>& powers = bayesFactors.exclusionLine.powers;
+
+    // Bins below the window start don't change while it is there, and the bins appended by stepping start at the previous end of the line
+    delta.keyframe = (snapshots % keyframeInterval == 0) || powers.size() < previousSize;
+    delta.firstBin = delta.keyframe ? 0 : min((size_t)max(0, bayesFactors.startIndex), previousSize);
+    delta.powers.assign(powers.begin() + min(delta.firstBin, powers.size()), powers.end());
+
+    delta.gridStart = bayesFactors.scanAxis.empty() ? 0 : bayesFactors.scanAxis.front();
+    delta.freqRes = bayesFactors.freqRes;
+
+    previousSize = powers.size();
+    snapshots++;
+}
+
+
+
+/**
+ * @brief Starts the trace over, so the next snapshot is a keyframe.
+ *
+ */
+void ExclusionLineTrace::reset() {
+    snapshots = 0;
+    previousSize = 0;
+}
+
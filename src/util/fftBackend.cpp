@@ -0,0 +1,208 @@
+/**
+ * @file fftBackend.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for FFTBackend and its FFTW and cuFFT implementations. The cuFFT backend is only built with ENABLE_CUDA_FFT.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+/**
+ * @brief Makes the backend for one chain of the FFT stage.
+ *
+ * @param backend - FFT_BACKEND_* to make
+ * @param samplesPerSpectrum - length of each spectrum
+ * @param spectraPerBlock - most spectra per loaded block, the batch of the batched plan
+ * @param plan - single spectrum pipeline plan, used by FFT_BACKEND_FFTW
+ * @param batchPlan - batched pipeline plan over spectraPerBlock spectra, used by FFT_BACKEND_FFTW. May be NULL if spectraPerBlock is 1
+ * @return std::unique_ptr<FFTBackend> - the backend
+ */
+std::unique_ptr<FFTBackend> FFTBackend::create(int backend, int samplesPerSpectrum, int spectraPerBlock, pipeline_plan plan, pipeline_plan batchPlan) {
+    if (backend == FFT_BACKEND_FFTW) {
+        return std::make_unique<FFTWBackend>(samplesPerSpectrum, spectraPerBlock, plan, batchPlan);
+    }
+    if (backend == FFT_BACKEND_CUFFT) {
+        #if CUDA_FFT_BACKEND
+        return std::make_unique<CuFFTBackend>(samplesPerSpectrum, spectraPerBlock);
+        #else
+        throw std::runtime_error("Error: The cuFFT backend needs a build with ENABLE_CUDA_FFT\n");
+        #endif
+    }
+    throw std::runtime_error("Error: Unknown FFT backend " + std::to_string(backend) + "\n");
+}
+
+
+
+FFTWBackend::FFTWBackend(int samplesPerSpectrum, int spectraPerBlock, pipeline_plan plan, pipeline_plan batchPlan)
+    : FFTBackend(samplesPerSpectrum, spectraPerBlock), plan(plan), batchPlan(batchPlan), sum(samplesPerSpectrum, 0) {
+    spectra = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * spectraPerBlock * samplesPerSpectrum));
+}
+
+
+
+FFTWBackend::~FFTWBackend() {
+    pipeline_free(spectra);
+}
+
+
+
+void FFTWBackend::load(pipeline_complex* samples, int numSpectra) {
+    processDataFFTBatched(samples, spectra, numSpectra, samplesPerSpectrum, plan, batchPlan, spectraPerBlock);
+}
+
+
+
+void FFTWBackend::addPowers(int firstSpectrum, int numSpectra) {
+    for (int spectrum = firstSpectrum; spectrum < firstSpectrum + numSpectra; spectrum++) {
+        pipeline_complex* FFTData = spectra + (size_t)spectrum*samplesPerSpectrum;
+        for (int i = 0; i < samplesPerSpectrum; i++) {
+            sum[i] += FFTData[i][0]*FFTData[i][0] + FFTData[i][1]*FFTData[i][1];
+        }
+    }
+}
+
+
+
+void FFTWBackend::takePowerSum(pipeline_real* powerSum) {
+    std::copy(sum.begin(), sum.end(), powerSum);
+    std::fill(sum.begin(), sum.end(), (pipeline_real)0);
+}
+
+
+
+#if CUDA_FFT_BACKEND
+static void checkCuda(cudaError_t result, const char* call) {
+    if (result != cudaSuccess) {
+        throw std::runtime_error("Error: " + std::string(call) + " failed: " + cudaGetErrorString(result) + "\n");
+    }
+}
+
+static void checkCuFFT(cufftResult result, const char* call) {
+    if (result != CUFFT_SUCCESS) {
+        throw std::runtime_error("Error: " + std::string(call) + " failed with cufftResult " + std::to_string((int)result) + "\n");
+    }
+}
+
+
+
+/**
+ * @brief Sets up the stream, batched plans and device buffers for one chain.
+ *
+ * @param samplesPerSpectrum - length of each spectrum
+ * @param spectraPerBlock - most spectra per loaded block, the batch of the batched plan
+ * @param device - CUDA device to run on
+ */
+CuFFTBackend::CuFFTBackend(int samplesPerSpectrum, int spectraPerBlock, int device) : FFTBackend(samplesPerSpectrum, spectraPerBlock), device(device) {
+    try {
+        checkCuda(cudaSetDevice(device), "cudaSetDevice");
+        checkCuda(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), "cudaStreamCreate");
+
+        int N = samplesPerSpectrum;
+        checkCuFFT(cufftPlan1d(&plan, N, DEVICE_FFT_TYPE, 1), "cufftPlan1d");
+        checkCuFFT(cufftSetStream(plan, stream), "cufftSetStream");
+        if (spectraPerBlock > 1) {
+            checkCuFFT(cufftPlanMany(&batchPlan, 1, &N, NULL, 1, N, NULL, 1, N, DEVICE_FFT_TYPE, spectraPerBlock), "cufftPlanMany");
+            checkCuFFT(cufftSetStream(batchPlan, stream), "cufftSetStream");
+        }
+
+        checkCuda(cudaMalloc(&deviceSpectra, sizeof(device_complex) * spectraPerBlock * N), "cudaMalloc");
+        checkCuda(cudaMalloc(&deviceSum, sizeof(pipeline_real) * N), "cudaMalloc");
+        checkCuda(cudaMemset(deviceSum, 0, sizeof(pipeline_real) * N), "cudaMemset");
+        checkCuda(cudaMallocHost(&hostSum, sizeof(pipeline_real) * N), "cudaMallocHost");
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+}
+
+
+
+CuFFTBackend::~CuFFTBackend() {
+    release();
+}
+
+
+
+// Frees whatever the constructor got to, after the queued work is done
+void CuFFTBackend::release() {
+    cudaSetDevice(device);
+    if (stream != nullptr) {
+        cudaStreamSynchronize(stream);
+    }
+    if (batchPlan != 0) {
+        cufftDestroy(batchPlan);
+        batchPlan = 0;
+    }
+    if (plan != 0) {
+        cufftDestroy(plan);
+        plan = 0;
+    }
+    cudaFreeHost(hostSum);
+    cudaFree(deviceSum);
+    cudaFree(deviceSpectra);
+    hostSum = nullptr;
+    deviceSum = nullptr;
+    deviceSpectra = nullptr;
+    if (stream != nullptr) {
+        cudaStreamDestroy(stream);
+        stream = nullptr;
+    }
+}
+
+
+
+/**
+ * @brief Copies a block to the device and queues its transform, in place, with the batched plan if the block is full and spectrum by spectrum
+ *        otherwise. The samples are pageable pool memory, so the copy returns once they are staged and the pool buffer can be released.
+ *
+ * @param samples - numSpectra contiguous spectra of samplesPerSpectrum samples
+ * @param numSpectra - spectra in the block, at most spectraPerBlock
+ */
+void CuFFTBackend::load(pipeline_complex* samples, int numSpectra) {
+    if (numSpectra > spectraPerBlock) {
+        throw std::runtime_error("Error: Block of " + std::to_string(numSpectra) + " spectra is larger than the cuFFT batch\n");
+    }
+
+    size_t N = (size_t)samplesPerSpectrum;
+    checkCuda(cudaSetDevice(device), "cudaSetDevice");
+    checkCuda(cudaMemcpyAsync(deviceSpectra, samples, sizeof(device_complex) * numSpectra * N, cudaMemcpyHostToDevice, stream), "cudaMemcpyAsync");
+
+    if (batchPlan != 0 && numSpectra == spectraPerBlock) {
+        checkCuFFT(device_execute_dft(batchPlan, deviceSpectra, deviceSpectra, CUFFT_FORWARD), "cufftExec");
+        return;
+    }
+    for (int spectrum = 0; spectrum < numSpectra; spectrum++) {
+        device_complex* spectrumData = deviceSpectra + spectrum*N;
+        checkCuFFT(device_execute_dft(plan, spectrumData, spectrumData, CUFFT_FORWARD), "cufftExec");
+    }
+}
+
+
+
+void CuFFTBackend::addPowers(int firstSpectrum, int numSpectra) {
+    if (numSpectra > 0) {
+        addDevicePowers(deviceSpectra + (size_t)firstSpectrum*samplesPerSpectrum, numSpectra, samplesPerSpectrum, deviceSum, stream);
+        checkCuda(cudaGetLastError(), "addDevicePowers");
+    }
+}
+
+
+
+/**
+ * @brief Copies the sum back, the only transfer from the device, and clears it for the next average. Waits for the queued work of the stream.
+ *
+ * @param powerSum - samplesPerSpectrum values to write the sum to
+ */
+void CuFFTBackend::takePowerSum(pipeline_real* powerSum) {
+    size_t bytes = sizeof(pipeline_real) * samplesPerSpectrum;
+    checkCuda(cudaMemcpyAsync(hostSum, deviceSum, bytes, cudaMemcpyDeviceToHost, stream), "cudaMemcpyAsync");
+    checkCuda(cudaMemsetAsync(deviceSum, 0, bytes, stream), "cudaMemsetAsync");
+    checkCuda(cudaStreamSynchronize(stream), "cudaStreamSynchronize");
+    std::copy(hostSum, hostSum + samplesPerSpectrum, powerSum);
+}
+#endif
@@ -11,29 +11,100 @@
 
 #include "decs.hpp"
 
+/**
+ * @brief Reads a whole file into memory with a single read.
+ * 
+ * @param filename - file to read
+ * @param contents - set to the bytes of the file
+ * @return true - the file was read
+ * @return false - the file could not be opened or read
+ */
+static bool readFile(const std::string& filename, std::string& contents) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+
+    std::streamoff size = file.tellg();
+    contents.resize((size_t)max(size, (std::streamoff)0));
+    file.seekg(0);
+    file.read(&contents[0], (std::streamsize)contents.size());
+    return (bool)file || file.eof();
+}
+
+
+
+/**
+ * @brief Parses the number at next with std::from_chars, skipping leading blanks and a '+' sign, which from_chars does not accept.
+ * 
+ * @param next - first character to parse, advanced past the number
+ * @param end - end of the text
+ * @param value - parsed number
+ * @return true - a number was parsed
+ * @return false - next is not at a number
+ */
+static bool parseNumber(const char*& next, const char* end, double& value) {
+    while (next != end && (*next == ' ' || *next == '\t')) {
+        next++;
+    }
+    if (next != end && *next == '+') {
+        next++;
+    }
+
+    std::from_chars_result result = std::from_chars(next, end, value);
+    if (result.ec == std::errc::invalid_argument) {
+        return false;
+    }
+    if (result.ec == std::errc::result_out_of_range) {
+        value = std::strtod(std::string(next, result.ptr).c_str(), nullptr); // Rounds to 0 or infinity like operator>> does
+    }
+    next = result.ptr;
+    return true;
+}
+
+
+
+/**
+ * @brief Reads a CSV file of numbers into one row per line. The file is read in one go and parsed in place.
+ * 
+ * @param filename - file to read
+ * @param maxLines - lines to read at most, all if <= 0
+ * @return std::vector<std::vector<double>> - rows of the file, empty if it could not be opened
+ */
 std::vector<std::vector<double>> readCSV(std::string filename, int maxLines = -1) {
     std::vector<std::vector<double>> data;
 
-    std::ifstream file(filename);
-    if (!file) {
+    std::string contents;
+    if (!readFile(filename, contents)) {
         // Handle file not found or other errors.
         return data;
     }
 
-    std::string line;
+    const char* next = contents.data();
+    const char* end = next + contents.size();
     int linesRead = 0; // Keep track of the number of lines read
 
-    while (std::getline(file, line)) {
+    while (next != end) {
+        const char* lineEnd = std::find(next, end, '\n');
         std::vector<double> row;
-        std::stringstream ss(line);
-        std::string cell;
 
-        while (std::getline(ss, cell, ',')) {
-            double value = std::stod(cell);
+        while (next != lineEnd && !(lineEnd - next == 1 && *next == '\r')) {
+            double value;
+            if (!parseNumber(next, lineEnd, value)) {
+                throw std::runtime_error("Error: Value in line " + std::to_string(linesRead + 1) + " of " + filename + " is not a number\n");
+            }
             row.push_back(value);
+
+            while (next != lineEnd && (*next == ' ' || *next == '\t' || *next == '\r')) {
+                next++;
+            }
+            if (next != lineEnd && *next == ',') {
+                next++;
+            }
         }
+        next = (lineEnd == end) ? end : lineEnd + 1;
 
-        data.push_back(row);
+        data.push_back(std::move(row));
 
         linesRead++;
         if (maxLines > 0 && linesRead >= maxLines) {
@@ -45,36 +116,102 @@ std::vector<std::vector<double>> readCSV(std::string filename, int maxLines = -1
 }
 
 
+
+/**
+ * @brief Reads every number of a file separated by commas or whitespace, across lines, into one vector. The file is read in one go and
+ *        parsed in place. Stops at the first value that is not a number.
+ * 
+ * @param filename - file to read
+ * @return std::vector<double> - values of the file, empty if it could not be opened
+ */
 std::vector<double> readVector(const std::string& filename) {
     std::vector<double> data;
-    std::ifstream file(filename);
 
-    if (!file.is_open()) {
+    std::string contents;
+    if (!readFile(filename, contents)) {
         std::cerr << "Error: Unable to open file " << filename << std::endl;
         return data;
     }
+    data.reserve(std::count(contents.begin(), contents.end(), ',') + std::count(contents.begin(), contents.end(), '\n') + 1);
+
+    const char* next = contents.data();
+    const char* end = next + contents.size();
+    while (true) {
+        while (next != end && (*next == ',' || std::isspace((unsigned char)*next))) {
+            next++;
+        }
+        if (next == end) {
+            break;
+        }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
         double value;
-        while (iss >> value) {
-            data.push_back(value);
-            char comma;
-            if (!(iss >> comma)) {
-                break; // No more characters to read on this line
-            }
+        if (!parseNumber(next, end, value)) {
+            std::cerr << "Error: Value " << std::to_string(data.size()) << " of " << filename << " is not a number" << std::endl;
+            break;
         }
+        data.push_back(value);
     }
 
-    file.close();
     return data;
 }
 
 
-void saveVector(std::vector<double> data, std::string filename) {
+
+/**
+ * @brief Name of the file a save function writes for filename. Binary files take SPECTRUM_FILE_EXTENSION in place of the extension of
+ *        filename, so callers can keep asking for .csv files.
+ * 
+ * @param filename - requested file
+ * @param format - OUTPUT_BINARY or OUTPUT_CSV
+ * @return std::string - file written
+ */
+std::string outputFilename(const std::string& filename, int format) {
+    if (format == OUTPUT_CSV) {
+        return filename;
+    }
+    return std::filesystem::path(filename).replace_extension(SPECTRUM_FILE_EXTENSION).string();
+}
+
+
+
+/**
+ * @brief Writes arraysPerRecord arrays as one SPECTRUM_FILE_SINGLE record. Failures are reported like the CSV writers report them.
+ */
+static void saveArrays(const std::vector<const std::vector<double>*>& arrays, const FrequencyAxis* axis, double trueCenterFreq, 
+                       const std::string& filename) {
+    std::string binaryFilename = outputFilename(filename, OUTPUT_BINARY);
+    try {
+        SpectrumFileWriter writer(binaryFilename, arrays[0]->size(), (U32)arrays.size(), SPECTRUM_FILE_SINGLE, axis, trueCenterFreq);
+        if (!writer.isOpen()) {
+            std::cerr << "Unable to open file " << binaryFilename << " to save data." << std::endl;
+            return;
+        }
+
+        for (const std::vector<double>* array : arrays) {
+            writer.writeArray(*array);
+        }
+        if (!writer.close()) {
+            std::cerr << "Unable to write file " << binaryFilename << "." << std::endl;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Unable to save data to " << binaryFilename << " -- " << e.what() << std::endl;
+    }
+}
+
+
+
+void saveVector(const std::vector<double>& data, const std::string& filename, int format) {
+    if (format == OUTPUT_BINARY) {
+        saveArrays({ &data }, nullptr, 0, filename);
+        return;
+    }
+
     std::ofstream dataFile(filename);
+    if (data.size() == 0){ return; }
+
     if (dataFile.is_open()) {
+        dataFile << std::setprecision(std::numeric_limits<double>::max_digits10);
         dataFile << data[0];
         for (size_t i = 1; i < data.size(); i++) {
             dataFile << "," << data[i];
@@ -86,7 +223,14 @@ void saveVector(std::vector<double> data, std::string filename) {
 }
 
 
-void saveVector(std::vector<int> data, std::string filename) {
+void saveVector(const std::vector<int>& data, const std::string& filename, int format) {
+    // Binary files hold doubles, which represent every int exactly
+    if (format == OUTPUT_BINARY) {
+        std::vector<double> values(data.begin(), data.end());
+        saveArrays({ &values }, nullptr, 0, filename);
+        return;
+    }
+
     std::ofstream dataFile(filename);
     if (data.size() == 0){ return; }
     
@@ -102,9 +246,15 @@ void saveVector(std::vector<int> data, std::string filename) {
 }
 
 
-void saveSpectrum(Spectrum data, std::string filename) {
+void saveSpectrum(const Spectrum& data, const std::string& filename, int format) {
+    if (format == OUTPUT_BINARY) {
+        saveArrays({ &data.powers }, &data.freqAxis, data.trueCenterFreq, filename);
+        return;
+    }
+
     std::ofstream dataFile(filename);
     if (dataFile.is_open()) {
+        dataFile << std::setprecision(std::numeric_limits<double>::max_digits10);
         dataFile << data.powers[0];
         for (size_t i = 1; i < data.powers.size(); i++) {
             dataFile << "," << data.powers[i];
@@ -124,9 +274,15 @@ void saveSpectrum(Spectrum data, std::string filename) {
 }
 
 
-void saveCombinedSpectrum(CombinedSpectrum data, std::string filename) {
+void saveCombinedSpectrum(const CombinedSpectrum& data, const std::string& filename, int format) {
+    if (format == OUTPUT_BINARY) {
+        saveArrays({ &data.powers, &data.sigmaCombined }, &data.freqAxis, data.trueCenterFreq, filename);
+        return;
+    }
+
     std::ofstream dataFile(filename);
     if (dataFile.is_open()) {
+        dataFile << std::setprecision(std::numeric_limits<double>::max_digits10);
         dataFile << data.powers[0];
         for (size_t i = 1; i < data.powers.size(); i++) {
             dataFile << "," << data.powers[i];
@@ -169,12 +325,48 @@ std::string getDateTimeString() {
 
 
 
-void saveSpectraFromQueue(std::queue<Spectrum>& spectraQueue, std::string filename) {
+/**
+ * @brief Saves and empties a queue of spectra that share the first spectrum's frequency axis, e.g. the exclusion lines of a step.
+ * 
+ * @param spectraQueue - spectra to save, emptied
+ * @param filename - requested file, see outputFilename
+ * @param format - OUTPUT_BINARY writes a SPECTRUM_FILE_SEQUENCE file, OUTPUT_CSV the axis followed by one row per spectrum
+ */
+void saveSpectraFromQueue(std::queue<Spectrum>& spectraQueue, const std::string& filename, int format) {
+    if (format == OUTPUT_BINARY) {
+        std::string binaryFilename = outputFilename(filename, OUTPUT_BINARY);
+        size_t numBins = spectraQueue.empty() ? 0 : spectraQueue.front().powers.size();
+        double trueCenterFreq = spectraQueue.empty() ? 0 : spectraQueue.front().trueCenterFreq;
+        const FrequencyAxis* axis = spectraQueue.empty() ? nullptr : &spectraQueue.front().freqAxis;
+
+        try {
+            SpectrumFileWriter writer(binaryFilename, numBins, 1, SPECTRUM_FILE_SEQUENCE, axis, trueCenterFreq);
+            if (!writer.isOpen()) {
+                std::cerr << "Unable to open file " << binaryFilename << " to save data." << std::endl;
+                return;
+            }
+
+            while (!spectraQueue.empty()) {
+                writer.writeArray(spectraQueue.front().powers);
+                spectraQueue.pop();
+            }
+            if (!writer.close()) {
+                std::cerr << "Unable to write file " << binaryFilename << "." << std::endl;
+            }
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Unable to save data to " << binaryFilename << " -- " << e.what() << std::endl;
+        }
+        return;
+    }
+
     std::ofstream dataFile(filename);
     if (dataFile.is_open()) {
+        dataFile << std::setprecision(std::numeric_limits<double>::max_digits10);
+
         // Write the frequency axis (assuming all spectra have the same frequency axis)
         if (!spectraQueue.empty()) {
-            Spectrum firstSpectrum = spectraQueue.front();
+            const Spectrum& firstSpectrum = spectraQueue.front();
             dataFile << firstSpectrum.freqAxis[0];
             for (size_t i = 1; i < firstSpectrum.freqAxis.size(); i++) {
                 dataFile << "," << firstSpectrum.freqAxis[i];
@@ -186,7 +378,7 @@ void saveSpectraFromQueue(std::queue<Spectrum>& spectraQueue, std::string filena
 
         // Write each spectrum's powers
         while (!spectraQueue.empty()) {
-            Spectrum spectrum = spectraQueue.front();
+            const Spectrum& spectrum = spectraQueue.front();
             dataFile << spectrum.powers[0];
             for (size_t i = 1; i < spectrum.powers.size(); i++) {
                 dataFile << "," << spectrum.powers[i];
@@ -201,3 +393,39 @@ void saveSpectraFromQueue(std::queue<Spectrum>& spectraQueue, std::string filena
         std::cerr << "Unable to open file " << filename << " to save data." << std::endl;
     }
 }
+
+
+
+/**
+ * @brief Saves and empties a queue of exclusion line snapshots to a SPECTRUM_FILE_DELTAS file, on the axis of the scan grid. There is no CSV
+ *        form, as the records have different lengths, so SPECTRUM_FILE_EXTENSION always replaces the extension of filename.
+ * 
+ * @param deltas - snapshots to save in the order they were taken, emptied
+ * @param filename - requested file, see outputFilename
+ */
+void saveExclusionLineDeltas(std::queue<ExclusionLineDelta>& deltas, const std::string& filename) {
+    std::string binaryFilename = outputFilename(filename, OUTPUT_BINARY);
+
+    try {
+        SpectrumFileWriter writer(binaryFilename, 0, 1, SPECTRUM_FILE_DELTAS);
+        if (!writer.isOpen()) {
+            std::cerr << "Unable to open file " << binaryFilename << " to save data." << std::endl;
+            return;
+        }
+        if (!deltas.empty()) {
+            writer.setUniformAxis(deltas.front().gridStart, deltas.front().freqRes);
+        }
+
+        while (!deltas.empty()) {
+            const ExclusionLineDelta& delta = deltas.front();
+            writer.writeDelta(delta.firstBin, delta.powers.data(), delta.powers.size(), delta.keyframe);
+            deltas.pop();
+        }
+        if (!writer.close()) {
+            std::cerr << "Unable to write file " << binaryFilename << "." << std::endl;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Unable to save data to " << binaryFilename << " -- " << e.what() << std::endl;
+    }
+}
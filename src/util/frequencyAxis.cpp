@@ -0,0 +1,97 @@
+/**
+ * @file frequencyAxis.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the FrequencyAxis class. See include\utils\frequencyAxis.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Construct a FrequencyAxis that takes ownership of axis.
+ *
+ * @param axis - frequency of each bin
+ */
+FrequencyAxis::FrequencyAxis(std::vector<double> axis) {
+    *this = std::move(axis);
+}
+
+
+
+/**
+ * @brief Replaces the axis with new values. Other spectra that shared the old values keep them.
+ *
+ * @param axis - frequency of each bin
+ */
+FrequencyAxis& FrequencyAxis::operator=(std::vector<double> axis) {
+    values = std::make_shared<std::vector<double>>(std::move(axis));
+    offset = 0;
+    trimmedBack = 0;
+    return *this;
+}
+
+
+
+/**
+ * @brief Hides bins at either end of the axis. The shared values are not copied.
+ *
+ * @param fromFront - number of bins removed from the front
+ * @param fromBack - number of bins removed from the back
+ */
+void FrequencyAxis::trim(size_t fromFront, size_t fromBack) {
+    if (fromFront + fromBack > size()) {
+        throw std::runtime_error("Error: Trimming " + std::to_string(fromFront + fromBack) + " bins from a frequency axis of " 
+                                 + std::to_string(size()) + " bins\n");
+    }
+
+    offset += fromFront;
+    trimmedBack += fromBack;
+}
+
+
+
+/**
+ * @brief Gives write access to the axis values. The values are copied first unless this axis is their only, untrimmed user.
+ *
+ * @return std::vector<double>& - values owned by this axis alone. Only valid until the axis is next copied, assigned or trimmed
+ */
+std::vector<double>& FrequencyAxis::edit() {
+    if (values == nullptr) {
+        values = std::make_shared<std::vector<double>>();
+    }
+    else if (values.use_count() > 1 || offset != 0 || trimmedBack != 0) {
+        values = std::make_shared<std::vector<double>>(begin(), end());
+        offset = 0;
+        trimmedBack = 0;
+    }
+
+    return *values;
+}
+
+
+
+/**
+ * @brief Empties the axis. Other spectra sharing the values keep them.
+ *
+ */
+void FrequencyAxis::clear() {
+    values.reset();
+    offset = 0;
+    trimmedBack = 0;
+}
+
+
+
+/**
+ * @brief Values behind begin() and end(). An empty axis has no values allocated, so it refers to a shared empty vector instead.
+ *
+ */
+const std::vector<double>& FrequencyAxis::storage() const {
+    static const std::vector<double> noValues;
+    return (values == nullptr) ? noValues : *values;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file latencyHistogram.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for LatencyHistogram, the lock-free latency distribution behind the stage timers of timing.cpp.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+int LatencyHistogram::bucketOf(uint64_t nanoseconds) {
+    if (nanoseconds < (uint64_t)subBuckets) {
+        return (int)nanoseconds;
+    }
+
+    // Index of the highest set bit, found by halving
+    int exponent = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+        if (nanoseconds >> (exponent + shift)) {
+            exponent += shift;
+        }
+    }
+
+    int subBucket = (int)((nanoseconds >> (exponent - subBucketBits)) & (subBuckets - 1));
+    return (exponent - subBucketBits + 1) * subBuckets + subBucket;
+}
+
+
+
+double LatencyHistogram::bucketMidpoint(int bucket) {
+    if (bucket < subBuckets) {
+        return bucket;
+    }
+
+    int shift = bucket / subBuckets - 1;
+    double lower = std::ldexp((double)(subBuckets + bucket % subBuckets), shift);
+    return lower + 0.5 * (std::ldexp(1.0, shift) - 1);
+}
+
+
+
+/**
+ * @brief Adds one latency. Safe to call from any number of threads at once.
+ *
+ * @param nanoseconds - Latency, negative values count as 0
+ */
+void LatencyHistogram::record(int64_t nanoseconds) {
+    nanoseconds = (nanoseconds < 0) ? 0 : nanoseconds;
+
+    buckets[bucketOf((uint64_t)nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    int64_t previous = maxNanoseconds.load(std::memory_order_relaxed);
+    while (nanoseconds > previous && !maxNanoseconds.compare_exchange_weak(previous, nanoseconds, std::memory_order_relaxed)) {}
+}
+
+
+
+/**
+ * @brief Empties the histogram. Latencies recorded while it runs may survive it.
+ *
+ */
+void LatencyHistogram::reset() {
+    for (std::atomic<uint64_t>& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    samples.store(0, std::memory_order_relaxed);
+    totalNanoseconds.store(0, std::memory_order_relaxed);
+    maxNanoseconds.store(0, std::memory_order_relaxed);
+}
+
+
+
+/**
+ * @brief Overwrites the total, e.g. for a stage timed outside the histogram. The distribution is left alone.
+ *
+ * @param seconds - New total
+ */
+void LatencyHistogram::setTotal(double seconds) {
+    totalNanoseconds.store((int64_t)(seconds * 1e9), std::memory_order_relaxed);
+}
+
+
+
+/**
+ * @brief Sum of every latency recorded since the last reset, in seconds.
+ *
+ */
+double LatencyHistogram::total() const {
+    return totalNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+}
+
+
+
+/**
+ * @brief Latency below which the given fraction of the recorded latencies fall, from the midpoint of the bucket holding it.
+ *
+ * @param fraction - Between 0 and 1, e.g. 0.99 for the 99th percentile
+ * @return double - Latency in seconds, 0 if nothing was recorded
+ */
+double LatencyHistogram::percentile(double fraction) const {
+    uint64_t numSamples = count();
+    if (numSamples == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)std::ceil(fraction * numSamples);
+    rank = (rank == 0) ? 1 : rank;
+
+    uint64_t seen = 0;
+    double largest = maxNanoseconds.load(std::memory_order_relaxed);
+    for (int bucket = 0; bucket < numBuckets; bucket++) {
+        seen += buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return min(bucketMidpoint(bucket), largest) * 1e-9;
+        }
+    }
+    return largest * 1e-9;
+}
+
+
+
+/**
+ * @brief Count, total, median, 99th percentile and maximum of the recorded latencies.
+ *
+ */
+LatencySummary LatencyHistogram::summary() const {
+    LatencySummary result;
+    result.count = count();
+    result.total = total();
+    result.p50 = percentile(0.5);
+    result.p99 = percentile(0.99);
+    result.max = maxNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+    return result;
+}
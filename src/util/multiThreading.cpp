@@ -17,503 +17,1367 @@
 #include "decs.hpp"
 
 /**
- * @brief Function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous. Fourier transforms incoming data and
- *        pushes the result to the decision making and saving queues.
+ * @brief Sizes the lock-free rings between the pipeline stages for one acquisition and creates one data ring per FFT worker. Must be called
+ *        before any stage thread starts.
  * 
- * @param plan - FFTW plan object for the FFT
- * @param samplesPerSpectrum - Number of samples per buffer shared in the data queue
- * @param sharedData - Struct containing data shared between threads
- * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param sharedData - Struct containing data shared between the acquisition and FFT threads
+ * @param sharedDataProc - Struct containing data shared between processing threads
+ * @param syncFlags - Struct containing synchronization flags shared between threads. Every ring watches its cancellation token
+ * @param numFFTWorkers - Number of FFTThread workers that will run. Also sets sharedData.activeFFTWorkers
+ * @param capacity - Slots per ring. Stages that run back to back (ScanRunner::unrolledAcquisition) need room for the whole acquisition
+ * @param waitStrategy - RING_WAIT_BLOCKING or RING_WAIT_SPIN
+ * @param numProcessingWorkers - Number of processingWorker threads that will run, if any. Also clears the processing reorder buffer
  */
-void FFTThread(fftw_plan plan, int samplesPerSpectrum, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
-    try{
-    int numProcessed = 0;
-    while (true) {
-        // std::cout << "Waiting for data..." << std::endl;
+void initPipelineRings(SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, int numFFTWorkers, 
+                       size_t capacity, int waitStrategy, int numProcessingWorkers) {
+    sharedData.activeFFTWorkers = numFFTWorkers;
+    {
+        std::lock_guard<std::mutex> lock(sharedDataProc.mutex);
+        sharedDataProc.processingReorderBuffer.clear();
+        sharedDataProc.nextRawSequence = 0;
+        sharedDataProc.nextProcessedSequence = 0;
+        sharedDataProc.activeProcessingWorkers = numProcessingWorkers;
+    }
 
-        // Wait for signal from dataReadyCondition or immediately continue if the data queue is not empty (lock releases while waiting)
-        std::unique_lock<std::mutex> lock(sharedData.mutex);
-        sharedData.dataReadyCondition.wait(lock, [&sharedData]() {
-            return !sharedData.dataQueue.empty();
-        });
+    // Rings that already have the requested shape are only emptied, so long-lived shared data is not reallocated every step
+    bool sameShape = ((int)sharedData.dataRings.size() == numFFTWorkers) && (sharedData.FFTDataRing.capacity() >= capacity);
+    if (sameShape) {
+        for (std::unique_ptr<SPSCRing<DataBlock>>& dataRing : sharedData.dataRings) {
+            dataRing->reset(waitStrategy);
+        }
+        sharedData.FFTDataRing.reset(waitStrategy);
+        sharedDataProc.magDataRing.reset(waitStrategy);
+        sharedDataProc.rawDataRing.reset(waitStrategy);
+        sharedDataProc.rebinnedDataRing.reset(waitStrategy);
+        sharedDataProc.digitizerDataRing.reset(waitStrategy);
+    }
+    else {
+        sharedData.dataRings.clear();
+        for (int i = 0; i < numFFTWorkers; i++) {
+            sharedData.dataRings.push_back(std::make_unique<SPSCRing<DataBlock>>());
+            sharedData.dataRings.back()->allocate(capacity, waitStrategy);
+        }
 
+        sharedData.FFTDataRing.allocate(capacity, waitStrategy);
+        sharedDataProc.magDataRing.allocate(capacity, waitStrategy);
+        sharedDataProc.rawDataRing.allocate(capacity, waitStrategy);
+        sharedDataProc.rebinnedDataRing.allocate(capacity, waitStrategy);
+        sharedDataProc.digitizerDataRing.allocate(capacity, waitStrategy);
+    }
 
-        // Process data until data queue is empty (lock is reaquired before checking the data queue)
-        startTimer(TIMER_FFT);
-        while (!sharedData.dataQueue.empty()) {
-            // Get the pointer to the data from the queue
-            fftw_complex* complexOutput = sharedData.dataQueue.front();
-            sharedData.dataQueue.pop();
-            lock.unlock();
+    // A failure anywhere wakes every stage blocked on its rings
+    for (std::unique_ptr<SPSCRing<DataBlock>>& dataRing : sharedData.dataRings) {
+        dataRing->cancelOn(syncFlags.cancellation);
+    }
+    sharedData.FFTDataRing.cancelOn(syncFlags.cancellation);
+    sharedDataProc.magDataRing.cancelOn(syncFlags.cancellation);
+    sharedDataProc.rawDataRing.cancelOn(syncFlags.cancellation);
+    sharedDataProc.rebinnedDataRing.cancelOn(syncFlags.cancellation);
+    sharedDataProc.digitizerDataRing.cancelOn(syncFlags.cancellation);
+}
 
-            // Process the data (lock is released while processing)
-            fftw_complex* FFTData = processDataFFT(complexOutput, plan, samplesPerSpectrum);
-            numProcessed++;
 
 
-            // Acquire a new lock_guard and push the processed data to the shared queue
-            {
-                std::lock_guard<std::mutex> lock(sharedData.mutex);
-                fftw_free(complexOutput);  // Free the memory allocated for the raw data
-                sharedData.FFTDataQueue.push(FFTData);
+/**
+ * @brief Clears the per-step state of shared data that outlives a step (see ScanRunner's persistent pipeline) so the next step starts fresh.
+ *
+ * @warning Only call between steps, while no pipeline thread is running a step. The backup queue must already be empty (trimBackupQueue).
+ *
+ * @param sharedData - Struct containing data shared between the acquisition and FFT threads
+ * @param sharedSavedData - Struct containing data shared with the saving thread
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ */
+void resetStepData(SharedDataBasic& sharedData, SharedDataSaving& sharedSavedData, SynchronizationFlags& syncFlags) {
+    {
+        std::lock_guard<std::mutex> lock(sharedData.mutex);
+        for (std::pair<const int, DataBlock>& entry : sharedData.FFTReorderBuffer) {
+            if (sharedData.FFTPool == nullptr) {
+                pipeline_free(entry.second.data);
             }
-            sharedData.FFTDataReadyCondition.notify_one();
-            sharedData.saveReadyCondition.notify_one();
-            
-            lock.lock();  // Reacquire lock before checking the data queue
         }
-        stopTimer(TIMER_FFT);
+        sharedData.FFTReorderBuffer.clear();
+        sharedData.nextFFTSequence = 0;
+    }
 
-        // Check if the acquisition and processing is complete or another thread threw an error
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (syncFlags.acquisitionComplete && sharedData.dataQueue.empty()) {
-                std::cout << "FFT thread exiting. Processed " << std::to_string(numProcessed) << " spectra." << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(sharedSavedData.mutex);
+        sharedSavedData.exclusionLineQueue = std::queue<ExclusionLineDelta>();
+        sharedSavedData.exclusionLineTrace.reset();
+        sharedSavedData.exclusionLinesClosed = false;
+    }
 
-                syncFlags.FFTComplete = true;
-                sharedData.FFTDataReadyCondition.notify_one();
-                break;  // Exit the processing thread
-            }
+    syncFlags.cancellation.reset();
+
+    std::lock_guard<std::mutex> lock(syncFlags.mutex);
+    syncFlags.pauseDataCollection = false;
+    syncFlags.acquisitionComplete = false;
+    syncFlags.FFTComplete = false;
+    syncFlags.magnitudeComplete = false;
+    syncFlags.averagingComplete = false;
+    syncFlags.processingComplete = false;
+    syncFlags.decisionsComplete = false;
+    syncFlags.errorFlag = false;
+    syncFlags.errorMessage = "";
+    syncFlags.stopRequested = false;
+    syncFlags.drainInFlight = false;
+    syncFlags.wakeAcquisition = nullptr;
+    syncFlags.spectraToStop = -1;
+    syncFlags.prepareNextStep = nullptr;
+}
 
-            if (syncFlags.errorFlag) {
-                std::cout << "FFT thread gracefully exiting due to error." << std::endl;
 
-                sharedData.FFTDataReadyCondition.notify_one();
-                break;
-            }
+
+/**
+ * @brief Stops the acquisition of the current step as soon as possible. Sets the pause flags, timestamps the request for the 
+ *        DECISION_STOP_LATENCY metric and wakes the acquisition through the hook it installed, so it does not sit out its buffer wait.
+ *        With DRAIN_AFTER_DECISION the stages then discard whatever is still in flight instead of processing it.
+ *        The chains of the other digitizers of a multi-digitizer step are stopped with it.
+ * 
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ */
+void requestAcquisitionStop(SynchronizationFlags& syncFlags) {
+    std::function<void()> wakeAcquisition;
+    std::vector<SynchronizationFlags*> linkedFlags;
+    {
+        std::lock_guard<std::mutex> lock(syncFlags.mutex);
+        syncFlags.acquisitionComplete = true;
+        syncFlags.pauseDataCollection = true;
+
+        if (!syncFlags.stopRequested) {
+            syncFlags.stopRequested = true;
+            syncFlags.drainInFlight = DRAIN_AFTER_DECISION;
+            syncFlags.stopRequestTime = std::chrono::steady_clock::now();
+            wakeAcquisition = syncFlags.wakeAcquisition;
+            linkedFlags = syncFlags.linkedFlags;
         }
     }
+
+    // The hook takes the acquisition's own locks, so it must run without syncFlags.mutex
+    if (wakeAcquisition) {
+        wakeAcquisition();
     }
-    catch (const std::exception& e) {
-        std::lock_guard<std::mutex> lock(syncFlags.mutex);
-        syncFlags.errorFlag = true;
-        syncFlags.errorMessage = "FFTThread: " + std::string(e.what());
-        std::cout << syncFlags.errorMessage << '\n';
+
+    for (SynchronizationFlags* linked : linkedFlags) {
+        requestAcquisitionStop(*linked);
     }
 }
 
 
-void magnitudeThread(int samplesPerSpectrum, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor) {
-    try
-    {
-        int numProcessed = 0;
-        while (true) {
-            // std::cout << "Waiting for data..." << std::endl;
 
-            // Wait for signal from dataReadyCondition or immediately continue if the data queue is not empty (lock releases while waiting)
-            std::unique_lock<std::mutex> lock(sharedData.mutex);
-            sharedData.FFTDataReadyCondition.wait(lock, [&sharedData]() {
-                return !sharedData.FFTDataQueue.empty();
-            });
+/**
+ * @brief Checks the step's cancellation token without locking.
+ * 
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @return true - another thread has failed
+ */
+static bool threadCancelled(SynchronizationFlags& syncFlags) {
+    return syncFlags.cancellation.cancelled();
+}
 
 
-            // Process data until data queue is empty (lock is reaquired before checking the data queue)
-            startTimer(TIMER_MAG);
-            while (!sharedData.FFTDataQueue.empty()) {
 
-                // Get the pointer to the data from the queue
-                fftw_complex* FFTData = sharedData.FFTDataQueue.front();
-                sharedData.FFTDataQueue.pop();
-                lock.unlock();
+/**
+ * @brief Reads the drain flag set by requestAcquisitionStop.
+ * 
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @return true - in-flight data should be discarded
+ */
+static bool threadDrainFlag(SynchronizationFlags& syncFlags) {
+    return syncFlags.drainInFlight.load(std::memory_order_acquire);
+}
 
-                std::vector<double> magData(samplesPerSpectrum);
-                for (int i = 0; i < samplesPerSpectrum; i++) {
-                    magData[i] = ( FFTData[i][0]*FFTData[i][0] + FFTData[i][1]*FFTData[i][1] ) / samplesPerSpectrum / 50; // Hard code in 50 Ohm input impedance
-                }
 
-                magData = dataProcessor.trimDC(dataProcessor.removeBadBins(magData));
 
-                if (magData.empty()) {
-                    std::cout << "Error: Second unexpected empty data in magnitude thread." << std::endl;
-                    std::cout << "Expected magData.size() = " << std::to_string(samplesPerSpectrum) << std::endl;
-                }
+/**
+ * @brief Returns a block's buffer to its pool if it was borrowed from one, or frees it if it was allocated for the block.
+ * 
+ * @param block - block to release
+ * @param pool - pool of the stage, may be nullptr
+ */
+static void releaseBlockData(const DataBlock& block, BufferPool* pool) {
+    if (block.pooled) {
+        pool->release(block.data);
+    }
+    else {
+        pipeline_free(block.data);
+    }
+}
+
+
+
+/**
+ * @brief Pushes an item to the next stage, waiting as long as the ring is full unless the step is cancelled in the meantime.
+ * 
+ * @param ring - Ring to the next stage
+ * @param item - Item to push. Moved into the ring on success
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @return true - the item was pushed
+ * @return false - the step was cancelled while waiting
+ */
+template <typename T>
+static bool pushToRing(SPSCRing<T>& ring, T& item, SynchronizationFlags& syncFlags) {
+    while (!ring.push(item, RING_POLL_MS)) {
+        if (threadCancelled(syncFlags)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-                // Free the memory allocated for the fft data
-                fftw_free(FFTData);
-                numProcessed++;
 
 
-                // Acquire a new lock_guard and push the processed data to the shared queue
+/**
+ * @brief Function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous. Fourier transforms incoming data and
+ *        pushes the result to the decision making and saving queues. Each block of spectra is transformed with the batched plan where possible.
+ *        Several workers can run this function, each consuming its own data ring. Finished blocks are released to FFTDataRing in acquisition
+ *        order using the block sequence numbers, so downstream stages are unaffected by the number of workers.
+ * 
+ * @note Executing one plan on different arrays from several threads is thread-safe in FFTW, so all workers share the same plans.
+ * 
+ * @param plan - FFTW plan object for a single spectrum
+ * @param batchPlan - Batched FFTW plan over sharedData.spectraPerBlock contiguous spectra. May be NULL if blocks hold a single spectrum
+ * @param samplesPerSpectrum - Number of samples per spectrum in each block of the data rings
+ * @param sharedData - Struct containing data shared between threads. The rings must be set up by initPipelineRings before launching
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param workerID - Index of this worker and of the data ring it consumes
+ */
+void FFTThread(pipeline_plan plan, pipeline_plan batchPlan, int samplesPerSpectrum, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags, int workerID) {
+    try{
+    int numProcessed = 0;
+    size_t samplesPerBlock = (size_t)samplesPerSpectrum * max(1, sharedData.spectraPerBlock);
+    SPSCRing<DataBlock>& dataRing = *sharedData.dataRings[workerID];
+    while (true) {
+        // Wait for the next block dealt to this worker. The timeout lets an idle worker notice errors in other threads
+        DataBlock rawBlock;
+        if (!dataRing.pop(rawBlock, RING_POLL_MS)) {
+            if (dataRing.drained()) {
+                std::cout << "FFT worker " << std::to_string(workerID) << " exiting. Processed " << std::to_string(numProcessed) << " spectra." << std::endl;
+
+                // The last worker out marks the stage complete. Every earlier block has been released from the reorder buffer by now, unless
+                // blocks were discarded while draining. Those leave gaps in the sequence, so whatever is still waiting behind them is dropped
+                bool lastWorker;
                 {
                     std::lock_guard<std::mutex> lock(sharedData.mutex);
-                    if (!magData.empty()) {
-                        sharedDataProc.magDataQueue.push(magData);
+                    lastWorker = (--sharedData.activeFFTWorkers == 0);
+                    if (lastWorker) {
+                        for (std::pair<const int, DataBlock>& entry : sharedData.FFTReorderBuffer) {
+                            releaseBlockData(entry.second, sharedData.FFTPool);
+                        }
+                        sharedData.FFTReorderBuffer.clear();
+                    }
+                }
+                if (lastWorker) {
+                    {
+                        std::lock_guard<std::mutex> lock(syncFlags.mutex);
+                        syncFlags.FFTComplete = true;
                     }
+                    sharedData.FFTDataRing.close();
                 }
-                sharedDataProc.magDataReadyCondition.notify_one();
-                
-                lock.lock();  // Reacquire lock before checking the data queue
+                break;  // Exit the processing thread
+            }
+
+            if (threadCancelled(syncFlags)) {
+                std::cout << "FFT worker " << std::to_string(workerID) << " gracefully exiting due to error." << std::endl;
+                break;
             }
-            stopTimer(TIMER_MAG);
+            continue;
+        }
 
-            // Check if the acquisition and processing is complete
-            {
-                std::lock_guard<std::mutex> lock(syncFlags.mutex);
-                if (syncFlags.FFTComplete && sharedData.FFTDataQueue.empty()) {
-                    std::cout << "Magnitude thread exiting. Processed " << std::to_string(numProcessed) << " spectra." << std::endl;
+        // Once a decision has stopped the step, return the block untransformed
+        if (threadDrainFlag(syncFlags)) {
+            releaseBlockData(rawBlock, sharedData.dataPool);
+            dataRing.countDiscarded();
+            continue;
+        }
 
-                    syncFlags.magnitudeComplete = true;
-                    sharedDataProc.magDataReadyCondition.notify_one();
-                    break;  // Exit the processing thread
-                }
 
-                if (syncFlags.errorFlag) {
-                    std::cout << "Magnitude thread gracefully exiting due to error." << std::endl;
+        // Process the data. Outputs are borrowed from the FFT pool when one is provided
+        startTimer(TIMER_FFT);
+        DataBlock FFTBlock = { nullptr, rawBlock.numSpectra, rawBlock.sequence, rawBlock.deliveredAt };
+        if (sharedData.FFTPool != nullptr) {
+            FFTBlock.data = sharedData.FFTPool->acquire(5000);
+            if (FFTBlock.data == nullptr) {
+                throw std::runtime_error("Timed out waiting for a free FFT buffer");
+            }
+            FFTBlock.pooled = true;
+        }
+        else {
+            FFTBlock.data = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * samplesPerBlock));
+        }
+        processDataFFTBatched(rawBlock.data, FFTBlock.data, rawBlock.numSpectra, samplesPerSpectrum, plan, batchPlan, sharedData.spectraPerBlock);
+        numProcessed += rawBlock.numSpectra;
+
+        // Return the raw data block to its pool or free it
+        releaseBlockData(rawBlock, sharedData.dataPool);
 
-                    sharedDataProc.magDataReadyCondition.notify_one();
+
+        // Push every block that is now next in acquisition order to the next stage. The lock makes the workers a single producer of FFTDataRing
+        bool stalled = false;
+        {
+            std::lock_guard<std::mutex> lock(sharedData.mutex);
+            sharedData.FFTReorderBuffer[FFTBlock.sequence] = FFTBlock;
+
+            auto next = sharedData.FFTReorderBuffer.find(sharedData.nextFFTSequence);
+            while (next != sharedData.FFTReorderBuffer.end()) {
+                if (!pushToRing(sharedData.FFTDataRing, next->second, syncFlags)) {
+                    stalled = true;
                     break;
                 }
+                sharedData.FFTReorderBuffer.erase(next);
+                sharedData.nextFFTSequence++;
+
+                next = sharedData.FFTReorderBuffer.find(sharedData.nextFFTSequence);
             }
         }
+        stopTimer(TIMER_FFT, FFTBlock.sequence);
+
+        if (stalled) {
+            std::cout << "FFT worker " << std::to_string(workerID) << " gracefully exiting due to error." << std::endl;
+            break;
+        }
+    }
     }
     catch (const std::exception& e) {
-        std::lock_guard<std::mutex> lock(syncFlags.mutex);
-        syncFlags.errorFlag = true;
-        syncFlags.errorMessage = "MagnitudeThread: " + std::string(e.what());
-        std::cout << syncFlags.errorMessage << '\n';
+        std::string message = "FFTThread: " + std::string(e.what());
+        std::cout << message << '\n';
+        syncFlags.raiseError(message);
+    }
+}
+
+
+void magnitudeThread(int samplesPerSpectrum, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor) {
+    int numProcessed = 0;
+
+    Stage<DataBlock, std::vector<double>> stage("Magnitude thread", sharedData.FFTDataRing, &sharedDataProc.magDataRing, syncFlags);
+    stage.backpressure(sharedDataProc.backpressurePolicy, sharedDataProc.spillDepth);
+    stage.completes(&SynchronizationFlags::magnitudeComplete);
+    stage.drainsOnStop([&](DataBlock& FFTBlock) { releaseBlockData(FFTBlock, sharedData.FFTPool); });
+
+    stage.onItem([&](DataBlock& FFTBlock, const auto& emit) {
+        startTimer(TIMER_MAG);
+        bool pushed = true;
+        for (int spectrum = 0; spectrum < FFTBlock.numSpectra && pushed; spectrum++) {
+            pipeline_complex* FFTData = FFTBlock.data + (size_t)spectrum*samplesPerSpectrum;
+
+            std::vector<double> magData(samplesPerSpectrum);
+            for (int i = 0; i < samplesPerSpectrum; i++) {
+                magData[i] = ( FFTData[i][0]*FFTData[i][0] + FFTData[i][1]*FFTData[i][1] ) / samplesPerSpectrum / 50; // Hard code in 50 Ohm input impedance
+            }
+
+            dataProcessor.maskBadBinsAndDC(magData);
+
+            if (magData.empty()) {
+                std::cout << "Error: Second unexpected empty data in magnitude thread." << std::endl;
+                std::cout << "Expected magData.size() = " << std::to_string(samplesPerSpectrum) << std::endl;
+            }
+            else {
+                pushed = emit(magData);
+            }
+        }
+
+        // Return or free the memory allocated for the fft data
+        releaseBlockData(FFTBlock, sharedData.FFTPool);
+        numProcessed += FFTBlock.numSpectra;
+        stopTimer(TIMER_MAG, FFTBlock.sequence);
+
+        return pushed;
+    });
+
+    stage.onFinish([&](const auto&) {
+        std::cout << "Magnitude thread exiting. Processed " << std::to_string(numProcessed) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
+}
+
+
+
+/**
+ * @brief Sub-spectra in the next average of an averaging stage, chosen as the average starts. With batch bounds set in sharedData, the stage
+ *        averages its largest batches while the processing stage falls behind, so it gets fewer spectra to process, and its smallest once
+ *        the decision forecasts a stop, so the stop lands within a few sub-spectra of where the decision crosses its threshold. Otherwise it
+ *        keeps subSpectraAveragingNumber. Every spectrum records its batch, see DataProcessor::averagingWeight.
+ * 
+ * @param sharedData - Struct containing data shared between processing threads, with the batch bounds and the raw data ring
+ * @param syncFlags - Struct containing synchronization flags shared between threads, with the decision's forecast
+ * @param subSpectraAveragingNumber - nominal sub-spectra per averaged spectrum
+ * @return int - sub-spectra to average
+ */
+static int adaptiveBatchSize(const SharedDataProcessing& sharedData, const SynchronizationFlags& syncFlags, int subSpectraAveragingNumber) {
+    if (sharedData.minSubSpectra <= 0 && sharedData.maxSubSpectra <= 0) {
+        return subSpectraAveragingNumber;
+    }
+
+    size_t capacity = sharedData.rawDataRing.capacity();
+    if (capacity > 0 && sharedData.rawDataRing.size() >= ADAPTIVE_BATCH_LAG_FILL*capacity) {
+        return max(sharedData.maxSubSpectra, subSpectraAveragingNumber);
     }
+
+    int forecast = syncFlags.spectraToStop.load(std::memory_order_relaxed);
+    if (forecast >= 0 && forecast <= ADAPTIVE_BATCH_NEAR_STOP && sharedData.minSubSpectra > 0) {
+        return min(sharedData.minSubSpectra, subSpectraAveragingNumber);
+    }
+    return subSpectraAveragingNumber;
 }
 
 
 
 void averagingThread(SharedDataProcessing& sharedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, double trueCenterFreq, int subSpectraAveragingNumber = 20) {
-    try{
     int subSpectraAveraged = 0;
     int totalProcessed = 0;
-    while (true) {
-        // Wait for signal from dataReadyCondition or immediately continue if the data queue is not empty (lock releases while waiting)
-        std::unique_lock<std::mutex> lock(sharedData.mutex);
-        sharedData.magDataReadyCondition.wait(lock, [&sharedData, &subSpectraAveragingNumber, &syncFlags]() {
-            return (sharedData.magDataQueue.size() >= subSpectraAveragingNumber) || syncFlags.magnitudeComplete;
-        });
+    std::vector<std::vector<double>> subSpectra;
+    int batchSize = subSpectraAveragingNumber;
 
+    // Averages and emits the collected sub-spectra
+    auto emitAverage = [&](const Stage<std::vector<double>, Spectrum>::Emit& emit) {
         startTimer(TIMER_AVERAGE);
+        Spectrum rawSpectrum;
+        rawSpectrum.powers = averageVectors(subSpectra);
+        rawSpectrum.freqAxis = dataProcessor.SNR.freqAxis;
+        rawSpectrum.trueCenterFreq = trueCenterFreq;
+        rawSpectrum.subSpectra = (int)subSpectra.size();
+        rawSpectrum.nominalSubSpectra = subSpectraAveragingNumber;
+
+        subSpectraAveraged += (int)subSpectra.size();
+        totalProcessed += 1;
+        subSpectra.clear();
+
+        bool pushed = emit(rawSpectrum);
+        stopTimer(TIMER_AVERAGE);
+        return pushed;
+    };
+
+    Stage<std::vector<double>, Spectrum> stage("Averaging thread", sharedData.magDataRing, &sharedData.rawDataRing, syncFlags);
+    stage.backpressure(sharedData.backpressurePolicy, sharedData.spillDepth);
+    stage.completes(&SynchronizationFlags::averagingComplete);
+    stage.drainsOnStop();
+
+    stage.onItem([&](std::vector<double>& magData, const auto& emit) {
+        if (magData.empty()) {
+            std::cout << "Error: Unexpected empty data in averaging thread." << std::endl;
+            std::cout << "Spectrum Number = " << std::to_string(subSpectra.size()) << std::endl;
+            return true;
+        }
+
+        if (subSpectra.empty()) {
+            batchSize = adaptiveBatchSize(sharedData, syncFlags, subSpectraAveragingNumber);
+        }
+
+        // Update the running average using DataProcessor
+        dataProcessor.addRawSpectrumToRunningAverage(magData);
+        subSpectra.push_back(std::move(magData));
+
+        return ((int)subSpectra.size() < batchSize) || emitAverage(emit);
+    });
+
+    // Average whatever is left once the magnitude stage has finished
+    stage.onFinish([&](const auto& emit) {
+        if (!subSpectra.empty() && !emitAverage(emit)) {
+            return false;
+        }
+
+        if (syncFlags.recordsMetrics) {
+            setMetric(ACQUIRED_SPECTRA, subSpectraAveraged);
+            setMetric(SPECTRUM_AVERAGE_SIZE, (totalProcessed > 0) ? (int)std::lround((double)subSpectraAveraged/totalProcessed) : subSpectraAveragingNumber);
+        }
+
+        std::cout << "Averaging thread exiting. Averaged " << std::to_string(subSpectraAveraged) << " sub-spectra into "
+                                                           << std::to_string(totalProcessed) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
+}
+
+
+
+/**
+ * @brief Fused replacement for magnitudeThread and averagingThread. Computes the power of each incoming FFT spectrum straight into a running
+ *        sub-spectrum sum, and once a batch of spectra is summed (see adaptiveBatchSize) applies the bad bin and DC mask to the average in place
+ *        and pushes it to the raw data ring. No per-spectrum vectors or intermediate rings are used. Masking the average is equivalent to
+ *        averaging masked spectra because both fills are linear.
+ * 
+ * @param samplesPerSpectrum - Number of samples per spectrum in each block of the FFT data ring
+ * @param sharedData - Struct containing data shared between the acquisition and FFT threads
+ * @param sharedDataProc - Struct containing data shared between processing threads. This function writes to rawDataRing
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param dataProcessor - DataProcessor holding the bad bins and running average
+ * @param trueCenterFreq - Center frequency attached to each averaged spectrum
+ * @param subSpectraAveragingNumber - Nominal number of sub-spectra per averaged spectrum
+ */
+void accumulationThread(int samplesPerSpectrum, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, SynchronizationFlags& syncFlags,
+                        DataProcessor& dataProcessor, double trueCenterFreq, int subSpectraAveragingNumber) {
+    int subSpectraAveraged = 0;
+    int totalProcessed = 0;
+
+    std::vector<pipeline_real> powerSum(samplesPerSpectrum, 0);
+    int numSummed = 0;
+    int batchSize = subSpectraAveragingNumber; // Of the current sum, see adaptiveBatchSize
+    int64_t newestDelivered = 0; // Delivery of the block the current sum was last added from
+
+    // Masks and emits the current sum as one averaged spectrum, then clears the sum. Returns false if the error flag was raised while waiting
+    auto emitAverage = [&](const Stage<DataBlock, Spectrum>::Emit& emit) {
+        Spectrum rawSpectrum;
+        rawSpectrum.powers.resize(samplesPerSpectrum);
+
+        // Spectra leave the pipeline precision here, baselining and the Bayes accumulation run in double
+        double scale = 1.0 / ((double)samplesPerSpectrum * 50 * numSummed); // Hard code in 50 Ohm input impedance
+        for (int i = 0; i < samplesPerSpectrum; i++) {
+            rawSpectrum.powers[i] = powerSum[i] * scale;
+        }
+        dataProcessor.maskBadBinsAndDC(rawSpectrum.powers);
+        dataProcessor.addAverageToRunningAverage(rawSpectrum.powers, numSummed);
 
-        int procNumber = min(subSpectraAveragingNumber, (int) sharedData.magDataQueue.size());
-        std::vector<std::vector<double>> subSpectra;
-
-        int preProcQueueSize = (int) sharedData.magDataQueue.size();
-        for(int i = 0; i < procNumber; i++) {
-            // Get the pointer to the data from the queue
-            if (sharedData.magDataQueue.front().empty()) {
-                std::cout << "Error: Unexpected empty data in averaging thread." << std::endl;
-                std::cout << "Expected procNumber = " << std::to_string(procNumber) << std::endl;
-                std::cout << "Original sharedData.magDataQueue.size() = " << std::to_string(preProcQueueSize) << std::endl;
-                std::cout << "Spectrum Number = " << std::to_string(i) << std::endl;
+        rawSpectrum.freqAxis = dataProcessor.SNR.freqAxis;
+        rawSpectrum.trueCenterFreq = trueCenterFreq;
+        rawSpectrum.acquiredAt = newestDelivered;
+        rawSpectrum.subSpectra = numSummed;
+        rawSpectrum.nominalSubSpectra = subSpectraAveragingNumber;
+
+        subSpectraAveraged += numSummed;
+        totalProcessed += 1;
+
+        std::fill(powerSum.begin(), powerSum.end(), (pipeline_real)0);
+        numSummed = 0;
+
+        return emit(rawSpectrum);
+    };
+
+    Stage<DataBlock, Spectrum> stage("Accumulation thread", sharedData.FFTDataRing, &sharedDataProc.rawDataRing, syncFlags);
+    stage.backpressure(sharedDataProc.backpressurePolicy, sharedDataProc.spillDepth);
+    stage.completes(&SynchronizationFlags::magnitudeComplete).completes(&SynchronizationFlags::averagingComplete);
+    stage.drainsOnStop([&](DataBlock& FFTBlock) { releaseBlockData(FFTBlock, sharedData.FFTPool); });
+
+    stage.onItem([&](DataBlock& FFTBlock, const auto& emit) {
+        startTimer(TIMER_AVERAGE);
+        newestDelivered = FFTBlock.deliveredAt;
+        bool pushed = true;
+        for (int spectrum = 0; spectrum < FFTBlock.numSpectra && pushed; spectrum++) {
+            pipeline_complex* FFTData = FFTBlock.data + (size_t)spectrum*samplesPerSpectrum;
+
+            if (numSummed == 0) {
+                batchSize = adaptiveBatchSize(sharedDataProc, syncFlags, subSpectraAveragingNumber);
             }
-            else{
-                subSpectra.push_back(sharedData.magDataQueue.front());
-                // Update the running average using DataProcessor
-                dataProcessor.addRawSpectrumToRunningAverage(sharedData.magDataQueue.front());
+            for (int i = 0; i < samplesPerSpectrum; i++) {
+                powerSum[i] += FFTData[i][0]*FFTData[i][0] + FFTData[i][1]*FFTData[i][1];
             }
-            sharedData.magDataQueue.pop();
+            numSummed++;
+
+            if (numSummed == batchSize) {
+                pushed = emitAverage(emit);
+            }
+        }
+
+        // Return or free the memory allocated for the fft data
+        releaseBlockData(FFTBlock, sharedData.FFTPool);
+        stopTimer(TIMER_AVERAGE, FFTBlock.sequence);
+
+        return pushed;
+    });
+
+    // Emit the final partial average, as averagingThread does
+    stage.onFinish([&](const auto& emit) {
+        if (numSummed > 0 && !emitAverage(emit)) {
+            return false;
+        }
+
+        if (syncFlags.recordsMetrics) {
+            setMetric(ACQUIRED_SPECTRA, subSpectraAveraged);
+            setMetric(SPECTRUM_AVERAGE_SIZE, (totalProcessed > 0) ? (int)std::lround((double)subSpectraAveraged/totalProcessed) : subSpectraAveragingNumber);
         }
-        lock.unlock();
+
+        std::cout << "Accumulation thread exiting. Averaged " << std::to_string(subSpectraAveraged) << " sub-spectra into "
+                                                              << std::to_string(totalProcessed) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
+}
+
+
+
+/**
+ * @brief Replaces the FFTThread workers and accumulationThread of a chain when the FFT runs on a device backend. Each block of raw spectra is
+ *        loaded into the backend with one batched transform, and the power of its spectra is summed where they were transformed, up to every
+ *        batch of sub-spectra (see adaptiveBatchSize). Only those sums come back, and are masked and pushed to the raw data ring as accumulationThread
+ *        does. The chain runs a single data ring, so blocks arrive in acquisition order and need no reordering.
+ * 
+ * @param backend - FFTBackend of the chain, holding the loaded block and the sum
+ * @param samplesPerSpectrum - Number of samples per spectrum in each block of the data ring
+ * @param sharedData - Struct containing data shared between the acquisition and FFT threads. Blocks are taken from dataRings[0]
+ * @param sharedDataProc - Struct containing data shared between processing threads. This function writes to rawDataRing
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param dataProcessor - DataProcessor holding the bad bins and running average
+ * @param trueCenterFreq - Center frequency attached to each averaged spectrum
+ * @param subSpectraAveragingNumber - Nominal number of sub-spectra per averaged spectrum
+ */
+void transformAccumulationThread(FFTBackend& backend, int samplesPerSpectrum, SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc, 
+                                 SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, double trueCenterFreq, int subSpectraAveragingNumber) {
+    int subSpectraAveraged = 0;
+    int totalProcessed = 0;
+
+    std::vector<pipeline_real> powerSum(samplesPerSpectrum);
+    int numSummed = 0;
+    int batchSize = subSpectraAveragingNumber; // Of the current sum, see adaptiveBatchSize
+    int64_t newestDelivered = 0; // Delivery of the block the current sum was last added from
+
+    // Takes the sum from the backend and emits it as one averaged spectrum. Returns false if the error flag was raised while waiting
+    auto emitAverage = [&](const Stage<DataBlock, Spectrum>::Emit& emit) {
+        backend.takePowerSum(powerSum.data());
 
         Spectrum rawSpectrum;
-        rawSpectrum.powers = averageVectors(subSpectra);
+        rawSpectrum.powers.resize(samplesPerSpectrum);
+        double scale = 1.0 / ((double)samplesPerSpectrum * 50 * numSummed); // Hard code in 50 Ohm input impedance
+        for (int i = 0; i < samplesPerSpectrum; i++) {
+            rawSpectrum.powers[i] = powerSum[i] * scale;
+        }
+        dataProcessor.maskBadBinsAndDC(rawSpectrum.powers);
+        dataProcessor.addAverageToRunningAverage(rawSpectrum.powers, numSummed);
+
         rawSpectrum.freqAxis = dataProcessor.SNR.freqAxis;
         rawSpectrum.trueCenterFreq = trueCenterFreq;
+        rawSpectrum.acquiredAt = newestDelivered;
+        rawSpectrum.subSpectra = numSummed;
+        rawSpectrum.nominalSubSpectra = subSpectraAveragingNumber;
 
-        subSpectraAveraged += procNumber;
+        subSpectraAveraged += numSummed;
         totalProcessed += 1;
+        numSummed = 0;
 
+        return emit(rawSpectrum);
+    };
 
-        // Acquire a new lock_guard and push the processed data to the shared queue
-        {
-            std::lock_guard<std::mutex> lock(sharedData.mutex);
-            sharedData.rawDataQueue.push(rawSpectrum);
-        }
-        sharedData.rawDataReadyCondition.notify_one();
-        
-        lock.lock();  // Reacquire lock before checking the data queue
-        stopTimer(TIMER_AVERAGE);
+    Stage<DataBlock, Spectrum> stage("Transform accumulation thread", *sharedData.dataRings[0], &sharedDataProc.rawDataRing, syncFlags);
+    stage.backpressure(sharedDataProc.backpressurePolicy, sharedDataProc.spillDepth);
+    stage.completes(&SynchronizationFlags::FFTComplete).completes(&SynchronizationFlags::magnitudeComplete).completes(&SynchronizationFlags::averagingComplete);
+    stage.drainsOnStop([&](DataBlock& rawBlock) { releaseBlockData(rawBlock, sharedData.dataPool); });
 
-        // Check if the acquisition and processing is complete
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (syncFlags.magnitudeComplete && sharedData.magDataQueue.empty()) {
-                setMetric(ACQUIRED_SPECTRA, subSpectraAveraged);
-                setMetric(SPECTRUM_AVERAGE_SIZE, subSpectraAveragingNumber);
+    stage.onItem([&](DataBlock& rawBlock, const auto& emit) {
+        startTimer(TIMER_FFT);
+        backend.load(rawBlock.data, rawBlock.numSpectra);
+        releaseBlockData(rawBlock, sharedData.dataPool);
+        stopTimer(TIMER_FFT, rawBlock.sequence);
 
-                std::cout << "Averaging thread exiting. Averaged " << std::to_string(subSpectraAveraged) << " sub-spectra into " 
-                                                                   << std::to_string(totalProcessed) << " spectra." << std::endl;
+        // Add the block to the sum in runs that end on the sub-spectrum boundaries
+        startTimer(TIMER_AVERAGE);
+        newestDelivered = rawBlock.deliveredAt;
+        bool pushed = true;
+        int spectrum = 0;
+        while (spectrum < rawBlock.numSpectra && pushed) {
+            if (numSummed == 0) {
+                batchSize = adaptiveBatchSize(sharedDataProc, syncFlags, subSpectraAveragingNumber);
+            }
+            int numAdded = min(rawBlock.numSpectra - spectrum, batchSize - numSummed);
+            backend.addPowers(spectrum, numAdded);
+            spectrum += numAdded;
+            numSummed += numAdded;
 
-                syncFlags.averagingComplete = true;
-                sharedData.rawDataReadyCondition.notify_one();
-                break;  // Exit the processing thread
+            if (numSummed == batchSize) {
+                pushed = emitAverage(emit);
             }
+        }
+        stopTimer(TIMER_AVERAGE, rawBlock.sequence);
 
-            if (syncFlags.errorFlag) {
-                std::cout << "Averaging thread gracefully exiting due to error." << std::endl;
+        return pushed;
+    });
 
-                sharedData.rawDataReadyCondition.notify_one();
-                break;
-            }
+    // Emit the final partial average, as accumulationThread does
+    stage.onFinish([&](const auto& emit) {
+        if (numSummed > 0 && !emitAverage(emit)) {
+            return false;
         }
+
+        if (syncFlags.recordsMetrics) {
+            setMetric(ACQUIRED_SPECTRA, subSpectraAveraged);
+            setMetric(SPECTRUM_AVERAGE_SIZE, (totalProcessed > 0) ? (int)std::lround((double)subSpectraAveraged/totalProcessed) : subSpectraAveragingNumber);
+        }
+
+        std::cout << "Transform accumulation thread (" << backend.name() << ") exiting. Averaged " << std::to_string(subSpectraAveraged) 
+                  << " sub-spectra into " << std::to_string(totalProcessed) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
+}
+
+
+
+/**
+ * @brief Last stage of a calibration pipeline, in place of the accumulation, processing and decision stages. Sums the power of each incoming
+ *        FFT spectrum like accumulationThread, and folds every average of subSpectraAveragingNumber sub-spectra into the running means of the
+ *        calibration statistics instead of passing it on. The spectra are not masked, since the calibration is what finds the bad bins.
+ *        A sub-spectrum sum left incomplete at the end of an acquisition is continued by the next one. Incomplete averages are never used.
+ * 
+ * @param samplesPerSpectrum - Number of samples per spectrum in each block of the FFT data ring
+ * @param sharedData - Struct containing data shared between the acquisition and FFT threads
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param dataProcessor - DataProcessor holding the baseline the spectra are processed with when calibration.processSpectra is set
+ * @param calibration - Statistics accumulated over the whole calibration
+ */
+void calibrationThread(int samplesPerSpectrum, SharedDataBasic& sharedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, 
+                       CalibrationStatistics& calibration) {
+    int spectraSummed = 0;
+    int averagesAdded = 0;
+
+    if ((int)calibration.powerSum.size() != samplesPerSpectrum) {
+        calibration.powerSum.assign(samplesPerSpectrum, 0);
+        calibration.numSummed = 0;
     }
-    }
-                
-    catch (const std::exception& e) {
-        std::lock_guard<std::mutex> lock(syncFlags.mutex);
-        syncFlags.errorFlag = true;
-        syncFlags.errorMessage = "AveragingThread: " + std::string(e.what());
-        std::cout << syncFlags.errorMessage << '\n';
-    }
+
+    // Turns the current sum into one averaged raw spectrum and adds it to the statistics, then clears the sum
+    auto addAverage = [&]() {
+        Spectrum rawSpectrum;
+        rawSpectrum.powers.resize(samplesPerSpectrum);
+        rawSpectrum.trueCenterFreq = 0;
+
+        double scale = 1.0 / ((double)samplesPerSpectrum * 50 * calibration.numSummed); // Hard code in 50 Ohm input impedance
+        for (int i = 0; i < samplesPerSpectrum; i++) {
+            rawSpectrum.powers[i] = calibration.powerSum[i] * scale;
+        }
+        std::fill(calibration.powerSum.begin(), calibration.powerSum.end(), 0.0);
+        calibration.numSummed = 0;
+
+        if (calibration.firstRawSpectrum.empty()) {
+            calibration.firstRawSpectrum = rawSpectrum.powers;
+        }
+        addToRunningMean(calibration.rawAverage, calibration.rawSpectra, rawSpectrum.powers);
+
+        if (calibration.processSpectra) {
+            Spectrum processedSpectrum, processedBaseline;
+            std::tie(processedSpectrum, processedBaseline) = dataProcessor.rawToProcessed(rawSpectrum);
+            addToRunningMean(calibration.processedAverage, calibration.processedSpectra, processedSpectrum.powers);
+        }
+        averagesAdded++;
+    };
+
+    Stage<DataBlock, Spectrum> stage("Calibration thread", sharedData.FFTDataRing, nullptr, syncFlags);
+    stage.completes(&SynchronizationFlags::magnitudeComplete).completes(&SynchronizationFlags::averagingComplete);
+    stage.completes(&SynchronizationFlags::processingComplete).completes(&SynchronizationFlags::decisionsComplete);
+
+    stage.onItem([&](DataBlock& FFTBlock, const auto&) {
+        for (int spectrum = 0; spectrum < FFTBlock.numSpectra; spectrum++) {
+            pipeline_complex* FFTData = FFTBlock.data + (size_t)spectrum*samplesPerSpectrum;
+
+            for (int i = 0; i < samplesPerSpectrum; i++) {
+                calibration.powerSum[i] += FFTData[i][0]*FFTData[i][0] + FFTData[i][1]*FFTData[i][1];
+            }
+            calibration.numSummed++;
+
+            if (calibration.numSummed == calibration.subSpectraAveragingNumber) {
+                addAverage();
+            }
+        }
+
+        releaseBlockData(FFTBlock, sharedData.FFTPool);
+        spectraSummed += FFTBlock.numSpectra;
+        return true;
+    });
+
+    stage.onFinish([&](const auto&) {
+        std::cout << "Calibration thread exiting. Averaged " << std::to_string(spectraSummed) << " sub-spectra into "
+                                                             << std::to_string(averagesAdded) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
 }
 
 
 
 /**
- * @brief Placeholder function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous. 
+ * @brief Placeholder function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous.
  *        Currently just pops data from the processed data queue and frees the memory.
  * 
  * @param sharedData - Struct containing data shared between threads
  * @param syncFlags - Struct containing synchronization flags shared between threads
  */
-void processingThread(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, BayesFactors& bayesFactors) {
-    try{
+void processingThread(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor) {
     int buffersProcessed = 0;
-    while (true) {
-        // Check if processed data queue is empty
-        std::unique_lock<std::mutex> lock(sharedData.mutex);
-        sharedData.rawDataReadyCondition.wait(lock, [&sharedData]() {
-            return !sharedData.rawDataQueue.empty();
-        });
 
+    Stage<Spectrum, CombinedSpectrum> stage("Processing thread", sharedData.rawDataRing, &sharedData.rebinnedDataRing, syncFlags);
+    stage.backpressure(sharedData.backpressurePolicy, sharedData.spillDepth);
+    stage.completes(&SynchronizationFlags::processingComplete);
+    stage.drainsOnStop();
 
-        // Process data if the data queue is not empty
+    // Cleared for every spectrum rather than made again, so its storage is reused
+    CombinedSpectrumGrid combinedGrid(REBINNING_WIDTH, CONVOLUTION_WIDTH);
+
+    stage.onItem([&](Spectrum& rawSpectrum, const auto& emit) {
         startTimer(TIMER_PROCESS);
-        while (!sharedData.rawDataQueue.empty()) {
-            // Get the pointer to the data from the queue
-            Spectrum rawSpectrum = sharedData.rawDataQueue.front();
-            sharedData.rawDataQueue.pop();
-            lock.unlock();
+        Spectrum processedSpectrum = dataProcessor.rawToProcessedSpectrum(rawSpectrum);
 
-            Spectrum processedSpectrum, foo;
-            std::tie(processedSpectrum, foo) = dataProcessor.rawToProcessed(rawSpectrum);
+        Spectrum rescaledSpectrum = dataProcessor.processedToRescaledTrimmed(processedSpectrum, 0.1);
 
-            trimSpectrum(processedSpectrum, 0.1);
-            dataProcessor.trimSNRtoMatch(processedSpectrum);
+        combinedGrid.clear();
+        dataProcessor.addRescaledToCombined(rescaledSpectrum, combinedGrid);
 
-            Spectrum rescaledSpectrum = dataProcessor.processedToRescaled(processedSpectrum);
+        CombinedSpectrum rebinnedSpectrum = combinedGrid.rebinnedSpectrum();
+        rebinnedSpectrum.acquiredAt = rawSpectrum.acquiredAt;
 
-            CombinedSpectrum combinedSpectrum;
-            dataProcessor.addRescaledToCombined(rescaledSpectrum, combinedSpectrum);
+        // bayesFactors.updateExclusionLine(rebinnedSpectrum);
 
-            CombinedSpectrum rebinnedSpectrum = dataProcessor.rebinCombinedSpectrum(combinedSpectrum, 10, 1);
+        buffersProcessed++;
+
+        if (sharedData.archive != nullptr) {
+            sharedData.archive->writeSpectrum(ARCHIVE_AVERAGED_SPECTRA, rawSpectrum, sharedData.archiveStep);
+        }
+        if (sharedData.telemetry != nullptr && sharedData.diagnostics) {
+            sharedData.telemetry->publishSpectrum(TELEMETRY_RAW_SPECTRUM, rawSpectrum);
+            sharedData.telemetry->publishSpectrum(TELEMETRY_PROCESSED_SPECTRUM, processedSpectrum);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(savedData.mutex);
+            if (savedData.rawSpectra.size() < savedData.rawSpectraLimit){
+                savedData.rawSpectra.push_back(std::move(rawSpectrum));
+            }
+            // savedData.processedSpectra.push_back(processedSpectrum);
+            // savedData.rescaledSpectra.push_back(rescaledSpectrum);
+            dataProcessor.addRescaledToCombined(rescaledSpectrum, savedData.combinedSpectrum);
+        }
+
+        bool pushed = emit(rebinnedSpectrum);
+        stopTimer(TIMER_PROCESS, buffersProcessed - 1);
+        return pushed;
+    });
+
+    stage.onFinish([&](const auto&) {
+        std::cout << "Processing thread exiting. Processed " << std::to_string(buffersProcessed) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
+}
 
-            // bayesFactors.updateExclusionLine(rebinnedSpectrum);
 
-            buffersProcessed++;
 
-            {
-                std::lock_guard<std::mutex> lock(savedData.mutex);
-                if (savedData.rawSpectra.size() < 10){
-                    savedData.rawSpectra.push_back(rawSpectrum);
+/**
+ * @brief Parallel replacement for processingThread. Several workers pop averaged spectra from the raw data ring, baseline, rescale and rebin
+ *        them concurrently, and release the results in the order the spectra were averaged. The order-dependent merge into
+ *        savedData.combinedSpectrum and the push to the decision stage happen in that ordered release, under sharedData.mutex, so they stay
+ *        single-threaded and the decision stage (and its BayesFactors update) sees the same sequence as with processingThread.
+ *        Each worker runs on its own copy of the processing state, and its filter passes start from a reset filter so a spectrum's result
+ *        does not depend on which worker processed it. Full output rings always block, the backpressure policies are not applied here.
+ * 
+ * @param sharedData - Struct containing data shared between processing threads. Its reorder state must be set up by initPipelineRings
+ * @param savedData - Struct holding the saved raw spectra and the combined spectrum
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param dataProcessor - DataProcessor holding the baseline, SNR and filter design. Only read, once, when the worker starts
+ * @param workerID - Index of this worker
+ */
+void processingWorker(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, int workerID) {
+    try{
+    int buffersProcessed = 0;
+
+    // rawToProcessed and trimSNRtoMatch write to the processor, so each worker needs its own
+    DataProcessor workerProcessor;
+    workerProcessor.loadProcessingState(dataProcessor);
+
+    std::vector<ProcessedSpectrum> batch;
+    batch.reserve(PROCESSING_BATCH_SIZE);
+    CombinedSpectrumGrid combinedGrid(REBINNING_WIDTH, CONVOLUTION_WIDTH); // Cleared for every spectrum, so its storage is reused
+
+    while (true) {
+        // Number each spectrum as it is popped so the results can be put back in order. Spectra discarded while draining get no number,
+        // so the numbered ones stay contiguous and are all released. Spectra already waiting behind the first join its batch, so their
+        // baselines are filtered together
+        batch.clear();
+        bool popped;
+        {
+            std::lock_guard<std::mutex> lock(sharedData.rawDataMutex);
+            ProcessedSpectrum result;
+            popped = sharedData.rawDataRing.pop(result.rawSpectrum, RING_POLL_MS);
+            while (popped) {
+                if (threadDrainFlag(syncFlags)) {
+                    sharedData.rawDataRing.countDiscarded();
                 }
-                // savedData.processedSpectra.push_back(processedSpectrum);
-                // savedData.rescaledSpectra.push_back(rescaledSpectrum);
-                dataProcessor.addRescaledToCombined(rescaledSpectrum, savedData.combinedSpectrum);
+                else {
+                    result.sequence = sharedData.nextRawSequence++;
+                    batch.push_back(std::move(result));
+                }
+
+                if (batch.size() == PROCESSING_BATCH_SIZE) {
+                    break;
+                }
+                result = ProcessedSpectrum();
+                popped = sharedData.rawDataRing.tryPop(result.rawSpectrum);
             }
+        }
 
-            // Acquire a new lock_guard and push the processed data to the shared queue
-            {
-                std::lock_guard<std::mutex> lock(sharedData.mutex);
-                sharedData.rebinnedDataQueue.push(rebinnedSpectrum);
-                sharedData.rescaledDataReadyCondition.notify_one();
+        // Nothing to process, either because the ring is idle or because every spectrum popped was discarded
+        if (batch.empty()) {
+            if (sharedData.rawDataRing.drained()) {
+                std::cout << "Processing worker " << std::to_string(workerID) << " exiting. Processed " << std::to_string(buffersProcessed) << " spectra." << std::endl;
+
+                // The last worker out marks the stage complete. Every earlier result has been released from the reorder buffer by now
+                bool lastWorker;
+                {
+                    std::lock_guard<std::mutex> lock(sharedData.mutex);
+                    lastWorker = (--sharedData.activeProcessingWorkers == 0);
+                }
+                if (lastWorker) {
+                    {
+                        std::lock_guard<std::mutex> lock(syncFlags.mutex);
+                        syncFlags.processingComplete = true;
+                    }
+                    sharedData.rebinnedDataRing.close();
+                }
+                break;
             }
 
-            lock.lock();  // Lock again before checking the data queue
+            if (threadCancelled(syncFlags)) {
+                std::cout << "Processing worker " << std::to_string(workerID) << " gracefully exiting due to error." << std::endl;
+                break;
+            }
+            continue;
         }
-        stopTimer(TIMER_PROCESS);
-        
 
-        // Check if the acquisition is complete
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (syncFlags.averagingComplete && sharedData.rawDataQueue.empty()) {
-                std::cout << "Processing thread exiting. Processed " << std::to_string(buffersProcessed) << " spectra." << std::endl;
 
-                syncFlags.processingComplete = true;
-                sharedData.rescaledDataReadyCondition.notify_one();
+        // Independent per-spectrum work, as in processingThread
+        startTimer(TIMER_PROCESS);
+        std::vector<Spectrum> rawSpectra(batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            rawSpectra[i] = std::move(batch[i].rawSpectrum);
+        }
+        std::vector<Spectrum> processedSpectra = workerProcessor.rawToProcessedBatch(rawSpectra);
+        for (size_t i = 0; i < batch.size(); i++) {
+            batch[i].rawSpectrum = std::move(rawSpectra[i]);
+        }
+
+        // Any worker may publish, the telemetry takes the first spectrum that comes along once the channel is due
+        if (sharedData.telemetry != nullptr && sharedData.diagnostics && !processedSpectra.empty()) {
+            sharedData.telemetry->publishSpectrum(TELEMETRY_PROCESSED_SPECTRUM, processedSpectra.back());
+        }
 
-                break;  // Exit the processing thread
+        for (size_t i = 0; i < batch.size(); i++) {
+            batch[i].rescaledSpectrum = workerProcessor.processedToRescaledTrimmed(processedSpectra[i], 0.1);
+
+            combinedGrid.clear();
+            workerProcessor.addRescaledToCombined(batch[i].rescaledSpectrum, combinedGrid);
+
+            batch[i].rebinnedSpectrum = combinedGrid.rebinnedSpectrum();
+            batch[i].rebinnedSpectrum.acquiredAt = batch[i].rawSpectrum.acquiredAt;
+            buffersProcessed++;
+        }
+
+
+        // Release every result that is now next in order. The lock makes the workers a single producer of rebinnedDataRing
+        bool stalled = false;
+        {
+            std::lock_guard<std::mutex> lock(sharedData.mutex);
+            for (ProcessedSpectrum& result : batch) {
+                int sequence = result.sequence;
+                sharedData.processingReorderBuffer.emplace(sequence, std::move(result));
             }
 
-            if (syncFlags.errorFlag) {
-                std::cout << "Processing thread gracefully exiting due to error." << std::endl;
+            auto next = sharedData.processingReorderBuffer.find(sharedData.nextProcessedSequence);
+            while (next != sharedData.processingReorderBuffer.end()) {
+                ProcessedSpectrum& ready = next->second;
+                if (!pushToRing(sharedData.rebinnedDataRing, ready.rebinnedSpectrum, syncFlags)) {
+                    stalled = true;
+                    break;
+                }
+
+                if (sharedData.archive != nullptr) {
+                    sharedData.archive->writeSpectrum(ARCHIVE_AVERAGED_SPECTRA, ready.rawSpectrum, sharedData.archiveStep);
+                }
+                if (sharedData.telemetry != nullptr && sharedData.diagnostics) {
+                    sharedData.telemetry->publishSpectrum(TELEMETRY_RAW_SPECTRUM, ready.rawSpectrum);
+                }
 
-                sharedData.rescaledDataReadyCondition.notify_one();
-                break;
+                // Every worker holds the same trimmed SNR, so whichever releases the spectrum can merge it
+                {
+                    std::lock_guard<std::mutex> savedLock(savedData.mutex);
+                    if (savedData.rawSpectra.size() < savedData.rawSpectraLimit){
+                        savedData.rawSpectra.push_back(std::move(ready.rawSpectrum));
+                    }
+                    workerProcessor.addRescaledToCombined(ready.rescaledSpectrum, savedData.combinedSpectrum);
+                }
+
+                sharedData.processingReorderBuffer.erase(next);
+                sharedData.nextProcessedSequence++;
+
+                next = sharedData.processingReorderBuffer.find(sharedData.nextProcessedSequence);
             }
         }
-    }
+        stopTimer(TIMER_PROCESS);
 
+        if (stalled) {
+            std::cout << "Processing worker " << std::to_string(workerID) << " gracefully exiting due to error." << std::endl;
+            break;
+        }
     }
-    catch(const std::exception& e)
-    {
-        std::lock_guard<std::mutex> lock(syncFlags.mutex);
-        syncFlags.errorFlag = true;
-        syncFlags.errorMessage = "ProcessingThread: " + std::string(e.what());
-        std::cout << syncFlags.errorMessage << '\n';
     }
+    catch (const std::exception& e) {
+        std::string message = "processingWorker: " + std::string(e.what());
+        std::cout << message << '\n';
+        syncFlags.raiseError(message);
+    }
+}
+
+
+
+/**
+ * @brief Processing stage of one digitizer's chain in a multi-digitizer step, in place of processingThread. Baselines and rescales each averaged
+ *        spectrum of the digitizer like processingThread and merges it into savedData.combinedSpectrum, which combines the digitizers by
+ *        absolute frequency. Instead of rebinning, it passes the spectrum on as a single trace CombinedSpectrum (powers and SNR weights on the
+ *        absolute frequency axis), so digitizerMergeThread can combine the traces of every digitizer before they are rebinned.
+ * 
+ * @param sharedData - Struct containing data shared between the digitizer's processing threads. This function writes to digitizerDataRing
+ * @param savedData - Struct holding the saved raw spectra and the combined spectrum
+ * @param syncFlags - Struct containing synchronization flags shared between the digitizer's threads
+ * @param dataProcessor - DataProcessor of the digitizer, holding its baseline, SNR and filter design
+ * @param primary - Chain of the primary digitizer, which alone keeps the raw spectra, so they stay in step order
+ */
+void digitizerProcessingThread(SharedDataProcessing& sharedData, SavedData& savedData, SynchronizationFlags& syncFlags, DataProcessor& dataProcessor, 
+                               bool primary) {
+    int buffersProcessed = 0;
+
+    Stage<Spectrum, CombinedSpectrum> stage("Digitizer processing thread", sharedData.rawDataRing, &sharedData.digitizerDataRing, syncFlags);
+    stage.backpressure(sharedData.backpressurePolicy, sharedData.spillDepth);
+    stage.completes(&SynchronizationFlags::processingComplete);
+    stage.drainsOnStop();
+
+    CombinedSpectrumGrid traceGrid;
+
+    stage.onItem([&](Spectrum& rawSpectrum, const auto& emit) {
+        startTimer(TIMER_PROCESS);
+        Spectrum processedSpectrum = dataProcessor.rawToProcessedSpectrum(rawSpectrum);
+
+        Spectrum rescaledSpectrum = dataProcessor.processedToRescaledTrimmed(processedSpectrum, 0.1);
+
+        // A grid holding one trace is the trace with its weights, which is what the merge stage combines
+        traceGrid.clear();
+        dataProcessor.addRescaledToCombined(rescaledSpectrum, traceGrid);
+
+        CombinedSpectrum trace = traceGrid.toCombinedSpectrum();
+        trace.acquiredAt = rawSpectrum.acquiredAt;
+
+        buffersProcessed++;
+
+        if (sharedData.archive != nullptr) {
+            sharedData.archive->writeSpectrum(ARCHIVE_AVERAGED_SPECTRA, rawSpectrum, sharedData.archiveStep);
+        }
+        if (sharedData.telemetry != nullptr && sharedData.diagnostics) {
+            sharedData.telemetry->publishSpectrum(TELEMETRY_RAW_SPECTRUM, rawSpectrum);
+            sharedData.telemetry->publishSpectrum(TELEMETRY_PROCESSED_SPECTRUM, processedSpectrum);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(savedData.mutex);
+            if (primary && savedData.rawSpectra.size() < savedData.rawSpectraLimit){
+                savedData.rawSpectra.push_back(std::move(rawSpectrum));
+            }
+            dataProcessor.addRescaledToCombined(rescaledSpectrum, savedData.combinedSpectrum);
+        }
+
+        bool pushed = emit(trace);
+        stopTimer(TIMER_PROCESS, buffersProcessed - 1);
+        return pushed;
+    });
+
+    stage.onFinish([&](const auto&) {
+        std::cout << "Digitizer processing thread exiting. Processed " << std::to_string(buffersProcessed) << " spectra." << std::endl;
+        return true;
+    });
+
+    stage.run();
 }
 
 
 
+/**
+ * @brief Merge stage of a multi-digitizer step, between the digitizers' processing threads and the decision stage. Takes the next trace of
+ *        every digitizer, combines them by absolute frequency on one grid and passes the rebinned result on, so the decision stage sees one
+ *        spectrum covering the bands of all the digitizers for every averaged spectrum of the step. The digitizers acquire the same number of
+ *        spectra per step, and once any of them has run out the spectra left over from the others have nothing to merge with. They are 
+ *        discarded, and the other chains are stopped, once the first digitizer's chain has finished.
+ * 
+ * @param digitizerData - Processing data of every digitizer's chain, the primary digitizer first. Each chain's digitizerDataRing is read
+ * @param sharedData - Struct containing data shared with the decision stage. This function writes to rebinnedDataRing
+ * @param syncFlags - Struct containing synchronization flags of the primary digitizer's chain, linked to those of the other chains
+ */
+void digitizerMergeThread(const std::vector<SharedDataProcessing*>& digitizerData, SharedDataProcessing& sharedData, SynchronizationFlags& syncFlags) {
+    int spectraMerged = 0;
+    int spectraUnmatched = 0;
+    bool digitizerFinished = false; // One of the other digitizers has no spectra left, so no later spectrum can be merged
+
+    // Pops the next trace of digitizer k. False once its chain has finished or the step was cancelled
+    auto popTrace = [&](size_t k, CombinedSpectrum& trace) {
+        SPSCRing<CombinedSpectrum>& ring = digitizerData[k]->digitizerDataRing;
+        while (!ring.pop(trace, RING_POLL_MS)) {
+            if (ring.drained() || threadCancelled(syncFlags)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    Stage<CombinedSpectrum, CombinedSpectrum> stage("Digitizer merge thread", digitizerData[0]->digitizerDataRing, &sharedData.rebinnedDataRing, syncFlags);
+    stage.drainsOnStop();
+
+    stage.onItem([&](CombinedSpectrum& trace, const auto& emit) {
+        if (digitizerFinished) {
+            spectraUnmatched++;
+            return true;
+        }
+
+        startTimer(TIMER_PROCESS);
+        CombinedSpectrumGrid mergedGrid(REBINNING_WIDTH, CONVOLUTION_WIDTH);
+        mergedGrid.merge(trace);
+        int64_t acquiredAt = trace.acquiredAt;
+
+        CombinedSpectrum otherTrace;
+        for (size_t k = 1; k < digitizerData.size(); k++) {
+            if (!popTrace(k, otherTrace)) {
+                stopTimer(TIMER_PROCESS);
+                if (threadCancelled(syncFlags)) {
+                    return false;
+                }
+                digitizerFinished = true;
+                spectraUnmatched += (int)k; // This digitizer's trace and those already popped from the others
+                return true;
+            }
+            mergedGrid.merge(otherTrace);
+            acquiredAt = max(acquiredAt, otherTrace.acquiredAt);
+        }
+
+        CombinedSpectrum rebinnedSpectrum = mergedGrid.rebinnedSpectrum();
+        rebinnedSpectrum.acquiredAt = acquiredAt;
+        spectraMerged++;
+
+        bool pushed = emit(rebinnedSpectrum);
+        stopTimer(TIMER_PROCESS, spectraMerged - 1);
+        return pushed;
+    });
+
+    // Every spectrum of the first digitizer has been merged or dropped, so whatever the others still deliver is unmatched. Their chains are
+    // stopped and emptied so none of them is left blocking on a full ring
+    stage.onFinish([&](const auto&) {
+        for (SynchronizationFlags* linked : syncFlags.linkedFlags) {
+            requestAcquisitionStop(*linked);
+        }
+
+        CombinedSpectrum otherTrace;
+        for (size_t k = 1; k < digitizerData.size(); k++) {
+            while (popTrace(k, otherTrace)) {
+                spectraUnmatched++;
+            }
+        }
+        if (threadCancelled(syncFlags)) {
+            return false;
+        }
+
+        std::cout << "Digitizer merge thread exiting. Merged " << std::to_string(spectraMerged) << " spectra of " << std::to_string(digitizerData.size())
+                  << " digitizers." << std::endl;
+        if (spectraUnmatched > 0) {
+            std::cout << "Digitizer merge thread dropped " << std::to_string(spectraUnmatched) << " spectra the other digitizers had no match for." << std::endl;
+        }
+        return true;
+    });
+
+    stage.run();
+}
+
 
 
 /**
- * @brief Placeholder function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous. 
+ * @brief Placeholder function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous.
  *        Currently just pops data from the processed data queue and frees the memory.
  * 
  * @param sharedData - Struct containing data shared between threads
  * @param syncFlags - Struct containing synchronization flags shared between threads
  */
 void decisionMakingThread(SharedDataProcessing& sharedData, SharedDataSaving& savedData, SynchronizationFlags& syncFlags, BayesFactors& bayesFactors, DecisionAgent& decisionAgent) {
-    try{
     setMetric(SPECTRA_AT_DECISION, -1);
-    
+
     int buffersDecided = 0;
     bool decisionThrown = false;
-    while (true) {
-        // Check if processed data queue is empty
-        std::unique_lock<std::mutex> lock(sharedData.mutex);
-        sharedData.rescaledDataReadyCondition.wait(lock, [&sharedData]() {
-            return !sharedData.rebinnedDataQueue.empty();
-        });
+    size_t scoredWindowStart = SIZE_MAX; // Exclusion line bin the decision agent's score was last computed from
+    bool forecastIssued = false;
 
+    // Last stage, so there is no output ring
+    Stage<CombinedSpectrum, std::nullptr_t> stage("Decision making thread", sharedData.rebinnedDataRing, nullptr, syncFlags);
+    stage.completes(&SynchronizationFlags::acquisitionComplete).completes(&SynchronizationFlags::pauseDataCollection);
+    stage.completes(&SynchronizationFlags::decisionsComplete);
+    stage.drainsOnStop();
 
-        // Process data if the data queue is not empty
+    stage.onItem([&](CombinedSpectrum& rebinnedSpectrum, const auto&) {
         startTimer(TIMER_DECISION);
-        while (!sharedData.rebinnedDataQueue.empty()) {
-            // Get the pointer to the data from the queue
-            CombinedSpectrum rebinnedSpectrum = sharedData.rebinnedDataQueue.front();
-            sharedData.rebinnedDataQueue.pop();
-            lock.unlock();
+        if (decisionAgent.trimmedSNR.powers.empty()) {
+            decisionAgent.resizeSNRtoMatch(rebinnedSpectrum);
+            decisionAgent.setTargets();
+            decisionAgent.setPoints();
+        }
 
-            if (decisionAgent.trimmedSNR.powers.empty()) {
-                decisionAgent.resizeSNRtoMatch(rebinnedSpectrum);
-                decisionAgent.setTargets();
-                decisionAgent.setPoints();
-            }
-            
 
-            bayesFactors.updateExclusionLine(rebinnedSpectrum);
+        // Keep the spectra the decisions are made on for DecisionSweep. Those still draining after a decision are not captured
+        if (savedData.decisionCapture != nullptr && !decisionThrown) {
+            savedData.decisionCapture->push_back(rebinnedSpectrum);
+        }
+
+        bayesFactors.updateExclusionLine(rebinnedSpectrum);
 
-            #if SAVE_PROGRESS
-            // Create a copy of the bayesFactors object and add it to the exclusionLineQueue
-            {
-                std::lock_guard<std::mutex> savedDataLock(savedData.mutex);
-                Spectrum exclusionCopy = bayesFactors.exclusionLine;
-                savedData.exclusionLineQueue.push(exclusionCopy);
-                savedData.exclusionLineReadyCondition.notify_one();
+        if (sharedData.telemetry != nullptr) {
+            sharedData.telemetry->publishSpectrum(TELEMETRY_REBINNED_SPECTRUM, rebinnedSpectrum);
+            sharedData.telemetry->publishSpectrum(TELEMETRY_EXCLUSION_LINE, bayesFactors.exclusionLine);
+            if (sharedData.queueGauges != nullptr) {
+                sharedData.queueGauges->publish(*sharedData.telemetry);
             }
-            #endif
+        }
 
-            if (!decisionThrown){
-                std::vector<double> activeWindow(bayesFactors.exclusionLine.powers.end() - decisionAgent.trimmedSNR.powers.size(), bayesFactors.exclusionLine.powers.end());
-                int decision = decisionAgent.getDecision(activeWindow, buffersDecided);
-                // int decision = 0;
+        #if SAVE_PROGRESS
+        // Queue the bins of the exclusion line this update changed, with a full line every EXCLUSION_KEYFRAME_INTERVAL snapshots
+        {
+            ExclusionLineDelta delta;
+            savedData.exclusionLineTrace.snapshot(bayesFactors, delta);
 
-                buffersDecided++;
+            std::lock_guard<std::mutex> savedDataLock(savedData.mutex);
+            savedData.exclusionLineQueue.push(std::move(delta));
+            savedData.exclusionLineReadyCondition.notify_one();
+        }
+        #endif
 
-                if (decision) {
-                    decisionThrown = true;
+        if (!decisionThrown){
+            double score = decisionAgent.scoreExclusionLine(bayesFactors, rebinnedSpectrum.powers.size(), scoredWindowStart);
 
-                    std::lock_guard<std::mutex> lock(syncFlags.mutex);
-                    syncFlags.acquisitionComplete = true;
-                    syncFlags.pauseDataCollection = true;
+            int decision = decisionAgent.getDecision(score, buffersDecided);
+            // int decision = 0;
 
-                    updateMetric(SPECTRA_AT_DECISION, buffersDecided);
-                    break;
-                }
+            if (rebinnedSpectrum.acquiredAt != 0) {
+                recordLatency(LATENCY_BUFFER_TO_DECISION, rebinnedSpectrum.acquiredAt);
             }
 
+            buffersDecided++;
 
-            lock.lock();  // Lock again before checking the data queue
+            // Stop the acquisition right away. With DRAIN_AFTER_DECISION the spectra already in flight are discarded, otherwise they keep
+            // draining through the pipeline
+            if (decision) {
+                decisionThrown = true;
+                requestAcquisitionStop(syncFlags);
+
+                updateMetric(SPECTRA_AT_DECISION, buffersDecided);
+            }
+            else {
+                // Let the scan get the next step ready while the last few spectra before the forecast stop come in
+                int forecast = decisionAgent.forecastSpectraToStop(buffersDecided);
+                syncFlags.spectraToStop.store(forecast, std::memory_order_relaxed);
+
+                if (!forecastIssued && forecast >= 0 && forecast <= STOP_FORECAST_LEAD) {
+                    forecastIssued = true;
+
+                    std::function<void()> prepareNextStep;
+                    {
+                        std::lock_guard<std::mutex> lock(syncFlags.mutex);
+                        prepareNextStep = syncFlags.prepareNextStep;
+                    }
+                    if (prepareNextStep) {
+                        prepareNextStep();
+                    }
+                }
+            }
         }
-        stopTimer(TIMER_DECISION);
+        stopTimer(TIMER_DECISION, buffersDecided - 1);
 
-        // Check if the acquisition is complete
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (syncFlags.processingComplete && sharedData.rebinnedDataQueue.empty()) {
+        return true;
+    });
 
-                if (!decisionThrown) {
-                    updateMetric(SPECTRA_AT_DECISION, buffersDecided);
-                }
+    // End of stream for the saving thread, whether the stage finished or stopped. The archive keeps the step's final exclusion line
+    auto closeExclusionLines = [&]() {
+        if (sharedData.archive != nullptr && !bayesFactors.exclusionLine.powers.empty()) {
+            sharedData.archive->writeSpectrum(ARCHIVE_EXCLUSION_LINES, bayesFactors.exclusionLine, sharedData.archiveStep);
+        }
 
-                std::cout<< "Decision making thread exiting. Decided on " << std::to_string(buffersDecided) << " spectra." << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(savedData.mutex);
+            savedData.exclusionLinesClosed = true;
+        }
+        savedData.exclusionLineReadyCondition.notify_all();
+    };
 
-                syncFlags.acquisitionComplete = true;
-                syncFlags.pauseDataCollection = true;
-                syncFlags.decisionsComplete = true;
-                
-                break;  // Exit the processing thread
-            }
+    stage.onFinish([&](const auto&) {
+        if (!decisionThrown) {
+            updateMetric(SPECTRA_AT_DECISION, buffersDecided);
+        }
+        closeExclusionLines();
 
-            if (syncFlags.errorFlag) {
-                std::cout << "Decision making thread gracefully exiting due to error." << std::endl;
+        std::cout<< "Decision making thread exiting. Decided on " << std::to_string(buffersDecided) << " spectra." << std::endl;
+        return true;
+    });
 
-                if (!decisionThrown) {
-                    updateMetric(SPECTRA_AT_DECISION, buffersDecided);
-                }
-                break;
-            }
+    stage.onAbort([&]() {
+        if (!decisionThrown) {
+            updateMetric(SPECTRA_AT_DECISION, buffersDecided);
         }
-    }
-    }
-    catch(const std::exception& e)
-    {
-        std::lock_guard<std::mutex> lock(syncFlags.mutex);
-        syncFlags.errorFlag = true;
-        syncFlags.errorMessage = "DecisionThread: " + std::string(e.what());
-        std::cout << syncFlags.errorMessage << '\n';
-    }
+        closeExclusionLines();
+    });
+
+    stage.run();
 }
 
 
 
+/**
+ * @brief Writes the exclusion line snapshots of a step (SAVE_PROGRESS) to one SPECTRUM_FILE_DELTAS file as the decision stage queues them.
+ *        Runs until the decision stage closes the queue.
+ * 
+ * @param savedData - Struct containing the snapshot queue
+ * @param syncFlags - Struct containing synchronization flags shared between threads
+ */
 void dataSavingThread(SharedDataSaving& savedData, SynchronizationFlags& syncFlags) {
     try{
-    int buffersSaved = 0;
+    int snapshotsSaved = 0;
+    std::string exclusionLineFilename = "../../../plotting/exclusionLineComparisons/scanProgress/exclusionLine_" + getDateTimeString()
+                                        + SPECTRUM_FILE_EXTENSION;
+    std::unique_ptr<SpectrumFileWriter> writer;
+
+    // Wake the wait below if another thread fails
+    CancellationToken::Subscription cancelSubscription = syncFlags.cancellation.subscribe([&savedData]() {
+        std::lock_guard<std::mutex> lock(savedData.mutex);
+        savedData.exclusionLineReadyCondition.notify_all();
+    });
 
     while (true) {
-        Spectrum exclusionLine;
+        ExclusionLineDelta delta;
 
-        // Check if processed data queue is empty
+        // Wait for a snapshot or the end of the stream
         std::unique_lock<std::mutex> lock(savedData.mutex);
-        savedData.exclusionLineReadyCondition.wait(lock, [&savedData]() {
-            return !savedData.exclusionLineQueue.empty();
+        savedData.exclusionLineReadyCondition.wait(lock, [&savedData, &syncFlags]() {
+            return !savedData.exclusionLineQueue.empty() || savedData.exclusionLinesClosed || syncFlags.cancellation.cancelled();
         });
 
         // Process data if the data queue is not empty
         startTimer(TIMER_SAVE);
         while (!savedData.exclusionLineQueue.empty()) {
-            exclusionLine = savedData.exclusionLineQueue.front();
+            delta = std::move(savedData.exclusionLineQueue.front());
             savedData.exclusionLineQueue.pop();
 
             lock.unlock();
-            std::string exclusionLineFilename = "../../../plotting/exclusionLineComparisons/scanProgress/exclusionLine_" + 
-                                                std::to_string(buffersSaved) + "_" + getDateTimeString() + ".csv";
-            saveSpectrum(exclusionLine, exclusionLineFilename);
-            buffersSaved++;
+            if (writer == nullptr) {
+                writer = std::make_unique<SpectrumFileWriter>(exclusionLineFilename, 0, 1, SPECTRUM_FILE_DELTAS);
+                if (!writer->isOpen()) {
+                    throw std::runtime_error("Error: Unable to open " + exclusionLineFilename + " to save the exclusion line progress\n");
+                }
+                writer->setUniformAxis(delta.gridStart, delta.freqRes);
+            }
+            writer->writeDelta(delta.firstBin, delta.powers.data(), delta.powers.size(), delta.keyframe);
+            snapshotsSaved++;
             lock.lock();
         }
         stopTimer(TIMER_SAVE);
 
 
-        // Check if the acquisition is complete
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (savedData.exclusionLineQueue.empty() && syncFlags.decisionsComplete) {
-                std::cout<< "Saving thread exiting. Saved " << std::to_string(buffersSaved) << " spectra." << std::endl;
-                break;  // Exit the processing thread
-            }
+        // Check if the decision stage has closed the queue
+        if (savedData.exclusionLineQueue.empty() && (savedData.exclusionLinesClosed || syncFlags.cancellation.cancelled())) {
+            std::cout<< "Saving thread exiting. Saved " << std::to_string(snapshotsSaved) << " snapshots." << std::endl;
+            break;  // Exit the processing thread
         }
     }
+
+    if (writer != nullptr && !writer->close()) {
+        std::cerr << "Unable to write file " << exclusionLineFilename << "." << std::endl;
+    }
     }
     catch(const std::exception& e)
     {
@@ -525,61 +1389,24 @@ void dataSavingThread(SharedDataSaving& savedData, SynchronizationFlags& syncFla
 
 
 /**
- * @brief Function to be run in a separate thread in parallel with ATS::AcquireDataMultithreadedContinuous. Saves data from the data 
- *        saving queue to binary files. The data is saved in the output directory.
+ * @brief Drops the oldest buffers in the backup queue until at most maxSize remain, releasing each according to sharedData.backupPolicy.
+ *        Copies are freed and shared buffers drop their backup reference in the data pool.
+ * 
+ * @warning The caller must hold sharedData.mutex.
  * 
  * @param sharedData - Struct containing data shared between threads
- * @param syncFlags - Struct containing synchronization flags shared between threads
+ * @param maxSize - Number of buffers to keep. Pass 0 to empty the queue.
  */
-void saveDataToBin(SharedDataBasic& sharedData, SynchronizationFlags& syncFlags) {
-    // Create the output directory
-    std::filesystem::create_directory("output");
-
-    int numSaved = 0;
-    while (true) {
-        // Check if data queue is empty
-        std::unique_lock<std::mutex> lock(sharedData.mutex);
-        sharedData.saveReadyCondition.wait(lock, [&sharedData]() {
-            return !sharedData.dataSavingQueue.empty();
-        });
-
+void trimBackupQueue(SharedDataBasic& sharedData, int maxSize) {
+    while ((int)sharedData.backupDataQueue.size() > maxSize) {
+        pipeline_complex* backup = sharedData.backupDataQueue.front();
+        sharedData.backupDataQueue.pop();
 
-        // Process data if the data queue is not empty
-        startTimer(TIMER_SAVE);
-        while (!sharedData.dataSavingQueue.empty()) {
-            // Get the pointer to the data from the queue
-            fftw_complex* rawData = sharedData.dataSavingQueue.front();
-            sharedData.dataSavingQueue.pop();
-            lock.unlock();
-        
-
-            std::string filename = "output/Buffer" + std::to_string(numSaved+1) + ".bin";
-            // Open the file in binary mode
-            std::ofstream file(filename, std::ios::binary);
-            if (!file) {
-                std::cout << "Failed to open the file." << std::endl;
-            }
-
-            // Write the complex data to the file
-            file.write(reinterpret_cast<const char*>(rawData), sizeof(fftw_complex) * sharedData.samplesPerBuffer);
-
-            // Close the file
-            file.close();
-            numSaved++;
-
-            // Free the memory allocated for the raw data
-            fftw_free(rawData);
-
-            lock.lock();  // Lock again before checking the data queue
+        if (sharedData.backupPolicy == BACKUP_SHARED) {
+            sharedData.dataPool->release(backup);
         }
-        stopTimer(TIMER_SAVE);
-
-        // Check if the acquisition and saving is complete
-        {
-            std::lock_guard<std::mutex> lock(syncFlags.mutex);
-            if (syncFlags.acquisitionComplete && sharedData.dataSavingQueue.empty()) {
-                break;
-            }
+        else {
+            pipeline_free(backup);
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+/**
+ * @file pageAllocation.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Page allocation of the DMA buffers and buffer pools. Multi-megabyte buffers on 4K pages take thousands of TLB entries per pass,
+ *        so buffers can be placed on large pages when the process holds SeLockMemoryPrivilege, and 4K pages can be locked into the
+ *        working set so the driver and the FFT never fault on them. Every request falls back to plain pages if the system refuses it.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+// Privilege detection runs once, and the working set grows and shrinks with the locked allocations, from any thread
+static std::mutex pageAllocationMutex;
+static int largePageState = -1; // -1 not checked yet, 0 unavailable, 1 available
+static std::unordered_map<void*, size_t> lockedAllocations;
+
+
+
+// Enables SeLockMemoryPrivilege in the process token. It's only there to enable if the account has the "Lock pages in memory" right
+static bool enableLockMemoryPrivilege() {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+
+    TOKEN_PRIVILEGES privileges;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool enabled = LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                   AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() != ERROR_NOT_ALL_ASSIGNED;
+    CloseHandle(token);
+    return enabled;
+}
+
+
+
+/**
+ * @brief Whether buffers can go on large pages: the system supports them and the process could enable SeLockMemoryPrivilege. Checked
+ *        once, with a note on how to grant the privilege if it is missing.
+ *
+ * @return true if ALLOCATE_LARGE_PAGES can place buffers on large pages
+ */
+bool largePagesAvailable() {
+    std::lock_guard<std::mutex> lock(pageAllocationMutex);
+    if (largePageState < 0) {
+        largePageState = (GetLargePageMinimum() > 0 && enableLockMemoryPrivilege()) ? 1 : 0;
+        if (largePageState == 0) {
+            std::cout << "Large pages are unavailable, buffers stay on 4K pages. Grant the \"Lock pages in memory\" right (secpol.msc) to "
+                      << "this account and log on again to use them." << std::endl;
+        }
+    }
+    return largePageState == 1;
+}
+
+
+
+// Locks 4K pages into the working set, growing the working set by their size first so VirtualLock stays within its quota
+static bool lockPages(void* pages, size_t bytes) {
+    std::lock_guard<std::mutex> lock(pageAllocationMutex);
+    SIZE_T minimumSize, maximumSize;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minimumSize, &maximumSize) ||
+        !SetProcessWorkingSetSize(GetCurrentProcess(), minimumSize + bytes, maximumSize + bytes)) {
+        return false;
+    }
+
+    if (!VirtualLock(pages, bytes)) {
+        SetProcessWorkingSetSize(GetCurrentProcess(), minimumSize, maximumSize);
+        return false;
+    }
+    lockedAllocations[pages] = bytes;
+    return true;
+}
+
+
+
+/**
+ * @brief Allocates page aligned memory by ALLOCATE_* flags. With ALLOCATE_LARGE_PAGES the allocation is rounded up to whole large pages,
+ *        unless that would waste more than LARGE_PAGE_MAX_WASTE of it. Large pages are never paged out, so ALLOCATE_LOCKED only locks
+ *        allocations that end up on 4K pages. Free with freePages.
+ *
+ * @param bytes - bytes to allocate
+ * @param flags - ALLOCATE_* flags requested
+ * @param placed - set to the ALLOCATE_* flags the allocation got, if not null
+ * @return void* - the memory, nullptr if even plain pages could not be committed
+ */
+void* allocatePages(size_t bytes, int flags, int* placed) {
+    int got = ALLOCATE_DEFAULT;
+    void* pages = nullptr;
+
+    if ((flags & ALLOCATE_LARGE_PAGES) && largePagesAvailable()) {
+        size_t largePage = GetLargePageMinimum();
+        size_t rounded = (bytes + largePage - 1) / largePage * largePage;
+        if (rounded - bytes <= LARGE_PAGE_MAX_WASTE*rounded) {
+            pages = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (pages != nullptr) {
+                got = ALLOCATE_LARGE_PAGES | ALLOCATE_LOCKED;
+            }
+        }
+    }
+
+    if (pages == nullptr) {
+        pages = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (pages != nullptr && (flags & ALLOCATE_LOCKED)) {
+            if (lockPages(pages, bytes)) {
+                got = ALLOCATE_LOCKED;
+            }
+            else {
+                std::cerr << "Failed to lock " << bytes << " bytes in memory, error " << GetLastError() << std::endl;
+            }
+        }
+    }
+
+    if (placed != nullptr) {
+        *placed = got;
+    }
+    return pages;
+}
+
+
+
+/**
+ * @brief Frees memory from allocatePages, and shrinks the working set again by what it had locked.
+ *
+ * @param pages - memory from allocatePages, or nullptr
+ */
+void freePages(void* pages) {
+    if (pages == nullptr) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pageAllocationMutex);
+        std::unordered_map<void*, size_t>::iterator locked = lockedAllocations.find(pages);
+        if (locked != lockedAllocations.end()) {
+            SIZE_T minimumSize, maximumSize;
+            if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimumSize, &maximumSize) && minimumSize > locked->second) {
+                SetProcessWorkingSetSize(GetCurrentProcess(), minimumSize - locked->second, maximumSize - locked->second);
+            }
+            lockedAllocations.erase(locked);
+        }
+    }
+    VirtualFree(pages, 0, MEM_RELEASE);
+}
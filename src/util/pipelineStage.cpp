@@ -0,0 +1,283 @@
+/**
+ * @file pipelineStage.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the Pipeline class. See include\utils\pipelineStage.hpp for the class definitions.
+ *        Stage is a template and is defined in its header.
+ * @version 0.1
+ * @date 2023-11-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Destroy the Pipeline object. Stops persistent threads and joins any thread that is still running so none is left detached.
+ *
+ */
+Pipeline::~Pipeline() {
+    shutdown();
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+
+
+/**
+ * @brief Adds a thread body to the pipeline. Bodies are launched and joined in the order they are added.
+ *
+ * @param name - name printed when the thread is joined
+ * @param body - thread body, e.g. a lambda calling Stage::run()
+ */
+void Pipeline::add(std::string name, std::function<void()> body) {
+    names.push_back(name);
+    bodies.push_back(body);
+}
+
+
+
+/**
+ * @brief Stops any persistent threads and removes every body so the pipeline can be rebuilt.
+ *
+ */
+void Pipeline::clear() {
+    shutdown();
+    names.clear();
+    bodies.clear();
+}
+
+
+
+/**
+ * @brief Launches every body on its own thread.
+ *
+ */
+void Pipeline::start() {
+    for (size_t i = 0; i < bodies.size(); i++) {
+        threads.emplace_back([this, i]() {
+            setTraceThreadName(names[i]);
+            bodies[i]();
+        });
+    }
+}
+
+
+
+/**
+ * @brief Waits for every thread launched by start() to finish.
+ *
+ */
+void Pipeline::join() {
+    for (size_t i = 0; i < threads.size(); i++) {
+        if (threads[i].joinable()) {
+            threads[i].join();
+            std::cout << names[i] << " joined." << std::endl;
+        }
+        else { std::cerr << names[i] << " is not joinable" << std::endl; }
+    }
+    threads.clear();
+}
+
+
+
+/**
+ * @brief Runs each body to completion before launching the next. The rings between stages must be large enough to hold a whole acquisition.
+ *
+ */
+void Pipeline::runSequentially() {
+    for (size_t i = 0; i < bodies.size(); i++) {
+        std::cout << "Launching " << names[i] << "." << std::endl;
+        std::thread thread([this, i]() {
+            setTraceThreadName(names[i]);
+            bodies[i]();
+        });
+        thread.join();
+    }
+}
+
+
+
+/**
+ * @brief Launches one long-lived thread per body. The threads wait for beginStep() and return to waiting after each step until shutdown().
+ *
+ */
+void Pipeline::startPersistent() {
+    if (persistentMode) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stepMutex);
+        persistentMode = true;
+        stopping = false;
+        stepNumber = 0;
+        bodiesRunning = 0;
+        bodySteps.assign(bodies.size(), 0);
+    }
+
+    for (size_t i = 0; i < bodies.size(); i++) {
+        threads.emplace_back(&Pipeline::persistentLoop, this, i);
+    }
+}
+
+
+
+/**
+ * @brief "Step started" message. Every persistent thread runs its body once.
+ *
+ * @warning The previous step must have ended (see endStep()) and the shared data the bodies use must be reset before calling.
+ */
+void Pipeline::beginStep() {
+    {
+        std::lock_guard<std::mutex> lock(stepMutex);
+        if (!persistentMode) {
+            throw std::runtime_error("Error: Pipeline::beginStep called before startPersistent\n");
+        }
+
+        stepNumber++;
+        bodiesRunning = (int)bodies.size();
+    }
+    stepStartedCondition.notify_all();
+}
+
+
+
+/**
+ * @brief "Step ended" message. Waits until every body has returned for the current step. The threads stay alive for the next one.
+ *
+ */
+void Pipeline::endStep() {
+    std::unique_lock<std::mutex> lock(stepMutex);
+    stepEndedCondition.wait(lock, [this]() { return bodiesRunning == 0; });
+}
+
+
+
+/**
+ * @brief Waits until bodies[index] has returned for the current step. The other bodies may still be running.
+ *
+ * @param index - index of the body, in the order it was added
+ */
+void Pipeline::waitForBody(size_t index) {
+    std::unique_lock<std::mutex> lock(stepMutex);
+    if (!persistentMode || index >= bodySteps.size()) {
+        throw std::runtime_error("Error: Pipeline::waitForBody called without a persistent body " + std::to_string(index) + "\n");
+    }
+
+    stepEndedCondition.wait(lock, [this, index]() { return bodySteps[index] >= stepNumber; });
+}
+
+
+
+/**
+ * @brief Waits for the current step, then stops and joins the persistent threads.
+ *
+ */
+void Pipeline::shutdown() {
+    {
+        std::unique_lock<std::mutex> lock(stepMutex);
+        if (!persistentMode) {
+            return;
+        }
+
+        stepEndedCondition.wait(lock, [this]() { return bodiesRunning == 0; });
+        stopping = true;
+    }
+    stepStartedCondition.notify_all();
+
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads.clear();
+    persistentMode = false;
+}
+
+
+
+/**
+ * @brief Body of a persistent thread. Runs bodies[index] once per step until shutdown().
+ *
+ * @param index - index of the body this thread runs
+ */
+void Pipeline::persistentLoop(size_t index) {
+    setTraceThreadName(names[index]);
+    int lastStep = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stepMutex);
+            stepStartedCondition.wait(lock, [this, lastStep]() { return stopping || stepNumber > lastStep; });
+            if (stopping) {
+                return;
+            }
+            lastStep = stepNumber;
+        }
+
+        // Bodies report their own errors through SynchronizationFlags. Anything that escapes must not kill the long-lived thread
+        try {
+            bodies[index]();
+        }
+        catch (const std::exception& e) {
+            std::cout << names[index] << " step failed: " << e.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stepMutex);
+            bodySteps[index] = lastStep;
+            bodiesRunning--;
+        }
+        stepEndedCondition.notify_all();
+    }
+}
+
+
+
+/**
+ * @brief Starts a new sequence. Every body is treated as having finished lastStep, so the next turn each body may take is lastStep + 1.
+ *
+ * @param numBodies - number of bodies in each Pipeline being sequenced
+ * @param lastStep - step that has already been completed by every body
+ */
+void StepSequencer::reset(size_t numBodies, int lastStep) {
+    std::lock_guard<std::mutex> lock(mutex);
+    finishedSteps.assign(numBodies, lastStep);
+}
+
+
+
+/**
+ * @brief Waits until body index has finished every step before this one.
+ *
+ * @param index - index of the body in its Pipeline
+ * @param step - step the calling body is about to run
+ */
+void StepSequencer::waitForTurn(size_t index, int step) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (index >= finishedSteps.size()) {
+        throw std::runtime_error("Error: StepSequencer has no body " + std::to_string(index) + "\n");
+    }
+
+    turnFinishedCondition.wait(lock, [this, index, step]() { return finishedSteps[index] >= step - 1; });
+}
+
+
+
+/**
+ * @brief Records that body index has finished step and lets the same body of the next step start.
+ *
+ * @param index - index of the body in its Pipeline
+ * @param step - step the calling body has just finished
+ */
+void StepSequencer::finishTurn(size_t index, int step) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishedSteps[index] = max(finishedSteps[index], step);
+    }
+    turnFinishedCondition.notify_all();
+}
@@ -0,0 +1,64 @@
+/**
+ * @file powerKernels.cu
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Device kernels of CuFFTBackend, only built with ENABLE_CUDA_FFT. Includes only the CUDA headers so nvcc never sees decs.hpp, and
+ *        the launchers are declared in decs.hpp for fftBackend.cpp.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <cuda_runtime.h>
+#include <cufft.h>
+
+#define POWER_KERNEL_THREADS (256) // Threads per block of addPowersKernel
+
+// One thread per bin walks the spectra of the block, so every read of a spectrum is coalesced and the sum is read and written once
+template <typename Complex, typename Real>
+__global__ void addPowersKernel(const Complex* spectra, int numSpectra, int N, Real* powerSum) {
+    int i = blockIdx.x*blockDim.x + threadIdx.x;
+    if (i >= N) {
+        return;
+    }
+
+    Real sum = powerSum[i];
+    for (int spectrum = 0; spectrum < numSpectra; spectrum++) {
+        Complex value = spectra[(size_t)spectrum*N + i];
+        sum += value.x*value.x + value.y*value.y;
+    }
+    powerSum[i] = sum;
+}
+
+
+
+/**
+ * @brief Queues the sum of |X|^2 of numSpectra contiguous spectra into powerSum on a stream.
+ *
+ * @param spectra - numSpectra spectra of N bins on the device
+ * @param numSpectra - spectra to add
+ * @param N - bins per spectrum
+ * @param powerSum - N sums on the device
+ * @param stream - stream to queue the kernel on
+ */
+void addDevicePowers(const cufftComplex* spectra, int numSpectra, int N, float* powerSum, cudaStream_t stream) {
+    int blocks = (N + POWER_KERNEL_THREADS - 1) / POWER_KERNEL_THREADS;
+    addPowersKernel<<<blocks, POWER_KERNEL_THREADS, 0, stream>>>(spectra, numSpectra, N, powerSum);
+}
+
+
+
+/**
+ * @brief Double precision version of addDevicePowers.
+ *
+ * @param spectra - numSpectra spectra of N bins on the device
+ * @param numSpectra - spectra to add
+ * @param N - bins per spectrum
+ * @param powerSum - N sums on the device
+ * @param stream - stream to queue the kernel on
+ */
+void addDevicePowers(const cufftDoubleComplex* spectra, int numSpectra, int N, double* powerSum, cudaStream_t stream) {
+    int blocks = (N + POWER_KERNEL_THREADS - 1) / POWER_KERNEL_THREADS;
+    addPowersKernel<<<blocks, POWER_KERNEL_THREADS, 0, stream>>>(spectra, numSpectra, N, powerSum);
+}
@@ -0,0 +1,125 @@
+/**
+ * @file queueGauges.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for QueueGauges, which samples the depth and throughput of the rings between the pipeline stages.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+// Adds a ring's counters to a gauge, so several rings can share one
+template <typename T>
+static void addRing(QueueGauge& gauge, const SPSCRing<T>& ring, double bytesPerItem) {
+    uint64_t popped = ring.popped();
+    uint64_t pushed = ring.pushed();
+    uint64_t depth = (pushed > popped) ? pushed - popped : 0;
+
+    gauge.pushed += pushed;
+    gauge.popped += popped;
+    gauge.depth += depth;
+    gauge.highWater += ring.highWater();
+    gauge.capacity += ring.capacity();
+    gauge.bytesInFlight += depth * bytesPerItem;
+    gauge.discarded += ring.discarded();
+}
+
+
+
+/**
+ * @brief Sets the shared data whose rings are sampled, and restarts.
+ *
+ * @param sharedData - Struct holding the data and FFT rings
+ * @param sharedDataProc - Struct holding the magnitude, raw and rebinned rings
+ */
+void QueueGauges::watch(SharedDataBasic& sharedData, SharedDataProcessing& sharedDataProc) {
+    this->sharedData = &sharedData;
+    this->sharedDataProc = &sharedDataProc;
+    restart();
+}
+
+
+
+/**
+ * @brief Clears the gauges for a new step, whose rings start counting from 0 again. The first sample's rates are since this call.
+ *
+ */
+void QueueGauges::restart() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (QueueGauge& gauge : gauges) {
+        gauge = QueueGauge();
+    }
+    sampled = std::chrono::steady_clock::now();
+}
+
+
+
+/**
+ * @brief Reads every ring and stores the new gauges with setQueueGauge. Safe to call from any thread while the stages run.
+ *
+ */
+void QueueGauges::sample() {
+    if (sharedData == nullptr || sharedDataProc == nullptr) {
+        return;
+    }
+
+    double bufferBytes = (double)sharedData->samplesPerBuffer * sizeof(double);
+    double blockBytes = (double)sharedData->samplesPerBuffer * max(1, sharedData->spectraPerBlock) * sizeof(pipeline_complex);
+
+    QueueGauge current[NUM_QUEUES];
+    for (const std::unique_ptr<SPSCRing<DataBlock>>& dataRing : sharedData->dataRings) {
+        addRing(current[QUEUE_DATA], *dataRing, blockBytes);
+    }
+    addRing(current[QUEUE_FFT_DATA], sharedData->FFTDataRing, blockBytes);
+    addRing(current[QUEUE_MAG_DATA], sharedDataProc->magDataRing, bufferBytes);
+    addRing(current[QUEUE_RAW_DATA], sharedDataProc->rawDataRing, bufferBytes);
+    addRing(current[QUEUE_REBINNED_DATA], sharedDataProc->rebinnedDataRing, bufferBytes);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - sampled).count();
+    sampled = now;
+
+    for (int queue = 0; queue < NUM_QUEUES; queue++) {
+        // Counts only go down if the rings were reset without a restart, then the new counts are all that happened since
+        const QueueGauge& previous = gauges[queue];
+        uint64_t newPushes = current[queue].pushed - ((current[queue].pushed >= previous.pushed) ? previous.pushed : 0);
+        uint64_t newPops = current[queue].popped - ((current[queue].popped >= previous.popped) ? previous.popped : 0);
+
+        if (elapsed > 0) {
+            current[queue].pushRate = newPushes / elapsed;
+            current[queue].popRate = newPops / elapsed;
+        }
+
+        gauges[queue] = current[queue];
+        setQueueGauge(queue, current[queue]);
+    }
+}
+
+
+
+/**
+ * @brief Samples the rings and publishes the gauges to TELEMETRY_QUEUE_GAUGES if that channel is due, QUEUE_GAUGE_VALUES values per queue:
+ *        depth, high water mark, capacity, pushes per second, pops per second, bytes in flight, items pushed and items discarded.
+ *
+ * @param telemetry - Publisher of the scan
+ * @return true if the gauges were published
+ */
+bool QueueGauges::publish(TelemetryPublisher& telemetry) {
+    if (!telemetry.due(TELEMETRY_QUEUE_GAUGES)) {
+        return false;
+    }
+    sample();
+
+    double values[NUM_QUEUES * QUEUE_GAUGE_VALUES];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int queue = 0; queue < NUM_QUEUES; queue++) {
+            queueGaugeValues(gauges[queue], values + queue * QUEUE_GAUGE_VALUES);
+        }
+    }
+    return telemetry.publishValues(TELEMETRY_QUEUE_GAUGES, values, NUM_QUEUES * QUEUE_GAUGE_VALUES);
+}
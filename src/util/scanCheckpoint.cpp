@@ -0,0 +1,477 @@
+/**
+ * @file scanCheckpoint.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the ScanCheckpoint and ScanCheckpointWriter classes. See include\utils\scanCheckpoint.hpp
+ *        for the class definitions and the file format.
+ * @version 0.1
+ * @date 2023-11-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+template <typename T>
+static void writeValue(std::ostream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static void readValue(std::istream& file, T& value) {
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+template <typename Container>
+static void writeArray(std::ostream& file, const Container& values) {
+    writeValue(file, (uint64_t)values.size());
+    for (const auto& value : values) {
+        writeValue(file, value);
+    }
+}
+
+template <typename T>
+static void writeArray(std::ostream& file, const std::vector<T>& values) {
+    writeValue(file, (uint64_t)values.size());
+    file.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+}
+
+// Sizes are checked against the bytes left in the file, so a corrupt count fails the read instead of allocating without bound
+template <typename Container>
+static void readArray(std::istream& file, Container& values, uint64_t bytesLeft) {
+    uint64_t size = 0;
+    readValue(file, size);
+    if (!file || size > bytesLeft/sizeof(typename Container::value_type)) {
+        file.setstate(std::ios::failbit);
+        return;
+    }
+    values.resize((size_t)size);
+    for (auto& value : values) {
+        readValue(file, value);
+    }
+}
+
+template <typename T>
+static void readArray(std::istream& file, std::vector<T>& values, uint64_t bytesLeft) {
+    uint64_t size = 0;
+    readValue(file, size);
+    if (!file || size > bytesLeft/sizeof(T)) {
+        file.setstate(std::ios::failbit);
+        return;
+    }
+    values.resize((size_t)size);
+    file.read(reinterpret_cast<char*>(values.data()), values.size()*sizeof(T));
+}
+
+static void writeSpectrum(std::ostream& file, const Spectrum& spectrum) {
+    writeArray(file, spectrum.powers);
+    writeArray(file, (std::vector<double>)spectrum.freqAxis);
+    writeValue(file, spectrum.trueCenterFreq);
+}
+
+static void readSpectrum(std::istream& file, Spectrum& spectrum, uint64_t bytesLeft) {
+    std::vector<double> axis;
+    readArray(file, spectrum.powers, bytesLeft);
+    readArray(file, axis, bytesLeft);
+    readValue(file, spectrum.trueCenterFreq);
+    spectrum.freqAxis = std::move(axis);
+}
+
+
+
+/**
+ * @brief Copies the accumulated state of a scan. Call between steps, with no processing in flight.
+ *
+ * @param stepIndex - steps acquired so far
+ * @param trueCenterFreq - receiver center frequency of the last step in MHz
+ * @param acquisitionParams - acquisition parameters of the scan, a resuming scan must use the same sample rate and buffer size
+ * @param bayesFactors - exclusion line of the scan
+ * @param savedData - combined spectrum and kept raw spectra of the scan
+ * @param dataProcessor - processor holding the scan's baselining state
+ */
+void ScanCheckpoint::capture(int stepIndex, double trueCenterFreq, const AcquisitionParameters& acquisitionParams, const BayesFactors& bayesFactors,
+                             const SavedData& savedData, const DataProcessor& dataProcessor) {
+    header = CheckpointHeader();
+    std::strncpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.numMetrics = NUM_METRICS;
+    header.numQueues = NUM_QUEUES;
+    header.sampleRate = acquisitionParams.sampleRate;
+    header.samplesPerBuffer = acquisitionParams.samplesPerBuffer;
+    header.stepIndex = stepIndex;
+    header.trueCenterFreq = trueCenterFreq;
+
+    startIndex = bayesFactors.startIndex;
+    cutoffIndex = bayesFactors.cutoffIndex;
+    freqRes = bayesFactors.freqRes;
+    plannedScanWidth = bayesFactors.plannedScanWidth;
+    totalShift = bayesFactors.totalShift;
+    sigmaProc = bayesFactors.sigmaProc;
+    windowSize = bayesFactors.windowSize;
+    scanAxis = bayesFactors.scanAxis;
+    coeffSumA = bayesFactors.coeffSumA;
+    coeffSumB = bayesFactors.coeffSumB;
+    exclusionPowers = bayesFactors.exclusionLine.powers;
+    exclusionCenterFreq = bayesFactors.exclusionLine.trueCenterFreq;
+
+    combinedSpectrum = savedData.combinedSpectrum;
+    rawSpectra = savedData.rawSpectra;
+
+    numSpectra = dataProcessor.numSpectra;
+    runningAverage = dataProcessor.runningAverage;
+    currentBaseline = dataProcessor.currentBaseline;
+    badBins = dataProcessor.badBins;
+
+    metrics.resize(NUM_METRICS);
+    for (int i = 0; i < NUM_METRICS; i++) {
+        metrics[i] = getMetric(i);
+    }
+
+    queueGauges.resize(NUM_QUEUES * QUEUE_GAUGE_VALUES);
+    for (int i = 0; i < NUM_QUEUES; i++) {
+        queueGaugeValues(getQueueGauge(i), queueGauges.data() + i * QUEUE_GAUGE_VALUES);
+    }
+}
+
+
+
+/**
+ * @brief Puts the captured state back into a scan. The exclusion line axis is rebuilt as a view of the scan grid, as BayesFactors keeps it.
+ *
+ * @param bayesFactors - exclusion line to restore
+ * @param savedData - combined spectrum and raw spectra to restore
+ * @param dataProcessor - baselining state to restore
+ */
+void ScanCheckpoint::restore(BayesFactors& bayesFactors, SavedData& savedData, DataProcessor& dataProcessor) const {
+    bayesFactors.startIndex = startIndex;
+    bayesFactors.cutoffIndex = cutoffIndex;
+    bayesFactors.freqRes = freqRes;
+    bayesFactors.plannedScanWidth = plannedScanWidth;
+    bayesFactors.totalShift = totalShift;
+    bayesFactors.sigmaProc = sigmaProc;
+    bayesFactors.windowSize = (size_t)windowSize;
+    bayesFactors.scanAxis = scanAxis;
+    bayesFactors.coeffSumA = coeffSumA;
+    bayesFactors.coeffSumB = coeffSumB;
+    bayesFactors.exclusionLine.powers = exclusionPowers;
+    bayesFactors.exclusionLine.trueCenterFreq = exclusionCenterFreq;
+    if (!exclusionPowers.empty()) {
+        bayesFactors.exclusionLine.powers.reserve(scanAxis.size());
+        bayesFactors.coeffSumA.reserve(scanAxis.size());
+        bayesFactors.coeffSumB.reserve(scanAxis.size());
+        bayesFactors.showWindow();
+    }
+    else {
+        bayesFactors.exclusionLine.freqAxis.clear();
+    }
+
+    {
+        // The pyramid isn't checkpointed, it is rebuilt at the depth of the resuming scan
+        std::lock_guard<std::mutex> lock(savedData.mutex);
+        int pyramidLevels = savedData.combinedSpectrum.pyramidLevels();
+        savedData.combinedSpectrum = combinedSpectrum;
+        savedData.combinedSpectrum.setPyramid(pyramidLevels);
+        savedData.rawSpectra = rawSpectra;
+    }
+
+    dataProcessor.numSpectra = numSpectra;
+    dataProcessor.runningAverage = runningAverage;
+    dataProcessor.currentBaseline = currentBaseline;
+    dataProcessor.badBins = badBins;
+
+    for (int i = 0; i < NUM_METRICS && i < (int)metrics.size(); i++) {
+        restoreMetric(i, metrics[i]);
+    }
+}
+
+
+
+/**
+ * @brief Writes the checkpoint to path + CHECKPOINT_TEMP_SUFFIX, then renames it over path, so path keeps the previous checkpoint until this
+ *        one is complete.
+ *
+ * @param path - checkpoint file
+ * @return true - path holds this checkpoint
+ * @return false - the checkpoint could not be written, path is unchanged
+ */
+bool ScanCheckpoint::write(const std::string& path) const {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+        std::filesystem::create_directories(parent);
+    }
+
+    std::string tempPath = path + CHECKPOINT_TEMP_SUFFIX;
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+
+        writeValue(file, header);
+
+        writeValue(file, startIndex);
+        writeValue(file, cutoffIndex);
+        writeValue(file, freqRes);
+        writeValue(file, plannedScanWidth);
+        writeValue(file, totalShift);
+        writeValue(file, sigmaProc);
+        writeValue(file, windowSize);
+        writeArray(file, scanAxis);
+        writeArray(file, coeffSumA);
+        writeArray(file, coeffSumB);
+        writeArray(file, exclusionPowers);
+        writeValue(file, exclusionCenterFreq);
+
+        writeGrid(file);
+        writeValue(file, (uint64_t)rawSpectra.size());
+        for (const Spectrum& spectrum : rawSpectra) {
+            writeSpectrum(file, spectrum);
+        }
+
+        writeValue(file, numSpectra);
+        writeArray(file, runningAverage);
+        writeArray(file, currentBaseline);
+        writeArray(file, badBins);
+
+        for (const std::vector<int>& metric : metrics) {
+            writeArray(file, metric);
+        }
+        writeArray(file, queueGauges);
+        file.write(header.magic, sizeof(header.magic));
+
+        file.close();
+        if (!file) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
+
+
+
+/**
+ * @brief Reads a checkpoint written by write.
+ *
+ * @param path - checkpoint file
+ * @return true - the checkpoint was read
+ * @return false - there is no checkpoint at path, or it is not a complete version CHECKPOINT_VERSION checkpoint
+ */
+bool ScanCheckpoint::read(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    uint64_t size = (uint64_t)file.tellg();
+    file.seekg(0);
+
+    readValue(file, header);
+    if (!file || std::strncmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION) {
+        return false;
+    }
+
+    readValue(file, startIndex);
+    readValue(file, cutoffIndex);
+    readValue(file, freqRes);
+    readValue(file, plannedScanWidth);
+    readValue(file, totalShift);
+    readValue(file, sigmaProc);
+    readValue(file, windowSize);
+    readArray(file, scanAxis, size);
+    readArray(file, coeffSumA, size);
+    readArray(file, coeffSumB, size);
+    readArray(file, exclusionPowers, size);
+    readValue(file, exclusionCenterFreq);
+
+    readGrid(file, size);
+    uint64_t numRawSpectra = 0;
+    readValue(file, numRawSpectra);
+    if (!file || numRawSpectra > size) {
+        return false;
+    }
+    rawSpectra.resize((size_t)numRawSpectra);
+    for (Spectrum& spectrum : rawSpectra) {
+        readSpectrum(file, spectrum, size);
+    }
+
+    readValue(file, numSpectra);
+    readArray(file, runningAverage, size);
+    readArray(file, currentBaseline, size);
+    readArray(file, badBins, size);
+
+    metrics.resize(header.numMetrics);
+    for (std::vector<int>& metric : metrics) {
+        readArray(file, metric, size);
+    }
+    readArray(file, queueGauges, size);
+
+    char trailer[sizeof(header.magic)];
+    file.read(trailer, sizeof(trailer));
+    return file && std::strncmp(trailer, CHECKPOINT_MAGIC, sizeof(trailer)) == 0;
+}
+
+
+
+/**
+ * @brief Writes every field of the combined spectrum grid, including its rebinned sums, so it carries on exactly where it stopped. Bins the
+ *        grid spilled are read back from the spill and written after the rest, one chunk at a time, so the checkpoint is self-contained.
+ *
+ * @param file - checkpoint being written
+ */
+void ScanCheckpoint::writeGrid(std::ostream& file) const {
+    const CombinedSpectrumGrid& grid = combinedSpectrum;
+    writeValue(file, grid.gridOrigin);
+    writeValue(file, grid.binWidth);
+    writeValue(file, grid.firstBin);
+    writeValue(file, grid.endBin);
+    writeValue(file, grid.storageFirstBin);
+    writeArray(file, grid.powers);
+    writeArray(file, grid.weightSum);
+    writeArray(file, grid.sigmaCombined);
+    writeArray(file, grid.numTraces);
+
+    writeValue(file, grid.rebinningWidthC);
+    writeValue(file, grid.convolutionWidthK);
+    writeValue(file, grid.firstCoarse);
+    writeArray(file, grid.coarseWeightedPowers);
+    writeArray(file, grid.coarseWeights);
+    writeValue(file, grid.lastFirstBin);
+    writeValue(file, grid.lastEndBin);
+
+    writeValue(file, (uint64_t)grid.spilledChunks.size());
+    for (const auto& chunk : grid.spilledChunks) {
+        std::vector<SpilledBin> bins = grid.spilledChunk(chunk.first);
+        std::vector<double> powers(bins.size()), weightSum(bins.size()), sigmaCombined(bins.size());
+        std::vector<int> numTraces(bins.size());
+        for (size_t i = 0; i < bins.size(); i++) {
+            powers[i] = bins[i].power;
+            weightSum[i] = bins[i].weightSum;
+            sigmaCombined[i] = bins[i].sigmaCombined;
+            numTraces[i] = bins[i].numTraces;
+        }
+
+        writeValue(file, chunk.first);
+        writeArray(file, powers);
+        writeArray(file, weightSum);
+        writeArray(file, sigmaCombined);
+        writeArray(file, numTraces);
+    }
+}
+
+
+
+void ScanCheckpoint::readGrid(std::istream& file, uint64_t size) {
+    CombinedSpectrumGrid& grid = combinedSpectrum;
+    readValue(file, grid.gridOrigin);
+    readValue(file, grid.binWidth);
+    readValue(file, grid.firstBin);
+    readValue(file, grid.endBin);
+    readValue(file, grid.storageFirstBin);
+    readArray(file, grid.powers, size);
+    readArray(file, grid.weightSum, size);
+    readArray(file, grid.sigmaCombined, size);
+    readArray(file, grid.numTraces, size);
+
+    readValue(file, grid.rebinningWidthC);
+    readValue(file, grid.convolutionWidthK);
+    readValue(file, grid.firstCoarse);
+    readArray(file, grid.coarseWeightedPowers, size);
+    readArray(file, grid.coarseWeights, size);
+    readValue(file, grid.lastFirstBin);
+    readValue(file, grid.lastEndBin);
+
+    // Spilled chunks go back into the storage, the resuming scan sets its own retention window
+    grid.spilledChunks.clear();
+    grid.spill.reset();
+    grid.retentionBins = 0;
+    uint64_t numChunks = 0;
+    readValue(file, numChunks);
+    for (uint64_t chunk = 0; chunk < numChunks && file; chunk++) {
+        long long chunkFirst = 0;
+        std::vector<double> powers, weightSum, sigmaCombined;
+        std::vector<int> numTraces;
+        readValue(file, chunkFirst);
+        readArray(file, powers, size);
+        readArray(file, weightSum, size);
+        readArray(file, sigmaCombined, size);
+        readArray(file, numTraces, size);
+        if (!file || weightSum.size() != powers.size() || sigmaCombined.size() != powers.size() || numTraces.size() != powers.size()) {
+            file.setstate(std::ios::failbit);
+            return;
+        }
+
+        grid.reserveBins(chunkFirst, chunkFirst + (long long)powers.size());
+        size_t offset = (size_t)(chunkFirst - grid.storageFirstBin);
+        std::copy(powers.begin(), powers.end(), grid.powers.begin() + offset);
+        std::copy(weightSum.begin(), weightSum.end(), grid.weightSum.begin() + offset);
+        std::copy(sigmaCombined.begin(), sigmaCombined.end(), grid.sigmaCombined.begin() + offset);
+        std::copy(numTraces.begin(), numTraces.end(), grid.numTraces.begin() + offset);
+    }
+}
+
+
+
+/**
+ * @brief Construct a new ScanCheckpointWriter and start its thread.
+ *
+ * @param path - checkpoint file, replaced by every checkpoint written
+ */
+ScanCheckpointWriter::ScanCheckpointWriter(const std::string& path) : checkpointPath(path) {
+    writerThread = std::thread(&ScanCheckpointWriter::writerLoop, this);
+}
+
+
+
+/**
+ * @brief Writes the checkpoint still waiting, if any, and stops the thread.
+ *
+ */
+ScanCheckpointWriter::~ScanCheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    condition.notify_all();
+    writerThread.join();
+}
+
+
+
+/**
+ * @brief Queues a checkpoint for writing and returns at once. Replaces a checkpoint that is still waiting.
+ *
+ * @param checkpoint - captured scan state
+ */
+void ScanCheckpointWriter::submit(std::unique_ptr<ScanCheckpoint> checkpoint) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(checkpoint);
+    }
+    condition.notify_all();
+}
+
+
+
+void ScanCheckpointWriter::writerLoop() {
+    while (true) {
+        std::unique_ptr<ScanCheckpoint> checkpoint;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return pending != nullptr || closing; });
+            if (pending == nullptr) {
+                return;
+            }
+            checkpoint = std::move(pending);
+        }
+
+        if (checkpoint->write(checkpointPath)) {
+            written++;
+        }
+        else {
+            std::cerr << "Error: Unable to write checkpoint of step " << std::to_string(checkpoint->header.stepIndex) << " to " << checkpointPath << '\n';
+        }
+    }
+}
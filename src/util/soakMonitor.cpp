@@ -0,0 +1,227 @@
+/**
+ * @file soakMonitor.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for SoakMonitor, which tracks the real-time headroom of the pipeline over a long run of steps.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+static const char* soakStageNames[NUM_TIMERS] = {"DATA ACQUISITION", "FOURIER TRANSFORM", "FFT MAGNITUDE", "AVERAGING", "PROCESSING",
+                                                 "DECISION MAKING", "DATA SAVING"};
+
+// Sum of the values of a metric recorded since the last call, seen counts the values already summed
+static long long newMetricTotal(int metricCode, size_t& seen) {
+    std::vector<int> values = getMetric(metricCode);
+    long long total = 0;
+    for (size_t i = seen; i < values.size(); i++) {
+        total += values[i];
+    }
+    seen = values.size();
+    return total;
+}
+
+// Working set and committed private bytes of this process, 0 if they can't be read
+static void processMemory(double& workingSet, double& privateBytes) {
+    PROCESS_MEMORY_COUNTERS_EX counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters))) {
+        workingSet = (double)counters.WorkingSetSize;
+        privateBytes = (double)counters.PrivateUsage;
+    }
+    else {
+        workingSet = privateBytes = 0;
+    }
+}
+
+
+
+/**
+ * @brief Starts the run and its first interval now. Only what the timers and metrics record from here on is counted.
+ *
+ * @param sampleRate - sample rate of the acquisition source, samples per second
+ * @param samplesPerSpectrum - samples per sub-spectrum, so each ACQUIRED_SPECTRA sub-spectrum is samplesPerSpectrum/sampleRate of data
+ * @param intervalSeconds - wall time between intervals
+ */
+SoakMonitor::SoakMonitor(double sampleRate, U32 samplesPerSpectrum, double intervalSeconds)
+    : sampleRate(sampleRate), samplesPerSpectrum(samplesPerSpectrum), intervalSeconds(intervalSeconds) {
+    for (int timer = 0; timer < NUM_TIMERS; timer++) {
+        stageWorkers[timer] = 1;
+        intervalTimerTotals[timer] = getTime(timer);
+    }
+    lastAcquisitionTime = getTime(TIMER_ACQUISITION);
+    for (int metric = 0; metric < NUM_METRICS; metric++) {
+        metricsSeen[metric] = getMetric(metric).size();
+    }
+
+    start = intervalStart = lastStep = std::chrono::steady_clock::now();
+}
+
+
+
+/**
+ * @brief Call once after every step, after acquireData returns. Everything since the previous call that wasn't spent acquiring, stepping
+ *        included, is dead time of this step.
+ *
+ */
+void SoakMonitor::stepCompleted() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double acquisitionTime = getTime(TIMER_ACQUISITION);
+
+    double stepTime = std::chrono::duration<double>(now - lastStep).count();
+    current.maxDeadTime = max(current.maxDeadTime, max(stepTime - (acquisitionTime - lastAcquisitionTime), 0.0));
+    current.steps++;
+
+    lastStep = now;
+    lastAcquisitionTime = acquisitionTime;
+}
+
+
+
+bool SoakMonitor::intervalDue() const {
+    return std::chrono::duration<double>(lastStep - intervalStart).count() >= intervalSeconds;
+}
+
+
+
+double SoakMonitor::elapsed() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+/**
+ * @brief Ends the current interval at the last completed step, prints it and starts the next one.
+ *
+ * @return const SoakInterval& - the interval just closed
+ */
+const SoakInterval& SoakMonitor::closeInterval() {
+    current.elapsed = std::chrono::duration<double>(lastStep - start).count();
+    current.wallTime = std::chrono::duration<double>(lastStep - intervalStart).count();
+
+    long long subSpectra = newMetricTotal(ACQUIRED_SPECTRA, metricsSeen[ACQUIRED_SPECTRA]);
+    current.dataTime = subSpectra*samplesPerSpectrum/sampleRate;
+    current.lateBuffers = newMetricTotal(LATE_BUFFERS, metricsSeen[LATE_BUFFERS]);
+    current.overruns = newMetricTotal(ACQUISITION_OVERRUNS, metricsSeen[ACQUISITION_OVERRUNS]);
+
+    for (int timer = 0; timer < NUM_TIMERS; timer++) {
+        double total = getTime(timer);
+        current.stageBusy[timer] = total - intervalTimerTotals[timer];
+        intervalTimerTotals[timer] = total;
+    }
+    current.acquisitionTime = current.stageBusy[TIMER_ACQUISITION];
+    processMemory(current.workingSet, current.privateBytes);
+
+    history.push_back(current);
+    current = SoakInterval();
+    intervalStart = lastStep;
+
+    const SoakInterval& closed = history.back();
+    double meanDeadTime = (closed.steps > 0) ? closed.deadTime()/closed.steps : 0;
+    fprintf(stdout, "Soak %8.3f h: %6d steps, duty cycle %6.4f, dead time %8.2f ms/step (max %8.2f), %6lld late buffers, %4lld overruns, "
+            "working set %9.1f MB, private %9.1f MB\n", closed.elapsed/3600, closed.steps, closed.dutyCycle(), 1e3*meanDeadTime,
+            1e3*closed.maxDeadTime, closed.lateBuffers, closed.overruns, closed.workingSet/1e6, closed.privateBytes/1e6);
+
+    return closed;
+}
+
+
+
+/**
+ * @brief Prints the sustained duty cycle and dead time over the whole run, the worst interval, the memory growth, and the load and
+ *        saturating sample rate of every stage.
+ *
+ */
+void SoakMonitor::report() const {
+    if (history.empty()) {
+        std::cout << "Soak test: no interval completed." << std::endl;
+        return;
+    }
+
+    SoakInterval total;
+    double worstDutyCycle = history.front().dutyCycle(), peakWorkingSet = 0;
+    for (const SoakInterval& interval : history) {
+        total.wallTime += interval.wallTime;
+        total.dataTime += interval.dataTime;
+        total.acquisitionTime += interval.acquisitionTime;
+        total.steps += interval.steps;
+        total.maxDeadTime = max(total.maxDeadTime, interval.maxDeadTime);
+        total.lateBuffers += interval.lateBuffers;
+        total.overruns += interval.overruns;
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            total.stageBusy[timer] += interval.stageBusy[timer];
+        }
+        worstDutyCycle = min(worstDutyCycle, interval.dutyCycle());
+        peakWorkingSet = max(peakWorkingSet, interval.workingSet);
+    }
+
+    // Growth from the end of the first interval, once the pipeline's allocations are in place
+    const SoakInterval& first = history.front();
+    const SoakInterval& last = history.back();
+    double growthHours = (last.elapsed - first.elapsed)/3600;
+    double privateGrowth = last.privateBytes - first.privateBytes;
+
+    fprintf(stdout, "\n********** SOAK TEST **********\n");
+    fprintf(stdout, "   RUN TIME:               %8.4g h, %d steps\n", total.wallTime/3600, total.steps);
+    fprintf(stdout, "   DATA ACQUIRED:          %8.4g s at %.4g MS/s\n", total.dataTime, sampleRate/1e6);
+    fprintf(stdout, "   SUSTAINED DUTY CYCLE:   %8.4f (worst interval %.4f)\n", total.dutyCycle(), worstDutyCycle);
+    fprintf(stdout, "   DEAD TIME PER STEP:     %8.4g ms (max %.4g ms)\n", (total.steps > 0) ? 1e3*total.deadTime()/total.steps : 0,
+            1e3*total.maxDeadTime);
+    fprintf(stdout, "   LATE BUFFERS:           %8lld\n", total.lateBuffers);
+    fprintf(stdout, "   ACQUISITION OVERRUNS:   %8lld\n", total.overruns);
+    fprintf(stdout, "   PEAK WORKING SET:       %8.1f MB\n", peakWorkingSet/1e6);
+    if (growthHours > 0) {
+        fprintf(stdout, "   PRIVATE BYTES GROWTH:   %8.3f MB over %.4g h (%.3f MB/h)\n", privateGrowth/1e6, growthHours, privateGrowth/1e6/growthHours);
+    }
+    fprintf(stdout, "*********************************\n\n");
+
+
+    // A stage busy u seconds per second of data per worker saturates at sampleRate/u
+    fprintf(stdout, "\n********** STAGE SATURATION **********\n");
+    fprintf(stdout, "   %-20s %8s %12s %10s %16s\n", "", "WORKERS", "BUSY (s)", "LOAD", "SATURATES (MS/s)");
+    for (int timer = TIMER_FFT; timer < NUM_TIMERS; timer++) {
+        if (total.stageBusy[timer] <= 0 || total.dataTime <= 0) {
+            continue;
+        }
+        double load = total.stageBusy[timer]/(stageWorkers[timer]*total.dataTime);
+        fprintf(stdout, "   %-20s %8d %12.4g %10.4f %16.4g\n", soakStageNames[timer], stageWorkers[timer], total.stageBusy[timer], load,
+                sampleRate/load/1e6);
+    }
+    fprintf(stdout, "*********************************\n\n");
+}
+
+
+
+/**
+ * @brief Saves the intervals as CSV, one interval per row, with the busy time of every stage at the end of the row.
+ *
+ * @param filename - CSV file
+ */
+void SoakMonitor::save(const std::string& filename) const {
+    std::ofstream dataFile(filename);
+    if (!dataFile.is_open()) {
+        std::cerr << "Unable to open file " << filename << " to save data." << std::endl;
+        return;
+    }
+
+    dataFile << "elapsed,wallTime,dataTime,acquisitionTime,steps,maxDeadTime,workingSet,privateBytes,lateBuffers,overruns";
+    for (int timer = 0; timer < NUM_TIMERS; timer++) {
+        dataFile << ",stageBusy" << timer;
+    }
+    dataFile << std::endl;
+
+    dataFile << std::setprecision(10);
+    for (const SoakInterval& interval : history) {
+        dataFile << interval.elapsed << "," << interval.wallTime << "," << interval.dataTime << "," << interval.acquisitionTime << ","
+                 << interval.steps << "," << interval.maxDeadTime << "," << interval.workingSet << "," << interval.privateBytes << ","
+                 << interval.lateBuffers << "," << interval.overruns;
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            dataFile << "," << interval.stageBusy[timer];
+        }
+        dataFile << std::endl;
+    }
+    dataFile.close();
+}
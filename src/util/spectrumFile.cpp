@@ -0,0 +1,154 @@
+/**
+ * @file spectrumFile.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the SpectrumFileWriter class. See include\utils\spectrumFile.hpp for the class definition
+ *        and the file format.
+ * @version 0.1
+ * @date 2023-11-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Creates the file and writes its header and axis. An existing file is overwritten. Check isOpen before writing.
+ *
+ * @param filename - file to write
+ * @param numBins - doubles in every array of the file
+ * @param arraysPerRecord - arrays in each record
+ * @param kind - SPECTRUM_FILE_SINGLE, SPECTRUM_FILE_SEQUENCE or SPECTRUM_FILE_DELTAS
+ * @param axis - frequency axis shared by every array, nullptr for plain arrays. Must hold numBins values. Delta files take their axis from
+ *               setUniformAxis instead
+ * @param trueCenterFreq - receiver center frequency the axis is relative to, MHz
+ */
+SpectrumFileWriter::SpectrumFileWriter(const std::string& filename, size_t numBins, U32 arraysPerRecord, U32 kind, const FrequencyAxis* axis,
+                                       double trueCenterFreq) {
+    header = SpectrumFileHeader();
+    std::strncpy(header.magic, SPECTRUM_FILE_MAGIC, sizeof(header.magic));
+    header.version = SPECTRUM_FILE_VERSION;
+    header.axisType = SPECTRUM_AXIS_NONE;
+    header.numBins = numBins;
+    header.arraysPerRecord = arraysPerRecord;
+    header.kind = kind;
+    header.trueCenterFreq = trueCenterFreq;
+
+    // A uniform axis is checked against its descriptor bin by bin, so the reader's start + i*step is the saved axis to within tolerance
+    if (axis != nullptr && axis->size() == numBins && numBins > 0) {
+        header.axisType = SPECTRUM_AXIS_UNIFORM;
+        header.axisStart = axis->front();
+        header.axisStep = (numBins > 1) ? (axis->back() - axis->front())/(double)(numBins - 1) : 0;
+
+        double tolerance = SPECTRUM_AXIS_TOLERANCE*std::abs(header.axisStep);
+        for (size_t i = 0; i < numBins; i++) {
+            if (std::abs((*axis)[i] - (header.axisStart + (double)i*header.axisStep)) > tolerance) {
+                header.axisType = SPECTRUM_AXIS_EXPLICIT;
+                break;
+            }
+        }
+    }
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    if (header.axisType == SPECTRUM_AXIS_EXPLICIT) {
+        file.write(reinterpret_cast<const char*>(&*axis->begin()), numBins*sizeof(double));
+    }
+}
+
+
+
+SpectrumFileWriter::~SpectrumFileWriter() {
+    close();
+}
+
+
+
+/**
+ * @brief Appends one array to the current record. Records are complete after every arraysPerRecord arrays.
+ *
+ * @param data - first value of the array
+ * @param size - values in the array, which must be the file's numBins
+ */
+void SpectrumFileWriter::writeArray(const double* data, size_t size) {
+    if (size != header.numBins) {
+        throw std::runtime_error("Error: Array of " + std::to_string(size) + " values written to a spectrum file of "
+                                 + std::to_string(header.numBins) + " bins\n");
+    }
+    file.write(reinterpret_cast<const char*>(data), size*sizeof(double));
+    arraysWritten++;
+}
+
+
+
+/**
+ * @brief Appends a delta record to a SPECTRUM_FILE_DELTAS file.
+ *
+ * @param firstBin - first bin of the array the record replaces, 0 for a keyframe
+ * @param data - first replaced value
+ * @param size - values replaced
+ * @param keyframe - the record starts the array over
+ */
+void SpectrumFileWriter::writeDelta(uint64_t firstBin, const double* data, size_t size, bool keyframe) {
+    if (header.kind != SPECTRUM_FILE_DELTAS) {
+        throw std::runtime_error("Error: Delta record written to a spectrum file that is not a SPECTRUM_FILE_DELTAS file\n");
+    }
+
+    SpectrumDeltaHeader delta = SpectrumDeltaHeader();
+    delta.firstBin = keyframe ? 0 : firstBin;
+    delta.numBins = size;
+    delta.keyframe = keyframe;
+    file.write(reinterpret_cast<const char*>(&delta), sizeof(delta));
+    file.write(reinterpret_cast<const char*>(data), size*sizeof(double));
+
+    widestDelta = max(widestDelta, delta.firstBin + delta.numBins);
+    arraysWritten++;
+}
+
+
+
+/**
+ * @brief Gives the file the uniform axis axisStart + i*axisStep, e.g. for a delta file whose width is only known once it closes. The header
+ *        is rewritten by close, so this can be called any time before it.
+ *
+ * @param axisStart - first axis value
+ * @param axisStep - spacing of the axis
+ */
+void SpectrumFileWriter::setUniformAxis(double axisStart, double axisStep) {
+    if (header.axisType == SPECTRUM_AXIS_EXPLICIT) {
+        throw std::runtime_error("Error: Spectrum file already holds an explicit axis\n");
+    }
+    header.axisType = SPECTRUM_AXIS_UNIFORM;
+    header.axisStart = axisStart;
+    header.axisStep = axisStep;
+}
+
+
+
+/**
+ * @brief Patches the number of complete records into the header and closes the file. Does nothing if the file is not open.
+ *
+ * @return true - every write succeeded
+ * @return false - the file could not be written
+ */
+bool SpectrumFileWriter::close() {
+    if (!file.is_open()) {
+        return false;
+    }
+
+    header.numRecords = (header.arraysPerRecord > 0) ? arraysWritten/header.arraysPerRecord : 0;
+    if (header.kind == SPECTRUM_FILE_DELTAS) {
+        header.numBins = widestDelta;
+    }
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    bool written = (bool)file;
+    file.close();
+    return written;
+}
@@ -0,0 +1,494 @@
+/**
+ * @file spectrumKernels.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Elementwise and reduction kernels on spectra of doubles, used by DataProcessor, dataProcessingUtils.cpp, BayesFactors and
+ *        DecisionAgent. Every kernel has a scalar and an AVX2/FMA version, and the first call picks one for the CPU the program runs on, so
+ *        a build without ENABLE_AVX2 still vectorizes on machines that have it. The spans need no alignment: unaligned loads cost nothing
+ *        extra on aligned data, and std::vector storage is only 16 byte aligned. Outputs may be the same span as an input.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SPECTRUM_KERNELS_X64 (1)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SPECTRUM_AVX2_TARGET // MSVC emits any intrinsic whatever /arch
+#else
+#define SPECTRUM_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+#else
+#define SPECTRUM_KERNELS_X64 (0)
+#endif
+
+// One implementation of every kernel
+struct SpectrumKernelTable {
+    const char* name;
+    void (*accumulate)(double*, const double*, size_t);
+    void (*scale)(double*, double, size_t);
+    void (*divide)(double*, const double*, const double*, size_t);
+    void (*scaleAdd)(double*, double, const double*, double, size_t);
+    void (*ratioMinusOne)(double*, const double*, const double*, size_t);
+    void (*scaledProduct)(double*, const double*, const double*, double, size_t);
+    double (*sum)(const double*, size_t);
+    void (*moments)(const double*, size_t, double, double&, double&);
+    void (*coefficientUpdate)(double*, double*, const double*, const double*, const double*, double, double, size_t);
+    void (*quadraticRoot)(double*, const double*, const double*, double, size_t);
+    double (*thresholdScore)(double*, const double*, const double*, const double*, size_t);
+};
+
+
+
+static void accumulateScalar(double* sum, const double* values, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        sum[i] += values[i];
+    }
+}
+
+static void scaleScalar(double* values, double scale, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        values[i] *= scale;
+    }
+}
+
+static void divideScalar(double* out, const double* numerator, const double* denominator, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = numerator[i] / denominator[i];
+    }
+}
+
+static void scaleAddScalar(double* values, double factor, const double* x, double weight, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        values[i] = factor*values[i] + weight*x[i];
+    }
+}
+
+static void ratioMinusOneScalar(double* out, const double* numerator, const double* denominator, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = numerator[i] / denominator[i] - 1;
+    }
+}
+
+static void scaledProductScalar(double* out, const double* x, const double* y, double scale, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = x[i] * scale * y[i];
+    }
+}
+
+static double sumScalar(const double* values, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+static void momentsScalar(const double* values, size_t n, double shift, double& sum, double& sumSquares) {
+    sum = 0;
+    sumSquares = 0;
+    for (size_t i = 0; i < n; i++) {
+        double value = values[i] - shift;
+        sum += value;
+        sumSquares += value*value;
+    }
+}
+
+static void coefficientUpdateScalar(double* sumA, double* sumB, const double* powers, const double* weights, const double* sigmas, double factorA,
+                                    double factorB, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        sumA[i] += weights[i]*factorA;
+        sumB[i] += factorB*std::sqrt(weights[i])*powers[i]/sigmas[i];
+    }
+}
+
+static void quadraticRootScalar(double* out, const double* a, const double* b, double c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (b[i] + std::sqrt(b[i]*b[i] + c*a[i]))/(2*a[i]);
+    }
+}
+
+static double thresholdScoreScalar(double* scores, const double* values, const double* thresholds, const double* weights, size_t n) {
+    double change = 0;
+    for (size_t i = 0; i < n; i++) {
+        double newScore = (values[i] > thresholds[i]) ? weights[i]*values[i]*values[i] : 0;
+        change += newScore - scores[i];
+        scores[i] = newScore;
+    }
+    return change;
+}
+
+static const SpectrumKernelTable scalarKernels = {
+    "scalar", accumulateScalar, scaleScalar, divideScalar, scaleAddScalar, ratioMinusOneScalar, scaledProductScalar, sumScalar, momentsScalar,
+    coefficientUpdateScalar, quadraticRootScalar, thresholdScoreScalar
+};
+
+
+
+#if SPECTRUM_KERNELS_X64
+// 4 doubles per register, the tails run the scalar loops
+SPECTRUM_AVX2_TARGET static void accumulateAVX2(double* sum, const double* values, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(sum + i, _mm256_add_pd(_mm256_loadu_pd(sum + i), _mm256_loadu_pd(values + i)));
+    }
+    accumulateScalar(sum + i, values + i, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void scaleAVX2(double* values, double scale, size_t n) {
+    const __m256d scaleVec = _mm256_set1_pd(scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(values + i, _mm256_mul_pd(_mm256_loadu_pd(values + i), scaleVec));
+    }
+    scaleScalar(values + i, scale, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void divideAVX2(double* out, const double* numerator, const double* denominator, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_loadu_pd(numerator + i), _mm256_loadu_pd(denominator + i)));
+    }
+    divideScalar(out + i, numerator + i, denominator + i, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void scaleAddAVX2(double* values, double factor, const double* x, double weight, size_t n) {
+    const __m256d factorVec = _mm256_set1_pd(factor);
+    const __m256d weightVec = _mm256_set1_pd(weight);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d weighted = _mm256_mul_pd(_mm256_loadu_pd(x + i), weightVec);
+        _mm256_storeu_pd(values + i, _mm256_fmadd_pd(_mm256_loadu_pd(values + i), factorVec, weighted));
+    }
+    scaleAddScalar(values + i, factor, x + i, weight, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void ratioMinusOneAVX2(double* out, const double* numerator, const double* denominator, size_t n) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d ratio = _mm256_div_pd(_mm256_loadu_pd(numerator + i), _mm256_loadu_pd(denominator + i));
+        _mm256_storeu_pd(out + i, _mm256_sub_pd(ratio, one));
+    }
+    ratioMinusOneScalar(out + i, numerator + i, denominator + i, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void scaledProductAVX2(double* out, const double* x, const double* y, double scale, size_t n) {
+    const __m256d scaleVec = _mm256_set1_pd(scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d scaled = _mm256_mul_pd(_mm256_loadu_pd(x + i), scaleVec);
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(scaled, _mm256_loadu_pd(y + i)));
+    }
+    scaledProductScalar(out + i, x + i, y + i, scale, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static double horizontalSum(__m256d values) {
+    __m128d pairs = _mm_add_pd(_mm256_castpd256_pd128(values), _mm256_extractf128_pd(values, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pairs, _mm_unpackhi_pd(pairs, pairs)));
+}
+
+// Two accumulators per sum hide the latency of the adds
+SPECTRUM_AVX2_TARGET static double sumAVX2(const double* values, size_t n) {
+    __m256d sumA = _mm256_setzero_pd(), sumB = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        sumA = _mm256_add_pd(sumA, _mm256_loadu_pd(values + i));
+        sumB = _mm256_add_pd(sumB, _mm256_loadu_pd(values + i + 4));
+    }
+    return horizontalSum(_mm256_add_pd(sumA, sumB)) + sumScalar(values + i, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void momentsAVX2(const double* values, size_t n, double shift, double& sum, double& sumSquares) {
+    const __m256d shiftVec = _mm256_set1_pd(shift);
+    __m256d sumA = _mm256_setzero_pd(), sumB = _mm256_setzero_pd();
+    __m256d squaresA = _mm256_setzero_pd(), squaresB = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d valueA = _mm256_sub_pd(_mm256_loadu_pd(values + i), shiftVec);
+        __m256d valueB = _mm256_sub_pd(_mm256_loadu_pd(values + i + 4), shiftVec);
+        sumA = _mm256_add_pd(sumA, valueA);
+        sumB = _mm256_add_pd(sumB, valueB);
+        squaresA = _mm256_fmadd_pd(valueA, valueA, squaresA);
+        squaresB = _mm256_fmadd_pd(valueB, valueB, squaresB);
+    }
+
+    double tailSum, tailSquares;
+    momentsScalar(values + i, n - i, shift, tailSum, tailSquares);
+    sum = horizontalSum(_mm256_add_pd(sumA, sumB)) + tailSum;
+    sumSquares = horizontalSum(_mm256_add_pd(squaresA, squaresB)) + tailSquares;
+}
+
+// Same operations in the same order as the scalar loops, and sqrt and division are exact, so both give the same coefficients
+SPECTRUM_AVX2_TARGET static void coefficientUpdateAVX2(double* sumA, double* sumB, const double* powers, const double* weights, const double* sigmas,
+                                                       double factorA, double factorB, size_t n) {
+    const __m256d factorAVec = _mm256_set1_pd(factorA);
+    const __m256d factorBVec = _mm256_set1_pd(factorB);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d weight = _mm256_loadu_pd(weights + i);
+        _mm256_storeu_pd(sumA + i, _mm256_add_pd(_mm256_loadu_pd(sumA + i), _mm256_mul_pd(weight, factorAVec)));
+
+        __m256d term = _mm256_mul_pd(_mm256_mul_pd(factorBVec, _mm256_sqrt_pd(weight)), _mm256_loadu_pd(powers + i));
+        _mm256_storeu_pd(sumB + i, _mm256_add_pd(_mm256_loadu_pd(sumB + i), _mm256_div_pd(term, _mm256_loadu_pd(sigmas + i))));
+    }
+    coefficientUpdateScalar(sumA + i, sumB + i, powers + i, weights + i, sigmas + i, factorA, factorB, n - i);
+}
+
+SPECTRUM_AVX2_TARGET static void quadraticRootAVX2(double* out, const double* a, const double* b, double c, size_t n) {
+    const __m256d cVec = _mm256_set1_pd(c);
+    const __m256d two = _mm256_set1_pd(2.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d aVec = _mm256_loadu_pd(a + i);
+        __m256d bVec = _mm256_loadu_pd(b + i);
+        __m256d root = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(bVec, bVec), _mm256_mul_pd(cVec, aVec)));
+        _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_add_pd(bVec, root), _mm256_mul_pd(two, aVec)));
+    }
+    quadraticRootScalar(out + i, a + i, b + i, c, n - i);
+}
+
+// Bins at or below their threshold, and NaN bins, are masked to 0 like the scalar comparison
+SPECTRUM_AVX2_TARGET static double thresholdScoreAVX2(double* scores, const double* values, const double* thresholds, const double* weights,
+                                                      size_t n) {
+    __m256d change = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d value = _mm256_loadu_pd(values + i);
+        __m256d above = _mm256_cmp_pd(value, _mm256_loadu_pd(thresholds + i), _CMP_GT_OQ);
+        __m256d newScore = _mm256_and_pd(above, _mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(weights + i), value), value));
+        change = _mm256_add_pd(change, _mm256_sub_pd(newScore, _mm256_loadu_pd(scores + i)));
+        _mm256_storeu_pd(scores + i, newScore);
+    }
+    return horizontalSum(change) + thresholdScoreScalar(scores + i, values + i, thresholds + i, weights + i, n - i);
+}
+
+static const SpectrumKernelTable avx2Kernels = {
+    "AVX2", accumulateAVX2, scaleAVX2, divideAVX2, scaleAddAVX2, ratioMinusOneAVX2, scaledProductAVX2, sumAVX2, momentsAVX2,
+    coefficientUpdateAVX2, quadraticRootAVX2, thresholdScoreAVX2
+};
+
+
+
+/**
+ * @brief Whether the CPU has AVX2 and FMA and the OS saves the YMM registers across context switches, so code built for them can run.
+ *        Also picks the AVX2 sample conversion of ATS.cpp.
+ *
+ * @return bool - true if AVX2 code can run
+ */
+bool cpuHasAVX2() {
+    #if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+    #else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    #endif
+}
+#else
+bool cpuHasAVX2() {
+    return false;
+}
+#endif
+
+
+
+// Kernels for this CPU, picked on first use
+static const SpectrumKernelTable& spectrumKernels() {
+    static const SpectrumKernelTable& kernels = []() -> const SpectrumKernelTable& {
+        #if SPECTRUM_KERNELS_X64
+        if (SPECTRUM_KERNEL_DISPATCH && cpuHasAVX2()) {
+            return avx2Kernels;
+        }
+        #endif
+        return scalarKernels;
+    }();
+    return kernels;
+}
+
+
+
+/**
+ * @brief Name of the kernels the CPU runs, "AVX2" or "scalar".
+ *
+ * @return const char* - the name
+ */
+const char* spectrumKernelName() {
+    return spectrumKernels().name;
+}
+
+
+
+/**
+ * @brief sum[i] += values[i]
+ *
+ * @param sum - n values to add to
+ * @param values - n values to add
+ * @param n - length of the spans
+ */
+void spectrumAccumulate(double* sum, const double* values, size_t n) {
+    spectrumKernels().accumulate(sum, values, n);
+}
+
+
+
+/**
+ * @brief values[i] *= scale
+ *
+ * @param values - n values to scale
+ * @param scale - factor
+ * @param n - length of the span
+ */
+void spectrumScale(double* values, double scale, size_t n) {
+    spectrumKernels().scale(values, scale, n);
+}
+
+
+
+/**
+ * @brief out[i] = numerator[i]/denominator[i]
+ *
+ * @param out - n quotients
+ * @param numerator - n numerators
+ * @param denominator - n denominators
+ * @param n - length of the spans
+ */
+void spectrumDivide(double* out, const double* numerator, const double* denominator, size_t n) {
+    spectrumKernels().divide(out, numerator, denominator, n);
+}
+
+
+
+/**
+ * @brief values[i] = factor*values[i] + weight*x[i], fused. The update of a weighted running mean.
+ *
+ * @param values - n values to update
+ * @param factor - factor on values
+ * @param x - n values to add
+ * @param weight - factor on x
+ * @param n - length of the spans
+ */
+void spectrumScaleAdd(double* values, double factor, const double* x, double weight, size_t n) {
+    spectrumKernels().scaleAdd(values, factor, x, weight, n);
+}
+
+
+
+/**
+ * @brief out[i] = numerator[i]/denominator[i] - 1, the fractional deviation of a spectrum from its baseline.
+ *
+ * @param out - n deviations
+ * @param numerator - n spectrum values
+ * @param denominator - n baseline values
+ * @param n - length of the spans
+ */
+void spectrumRatioMinusOne(double* out, const double* numerator, const double* denominator, size_t n) {
+    spectrumKernels().ratioMinusOne(out, numerator, denominator, n);
+}
+
+
+
+/**
+ * @brief out[i] = x[i]*scale*y[i]
+ *
+ * @param out - n products
+ * @param x - n values
+ * @param y - n factors, e.g. cached reciprocals
+ * @param scale - common factor
+ * @param n - length of the spans
+ */
+void spectrumScaledProduct(double* out, const double* x, const double* y, double scale, size_t n) {
+    spectrumKernels().scaledProduct(out, x, y, scale, n);
+}
+
+
+
+/**
+ * @brief Sum of n values.
+ *
+ * @param values - n values
+ * @param n - length of the span
+ * @return double - the sum
+ */
+double spectrumSum(const double* values, size_t n) {
+    return spectrumKernels().sum(values, n);
+}
+
+
+
+/**
+ * @brief Sum and sum of squares of values[i] - shift in one pass. With a shift near the mean the variance doesn't cancel.
+ *
+ * @param values - n values
+ * @param n - length of the span
+ * @param shift - subtracted from every value
+ * @param sum - receives the sum of the shifted values
+ * @param sumSquares - receives the sum of their squares
+ */
+void spectrumMoments(const double* values, size_t n, double shift, double& sum, double& sumSquares) {
+    spectrumKernels().moments(values, n, shift, sum, sumSquares);
+}
+
+
+
+/**
+ * @brief sumA[i] += weights[i]*factorA and sumB[i] += factorB*sqrt(weights[i])*powers[i]/sigmas[i], the coefficient update of the exclusion
+ *        line, see BayesFactors::updateExclusionLine.
+ *
+ * @param sumA - n coefficients accumulating the weights
+ * @param sumB - n coefficients accumulating the weighted powers
+ * @param powers - n combined powers
+ * @param weights - n combined weights
+ * @param sigmas - n combined standard deviations
+ * @param factorA - factor on the weights
+ * @param factorB - factor on the weighted powers
+ * @param n - length of the spans
+ */
+void spectrumCoefficientUpdate(double* sumA, double* sumB, const double* powers, const double* weights, const double* sigmas, double factorA,
+                               double factorB, size_t n) {
+    spectrumKernels().coefficientUpdate(sumA, sumB, powers, weights, sigmas, factorA, factorB, n);
+}
+
+
+
+/**
+ * @brief out[i] = (b[i] + sqrt(b[i]^2 + c*a[i]))/(2*a[i]), the positive root of a[i]*x^2 - b[i]*x - c/4 = 0.
+ *
+ * @param out - n roots
+ * @param a - n quadratic coefficients
+ * @param b - n linear coefficients
+ * @param c - common factor on a under the root
+ * @param n - length of the spans
+ */
+void spectrumQuadraticRoot(double* out, const double* a, const double* b, double c, size_t n) {
+    spectrumKernels().quadraticRoot(out, a, b, c, n);
+}
+
+
+
+/**
+ * @brief scores[i] = weights[i]*values[i]^2 for values above their threshold and 0 otherwise, the bin scores of DecisionAgent::updateScore.
+ *
+ * @param scores - n previous scores, overwritten with the new ones
+ * @param values - n values to score
+ * @param thresholds - n thresholds
+ * @param weights - n weights
+ * @param n - length of the spans
+ * @return double - sum of the new scores minus the previous ones
+ */
+double spectrumThresholdScore(double* scores, const double* values, const double* thresholds, const double* weights, size_t n) {
+    return spectrumKernels().thresholdScore(scores, values, thresholds, weights, n);
+}
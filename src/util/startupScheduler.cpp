@@ -0,0 +1,116 @@
+/**
+ * @file startupScheduler.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for StartupScheduler, which runs the independent phases of a startup concurrently and times each of them.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+/**
+ * @brief Adds a phase. It runs once every phase in after has finished.
+ *
+ * @param name - name of the phase in the report
+ * @param body - work of the phase
+ * @param after - indices, as returned by add, of the phases it depends on
+ * @return int - index of the phase, for the after list of later phases
+ */
+int StartupScheduler::add(const std::string& name, std::function<void()> body, const std::vector<int>& after) {
+    for (int dependency : after) {
+        if (dependency < 0 || dependency >= (int)phases.size()) {
+            throw std::runtime_error("Error: Startup phase " + name + " depends on a phase that was not added before it\n");
+        }
+    }
+
+    Phase phase;
+    phase.name = name;
+    phase.body = std::move(body);
+    phase.after = after;
+    phases.push_back(std::move(phase));
+    return (int)phases.size() - 1;
+}
+
+
+
+void StartupScheduler::runPhase(Phase& phase) {
+    phase.start = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    phase.body();
+    phase.end = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    phase.ran = true;
+}
+
+
+
+/**
+ * @brief Runs every phase and waits for all of them, then prints the report. Phases run concurrently unless PARALLEL_STARTUP is 0.
+ *
+ * @throws The exception of the first phase (in the order added) that failed or followed a failed phase
+ */
+void StartupScheduler::run() {
+    started = std::chrono::steady_clock::now();
+
+    // The phases are only launched here, so the vector no longer moves and every phase's dependencies already have their futures
+    for (Phase& phase : phases) {
+        #if PARALLEL_STARTUP
+        std::vector<std::shared_future<void>> dependencies;
+        for (int dependency : phase.after) {
+            dependencies.push_back(phases[dependency].done);
+        }
+
+        phase.done = std::async(std::launch::async, [this, &phase, dependencies]() {
+            // get() rethrows the failure of a dependency, which skips this phase
+            for (const std::shared_future<void>& dependency : dependencies) {
+                dependency.get();
+            }
+            runPhase(phase);
+        }).share();
+        #else
+        std::promise<void> finished;
+        try {
+            for (int dependency : phase.after) {
+                phases[dependency].done.get();
+            }
+            runPhase(phase);
+            finished.set_value();
+        }
+        catch (...) {
+            finished.set_exception(std::current_exception());
+        }
+        phase.done = finished.get_future().share();
+        #endif
+    }
+
+    for (Phase& phase : phases) {
+        phase.done.wait();
+    }
+    total = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    report();
+
+    for (Phase& phase : phases) {
+        phase.done.get();
+    }
+}
+
+
+
+/**
+ * @brief Prints when every phase started and how long it took, and the total time to the end of the last phase.
+ *
+ */
+void StartupScheduler::report() const {
+    std::cout << "Startup phases:" << std::endl;
+    for (const Phase& phase : phases) {
+        std::cout << "  " << std::left << std::setw(28) << phase.name << std::right << std::fixed << std::setprecision(3);
+        if (phase.ran) {
+            std::cout << std::setw(8) << phase.end - phase.start << " s, from " << phase.start << " s" << std::endl;
+        }
+        else {
+            std::cout << "      failed or skipped" << std::endl;
+        }
+    }
+    std::cout << "  Total" << std::setw(31) << total << " s" << std::defaultfloat << std::endl;
+}
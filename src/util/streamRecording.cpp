@@ -0,0 +1,721 @@
+/**
+ * @file streamRecording.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the StreamRecorder class and the buffer codec of packed recordings. See
+ *        include\utils\streamRecording.hpp for the class definition and the recording format.
+ * @version 0.1
+ * @date 2023-11-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+static_assert(RECORDING_BLOCK_BYTES % RECORDING_SECTOR_BYTES == 0, "Recording blocks must be whole sectors for unbuffered writes");
+
+// Packed codes are a little-endian bit stream, least significant bit first
+struct BitWriter {
+    char* out;
+    size_t pos = 0;
+    uint64_t acc = 0;
+    int bits = 0;
+
+    void put(uint32_t value, int n) {
+        acc |= (uint64_t)value << bits;
+        bits += n;
+        if (bits >= 32) {
+            uint32_t word = (uint32_t)acc;
+            std::memcpy(out + pos, &word, sizeof(word));
+            pos += sizeof(word);
+            acc >>= 32;
+            bits -= 32;
+        }
+    }
+
+    void flush() {
+        for (; bits > 0; bits -= 8) {
+            out[pos++] = (char)(acc & 0xFF);
+            acc >>= 8;
+        }
+        bits = 0;
+    }
+};
+
+struct BitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t pos = 0;
+    uint64_t acc = 0;
+    int bits = 0;
+
+    uint32_t get(int n) {
+        while (bits <= 56 && pos < size) {
+            acc |= (uint64_t)data[pos++] << bits;
+            bits += 8;
+        }
+        if (bits < n) {
+            throw std::runtime_error("Error: Packed buffer ends early\n");
+        }
+        uint32_t value = (uint32_t)(acc & ((1ull << n) - 1));
+        acc >>= n;
+        bits -= n;
+        return value;
+    }
+};
+
+// Differences of neighbouring codes wrap around 16 bits, and zigzag coding puts small differences of either sign in few bits
+static inline uint16_t zigzag(uint16_t difference) {
+    return (uint16_t)(((uint32_t)difference << 1) ^ (0u - ((uint32_t)difference >> 15)));
+}
+
+static inline uint16_t unzigzag(uint16_t code) {
+    return (uint16_t)(((uint32_t)code >> 1) ^ (0u - ((uint32_t)code & 1)));
+}
+
+
+
+/**
+ * @brief Packs a buffer of 16 bit codes for a packed recording. Each channel is packed on its own: the trailing zero bits every code of the
+ *        channel shares are dropped (4 bits), then the differences of neighbouring codes are zigzag coded and bit-packed in groups of
+ *        RECORDING_PACK_GROUP, each with the width (5 bits) of its largest difference. Digitizer noise only spans a few bits, so a buffer
+ *        packs to a fraction of its size, and a buffer that doesn't pack still grows by less than 1%.
+ *
+ * @param samples - samplesPerBuffer channel A codes followed by samplesPerBuffer channel B codes
+ * @param samplesPerBuffer - codes per channel
+ * @param bufferIndex - buffer of the step, for the PackedBufferHeader
+ * @param packed - set to the PackedBufferHeader of the buffer followed by its payload. Its storage is reused
+ */
+void packRecordedBuffer(const unsigned short* samples, size_t samplesPerBuffer, uint32_t bufferIndex, std::vector<char>& packed) {
+    size_t groups = (samplesPerBuffer + RECORDING_PACK_GROUP - 1)/RECORDING_PACK_GROUP;
+    size_t maxPayload = (2*(16*samplesPerBuffer + 5*groups + 4) + 7)/8 + 8;
+    packed.resize(sizeof(PackedBufferHeader) + maxPayload);
+
+    BitWriter writer{packed.data() + sizeof(PackedBufferHeader)};
+    for (int channel = 0; channel < 2; channel++) {
+        const unsigned short* codes = samples + channel*samplesPerBuffer;
+
+        unsigned combined = 0;
+        for (size_t i = 0; i < samplesPerBuffer; i++) {
+            combined |= codes[i];
+        }
+        int shift = 0;
+        while (combined != 0 && shift < 15 && ((combined >> shift) & 1) == 0) {
+            shift++;
+        }
+        writer.put(shift, 4);
+
+        uint16_t previous = 0;
+        uint16_t differences[RECORDING_PACK_GROUP];
+        for (size_t first = 0; first < samplesPerBuffer; first += RECORDING_PACK_GROUP) {
+            size_t count = min((size_t)RECORDING_PACK_GROUP, samplesPerBuffer - first);
+            unsigned spread = 0;
+            for (size_t j = 0; j < count; j++) {
+                uint16_t code = (uint16_t)(codes[first + j] >> shift);
+                differences[j] = zigzag((uint16_t)(code - previous));
+                spread |= differences[j];
+                previous = code;
+            }
+
+            int width = 0;
+            while ((spread >> width) != 0) {
+                width++;
+            }
+            writer.put(width, 5);
+            if (width > 0) {
+                for (size_t j = 0; j < count; j++) {
+                    writer.put(differences[j], width);
+                }
+            }
+        }
+    }
+    writer.flush();
+
+    size_t payloadBytes = (writer.pos + 7)/8*8;
+    std::memset(packed.data() + sizeof(PackedBufferHeader) + writer.pos, 0, payloadBytes - writer.pos);
+
+    PackedBufferHeader bufferHeader = PackedBufferHeader();
+    bufferHeader.magic = RECORDED_BUFFER_MAGIC;
+    bufferHeader.bufferIndex = bufferIndex;
+    bufferHeader.payloadBytes = (uint32_t)payloadBytes;
+    std::memcpy(packed.data(), &bufferHeader, sizeof(bufferHeader));
+    packed.resize(sizeof(PackedBufferHeader) + payloadBytes);
+}
+
+
+
+/**
+ * @brief Unpacks the payload of a buffer written by packRecordedBuffer.
+ *
+ * @param payload - packed codes, following the buffer's PackedBufferHeader
+ * @param payloadBytes - PackedBufferHeader::payloadBytes
+ * @param samplesPerBuffer - codes per channel
+ * @param samples - set to samplesPerBuffer channel A codes followed by samplesPerBuffer channel B codes
+ */
+void unpackRecordedBuffer(const char* payload, size_t payloadBytes, size_t samplesPerBuffer, unsigned short* samples) {
+    BitReader reader{reinterpret_cast<const unsigned char*>(payload), payloadBytes};
+    for (int channel = 0; channel < 2; channel++) {
+        unsigned short* codes = samples + channel*samplesPerBuffer;
+        int shift = (int)reader.get(4);
+
+        uint16_t previous = 0;
+        for (size_t first = 0; first < samplesPerBuffer; first += RECORDING_PACK_GROUP) {
+            size_t count = min((size_t)RECORDING_PACK_GROUP, samplesPerBuffer - first);
+            int width = (int)reader.get(5);
+            if (width > 16) {
+                throw std::runtime_error("Error: Packed buffer is corrupt\n");
+            }
+
+            for (size_t j = 0; j < count; j++) {
+                uint16_t difference = (width > 0) ? (uint16_t)reader.get(width) : 0;
+                previous = (uint16_t)(previous + unzigzag(difference));
+                codes[first + j] = (unsigned short)(previous << shift);
+            }
+        }
+    }
+}
+
+
+
+/**
+ * @brief Creates the recording, allocates its staging blocks, starts the writer thread and writes the recording header. An existing file at
+ *        path is overwritten.
+ *
+ * @param path - recording file
+ * @param acquisitionParams - acquisition parameters every recorded step must share
+ * @param preallocateBytes - bytes the file is extended by whenever the recording reaches its end
+ * @param codec - RECORDING_CODEC_* the buffers are recorded with. RECORDING_CODEC_PACKED also starts the codec threads
+ */
+StreamRecorder::StreamRecorder(const std::string& path, const AcquisitionParameters& acquisitionParams, size_t preallocateBytes, int codec)
+    : path(path), preallocateBytes(max(preallocateBytes, RECORDING_BLOCK_BYTES)), bufferCodec(codec) {
+    if (codec != RECORDING_CODEC_NONE && codec != RECORDING_CODEC_PACKED) {
+        throw std::runtime_error("Error: Unknown recording codec " + std::to_string(codec) + "\n");
+    }
+    if (codec == RECORDING_CODEC_PACKED && acquisitionParams.bytesPerSample != 2) {
+        throw std::runtime_error("Error: Packed recordings need 16 bit codes, the digitizer delivers " +
+                                 std::to_string(acquisitionParams.bytesPerSample) + " bytes per sample\n");
+    }
+
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+        std::filesystem::create_directories(parent);
+    }
+
+    file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Error: Unable to create recording " + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+
+    // VirtualAlloc returns page aligned memory, which satisfies the sector alignment of unbuffered writes
+    blocks.resize(max(RECORDING_BLOCKS, 2));
+    for (Block& block : blocks) {
+        block.data = reinterpret_cast<char*>(VirtualAlloc(NULL, RECORDING_BLOCK_BYTES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        block.overlapped = OVERLAPPED();
+        block.overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (block.data == nullptr || block.overlapped.hEvent == NULL) {
+            releaseBuffers();
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+            throw std::runtime_error("Error: Unable to allocate the staging blocks of recording " + path + "\n");
+        }
+    }
+    filling = &blocks[0];
+    for (size_t i = 1; i < blocks.size(); i++) {
+        freeBlocks.push_back(&blocks[i]);
+    }
+
+    header = RecordingHeader();
+    std::strncpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = (codec == RECORDING_CODEC_PACKED) ? RECORDING_PACKED_VERSION : RECORDING_VERSION;
+    header.sampleRate = acquisitionParams.sampleRate;
+    header.samplesPerBuffer = acquisitionParams.samplesPerBuffer;
+    header.bytesPerSample = acquisitionParams.bytesPerSample;
+    header.inputRange = acquisitionParams.inputRange;
+    bytesPerBuffer = 2 * (size_t)header.samplesPerBuffer * header.bytesPerSample;
+
+    writerThread = std::thread(&StreamRecorder::writerLoop, this);
+    append(&header, sizeof(header));
+
+    if (codec == RECORDING_CODEC_PACKED) {
+        codecJobs.resize(RECORDING_CODEC_JOBS);
+        for (CodecJob& job : codecJobs) {
+            freeJobs.push_back(&job);
+        }
+        for (int i = 0; i < RECORDING_CODEC_THREADS; i++) {
+            codecThreads.emplace_back(&StreamRecorder::codecLoop, this);
+        }
+    }
+}
+
+
+
+/**
+ * @brief Closes the recording, closing the open step first.
+ *
+ */
+StreamRecorder::~StreamRecorder() {
+    try {
+        close();
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+    }
+}
+
+
+
+/**
+ * @brief Closes the open step, stops the codec threads, writes out the staging blocks and waits for the writer thread. Then trims the file to
+ *        the recorded length and patches the step headers that were already on their way to disk when their step closed. Does nothing if
+ *        already closed.
+ *
+ */
+void StreamRecorder::close() {
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    try {
+        endStep(false);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+    }
+    stopCodec();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (filling->size > 0) {
+            fullBlocks.push_back(filling);
+        }
+        else {
+            freeBlocks.push_back(filling);
+        }
+        filling = nullptr;
+        closing = true;
+    }
+    condition.notify_all();
+    writerThread.join();
+
+    std::string error = failure;
+    CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    releaseBuffers();
+
+    // The last block was padded to a whole sector and the file was preallocated past it
+    std::error_code resizeError;
+    std::filesystem::resize_file(path, position, resizeError);
+    if (resizeError && error.empty()) {
+        error = "Error: Unable to trim recording " + path + " -- " + resizeError.message() + "\n";
+    }
+
+    if (!closedSteps.empty()) {
+        std::fstream patch(path, std::ios::in | std::ios::out | std::ios::binary);
+        for (const std::pair<uint64_t, RecordedStepHeader>& closedStep : closedSteps) {
+            patch.seekp((std::streamoff)closedStep.first);
+            patch.write(reinterpret_cast<const char*>(&closedStep.second), sizeof(RecordedStepHeader));
+        }
+        if (!patch && error.empty()) {
+            error = "Error: Failed patching the step headers of " + path + "\n";
+        }
+        closedSteps.clear();
+    }
+
+    std::cout << "Recorded " << std::to_string(numSteps) << " steps (" << std::to_string(position >> 20) << " MB) to " << path << std::endl;
+    if (bufferCodec == RECORDING_CODEC_PACKED && rawBytes > 0) {
+        std::cout << "Packed " << std::to_string(rawBytes >> 20) << " MB of buffers to " << std::to_string(100.0*position/rawBytes) << "%." << std::endl;
+    }
+    if (stalled > 0) {
+        std::cout << "Warning: Acquisition waited " << std::to_string(stalled) << " s for the disk while recording." << std::endl;
+    }
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+
+
+/**
+ * @brief Starts a step. Its buffers follow until endStep.
+ *
+ * @param acquisitionParams - acquisition parameters of the step, which must match the recording's
+ * @param centerFrequency - receiver center frequency in MHz
+ */
+void StreamRecorder::beginStep(const AcquisitionParameters& acquisitionParams, double centerFrequency) {
+    if (acquisitionParams.samplesPerBuffer != header.samplesPerBuffer || acquisitionParams.sampleRate != header.sampleRate) {
+        throw std::runtime_error("Error: Acquisition parameters changed while recording to " + path + ". Start a new recording\n");
+    }
+    endStep(false);
+    drainCodec();
+
+    step = RecordedStepHeader();
+    step.magic = RECORDED_STEP_MAGIC;
+    step.stepIndex = numSteps;
+    step.numBuffers = RECORDED_STEP_OPEN;
+    step.buffersPerAcquisition = acquisitionParams.buffersPerAcquisition;
+    step.centerFrequency = centerFrequency;
+
+    stepPosition = position;
+    append(&step, sizeof(step));
+    step.numBuffers = 0;
+    stepOpen = true;
+}
+
+
+
+/**
+ * @brief Appends one buffer to the open step. Only copies the buffer, unless every staging block is still being written. A packed recording
+ *        copies it for the codec threads instead, unless they still hold every codec job. Raises an error of the writer or codec threads.
+ *
+ * @param samples - samplesPerBuffer channel A codes followed by samplesPerBuffer channel B codes
+ */
+void StreamRecorder::writeBuffer(const unsigned short* samples) {
+    if (!stepOpen) {
+        return;
+    }
+
+    if (bufferCodec == RECORDING_CODEC_PACKED) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure.empty()) {
+                throw std::runtime_error(failure);
+            }
+        }
+
+        CodecJob* job;
+        auto waitStart = std::chrono::steady_clock::now();
+        bool waited = false;
+        {
+            std::unique_lock<std::mutex> lock(codecMutex);
+            if (freeJobs.empty()) {
+                waited = true;
+                codecCondition.wait(lock, [this]() { return !freeJobs.empty(); });
+            }
+            job = freeJobs.front();
+            freeJobs.pop_front();
+        }
+        if (waited) {
+            stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+        }
+
+        job->samples.assign(samples, samples + 2*(size_t)header.samplesPerBuffer);
+        job->sequence = nextJobSequence++;
+        job->bufferIndex = step.numBuffers;
+        {
+            std::lock_guard<std::mutex> lock(codecMutex);
+            pendingJobs.push_back(job);
+        }
+        codecCondition.notify_all();
+    }
+    else {
+        append(samples, bytesPerBuffer);
+    }
+    step.numBuffers++;
+    rawBytes += bytesPerBuffer;
+}
+
+
+
+/**
+ * @brief Closes the open step by patching its buffer count into the step header: in place if the header is still in the filling block,
+ *        otherwise when the recording is closed. Does nothing if no step is open.
+ *
+ * @param stoppedByDecision - a decision ended the step before its fixed horizon
+ */
+void StreamRecorder::endStep(bool stoppedByDecision) {
+    if (!stepOpen) {
+        return;
+    }
+    drainCodec();
+    stepOpen = false;
+    step.stoppedByDecision = stoppedByDecision;
+
+    if (filling != nullptr && stepPosition >= filling->offset) {
+        std::memcpy(filling->data + (stepPosition - filling->offset), &step, sizeof(step));
+    }
+    else {
+        closedSteps.emplace_back(stepPosition, step);
+    }
+    numSteps++;
+}
+
+
+
+/**
+ * @brief Copies bytes to the end of the recording, handing every block that fills to the writer thread. Only one thread appends at a time:
+ *        the acquisition thread, or in a packed recording the codec thread holding appendMutex, with the acquisition thread only appending
+ *        step headers once drainCodec has let the codec threads catch up.
+ *
+ * @param data - bytes to append
+ * @param size - number of bytes
+ */
+void StreamRecorder::append(const void* data, size_t size) {
+    if (filling == nullptr) {
+        throw std::runtime_error("Error: Recording " + path + " is closed\n");
+    }
+
+    const char* bytes = reinterpret_cast<const char*>(data);
+    while (size > 0) {
+        if (filling->size == RECORDING_BLOCK_BYTES) {
+            handOff();
+        }
+        size_t count = min(size, RECORDING_BLOCK_BYTES - filling->size);
+        std::memcpy(filling->data + filling->size, bytes, count);
+        filling->size += count;
+        position += count;
+        bytes += count;
+        size -= count;
+    }
+}
+
+
+
+/**
+ * @brief Queues the full filling block for the writer thread and takes a free block to fill next, waiting for one if the disk is behind.
+ *        Raises an error of the writer thread.
+ *
+ */
+void StreamRecorder::handOff() {
+    Block* full = filling;
+    auto waitStart = std::chrono::steady_clock::now();
+    bool waited = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!failure.empty()) {
+            throw std::runtime_error(failure);
+        }
+        fullBlocks.push_back(full);
+        condition.notify_all();
+
+        if (freeBlocks.empty()) {
+            waited = true;
+            condition.wait(lock, [this]() { return !freeBlocks.empty(); });
+        }
+        filling = freeBlocks.front();
+        freeBlocks.pop_front();
+    }
+    if (waited) {
+        stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+    }
+
+    filling->offset = full->offset + RECORDING_BLOCK_BYTES;
+    filling->size = 0;
+}
+
+
+
+/**
+ * @brief Writer thread. Submits every full block as soon as it is queued, so the disk always has the next write, and returns blocks to the
+ *        free list oldest first as their writes complete. After an error, blocks are returned unwritten so the acquisition thread never
+ *        waits on a writer that stopped writing. Exits once closing and every write has completed.
+ *
+ */
+void StreamRecorder::writerLoop() {
+    std::deque<Block*> inFlight;
+
+    while (true) {
+        Block* block = nullptr;
+        bool failed;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (inFlight.empty()) {
+                condition.wait(lock, [this]() { return !fullBlocks.empty() || closing; });
+            }
+            if (!fullBlocks.empty()) {
+                block = fullBlocks.front();
+                fullBlocks.pop_front();
+            }
+            else if (inFlight.empty()) {
+                return;
+            }
+            failed = !failure.empty();
+        }
+
+        try {
+            if (block == nullptr) {
+                block = inFlight.front();
+                inFlight.pop_front();
+                waitForBlock(*block);
+            }
+            else if (!failed) {
+                writeBlock(*block);
+                inFlight.push_back(block);
+                continue;
+            }
+        }
+        catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (failure.empty()) {
+                failure = e.what();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeBlocks.push_back(block);
+        }
+        condition.notify_all();
+    }
+}
+
+
+
+/**
+ * @brief Starts the overlapped write of a block, extending the preallocated file first if the block reaches past it. A partial block is
+ *        zero padded to whole sectors, the padding is trimmed when the recording closes.
+ *
+ * @param block - block to write, writer thread only
+ */
+void StreamRecorder::writeBlock(Block& block) {
+    size_t bytes = (block.size + RECORDING_SECTOR_BYTES - 1)/RECORDING_SECTOR_BYTES*RECORDING_SECTOR_BYTES;
+    std::memset(block.data + block.size, 0, bytes - block.size);
+
+    if (block.offset + bytes > allocated) {
+        uint64_t size = max(allocated + preallocateBytes, block.offset + bytes);
+        LARGE_INTEGER end;
+        end.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file)) {
+            throw std::runtime_error("Error: Unable to preallocate " + std::to_string(size >> 20) + " MB for recording " + path + " -- "
+                                     + std::to_string(GetLastError()) + "\n");
+        }
+        allocated = size;
+    }
+
+    HANDLE event = block.overlapped.hEvent;
+    block.overlapped = OVERLAPPED();
+    block.overlapped.hEvent = event;
+    block.overlapped.Offset = (DWORD)(block.offset & 0xFFFFFFFF);
+    block.overlapped.OffsetHigh = (DWORD)(block.offset >> 32);
+    if (!WriteFile(file, block.data, (DWORD)bytes, NULL, &block.overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        throw std::runtime_error("Error: Failed writing " + std::to_string(bytes) + " bytes at offset " + std::to_string(block.offset) + " of "
+                                 + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+}
+
+
+
+/**
+ * @brief Waits for the write of a block to complete.
+ *
+ * @param block - block submitted by writeBlock, writer thread only
+ */
+void StreamRecorder::waitForBlock(Block& block) {
+    DWORD written = 0;
+    if (!GetOverlappedResult(file, &block.overlapped, &written, TRUE) || written < block.size) {
+        throw std::runtime_error("Error: Failed writing " + std::to_string(block.size) + " bytes at offset " + std::to_string(block.offset)
+                                 + " of " + path + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+}
+
+
+
+void StreamRecorder::releaseBuffers() {
+    for (Block& block : blocks) {
+        if (block.data != nullptr) {
+            VirtualFree(block.data, 0, MEM_RELEASE);
+        }
+        if (block.overlapped.hEvent != NULL) {
+            CloseHandle(block.overlapped.hEvent);
+        }
+    }
+    blocks.clear();
+    freeBlocks.clear();
+    fullBlocks.clear();
+}
+
+
+
+/**
+ * @brief Codec thread of a packed recording. Packs the buffers writeBuffer queues, any number at once, and appends the packed buffers that
+ *        are next in order. Exits once stopCodec is called and no buffer is left.
+ *
+ */
+void StreamRecorder::codecLoop() {
+    while (true) {
+        CodecJob* job;
+        {
+            std::unique_lock<std::mutex> lock(codecMutex);
+            codecCondition.wait(lock, [this]() { return !pendingJobs.empty() || codecStopping; });
+            if (pendingJobs.empty()) {
+                return;
+            }
+            job = pendingJobs.front();
+            pendingJobs.pop_front();
+        }
+
+        packRecordedBuffer(job->samples.data(), header.samplesPerBuffer, job->bufferIndex, job->packed);
+        {
+            std::lock_guard<std::mutex> lock(codecMutex);
+            packedJobs[job->sequence] = job;
+        }
+        appendPacked();
+    }
+}
+
+
+
+/**
+ * @brief Appends every packed buffer that is next in order and frees its codec job. After an error the buffers are freed unwritten, the
+ *        error is raised by the next writeBuffer.
+ *
+ */
+void StreamRecorder::appendPacked() {
+    std::lock_guard<std::mutex> appending(appendMutex);
+    while (true) {
+        CodecJob* job;
+        {
+            std::lock_guard<std::mutex> lock(codecMutex);
+            auto next = packedJobs.find(nextAppendSequence);
+            if (next == packedJobs.end()) {
+                return;
+            }
+            job = next->second;
+            packedJobs.erase(next);
+        }
+
+        try {
+            append(job->packed.data(), job->packed.size());
+        }
+        catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (failure.empty()) {
+                failure = e.what();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(codecMutex);
+            freeJobs.push_back(job);
+            nextAppendSequence++;
+        }
+        codecCondition.notify_all();
+    }
+}
+
+
+
+// Waits until every buffer written so far has been appended, so the acquisition thread can append and patch step headers in order
+void StreamRecorder::drainCodec() {
+    if (bufferCodec != RECORDING_CODEC_PACKED) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(codecMutex);
+    codecCondition.wait(lock, [this]() { return nextAppendSequence == nextJobSequence; });
+}
+
+
+
+void StreamRecorder::stopCodec() {
+    {
+        std::lock_guard<std::mutex> lock(codecMutex);
+        codecStopping = true;
+    }
+    codecCondition.notify_all();
+    for (std::thread& thread : codecThreads) {
+        thread.join();
+    }
+    codecThreads.clear();
+}
@@ -0,0 +1,241 @@
+/**
+ * @file telemetryPublisher.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for TelemetryPublisher, the shared memory channel that live monitoring clients watch a scan through.
+ * @version 0.1
+ * @date 2023-11-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+/**
+ * @brief Creates the named shared memory, or opens it if a viewer still holds it from an earlier scan, and writes the header.
+ *
+ * @param name - Name of the mapping viewers open, TELEMETRY_NAME by default
+ * @param rateHz - Publications per second per channel at most
+ * @param maxValues - Values per channel, longer spectra are averaged down to fit
+ */
+TelemetryPublisher::TelemetryPublisher(const std::string& name, double rateHz, uint32_t maxValues) : mappingName(name), maxValues(maxValues) {
+    if (rateHz <= 0 || maxValues == 0) {
+        throw std::runtime_error("Error: Telemetry needs a positive rate and channel size\n");
+    }
+    periodNanoseconds = (int64_t)(1e9 / rateHz);
+    channelStride = sizeof(TelemetryChannelHeader) + (uint64_t)maxValues * sizeof(double);
+
+    uint64_t totalBytes = sizeof(TelemetryHeader) + TELEMETRY_CHANNELS * channelStride;
+    mappingHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(totalBytes >> 32), (DWORD)(totalBytes & 0xFFFFFFFF),
+                                       mappingName.c_str());
+    if (mappingHandle != NULL) {
+        if (GetLastError() == ERROR_ALREADY_EXISTS) {
+            std::cout << "Telemetry: reusing the shared memory " << mappingName << " still open in a viewer" << std::endl;
+        }
+        view = reinterpret_cast<char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, (SIZE_T)totalBytes));
+    }
+    if (view == nullptr) {
+        unmap();
+        throw std::runtime_error("Error: Unable to map telemetry memory " + mappingName + " -- " + std::to_string(GetLastError()) + "\n");
+    }
+
+    opened = std::chrono::steady_clock::now();
+
+    TelemetryHeader* header = reinterpret_cast<TelemetryHeader*>(view);
+    std::memset(header->magic, 0, sizeof(header->magic));
+    header->version = TELEMETRY_VERSION;
+    header->numChannels = TELEMETRY_CHANNELS;
+    header->maxValues = maxValues;
+    header->reserved = 0;
+    header->channelStride = channelStride;
+    header->rateHz = rateHz;
+
+    for (int channel = 0; channel < TELEMETRY_CHANNELS; channel++) {
+        TelemetryChannelHeader* channelInfo = channelHeader(channel);
+        channelInfo->sequence.store(0, std::memory_order_relaxed);
+        channelInfo->numValues = 0;
+        channelInfo->sourceBins = 0;
+    }
+
+    // The magic goes in last, after everything it vouches for
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+
+    std::cout << "Publishing telemetry to " << mappingName << " at " << rateHz << " Hz" << std::endl;
+}
+
+
+
+TelemetryPublisher::~TelemetryPublisher() {
+    if (view != nullptr) {
+        std::memset(reinterpret_cast<TelemetryHeader*>(view)->magic, 0, sizeof(TelemetryHeader::magic));
+    }
+    unmap();
+}
+
+
+
+void TelemetryPublisher::unmap() {
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mappingHandle != NULL) {
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+}
+
+
+
+int64_t TelemetryPublisher::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - opened).count();
+}
+
+
+
+TelemetryChannelHeader* TelemetryPublisher::channelHeader(int channel) const {
+    return reinterpret_cast<TelemetryChannelHeader*>(view + sizeof(TelemetryHeader) + channel * channelStride);
+}
+
+
+
+double* TelemetryPublisher::channelValues(int channel) const {
+    return reinterpret_cast<double*>(view + sizeof(TelemetryHeader) + channel * channelStride + sizeof(TelemetryChannelHeader));
+}
+
+
+
+/**
+ * @brief Whether a publication to the channel would be accepted now. Lets callers skip building values only telemetry needs.
+ *
+ * @param channel - TELEMETRY_* channel
+ */
+bool TelemetryPublisher::due(int channel) const {
+    return now() >= nextDue[channel].load(std::memory_order_relaxed);
+}
+
+
+
+/**
+ * @brief Takes the channel for one publication if it is due and no other thread is writing it. Never waits.
+ *
+ * @param channel - TELEMETRY_* channel
+ * @return true if the caller now writes the channel and must clear writing[channel] afterwards
+ */
+bool TelemetryPublisher::claim(int channel) {
+    if (!due(channel) || writing[channel].exchange(true, std::memory_order_acquire)) {
+        return false;
+    }
+
+    // Another thread may have published between the check above and the exchange
+    int64_t time = now();
+    if (time < nextDue[channel].load(std::memory_order_relaxed)) {
+        writing[channel].store(false, std::memory_order_release);
+        return false;
+    }
+    nextDue[channel].store(time + periodNanoseconds, std::memory_order_relaxed);
+    return true;
+}
+
+
+
+/**
+ * @brief Publishes the powers of a spectrum on its frequency axis, taken as uniform from its first and last frequencies.
+ *
+ * @param channel - TELEMETRY_* channel
+ * @param spectrum - Spectrum to publish, only read
+ * @return true if it was published, false if the channel was not due or busy
+ */
+bool TelemetryPublisher::publishSpectrum(int channel, const Spectrum& spectrum) {
+    double axisStart = 0, axisStep = 0;
+    if (!spectrum.freqAxis.empty()) {
+        axisStart = spectrum.freqAxis.front();
+        if (spectrum.freqAxis.size() > 1) {
+            axisStep = (spectrum.freqAxis.back() - spectrum.freqAxis.front()) / (spectrum.freqAxis.size() - 1);
+        }
+    }
+
+    return publishValues(channel, spectrum.powers.data(), spectrum.powers.size(), axisStart, axisStep, spectrum.trueCenterFreq);
+}
+
+
+
+/**
+ * @brief Publishes count values, averaging groups of consecutive values down to maxValues when there are more. The axis of the published
+ *        values is moved to the centers of the groups.
+ *
+ * @param channel - TELEMETRY_* channel
+ * @param values - Values to publish, only read
+ * @param count - Number of values
+ * @param axisStart - Frequency of values[0], 0 with axisStep for values without a frequency axis
+ * @param axisStep - Frequency step between values
+ * @param trueCenterFreq - Receiver center frequency, MHz
+ * @return true if it was published, false if the channel was not due or busy
+ */
+bool TelemetryPublisher::publishValues(int channel, const double* values, size_t count, double axisStart, double axisStep, double trueCenterFreq) {
+    if (!claim(channel)) {
+        return false;
+    }
+
+    size_t decimation = (count + maxValues - 1) / maxValues;
+    decimation = (decimation == 0) ? 1 : decimation;
+    size_t numValues = (count + decimation - 1) / decimation;
+
+    TelemetryChannelHeader* channelInfo = channelHeader(channel);
+    double* target = channelValues(channel);
+
+    uint64_t sequence = channelInfo->sequence.load(std::memory_order_relaxed);
+    channelInfo->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < numValues; i++) {
+        size_t first = i * decimation;
+        size_t last = (first + decimation < count) ? first + decimation : count;
+
+        double sum = 0;
+        for (size_t j = first; j < last; j++) {
+            sum += values[j];
+        }
+        target[i] = sum / (last - first);
+    }
+
+    channelInfo->numValues = (uint32_t)numValues;
+    channelInfo->decimation = (uint32_t)decimation;
+    channelInfo->step = currentStep.load(std::memory_order_relaxed);
+    channelInfo->sourceBins = count;
+    channelInfo->axisStart = axisStart + 0.5 * (decimation - 1) * axisStep;
+    channelInfo->axisStep = axisStep * decimation;
+    channelInfo->trueCenterFreq = trueCenterFreq;
+    channelInfo->timestamp = now() * 1e-9;
+
+    channelInfo->sequence.store(sequence + 2, std::memory_order_release);
+    writing[channel].store(false, std::memory_order_release);
+
+    published++;
+    return true;
+}
+
+
+
+/**
+ * @brief Publishes the stage times of timing.cpp and the latest value of every metric, NaN for metrics with no value yet.
+ *
+ * @return true if it was published, false if the channel was not due or busy
+ */
+bool TelemetryPublisher::publishMetrics() {
+    if (!due(TELEMETRY_METRICS)) {
+        return false;
+    }
+
+    double values[NUM_TIMERS + NUM_METRICS];
+    for (int timer = 0; timer < NUM_TIMERS; timer++) {
+        values[timer] = getTime(timer);
+    }
+    for (int metric = 0; metric < NUM_METRICS; metric++) {
+        std::vector<int> history = getMetric(metric);
+        values[NUM_TIMERS + metric] = history.empty() ? std::nan("") : history.back();
+    }
+
+    return publishValues(TELEMETRY_METRICS, values, NUM_TIMERS + NUM_METRICS);
+}
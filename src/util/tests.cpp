@@ -1,7 +1,7 @@
 /**
  * @file tests.cpp
  * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
- * @brief Implements some basic tests for the VISA communication and PSG/AWG classes.
+ * @brief Implements some basic tests for the VISA communication and PSG/AWG classes, and benchmarks for the acquisition kernels.
  * @version 0.1
  * @date 2023-06-30
  * 
@@ -128,4 +128,162 @@ void awgTesting(int gpibAdress){
     catch(const std::exception& e) {
         std::cerr << e.what() << '\n';
     }
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Benchmarks convertSamplesToComplex against the original per-sample conversion loop from the acquisition thread on a synthetic
+ * buffer, and checks that both produce the same voltages.
+ * 
+ * @param samplesPerBuffer - samples per channel in the synthetic DMA buffer
+ * @param repeats - number of conversions to time for each implementation
+ */
+void benchmarkSampleConversion(U32 samplesPerBuffer, int repeats) {
+    double inputRange = 0.8;
+
+    std::vector<unsigned short> dmaBuffer(2*samplesPerBuffer);
+    for (unsigned short& code : dmaBuffer) {
+        code = (unsigned short)(std::rand() & 0xFFFF);
+    }
+
+    fftw_complex* legacyOutput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * samplesPerBuffer));
+    fftw_complex* kernelOutput = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * samplesPerBuffer));
+
+
+    // Original loop, including the copy out of the DMA buffer
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < repeats; n++) {
+        std::vector<unsigned short> bufferData(dmaBuffer.begin(), dmaBuffer.end());
+
+        for (unsigned int i=0; i < bufferData.size()/2; i++) {
+            legacyOutput[i][0] = (bufferData[i]   / (double)0xFFFF) * 2 * inputRange - inputRange;
+            legacyOutput[i][1] = (bufferData[bufferData.size()/2 + i]  / (double)0xFFFF) * 2 * inputRange - inputRange;
+
+            if (i % 2 == 1) {
+                legacyOutput[i][0] *= -1;
+                legacyOutput[i][1] *= -1;
+            }
+        }
+    }
+    double legacyTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+
+    // Single pass kernel
+    start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < repeats; n++) {
+        convertSamplesToComplex(dmaBuffer.data(), kernelOutput, samplesPerBuffer, inputRange);
+    }
+    double kernelTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+
+    double maxError = 0;
+    for (U32 i = 0; i < samplesPerBuffer; i++) {
+        maxError = max(maxError, std::abs(legacyOutput[i][0] - kernelOutput[i][0]));
+        maxError = max(maxError, std::abs(legacyOutput[i][1] - kernelOutput[i][1]));
+    }
+
+    fftw_free(legacyOutput);
+    fftw_free(kernelOutput);
+
+    std::string kernelType = (SPECTRUM_KERNEL_DISPATCH && cpuHasAVX2()) ? "AVX2" : "scalar";
+
+    std::cout << "Sample conversion (" << std::to_string(samplesPerBuffer) << " samples x " << std::to_string(repeats) << " buffers)" << std::endl;
+    std::cout << "    Original loop: " << std::to_string(1e3*legacyTime/repeats) << " ms per buffer" << std::endl;
+    std::cout << "    " << kernelType << " kernel: " << std::to_string(1e3*kernelTime/repeats) << " ms per buffer (" 
+              << std::to_string(legacyTime/kernelTime) << "x)" << std::endl;
+    std::cout << "    Max difference: " << maxError << " V" << std::endl;
+}
+
+
+/**
+ * @brief Benchmarks the baseline filter kernels on synthetic spectra: the generic Dsp cascade run forward, reversed and run again, the generic
+ * ZeroPhaseFilter kernel, and the kernels specialized on the section count, one spectrum at a time and FILTER_SIMD_LANES at a time.
+ * Checks that both ZeroPhaseFilter kernels agree.
+ * 
+ * @param spectrumLength - bins per synthetic spectrum
+ * @param poleNumber - order of the Chebyshev II low pass, at most 6
+ * @param repeats - number of FILTER_SIMD_LANES spectrum groups to time for each kernel
+ */
+void benchmarkBaselineFilter(size_t spectrumLength, int poleNumber, int repeats) {
+    double sampleRate = 1e6, cutoffFrequency = 1e4, stopbandAttenuation = 15.0;
+
+    Dsp::SimpleFilter<Dsp::ChebyshevII::LowPass<6>, 1> cascade;
+    cascade.setup(poleNumber, sampleRate, cutoffFrequency, stopbandAttenuation);
+
+    Dsp::ChebyshevII::LowPass<6> design;
+    design.setup(poleNumber, sampleRate, cutoffFrequency, stopbandAttenuation);
+    ZeroPhaseFilter filter;
+    filter.setSections(design);
+
+    std::vector<std::vector<double>> spectra(FILTER_SIMD_LANES, std::vector<double>(spectrumLength));
+    for (std::vector<double>& spectrum : spectra) {
+        for (size_t i = 0; i < spectrumLength; i++) {
+            spectrum[i] = 1 + 0.1*std::sin(1e-3*i) + 0.01*(std::rand() % 100);
+        }
+    }
+    int numSpectra = repeats*FILTER_SIMD_LANES;
+
+
+    // Generic Dsp cascade, as rawToProcessed ran it before
+    std::vector<double> work;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < numSpectra; n++) {
+        work = spectra[n % FILTER_SIMD_LANES];
+        double* data[1] = {work.data()};
+        cascade.reset();
+        cascade.process(static_cast<int>(spectrumLength), data);
+        std::reverse(work.begin(), work.end());
+        cascade.reset();
+        cascade.process(static_cast<int>(spectrumLength), data);
+        std::reverse(work.begin(), work.end());
+    }
+    double cascadeTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+
+    // ZeroPhaseFilter, generic and fixed kernels
+    std::vector<std::vector<double>> genericOutput, fixedOutput;
+    double kernelTimes[2][2];
+    for (int fixed = 0; fixed < 2; fixed++) {
+        filter.setFixedKernels(fixed == 1);
+
+        start = std::chrono::high_resolution_clock::now();
+        for (int n = 0; n < numSpectra; n++) {
+            work = spectra[n % FILTER_SIMD_LANES];
+            filter.apply(work);
+        }
+        kernelTimes[fixed][0] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        std::vector<std::vector<double>> batch;
+        start = std::chrono::high_resolution_clock::now();
+        for (int n = 0; n < repeats; n++) {
+            batch = spectra;
+            std::vector<std::vector<double>*> signals;
+            for (std::vector<double>& spectrum : batch) {
+                signals.push_back(&spectrum);
+            }
+            filter.applyBatch(signals);
+        }
+        kernelTimes[fixed][1] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        (fixed == 1 ? fixedOutput : genericOutput) = batch;
+    }
+
+    double maxError = 0;
+    for (size_t j = 0; j < spectra.size(); j++) {
+        for (size_t i = 0; i < spectrumLength; i++) {
+            maxError = max(maxError, std::abs(genericOutput[j][i] - fixedOutput[j][i]));
+        }
+    }
+
+    std::string labels[2][2] = {{"Generic kernel, single", "Generic kernel, batched"}, {"Fixed kernel, single", "Fixed kernel, batched"}};
+    std::cout << "Baseline filter (order " << std::to_string(poleNumber) << ", " << std::to_string(spectrumLength) << " bins x " 
+              << std::to_string(numSpectra) << " spectra)" << std::endl;
+    std::cout << "    Dsp cascade: " << std::to_string(1e3*cascadeTime/numSpectra) << " ms per spectrum" << std::endl;
+    for (int fixed = 0; fixed < 2; fixed++) {
+        for (int batched = 0; batched < 2; batched++) {
+            std::cout << "    " << labels[fixed][batched] << ": " << std::to_string(1e3*kernelTimes[fixed][batched]/numSpectra) << " ms per spectrum (" 
+                      << std::to_string(cascadeTime/kernelTimes[fixed][batched]) << "x)" << std::endl;
+        }
+    }
+    std::cout << "    Max difference between kernels: " << maxError << std::endl;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file threadPlacement.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Function definitions for ThreadPlacement and ThreadPlacementScope, the core, priority and MMCSS placement of the pipeline threads.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+static const char* threadRoleNames[NUM_THREAD_ROLES] = {"acquisition", "fft", "compute"};
+
+static const std::pair<const char*, int> threadPriorityNames[] = {
+    {"idle", THREAD_PRIORITY_IDLE}, {"lowest", THREAD_PRIORITY_LOWEST}, {"below_normal", THREAD_PRIORITY_BELOW_NORMAL},
+    {"normal", THREAD_PRIORITY_NORMAL}, {"above_normal", THREAD_PRIORITY_ABOVE_NORMAL}, {"highest", THREAD_PRIORITY_HIGHEST},
+    {"time_critical", THREAD_PRIORITY_TIME_CRITICAL}
+};
+
+static std::string trimmed(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return "";
+    }
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+// "any", or a comma separated list of cores and ranges of cores, e.g. "0-1,4"
+static DWORD_PTR parseCores(const std::string& text) {
+    if (text == "any") {
+        return 0;
+    }
+
+    DWORD_PTR mask = 0;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        item = trimmed(item);
+        size_t dash = item.find('-');
+        int first = std::stoi(item.substr(0, dash));
+        int last = (dash == std::string::npos) ? first : std::stoi(item.substr(dash + 1));
+        if (first < 0 || last < first || last >= (int)(8*sizeof(DWORD_PTR))) {
+            throw std::runtime_error("Error: Invalid cores " + item + " in thread placement\n");
+        }
+        for (int core = first; core <= last; core++) {
+            mask |= (DWORD_PTR)1 << core;
+        }
+    }
+    return mask;
+}
+
+// THREAD_PRIORITY_* by name, e.g. "time_critical", or by value
+static int parsePriority(const std::string& text) {
+    for (const std::pair<const char*, int>& name : threadPriorityNames) {
+        if (text == name.first) {
+            return name.second;
+        }
+    }
+    return std::stoi(text);
+}
+
+
+
+/**
+ * @brief Every role on any core at normal priority, outside MMCSS.
+ *
+ */
+ThreadPlacement::ThreadPlacement() {
+    for (int role = 0; role < NUM_THREAD_ROLES; role++) {
+        affinityMask[role] = 0;
+        priority[role] = THREAD_PRIORITY_NORMAL;
+    }
+}
+
+
+
+/**
+ * @brief Placement that isolates the acquisition from the compute stages: the acquisition threads get the first acquisitionCores cores at
+ *        time critical priority and register with MMCSS as MMCSS_ACQUISITION_TASK, and the FFT workers and compute stages share the
+ *        remaining cores at normal priority. With no cores left over, only the priorities are set.
+ *
+ * @param acquisitionCores - cores reserved for the acquisition threads
+ * @return ThreadPlacement - the placement
+ */
+ThreadPlacement ThreadPlacement::isolated(int acquisitionCores) {
+    ThreadPlacement placement;
+    placement.priority[THREAD_ROLE_ACQUISITION] = THREAD_PRIORITY_TIME_CRITICAL;
+    placement.mmcssTask[THREAD_ROLE_ACQUISITION] = MMCSS_ACQUISITION_TASK;
+
+    int numCores = min((int)std::thread::hardware_concurrency(), (int)(8*sizeof(DWORD_PTR)));
+    acquisitionCores = max(1, acquisitionCores);
+    if (numCores <= acquisitionCores) {
+        return placement;
+    }
+
+    DWORD_PTR allCores = (numCores == (int)(8*sizeof(DWORD_PTR))) ? ~(DWORD_PTR)0 : ((DWORD_PTR)1 << numCores) - 1;
+    placement.affinityMask[THREAD_ROLE_ACQUISITION] = ((DWORD_PTR)1 << acquisitionCores) - 1;
+    placement.affinityMask[THREAD_ROLE_FFT] = allCores & ~placement.affinityMask[THREAD_ROLE_ACQUISITION];
+    placement.affinityMask[THREAD_ROLE_COMPUTE] = placement.affinityMask[THREAD_ROLE_FFT];
+    return placement;
+}
+
+
+
+/**
+ * @brief Reads a deployment's placement from a text file of "role.setting = value" lines, on top of the current placement. Roles are
+ *        acquisition, fft and compute. Settings are cores ("any", or a list like 0-1,4), priority (idle, lowest, below_normal, normal,
+ *        above_normal, highest, time_critical or a THREAD_PRIORITY_* value) and mmcss (an MMCSS task such as Pro Audio, or none).
+ *        Blank lines and lines starting with # are skipped.
+ *
+ * @param path - placement file
+ */
+void ThreadPlacement::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Error: Unable to open thread placement file " + path + "\n");
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trimmed(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t dot = line.find('.'), equals = line.find('=');
+        if (dot == std::string::npos || equals == std::string::npos || dot > equals) {
+            throw std::runtime_error("Error: Line " + std::to_string(lineNumber) + " of " + path + " is not role.setting = value\n");
+        }
+        std::string roleName = trimmed(line.substr(0, dot));
+        std::string setting = trimmed(line.substr(dot + 1, equals - dot - 1));
+        std::string value = trimmed(line.substr(equals + 1));
+
+        int role = (int)(std::find(threadRoleNames, threadRoleNames + NUM_THREAD_ROLES, roleName) - threadRoleNames);
+        if (role == NUM_THREAD_ROLES) {
+            throw std::runtime_error("Error: Unknown thread role " + roleName + " on line " + std::to_string(lineNumber) + " of " + path + "\n");
+        }
+
+        try {
+            if (setting == "cores") {
+                affinityMask[role] = parseCores(value);
+            }
+            else if (setting == "priority") {
+                priority[role] = parsePriority(value);
+            }
+            else if (setting == "mmcss") {
+                mmcssTask[role] = (value == "none") ? "" : value;
+            }
+            else {
+                throw std::runtime_error("Error: Unknown thread placement setting " + setting + "\n");
+            }
+        }
+        catch (const std::logic_error&) {
+            throw std::runtime_error("Error: Invalid value " + value + " on line " + std::to_string(lineNumber) + " of " + path + "\n");
+        }
+    }
+}
+
+
+
+void ThreadPlacement::print() const {
+    for (int role = 0; role < NUM_THREAD_ROLES; role++) {
+        std::cout << "Thread placement " << threadRoleNames[role] << ": cores ";
+        if (affinityMask[role] == 0) {
+            std::cout << "any";
+        }
+        else {
+            std::cout << "0x" << std::hex << (unsigned long long)affinityMask[role] << std::dec;
+        }
+        std::cout << ", priority " << std::to_string(priority[role]) << ", MMCSS " << (mmcssTask[role].empty() ? "none" : mmcssTask[role]) << std::endl;
+    }
+}
+
+
+
+/**
+ * @brief Moves the calling thread onto its role's cores, or the chain's, sets its priority and registers it with the role's MMCSS task.
+ *        A setting the system refuses is reported and left as it was, so the stage still runs.
+ *
+ * @param placement - placement of the pipeline
+ * @param role - THREAD_ROLE_* of the calling thread
+ * @param chainMask - cores of the thread's digitizer chain, used in place of the role's cores if set
+ */
+ThreadPlacementScope::ThreadPlacementScope(const ThreadPlacement& placement, int role, DWORD_PTR chainMask) {
+    HANDLE thread = GetCurrentThread();
+
+    DWORD_PTR mask = (chainMask != 0) ? chainMask : placement.affinityMask[role];
+    if (mask != 0) {
+        previousMask = SetThreadAffinityMask(thread, mask);
+        if (previousMask == 0) {
+            std::cerr << "Failed to set the affinity of a pipeline thread, error " << GetLastError() << std::endl;
+        }
+    }
+
+    int currentPriority = GetThreadPriority(thread);
+    if (currentPriority != THREAD_PRIORITY_ERROR_RETURN && currentPriority != placement.priority[role]) {
+        if (SetThreadPriority(thread, placement.priority[role])) {
+            previousPriority = currentPriority;
+        }
+        else {
+            std::cerr << "Failed to set the priority of a pipeline thread, error " << GetLastError() << std::endl;
+        }
+    }
+
+    if (!placement.mmcssTask[role].empty()) {
+        DWORD taskIndex = 0;
+        mmcssHandle = AvSetMmThreadCharacteristicsA(placement.mmcssTask[role].c_str(), &taskIndex);
+        if (mmcssHandle == NULL) {
+            std::cerr << "Failed to register a pipeline thread with MMCSS task " << placement.mmcssTask[role] << ", error " << GetLastError() << std::endl;
+        }
+    }
+}
+
+
+
+ThreadPlacementScope::~ThreadPlacementScope() {
+    HANDLE thread = GetCurrentThread();
+    if (mmcssHandle != NULL) {
+        AvRevertMmThreadCharacteristics(mmcssHandle);
+    }
+    if (previousPriority != THREAD_PRIORITY_ERROR_RETURN) {
+        SetThreadPriority(thread, previousPriority);
+    }
+    if (previousMask != 0) {
+        SetThreadAffinityMask(thread, previousMask);
+    }
+}
@@ -11,34 +11,111 @@
 
 #include "decs.hpp"
 
-static double timers[NUM_TIMERS];
-static double times[NUM_TIMERS] = {0};
+// Every timer keeps its total and per-item distribution in a lock-free histogram. Start times are per thread, so stages (and several
+// workers of one stage) running at once don't overwrite each other's
+static LatencyHistogram latencies[NUM_LATENCIES];
+static thread_local std::chrono::steady_clock::time_point timers[NUM_TIMERS];
+
+// Span names of the timers in a trace, see traceRecorder.cpp
+static const char* timerTraceNames[NUM_TIMERS] = {"Acquisition", "FFT", "Magnitude", "Averaging", "Processing", "Decision", "Saving"};
+
+// Allocations of every timer's items, attributed from this thread's counters at startTimer, see allocationTracker.cpp
+static AllocationStats allocationStats[NUM_TIMERS];
+static thread_local AllocationCounters allocationStarts[NUM_TIMERS];
 
 static std::vector<int> metrics[NUM_METRICS];
 
+// Latest sample of every pipeline queue, see QueueGauges. Both step slots of a pipelined scan may sample at once
+static QueueGauge queueGauges[NUM_QUEUES];
+static std::mutex queueGaugeMutex;
+
 void setTime(int timerCode, double val) {
-    times[timerCode] = val;
+    latencies[timerCode].setTotal(val);
 }
 
 double getTime(int timerCode) { 
-    return times[timerCode]; 
+    return latencies[timerCode].total(); 
 }
 
 void startTimer(int timerCode) {
-    timers[timerCode] = GetTickCount();
+    #if TRACK_ALLOCATIONS
+    allocationStarts[timerCode] = threadAllocations();
+    #endif
+    timers[timerCode] = std::chrono::steady_clock::now();
 }
 
-void stopTimer(int timerCode) {
-    times[timerCode] += (GetTickCount() - timers[timerCode])/1000;
+// Adds the time since this thread's startTimer to the total and records it as one item of the stage, and as a span while tracing. The
+// allocations this thread made in between are the item's, nested timers count them for both
+void stopTimer(int timerCode, int64_t traceItem) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(now - timers[timerCode]).count();
+    latencies[timerCode].record(duration);
+
+    AllocationCounters item;
+    #if TRACK_ALLOCATIONS
+    AllocationCounters current = threadAllocations();
+    item.allocations = current.allocations - allocationStarts[timerCode].allocations;
+    item.bytes = current.bytes - allocationStarts[timerCode].bytes;
+    allocationStats[timerCode].record(item, heapInUse());
+    #endif
+
+    if (tracingEnabled()) {
+        int64_t end = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        traceEvent(timerTraceNames[timerCode], TRACE_PIPELINE, end - duration, duration, traceItem,
+                   TRACK_ALLOCATIONS ? (int64_t)item.allocations : -1, (int64_t)item.bytes);
+    }
 }
 
 void resetTimers()
 {
+    for (int n = 0; n < NUM_LATENCIES; n++) {
+        latencies[n].reset();
+    }
     for (int n = 0; n < NUM_TIMERS; n++) {
-        times[n] = 0.;
+        allocationStats[n].reset();
     }
 }
 
+// Nanoseconds on the clock the timers use, for stamping data with when it was acquired
+int64_t latencyClock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the time from a latencyClock() stamp until now, e.g. LATENCY_BUFFER_TO_DECISION
+void recordLatency(int latencyCode, int64_t since) {
+    latencies[latencyCode].record(latencyClock() - since);
+}
+
+LatencySummary getLatency(int latencyCode) {
+    return latencies[latencyCode].summary();
+}
+
+AllocationSummary getAllocations(int timerCode) {
+    return allocationStats[timerCode].summary();
+}
+
+// Records the allocations of the timed stages since the last call as STEP_ALLOCATIONS, STEP_ALLOCATED_MB and STEP_PEAK_HEAP_MB, and
+// restarts the heap peak. Steps of a pipelined scan overlap, so a step is charged with whatever ran since the previous one finished
+void recordStepAllocations() {
+    static AllocationCounters seen;
+
+    AllocationCounters total;
+    for (int n = 0; n < NUM_TIMERS; n++) {
+        AllocationSummary allocations = allocationStats[n].summary();
+        total.allocations += allocations.allocations;
+        total.bytes += allocations.bytes;
+    }
+    if (total.allocations < seen.allocations || total.bytes < seen.bytes) {
+        seen = AllocationCounters(); // The timers were reset
+    }
+
+    setMetric(STEP_ALLOCATIONS, (int)min(total.allocations - seen.allocations, (uint64_t)INT_MAX));
+    setMetric(STEP_ALLOCATED_MB, (int)std::llround((total.bytes - seen.bytes)/1e6));
+    setMetric(STEP_PEAK_HEAP_MB, (int)std::llround(heapPeak()/1e6));
+    seen = total;
+    resetHeapPeak();
+}
+
 
 void setMetric(int metricCode, int val) {
     metrics[metricCode].push_back(val);
@@ -52,24 +129,106 @@ std::vector<int> getMetric(int metricCode) {
     return metrics[metricCode];
 }
 
+// Replace the values of a metric, e.g. with the values of a resumed scan
+void restoreMetric(int metricCode, const std::vector<int>& values) {
+    metrics[metricCode] = values;
+}
+
+void setQueueGauge(int queueCode, const QueueGauge& gauge) {
+    std::lock_guard<std::mutex> lock(queueGaugeMutex);
+    queueGauges[queueCode] = gauge;
+}
+
+QueueGauge getQueueGauge(int queueCode) {
+    std::lock_guard<std::mutex> lock(queueGaugeMutex);
+    return queueGauges[queueCode];
+}
+
+// Flattens a gauge into QUEUE_GAUGE_VALUES values: depth, high water, capacity, pushes/s, pops/s, bytes in flight, items pushed, items discarded
+void queueGaugeValues(const QueueGauge& gauge, double* values) {
+    values[0] = (double)gauge.depth;
+    values[1] = (double)gauge.highWater;
+    values[2] = (double)gauge.capacity;
+    values[3] = gauge.pushRate;
+    values[4] = gauge.popRate;
+    values[5] = gauge.bytesInFlight;
+    values[6] = (double)gauge.pushed;
+    values[7] = (double)gauge.discarded;
+}
+
 // Report a running average of timing data
 void reportPerformance()
 {
+    // Busy time of each stage. Stages with several workers sum the time of all of them
     fprintf(stdout, "\n********** ABSOLUTE PERFORMANCE **********\n");
 
-    fprintf(stdout, "   DATA ACQUISITION:    %8.4g s\n", times[TIMER_ACQUISITION]);
-    fprintf(stdout, "   FOURIER TRANSFORM:   %8.4g s\n", times[TIMER_FFT]);
-    fprintf(stdout, "   FFT MAGNITUDE:       %8.4g s\n", times[TIMER_MAG]);
-    fprintf(stdout, "   AVERAGING:           %8.4g s\n", times[TIMER_AVERAGE]);
-    fprintf(stdout, "   PROCESSING:          %8.4g s\n", times[TIMER_PROCESS]);
-    fprintf(stdout, "   DECISION MAKING:     %8.4g s\n", times[TIMER_DECISION]);
+    fprintf(stdout, "   DATA ACQUISITION:    %8.4g s\n", getTime(TIMER_ACQUISITION));
+    fprintf(stdout, "   FOURIER TRANSFORM:   %8.4g s\n", getTime(TIMER_FFT));
+    fprintf(stdout, "   FFT MAGNITUDE:       %8.4g s\n", getTime(TIMER_MAG));
+    fprintf(stdout, "   AVERAGING:           %8.4g s\n", getTime(TIMER_AVERAGE));
+    fprintf(stdout, "   PROCESSING:          %8.4g s\n", getTime(TIMER_PROCESS));
+    fprintf(stdout, "   DECISION MAKING:     %8.4g s\n", getTime(TIMER_DECISION));
     #if SAVE_PROGRESS
-    fprintf(stdout, "   DATA SAVING:         %8.4g s\n", times[TIMER_SAVE]);
+    fprintf(stdout, "   DATA SAVING:         %8.4g s\n", getTime(TIMER_SAVE));
     #endif
 
     fprintf(stdout, "*********************************\n\n");
 
 
+    // Per item distribution of every stage, an item being whatever the stage times at once (a block, a spectrum or a batch)
+    const char* latencyNames[NUM_LATENCIES] = {"DATA ACQUISITION", "FOURIER TRANSFORM", "FFT MAGNITUDE", "AVERAGING", "PROCESSING",
+                                               "DECISION MAKING", "DATA SAVING", "BUFFER TO DECISION"};
+
+    fprintf(stdout, "\n********** LATENCY PER ITEM **********\n");
+    fprintf(stdout, "   %-20s %10s %12s %12s %12s\n", "", "ITEMS", "P50 (us)", "P99 (us)", "MAX (us)");
+    for (int n = 0; n < NUM_LATENCIES; n++) {
+        LatencySummary latency = latencies[n].summary();
+        if (latency.count > 0) {
+            fprintf(stdout, "   %-20s %10llu %12.1f %12.1f %12.1f\n", latencyNames[n], (unsigned long long)latency.count,
+                    latency.p50*1e6, latency.p99*1e6, latency.max*1e6);
+        }
+    }
+
+    fprintf(stdout, "*********************************\n\n");
+
+
+    // Allocations per item of every stage, the cost of passing spectra by value. The peak is of the whole process, as the stage saw it
+    #if TRACK_ALLOCATIONS
+    fprintf(stdout, "\n********** ALLOCATIONS PER ITEM **********\n");
+    fprintf(stdout, "   %-20s %10s %12s %12s %14s\n", "", "ITEMS", "ALLOCATIONS", "KB", "PEAK HEAP (MB)");
+    for (int n = 0; n < NUM_TIMERS; n++) {
+        AllocationSummary allocations = allocationStats[n].summary();
+        if (allocations.items > 0) {
+            fprintf(stdout, "   %-20s %10llu %12.1f %12.1f %14.1f\n", latencyNames[n], (unsigned long long)allocations.items,
+                    (double)allocations.allocations/allocations.items, allocations.bytes/1e3/allocations.items, allocations.peakHeap/1e6);
+        }
+    }
+    if (!metrics[STEP_ALLOCATIONS].empty()) {
+        fprintf(stdout, "   LAST STEP:           %d allocations, %d MB, peak heap %d MB\n", metrics[STEP_ALLOCATIONS].back(),
+                metrics[STEP_ALLOCATED_MB].back(), metrics[STEP_PEAK_HEAP_MB].back());
+    }
+    fprintf(stdout, "   HEAP IN USE:         %.1f MB\n", heapInUse()/1e6);
+
+    fprintf(stdout, "*********************************\n\n");
+    #endif
+
+
+    // A queue that sits near its capacity, or pushes faster than it pops, points at the stage behind it
+    const char* queueNames[NUM_QUEUES] = {"DATA", "FFT DATA", "MAG DATA", "RAW DATA", "REBINNED DATA"};
+
+    fprintf(stdout, "\n********** PIPELINE QUEUES **********\n");
+    fprintf(stdout, "   %-14s %8s %10s %10s %12s %12s %12s %10s\n", "", "DEPTH", "HIGH WATER", "CAPACITY", "PUSHES/S", "POPS/S", "MB IN FLIGHT",
+            "DISCARDED");
+    for (int n = 0; n < NUM_QUEUES; n++) {
+        QueueGauge gauge = getQueueGauge(n);
+        fprintf(stdout, "   %-14s %8llu %10llu %10llu %12.1f %12.1f %12.2f %10llu\n", queueNames[n], (unsigned long long)gauge.depth,
+                (unsigned long long)gauge.highWater, (unsigned long long)gauge.capacity, gauge.pushRate, gauge.popRate, gauge.bytesInFlight/1e6,
+                (unsigned long long)gauge.discarded);
+    }
+
+    fprintf(stdout, "*********************************\n\n");
+
+
     // Calculate some per spectrum statistics
     int totalAcquiredSpectra = 0;
     double averageDecisionEnforcementDelay = 0;
@@ -87,12 +246,30 @@ void reportPerformance()
 
     averageDecisionEnforcementDelay /= (double)numDecisions;
 
+    // Only steps stopped by a decision have a latency
+    double averageStopLatency = 0;
+    int numStops = 0;
+    for (int latency : metrics[DECISION_STOP_LATENCY]) {
+        if (latency >= 0) {
+            averageStopLatency += latency;
+            numStops++;
+        }
+    }
+    averageStopLatency /= max(numStops, 1);
+
+    // Buffers that ate into the DMA ring's slack, and the acquisitions that ran out of it
+    long long totalLateBuffers = std::accumulate(metrics[LATE_BUFFERS].begin(), metrics[LATE_BUFFERS].end(), 0LL);
+    long long totalOverruns = std::accumulate(metrics[ACQUISITION_OVERRUNS].begin(), metrics[ACQUISITION_OVERRUNS].end(), 0LL);
+
 
     fprintf(stdout, "\n********** PER SPECTRUM PERFORMANCE **********\n");
 
     fprintf(stdout, "   ACQUIRED SPECTRA:                     %d \n", totalAcquiredSpectra);
-    fprintf(stdout, "   AVERAGE ACQUISITION TIME:             %8.4g \n", times[TIMER_ACQUISITION]/(double)totalAcquiredSpectra);
+    fprintf(stdout, "   AVERAGE ACQUISITION TIME:             %8.4g \n", getTime(TIMER_ACQUISITION)/(double)totalAcquiredSpectra);
     fprintf(stdout, "   AVERAGE DECISION ENFORCEMENT DELAY:   %8.4g \n", averageDecisionEnforcementDelay);
+    fprintf(stdout, "   AVERAGE DECISION TO STOP LATENCY:     %8.4g us\n", averageStopLatency);
+    fprintf(stdout, "   LATE BUFFERS:                         %lld \n", totalLateBuffers);
+    fprintf(stdout, "   ACQUISITION OVERRUNS:                 %lld \n", totalOverruns);
 
     fprintf(stdout, "*********************************\n\n");
 }
\ No newline at end of file
@@ -0,0 +1,242 @@
+/**
+ * @file traceRecorder.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Span recording for a Chrome trace-event view of the pipeline. Every thread records into its own ring of the last TRACE_BUFFER_EVENTS
+ *        spans, so recording takes no lock. writeTrace merges the rings into one trace-event JSON file
+ *        for chrome://tracing or ui.perfetto.dev.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+// Spans of one thread. Only the owning thread writes, writeTrace reads the slots below written
+struct TraceBuffer {
+    std::vector<TraceEvent> events = std::vector<TraceEvent>(TRACE_BUFFER_EVENTS);
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> generation{0}; // Trace the events belong to, a new trace restarts the ring
+    int threadID = 0;
+    std::string threadName;
+};
+
+static std::atomic<bool> tracing{false};
+static std::atomic<uint64_t> traceGeneration{0};
+static int64_t traceStart = 0;
+
+// Registration is the only locked step and happens once per thread per trace
+static std::mutex traceBuffersMutex;
+static std::vector<std::shared_ptr<TraceBuffer>> traceBuffers;
+static int nextTraceThreadID = 1;
+
+static thread_local std::shared_ptr<TraceBuffer> threadTraceBuffer;
+static thread_local std::string threadTraceName;
+
+
+
+static TraceBuffer& currentTraceBuffer() {
+    uint64_t generation = traceGeneration.load(std::memory_order_acquire);
+    if (threadTraceBuffer == nullptr) {
+        threadTraceBuffer = std::make_shared<TraceBuffer>();
+
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        threadTraceBuffer->threadID = nextTraceThreadID++;
+        threadTraceBuffer->threadName = threadTraceName.empty() ? "Thread " + std::to_string(threadTraceBuffer->threadID) : threadTraceName;
+        traceBuffers.push_back(threadTraceBuffer);
+    }
+
+    TraceBuffer& buffer = *threadTraceBuffer;
+    if (buffer.generation.load(std::memory_order_relaxed) != generation) {
+        buffer.written.store(0, std::memory_order_relaxed);
+        buffer.generation.store(generation, std::memory_order_release);
+    }
+    return buffer;
+}
+
+
+
+/**
+ * @brief Starts a new trace. Spans recorded before are dropped, and rings of threads that have exited since are freed.
+ *
+ */
+void startTracing() {
+    {
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        traceBuffers.erase(std::remove_if(traceBuffers.begin(), traceBuffers.end(),
+                                          [](const std::shared_ptr<TraceBuffer>& buffer) { return buffer.use_count() == 1; }), traceBuffers.end());
+        traceStart = latencyClock();
+    }
+    traceGeneration.fetch_add(1, std::memory_order_acq_rel);
+    tracing.store(true, std::memory_order_release);
+}
+
+
+
+/**
+ * @brief Stops recording spans. The trace is kept for writeTrace until the next startTracing.
+ *
+ */
+void stopTracing() {
+    tracing.store(false, std::memory_order_release);
+}
+
+
+
+bool tracingEnabled() {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+
+
+/**
+ * @brief Names the calling thread in the trace, e.g. after its pipeline stage. Threads that are never named show up as "Thread n".
+ *
+ * @param name - thread name
+ */
+void setTraceThreadName(const std::string& name) {
+    threadTraceName = name;
+    if (threadTraceBuffer != nullptr) {
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        threadTraceBuffer->threadName = name;
+    }
+}
+
+
+
+/**
+ * @brief Records a span into the calling thread's ring while tracing is on. The oldest span of the thread is overwritten once the ring is full.
+ *
+ * @param name - span name, a string literal
+ * @param category - TRACE_* category, a string literal
+ * @param start - latencyClock() when the span began
+ * @param duration - nanoseconds the span took
+ * @param item - buffer, block or step the span worked on, -1 for none
+ * @param allocations - heap allocations the thread made during the span, -1 if not counted
+ * @param allocatedBytes - bytes those allocations asked for
+ */
+void traceEvent(const char* name, const char* category, int64_t start, int64_t duration, int64_t item, int64_t allocations,
+                int64_t allocatedBytes) {
+    if (!tracingEnabled()) {
+        return;
+    }
+
+    TraceBuffer& buffer = currentTraceBuffer();
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index % TRACE_BUFFER_EVENTS] = {name, category, start, duration, item, allocations, allocatedBytes};
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+
+
+static void writeJSONString(std::ostream& file, const std::string& text) {
+    file << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            file << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            file << ' ';
+        }
+        else {
+            file << c;
+        }
+    }
+    file << '"';
+}
+
+
+
+/**
+ * @brief Writes the current trace as trace-event JSON: one complete ("X") event per span, timestamps in microseconds since startTracing,
+ *        and a thread name event per thread. Spans carry their item and, with TRACK_ALLOCATIONS, their allocations and bytes as args. Call after stopTracing, or between steps, so no thread overwrites spans while they are written.
+ *
+ * @param path - JSON file, overwritten
+ * @return true if the file was written
+ */
+bool writeTrace(const std::string& path) {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+        std::filesystem::create_directories(parent);
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cerr << "Failed to open trace file " << path << std::endl;
+        return false;
+    }
+
+    uint64_t generation = traceGeneration.load(std::memory_order_acquire);
+    size_t numEvents = 0, numDropped = 0;
+    bool first = true;
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << std::fixed << std::setprecision(3);
+
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    for (const std::shared_ptr<TraceBuffer>& buffer : traceBuffers) {
+        uint64_t written = buffer->written.load(std::memory_order_acquire);
+        if (buffer->generation.load(std::memory_order_acquire) != generation || written == 0) {
+            continue;
+        }
+
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadID << ",\"args\":{\"name\":";
+        writeJSONString(file, buffer->threadName);
+        file << "}}";
+        first = false;
+
+        uint64_t oldest = (written > TRACE_BUFFER_EVENTS) ? written - TRACE_BUFFER_EVENTS : 0;
+        numDropped += (size_t)oldest;
+        for (uint64_t index = oldest; index < written; index++) {
+            const TraceEvent& event = buffer->events[index % TRACE_BUFFER_EVENTS];
+            file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadID
+                 << ",\"ts\":" << (event.start - traceStart) * 1e-3 << ",\"dur\":" << event.duration * 1e-3;
+            if (event.item >= 0 || event.allocations >= 0) {
+                file << ",\"args\":{";
+                if (event.item >= 0) {
+                    file << "\"item\":" << event.item << (event.allocations >= 0 ? "," : "");
+                }
+                if (event.allocations >= 0) {
+                    file << "\"allocations\":" << event.allocations << ",\"bytes\":" << event.allocatedBytes;
+                }
+                file << "}";
+            }
+            file << "}";
+            numEvents++;
+        }
+    }
+    file << "\n]}\n";
+
+    file.close();
+    if (!file) {
+        std::cerr << "Failed to write trace file " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote " << numEvents << " trace events to " << path;
+    if (numDropped > 0) {
+        std::cout << ", " << numDropped << " older events were overwritten";
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+
+
+TraceSpan::TraceSpan(const char* name, const char* category, int64_t item)
+    : name(name), category(category), item(item), start(tracingEnabled() ? latencyClock() : 0) {
+    if (start != 0) {
+        startAllocations = threadAllocations();
+    }
+}
+
+
+
+TraceSpan::~TraceSpan() {
+    if (start != 0) {
+        AllocationCounters current = threadAllocations();
+        traceEvent(name, category, start, latencyClock() - start, item, TRACK_ALLOCATIONS ? (int64_t)(current.allocations - startAllocations.allocations) : -1,
+                   (int64_t)(current.bytes - startAllocations.bytes));
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file welchSegmenter.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the WelchSegmenter class. See include\utils\welchSegmenter.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Computes the window table and allocates the two buffers segments are cut from.
+ *
+ * @param samplesPerSegment - samples per buffer and per segment
+ * @param window - WELCH_WINDOW_* of the segments
+ * @param segmentsPerBuffer - segments starting in every buffer, 1/(1 - overlap). Must divide samplesPerSegment
+ */
+WelchSegmenter::WelchSegmenter(U32 samplesPerSegment, int window, int segmentsPerBuffer)
+    : N(samplesPerSegment), windowType(window), segmentsPerBuffer(segmentsPerBuffer) {
+    if (segmentsPerBuffer < 1 || samplesPerSegment % (U32)segmentsPerBuffer != 0) {
+        throw std::runtime_error("Error: Segments of " + std::to_string(samplesPerSegment) + " samples can't overlap " + 
+                                 std::to_string(segmentsPerBuffer) + " to a buffer\n");
+    }
+    hop = N/(U32)segmentsPerBuffer;
+
+    std::vector<double> table = windowTable(window, N);
+    windowValues.assign(table.begin(), table.end());
+
+    previous = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * N));
+    current = reinterpret_cast<pipeline_complex*>(pipeline_malloc(sizeof(pipeline_complex) * N));
+}
+
+
+
+WelchSegmenter::~WelchSegmenter() {
+    pipeline_free(previous);
+    pipeline_free(current);
+}
+
+
+
+/**
+ * @brief Periodic window of a given length, scaled to a mean square of 1.
+ *
+ * @param window - WELCH_WINDOW_*
+ * @param length - samples
+ * @return std::vector<double> - the window
+ */
+std::vector<double> WelchSegmenter::windowTable(int window, U32 length) {
+    std::vector<double> table(length, 1);
+    for (U32 n = 0; n < length; n++) {
+        double x = 2*M_PI*n/length;
+        if (window == WELCH_WINDOW_HANN) {
+            table[n] = 0.5 - 0.5*std::cos(x);
+        }
+        else if (window == WELCH_WINDOW_BLACKMAN_HARRIS) {
+            table[n] = 0.35875 - 0.48829*std::cos(x) + 0.14128*std::cos(2*x) - 0.01168*std::cos(3*x);
+        }
+        else if (window != WELCH_WINDOW_RECTANGULAR) {
+            throw std::runtime_error("Error: Unknown Welch window " + std::to_string(window) + "\n");
+        }
+    }
+
+    double meanSquare = 0;
+    for (double value : table) {
+        meanSquare += value*value;
+    }
+    meanSquare /= length;
+
+    double scale = 1/std::sqrt(meanSquare);
+    for (double& value : table) {
+        value *= scale;
+    }
+    return table;
+}
+
+
+
+/**
+ * @brief Writes one windowed segment ending in the current buffer.
+ *
+ * @param segment - segment from 0 to segmentsReady() - 1, oldest first. The last one is the current buffer itself
+ * @param output - receives samplesPerSegment() samples
+ */
+void WelchSegmenter::writeSegment(int segment, pipeline_complex* output) const {
+    // Samples before the current buffer, from the end of the previous one
+    U32 fromPrevious = havePrevious ? N - (U32)(segment + 1)*hop : 0;
+
+    // The conversion restarts its alternating signs with every buffer, which an odd buffer length breaks at the join
+    pipeline_real joinSign = (N % 2 == 1) ? -1 : 1;
+    for (U32 n = 0; n < fromPrevious; n++) {
+        const pipeline_real* sample = previous[N - fromPrevious + n];
+        output[n][0] = joinSign*windowValues[n]*sample[0];
+        output[n][1] = joinSign*windowValues[n]*sample[1];
+    }
+    for (U32 n = fromPrevious; n < N; n++) {
+        const pipeline_real* sample = current[n - fromPrevious];
+        output[n][0] = windowValues[n]*sample[0];
+        output[n][1] = windowValues[n]*sample[1];
+    }
+}
+
+
+
+/**
+ * @brief Makes the current buffer the previous one, once all of its segments are written.
+ *
+ */
+void WelchSegmenter::advance() {
+    std::swap(previous, current);
+    havePrevious = true;
+}
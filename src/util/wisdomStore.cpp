@@ -0,0 +1,137 @@
+/**
+ * @file wisdomStore.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the WisdomStore class. See include\utils\wisdomStore.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Creates a double precision plan for batchSize contiguous transforms of N samples (stride 1, distance N). Uses stored wisdom if
+ *        any exists at the requested rigor or above, and otherwise plans with flags and saves the new wisdom immediately.
+ *
+ * @param N - number of samples per transform
+ * @param batchSize - number of contiguous transforms per plan. 1 gives a plain fftw_plan_dft_1d equivalent
+ * @param flags - FFTW planner flags (FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT or FFTW_EXHAUSTIVE)
+ * @return fftw_plan
+ */
+fftw_plan WisdomStore::planDFT(int N, int batchSize, unsigned flags) {
+    batchSize = max(1, batchSize);
+
+    // Start from only this key's wisdom so the file saved below holds nothing else. Existing plans are unaffected
+    fftw_forget_wisdom();
+    for (unsigned level : levelsAtLeast(flags)) {
+        fftw_import_wisdom_from_filename(wisdomFilename(N, batchSize, false, level).c_str());
+    }
+
+    fftw_complex* input = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * batchSize * N));
+    fftw_complex* output = reinterpret_cast<fftw_complex*>(fftw_malloc(sizeof(fftw_complex) * batchSize * N));
+
+    fftw_plan plan = fftw_plan_many_dft(1, &N, batchSize, input, NULL, 1, N, output, NULL, 1, N, FFTW_FORWARD, flags | FFTW_WISDOM_ONLY);
+    if (plan == NULL) {
+        std::cout << "No stored wisdom for N = " << std::to_string(N) << " x " << std::to_string(batchSize) << ". Planning..." << std::endl;
+        plan = fftw_plan_many_dft(1, &N, batchSize, input, NULL, 1, N, output, NULL, 1, N, FFTW_FORWARD, flags);
+
+        std::filesystem::create_directories(directory);
+        if (fftw_export_wisdom_to_filename(wisdomFilename(N, batchSize, false, flags).c_str()) == 0) {
+            std::cout << "Failed to save FFTW wisdom to " << wisdomFilename(N, batchSize, false, flags) << std::endl;
+        }
+    }
+
+    fftw_free(input);
+    fftw_free(output);
+
+    if (plan == NULL) {
+        throw std::runtime_error("Error: FFTW failed to create a plan for N = " + std::to_string(N) + "\n");
+    }
+
+    return plan;
+}
+
+
+
+/**
+ * @brief Single precision version of planDFT, used by the SINGLE_PRECISION_PIPELINE build. Float wisdom is stored under its own keys.
+ *
+ * @param N - number of samples per transform
+ * @param batchSize - number of contiguous transforms per plan
+ * @param flags - FFTW planner flags
+ * @return fftwf_plan
+ */
+fftwf_plan WisdomStore::planDFTf(int N, int batchSize, unsigned flags) {
+    batchSize = max(1, batchSize);
+
+    fftwf_forget_wisdom();
+    for (unsigned level : levelsAtLeast(flags)) {
+        fftwf_import_wisdom_from_filename(wisdomFilename(N, batchSize, true, level).c_str());
+    }
+
+    fftwf_complex* input = reinterpret_cast<fftwf_complex*>(fftwf_malloc(sizeof(fftwf_complex) * batchSize * N));
+    fftwf_complex* output = reinterpret_cast<fftwf_complex*>(fftwf_malloc(sizeof(fftwf_complex) * batchSize * N));
+
+    fftwf_plan plan = fftwf_plan_many_dft(1, &N, batchSize, input, NULL, 1, N, output, NULL, 1, N, FFTW_FORWARD, flags | FFTW_WISDOM_ONLY);
+    if (plan == NULL) {
+        std::cout << "No stored single precision wisdom for N = " << std::to_string(N) << " x " << std::to_string(batchSize) << ". Planning..." << std::endl;
+        plan = fftwf_plan_many_dft(1, &N, batchSize, input, NULL, 1, N, output, NULL, 1, N, FFTW_FORWARD, flags);
+
+        std::filesystem::create_directories(directory);
+        if (fftwf_export_wisdom_to_filename(wisdomFilename(N, batchSize, true, flags).c_str()) == 0) {
+            std::cout << "Failed to save FFTW wisdom to " << wisdomFilename(N, batchSize, true, flags) << std::endl;
+        }
+    }
+
+    fftwf_free(input);
+    fftwf_free(output);
+
+    if (plan == NULL) {
+        throw std::runtime_error("Error: FFTW failed to create a single precision plan for N = " + std::to_string(N) + "\n");
+    }
+
+    return plan;
+}
+
+
+
+/**
+ * @brief Path of the wisdom file for one key, e.g. fftwWisdom/fftw_d_N320000_K4_T1_measure.wisdom
+ *
+ * @param N - number of samples per transform
+ * @param batchSize - number of contiguous transforms per plan
+ * @param singlePrecision - true for fftwf wisdom
+ * @param flags - FFTW planner flags. Only the rigor level is part of the key
+ * @return std::string
+ */
+std::string WisdomStore::wisdomFilename(int N, int batchSize, bool singlePrecision, unsigned flags) {
+    std::string level = "measure";
+    if (flags & FFTW_EXHAUSTIVE)     { level = "exhaustive"; }
+    else if (flags & FFTW_PATIENT)   { level = "patient"; }
+    else if (flags & FFTW_ESTIMATE)  { level = "estimate"; }
+
+    return directory + "/fftw_" + (singlePrecision ? "f" : "d") + "_N" + std::to_string(N) + "_K" + std::to_string(batchSize) 
+                     + "_T" + std::to_string(plannerThreads) + "_" + level + ".wisdom";
+}
+
+
+
+/**
+ * @brief Planner rigor levels whose wisdom can satisfy a request made with flags, least rigorous first.
+ *
+ * @param flags - FFTW planner flags of the request
+ * @return std::vector<unsigned>
+ */
+std::vector<unsigned> WisdomStore::levelsAtLeast(unsigned flags) {
+    std::vector<unsigned> levels = {FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT, FFTW_EXHAUSTIVE};
+
+    int start = 1;
+    if (flags & FFTW_EXHAUSTIVE)     { start = 3; }
+    else if (flags & FFTW_PATIENT)   { start = 2; }
+    else if (flags & FFTW_ESTIMATE)  { start = 0; }
+
+    return std::vector<unsigned>(levels.begin() + start, levels.end());
+}
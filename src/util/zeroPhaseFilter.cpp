@@ -0,0 +1,248 @@
+/**
+ * @file zeroPhaseFilter.cpp
+ * @author Kyle Quinlan (kyle.quinlan@colorado.edu)
+ * @brief Method definitions and documentation for the ZeroPhaseFilter class. See include\utils\zeroPhaseFilter.hpp for the class definition.
+ * @version 0.1
+ * @date 2023-11-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "decs.hpp"
+
+
+/**
+ * @brief Copies the second order sections of a designed cascade and computes their steady states.
+ *
+ * @param cascade - designed filter, e.g. a Dsp::ChebyshevII::LowPass after setup()
+ */
+void ZeroPhaseFilter::setSections(Dsp::Cascade& cascade) {
+    sections.clear();
+
+    double gain = 1;
+    for (int i = 0; i < cascade.getNumStages(); i++) {
+        const Dsp::Cascade::Stage& stage = cascade[i];
+
+        Section section;
+        section.b0 = stage.m_b0;
+        section.b1 = stage.m_b1;
+        section.b2 = stage.m_b2;
+        section.a1 = stage.m_a1;
+        section.a2 = stage.m_a2;
+
+        // Steady state of the transposed direct form II registers for a constant input, as in scipy's lfilter_zi
+        double B1 = section.b1 - section.a1*section.b0;
+        double B2 = section.b2 - section.a2*section.b0;
+        double zi1 = (B1 + B2)/(1 + section.a1 + section.a2);
+        section.zi1 = gain*zi1;
+        section.zi2 = gain*(B2 - section.a2*zi1);
+
+        gain *= (section.b0 + section.b1 + section.b2)/(1 + section.a1 + section.a2);
+        sections.push_back(section);
+    }
+
+    for (size_t s = 0; s < min(sections.size(), MAX_FIXED_SECTIONS); s++) {
+        coefficients[5*s + 0] = sections[s].b0;
+        coefficients[5*s + 1] = sections[s].b1;
+        coefficients[5*s + 2] = sections[s].b2;
+        coefficients[5*s + 3] = sections[s].a1;
+        coefficients[5*s + 4] = sections[s].a2;
+    }
+}
+
+
+
+/**
+ * @brief Filters a signal forward and backward in place. Signals of fewer than 2 samples are left unchanged.
+ *
+ * @param signal - signal to filter
+ */
+void ZeroPhaseFilter::apply(std::vector<double>& signal) const {
+    std::vector<double>* signals[1] = {&signal};
+    applyBatch(std::vector<std::vector<double>*>(signals, signals + 1));
+}
+
+
+
+/**
+ * @brief Filters several signals forward and backward in place, FILTER_SIMD_LANES at a time.
+ *
+ * @param signals - signals to filter, all of the same length
+ */
+void ZeroPhaseFilter::applyBatch(const std::vector<std::vector<double>*>& signals) const {
+    if (signals.empty() || sections.empty()) {
+        return;
+    }
+
+    size_t length = signals[0]->size();
+    for (std::vector<double>* signal : signals) {
+        if (signal->size() != length) {
+            throw std::runtime_error("Error: Signals filtered together must have the same length\n");
+        }
+    }
+    if (length < 2) {
+        return;
+    }
+
+    size_t pad = padLength(length);
+    size_t extendedLength = length + 2*pad;
+    std::vector<double> buffer(extendedLength*FILTER_SIMD_LANES);
+
+    for (size_t group = 0; group < signals.size(); group += FILTER_SIMD_LANES) {
+        size_t lanes = min((size_t)FILTER_SIMD_LANES, signals.size() - group);
+
+        // Interleave the odd extensions, 2*x[0] - x[pad - n] before and 2*x[end] - x[end - n] after the signal
+        for (size_t lane = 0; lane < lanes; lane++) {
+            const std::vector<double>& x = *signals[group + lane];
+            for (size_t n = 0; n < pad; n++) {
+                buffer[n*lanes + lane] = 2*x[0] - x[pad - n];
+                buffer[(pad + length + n)*lanes + lane] = 2*x[length - 1] - x[length - 2 - n];
+            }
+            for (size_t n = 0; n < length; n++) {
+                buffer[(pad + n)*lanes + lane] = x[n];
+            }
+        }
+
+        filterInterleaved(buffer.data(), extendedLength, lanes);
+
+        for (size_t lane = 0; lane < lanes; lane++) {
+            std::vector<double>& x = *signals[group + lane];
+            for (size_t n = 0; n < length; n++) {
+                x[n] = buffer[(pad + n)*lanes + lane];
+            }
+        }
+    }
+}
+
+
+
+/**
+ * @brief Extension at each end, 3 samples per filter order as in scipy's sosfiltfilt, shortened for signals shorter than that.
+ *
+ */
+size_t ZeroPhaseFilter::padLength(size_t length) const {
+    return min(3*(2*sections.size() + 1), length - 1);
+}
+
+
+
+/**
+ * @brief Runs the cascade forward and then backward over lanes interleaved signals. Each pass starts every section from its steady state
+ *        for the first sample of that pass.
+ *
+ * @param data - sample n of lane l at data[n*lanes + l]
+ * @param length - samples per lane
+ * @param lanes - number of interleaved signals, at most FILTER_SIMD_LANES
+ */
+void ZeroPhaseFilter::filterInterleaved(double* data, size_t length, size_t lanes) const {
+    if (fixedKernels) {
+        bool filtered = false;
+        switch (sections.size()) {
+            case 1: filtered = filterInterleavedFixed<1>(data, length, lanes); break;
+            case 2: filtered = filterInterleavedFixed<2>(data, length, lanes); break;
+            case 3: filtered = filterInterleavedFixed<3>(data, length, lanes); break;
+        }
+        if (filtered) {
+            return;
+        }
+    }
+
+    size_t numSections = sections.size();
+    std::vector<double> z1(numSections*FILTER_SIMD_LANES), z2(numSections*FILTER_SIMD_LANES);
+
+    for (int pass = 0; pass < 2; pass++) {
+        // The backward pass walks the forward output from its end
+        ptrdiff_t stride = (pass == 0) ? (ptrdiff_t)lanes : -(ptrdiff_t)lanes;
+        double* sample = (pass == 0) ? data : data + (length - 1)*lanes;
+
+        for (size_t s = 0; s < numSections; s++) {
+            for (size_t lane = 0; lane < lanes; lane++) {
+                z1[s*FILTER_SIMD_LANES + lane] = sections[s].zi1*sample[lane];
+                z2[s*FILTER_SIMD_LANES + lane] = sections[s].zi2*sample[lane];
+            }
+        }
+
+        for (size_t n = 0; n < length; n++, sample += stride) {
+            for (size_t s = 0; s < numSections; s++) {
+                const Section& section = sections[s];
+                double* state1 = z1.data() + s*FILTER_SIMD_LANES;
+                double* state2 = z2.data() + s*FILTER_SIMD_LANES;
+
+                // Transposed direct form II, one section of every lane at once
+                #pragma omp simd
+                for (size_t lane = 0; lane < lanes; lane++) {
+                    double x = sample[lane];
+                    double y = section.b0*x + state1[lane];
+                    state1[lane] = section.b1*x - section.a1*y + state2[lane];
+                    state2[lane] = section.b2*x - section.a2*y;
+                    sample[lane] = y;
+                }
+            }
+        }
+    }
+}
+
+
+
+/**
+ * @brief Picks the fixed kernel for the lane count of a cascade of NumSections sections.
+ *
+ * @return false - there is no fixed kernel for this lane count
+ */
+template <size_t NumSections>
+bool ZeroPhaseFilter::filterInterleavedFixed(double* data, size_t length, size_t lanes) const {
+    if (lanes == 1) {
+        filterInterleavedFixed<NumSections, 1>(data, length);
+        return true;
+    }
+    if (lanes == FILTER_SIMD_LANES) {
+        filterInterleavedFixed<NumSections, FILTER_SIMD_LANES>(data, length);
+        return true;
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief filterInterleaved for a cascade of exactly NumSections sections over Lanes lanes. Both counts are known at compile time, so the loops
+ *        are unrolled and the coefficients and state stay in registers instead of being reloaded through the section array for every sample.
+ *
+ */
+template <size_t NumSections, size_t Lanes>
+void ZeroPhaseFilter::filterInterleavedFixed(double* data, size_t length) const {
+    double c[5*NumSections];
+    for (size_t i = 0; i < 5*NumSections; i++) {
+        c[i] = coefficients[i];
+    }
+
+    alignas(64) double z1[NumSections][Lanes];
+    alignas(64) double z2[NumSections][Lanes];
+
+    for (int pass = 0; pass < 2; pass++) {
+        ptrdiff_t stride = (pass == 0) ? (ptrdiff_t)Lanes : -(ptrdiff_t)Lanes;
+        double* sample = (pass == 0) ? data : data + (length - 1)*Lanes;
+
+        for (size_t s = 0; s < NumSections; s++) {
+            for (size_t lane = 0; lane < Lanes; lane++) {
+                z1[s][lane] = sections[s].zi1*sample[lane];
+                z2[s][lane] = sections[s].zi2*sample[lane];
+            }
+        }
+
+        for (size_t n = 0; n < length; n++, sample += stride) {
+            #pragma omp simd
+            for (size_t lane = 0; lane < Lanes; lane++) {
+                double x = sample[lane];
+                for (size_t s = 0; s < NumSections; s++) {
+                    double y = c[5*s + 0]*x + z1[s][lane];
+                    z1[s][lane] = c[5*s + 1]*x - c[5*s + 3]*y + z2[s][lane];
+                    z2[s][lane] = c[5*s + 2]*x - c[5*s + 4]*y;
+                    x = y;
+                }
+                sample[lane] = x;
+            }
+        }
+    }
+}
@@ -11,7 +11,7 @@
 
 #include "decs.hpp"
 
-std::tuple<double, double> getVisibility(std::vector<double> fftPowerProbeOn, std::vector<double> fftPowerBackground, std::vector<double> probeFreqs, std::vector<double> freqAxis, double probeFreq, double yModeFreq);
+std::tuple<double, double> getVisibility(const std::vector<double>& fftPowerProbeOn, const std::vector<double>& fftPowerBackground, const std::vector<double>& probeFreqs, const std::vector<double>& freqAxis, double probeFreq, double yModeFreq);
 
 int main() {
     // Initialize scan runners
@@ -22,12 +22,15 @@ int main() {
     scanRunner.subSpectraAveragingNumber = subSpectraAveragingNumber;
 
 
-    // Probe parameters
-    PSG psgProbe(27);
-    psgProbe.setPow(-95);
+    // Probe parameters. The probe is the ScanRunner's PSG_PROBE, swept through a list
+    double probePower = -95; // dBm
+    double backgroundPower = -135; // dBm, the PSG's lowest output, stands in for the probe being off inside the list
 
     double probeSpan = 30; // MHz
     int numProbes = 100;
+    int settleSpectra = 1; // Spectra dropped at the start of every list point while the PSG settles
+    int interleaveCycles = 2; // On/off pairs per probe frequency, so slow gain drift cancels between the probe and its background
+    int spectraPerPoint = maxSpectra/interleaveCycles;
 
     double xModeFreq = 5.208; // GHz
 
@@ -39,56 +42,67 @@ int main() {
     }
     std::cout << std::endl;
 
-
-    // Acquire data
-    std::vector<double> visibility, trueProbeFreqs, freqAxis;
-    DataProcessor proc;
+    // The probe toggles between on and background at the same frequency interleaveCycles times per probe, so point 2*(n*interleaveCycles + c)
+    // is cycle c of probe n with the probe on and the next point is its background
+    std::vector<double> listFreqs, listPowers;
     for (double probe : probeFreqs) {
-        std::cout << std::endl
-          << "Taking data at " << std::fixed << std::setprecision(6) << probe
-          << " GHz, " << std::fixed << std::setprecision(2)
-          << (trueProbeFreqs.size() / static_cast<double>(numProbes)) * 100
-          << " % complete\r" << std::endl << std::endl;
-
-
-        psgProbe.setFreq(probe);
-        psgProbe.onOff(true);
-        scanRunner.acquireData();
-        std::vector<double> fftPowerProbeOn = averageVectors(scanRunner.retrieveRawData());
-        scanRunner.flushData();
-
-
-        psgProbe.onOff(false);
-        scanRunner.acquireData();
-        std::vector<double> fftPowerBackground = averageVectors(scanRunner.retrieveRawData());
-        freqAxis = scanRunner.retrieveRawAxis();
-        scanRunner.flushData();
-
-        std::cout << std::endl << "Saving data..." << std::endl;
-
+        for (int cycle = 0; cycle < interleaveCycles; cycle++) {
+            listFreqs.push_back(probe);
+            listPowers.push_back(probePower);
+            listFreqs.push_back(probe);
+            listPowers.push_back(backgroundPower);
+        }
+    }
 
-        std::string fileName = "../../../plotting/visMeasurement/visData/" + std::to_string(1e3*(probe - xModeFreq)) + ".csv";
-        saveVector(fftPowerProbeOn, fileName);
 
-        fileName = "../../../plotting/visMeasurement/visData/bg_" + std::to_string(1e3*(probe - xModeFreq)) + ".csv";
-        saveVector(fftPowerBackground, fileName);
+    // Acquire data, the whole curve in one list sweep
+    std::cout << std::endl << "Sweeping " << numProbes << " probe frequencies" << std::endl << std::endl;
+    std::vector<std::vector<double>> pointSpectra = scanRunner.acquireListSweep(PSG_PROBE, listFreqs, listPowers, spectraPerPoint, settleSpectra);
+    std::vector<double> freqAxis = scanRunner.retrieveRawAxis();
+    scanRunner.flushData();
+    printf("\n Acquisition complete!\n");
 
 
-        double vis, trueProbeFreq;
-        std::tie(vis, trueProbeFreq) = getVisibility(fftPowerProbeOn, fftPowerBackground, probeFreqs, freqAxis, probe, xModeFreq);
-        visibility.push_back(vis);
-        trueProbeFreqs.push_back(trueProbeFreq);
+    // The probes are independent, so their visibilities are computed on every hardware thread
+    std::vector<double> visibility(numProbes), trueProbeFreqs(numProbes);
+    std::atomic<int> nextProbe(0);
+    auto worker = [&]() {
+        for (int n = nextProbe++; n < numProbes; n = nextProbe++) {
+            double probe = probeFreqs[n];
+            std::vector<double> fftPowerProbeOn(freqAxis.size(), 0.0), fftPowerBackground(freqAxis.size(), 0.0);
+            for (int cycle = 0; cycle < interleaveCycles; cycle++) {
+                int point = 2*(n*interleaveCycles + cycle);
+                for (size_t i = 0; i < freqAxis.size(); i++) {
+                    fftPowerProbeOn[i] += pointSpectra[point][i]/interleaveCycles;
+                    fftPowerBackground[i] += pointSpectra[point + 1][i]/interleaveCycles;
+                }
+            }
+
+            std::string fileName = "../../../plotting/visMeasurement/visData/" + std::to_string(1e3*(probe - xModeFreq)) + ".csv";
+            saveVector(fftPowerProbeOn, fileName, OUTPUT_CSV);
+
+            fileName = "../../../plotting/visMeasurement/visData/bg_" + std::to_string(1e3*(probe - xModeFreq)) + ".csv";
+            saveVector(fftPowerBackground, fileName, OUTPUT_CSV);
+
+            std::tie(visibility[n], trueProbeFreqs[n]) = getVisibility(fftPowerProbeOn, fftPowerBackground, probeFreqs, freqAxis, probe, xModeFreq);
+        }
+    };
+
+    int numThreads = min(numProbes, max(1, (int)std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back(worker);
     }
-    printf("\n Acquisition complete!\n");
-
-    saveVector(visibility, "../../../src/dataProcessing/visCurve.csv");
-    saveVector(visibility, "../../../plotting/visMeasurement/visCurve.csv");
-    saveVector(trueProbeFreqs, "../../../src/dataProcessing/trueProbeFreqs.csv");
-    saveVector(trueProbeFreqs, "../../../plotting/visMeasurement/trueProbeFreqs.csv");
-    saveVector(freqAxis, "../../../plotting/visMeasurement/visFreq.csv");
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::cout << "Visibilities of " << numProbes << " probes computed on " << numThreads << " threads" << std::endl;
 
-    // Cleanup
-    psgProbe.onOff(false);
+    saveVector(visibility, "../../../src/dataProcessing/visCurve.csv", OUTPUT_CSV);
+    saveVector(visibility, "../../../plotting/visMeasurement/visCurve.csv", OUTPUT_CSV);
+    saveVector(trueProbeFreqs, "../../../src/dataProcessing/trueProbeFreqs.csv", OUTPUT_CSV);
+    saveVector(trueProbeFreqs, "../../../plotting/visMeasurement/trueProbeFreqs.csv", OUTPUT_CSV);
+    saveVector(freqAxis, "../../../plotting/visMeasurement/visFreq.csv", OUTPUT_CSV);
 
     _CrtDumpMemoryLeaks();
     return 0;
@@ -96,9 +110,7 @@ int main() {
 
 
 
-std::tuple<double, double> getVisibility(std::vector<double> fftPowerProbeOn, std::vector<double> fftPowerBackground, std::vector<double> probeFreqs, std::vector<double> freqAxis, double probeFreq, double yModeFreq) {
-    std::cout << std::endl << "Getting visibility for probe at " << probeFreq << " GHz" << std::endl;
-    
+std::tuple<double, double> getVisibility(const std::vector<double>& fftPowerProbeOn, const std::vector<double>& fftPowerBackground, const std::vector<double>& probeFreqs, const std::vector<double>& freqAxis, double probeFreq, double yModeFreq) {
     double probeSeparation = (probeFreqs[1] - probeFreqs[0])*1e9;   // GHz -> Hz
     double freqSeparation = (freqAxis[1] - freqAxis[0])*1e6;        // MHz -> Hz
 